@@ -11,20 +11,42 @@
 #include <stdbool.h>
 #include <string.h>
 
+#include <hwm-buffer.h>
+
+#include <push/basics.h>
+#include <push/talloc.h>
 #include <push/protobuf.h>
 
 #include <person.h>
 
 
+void
+person_init(person_t *person)
+{
+    memset(person, 0, sizeof(person_t));
+    hwm_buffer_init(&person->name);
+}
+
+
+void
+person_done(person_t *person)
+{
+    hwm_buffer_done(&person->name);
+}
+
+
 bool
-person_eq(person_t *person1, person_t *person2)
+person_eq(const person_t *person1, const person_t *person2)
 {
     if (person1 == person2)
         return true;
 
     return
         (person1->id == person2->id) &&
-        (strcmp(person1->name, person2->name) == 0) &&
+        (person1->name.current_size == person2->name.current_size) &&
+        (memcmp(hwm_buffer_mem(&person1->name, void),
+                hwm_buffer_mem(&person2->name, void),
+                person1->name.current_size) == 0) &&
         (person1->mother == person2->mother) &&
         (person1->father == person2->father) &&
         (person1->dob == person2->dob);
@@ -37,25 +59,48 @@ person_eq(person_t *person1, person_t *person2)
         goto error;                             \
     }
 
-push_protobuf_message_t *
-create_person_parser(person_t *person)
+push_callback_t *
+create_person_parser(const char *name,
+                     void *parent,
+                     push_parser_t *parser,
+                     person_t *person)
 {
-    push_protobuf_message_t  *result =
-        push_protobuf_message_new();
+    void  *context;
+    push_protobuf_field_map_t  *field_map;
+    push_callback_t  *callback;
 
-    if (result == NULL) goto error;
+    context = push_talloc_new(parent);
+    if (context == NULL) return NULL;
 
-    CHECK(push_protobuf_assign_uint32(result, 1, &person->id));
-    CHECK(push_protobuf_malloc_str(result, 2, &person->name));
-    CHECK(push_protobuf_assign_uint32(result, 3, &person->mother));
-    CHECK(push_protobuf_assign_uint32(result, 4, &person->father));
-    CHECK(push_protobuf_assign_uint64(result, 5, &person->dob));
+    if (name == NULL) name = "person";
 
-    return result;
+    field_map = push_protobuf_field_map_new(context);
+    if (field_map == NULL) goto error;
 
-  error:
-    if (result != NULL)
-        push_callback_free(&result->base);
+    CHECK(push_protobuf_assign_uint32(name, "id", context, parser,
+                                      field_map, 1, &person->id));
+    CHECK(push_protobuf_add_hwm_string(name, "name", context, parser,
+                                       field_map, 2, &person->name));
+    CHECK(push_protobuf_assign_uint32(name, "mother", context, parser,
+                                      field_map, 3, &person->mother));
+    CHECK(push_protobuf_assign_uint32(name, "father", context, parser,
+                                      field_map, 4, &person->father));
+    CHECK(push_protobuf_assign_uint64(name, "dob", context, parser,
+                                      field_map, 5, &person->dob));
+
+    /*
+     * The id and name fields are required in person.proto.
+     */
+
+    CHECK(push_protobuf_field_map_require_field(field_map, 1));
+    CHECK(push_protobuf_field_map_require_field(field_map, 2));
 
+    callback = push_protobuf_message_new(name, context, parser, field_map);
+
+    if (callback == NULL) goto error;
+    return callback;
+
+  error:
+    push_talloc_free(context);
     return NULL;
 }
@@ -14,7 +14,9 @@
 #include <stdbool.h>
 #include <stdint.h>
 
-#include <push/protobuf.h>
+#include <hwm-buffer.h>
+
+#include <push/basics.h>
 
 typedef uint32_t  person_id_t;
 typedef uint64_t  date_t;
@@ -22,24 +24,39 @@ typedef uint64_t  date_t;
 typedef struct _person
 {
     person_id_t  id;
-    char  *name;
+    hwm_buffer_t  name;
     person_id_t  mother;
     person_id_t  father;
     date_t  dob;
 } person_t;
 
 
+void
+person_init(person_t *person);
+
+
+void
+person_done(person_t *person);
+
+
 bool
-person_eq(person_t *person1, person_t *person2);
+person_eq(const person_t *person1, const person_t *person2);
 
 
 /**
  * Create a protobuf message parser that reads a Person message into
  * the given person_t object.
+ *
+ * This builds the parser by hand from the runtime field map helpers.
+ * The push-protoc tool can generate an equivalent (and faster)
+ * parser directly from person.proto.
  */
 
-push_protobuf_message_t *
-create_person_parser(person_t *person);
+push_callback_t *
+create_person_parser(const char *name,
+                     void *parent,
+                     push_parser_t *parser,
+                     person_t *person);
 
 
 #endif  /* PUSH_PROTOBUF_EXAMPLE_PERSON_H */
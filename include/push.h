@@ -13,6 +13,7 @@
 
 #include <push/basics.h>
 #include <push/combinators.h>
+#include <push/intern.h>
 #include <push/pairs.h>
 #include <push/pure.h>
 #include <push/primitives.h>
@@ -391,6 +391,41 @@ _push_callback_init
  push_set_error_func_t *set_error_func);
 
 
+/**
+ * Limits on the input that a parser will accept, so that the CPU and
+ * memory needed to parse a message from an untrusted source are
+ * bounded.  A limit of 0 means that there is no limit.  When a limit
+ * is exceeded, the parse fails with PUSH_LIMIT_ERROR.
+ */
+
+typedef struct _push_parser_limits
+{
+    /**
+     * How deeply length-prefixed values (such as Protocol Buffer
+     * submessages) can be nested.
+     */
+
+    size_t  max_depth;
+
+    /**
+     * The largest length-prefixed value that we'll read.  This is
+     * checked against the length prefix before any of the value is
+     * read.  A top-level message has no length prefix, so its size is
+     * only limited by how much data is submitted to the parser.
+     */
+
+    size_t  max_message_bytes;
+
+    /**
+     * The most fields that we'll read in a message, including the
+     * fields of any submessages.
+     */
+
+    size_t  max_field_count;
+
+} push_parser_limits_t;
+
+
 /**
  * @brief A push parser.
  */
@@ -462,6 +497,32 @@ struct _push_parser
 
     push_continue_continuation_t  ignore;
 
+    /**
+     * The parser's limits.
+     */
+
+    push_parser_limits_t  limits;
+
+    /**
+     * How deeply nested the current value is.  Use
+     * push_parser_enter_value and push_parser_leave_value to update
+     * this.
+     *
+     * @private
+     */
+
+    size_t  depth;
+
+    /**
+     * The number of fields that have been read in the current
+     * message.  Use push_parser_count_field and
+     * push_parser_reset_field_count to update this.
+     *
+     * @private
+     */
+
+    size_t  field_count;
+
 };
 
 
@@ -483,6 +544,78 @@ void
 push_parser_free(push_parser_t *parser);
 
 
+/**
+ * Set the limits on the input that a parser will accept.  These
+ * apply from the next time the parser is activated.
+ */
+
+void
+push_parser_set_limits(push_parser_t *parser,
+                       const push_parser_limits_t *limits);
+
+
+/**
+ * Check whether a value of the given size, nested extra_depth levels
+ * below the value that's currently being parsed, would exceed the
+ * parser's max_depth or max_message_bytes limits.  A size of 0 never
+ * exceeds max_message_bytes, so use that for values that don't have
+ * a length prefix.
+ *
+ * @return NULL if it wouldn't, or an error message if it would.
+ */
+
+const char *
+push_parser_check_value(const push_parser_t *parser,
+                        size_t size,
+                        size_t extra_depth);
+
+
+/**
+ * Enter a nested value (such as a Protocol Buffer submessage or
+ * group) of the given size, if it doesn't exceed the parser's limits;
+ * see push_parser_check_value.  Each successful call must be paired
+ * with a call to push_parser_leave_value, once the value has been
+ * parsed or has failed to parse.
+ *
+ * @return NULL if the value was entered, or an error message if it
+ * exceeds the parser's limits.
+ */
+
+const char *
+push_parser_enter_value(push_parser_t *parser, size_t size);
+
+
+/**
+ * Leave the nested value that was most recently entered with
+ * push_parser_enter_value.
+ */
+
+void
+push_parser_leave_value(push_parser_t *parser);
+
+
+/**
+ * Count one more field in the current message.
+ *
+ * @return <code>false</code> if the parser's field count limit has
+ * been exceeded.
+ */
+
+bool
+push_parser_count_field(push_parser_t *parser);
+
+
+/**
+ * Start counting fields towards the parser's field count limit from
+ * scratch.  This happens automatically when the parser is activated;
+ * a callback that parses a stream of separate messages can call this
+ * before each one.
+ */
+
+void
+push_parser_reset_field_count(push_parser_t *parser);
+
+
 /**
  * Set the top-level callback for a parser.
  *
@@ -43,14 +43,11 @@ push_compose_new(const char *name,
 /**
  * Create a new callback that calls another callback repeatedly.  The
  * input of each iteration of the wrapped callback is passed as input
- * into the next iteration.  We terminate the loop when the wrapped
- * callback generates a parse failure; whatever result we had
- * accumulated to that point is then returned as the result of the
- * fold callback.  Note, however, that the wrapped callback must
- * generate the parse error <i>immediately</i>; if it partially parses
- * the data, and then discovers the parse error in a later call, we
- * cannot backtrack the data.  This case generates a parse error for
- * the fold.
+ * into the next iteration.  We terminate the loop when we reach EOF
+ * in between iterations — that is, before the next iteration has
+ * seen any data; whatever result we had accumulated to that point is
+ * then returned as the result of the fold callback.  Any error from
+ * the wrapped callback is an error for the fold, too.
  */
 
 push_callback_t *
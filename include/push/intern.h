@@ -0,0 +1,98 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2010, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the LICENSE.txt file in this distribution for license
+ * details.
+ * ----------------------------------------------------------------------
+ */
+
+#ifndef PUSH_INTERN_H
+#define PUSH_INTERN_H
+
+#include <stdlib.h>
+
+#include <hwm-buffer.h>
+
+#include <push/basics.h>
+
+/**
+ * @file
+ *
+ * This file defines a size-bounded string interning table, and a
+ * parser callback that reads strings into it.  Repeated values cost a
+ * hash and a comparison instead of a fresh allocation.
+ */
+
+
+/**
+ * A table of interned strings.  Each distinct value is copied into
+ * the table once; every later lookup of the same value returns the
+ * same canonical pointer.  The table holds at most a fixed number of
+ * distinct values.  The canonical strings are owned by the table, and
+ * remain valid until the table is freed.
+ */
+
+typedef struct _push_intern_table  push_intern_table_t;
+
+
+/**
+ * Create a new interning table that can hold up to max_entries
+ * distinct strings.  The table (and every string it holds) is a
+ * talloc child of parent; passing in a push_parser_t gives you a
+ * per-parser table.
+ *
+ * @return <code>NULL</code> if max_entries is 0, or too large for the
+ * table's slots to be allocated.
+ */
+
+push_intern_table_t *
+push_intern_table_new(void *parent, size_t max_entries);
+
+
+/**
+ * Look up a string in an interning table, adding it if it's not
+ * already there.  The canonical copy is always NUL-terminated.
+ *
+ * @return the canonical pointer for this value, or
+ * <code>NULL</code> if the value isn't in the table and the table is
+ * full.
+ */
+
+const char *
+push_intern_table_lookup(push_intern_table_t *table,
+                         const void *buf,
+                         size_t size);
+
+
+/**
+ * Return the number of distinct strings in an interning table.
+ */
+
+size_t
+push_intern_table_size(push_intern_table_t *table);
+
+
+/**
+ * Create a new callback that reads a string and interns it.  Like
+ * push_hwm_string_new, this callback takes in a pointer to a size_t
+ * as input, and uses that as the length of the string.  The callback's
+ * result will be the canonical, NUL-terminated copy of the string
+ * from the interning table.
+ *
+ * If the table is full and the string isn't already in it, the string
+ * is copied into the HWM buffer instead, and the result points into
+ * the buffer.  That pointer is only valid until the callback is next
+ * activated.
+ */
+
+push_callback_t *
+push_interned_string_new(const char *name,
+                         void *parent,
+                         push_parser_t *parser,
+                         hwm_buffer_t *buf,
+                         push_intern_table_t *table);
+
+
+#endif  /* PUSH_INTERN_H */
@@ -19,11 +19,48 @@
  * callbacks.
  */
 
+#include <stdbool.h>
+
 #include <hwm-buffer.h>
 
 #include <push/basics.h>
 
 
+/**
+ * A string result that might point directly into a data chunk, or
+ * into a buffer that the string was copied into.
+ */
+
+typedef struct _push_string_view
+{
+    /**
+     * A pointer to the string's contents.
+     */
+
+    const void  *buf;
+
+    /**
+     * The length of the string.  This doesn't include any NUL
+     * terminator.
+     */
+
+    size_t  size;
+
+    /**
+     * Whether the string had to be copied.  If this is
+     * <code>false</code>, buf points directly into the data chunk
+     * that contained the string, and is only valid for as long as
+     * the caller keeps that chunk around; there won't be a NUL
+     * terminator.  If this is <code>true</code>, the string straddled
+     * two or more chunks, and buf points into an HWM buffer, which
+     * will be NUL-terminated.
+     */
+
+    bool  copied;
+
+} push_string_view_t;
+
+
 /**
  * Create a new callback that requires the end of the stream.  If any
  * data is present, it results in a parse error.
@@ -68,6 +105,23 @@ push_hwm_string_new(const char *name,
                     hwm_buffer_t *buf);
 
 
+/**
+ * Create a new callback that reads a string, just like
+ * push_hwm_string_new, but that avoids copying the string if
+ * possible.  The callback's result will be a pointer to a
+ * push_string_view_t.  If the string is entirely contained in the
+ * current data chunk, the view will point directly into the chunk.
+ * Only if the string straddles chunks will it be copied into the HWM
+ * buffer.
+ */
+
+push_callback_t *
+push_hwm_string_view_new(const char *name,
+                         void *parent,
+                         push_parser_t *parser,
+                         hwm_buffer_t *buf);
+
+
 /**
  * Create a new callback that does nothing.  It parses no data, and
  * copies its input to its output.
@@ -79,6 +133,40 @@ push_noop_new(const char *name,
               push_parser_t *parser);
 
 
+/**
+ * A function that receives each piece of a string as it arrives.
+ * The pieces are only valid for the duration of the call.  Every
+ * piece of the string has a nonzero size; once the whole string has
+ * arrived, the function is called one last time with a size of 0 to
+ * mark the end of the string.  (So an empty string is passed in as a
+ * single zero-length call.)  Return <code>false</code> to abort the
+ * parse with PUSH_PARSE_ERROR.
+ */
+
+typedef bool
+push_string_sink_func_t(void *user_data,
+                        const void *buf,
+                        size_t size);
+
+
+/**
+ * Create a new callback that streams a string to a sink function,
+ * without buffering it.  Like push_hwm_string_new, this callback
+ * takes in a pointer to a size_t as input, and uses that as the
+ * length of the string.  Each piece of the string is passed to the
+ * sink function as soon as it arrives, so we never hold on to more
+ * than the current data chunk.  The callback's result will be a
+ * pointer to the length of the string, as a size_t.
+ */
+
+push_callback_t *
+push_string_sink_new(const char *name,
+                     void *parent,
+                     push_parser_t *parser,
+                     push_string_sink_func_t *sink,
+                     void *sink_user_data);
+
+
 /**
  * Create a new callback that skips the specified number of bytes.
  * The callback's input should be a pointer to a size_t, indicating
@@ -20,10 +20,19 @@
 
 
 #include <push/protobuf/basics.h>
+#include <push/protobuf/columns.h>
 #include <push/protobuf/combinators.h>
+#include <push/protobuf/dynamic.h>
+#include <push/protobuf/encoder.h>
 #include <push/protobuf/field-map.h>
+#include <push/protobuf/field-stats.h>
+#include <push/protobuf/json.h>
+#include <push/protobuf/lazy.h>
+#include <push/protobuf/map.h>
 #include <push/protobuf/message.h>
 #include <push/protobuf/primitives.h>
+#include <push/protobuf/repeated.h>
+#include <push/protobuf/unknown.h>
 
 
 #endif  /* PUSH_PROTOBUF_H */
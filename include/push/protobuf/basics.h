@@ -87,7 +87,7 @@ typedef enum _push_protobuf_tag_type
  */
 
 #define PUSH_PROTOBUF_ZIGZAG_ENCODE32(n)        \
-    (((n) << 1) ^ ((n) >> 31))
+    (((uint32_t) (n) << 1) ^ (uint32_t) ((n) >> 31))
 
 
 /**
@@ -106,7 +106,7 @@ typedef enum _push_protobuf_tag_type
  */
 
 #define PUSH_PROTOBUF_ZIGZAG_ENCODE64(n)        \
-    (((n) << 1) ^ ((n) >> 63))
+    (((uint64_t) (n) << 1) ^ (uint64_t) ((n) >> 63))
 
 
 /**
@@ -0,0 +1,374 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2010, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the LICENSE.txt file in this distribution for license
+ * details.
+ * ----------------------------------------------------------------------
+ */
+
+#ifndef PUSH_PROTOBUF_COLUMNS_H
+#define PUSH_PROTOBUF_COLUMNS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <push/basics.h>
+#include <push/protobuf/basics.h>
+#include <push/protobuf/field-map.h>
+
+/**
+ * @file
+ *
+ * This file defines field map helpers that decode a stream of
+ * messages in columnar (struct-of-arrays) form.  Rather than
+ * assigning each field into a struct, and copying each struct into a
+ * batch, each field is appended directly to a column: a contiguous
+ * array with one element per message.  String and bytes columns use
+ * an offsets-plus-data layout: the value for row i is the bytes from
+ * offsets[i] to offsets[i+1] of a single data buffer.  Each column
+ * also has a validity bitmap, which records which messages contained
+ * the field; the element for a message that doesn't contain the
+ * field is zero (or empty).  Bit i of the bitmap is bit (i % 8) of
+ * byte (i / 8), which is the layout Apache Arrow uses.
+ *
+ * A push_protobuf_columns_t holds a set of columns that share the
+ * same rows.  Each message's row is finished by calling
+ * push_protobuf_columns_end_row; the easiest way to do that is to
+ * pass push_protobuf_columns_sink as the sink of a message stream
+ * callback, with a NULL element.  Like the other field map helpers,
+ * columns are never cleared while parsing; call
+ * push_protobuf_columns_clear once you've consumed the rows.
+ * Clearing keeps the columns' memory around, so once they have grown
+ * to fit a typical batch, parsing doesn't allocate.
+ *
+ * If a field appears more than once in a message, the last value
+ * wins, as with the assign helpers.
+ */
+
+
+/**
+ * The element type of a column.
+ */
+
+typedef enum _push_protobuf_column_type
+{
+    /**
+     * <code>int32</code>, <code>sint32</code>, and
+     * <code>sfixed32</code> fields, stored as <code>int32_t</code>.
+     */
+
+    PUSH_PROTOBUF_COLUMN_INT32,
+
+    /**
+     * <code>int64</code>, <code>sint64</code>, and
+     * <code>sfixed64</code> fields, stored as <code>int64_t</code>.
+     */
+
+    PUSH_PROTOBUF_COLUMN_INT64,
+
+    /**
+     * <code>uint32</code> and <code>fixed32</code> fields, stored as
+     * <code>uint32_t</code>.
+     */
+
+    PUSH_PROTOBUF_COLUMN_UINT32,
+
+    /**
+     * <code>uint64</code> and <code>fixed64</code> fields, stored as
+     * <code>uint64_t</code>.
+     */
+
+    PUSH_PROTOBUF_COLUMN_UINT64,
+
+    /**
+     * <code>float</code> fields, stored as <code>float</code>.
+     */
+
+    PUSH_PROTOBUF_COLUMN_FLOAT,
+
+    /**
+     * <code>double</code> fields, stored as <code>double</code>.
+     */
+
+    PUSH_PROTOBUF_COLUMN_DOUBLE,
+
+    /**
+     * <code>bool</code> fields, stored as a <code>uint8_t</code> that
+     * is 0 or 1.
+     */
+
+    PUSH_PROTOBUF_COLUMN_BOOL,
+
+    /**
+     * <code>string</code> and <code>bytes</code> fields, stored as
+     * <code>uint64_t</code> offsets into a data buffer.
+     */
+
+    PUSH_PROTOBUF_COLUMN_STRING
+
+} push_protobuf_column_type_t;
+
+
+/**
+ * A set of columns that share the same rows.
+ */
+
+typedef struct _push_protobuf_columns  push_protobuf_columns_t;
+
+
+/**
+ * A single column.  Columns are owned by their
+ * push_protobuf_columns_t.
+ */
+
+typedef struct _push_protobuf_column  push_protobuf_column_t;
+
+
+/**
+ * Create a new, empty set of columns.
+ */
+
+push_protobuf_columns_t *
+push_protobuf_columns_new(void *parent);
+
+
+/**
+ * Remove all of the rows from a set of columns, keeping their memory
+ * around for the next batch.
+ */
+
+void
+push_protobuf_columns_clear(push_protobuf_columns_t *columns);
+
+
+/**
+ * Finish the current row.  Any column that didn't receive a value
+ * since the previous row was finished gets a null.
+ *
+ * @return <code>false</code> if we can't allocate the memory.
+ */
+
+bool
+push_protobuf_columns_end_row(push_protobuf_columns_t *columns);
+
+
+/**
+ * A push_protobuf_message_sink_func_t that finishes a row for each
+ * message.  The user data should be the push_protobuf_columns_t.
+ * Use this with a message stream whose element is NULL, so that the
+ * sink is called once per message, before the next message's fields
+ * are parsed.
+ */
+
+bool
+push_protobuf_columns_sink(void *user_data,
+                           void *messages,
+                           size_t count);
+
+
+/**
+ * Return the number of finished rows in a set of columns.
+ */
+
+size_t
+push_protobuf_columns_row_count(const push_protobuf_columns_t *columns);
+
+
+/**
+ * Return the element type of a column.
+ */
+
+push_protobuf_column_type_t
+push_protobuf_column_type(const push_protobuf_column_t *column);
+
+
+/**
+ * Return a column's elements, as an array of the column's element
+ * type, with one element for each finished row.  For a string
+ * column, this is an array of <code>uint64_t</code> offsets, with one
+ * more element than there are rows.  The pointer is only valid until
+ * the next row is added.
+ */
+
+const void *
+push_protobuf_column_values(const push_protobuf_column_t *column);
+
+
+/**
+ * Return the data buffer of a string column, which the offsets point
+ * into.  Returns NULL for other columns.
+ */
+
+const uint8_t *
+push_protobuf_column_data(const push_protobuf_column_t *column);
+
+
+/**
+ * Return a column's validity bitmap.  Bit i is set if row i contained
+ * the column's field.
+ */
+
+const uint8_t *
+push_protobuf_column_validity(const push_protobuf_column_t *column);
+
+
+/**
+ * Return the number of finished rows that didn't contain the
+ * column's field.
+ */
+
+size_t
+push_protobuf_column_null_count(const push_protobuf_column_t *column);
+
+
+/**
+ * Return whether a finished row contained the column's field.
+ */
+
+bool
+push_protobuf_column_is_valid(const push_protobuf_column_t *column,
+                              size_t row);
+
+
+/**
+ * Add a new column for a field to a field map.  When parsing, the
+ * field's value is stored into the current row of a column in
+ * columns.  There's one of these for each scalar field type, plus
+ * push_protobuf_add_string_column for <code>string</code> and
+ * <code>bytes</code> fields.
+ *
+ * @return the new column, or <code>NULL</code> if we cannot add the
+ * new field.
+ */
+
+push_protobuf_column_t *
+push_protobuf_add_int32_column(const char *message_name,
+                               const char *field_name,
+                               void *parent,
+                               push_parser_t *parser,
+                               push_protobuf_field_map_t *field_map,
+                               push_protobuf_tag_number_t field_number,
+                               push_protobuf_columns_t *columns);
+
+push_protobuf_column_t *
+push_protobuf_add_int64_column(const char *message_name,
+                               const char *field_name,
+                               void *parent,
+                               push_parser_t *parser,
+                               push_protobuf_field_map_t *field_map,
+                               push_protobuf_tag_number_t field_number,
+                               push_protobuf_columns_t *columns);
+
+push_protobuf_column_t *
+push_protobuf_add_uint32_column(const char *message_name,
+                                const char *field_name,
+                                void *parent,
+                                push_parser_t *parser,
+                                push_protobuf_field_map_t *field_map,
+                                push_protobuf_tag_number_t field_number,
+                                push_protobuf_columns_t *columns);
+
+push_protobuf_column_t *
+push_protobuf_add_uint64_column(const char *message_name,
+                                const char *field_name,
+                                void *parent,
+                                push_parser_t *parser,
+                                push_protobuf_field_map_t *field_map,
+                                push_protobuf_tag_number_t field_number,
+                                push_protobuf_columns_t *columns);
+
+push_protobuf_column_t *
+push_protobuf_add_sint32_column(const char *message_name,
+                                const char *field_name,
+                                void *parent,
+                                push_parser_t *parser,
+                                push_protobuf_field_map_t *field_map,
+                                push_protobuf_tag_number_t field_number,
+                                push_protobuf_columns_t *columns);
+
+push_protobuf_column_t *
+push_protobuf_add_sint64_column(const char *message_name,
+                                const char *field_name,
+                                void *parent,
+                                push_parser_t *parser,
+                                push_protobuf_field_map_t *field_map,
+                                push_protobuf_tag_number_t field_number,
+                                push_protobuf_columns_t *columns);
+
+push_protobuf_column_t *
+push_protobuf_add_fixed32_column(const char *message_name,
+                                 const char *field_name,
+                                 void *parent,
+                                 push_parser_t *parser,
+                                 push_protobuf_field_map_t *field_map,
+                                 push_protobuf_tag_number_t field_number,
+                                 push_protobuf_columns_t *columns);
+
+push_protobuf_column_t *
+push_protobuf_add_fixed64_column(const char *message_name,
+                                 const char *field_name,
+                                 void *parent,
+                                 push_parser_t *parser,
+                                 push_protobuf_field_map_t *field_map,
+                                 push_protobuf_tag_number_t field_number,
+                                 push_protobuf_columns_t *columns);
+
+push_protobuf_column_t *
+push_protobuf_add_sfixed32_column(const char *message_name,
+                                  const char *field_name,
+                                  void *parent,
+                                  push_parser_t *parser,
+                                  push_protobuf_field_map_t *field_map,
+                                  push_protobuf_tag_number_t field_number,
+                                  push_protobuf_columns_t *columns);
+
+push_protobuf_column_t *
+push_protobuf_add_sfixed64_column(const char *message_name,
+                                  const char *field_name,
+                                  void *parent,
+                                  push_parser_t *parser,
+                                  push_protobuf_field_map_t *field_map,
+                                  push_protobuf_tag_number_t field_number,
+                                  push_protobuf_columns_t *columns);
+
+push_protobuf_column_t *
+push_protobuf_add_float_column(const char *message_name,
+                               const char *field_name,
+                               void *parent,
+                               push_parser_t *parser,
+                               push_protobuf_field_map_t *field_map,
+                               push_protobuf_tag_number_t field_number,
+                               push_protobuf_columns_t *columns);
+
+push_protobuf_column_t *
+push_protobuf_add_double_column(const char *message_name,
+                                const char *field_name,
+                                void *parent,
+                                push_parser_t *parser,
+                                push_protobuf_field_map_t *field_map,
+                                push_protobuf_tag_number_t field_number,
+                                push_protobuf_columns_t *columns);
+
+push_protobuf_column_t *
+push_protobuf_add_bool_column(const char *message_name,
+                              const char *field_name,
+                              void *parent,
+                              push_parser_t *parser,
+                              push_protobuf_field_map_t *field_map,
+                              push_protobuf_tag_number_t field_number,
+                              push_protobuf_columns_t *columns);
+
+push_protobuf_column_t *
+push_protobuf_add_string_column(const char *message_name,
+                                const char *field_name,
+                                void *parent,
+                                push_parser_t *parser,
+                                push_protobuf_field_map_t *field_map,
+                                push_protobuf_tag_number_t field_number,
+                                push_protobuf_columns_t *columns);
+
+
+#endif  /* PUSH_PROTOBUF_COLUMNS_H */
@@ -11,6 +11,9 @@
 #ifndef PUSH_PROTOBUF_COMBINATORS_H
 #define PUSH_PROTOBUF_COMBINATORS_H
 
+#include <stdbool.h>
+#include <stdlib.h>
+
 #include <push/basics.h>
 
 
@@ -20,6 +23,11 @@
  * callback.  This works just like the push_dynamic_max_bytes_new
  * combinator, except that the threshold is read in as a
  * varint-encoded integer from the parse stream.
+ *
+ * This is where the parser's max_depth and max_message_bytes limits
+ * are enforced: the callback fails with PUSH_PARSE_ERROR if the
+ * prefix is larger than max_message_bytes, or if it would be nested
+ * more than max_depth deep.
  */
 
 push_callback_t *
@@ -29,4 +37,55 @@ push_protobuf_varint_prefixed_new(const char *name,
                                   push_callback_t *wrapped);
 
 
+/**
+ * A function that receives the messages read by a message stream
+ * callback.  The messages are only valid for the duration of the
+ * call.  Return <code>false</code> to abort the parse with
+ * PUSH_PARSE_ERROR.
+ */
+
+typedef bool
+push_protobuf_message_sink_func_t(void *user_data,
+                                  void *messages,
+                                  size_t count);
+
+
+/**
+ * Create a new callback that reads a stream of varint-prefixed
+ * messages, such as the ones written by the
+ * <code>writeDelimitedTo</code> method of the C++ and Java protobuf
+ * libraries.  Each message is parsed by the message callback, which
+ * should store its values into element, a struct of element_size
+ * bytes.  The element is cleared to all zeroes before each message is
+ * parsed; afterwards, it's copied into a batch.  Once there are
+ * batch_size messages in the batch, the batch is passed to the sink
+ * function as an array of elements, and then reused for the next
+ * batch.  Any partial batch is passed to the sink at EOF.  This lets
+ * a stream of any length be parsed in constant memory.
+ *
+ * If element is NULL, the message callback's result is passed to the
+ * sink after each message, and batch_size is ignored.
+ *
+ * Unlike wrapping push_protobuf_varint_prefixed_new in push_fold_new,
+ * EOF is detected directly at each message boundary, rather than by
+ * activating the message callback and waiting for it to fail.  EOF
+ * in the middle of a message is a parse error.  The callback's input
+ * is passed into each activation of the message callback, and its
+ * result is a pointer to the number of messages read, as a size_t.
+ * The parser's max_field_count limit applies to each message
+ * separately.
+ */
+
+push_callback_t *
+push_protobuf_message_stream_new(const char *name,
+                                 void *parent,
+                                 push_parser_t *parser,
+                                 push_callback_t *message,
+                                 void *element,
+                                 size_t element_size,
+                                 size_t batch_size,
+                                 push_protobuf_message_sink_func_t *sink,
+                                 void *sink_user_data);
+
+
 #endif  /* PUSH_PROTOBUF_COMBINATORS_H */
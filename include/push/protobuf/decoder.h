@@ -0,0 +1,350 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2010, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the LICENSE.txt file in this distribution for license
+ * details.
+ * ----------------------------------------------------------------------
+ */
+
+#ifndef PUSH_PROTOBUF_DECODER_H
+#define PUSH_PROTOBUF_DECODER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <push/protobuf/basics.h>
+#include <push/protobuf/varint.h>
+
+/**
+ * @file
+ *
+ * This file defines the shared state machine used by the message
+ * decoders that <code>push-protoc</code> generates from a
+ * <code>.proto</code> file.  Each generated decoder is a single
+ * callback that reads an entire message; it dispatches on field tags
+ * with a <code>switch</code> statement, and stores values directly
+ * into a C struct.  The helpers in this file take care of the parts
+ * that don't depend on the message type: reading varints and
+ * fixed-width values that might be split across chunks, and skipping
+ * unknown fields.
+ *
+ * Everything here is <code>static inline</code>, so that the
+ * compiler can fold it into each generated decoder.
+ */
+
+
+/**
+ * The states of a generated decoder.
+ */
+
+typedef enum _push_protobuf_decoder_state
+{
+    /**
+     * Reading a field tag.
+     */
+
+    PUSH_PROTOBUF_DECODER_TAG,
+
+    /**
+     * Reading a varint value.
+     */
+
+    PUSH_PROTOBUF_DECODER_VARINT,
+
+    /**
+     * Reading a FIXED32 value.
+     */
+
+    PUSH_PROTOBUF_DECODER_FIXED32,
+
+    /**
+     * Reading a FIXED64 value.
+     */
+
+    PUSH_PROTOBUF_DECODER_FIXED64,
+
+    /**
+     * Reading the length of a length-delimited value.
+     */
+
+    PUSH_PROTOBUF_DECODER_LENGTH,
+
+    /**
+     * Reading the contents of a string or bytes value.
+     */
+
+    PUSH_PROTOBUF_DECODER_BYTES,
+
+    /**
+     * Reading the varints of a packed repeated field.
+     */
+
+    PUSH_PROTOBUF_DECODER_PACKED_VARINT,
+
+    /**
+     * Reading the FIXED32 values of a packed repeated field.
+     */
+
+    PUSH_PROTOBUF_DECODER_PACKED_FIXED32,
+
+    /**
+     * Reading the FIXED64 values of a packed repeated field.
+     */
+
+    PUSH_PROTOBUF_DECODER_PACKED_FIXED64,
+
+    /**
+     * A submessage callback is reading an embedded message.
+     */
+
+    PUSH_PROTOBUF_DECODER_SUBMESSAGE
+
+} push_protobuf_decoder_state_t;
+
+
+/**
+ * The state of a generated decoder.
+ */
+
+typedef struct _push_protobuf_decoder
+{
+    /**
+     * The current state.
+     */
+
+    push_protobuf_decoder_state_t  state;
+
+    /**
+     * The number of the field whose value we're reading.  This is 0
+     * if we're skipping an unknown field.
+     */
+
+    push_protobuf_tag_number_t  field;
+
+    /**
+     * The tag, length, or value that we're currently reading.
+     */
+
+    uint64_t  value;
+
+    /**
+     * The number of bytes of the current varint or fixed-width value
+     * that we've read from earlier chunks.  This is 0 between
+     * values.
+     */
+
+    size_t  size;
+
+    /**
+     * The number of bytes left in the current length-delimited
+     * value.
+     */
+
+    uint64_t  bytes_left;
+
+    /**
+     * The number of unknown groups that we're currently skipping.
+     */
+
+    size_t  depth;
+
+} push_protobuf_decoder_t;
+
+
+/**
+ * Reset a decoder so that it's ready to read the first field of a
+ * new message.
+ */
+
+static inline void
+push_protobuf_decoder_init(push_protobuf_decoder_t *decoder)
+{
+    decoder->state = PUSH_PROTOBUF_DECODER_TAG;
+    decoder->field = 0;
+    decoder->value = 0;
+    decoder->size = 0;
+    decoder->bytes_left = 0;
+    decoder->depth = 0;
+}
+
+
+/**
+ * Read some of a varint into decoder->value.  Returns the number of
+ * bytes consumed, or <code>(size_t) -1</code> if the varint is too
+ * long.  Sets *done once the varint is complete.
+ */
+
+static inline size_t
+push_protobuf_decoder_read_varint(push_protobuf_decoder_t *decoder,
+                                  const uint8_t *buf,
+                                  size_t bytes_remaining,
+                                  bool *done)
+{
+    size_t  used = 0;
+
+    if (decoder->size == 0)
+    {
+        /*
+         * Fast path: a complete varint in the current chunk.
+         */
+
+        if (bytes_remaining >= PUSH_PROTOBUF_MAX_VARINT_LENGTH)
+        {
+            used = push_protobuf_varint_decode(buf, &decoder->value);
+            if (used == 0)
+                return (size_t) -1;
+
+            *done = true;
+            return used;
+        }
+
+        decoder->value = 0;
+    }
+
+    while (used < bytes_remaining)
+    {
+        uint8_t  b = buf[used++];
+
+        if (decoder->size == PUSH_PROTOBUF_MAX_VARINT_LENGTH)
+            return (size_t) -1;
+
+        decoder->value |=
+            ((uint64_t) (b & 0x7f)) << (7 * decoder->size);
+        decoder->size++;
+
+        if (b < 0x80)
+        {
+            decoder->size = 0;
+            *done = true;
+            return used;
+        }
+    }
+
+    *done = false;
+    return used;
+}
+
+
+/**
+ * Read some of a little-endian fixed-width value, which is width
+ * bytes long, into decoder->value.  Returns the number of bytes
+ * consumed.  Sets *done once the value is complete.
+ */
+
+static inline size_t
+push_protobuf_decoder_read_fixed(push_protobuf_decoder_t *decoder,
+                                 const uint8_t *buf,
+                                 size_t bytes_remaining,
+                                 size_t width,
+                                 bool *done)
+{
+    size_t  used;
+
+    if (decoder->size == 0)
+    {
+        /*
+         * Fast path: the whole value is in the current chunk.
+         */
+
+        if (bytes_remaining >= width)
+        {
+            decoder->value =
+                (width == sizeof(uint32_t))?
+                push_protobuf_load_le32(buf):
+                push_protobuf_load_le64(buf);
+
+            *done = true;
+            return width;
+        }
+
+        decoder->value = 0;
+    }
+
+    for (used = 0;
+         (used < bytes_remaining) && (decoder->size < width);
+         used++, decoder->size++)
+    {
+        decoder->value |= ((uint64_t) buf[used]) << (8 * decoder->size);
+    }
+
+    if (decoder->size == width)
+    {
+        decoder->size = 0;
+        *done = true;
+    } else {
+        *done = false;
+    }
+
+    return used;
+}
+
+
+/**
+ * Set up the decoder to skip the value of an unknown field with the
+ * given tag.  Groups are skipped by reading (and skipping) each of
+ * their fields until the matching END_GROUP.  Returns
+ * <code>false</code> if the tag is invalid.
+ */
+
+static inline bool
+push_protobuf_decoder_skip(push_protobuf_decoder_t *decoder,
+                           push_protobuf_tag_t tag)
+{
+    decoder->field = 0;
+
+    switch (PUSH_PROTOBUF_GET_TAG_TYPE(tag))
+    {
+      case PUSH_PROTOBUF_TAG_TYPE_VARINT:
+        decoder->state = PUSH_PROTOBUF_DECODER_VARINT;
+        return true;
+
+      case PUSH_PROTOBUF_TAG_TYPE_FIXED64:
+        decoder->state = PUSH_PROTOBUF_DECODER_FIXED64;
+        return true;
+
+      case PUSH_PROTOBUF_TAG_TYPE_LENGTH_DELIMITED:
+        decoder->state = PUSH_PROTOBUF_DECODER_LENGTH;
+        return true;
+
+      case PUSH_PROTOBUF_TAG_TYPE_START_GROUP:
+        decoder->depth++;
+        decoder->state = PUSH_PROTOBUF_DECODER_TAG;
+        return true;
+
+      case PUSH_PROTOBUF_TAG_TYPE_END_GROUP:
+        if (decoder->depth == 0)
+            return false;
+
+        decoder->depth--;
+        decoder->state = PUSH_PROTOBUF_DECODER_TAG;
+        return true;
+
+      case PUSH_PROTOBUF_TAG_TYPE_FIXED32:
+        decoder->state = PUSH_PROTOBUF_DECODER_FIXED32;
+        return true;
+
+      default:
+        return false;
+    }
+}
+
+
+/**
+ * Returns whether the decoder is between fields, and so can stop at
+ * the end of the message.
+ */
+
+static inline bool
+push_protobuf_decoder_at_field_boundary(push_protobuf_decoder_t *decoder)
+{
+    return
+        (decoder->state == PUSH_PROTOBUF_DECODER_TAG) &&
+        (decoder->size == 0) &&
+        (decoder->depth == 0);
+}
+
+
+#endif  /* PUSH_PROTOBUF_DECODER_H */
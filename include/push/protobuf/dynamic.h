@@ -0,0 +1,367 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2010, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the LICENSE.txt file in this distribution for license
+ * details.
+ * ----------------------------------------------------------------------
+ */
+
+#ifndef PUSH_PROTOBUF_DYNAMIC_H
+#define PUSH_PROTOBUF_DYNAMIC_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <push/basics.h>
+#include <push/protobuf/basics.h>
+
+/**
+ * @file
+ *
+ * This file defines parsers for message types that aren't known until
+ * runtime.  The message types are loaded from a serialized
+ * <code>FileDescriptorSet</code> (as produced by <code>protoc
+ * --descriptor_set_out</code>) into a descriptor pool.  A dynamic
+ * message callback then parses messages of any type in the pool into
+ * a generic, arena-backed representation.
+ *
+ * The pool builds the field map graph for each message type the
+ * first time that it's needed for a particular parser, and reuses it
+ * for every later message of that type, whether it appears at the top
+ * level or as a submessage.
+ */
+
+
+/**
+ * The type of a field, as defined in <code>descriptor.proto</code>.
+ */
+
+typedef enum _push_protobuf_field_type
+{
+    PUSH_PROTOBUF_TYPE_DOUBLE = 1,
+    PUSH_PROTOBUF_TYPE_FLOAT = 2,
+    PUSH_PROTOBUF_TYPE_INT64 = 3,
+    PUSH_PROTOBUF_TYPE_UINT64 = 4,
+    PUSH_PROTOBUF_TYPE_INT32 = 5,
+    PUSH_PROTOBUF_TYPE_FIXED64 = 6,
+    PUSH_PROTOBUF_TYPE_FIXED32 = 7,
+    PUSH_PROTOBUF_TYPE_BOOL = 8,
+    PUSH_PROTOBUF_TYPE_STRING = 9,
+    PUSH_PROTOBUF_TYPE_GROUP = 10,
+    PUSH_PROTOBUF_TYPE_MESSAGE = 11,
+    PUSH_PROTOBUF_TYPE_BYTES = 12,
+    PUSH_PROTOBUF_TYPE_UINT32 = 13,
+    PUSH_PROTOBUF_TYPE_ENUM = 14,
+    PUSH_PROTOBUF_TYPE_SFIXED32 = 15,
+    PUSH_PROTOBUF_TYPE_SFIXED64 = 16,
+    PUSH_PROTOBUF_TYPE_SINT32 = 17,
+    PUSH_PROTOBUF_TYPE_SINT64 = 18
+} push_protobuf_field_type_t;
+
+
+/**
+ * The label of a field, as defined in <code>descriptor.proto</code>.
+ */
+
+typedef enum _push_protobuf_field_label
+{
+    PUSH_PROTOBUF_LABEL_OPTIONAL = 1,
+    PUSH_PROTOBUF_LABEL_REQUIRED = 2,
+    PUSH_PROTOBUF_LABEL_REPEATED = 3
+} push_protobuf_field_label_t;
+
+
+typedef struct _push_protobuf_message_descriptor
+    push_protobuf_message_descriptor_t;
+
+
+/**
+ * Describes one field of a message type.
+ */
+
+typedef struct _push_protobuf_field_descriptor
+{
+    /**
+     * The name of the field.
+     */
+
+    const char  *name;
+
+    /**
+     * The field number.
+     */
+
+    push_protobuf_tag_number_t  number;
+
+    /**
+     * Whether the field is optional, required, or repeated.
+     */
+
+    push_protobuf_field_label_t  label;
+
+    /**
+     * The type of the field.
+     */
+
+    push_protobuf_field_type_t  type;
+
+    /**
+     * Whether a repeated scalar field is packed.
+     */
+
+    bool  packed;
+
+    /**
+     * For message fields, the descriptor of the submessage type.
+     * This is NULL for all other fields.
+     */
+
+    const push_protobuf_message_descriptor_t  *message_type;
+
+} push_protobuf_field_descriptor_t;
+
+
+/**
+ * Describes a message type.
+ */
+
+struct _push_protobuf_message_descriptor
+{
+    /**
+     * The fully qualified name of the message type, without a
+     * leading period; for instance, <code>pkg.Outer.Inner</code>.
+     */
+
+    const char  *full_name;
+
+    /**
+     * The number of fields in the message type.
+     */
+
+    size_t  field_count;
+
+    /**
+     * The message type's fields, in the order they were declared.
+     */
+
+    const push_protobuf_field_descriptor_t  *fields;
+
+    /**
+     * The position of this message type in its descriptor pool.
+     *
+     * @private
+     */
+
+    size_t  index;
+};
+
+
+/**
+ * A set of message types, loaded from one or more
+ * <code>FileDescriptorSet</code>s.
+ */
+
+typedef struct _push_protobuf_descriptor_pool
+    push_protobuf_descriptor_pool_t;
+
+
+/**
+ * Create a new, empty descriptor pool.
+ */
+
+push_protobuf_descriptor_pool_t *
+push_protobuf_descriptor_pool_new(void *parent);
+
+
+/**
+ * Load all of the message types from a serialized
+ * <code>FileDescriptorSet</code> into a descriptor pool.  The set is
+ * parsed with a dynamic message callback, using a built-in
+ * description of <code>descriptor.proto</code>.  Every message type
+ * that a field refers to must be defined in the same set, or in a set
+ * that was loaded earlier.
+ *
+ * @return <code>false</code> if the set can't be parsed or refers to
+ * an unknown message type.
+ */
+
+bool
+push_protobuf_descriptor_pool_load(push_protobuf_descriptor_pool_t *pool,
+                                   const void *buf,
+                                   size_t size);
+
+
+/**
+ * Find a message type in a descriptor pool, given its fully qualified
+ * name.  A leading period is allowed.  Returns NULL if there's no
+ * such message type.
+ */
+
+const push_protobuf_message_descriptor_t *
+push_protobuf_descriptor_pool_find_message
+    (push_protobuf_descriptor_pool_t *pool,
+     const char *full_name);
+
+
+/**
+ * Create a projection of a message type, which only includes the
+ * fields named by a list of field paths.  Each path is a
+ * period-separated list of field names, relative to the message type;
+ * for a Person message, <code>address.zip</code> names the zip field
+ * of the address submessage.  A path that ends at a message field
+ * keeps the whole submessage.
+ *
+ * Parsing a message with a projection (using
+ * push_protobuf_dynamic_message_new) only descends into the
+ * submessages on a requested path.  Every other field is treated as
+ * an unknown field, so length-delimited ones are skipped by length
+ * without being parsed.  The parsed message's descriptor is the
+ * projection, which only has the requested fields.
+ *
+ * The projection belongs to the pool; it can't be found with
+ * push_protobuf_descriptor_pool_find_message.
+ *
+ * @return NULL if a path doesn't name a field, or passes through a
+ * field that isn't a message.
+ */
+
+const push_protobuf_message_descriptor_t *
+push_protobuf_descriptor_pool_project
+    (push_protobuf_descriptor_pool_t *pool,
+     const push_protobuf_message_descriptor_t *descriptor,
+     const char * const *paths,
+     size_t path_count);
+
+
+/**
+ * A single value of a dynamic message field.  Which member of the
+ * union is filled in depends on the field's type: enums are stored as
+ * <code>int32</code>; strings and bytes as a (NUL-terminated) pointer
+ * and size.
+ */
+
+typedef struct _push_protobuf_dynamic_value
+    push_protobuf_dynamic_value_t;
+
+typedef struct _push_protobuf_dynamic_message
+    push_protobuf_dynamic_message_t;
+
+struct _push_protobuf_dynamic_value
+{
+    /**
+     * The next value of a repeated field.
+     */
+
+    push_protobuf_dynamic_value_t  *next;
+
+    union
+    {
+        int32_t  i32;
+        int64_t  i64;
+        uint32_t  u32;
+        uint64_t  u64;
+        float  f;
+        double  d;
+        bool  b;
+
+        struct
+        {
+            const char  *data;
+            size_t  size;
+        } bytes;
+
+        push_protobuf_dynamic_message_t  *message;
+    } v;
+};
+
+
+/**
+ * The values of one field of a dynamic message.  A singular field
+ * has at most one value; if it appears more than once in the
+ * message, the last value wins, except for submessages, which are
+ * merged together.  A repeated field has a linked list of values, in
+ * the order that they were parsed.
+ */
+
+typedef struct _push_protobuf_dynamic_field
+{
+    /**
+     * The number of values that were parsed.  This is 0 if the field
+     * wasn't present.
+     */
+
+    size_t  count;
+
+    /**
+     * The first value.
+     */
+
+    push_protobuf_dynamic_value_t  *first;
+
+    /**
+     * The last value.
+     */
+
+    push_protobuf_dynamic_value_t  *last;
+
+} push_protobuf_dynamic_field_t;
+
+
+/**
+ * A message parsed by a dynamic message callback.
+ */
+
+struct _push_protobuf_dynamic_message
+{
+    /**
+     * The type of the message.
+     */
+
+    const push_protobuf_message_descriptor_t  *descriptor;
+
+    /**
+     * The values of each field, in the same order as
+     * descriptor->fields.
+     */
+
+    push_protobuf_dynamic_field_t  *fields;
+};
+
+
+/**
+ * Get the values of a field of a dynamic message, given its field
+ * number.  Returns NULL if the message type doesn't have that field.
+ */
+
+const push_protobuf_dynamic_field_t *
+push_protobuf_dynamic_message_get_field
+    (const push_protobuf_dynamic_message_t *message,
+     push_protobuf_tag_number_t field_number);
+
+
+/**
+ * Create a new callback that parses a message of the given type into
+ * a push_protobuf_dynamic_message_t.  All of the values are allocated
+ * from an arena owned by the callback; the result is only valid until
+ * the callback is activated again.  Unknown fields, and fields whose
+ * type isn't supported (groups), are skipped.
+ *
+ * Because the field map graphs are shared between all of the dynamic
+ * message callbacks that use the same pool and parser, these
+ * callbacks can be run one after another, but not in parallel (with
+ * push_par_new, for instance).
+ */
+
+push_callback_t *
+push_protobuf_dynamic_message_new
+    (const char *name,
+     void *parent,
+     push_parser_t *parser,
+     push_protobuf_descriptor_pool_t *pool,
+     const push_protobuf_message_descriptor_t *descriptor);
+
+
+#endif  /* PUSH_PROTOBUF_DYNAMIC_H */
@@ -0,0 +1,309 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2010, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the LICENSE.txt file in this distribution for license
+ * details.
+ * ----------------------------------------------------------------------
+ */
+
+#ifndef PUSH_PROTOBUF_ENCODER_H
+#define PUSH_PROTOBUF_ENCODER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/uio.h>
+
+#include <push/protobuf/basics.h>
+#include <push/protobuf/dynamic.h>
+#include <push/protobuf/unknown.h>
+
+/**
+ * @file
+ *
+ * This file defines a Protocol Buffer encoder.  Fields are added to
+ * the encoder one at a time, in the order that they should appear on
+ * the wire.  The encoded message is produced as a list of
+ * <code>struct iovec</code>s, ready to pass to
+ * <code>writev</code>.  Tags, scalar values, and short strings are
+ * written into fixed-size chunks that the encoder owns, and that are
+ * reused after each reset.  Longer strings and bytes values aren't
+ * copied at all; their iovecs point directly at the caller's memory.
+ *
+ * The length of a submessage isn't known until the submessage is
+ * finished.  Rather than encoding each submessage twice (once to
+ * compute its size, and again to write it out), or moving its
+ * contents once the length prefix's size is known, the encoder
+ * reserves room for the prefix in its own iovec, and fills it in —
+ * setting the iovec's length to the actual size of the varint — when
+ * the submessage is ended.
+ */
+
+
+/**
+ * The default chunk size for an encoder.
+ */
+
+#define PUSH_PROTOBUF_ENCODER_DEFAULT_CHUNK_SIZE  4096
+
+
+/**
+ * By default, strings and bytes values at least this long are
+ * referenced instead of copied.
+ */
+
+#define PUSH_PROTOBUF_ENCODER_DEFAULT_COPY_THRESHOLD  256
+
+
+/**
+ * A Protocol Buffer encoder.
+ */
+
+typedef struct _push_protobuf_encoder  push_protobuf_encoder_t;
+
+
+/**
+ * Create a new encoder.  Output is written into chunks of chunk_size
+ * bytes (which must be at least 64); string and bytes values shorter
+ * than copy_threshold are copied into the chunks, and longer ones are
+ * referenced.  Pass 0 for either to use the default.
+ */
+
+push_protobuf_encoder_t *
+push_protobuf_encoder_new(void *parent,
+                          size_t chunk_size,
+                          size_t copy_threshold);
+
+
+/**
+ * Throw away the current output, so that the encoder can be used for
+ * another message.  The encoder keeps its chunks.
+ */
+
+void
+push_protobuf_encoder_reset(push_protobuf_encoder_t *encoder);
+
+
+/**
+ * Return the iovecs for the output so far, and the number of them in
+ * *count.  Any string or bytes values that were referenced must stay
+ * valid until the iovecs have been consumed.  The iovecs are only
+ * valid until the next field is added or the encoder is reset.
+ */
+
+const struct iovec *
+push_protobuf_encoder_iovecs(push_protobuf_encoder_t *encoder,
+                             size_t *count);
+
+
+/**
+ * Return the total number of bytes of output so far.
+ */
+
+size_t
+push_protobuf_encoder_size(push_protobuf_encoder_t *encoder);
+
+
+/**
+ * Add a varint field.  This works for <code>uint32</code>,
+ * <code>uint64</code>, <code>bool</code>, and (non-negative)
+ * <code>enum</code> fields.
+ *
+ * @return <code>false</code> if we can't allocate a new chunk.
+ */
+
+bool
+push_protobuf_encoder_add_varint(push_protobuf_encoder_t *encoder,
+                                 push_protobuf_tag_number_t field_number,
+                                 uint64_t value);
+
+
+/**
+ * Add an <code>int32</code> or <code>enum</code> field.  Negative
+ * values are sign-extended to 64 bits, as the protocol requires, so
+ * they always take ten bytes.
+ */
+
+bool
+push_protobuf_encoder_add_int32(push_protobuf_encoder_t *encoder,
+                                push_protobuf_tag_number_t field_number,
+                                int32_t value);
+
+
+/**
+ * Add an <code>int64</code> field.
+ */
+
+bool
+push_protobuf_encoder_add_int64(push_protobuf_encoder_t *encoder,
+                                push_protobuf_tag_number_t field_number,
+                                int64_t value);
+
+
+/**
+ * Add a <code>sint32</code> field, using the zig-zag encoding.
+ */
+
+bool
+push_protobuf_encoder_add_sint32(push_protobuf_encoder_t *encoder,
+                                 push_protobuf_tag_number_t field_number,
+                                 int32_t value);
+
+
+/**
+ * Add a <code>sint64</code> field, using the zig-zag encoding.
+ */
+
+bool
+push_protobuf_encoder_add_sint64(push_protobuf_encoder_t *encoder,
+                                 push_protobuf_tag_number_t field_number,
+                                 int64_t value);
+
+
+/**
+ * Add a <code>fixed32</code> or <code>sfixed32</code> field.
+ */
+
+bool
+push_protobuf_encoder_add_fixed32(push_protobuf_encoder_t *encoder,
+                                  push_protobuf_tag_number_t field_number,
+                                  uint32_t value);
+
+
+/**
+ * Add a <code>fixed64</code> or <code>sfixed64</code> field.
+ */
+
+bool
+push_protobuf_encoder_add_fixed64(push_protobuf_encoder_t *encoder,
+                                  push_protobuf_tag_number_t field_number,
+                                  uint64_t value);
+
+
+/**
+ * Add a <code>float</code> field.
+ */
+
+bool
+push_protobuf_encoder_add_float(push_protobuf_encoder_t *encoder,
+                                push_protobuf_tag_number_t field_number,
+                                float value);
+
+
+/**
+ * Add a <code>double</code> field.
+ */
+
+bool
+push_protobuf_encoder_add_double(push_protobuf_encoder_t *encoder,
+                                 push_protobuf_tag_number_t field_number,
+                                 double value);
+
+
+/**
+ * Add a <code>string</code> or <code>bytes</code> field.  If the
+ * value is at least as long as the encoder's copy threshold, it's
+ * referenced rather than copied, and must stay valid until the
+ * output has been consumed.
+ */
+
+bool
+push_protobuf_encoder_add_bytes(push_protobuf_encoder_t *encoder,
+                                push_protobuf_tag_number_t field_number,
+                                const void *buf,
+                                size_t size);
+
+
+/**
+ * Start a submessage field.  Every field added until the matching
+ * push_protobuf_encoder_end_submessage belongs to the submessage.
+ * Submessages can be nested.  This can also be used to start a
+ * packed repeated field, whose values are then written with the
+ * push_protobuf_encoder_write_* functions.
+ */
+
+bool
+push_protobuf_encoder_begin_submessage
+    (push_protobuf_encoder_t *encoder,
+     push_protobuf_tag_number_t field_number);
+
+
+/**
+ * Finish the innermost submessage, filling in its length prefix.
+ *
+ * @return <code>false</code> if there's no submessage to end, or if
+ * the submessage is 4GB or longer.
+ */
+
+bool
+push_protobuf_encoder_end_submessage(push_protobuf_encoder_t *encoder);
+
+
+/**
+ * Write a bare varint, with no tag.  This is used for the values of
+ * packed repeated fields.
+ */
+
+bool
+push_protobuf_encoder_write_varint(push_protobuf_encoder_t *encoder,
+                                   uint64_t value);
+
+
+/**
+ * Write a bare little-endian 32-bit value, with no tag.
+ */
+
+bool
+push_protobuf_encoder_write_fixed32(push_protobuf_encoder_t *encoder,
+                                    uint32_t value);
+
+
+/**
+ * Write a bare little-endian 64-bit value, with no tag.
+ */
+
+bool
+push_protobuf_encoder_write_fixed64(push_protobuf_encoder_t *encoder,
+                                    uint64_t value);
+
+
+/**
+ * Write raw bytes, with no tag.  Like the values of bytes fields,
+ * they're referenced rather than copied if there are at least as many
+ * as the encoder's copy threshold.
+ */
+
+bool
+push_protobuf_encoder_write_bytes(push_protobuf_encoder_t *encoder,
+                                  const void *buf,
+                                  size_t size);
+
+
+/**
+ * Add a list of unknown fields, exactly as they were read.
+ */
+
+bool
+push_protobuf_encoder_add_unknown_fields
+    (push_protobuf_encoder_t *encoder,
+     const push_protobuf_unknown_fields_t *fields);
+
+
+/**
+ * Add every field of a dynamic message, in the order that they
+ * appear in its message type.  Packed fields are written packed.
+ * String and bytes values are referenced from the message's arena, so
+ * the output must be consumed before the dynamic message callback is
+ * activated again.  This lets a message be parsed, modified, and
+ * re-encoded without another Protocol Buffer library.
+ */
+
+bool
+push_protobuf_encoder_add_dynamic_message
+    (push_protobuf_encoder_t *encoder,
+     const push_protobuf_dynamic_message_t *message);
+
+
+#endif  /* PUSH_PROTOBUF_ENCODER_H */
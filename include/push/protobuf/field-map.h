@@ -12,10 +12,13 @@
 #define PUSH_PROTOBUF_FIELD_MAP_H
 
 #include <stdbool.h>
+#include <stdint.h>
 
 #include <hwm-buffer.h>
 
 #include <push/basics.h>
+#include <push/intern.h>
+#include <push/primitives.h>
 #include <push/protobuf/basics.h>
 
 
@@ -29,6 +32,24 @@
 typedef struct _push_protobuf_field_map  push_protobuf_field_map_t;
 
 
+/**
+ * A list of the unknown fields of a message.  See
+ * push/protobuf/unknown.h.
+ */
+
+typedef struct _push_protobuf_unknown_fields
+    push_protobuf_unknown_fields_t;
+
+
+/**
+ * The statistics for each field of a message type.  See
+ * push/protobuf/field-stats.h.
+ */
+
+typedef struct _push_protobuf_field_stats
+    push_protobuf_field_stats_t;
+
+
 /**
  * Create a new field map.  The field map should be created and
  * populated before creating the message callback that will use it.
@@ -78,7 +99,8 @@ push_protobuf_field_map_set_error
  * if needed.  We also verify that the tag type matches what we
  * expect, throwing a parse error if it doesn't.
  *
- * @return <code>false</code> if we cannot add the new field.
+ * @return <code>false</code> if we cannot add the new field, or if
+ * the field map already has a field with the same number.
  */
 
 bool
@@ -91,6 +113,30 @@ push_protobuf_field_map_add_field
  push_callback_t *value_callback);
 
 
+/**
+ * Add a new repeated scalar field to a field map.  An encoder can
+ * write each element with its own tag, or pack several elements into
+ * a single length-delimited run, and a parser has to accept both.
+ * The element callback reads the value of a tag with
+ * element_tag_type; the packed callback reads the value of a
+ * LENGTH_DELIMITED tag, including its length prefix.  Any other tag
+ * type is a parse error.
+ *
+ * @return <code>false</code> if we cannot add the new field, or if
+ * the field map already has a field with the same number.
+ */
+
+bool
+push_protobuf_field_map_add_packable_field
+(const char *field_name,
+ push_parser_t *parser,
+ push_protobuf_field_map_t *field_map,
+ push_protobuf_tag_number_t field_number,
+ push_protobuf_tag_type_t element_tag_type,
+ push_callback_t *element_callback,
+ push_callback_t *packed_callback);
+
+
 /**
  * Get the field callback for the specified field.  If that field
  * isn't in the field map, return NULL.
@@ -102,6 +148,127 @@ push_protobuf_field_map_get_field
      push_protobuf_tag_number_t field_number);
 
 
+/**
+ * Get the value callback for a field, given the field's full tag.
+ * This only succeeds for fields whose tags fit into two bytes, and
+ * only if the tag's wire type matches what the field expects.  The
+ * callback that we return doesn't verify the tag; it reads the value
+ * directly, and succeeds the same way that the field's full field
+ * callback would.  If this returns NULL, use
+ * push_protobuf_field_map_get_field instead.
+ */
+
+push_callback_t *
+push_protobuf_field_map_get_tag_callback
+    (push_protobuf_field_map_t *field_map,
+     push_protobuf_tag_t tag);
+
+
+/**
+ * Record the unknown fields of each message in dest, instead of
+ * skipping them.  This must be called before creating the message
+ * callback that will use the field map.
+ */
+
+void
+push_protobuf_field_map_preserve_unknown
+    (push_protobuf_field_map_t *field_map,
+     push_protobuf_unknown_fields_t *dest);
+
+
+/**
+ * Get the list that a field map records unknown fields in, or NULL if
+ * it skips them.
+ */
+
+push_protobuf_unknown_fields_t *
+push_protobuf_field_map_get_unknown_fields
+    (push_protobuf_field_map_t *field_map);
+
+
+/**
+ * Count how often each field appears in dest, how many bytes it
+ * takes up, and how often it fails to parse.  This must be called
+ * before creating the message callback that will use the field map.
+ */
+
+void
+push_protobuf_field_map_track_stats
+    (push_protobuf_field_map_t *field_map,
+     push_protobuf_field_stats_t *dest);
+
+
+/**
+ * Get the statistics that a field map's message callback updates, or
+ * NULL if it isn't tracking statistics.
+ */
+
+push_protobuf_field_stats_t *
+push_protobuf_field_map_get_stats(push_protobuf_field_map_t *field_map);
+
+
+/**
+ * The presence bit for a field number.  Only fields numbered below
+ * PUSH_PROTOBUF_PRESENCE_LIMIT have a presence bit; the bit for any
+ * other field is 0.
+ */
+
+#define PUSH_PROTOBUF_PRESENCE_LIMIT  64
+
+#define PUSH_PROTOBUF_PRESENCE_BIT(field_number)                \
+    (((field_number) < PUSH_PROTOBUF_PRESENCE_LIMIT)?           \
+     (((uint64_t) 1) << (field_number)): 0)
+
+
+/**
+ * Keep track of which fields appear in each message.  When a message
+ * starts, *dest is cleared; each field that's read then sets its
+ * presence bit (see PUSH_PROTOBUF_PRESENCE_BIT) in *dest.  This must
+ * be called before creating the message callback that will use the
+ * field map.
+ */
+
+void
+push_protobuf_field_map_track_presence
+    (push_protobuf_field_map_t *field_map,
+     uint64_t *dest);
+
+
+/**
+ * Mark a field as required.  When a message ends, if any of its
+ * required fields didn't appear, the message callback fails with
+ * PUSH_PARSE_ERROR.  This turns on presence tracking if it isn't on
+ * already.
+ * This must be called before creating the message callback that will
+ * use the field map.
+ *
+ * @return <code>false</code> if the field number doesn't have a
+ * presence bit.
+ */
+
+bool
+push_protobuf_field_map_require_field
+    (push_protobuf_field_map_t *field_map,
+     push_protobuf_tag_number_t field_number);
+
+
+/**
+ * Get the presence bitmap that a field map's message callback
+ * updates, or NULL if it isn't tracking presence.
+ */
+
+uint64_t *
+push_protobuf_field_map_get_presence(push_protobuf_field_map_t *field_map);
+
+
+/**
+ * Get the presence bits of a field map's required fields.
+ */
+
+uint64_t
+push_protobuf_field_map_get_required(push_protobuf_field_map_t *field_map);
+
+
 /**
  * Add a new submessage to a field map.
  *
@@ -118,6 +285,24 @@ push_protobuf_add_submessage(const char *message_name,
                              push_callback_t *message);
 
 
+/**
+ * Add a new group to a field map.  The fields of the group are read
+ * using the callbacks in group_field_map, as with
+ * push_protobuf_group_new.
+ *
+ * @return <code>false</code> if we cannot add the new field.
+ */
+
+bool
+push_protobuf_add_group(const char *message_name,
+                        const char *field_name,
+                        void *parent,
+                        push_parser_t *parser,
+                        push_protobuf_field_map_t *field_map,
+                        push_protobuf_tag_number_t field_number,
+                        push_protobuf_field_map_t *group_field_map);
+
+
 /**
  * Create a new callback that reads a length-prefixed Protocol Buffer
  * string into a high-water mark buffer.
@@ -133,6 +318,69 @@ push_protobuf_add_hwm_string(const char *message_name,
                              hwm_buffer_t *dest);
 
 
+/**
+ * Add a new string field to a field map.  When parsing, a
+ * push_string_view_t describing the string will be assigned to the
+ * dest pointer.  If the string is contained entirely in one data
+ * chunk, the view will point directly into that chunk, and will only
+ * be valid for as long as the caller keeps that chunk around.
+ * Otherwise the string is copied into the buf HWM buffer.
+ *
+ * @return <code>false</code> if we cannot add the new field.
+ */
+
+bool
+push_protobuf_add_string_view(const char *message_name,
+                              const char *field_name,
+                              void *parent,
+                              push_parser_t *parser,
+                              push_protobuf_field_map_t *field_map,
+                              push_protobuf_tag_number_t field_number,
+                              hwm_buffer_t *buf,
+                              push_string_view_t *dest);
+
+
+/**
+ * Add a new interned string field to a field map.  When parsing, the
+ * field's value is looked up in the interning table, and dest will
+ * point at the table's canonical copy.  If the table is full and the
+ * value is new, dest will point into the HWM buffer instead.
+ *
+ * @return <code>false</code> if we cannot add the new field.
+ */
+
+bool
+push_protobuf_add_interned_string(const char *message_name,
+                                  const char *field_name,
+                                  void *parent,
+                                  push_parser_t *parser,
+                                  push_protobuf_field_map_t *field_map,
+                                  push_protobuf_tag_number_t field_number,
+                                  hwm_buffer_t *buf,
+                                  push_intern_table_t *table,
+                                  const char **dest);
+
+
+/**
+ * Add a new string or bytes field to a field map.  When parsing, each
+ * piece of the field's value will be passed to the sink function as
+ * it arrives; the value is never buffered in its entirety.  This is
+ * the right choice for very large bytes fields.
+ *
+ * @return <code>false</code> if we cannot add the new field.
+ */
+
+bool
+push_protobuf_add_string_sink(const char *message_name,
+                              const char *field_name,
+                              void *parent,
+                              push_parser_t *parser,
+                              push_protobuf_field_map_t *field_map,
+                              push_protobuf_tag_number_t field_number,
+                              push_string_sink_func_t *sink,
+                              void *sink_user_data);
+
+
 /**
  * Add a new <code>uint32</code> field to a field map.  When parsing,
  * the field's value will be assigned to the dest pointer.
@@ -235,4 +483,296 @@ push_protobuf_assign_sint64(const char *message_name,
                             int64_t *dest);
 
 
+/**
+ * Add a new <code>fixed32</code> field to a field map.  When parsing,
+ * the field's value will be assigned to the dest pointer.
+ *
+ * @return <code>false</code> if we cannot add the new field.
+ */
+
+bool
+push_protobuf_assign_fixed32(const char *message_name,
+                             const char *field_name,
+                             void *parent,
+                             push_parser_t *parser,
+                             push_protobuf_field_map_t *field_map,
+                             push_protobuf_tag_number_t field_number,
+                             uint32_t *dest);
+
+
+/**
+ * Add a new <code>fixed64</code> field to a field map.  When parsing,
+ * the field's value will be assigned to the dest pointer.
+ *
+ * @return <code>false</code> if we cannot add the new field.
+ */
+
+bool
+push_protobuf_assign_fixed64(const char *message_name,
+                             const char *field_name,
+                             void *parent,
+                             push_parser_t *parser,
+                             push_protobuf_field_map_t *field_map,
+                             push_protobuf_tag_number_t field_number,
+                             uint64_t *dest);
+
+
+/**
+ * Add a new <code>sfixed32</code> field to a field map.  When parsing,
+ * the field's value will be assigned to the dest pointer.
+ *
+ * @return <code>false</code> if we cannot add the new field.
+ */
+
+bool
+push_protobuf_assign_sfixed32(const char *message_name,
+                              const char *field_name,
+                              void *parent,
+                              push_parser_t *parser,
+                              push_protobuf_field_map_t *field_map,
+                              push_protobuf_tag_number_t field_number,
+                              int32_t *dest);
+
+
+/**
+ * Add a new <code>sfixed64</code> field to a field map.  When parsing,
+ * the field's value will be assigned to the dest pointer.
+ *
+ * @return <code>false</code> if we cannot add the new field.
+ */
+
+bool
+push_protobuf_assign_sfixed64(const char *message_name,
+                              const char *field_name,
+                              void *parent,
+                              push_parser_t *parser,
+                              push_protobuf_field_map_t *field_map,
+                              push_protobuf_tag_number_t field_number,
+                              int64_t *dest);
+
+
+/**
+ * Add a new <code>float</code> field to a field map.  When parsing,
+ * the field's value will be assigned to the dest pointer.
+ *
+ * @return <code>false</code> if we cannot add the new field.
+ */
+
+bool
+push_protobuf_assign_float(const char *message_name,
+                           const char *field_name,
+                           void *parent,
+                           push_parser_t *parser,
+                           push_protobuf_field_map_t *field_map,
+                           push_protobuf_tag_number_t field_number,
+                           float *dest);
+
+
+/**
+ * Add a new <code>double</code> field to a field map.  When parsing,
+ * the field's value will be assigned to the dest pointer.
+ *
+ * @return <code>false</code> if we cannot add the new field.
+ */
+
+bool
+push_protobuf_assign_double(const char *message_name,
+                            const char *field_name,
+                            void *parent,
+                            push_parser_t *parser,
+                            push_protobuf_field_map_t *field_map,
+                            push_protobuf_tag_number_t field_number,
+                            double *dest);
+
+
+/**
+ * Add a new packed repeated <code>uint32</code> field to a field map.
+ * Elements are appended to dest as <code>uint32_t</code>s.
+ *
+ * All of the packed helpers treat dest as an array of the element
+ * type; use hwm_buffer_current_list_size to find out how many
+ * elements there are.  The buffer is not cleared between fields, so
+ * several packed runs of the same field accumulate.  Varint elements
+ * are decoded a word at a time; fixed-width elements are copied
+ * directly.  Elements that aren't packed, each with its own tag, are
+ * appended to the same array, in the order that they appear.
+ *
+ * @return <code>false</code> if we cannot add the new field.
+ */
+
+bool
+push_protobuf_add_packed_uint32(const char *message_name,
+                                const char *field_name,
+                                void *parent,
+                                push_parser_t *parser,
+                                push_protobuf_field_map_t *field_map,
+                                push_protobuf_tag_number_t field_number,
+                                hwm_buffer_t *dest);
+
+
+/**
+ * Add a new packed repeated <code>uint64</code> field to a field map.
+ * Elements are appended to dest as <code>uint64_t</code>s.
+ */
+
+bool
+push_protobuf_add_packed_uint64(const char *message_name,
+                                const char *field_name,
+                                void *parent,
+                                push_parser_t *parser,
+                                push_protobuf_field_map_t *field_map,
+                                push_protobuf_tag_number_t field_number,
+                                hwm_buffer_t *dest);
+
+
+/**
+ * Add a new packed repeated <code>int32</code> field to a field map.
+ * Elements are appended to dest as <code>int32_t</code>s.
+ */
+
+bool
+push_protobuf_add_packed_int32(const char *message_name,
+                               const char *field_name,
+                               void *parent,
+                               push_parser_t *parser,
+                               push_protobuf_field_map_t *field_map,
+                               push_protobuf_tag_number_t field_number,
+                               hwm_buffer_t *dest);
+
+
+/**
+ * Add a new packed repeated <code>int64</code> field to a field map.
+ * Elements are appended to dest as <code>int64_t</code>s.
+ */
+
+bool
+push_protobuf_add_packed_int64(const char *message_name,
+                               const char *field_name,
+                               void *parent,
+                               push_parser_t *parser,
+                               push_protobuf_field_map_t *field_map,
+                               push_protobuf_tag_number_t field_number,
+                               hwm_buffer_t *dest);
+
+
+/**
+ * Add a new packed repeated <code>sint32</code> field to a field map.
+ * Elements are appended to dest as <code>int32_t</code>s.
+ */
+
+bool
+push_protobuf_add_packed_sint32(const char *message_name,
+                                const char *field_name,
+                                void *parent,
+                                push_parser_t *parser,
+                                push_protobuf_field_map_t *field_map,
+                                push_protobuf_tag_number_t field_number,
+                                hwm_buffer_t *dest);
+
+
+/**
+ * Add a new packed repeated <code>sint64</code> field to a field map.
+ * Elements are appended to dest as <code>int64_t</code>s.
+ */
+
+bool
+push_protobuf_add_packed_sint64(const char *message_name,
+                                const char *field_name,
+                                void *parent,
+                                push_parser_t *parser,
+                                push_protobuf_field_map_t *field_map,
+                                push_protobuf_tag_number_t field_number,
+                                hwm_buffer_t *dest);
+
+
+/**
+ * Add a new packed repeated <code>fixed32</code> field to a field map.
+ * Elements are appended to dest as <code>uint32_t</code>s.
+ */
+
+bool
+push_protobuf_add_packed_fixed32(const char *message_name,
+                                 const char *field_name,
+                                 void *parent,
+                                 push_parser_t *parser,
+                                 push_protobuf_field_map_t *field_map,
+                                 push_protobuf_tag_number_t field_number,
+                                 hwm_buffer_t *dest);
+
+
+/**
+ * Add a new packed repeated <code>fixed64</code> field to a field map.
+ * Elements are appended to dest as <code>uint64_t</code>s.
+ */
+
+bool
+push_protobuf_add_packed_fixed64(const char *message_name,
+                                 const char *field_name,
+                                 void *parent,
+                                 push_parser_t *parser,
+                                 push_protobuf_field_map_t *field_map,
+                                 push_protobuf_tag_number_t field_number,
+                                 hwm_buffer_t *dest);
+
+
+/**
+ * Add a new packed repeated <code>sfixed32</code> field to a field map.
+ * Elements are appended to dest as <code>int32_t</code>s.
+ */
+
+bool
+push_protobuf_add_packed_sfixed32(const char *message_name,
+                                  const char *field_name,
+                                  void *parent,
+                                  push_parser_t *parser,
+                                  push_protobuf_field_map_t *field_map,
+                                  push_protobuf_tag_number_t field_number,
+                                  hwm_buffer_t *dest);
+
+
+/**
+ * Add a new packed repeated <code>sfixed64</code> field to a field map.
+ * Elements are appended to dest as <code>int64_t</code>s.
+ */
+
+bool
+push_protobuf_add_packed_sfixed64(const char *message_name,
+                                  const char *field_name,
+                                  void *parent,
+                                  push_parser_t *parser,
+                                  push_protobuf_field_map_t *field_map,
+                                  push_protobuf_tag_number_t field_number,
+                                  hwm_buffer_t *dest);
+
+
+/**
+ * Add a new packed repeated <code>float</code> field to a field map.
+ * Elements are appended to dest as <code>float</code>s.
+ */
+
+bool
+push_protobuf_add_packed_float(const char *message_name,
+                               const char *field_name,
+                               void *parent,
+                               push_parser_t *parser,
+                               push_protobuf_field_map_t *field_map,
+                               push_protobuf_tag_number_t field_number,
+                               hwm_buffer_t *dest);
+
+
+/**
+ * Add a new packed repeated <code>double</code> field to a field map.
+ * Elements are appended to dest as <code>double</code>s.
+ */
+
+bool
+push_protobuf_add_packed_double(const char *message_name,
+                                const char *field_name,
+                                void *parent,
+                                push_parser_t *parser,
+                                push_protobuf_field_map_t *field_map,
+                                push_protobuf_tag_number_t field_number,
+                                hwm_buffer_t *dest);
+
+
 #endif  /* PUSH_PROTOBUF_FIELD_MAP_H */
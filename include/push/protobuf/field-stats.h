@@ -0,0 +1,193 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2010, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the LICENSE.txt file in this distribution for license
+ * details.
+ * ----------------------------------------------------------------------
+ */
+
+#ifndef PUSH_PROTOBUF_FIELD_STATS_H
+#define PUSH_PROTOBUF_FIELD_STATS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <hwm-buffer.h>
+
+#include <push/basics.h>
+#include <push/protobuf/basics.h>
+#include <push/protobuf/field-map.h>
+
+/**
+ * @file
+ *
+ * This file defines a way to find out which fields of a message type
+ * actually appear in a stream, and what they cost.  If a field map
+ * has been given a push_protobuf_field_stats_t (with
+ * push_protobuf_field_map_track_stats), its message callback counts,
+ * for each field number — including the numbers of unknown fields —
+ * how many times the field appeared, how many bytes it took up on the
+ * wire, and how many times its callback failed.  If the field map
+ * isn't tracking statistics, the message callback doesn't do any
+ * extra work.
+ *
+ * A field's bytes include its tag.  For a submessage, they include
+ * the length prefix and the entire contents of the submessage; the
+ * submessage's own fields are only counted if its field map is
+ * tracking statistics, too.  The same goes for a group, whose bytes
+ * include its START_GROUP and END_GROUP tags.
+ *
+ * Statistics accumulate across messages until they're cleared (with
+ * push_protobuf_field_stats_clear).  They can be read at any time,
+ * including from within a callback; a field that's still being read
+ * has its occurrence counted, but not its bytes.
+ */
+
+
+/**
+ * The statistics for one field number.
+ */
+
+typedef struct _push_protobuf_field_stat
+{
+    /**
+     * The field number.
+     */
+
+    push_protobuf_tag_number_t  number;
+
+    /**
+     * The number of times that the field appeared.
+     */
+
+    uint64_t  occurrences;
+
+    /**
+     * The total number of bytes, including tags, of the occurrences
+     * that were read successfully.
+     */
+
+    uint64_t  bytes;
+
+    /**
+     * The number of occurrences whose callback failed.
+     */
+
+    uint64_t  failures;
+
+} push_protobuf_field_stat_t;
+
+
+/**
+ * Field numbers below this limit are found with a directly indexed
+ * table; larger ones with a linear search.
+ */
+
+#define PUSH_PROTOBUF_FIELD_STATS_DENSE_LIMIT  2048
+
+
+/**
+ * The statistics for all of the fields of a message type.
+ */
+
+struct _push_protobuf_field_stats
+{
+    /**
+     * The statistics for each field number that has appeared, as a
+     * list of push_protobuf_field_stat_t instances, in the order
+     * that the field numbers first appeared.
+     *
+     * @private
+     */
+
+    hwm_buffer_t  entries;
+
+    /**
+     * For each field number below
+     * PUSH_PROTOBUF_FIELD_STATS_DENSE_LIMIT, one more than the index
+     * of its entry, or 0 if it hasn't appeared, as a list of
+     * <code>uint32_t</code>.
+     *
+     * @private
+     */
+
+    hwm_buffer_t  dense;
+};
+
+
+/**
+ * Initialize a new, empty set of field statistics.
+ */
+
+void
+push_protobuf_field_stats_init(push_protobuf_field_stats_t *stats);
+
+
+/**
+ * Free the memory used by a set of field statistics.
+ */
+
+void
+push_protobuf_field_stats_done(push_protobuf_field_stats_t *stats);
+
+
+/**
+ * Reset all of the statistics, keeping their memory around.
+ */
+
+void
+push_protobuf_field_stats_clear(push_protobuf_field_stats_t *stats);
+
+
+/**
+ * Return the number of field numbers that have appeared.
+ */
+
+size_t
+push_protobuf_field_stats_count(const push_protobuf_field_stats_t *stats);
+
+
+/**
+ * Get the statistics for one of the field numbers that have
+ * appeared.  Field numbers are indexed from 0 in the order that they
+ * first appeared.  The pointer is only valid until a new field number
+ * appears.
+ *
+ * @return <code>NULL</code> if index is out of range.
+ */
+
+const push_protobuf_field_stat_t *
+push_protobuf_field_stats_get(const push_protobuf_field_stats_t *stats,
+                              size_t index);
+
+
+/**
+ * Get the statistics for a field number.  The pointer is only valid
+ * until a new field number appears.
+ *
+ * @return <code>NULL</code> if the field number hasn't appeared.
+ */
+
+const push_protobuf_field_stat_t *
+push_protobuf_field_stats_find(const push_protobuf_field_stats_t *stats,
+                               push_protobuf_tag_number_t number);
+
+
+/**
+ * Find the index of the statistics for a field number, adding an
+ * entry with zero counts if the field number hasn't appeared before.
+ * This is used by the message callback.
+ *
+ * @return <code>false</code> if we can't allocate the new entry.
+ */
+
+bool
+push_protobuf_field_stats_add(push_protobuf_field_stats_t *stats,
+                              push_protobuf_tag_number_t number,
+                              size_t *index);
+
+
+#endif  /* PUSH_PROTOBUF_FIELD_STATS_H */
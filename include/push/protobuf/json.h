@@ -0,0 +1,77 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2010, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the LICENSE.txt file in this distribution for license
+ * details.
+ * ----------------------------------------------------------------------
+ */
+
+#ifndef PUSH_PROTOBUF_JSON_H
+#define PUSH_PROTOBUF_JSON_H
+
+#include <hwm-buffer.h>
+
+#include <push/basics.h>
+#include <push/protobuf/dynamic.h>
+
+/**
+ * @file
+ *
+ * This file defines a callback that transcodes Protocol Buffer
+ * messages into JSON.  The JSON is written into an output buffer as
+ * each field is parsed, without building a
+ * push_protobuf_dynamic_message_t or any other representation of the
+ * message first.
+ *
+ * The output follows the proto3 JSON mapping, with a few differences
+ * that come from not materializing the message:
+ *
+ *   - Fields are written in the order they first appear on the wire,
+ *     using their names from the <code>.proto</code> file rather
+ *     than lowerCamelCase.
+ *
+ *   - Each field has a single key.  A repeated field is written as an
+ *     array of all of its values, even if they're interleaved with
+ *     other fields.  If a singular field appears more than once, the
+ *     last scalar value wins, and submessages are merged, as when
+ *     parsing the binary format.  Encoders don't normally repeat
+ *     fields, so the JSON is written as the fields are parsed, and
+ *     the callback remembers where each field's values went.  If a
+ *     message does repeat one, the callback rewrites that message's
+ *     JSON from those positions once the message has been read.
+ *
+ *   - Enums are written as numbers, since descriptor pools don't
+ *     keep the names of enum values.  Maps are written as arrays of
+ *     entry objects, and groups are skipped.
+ *
+ * As in the proto3 mapping, 64-bit integers are written as strings,
+ * bytes fields are base64 encoded, and non-finite floats are written
+ * as the strings <code>"NaN"</code>, <code>"Infinity"</code>, and
+ * <code>"-Infinity"</code>.  Unknown fields are skipped.
+ */
+
+
+/**
+ * Create a new callback that reads a message of the given type and
+ * appends its JSON representation to dest.  The callback doesn't
+ * clear dest or NUL-terminate it, so several messages can be written
+ * into the same buffer.  The callback's result is dest.
+ *
+ * The nested messages are handled by the callback itself, so any
+ * message type, including a recursive one, is transcoded by a single
+ * callback.  Nested messages count towards the parser's max_depth
+ * and max_message_bytes limits, and every field towards
+ * max_field_count.
+ */
+
+push_callback_t *
+push_protobuf_json_new(const char *name,
+                       void *parent,
+                       push_parser_t *parser,
+                       const push_protobuf_message_descriptor_t *descriptor,
+                       hwm_buffer_t *dest);
+
+
+#endif  /* PUSH_PROTOBUF_JSON_H */
@@ -0,0 +1,152 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2010, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the LICENSE.txt file in this distribution for license
+ * details.
+ * ----------------------------------------------------------------------
+ */
+
+#ifndef PUSH_PROTOBUF_LAZY_H
+#define PUSH_PROTOBUF_LAZY_H
+
+#include <stdbool.h>
+
+#include <hwm-buffer.h>
+
+#include <push/basics.h>
+#include <push/primitives.h>
+#include <push/protobuf/basics.h>
+#include <push/protobuf/field-map.h>
+
+/**
+ * @file
+ *
+ * This file defines lazy submessage fields.  Rather than parsing a
+ * submessage while the enclosing message is parsed, a lazy field only
+ * records the submessage's serialized bytes.  The submessage is
+ * parsed the first time that the consumer asks for it, and the result
+ * of that parse is remembered, so it's never parsed twice.  For wide
+ * messages where only a few submessages are ever looked at, this
+ * skips most of the decoding work.
+ */
+
+
+/**
+ * A lazily decoded submessage.
+ */
+
+typedef struct _push_protobuf_lazy_message
+{
+    /**
+     * The serialized submessage.  This points into one of the HWM
+     * buffers below, so it stays valid after the data chunks that
+     * it was read from have been reused.
+     */
+
+    push_string_view_t  view;
+
+    /**
+     * Whether the field appeared in the enclosing message.
+     */
+
+    bool  present;
+
+    /**
+     * Whether the submessage has been decoded since it was last
+     * read.
+     */
+
+    bool  decoded;
+
+    /**
+     * The result of decoding the submessage.
+     */
+
+    push_error_code_t  result;
+
+    /**
+     * A buffer for submessages that straddle data chunks.
+     *
+     * @private
+     */
+
+    hwm_buffer_t  buf;
+
+    /**
+     * A buffer that holds the submessage once it has been copied
+     * out of buf, or merged together from several occurrences.
+     *
+     * @private
+     */
+
+    hwm_buffer_t  merged;
+
+} push_protobuf_lazy_message_t;
+
+
+/**
+ * Initialize a lazy submessage.
+ */
+
+void
+push_protobuf_lazy_message_init(push_protobuf_lazy_message_t *lazy);
+
+
+/**
+ * Free the buffers owned by a lazy submessage.
+ */
+
+void
+push_protobuf_lazy_message_done(push_protobuf_lazy_message_t *lazy);
+
+
+/**
+ * Mark a lazy submessage as absent.  Call this before parsing each
+ * enclosing message; otherwise, a field that appears in one message
+ * is merged with the same field in the next.
+ */
+
+void
+push_protobuf_lazy_message_clear(push_protobuf_lazy_message_t *lazy);
+
+
+/**
+ * Decode a lazy submessage.  The parser's callback should parse the
+ * submessage's fields (with push_protobuf_message_new, for
+ * instance).  The first call runs the parser over the submessage's
+ * bytes; later calls return the same result without parsing again,
+ * until the field is read again.  An absent submessage is parsed as
+ * an empty one.
+ *
+ * @return PUSH_SUCCESS if the submessage was decoded, or the parser's
+ * error code otherwise.
+ */
+
+push_error_code_t
+push_protobuf_lazy_message_decode(push_protobuf_lazy_message_t *lazy,
+                                  push_parser_t *parser);
+
+
+/**
+ * Add a new lazy submessage field to a field map.  When parsing, the
+ * submessage's bytes are recorded in dest, which is marked as not yet
+ * decoded.  If the field appears more than once in a message, the
+ * occurrences are concatenated, which gives the same result as
+ * merging them.
+ *
+ * @return <code>false</code> if we cannot add the new field.
+ */
+
+bool
+push_protobuf_add_lazy_submessage(const char *message_name,
+                                  const char *field_name,
+                                  void *parent,
+                                  push_parser_t *parser,
+                                  push_protobuf_field_map_t *field_map,
+                                  push_protobuf_tag_number_t field_number,
+                                  push_protobuf_lazy_message_t *dest);
+
+
+#endif  /* PUSH_PROTOBUF_LAZY_H */
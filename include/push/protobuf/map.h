@@ -0,0 +1,255 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2010, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the LICENSE.txt file in this distribution for license
+ * details.
+ * ----------------------------------------------------------------------
+ */
+
+#ifndef PUSH_PROTOBUF_MAP_H
+#define PUSH_PROTOBUF_MAP_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <push/basics.h>
+#include <push/protobuf/basics.h>
+#include <push/protobuf/field-map.h>
+
+/**
+ * @file
+ *
+ * This file defines field map helpers for <code>map&lt;K,V&gt;</code>
+ * fields.  On the wire, a map field is a repeated submessage, each
+ * entry containing a key (field 1) and a value (field 2).  Rather
+ * than parsing each entry into a struct and inserting it into a hash
+ * table of your own, these helpers parse the entries directly into a
+ * push_protobuf_map_t, which is an open-addressing hash table whose
+ * string keys and values live in an arena that the table owns.
+ *
+ * Like the repeated helpers, these never clear their destination;
+ * call push_protobuf_map_clear before parsing each message.  Clearing
+ * a map keeps its memory around, so once it has grown to fit a
+ * typical message, parsing doesn't allocate.
+ */
+
+
+/**
+ * How the keys or values of a map are encoded.
+ */
+
+typedef enum _push_protobuf_map_kind
+{
+    /**
+     * <code>int32</code>, <code>int64</code>, <code>uint32</code>,
+     * <code>uint64</code>, <code>bool</code>, and enums.  Stored as
+     * the raw varint, so negative <code>int32</code>s and
+     * <code>int64</code>s are sign-extended to 64 bits.
+     */
+
+    PUSH_PROTOBUF_MAP_VARINT,
+
+    /**
+     * <code>sint32</code> and <code>sint64</code>.  Stored zigzag
+     * decoded, as a two's-complement 64-bit value.
+     */
+
+    PUSH_PROTOBUF_MAP_SVARINT,
+
+    /**
+     * <code>fixed32</code>, <code>sfixed32</code>, and
+     * <code>float</code>.  Stored as the raw 32 bits.
+     */
+
+    PUSH_PROTOBUF_MAP_FIXED32,
+
+    /**
+     * <code>fixed64</code>, <code>sfixed64</code>, and
+     * <code>double</code>.  Stored as the raw 64 bits.
+     */
+
+    PUSH_PROTOBUF_MAP_FIXED64,
+
+    /**
+     * <code>string</code> and <code>bytes</code>.  Stored in the
+     * map's arena, with a NUL terminator.
+     */
+
+    PUSH_PROTOBUF_MAP_STRING,
+
+    /**
+     * Submessages.  Only valid for values; see
+     * push_protobuf_add_map_submessage.
+     */
+
+    PUSH_PROTOBUF_MAP_MESSAGE
+
+} push_protobuf_map_kind_t;
+
+
+/**
+ * A key or value in a map.
+ */
+
+typedef struct _push_protobuf_map_value
+{
+    /**
+     * The value of an integer or fixed-width key or value.
+     */
+
+    uint64_t  integer;
+
+    /**
+     * The contents of a string key or value, or the struct that a
+     * submessage value was parsed into.  This points into the map's
+     * arena, and is only valid until the next entry is added to the
+     * map.
+     */
+
+    const void  *data;
+
+    /**
+     * The length of a string, not including the NUL terminator, or
+     * the size of a submessage's struct.
+     */
+
+    size_t  size;
+
+} push_protobuf_map_value_t;
+
+
+/**
+ * A map, as an open-addressing hash table.
+ */
+
+typedef struct _push_protobuf_map  push_protobuf_map_t;
+
+
+/**
+ * Create a new, empty map.  A map's keys can't be submessages.
+ */
+
+push_protobuf_map_t *
+push_protobuf_map_new(void *parent,
+                      push_protobuf_map_kind_t key_kind,
+                      push_protobuf_map_kind_t value_kind);
+
+
+/**
+ * Remove all of the entries from a map, keeping its memory around
+ * for the next message.
+ */
+
+void
+push_protobuf_map_clear(push_protobuf_map_t *map);
+
+
+/**
+ * Make sure that a map can hold at least count entries without
+ * growing its hash table.
+ *
+ * @return <code>false</code> if we can't allocate the memory.
+ */
+
+bool
+push_protobuf_map_reserve(push_protobuf_map_t *map, size_t count);
+
+
+/**
+ * Return the number of entries in a map.
+ */
+
+size_t
+push_protobuf_map_count(const push_protobuf_map_t *map);
+
+
+/**
+ * Get one of the entries in a map.  Entries are numbered from 0 in
+ * the order that their keys first appeared.
+ *
+ * @return <code>false</code> if index is out of range.
+ */
+
+bool
+push_protobuf_map_get(const push_protobuf_map_t *map,
+                      size_t index,
+                      push_protobuf_map_value_t *key,
+                      push_protobuf_map_value_t *value);
+
+
+/**
+ * Look up the value for an integer or fixed-width key.  For an
+ * SVARINT map, key should be the signed value, cast to
+ * <code>uint64_t</code>.
+ *
+ * @return <code>false</code> if the key isn't in the map.
+ */
+
+bool
+push_protobuf_map_find_integer(const push_protobuf_map_t *map,
+                               uint64_t key,
+                               push_protobuf_map_value_t *value);
+
+
+/**
+ * Look up the value for a string key.
+ *
+ * @return <code>false</code> if the key isn't in the map.
+ */
+
+bool
+push_protobuf_map_find_string(const push_protobuf_map_t *map,
+                              const void *key,
+                              size_t size,
+                              push_protobuf_map_value_t *value);
+
+
+/**
+ * Add a new map field, whose values are scalars or strings, to a
+ * field map.  Each entry is added to dest; if its key is already in
+ * dest, its value replaces the old one.  The size of the first entry,
+ * and how much of the surrounding message is left when it starts, are
+ * used to estimate how many entries there are, and dest's hash table
+ * is sized accordingly up front.  (Only the part of the message that
+ * has already arrived counts towards the estimate.)
+ *
+ * @return <code>false</code> if we cannot add the new field.
+ */
+
+bool
+push_protobuf_add_map(const char *message_name,
+                      const char *field_name,
+                      void *parent,
+                      push_parser_t *parser,
+                      push_protobuf_field_map_t *field_map,
+                      push_protobuf_tag_number_t field_number,
+                      push_protobuf_map_t *dest);
+
+
+/**
+ * Add a new map field, whose values are submessages, to a field map.
+ * The message callback should parse each value into element, which
+ * is a struct of element_size bytes.  Before each entry is parsed,
+ * element is cleared to all zeroes; afterwards, it's copied into
+ * dest's arena.  dest's value kind must be PUSH_PROTOBUF_MAP_MESSAGE.
+ *
+ * @return <code>false</code> if we cannot add the new field.
+ */
+
+bool
+push_protobuf_add_map_submessage(const char *message_name,
+                                 const char *field_name,
+                                 void *parent,
+                                 push_parser_t *parser,
+                                 push_protobuf_field_map_t *field_map,
+                                 push_protobuf_tag_number_t field_number,
+                                 push_callback_t *message,
+                                 void *element,
+                                 size_t element_size,
+                                 push_protobuf_map_t *dest);
+
+
+#endif  /* PUSH_PROTOBUF_MAP_H */
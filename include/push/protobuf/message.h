@@ -24,7 +24,9 @@
 /**
  * Create a new callback for reading a Protocol Buffer message.  The
  * new callback will use the field callbacks in field_map to read the
- * fields of the message.
+ * fields of the message.  Each field counts towards the parser's
+ * max_field_count limit; if it's exceeded, the callback fails with
+ * PUSH_PARSE_ERROR.
  */
 
 push_callback_t *
@@ -34,4 +36,23 @@ push_protobuf_message_new(const char *name,
                           push_protobuf_field_map_t *field_map);
 
 
+/**
+ * Create a new callback for reading the fields of a group.  The
+ * callback should be activated just after the group's START_GROUP
+ * tag; it uses the field callbacks in field_map to read each field,
+ * and succeeds once it reads the END_GROUP tag for field_number.  Any
+ * other END_GROUP tag is a parse error.  The field map belongs to
+ * the group callback, and can't be shared with any other message or
+ * group.  A group counts towards the parser's max_depth limit, and
+ * each of its fields towards max_field_count.
+ */
+
+push_callback_t *
+push_protobuf_group_new(const char *name,
+                        void *parent,
+                        push_parser_t *parser,
+                        push_protobuf_field_map_t *field_map,
+                        push_protobuf_tag_number_t field_number);
+
+
 #endif  /* PUSH_PROTOBUF_MESSAGE_H */
@@ -14,6 +14,8 @@
 #include <hwm-buffer.h>
 
 #include <push/basics.h>
+#include <push/intern.h>
+#include <push/primitives.h>
 
 
 /**
@@ -28,6 +30,64 @@ push_protobuf_hwm_string_new(const char *name,
                              hwm_buffer_t *buf);
 
 
+/**
+ * Create a new callback that reads a length-prefixed Protocol Buffer
+ * string, avoiding a copy if the string is contained entirely in the
+ * current data chunk.  The result will be a pointer to a
+ * push_string_view_t; see push_hwm_string_view_new for details.
+ */
+
+push_callback_t *
+push_protobuf_hwm_string_view_new(const char *name,
+                                  void *parent,
+                                  push_parser_t *parser,
+                                  hwm_buffer_t *buf);
+
+
+/**
+ * Create a new callback that reads a length-prefixed Protocol Buffer
+ * string and interns it.  See push_interned_string_new for details.
+ */
+
+push_callback_t *
+push_protobuf_interned_string_new(const char *name,
+                                  void *parent,
+                                  push_parser_t *parser,
+                                  hwm_buffer_t *buf,
+                                  push_intern_table_t *table);
+
+
+/**
+ * Create a new callback that streams a length-prefixed Protocol
+ * Buffer string to a sink function, without buffering it.  See
+ * push_string_sink_new for details.
+ */
+
+push_callback_t *
+push_protobuf_string_sink_new(const char *name,
+                              void *parent,
+                              push_parser_t *parser,
+                              push_string_sink_func_t *sink,
+                              void *sink_user_data);
+
+
+/**
+ * Create a new callback that skips over a Protocol Buffers field of
+ * any wire type.  The callback's input should be a pointer to the
+ * field's tag, as a push_protobuf_tag_t; the tag itself should
+ * already have been read.  Varints are skipped by scanning for their
+ * last byte without decoding them, fixed-width and length-delimited
+ * values are skipped in constant time within a chunk, and groups are
+ * skipped by scanning the tags they contain, keeping track of
+ * nesting.
+ */
+
+push_callback_t *
+push_protobuf_skip_field_new(const char *name,
+                             void *parent,
+                             push_parser_t *parser);
+
+
 /**
  * Create a new callback that skips over a length-prefixed Protocol
  * Buffers field.
@@ -75,4 +135,28 @@ push_protobuf_varint_size_new(const char *name,
                               push_parser_t *parser);
 
 
+/**
+ * Create a new callback for parsing a little-endian 32-bit value
+ * (the FIXED32 wire type).  The result pointer will point at the
+ * parsed value, stored as a uint32_t.
+ */
+
+push_callback_t *
+push_protobuf_fixed32_new(const char *name,
+                          void *parent,
+                          push_parser_t *parser);
+
+
+/**
+ * Create a new callback for parsing a little-endian 64-bit value
+ * (the FIXED64 wire type).  The result pointer will point at the
+ * parsed value, stored as a uint64_t.
+ */
+
+push_callback_t *
+push_protobuf_fixed64_new(const char *name,
+                          void *parent,
+                          push_parser_t *parser);
+
+
 #endif  /* PUSH_PROTOBUF_PRIMITIVES_H */
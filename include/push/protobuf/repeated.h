@@ -0,0 +1,338 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2010, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the LICENSE.txt file in this distribution for license
+ * details.
+ * ----------------------------------------------------------------------
+ */
+
+#ifndef PUSH_PROTOBUF_REPEATED_H
+#define PUSH_PROTOBUF_REPEATED_H
+
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include <hwm-buffer.h>
+
+#include <push/basics.h>
+#include <push/protobuf/basics.h>
+#include <push/protobuf/field-map.h>
+
+/**
+ * @file
+ *
+ * This file defines field map helpers for repeated fields.  Each
+ * occurrence of the field appends a new element to an array, rather
+ * than overwriting the previous value.  The arrays are
+ * HWM buffers, so they grow geometrically and their elements are
+ * always contiguous.  Like the packed helpers, these never clear
+ * their destination; call hwm_buffer_clear (or
+ * push_protobuf_string_list_clear) before parsing each message.
+ */
+
+
+/**
+ * A list of strings, for repeated <code>string</code> and
+ * <code>bytes</code> fields.  Every string is stored back to back in
+ * a single buffer, each followed by a NUL terminator.
+ */
+
+typedef struct _push_protobuf_string_list
+{
+    /**
+     * The contents of the strings.
+     */
+
+    hwm_buffer_t  data;
+
+    /**
+     * The offset of each string within data, as a
+     * <code>size_t</code>.
+     */
+
+    hwm_buffer_t  offsets;
+
+} push_protobuf_string_list_t;
+
+
+/**
+ * Initialize a new, empty string list.
+ */
+
+void
+push_protobuf_string_list_init(push_protobuf_string_list_t *list);
+
+
+/**
+ * Free the memory used by a string list.
+ */
+
+void
+push_protobuf_string_list_done(push_protobuf_string_list_t *list);
+
+
+/**
+ * Remove all of the strings from a string list, keeping its memory
+ * around for the next message.
+ */
+
+void
+push_protobuf_string_list_clear(push_protobuf_string_list_t *list);
+
+
+/**
+ * Return the number of strings in a string list.
+ */
+
+#define push_protobuf_string_list_count(list)                          \
+    (hwm_buffer_current_list_size(&(list)->offsets, size_t))
+
+
+/**
+ * Return a pointer to one of the strings in a string list.  The
+ * string is NUL-terminated; if size isn't NULL, it's filled in with
+ * the string's length, not counting the terminator.  The pointer is
+ * only valid until the next string is added to the list.
+ */
+
+const char *
+push_protobuf_string_list_get(const push_protobuf_string_list_t *list,
+                              size_t index,
+                              size_t *size);
+
+
+/**
+ * Add a new repeated <code>string</code> or <code>bytes</code> field
+ * to a field map.  Each value is appended to dest.
+ *
+ * @return <code>false</code> if we cannot add the new field.
+ */
+
+bool
+push_protobuf_add_repeated_string(const char *message_name,
+                                  const char *field_name,
+                                  void *parent,
+                                  push_parser_t *parser,
+                                  push_protobuf_field_map_t *field_map,
+                                  push_protobuf_tag_number_t field_number,
+                                  push_protobuf_string_list_t *dest);
+
+
+/**
+ * Add a new repeated submessage field to a field map.  The message
+ * callback should parse each submessage into element, which is a
+ * struct of element_size bytes.  Before each submessage is parsed,
+ * element is cleared to all zeroes; afterwards, it's copied onto the
+ * end of dest, which is treated as an array of these structs.
+ *
+ * Since the element is cleared rather than reused, any HWM buffers
+ * that the submessage fills in start out empty (a zeroed
+ * hwm_buffer_t is an initialized one), and each array element ends
+ * up owning its own copy of them.  The caller is responsible for
+ * calling hwm_buffer_done on them once it's finished with the array.
+ *
+ * @return <code>false</code> if we cannot add the new field.
+ */
+
+bool
+push_protobuf_add_repeated_submessage
+    (const char *message_name,
+     const char *field_name,
+     void *parent,
+     push_parser_t *parser,
+     push_protobuf_field_map_t *field_map,
+     push_protobuf_tag_number_t field_number,
+     push_callback_t *message,
+     void *element,
+     size_t element_size,
+     hwm_buffer_t *dest);
+
+
+/**
+ * Add a new repeated <code>uint32</code> field to a field map.  Each
+ * value is appended to dest as a <code>uint32_t</code>.  Like every
+ * repeated scalar field, this accepts elements that are packed into
+ * length-delimited runs, too, so it's the same as
+ * push_protobuf_add_packed_uint32.
+ *
+ * @return <code>false</code> if we cannot add the new field.
+ */
+
+bool
+push_protobuf_add_repeated_uint32(const char *message_name,
+                                  const char *field_name,
+                                  void *parent,
+                                  push_parser_t *parser,
+                                  push_protobuf_field_map_t *field_map,
+                                  push_protobuf_tag_number_t field_number,
+                                  hwm_buffer_t *dest);
+
+
+/**
+ * Add a new repeated <code>uint64</code> field to a field map.  Each
+ * value is appended to dest as a <code>uint64_t</code>.
+ */
+
+bool
+push_protobuf_add_repeated_uint64(const char *message_name,
+                                  const char *field_name,
+                                  void *parent,
+                                  push_parser_t *parser,
+                                  push_protobuf_field_map_t *field_map,
+                                  push_protobuf_tag_number_t field_number,
+                                  hwm_buffer_t *dest);
+
+
+/**
+ * Add a new repeated <code>int32</code> field to a field map.  Each
+ * value is appended to dest as a <code>int32_t</code>.
+ */
+
+bool
+push_protobuf_add_repeated_int32(const char *message_name,
+                                 const char *field_name,
+                                 void *parent,
+                                 push_parser_t *parser,
+                                 push_protobuf_field_map_t *field_map,
+                                 push_protobuf_tag_number_t field_number,
+                                 hwm_buffer_t *dest);
+
+
+/**
+ * Add a new repeated <code>int64</code> field to a field map.  Each
+ * value is appended to dest as a <code>int64_t</code>.
+ */
+
+bool
+push_protobuf_add_repeated_int64(const char *message_name,
+                                 const char *field_name,
+                                 void *parent,
+                                 push_parser_t *parser,
+                                 push_protobuf_field_map_t *field_map,
+                                 push_protobuf_tag_number_t field_number,
+                                 hwm_buffer_t *dest);
+
+
+/**
+ * Add a new repeated <code>sint32</code> field to a field map.  Each
+ * value is appended to dest as a <code>int32_t</code>.
+ */
+
+bool
+push_protobuf_add_repeated_sint32(const char *message_name,
+                                  const char *field_name,
+                                  void *parent,
+                                  push_parser_t *parser,
+                                  push_protobuf_field_map_t *field_map,
+                                  push_protobuf_tag_number_t field_number,
+                                  hwm_buffer_t *dest);
+
+
+/**
+ * Add a new repeated <code>sint64</code> field to a field map.  Each
+ * value is appended to dest as a <code>int64_t</code>.
+ */
+
+bool
+push_protobuf_add_repeated_sint64(const char *message_name,
+                                  const char *field_name,
+                                  void *parent,
+                                  push_parser_t *parser,
+                                  push_protobuf_field_map_t *field_map,
+                                  push_protobuf_tag_number_t field_number,
+                                  hwm_buffer_t *dest);
+
+
+/**
+ * Add a new repeated <code>fixed32</code> field to a field map.  Each
+ * value is appended to dest as a <code>uint32_t</code>.
+ */
+
+bool
+push_protobuf_add_repeated_fixed32(const char *message_name,
+                                   const char *field_name,
+                                   void *parent,
+                                   push_parser_t *parser,
+                                   push_protobuf_field_map_t *field_map,
+                                   push_protobuf_tag_number_t field_number,
+                                   hwm_buffer_t *dest);
+
+
+/**
+ * Add a new repeated <code>fixed64</code> field to a field map.  Each
+ * value is appended to dest as a <code>uint64_t</code>.
+ */
+
+bool
+push_protobuf_add_repeated_fixed64(const char *message_name,
+                                   const char *field_name,
+                                   void *parent,
+                                   push_parser_t *parser,
+                                   push_protobuf_field_map_t *field_map,
+                                   push_protobuf_tag_number_t field_number,
+                                   hwm_buffer_t *dest);
+
+
+/**
+ * Add a new repeated <code>sfixed32</code> field to a field map.  Each
+ * value is appended to dest as a <code>int32_t</code>.
+ */
+
+bool
+push_protobuf_add_repeated_sfixed32(const char *message_name,
+                                    const char *field_name,
+                                    void *parent,
+                                    push_parser_t *parser,
+                                    push_protobuf_field_map_t *field_map,
+                                    push_protobuf_tag_number_t field_number,
+                                    hwm_buffer_t *dest);
+
+
+/**
+ * Add a new repeated <code>sfixed64</code> field to a field map.  Each
+ * value is appended to dest as a <code>int64_t</code>.
+ */
+
+bool
+push_protobuf_add_repeated_sfixed64(const char *message_name,
+                                    const char *field_name,
+                                    void *parent,
+                                    push_parser_t *parser,
+                                    push_protobuf_field_map_t *field_map,
+                                    push_protobuf_tag_number_t field_number,
+                                    hwm_buffer_t *dest);
+
+
+/**
+ * Add a new repeated <code>float</code> field to a field map.  Each
+ * value is appended to dest as a <code>float</code>.
+ */
+
+bool
+push_protobuf_add_repeated_float(const char *message_name,
+                                 const char *field_name,
+                                 void *parent,
+                                 push_parser_t *parser,
+                                 push_protobuf_field_map_t *field_map,
+                                 push_protobuf_tag_number_t field_number,
+                                 hwm_buffer_t *dest);
+
+
+/**
+ * Add a new repeated <code>double</code> field to a field map.  Each
+ * value is appended to dest as a <code>double</code>.
+ */
+
+bool
+push_protobuf_add_repeated_double(const char *message_name,
+                                  const char *field_name,
+                                  void *parent,
+                                  push_parser_t *parser,
+                                  push_protobuf_field_map_t *field_map,
+                                  push_protobuf_tag_number_t field_number,
+                                  hwm_buffer_t *dest);
+
+
+#endif  /* PUSH_PROTOBUF_REPEATED_H */
@@ -0,0 +1,139 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2010, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the LICENSE.txt file in this distribution for license
+ * details.
+ * ----------------------------------------------------------------------
+ */
+
+#ifndef PUSH_PROTOBUF_UNKNOWN_H
+#define PUSH_PROTOBUF_UNKNOWN_H
+
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include <hwm-buffer.h>
+
+#include <push/basics.h>
+#include <push/protobuf/basics.h>
+#include <push/protobuf/field-map.h>
+
+/**
+ * @file
+ *
+ * This file defines a way to preserve the unknown fields of a
+ * message.  Normally, a message callback skips any field that isn't
+ * in its field map.  If the field map has been given a
+ * push_protobuf_unknown_fields_t (with
+ * push_protobuf_field_map_preserve_unknown), the message callback
+ * records each unknown field's tag and raw bytes instead, so that
+ * they can be written out again verbatim (with
+ * push_protobuf_encoder_add_unknown_fields, for instance) without
+ * parsing the message a second time.
+ */
+
+
+/**
+ * The unknown fields of a message, in the order that they appeared.
+ * Each field's bytes are its value exactly as it appeared on the
+ * wire, following the tag: a varint's bytes, a fixed-width value, a
+ * length prefix and its contents, or a group's contents and end tag.
+ *
+ * If a field's bytes were contained entirely in one data chunk, they
+ * point directly into that chunk, and are only valid for as long as
+ * the caller keeps that chunk around.  Otherwise they're copied into
+ * the data buffer.
+ *
+ * Unknown fields accumulate until the list is cleared, so it should
+ * be cleared (with push_protobuf_unknown_fields_clear) before parsing
+ * each message.
+ */
+
+struct _push_protobuf_unknown_fields
+{
+    /**
+     * Where each field is, as a list of unknown_field_t instances.
+     *
+     * @private
+     */
+
+    hwm_buffer_t  entries;
+
+    /**
+     * The bytes of any fields that straddled data chunks.
+     *
+     * @private
+     */
+
+    hwm_buffer_t  data;
+};
+
+
+/**
+ * Initialize a new, empty list of unknown fields.
+ */
+
+void
+push_protobuf_unknown_fields_init(push_protobuf_unknown_fields_t *fields);
+
+
+/**
+ * Free the memory used by a list of unknown fields.
+ */
+
+void
+push_protobuf_unknown_fields_done(push_protobuf_unknown_fields_t *fields);
+
+
+/**
+ * Remove all of the fields from a list of unknown fields, keeping its
+ * memory around for the next message.
+ */
+
+void
+push_protobuf_unknown_fields_clear(push_protobuf_unknown_fields_t *fields);
+
+
+/**
+ * Return the number of fields in a list of unknown fields.
+ */
+
+size_t
+push_protobuf_unknown_fields_count
+    (const push_protobuf_unknown_fields_t *fields);
+
+
+/**
+ * Return the raw bytes of one of the unknown fields in a list, and
+ * fill in its tag and the number of bytes.  Returns NULL if index is
+ * out of range.  If the bytes were copied, the pointer is only valid
+ * until the next field is added to the list.
+ */
+
+const void *
+push_protobuf_unknown_fields_get
+    (const push_protobuf_unknown_fields_t *fields,
+     size_t index,
+     push_protobuf_tag_t *tag,
+     size_t *size);
+
+
+/**
+ * Create a new callback that reads an unknown field of any wire
+ * type, and records it in dest.  Like push_protobuf_skip_field_new,
+ * the callback's input should be a pointer to the field's tag, which
+ * should already have been read.  A message callback uses one of
+ * these in place of its skip callback if its field map is preserving
+ * unknown fields.
+ */
+
+push_callback_t *
+push_protobuf_unknown_field_new(const char *name,
+                                void *parent,
+                                push_parser_t *parser,
+                                push_protobuf_unknown_fields_t *dest);
+
+
+#endif  /* PUSH_PROTOBUF_UNKNOWN_H */
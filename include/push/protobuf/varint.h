@@ -0,0 +1,208 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2010, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the LICENSE.txt file in this distribution for license
+ * details.
+ * ----------------------------------------------------------------------
+ */
+
+#ifndef PUSH_PROTOBUF_VARINT_H
+#define PUSH_PROTOBUF_VARINT_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#if defined(__BMI2__)
+#include <immintrin.h>
+#endif
+
+#include <push/protobuf/basics.h>
+
+/**
+ * @file
+ *
+ * This file defines word-at-a-time varint decoding kernels.  Rather
+ * than looping over a varint one byte at a time, these kernels load
+ * eight bytes at once, find the terminating byte from the mask of
+ * continuation bits, and squeeze out the continuation bits with a
+ * few shifts (or a single <code>pext</code> instruction, if the
+ * compiler is targeting BMI2).
+ *
+ * The kernels are deliberately branch-light: on a realistic mix of
+ * value sizes, a per-byte (or even a single-byte) branch mispredicts
+ * often enough to dominate.  Callers whose input is almost entirely
+ * single-byte varints, like tags, should test for that case
+ * themselves before calling a kernel.
+ *
+ * The kernels read past the end of the varint, so the caller must
+ * guarantee that enough bytes are readable; see each function for
+ * the exact requirement.
+ */
+
+
+/**
+ * The continuation bit of each byte in a 64-bit word.
+ */
+
+#define PUSH_PROTOBUF_VARINT_CONT_BITS   UINT64_C(0x8080808080808080)
+
+/**
+ * The payload bits of each byte in a 64-bit word.
+ */
+
+#define PUSH_PROTOBUF_VARINT_VALUE_BITS  UINT64_C(0x7f7f7f7f7f7f7f7f)
+
+
+/**
+ * Load four bytes as a little-endian 32-bit word, without any
+ * alignment requirement.
+ */
+
+static inline uint32_t
+push_protobuf_load_le32(const void *buf)
+{
+    uint32_t  word;
+    memcpy(&word, buf, sizeof(uint32_t));
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+    word = __builtin_bswap32(word);
+#endif
+    return word;
+}
+
+
+/**
+ * Load eight bytes as a little-endian 64-bit word, without any
+ * alignment requirement.
+ */
+
+static inline uint64_t
+push_protobuf_load_le64(const void *buf)
+{
+    uint64_t  word;
+    memcpy(&word, buf, sizeof(uint64_t));
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+    word = __builtin_bswap64(word);
+#endif
+    return word;
+}
+
+
+/**
+ * Given a little-endian word containing the bytes of a varint, with
+ * every byte after the varint's last byte already cleared, squeeze
+ * the 7-bit payloads together into a single value.
+ */
+
+static inline uint64_t
+push_protobuf_varint_compact(uint64_t word)
+{
+#if defined(__BMI2__)
+    return _pext_u64(word, PUSH_PROTOBUF_VARINT_VALUE_BITS);
+#else
+    word &= PUSH_PROTOBUF_VARINT_VALUE_BITS;
+    word = ((word & UINT64_C(0x7f007f007f007f00)) >> 1) |
+            (word & UINT64_C(0x007f007f007f007f));
+    word = ((word & UINT64_C(0x3fff00003fff0000)) >> 2) |
+            (word & UINT64_C(0x00003fff00003fff));
+    word = ((word & UINT64_C(0x0fffffff00000000)) >> 4) |
+            (word & UINT64_C(0x000000000fffffff));
+    return word;
+#endif
+}
+
+
+/**
+ * Decode a single varint, using the first eight bytes of the word
+ * starting at buf.  There must be at least
+ * PUSH_PROTOBUF_MAX_VARINT_LENGTH readable bytes at buf, regardless
+ * of how long the varint actually is.  Bits beyond the 64th are
+ * discarded, just like in the byte-at-a-time decoder.
+ *
+ * @return the number of bytes in the varint, or 0 if there's no
+ * terminating byte within PUSH_PROTOBUF_MAX_VARINT_LENGTH bytes.
+ */
+
+static inline size_t
+push_protobuf_varint_decode(const void *buf, uint64_t *value)
+{
+    const uint8_t  *ibuf = (const uint8_t *) buf;
+    uint64_t  word = push_protobuf_load_le64(buf);
+    uint64_t  stop = ~word & PUSH_PROTOBUF_VARINT_CONT_BITS;
+    uint64_t  result;
+
+    if (stop != 0)
+    {
+        /*
+         * stop ^ (stop - 1) has every bit set up to and including
+         * the first stop bit, which is exactly the bytes of this
+         * varint.
+         */
+
+        *value = push_protobuf_varint_compact(word & (stop ^ (stop - 1)));
+        return (__builtin_ctzll(stop) >> 3) + 1;
+    }
+
+    /*
+     * The varint is longer than eight bytes, which only happens for
+     * very large (or negative) values.
+     */
+
+    result = push_protobuf_varint_compact(word);
+
+    result |= ((uint64_t) (ibuf[8] & 0x7f)) << 56;
+    if (ibuf[8] < 0x80)
+    {
+        *value = result;
+        return 9;
+    }
+
+    result |= ((uint64_t) ibuf[9]) << 63;
+    if (ibuf[9] < 0x80)
+    {
+        *value = result;
+        return 10;
+    }
+
+    return 0;
+}
+
+
+/**
+ * Return a mask with one bit for each of the 16 bytes starting at
+ * buf.  A bit is set if the corresponding byte is the last byte of a
+ * varint (i.e., its continuation bit is clear).  There must be at
+ * least 16 readable bytes at buf.
+ */
+
+static inline uint32_t
+push_protobuf_varint_stop_mask16(const void *buf)
+{
+#if defined(__SSE2__)
+    __m128i  bytes = _mm_loadu_si128((const __m128i *) buf);
+    return (~_mm_movemask_epi8(bytes)) & 0xffff;
+#else
+    const uint8_t  *ibuf = (const uint8_t *) buf;
+    uint64_t  lo = ~push_protobuf_load_le64(ibuf) &
+        PUSH_PROTOBUF_VARINT_CONT_BITS;
+    uint64_t  hi = ~push_protobuf_load_le64(ibuf + 8) &
+        PUSH_PROTOBUF_VARINT_CONT_BITS;
+
+    /*
+     * Gather the eight stop bits of each word into a single byte.
+     */
+
+    lo = ((lo >> 7) * UINT64_C(0x0102040810204080)) >> 56;
+    hi = ((hi >> 7) * UINT64_C(0x0102040810204080)) >> 56;
+    return (uint32_t) (lo | (hi << 8));
+#endif
+}
+
+
+#endif  /* PUSH_PROTOBUF_VARINT_H */
@@ -18,7 +18,11 @@
  * @file
  *
  * This file defines a macro for creating parser callbacks from pure C
- * functions.
+ * functions.  A pure function returns <code>false</code> if it fails;
+ * by default, the callback then throws a parse error.  The
+ * <code>_with_error</code> variants throw the error code and message
+ * that you give instead; for instance, PUSH_MEMORY_ERROR for a
+ * pure function that can only fail if it can't allocate memory.
  */
 
 
@@ -27,6 +31,16 @@
                                        input_t,                 \
                                        output_t,                \
                                        user_data_t)             \
+    push_define_pure_data_callback_with_error                   \
+        (new_func, pure_func, default_name,                     \
+         input_t, output_t, user_data_t,                        \
+         PUSH_PARSE_ERROR, "Pure function failed")
+
+
+#define push_define_pure_data_callback_with_error(              \
+    new_func, pure_func, default_name,                          \
+    input_t, output_t, user_data_t,                             \
+    error_code, error_message)                                  \
     typedef struct _##new_func                                  \
     {                                                           \
         push_callback_t  callback;                              \
@@ -50,8 +64,8 @@
             return;                                             \
         } else {                                                \
             push_continuation_call(pure->callback.error,        \
-                                   PUSH_PARSE_ERROR,            \
-                                   "Pure function failed");     \
+                                   error_code,                  \
+                                   error_message);              \
             return;                                             \
         }                                                       \
     }                                                           \
@@ -86,6 +100,16 @@
                                   input_t,                      \
                                   output_t,                     \
                                   user_data_t)                  \
+    push_define_pure_callback_with_error                        \
+        (new_func, pure_func, default_name,                     \
+         input_t, output_t, user_data_t,                        \
+         PUSH_PARSE_ERROR, "Pure function failed")
+
+
+#define push_define_pure_callback_with_error(                   \
+    new_func, pure_func, default_name,                          \
+    input_t, output_t, user_data_t,                             \
+    error_code, error_message)                                  \
     typedef struct _##new_func                                  \
     {                                                           \
         push_callback_t  callback;                              \
@@ -109,8 +133,8 @@
             return;                                             \
         } else {                                                \
             push_continuation_call(pure->callback.error,        \
-                                   PUSH_PARSE_ERROR,            \
-                                   "Pure function failed");     \
+                                   error_code,                  \
+                                   error_message);              \
             return;                                             \
         }                                                       \
     }                                                           \
@@ -30,28 +30,25 @@ typedef struct _fold
     push_callback_t  callback;
 
     /**
-     * An incomplete continuation that “remembers” when the wrapped
-     * callback generates an incomplete.  This is used to select
-     * between our two error continuations — the first turns wrapped
-     * parse errors into fold successes, the second keeps them as
-     * parse errors.
+     * An incomplete continuation that checks whether the wrapped
+     * callback has seen any data during this iteration.  If it
+     * hasn't, then an EOF before the next chunk is the clean end of
+     * the fold's input.
      */
 
     push_incomplete_continuation_t  remember_incomplete;
 
     /**
      * A continue continuation that is called after empty initial data
-     * chunks.  These don't count towards the “no parse errors after
-     * incompletes” rule, but we have to keep the first_chunk field up
-     * to date in this case.
+     * chunks.  If it receives an EOF, the fold succeeds; otherwise it
+     * passes the data on to the wrapped callback.
      */
 
     push_continue_continuation_t  continue_after_empty;
 
     /**
-     * An error continuation that catches a wrapped parse error.  If
-     * the wrapped callback hasn't returned an incomplete yet, then
-     * this turns into a success for the fold.
+     * An error continuation that passes on any error from the
+     * wrapped callback.
      */
 
     push_error_continuation_t  wrapped_error;
@@ -62,13 +59,6 @@ typedef struct _fold
 
     push_callback_t  *wrapped;
 
-    /**
-     * Whether the wrapped callback has returned an incomplete during
-     * this iteration.
-     */
-
-    bool  wrapped_incomplete;
-
     /**
      * The wrapped callback's continue continuation.  This is used to
      * actually process the data during our own continue_after_empty
@@ -78,28 +68,18 @@ typedef struct _fold
     push_continue_continuation_t  *wrapped_cont;
 
     /**
-     * A saved copy of the most recent result.  While we're in the
-     * middle of trying the next iteration, we might generate a new
-     * result.  If the next iteration fails, then we need to return
-     * the result that we had before trying the iteration.
+     * A saved copy of the most recent result.  If we reach EOF in
+     * between iterations, this is the result of the fold.
      */
 
     void  *last_result;
 
     /**
-     * A pointer to the first data chunk of each iteration.  If the
-     * wrapped callback fails during this chunk, then the overall fold
-     * succeeds, and we have to pass this initial chunk on to our
-     * success continuation.
+     * Whether the wrapped callback has received any data during this
+     * iteration.
      */
 
-    const void  *first_chunk;
-
-    /**
-     * The length of first_chunk.
-     */
-
-    size_t  first_size;
+    bool  has_data;
 
 } fold_t;
 
@@ -123,20 +103,7 @@ fold_activate(void *user_data,
                    result);
     fold->last_result = result;
 
-    /*
-     * This is the start of a new iteration, so the wrapped callback
-     * hasn't returned an incomplete yet.
-     */
-
-    fold->wrapped_incomplete = false;
-
-    /*
-     * Before calling the wrapped callback, save this initial chunk of
-     * data, in case we need to pass it on during a successful result.
-     */
-
-    fold->first_chunk = buf;
-    fold->first_size = bytes_remaining;
+    fold->has_data = (bytes_remaining > 0);
 
     PUSH_DEBUG_MSG("%s: Activating wrapped callback "
                    "with %zu bytes.\n",
@@ -158,52 +125,31 @@ fold_remember_incomplete(void *user_data,
     fold_t  *fold = (fold_t *) user_data;
 
     /*
-     * If the wrapped callback has already returned an incomplete,
-     * just pass on the continue continuation.
-     */
-
-    if (fold->wrapped_incomplete)
-    {
-        push_continuation_call(fold->callback.incomplete, cont);
-
-        return;
-    }
-
-    /*
-     * If we reach this continuation, then the wrapped callback
-     * generated an incomplete.  Assuming that the first chunk of data
-     * isn't empty, then the wrapped callback is no longer allowed to
-     * generate a parse error.  If it does, then the fold generates a
-     * parse error, as well.
+     * If the wrapped callback has already seen some data during this
+     * iteration, then it's in the middle of parsing something, and an
+     * EOF is its business, not ours.  Just pass on the continue
+     * continuation.
      */
 
-    if (fold->first_size > 0)
+    if (fold->has_data)
     {
-        PUSH_DEBUG_MSG("%s: Wrapped callback is incomplete.  "
-                       "It can no longer generate a parse error.\n",
+        PUSH_DEBUG_MSG("%s: Wrapped callback is incomplete.\n",
                        push_talloc_get_name(fold));
 
-        fold->wrapped_incomplete = true;
-
-        /*
-         * Pass on the incomplete.
-         */
-
         push_continuation_call(fold->callback.incomplete, cont);
 
         return;
     }
 
     /*
-     * If the first chunk of data was empty (which can happen when the
-     * callback is first activated), then it doesn't count towards the
-     * “no parse errors after incompletes” rule.  We have to register
-     * our own continue continuation, though, since we have to keep
-     * that first_chunk field up to date.
+     * Otherwise, the wrapped callback hasn't gotten any data yet
+     * (which happens when it's activated at the end of a chunk), so
+     * if the next chunk is an EOF, the fold is finished.  We have to
+     * register our own continue continuation to check for this.
      */
 
     PUSH_DEBUG_MSG("%s: Wrapped callback is incomplete, "
-                   "but first data chunk is empty.\n",
+                   "but hasn't seen any data yet.\n",
                    push_talloc_get_name(fold));
 
     fold->wrapped_cont = cont;
@@ -223,10 +169,8 @@ fold_continue_after_empty(void *user_data,
     fold_t  *fold = (fold_t *) user_data;
 
     /*
-     * If we reach this continuation, we've only gotten empty data
-     * chunks so far, so they didn't count towards the “no parse
-     * errors after incompletes” rule.  If we don't have any data,
-     * then this is an EOF in between iterations, which is allowed.
+     * If we don't have any data, then this is an EOF in between
+     * iterations, which is the clean end of the fold's input.
      */
 
     if (bytes_remaining == 0)
@@ -243,9 +187,8 @@ fold_continue_after_empty(void *user_data,
     }
 
     /*
-     * If we do have data, we want to pass this data on to the wrapped
-     * callback, but we need to keep the first_chunk field up to date
-     * before we do so.
+     * If we do have data, we pass it on to the wrapped callback,
+     * which now has something to parse.
      */
 
     PUSH_DEBUG_MSG("%s: Continuing wrapped callback with "
@@ -253,8 +196,7 @@ fold_continue_after_empty(void *user_data,
                    push_talloc_get_name(fold),
                    bytes_remaining);
 
-    fold->first_chunk = buf;
-    fold->first_size = bytes_remaining;
+    fold->has_data = true;
 
     push_continuation_call(fold->wrapped_cont, buf, bytes_remaining);
 
@@ -270,43 +212,15 @@ fold_wrapped_error(void *user_data,
     fold_t  *fold = (fold_t *) user_data;
 
     /*
-     * If we reach this continuation, then the wrapped callback
-     * generated an error in its initial data chunk.  If this is a
-     * parse error, and the wrapped callback hasn't returned an
-     * incomplete yet, then the fold succeeds, and we use the last
-     * successful result as the fold's result.
+     * The only way for the fold to end successfully is an EOF in
+     * between iterations, which fold_continue_after_empty takes care
+     * of.  Any error from the wrapped callback is an error for the
+     * fold, too.
      */
 
-    if (error_code == PUSH_PARSE_ERROR)
-    {
-        if (fold->wrapped_incomplete)
-        {
-            PUSH_DEBUG_MSG("%s: Parse error after incomplete.  "
-                           "Fold results in a parse error!\n",
-                           push_talloc_get_name(fold));
-
-            push_continuation_call(fold->callback.error,
-                                   PUSH_PARSE_ERROR,
-                                   "Parse error in fold after incomplete");
-
-            return;
-        } else {
-            PUSH_DEBUG_MSG("%s: Parse error.  Fold succeeds with "
-                           "previous result.\n",
-                           push_talloc_get_name(fold));
-
-            push_continuation_call(fold->callback.success,
-                                   fold->last_result,
-                                   fold->first_chunk,
-                                   fold->first_size);
-
-            return;
-        }
-    }
-
-    /*
-     * We pass on any other error as-is.
-     */
+    PUSH_DEBUG_MSG("%s: Wrapped callback failed.  "
+                   "Fold fails, too.\n",
+                   push_talloc_get_name(fold));
 
     push_continuation_call(fold->callback.error,
                            error_code, error_message);
@@ -380,9 +294,8 @@ push_fold_new(const char *name,
     /*
      * If the wrapped callback succeeds, it should reactivate the fold
      * to start the next iteration.  If it incompletes, then we need
-     * to remember this so that we can ensure that it doesn't generate
-     * a parse error after that.  If it errors, we need to check for
-     * parse errors and possibly turn those into a fold success.
+     * to check whether an EOF would end the fold cleanly.  If it
+     * errors, we pass the error on.
      */
 
     push_continuation_call(&fold->wrapped->set_success,
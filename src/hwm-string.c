@@ -49,9 +49,55 @@ typedef struct _hwm_string
 
     size_t  bytes_left;
 
+    /**
+     * Whether we produce a push_string_view_t result, which is
+     * allowed to point directly into the data chunk, instead of a
+     * pointer to the HWM buffer's contents.
+     */
+
+    bool  view;
+
+    /**
+     * The view result, if we're in view mode.
+     */
+
+    push_string_view_t  result;
+
 } hwm_string_t;
 
 
+/**
+ * Pass the contents of the HWM buffer on to the success continuation.
+ * The buffer should already be NUL-terminated.
+ */
+
+static void
+hwm_string_succeed(hwm_string_t *hwm_string,
+                   void *str,
+                   const void *buf,
+                   size_t bytes_remaining)
+{
+    if (hwm_string->view)
+    {
+        /*
+         * Don't count the NUL terminator in the view's size.
+         */
+
+        hwm_string->result.buf = str;
+        hwm_string->result.size = hwm_string->buf->current_size - 1;
+        hwm_string->result.copied = true;
+
+        push_continuation_call(hwm_string->callback.success,
+                               &hwm_string->result,
+                               buf, bytes_remaining);
+    } else {
+        push_continuation_call(hwm_string->callback.success,
+                               str,
+                               buf, bytes_remaining);
+    }
+}
+
+
 static void
 hwm_string_continue(void *user_data,
                     const void *buf,
@@ -69,7 +115,7 @@ hwm_string_continue(void *user_data,
     {
         if (hwm_string->bytes_left == 0)
         {
-            void  *str;
+            uint8_t  *str;
 
             /*
              * In most cases, we'll have already returned PUSH_SUCCESS
@@ -86,7 +132,25 @@ hwm_string_continue(void *user_data,
              * Get a pointer to the HWM buffer's contents.
              */
 
-            str = hwm_buffer_writable_mem(hwm_string->buf, void);
+            if (hwm_string->view)
+            {
+                /*
+                 * In view mode, an empty string doesn't need the HWM
+                 * buffer at all.
+                 */
+
+                hwm_string->result.buf = NULL;
+                hwm_string->result.size = 0;
+                hwm_string->result.copied = false;
+
+                push_continuation_call(hwm_string->callback.success,
+                                       &hwm_string->result,
+                                       buf, bytes_remaining);
+
+                return;
+            }
+
+            str = hwm_buffer_writable_mem(hwm_string->buf, uint8_t);
             if (str == NULL)
             {
                 PUSH_DEBUG_MSG("%s: Cannot get pointer to buffer.\n",
@@ -122,6 +186,36 @@ hwm_string_continue(void *user_data,
         }
     }
 
+    /*
+     * In view mode, if the rest of the string is in this chunk, and
+     * we haven't had to copy any earlier pieces of it, we can point
+     * directly into the chunk without copying anything.
+     */
+
+    if (hwm_string->view &&
+        (hwm_string->buf->current_size == 0) &&
+        (bytes_remaining >= hwm_string->bytes_left))
+    {
+        PUSH_DEBUG_MSG("%s: String is contiguous; "
+                       "returning a view of %zu bytes.\n",
+                       push_talloc_get_name(hwm_string),
+                       hwm_string->bytes_left);
+
+        hwm_string->result.buf = buf;
+        hwm_string->result.size = hwm_string->bytes_left;
+        hwm_string->result.copied = false;
+
+        buf += hwm_string->bytes_left;
+        bytes_remaining -= hwm_string->bytes_left;
+        hwm_string->bytes_left = 0;
+
+        push_continuation_call(hwm_string->callback.success,
+                               &hwm_string->result,
+                               buf, bytes_remaining);
+
+        return;
+    }
+
     /*
      * Make sure we don't copy more data than is available, or more
      * data than we need.
@@ -197,11 +291,7 @@ hwm_string_continue(void *user_data,
          * Our result is the pointer to the buffer contents.
          */
 
-
-        push_continuation_call(hwm_string->callback.success,
-                               str,
-                               buf, bytes_remaining);
-
+        hwm_string_succeed(hwm_string, str, buf, bytes_remaining);
         return;
     }
 
@@ -248,10 +338,16 @@ hwm_string_activate(void *user_data,
     /*
      * Since we know in advance how big the string will need to be,
      * preallocate enough space for it.  Include an extra byte for the
-     * NUL terminator.
+     * NUL terminator.  In view mode, we skip this when the whole
+     * string is already in the current chunk, since we won't copy it.
      */
 
-    if (hwm_buffer_ensure_size(hwm_string->buf, (*input_size) + 1))
+    if (hwm_string->view && (bytes_remaining >= *input_size))
+    {
+        PUSH_DEBUG_MSG("%s: String is in the current chunk; "
+                       "not allocating.\n",
+                       push_talloc_get_name(hwm_string));
+    } else if (hwm_buffer_ensure_size(hwm_string->buf, (*input_size) + 1))
     {
         PUSH_DEBUG_MSG("%s: Successfully allocated %zu bytes.\n",
                        push_talloc_get_name(hwm_string),
@@ -293,11 +389,12 @@ hwm_string_activate(void *user_data,
 }
 
 
-push_callback_t *
-push_hwm_string_new(const char *name,
-                    void *parent,
-                    push_parser_t *parser,
-                    hwm_buffer_t *buf)
+static push_callback_t *
+inner_hwm_string_new(const char *name,
+                     void *parent,
+                     push_parser_t *parser,
+                     hwm_buffer_t *buf,
+                     bool view)
 {
     hwm_string_t  *hwm_string = push_talloc(parent, hwm_string_t);
 
@@ -309,12 +406,11 @@ push_hwm_string_new(const char *name,
      */
 
     hwm_string->buf = buf;
+    hwm_string->view = view;
 
     /*
      * Initialize the push_callback_t instance.
      */
-
-    if (name == NULL) name = "hwm-string";
     push_talloc_set_name_const(hwm_string, name);
 
     push_callback_init(&hwm_string->callback, parser, hwm_string,
@@ -332,3 +428,25 @@ push_hwm_string_new(const char *name,
 
     return &hwm_string->callback;
 }
+
+
+push_callback_t *
+push_hwm_string_new(const char *name,
+                    void *parent,
+                    push_parser_t *parser,
+                    hwm_buffer_t *buf)
+{
+    if (name == NULL) name = "hwm-string";
+    return inner_hwm_string_new(name, parent, parser, buf, false);
+}
+
+
+push_callback_t *
+push_hwm_string_view_new(const char *name,
+                         void *parent,
+                         push_parser_t *parser,
+                         hwm_buffer_t *buf)
+{
+    if (name == NULL) name = "hwm-string-view";
+    return inner_hwm_string_new(name, parent, parser, buf, true);
+}
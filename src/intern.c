@@ -0,0 +1,340 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2010, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the LICENSE.txt file in this distribution for license
+ * details.
+ * ----------------------------------------------------------------------
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <hwm-buffer.h>
+
+#include <push/basics.h>
+#include <push/combinators.h>
+#include <push/intern.h>
+#include <push/primitives.h>
+#include <push/pure.h>
+#include <push/talloc.h>
+
+
+/*-----------------------------------------------------------------------
+ * Interning table
+ */
+
+/**
+ * One slot in an interning table's hash table.
+ */
+
+typedef struct _intern_entry
+{
+    /**
+     * The canonical copy of the string, or <code>NULL</code> if this
+     * slot is empty.
+     */
+
+    char  *str;
+
+    /**
+     * The length of the string, not including the NUL terminator.
+     */
+
+    size_t  size;
+
+    /**
+     * The hash of the string.  We compare this before comparing the
+     * contents.
+     */
+
+    uint32_t  hash;
+
+} intern_entry_t;
+
+
+struct _push_intern_table
+{
+    /**
+     * The hash table.  We use open addressing with linear probing.
+     * The number of slots is a power of two, and at least twice the
+     * maximum number of entries, so that probe sequences stay short
+     * and always end at an empty slot.
+     */
+
+    intern_entry_t  *entries;
+
+    /**
+     * The number of slots, minus one.
+     */
+
+    size_t  mask;
+
+    /**
+     * The number of distinct strings in the table.
+     */
+
+    size_t  size;
+
+    /**
+     * The maximum number of distinct strings in the table.
+     */
+
+    size_t  max_entries;
+};
+
+
+/**
+ * The FNV-1a hash function.
+ */
+
+static uint32_t
+intern_hash(const void *buf, size_t size)
+{
+    const uint8_t  *bytes = (const uint8_t *) buf;
+    uint32_t  hash = 2166136261U;
+    size_t  i;
+
+    for (i = 0; i < size; i++)
+    {
+        hash ^= bytes[i];
+        hash *= 16777619U;
+    }
+
+    return hash;
+}
+
+
+push_intern_table_t *
+push_intern_table_new(void *parent, size_t max_entries)
+{
+    push_intern_table_t  *table;
+    size_t  num_slots;
+
+    if (max_entries == 0)
+        return NULL;
+
+    /*
+     * The slot array has up to 4 * max_entries slots.  Refuse any
+     * size where that would overflow; otherwise the doubling below
+     * could wrap around to 0 and never finish.
+     */
+
+    if (max_entries > SIZE_MAX / 4 / sizeof(intern_entry_t))
+        return NULL;
+
+    table = push_talloc(parent, push_intern_table_t);
+    if (table == NULL)
+        return NULL;
+
+    push_talloc_set_name_const(table, "intern-table");
+
+    num_slots = 16;
+    while (num_slots < 2 * max_entries)
+        num_slots *= 2;
+
+    table->entries = push_talloc_zero_array(table, intern_entry_t,
+                                            num_slots);
+    if (table->entries == NULL)
+    {
+        push_talloc_free(table);
+        return NULL;
+    }
+
+    table->mask = num_slots - 1;
+    table->size = 0;
+    table->max_entries = max_entries;
+
+    return table;
+}
+
+
+const char *
+push_intern_table_lookup(push_intern_table_t *table,
+                         const void *buf,
+                         size_t size)
+{
+    uint32_t  hash = intern_hash(buf, size);
+    size_t  index = hash & table->mask;
+    intern_entry_t  *entry;
+
+    /*
+     * Probe until we find the string or an empty slot.
+     */
+
+    for (entry = &table->entries[index];
+         entry->str != NULL;
+         entry = &table->entries[index])
+    {
+        if ((entry->hash == hash) &&
+            (entry->size == size) &&
+            (memcmp(entry->str, buf, size) == 0))
+        {
+            return entry->str;
+        }
+
+        index = (index + 1) & table->mask;
+    }
+
+    /*
+     * The string isn't in the table.  Add it, if there's room.
+     */
+
+    if (table->size >= table->max_entries)
+        return NULL;
+
+    entry->str = push_talloc_size(table, size + 1);
+    if (entry->str == NULL)
+        return NULL;
+
+    memcpy(entry->str, buf, size);
+    entry->str[size] = '\0';
+    entry->size = size;
+    entry->hash = hash;
+    table->size++;
+
+    return entry->str;
+}
+
+
+size_t
+push_intern_table_size(push_intern_table_t *table)
+{
+    return table->size;
+}
+
+
+/*-----------------------------------------------------------------------
+ * Interned string callback
+ */
+
+/**
+ * The user data for the pure function that interns a string view.
+ */
+
+typedef struct _intern_data
+{
+    /**
+     * The interning table.
+     */
+
+    push_intern_table_t  *table;
+
+    /**
+     * The buffer to copy the string into if the table is full.
+     */
+
+    hwm_buffer_t  *buf;
+
+} intern_data_t;
+
+
+static bool
+intern(intern_data_t *data,
+       push_string_view_t *input,
+       char **output)
+{
+    const char  *str;
+
+    str = push_intern_table_lookup(data->table,
+                                   input->buf, input->size);
+
+    if (str != NULL)
+    {
+        *output = (char *) str;
+        return true;
+    }
+
+    /*
+     * The table is full.  If the view already points into the HWM
+     * buffer, it's NUL-terminated there, and we can use it as-is.
+     * Otherwise, copy it over.
+     */
+
+    if (!input->copied)
+    {
+        if (!hwm_buffer_ensure_size(data->buf, input->size + 1))
+            return false;
+
+        memcpy(hwm_buffer_writable_mem(data->buf, char),
+               input->buf, input->size);
+        hwm_buffer_writable_mem(data->buf, char)[input->size] = '\0';
+        data->buf->current_size = input->size + 1;
+    }
+
+    *output = hwm_buffer_writable_mem(data->buf, char);
+    return true;
+}
+
+push_define_pure_data_callback_with_error
+    (intern_new, intern, "intern",
+     push_string_view_t, char, intern_data_t,
+     PUSH_MEMORY_ERROR, "Cannot copy interned string");
+
+
+push_callback_t *
+push_interned_string_new(const char *name,
+                         void *parent,
+                         push_parser_t *parser,
+                         hwm_buffer_t *buf,
+                         push_intern_table_t *table)
+{
+    void  *context;
+    intern_data_t  *data = NULL;
+    push_callback_t  *read = NULL;
+    push_callback_t  *intern = NULL;
+    push_callback_t  *compose = NULL;
+
+    /*
+     * If the table is NULL, return NULL ourselves.
+     */
+
+    if (table == NULL)
+        return NULL;
+
+    /*
+     * Create a memory context for the objects we're about to create.
+     */
+
+    context = push_talloc_new(parent);
+    if (context == NULL) return NULL;
+
+    /*
+     * Create the callbacks.
+     */
+
+    if (name == NULL) name = "interned-string";
+
+    read = push_hwm_string_view_new
+        (push_talloc_asprintf(context, "%s.read", name),
+         context, parser, buf);
+    intern = intern_new
+        (push_talloc_asprintf(context, "%s.intern", name),
+         context, parser, &data);
+    compose = push_compose_new
+        (push_talloc_asprintf(context, "%s.compose", name),
+         context, parser, read, intern);
+
+    /*
+     * Because of NULL propagation, we only have to check the last
+     * result to see if everything was created okay.
+     */
+
+    if (compose == NULL) goto error;
+
+    data->table = table;
+    data->buf = buf;
+
+    return compose;
+
+  error:
+    /*
+     * Before returning, free any objects we created before the error.
+     */
+
+    push_talloc_free(context);
+    return NULL;
+}
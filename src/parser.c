@@ -140,6 +140,16 @@ push_parser_new(push_callback_t *callback)
                           parser_ignore,
                           result);
 
+    /*
+     * There aren't any limits until the caller sets some.
+     */
+
+    result->limits.max_depth = 0;
+    result->limits.max_message_bytes = 0;
+    result->limits.max_field_count = 0;
+    result->depth = 0;
+    result->field_count = 0;
+
     return result;
 }
 
@@ -158,6 +168,67 @@ push_parser_free(push_parser_t *parser)
 }
 
 
+void
+push_parser_set_limits(push_parser_t *parser,
+                       const push_parser_limits_t *limits)
+{
+    parser->limits = *limits;
+}
+
+
+const char *
+push_parser_check_value(const push_parser_t *parser,
+                        size_t size,
+                        size_t extra_depth)
+{
+    if ((parser->limits.max_message_bytes != 0) &&
+        (size > parser->limits.max_message_bytes))
+        return "Message too large";
+
+    if ((parser->limits.max_depth != 0) &&
+        (parser->depth + extra_depth >= parser->limits.max_depth))
+        return "Messages nested too deeply";
+
+    return NULL;
+}
+
+
+const char *
+push_parser_enter_value(push_parser_t *parser, size_t size)
+{
+    const char  *error_message;
+
+    error_message = push_parser_check_value(parser, size, 0);
+    if (error_message == NULL)
+        parser->depth++;
+
+    return error_message;
+}
+
+
+void
+push_parser_leave_value(push_parser_t *parser)
+{
+    parser->depth--;
+}
+
+
+bool
+push_parser_count_field(push_parser_t *parser)
+{
+    parser->field_count++;
+    return (parser->limits.max_field_count == 0) ||
+        (parser->field_count <= parser->limits.max_field_count);
+}
+
+
+void
+push_parser_reset_field_count(push_parser_t *parser)
+{
+    parser->field_count = 0;
+}
+
+
 void
 push_parser_set_callback(push_parser_t *parser,
                          push_callback_t *callback)
@@ -192,6 +263,13 @@ push_parser_activate(push_parser_t *parser,
     PUSH_DEBUG_MSG("parser: Activating with input pointer %p.\n",
                    input);
 
+    /*
+     * Start counting towards the limits from scratch.
+     */
+
+    parser->depth = 0;
+    parser->field_count = 0;
+
     /*
      * We activate the initial callback without any data.  In most
      * cases, this will cause it to return incomplete.
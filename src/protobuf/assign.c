@@ -11,6 +11,7 @@
 #include <inttypes.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <string.h>
 
 #include <push/basics.h>
 #include <push/combinators.h>
@@ -102,6 +103,58 @@ push_define_pure_callback(assign_sint64_new, assign_sint64, "assign",
 
 
 
+static bool
+assign_sfixed32(int32_t *dest, uint32_t *input, int32_t **output)
+{
+    *dest = *input;
+    *output = dest;
+    return true;
+}
+
+push_define_pure_callback(assign_sfixed32_new, assign_sfixed32, "assign",
+                          uint32_t, int32_t, int32_t);
+
+
+
+static bool
+assign_sfixed64(int64_t *dest, uint64_t *input, int64_t **output)
+{
+    *dest = *input;
+    *output = dest;
+    return true;
+}
+
+push_define_pure_callback(assign_sfixed64_new, assign_sfixed64, "assign",
+                          uint64_t, int64_t, int64_t);
+
+
+
+static bool
+assign_float(float *dest, uint32_t *input, float **output)
+{
+    memcpy(dest, input, sizeof(float));
+    *output = dest;
+    return true;
+}
+
+push_define_pure_callback(assign_float_new, assign_float, "assign",
+                          uint32_t, float, float);
+
+
+
+static bool
+assign_double(double *dest, uint64_t *input, double **output)
+{
+    memcpy(dest, input, sizeof(double));
+    *output = dest;
+    return true;
+}
+
+push_define_pure_callback(assign_double_new, assign_double, "assign",
+                          uint64_t, double, double);
+
+
+
 #define ADD_FIELD(ASSIGN, VALUE_STR, VALUE_CALLBACK_NEW,                \
                   DEST_STR, DEST_T, ASSIGN_NEW,                         \
                   TAG_TYPE)                                             \
@@ -225,3 +278,39 @@ ADD_FIELD(push_protobuf_assign_sint64,
           "varint64", push_protobuf_varint64_new,
           "int64", int64_t, assign_sint64_new,
           PUSH_PROTOBUF_TAG_TYPE_VARINT);
+
+
+ADD_FIELD(push_protobuf_assign_fixed32,
+          "fixed32", push_protobuf_fixed32_new,
+          "uint32", uint32_t, assign_uint32_new,
+          PUSH_PROTOBUF_TAG_TYPE_FIXED32);
+
+
+ADD_FIELD(push_protobuf_assign_fixed64,
+          "fixed64", push_protobuf_fixed64_new,
+          "uint64", uint64_t, assign_uint64_new,
+          PUSH_PROTOBUF_TAG_TYPE_FIXED64);
+
+
+ADD_FIELD(push_protobuf_assign_sfixed32,
+          "fixed32", push_protobuf_fixed32_new,
+          "int32", int32_t, assign_sfixed32_new,
+          PUSH_PROTOBUF_TAG_TYPE_FIXED32);
+
+
+ADD_FIELD(push_protobuf_assign_sfixed64,
+          "fixed64", push_protobuf_fixed64_new,
+          "int64", int64_t, assign_sfixed64_new,
+          PUSH_PROTOBUF_TAG_TYPE_FIXED64);
+
+
+ADD_FIELD(push_protobuf_assign_float,
+          "fixed32", push_protobuf_fixed32_new,
+          "float", float, assign_float_new,
+          PUSH_PROTOBUF_TAG_TYPE_FIXED32);
+
+
+ADD_FIELD(push_protobuf_assign_double,
+          "fixed64", push_protobuf_fixed64_new,
+          "double", double, assign_double_new,
+          PUSH_PROTOBUF_TAG_TYPE_FIXED64);
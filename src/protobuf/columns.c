@@ -0,0 +1,866 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2010, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the LICENSE.txt file in this distribution for license
+ * details.
+ * ----------------------------------------------------------------------
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <hwm-buffer.h>
+
+#include <push/basics.h>
+#include <push/combinators.h>
+#include <push/pure.h>
+#include <push/talloc.h>
+
+#include <push/protobuf/basics.h>
+#include <push/protobuf/columns.h>
+#include <push/protobuf/field-map.h>
+#include <push/protobuf/primitives.h>
+
+
+/*-----------------------------------------------------------------------
+ * Columns
+ */
+
+struct _push_protobuf_columns
+{
+    /**
+     * The number of finished rows.
+     */
+
+    size_t  row_count;
+
+    /**
+     * The columns, as an array of pointers.
+     */
+
+    hwm_buffer_t  columns;
+};
+
+
+struct _push_protobuf_column
+{
+    /**
+     * The set of columns that this column belongs to.
+     */
+
+    push_protobuf_columns_t  *columns;
+
+    /**
+     * The column's element type.
+     */
+
+    push_protobuf_column_type_t  type;
+
+    /**
+     * The size of each element of values.
+     */
+
+    size_t  width;
+
+    /**
+     * The column's elements.  For a string column, these are the
+     * offsets into data.  For other columns, this includes the
+     * current row's element once it has been set.
+     */
+
+    hwm_buffer_t  values;
+
+    /**
+     * The contents of a string column.
+     */
+
+    hwm_buffer_t  data;
+
+    /**
+     * The validity bitmap.  This always includes the byte for the
+     * current row, once that row's element has been set.  Bytes are
+     * cleared when they're added to the bitmap, so only the bits of
+     * valid rows are ever set.
+     */
+
+    hwm_buffer_t  validity;
+
+    /**
+     * The number of finished rows that are null.
+     */
+
+    size_t  null_count;
+};
+
+
+static int
+columns_destructor(void *ptr)
+{
+    push_protobuf_columns_t  *columns = (push_protobuf_columns_t *) ptr;
+
+    hwm_buffer_done(&columns->columns);
+    return 0;
+}
+
+
+static int
+column_destructor(void *ptr)
+{
+    push_protobuf_column_t  *column = (push_protobuf_column_t *) ptr;
+
+    hwm_buffer_done(&column->values);
+    hwm_buffer_done(&column->data);
+    hwm_buffer_done(&column->validity);
+    return 0;
+}
+
+
+push_protobuf_columns_t *
+push_protobuf_columns_new(void *parent)
+{
+    push_protobuf_columns_t  *columns;
+
+    columns = push_talloc(parent, push_protobuf_columns_t);
+    if (columns == NULL)
+        return NULL;
+
+    columns->row_count = 0;
+    hwm_buffer_init(&columns->columns);
+    push_talloc_set_destructor(columns, columns_destructor);
+
+    return columns;
+}
+
+
+/**
+ * Remove all of the rows from a column.  A string column always has
+ * one more offset than it has rows, so it starts off with a 0.
+ */
+
+static bool
+column_clear(push_protobuf_column_t *column)
+{
+    hwm_buffer_clear(&column->values);
+    hwm_buffer_clear(&column->data);
+    hwm_buffer_clear(&column->validity);
+    column->null_count = 0;
+
+    if (column->type == PUSH_PROTOBUF_COLUMN_STRING)
+    {
+        uint64_t  *offset =
+            hwm_buffer_append_list_elem(&column->values, uint64_t);
+
+        if (offset == NULL)
+            return false;
+
+        *offset = 0;
+    }
+
+    return true;
+}
+
+
+static inline push_protobuf_column_t **
+columns_list(push_protobuf_columns_t *columns, size_t *count)
+{
+    *count = hwm_buffer_current_list_size(&columns->columns,
+                                          push_protobuf_column_t *);
+    return hwm_buffer_writable_mem(&columns->columns,
+                                   push_protobuf_column_t *);
+}
+
+
+void
+push_protobuf_columns_clear(push_protobuf_columns_t *columns)
+{
+    push_protobuf_column_t  **list;
+    size_t  count;
+    size_t  i;
+
+    list = columns_list(columns, &count);
+    for (i = 0; i < count; i++)
+    {
+        /*
+         * The offsets buffer always has room for the first offset
+         * once the column has been created, so this can't fail.
+         */
+
+        column_clear(list[i]);
+    }
+
+    columns->row_count = 0;
+}
+
+
+size_t
+push_protobuf_columns_row_count(const push_protobuf_columns_t *columns)
+{
+    return columns->row_count;
+}
+
+
+static size_t
+column_width(push_protobuf_column_type_t type)
+{
+    switch (type)
+    {
+      case PUSH_PROTOBUF_COLUMN_INT32:
+      case PUSH_PROTOBUF_COLUMN_UINT32:
+      case PUSH_PROTOBUF_COLUMN_FLOAT:
+        return sizeof(uint32_t);
+
+      case PUSH_PROTOBUF_COLUMN_BOOL:
+        return sizeof(uint8_t);
+
+      default:
+        return sizeof(uint64_t);
+    }
+}
+
+
+static bool
+column_end_row(push_protobuf_column_t *column);
+
+
+/**
+ * Create a new column, and add it to a set of columns.  If the set
+ * already has rows, the new column is null in all of them.
+ */
+
+static push_protobuf_column_t *
+column_new(push_protobuf_columns_t *columns,
+           push_protobuf_column_type_t type)
+{
+    push_protobuf_column_t  *column;
+    push_protobuf_column_t  **slot;
+    size_t  row_count;
+    size_t  row;
+
+    column = push_talloc(columns, push_protobuf_column_t);
+    if (column == NULL)
+        return NULL;
+
+    column->columns = columns;
+    column->type = type;
+    column->width = column_width(type);
+    hwm_buffer_init(&column->values);
+    hwm_buffer_init(&column->data);
+    hwm_buffer_init(&column->validity);
+    push_talloc_set_destructor(column, column_destructor);
+
+    if (!column_clear(column))
+        goto error;
+
+    slot = hwm_buffer_append_list_elem(&columns->columns,
+                                       push_protobuf_column_t *);
+    if (slot == NULL)
+        goto error;
+
+    *slot = column;
+
+    /*
+     * Catch up with any rows that have already been finished.  We
+     * temporarily rewind the row count so that the end-of-row logic
+     * can fill in the nulls.
+     */
+
+    row_count = columns->row_count;
+
+    for (row = 0; row < row_count; row++)
+    {
+        bool  ok;
+
+        columns->row_count = row;
+        ok = column_end_row(column);
+        columns->row_count = row_count;
+
+        if (!ok)
+        {
+            columns->columns.current_size -=
+                sizeof(push_protobuf_column_t *);
+            goto error;
+        }
+    }
+
+    return column;
+
+  error:
+    push_talloc_free(column);
+    return NULL;
+}
+
+
+/**
+ * Make sure that the validity bitmap includes the byte for the given
+ * row, clearing any bytes that we add.
+ */
+
+static inline bool
+column_extend_validity(push_protobuf_column_t *column, size_t row)
+{
+    size_t  size = row / 8 + 1;
+    size_t  old_size = column->validity.current_size;
+
+    if (old_size >= size)
+        return true;
+
+    if (!hwm_buffer_ensure_size(&column->validity, size))
+        return false;
+
+    memset(hwm_buffer_writable_mem(&column->validity, uint8_t) + old_size,
+           0, size - old_size);
+    column->validity.current_size = size;
+    return true;
+}
+
+
+static inline bool
+column_is_set(const push_protobuf_column_t *column, size_t row)
+{
+    const uint8_t  *bitmap = hwm_buffer_mem(&column->validity, uint8_t);
+
+    return
+        (column->validity.current_size > row / 8) &&
+        ((bitmap[row / 8] & (1 << (row % 8))) != 0);
+}
+
+
+/**
+ * Mark the current row as valid.
+ */
+
+static inline bool
+column_set_valid(push_protobuf_column_t *column)
+{
+    size_t  row = column->columns->row_count;
+
+    if (!column_extend_validity(column, row))
+        return false;
+
+    hwm_buffer_writable_mem(&column->validity, uint8_t)[row / 8] |=
+        (1 << (row % 8));
+    return true;
+}
+
+
+/**
+ * Store the current row's element of a fixed-width column.
+ */
+
+static inline bool
+column_set(push_protobuf_column_t *column, const void *value)
+{
+    size_t  row = column->columns->row_count;
+    size_t  size = (row + 1) * column->width;
+
+    if (!hwm_buffer_ensure_size(&column->values, size))
+        return false;
+
+    memcpy(hwm_buffer_writable_mem(&column->values, uint8_t) +
+           row * column->width,
+           value, column->width);
+    column->values.current_size = size;
+
+    return column_set_valid(column);
+}
+
+
+/**
+ * Finish the current row of one column.
+ */
+
+static bool
+column_end_row(push_protobuf_column_t *column)
+{
+    size_t  row = column->columns->row_count;
+    bool  valid = column_is_set(column, row);
+
+    if (!valid)
+    {
+        column->null_count++;
+
+        if (!column_extend_validity(column, row))
+            return false;
+    }
+
+    if (column->type == PUSH_PROTOBUF_COLUMN_STRING)
+    {
+        uint64_t  *offset;
+
+        /*
+         * A null row has an empty value.
+         */
+
+        if (!valid)
+        {
+            column->data.current_size =
+                hwm_buffer_mem(&column->values, uint64_t)[row];
+        }
+
+        offset = hwm_buffer_append_list_elem(&column->values, uint64_t);
+        if (offset == NULL)
+            return false;
+
+        *offset = column->data.current_size;
+    }
+
+    else if (!valid)
+    {
+        size_t  size = (row + 1) * column->width;
+
+        if (!hwm_buffer_ensure_size(&column->values, size))
+            return false;
+
+        memset(hwm_buffer_writable_mem(&column->values, uint8_t) +
+               row * column->width,
+               0, column->width);
+        column->values.current_size = size;
+    }
+
+    return true;
+}
+
+
+bool
+push_protobuf_columns_end_row(push_protobuf_columns_t *columns)
+{
+    push_protobuf_column_t  **list;
+    size_t  count;
+    size_t  i;
+
+    list = columns_list(columns, &count);
+    for (i = 0; i < count; i++)
+    {
+        if (!column_end_row(list[i]))
+            return false;
+    }
+
+    columns->row_count++;
+    return true;
+}
+
+
+bool
+push_protobuf_columns_sink(void *user_data,
+                           void *messages,
+                           size_t count)
+{
+    push_protobuf_columns_t  *columns =
+        (push_protobuf_columns_t *) user_data;
+
+    return push_protobuf_columns_end_row(columns);
+}
+
+
+push_protobuf_column_type_t
+push_protobuf_column_type(const push_protobuf_column_t *column)
+{
+    return column->type;
+}
+
+
+const void *
+push_protobuf_column_values(const push_protobuf_column_t *column)
+{
+    return hwm_buffer_mem(&column->values, void);
+}
+
+
+const uint8_t *
+push_protobuf_column_data(const push_protobuf_column_t *column)
+{
+    if (column->type != PUSH_PROTOBUF_COLUMN_STRING)
+        return NULL;
+
+    return hwm_buffer_mem(&column->data, uint8_t);
+}
+
+
+const uint8_t *
+push_protobuf_column_validity(const push_protobuf_column_t *column)
+{
+    return hwm_buffer_mem(&column->validity, uint8_t);
+}
+
+
+size_t
+push_protobuf_column_null_count(const push_protobuf_column_t *column)
+{
+    return column->null_count;
+}
+
+
+bool
+push_protobuf_column_is_valid(const push_protobuf_column_t *column,
+                              size_t row)
+{
+    if (row >= column->columns->row_count)
+        return false;
+
+    return column_is_set(column, row);
+}
+
+
+/*-----------------------------------------------------------------------
+ * Field callbacks
+ */
+
+static bool
+column_raw32(push_protobuf_column_t *column,
+             uint32_t *input, uint32_t **output)
+{
+    *output = input;
+    return column_set(column, input);
+}
+
+push_define_pure_callback(column_raw32_new, column_raw32, "column",
+                          uint32_t, uint32_t, push_protobuf_column_t);
+
+
+static bool
+column_raw64(push_protobuf_column_t *column,
+             uint64_t *input, uint64_t **output)
+{
+    *output = input;
+    return column_set(column, input);
+}
+
+push_define_pure_callback(column_raw64_new, column_raw64, "column",
+                          uint64_t, uint64_t, push_protobuf_column_t);
+
+
+static bool
+column_zigzag32(push_protobuf_column_t *column,
+                uint32_t *input, uint32_t **output)
+{
+    int32_t  value = PUSH_PROTOBUF_ZIGZAG_DECODE32(*input);
+
+    *output = input;
+    return column_set(column, &value);
+}
+
+push_define_pure_callback(column_zigzag32_new, column_zigzag32, "column",
+                          uint32_t, uint32_t, push_protobuf_column_t);
+
+
+static bool
+column_zigzag64(push_protobuf_column_t *column,
+                uint64_t *input, uint64_t **output)
+{
+    int64_t  value = PUSH_PROTOBUF_ZIGZAG_DECODE64(*input);
+
+    *output = input;
+    return column_set(column, &value);
+}
+
+push_define_pure_callback(column_zigzag64_new, column_zigzag64, "column",
+                          uint64_t, uint64_t, push_protobuf_column_t);
+
+
+static bool
+column_bool(push_protobuf_column_t *column,
+            uint32_t *input, uint32_t **output)
+{
+    uint8_t  value = (*input != 0);
+
+    *output = input;
+    return column_set(column, &value);
+}
+
+push_define_pure_callback(column_bool_new, column_bool, "column",
+                          uint32_t, uint32_t, push_protobuf_column_t);
+
+
+/**
+ * Start the current row's value of a string column.  If the field
+ * already appeared in this message, its earlier value is discarded.
+ */
+
+static bool
+column_begin_string(push_protobuf_column_t *column,
+                    void *input, void **output)
+{
+    size_t  row = column->columns->row_count;
+
+    column->data.current_size =
+        hwm_buffer_mem(&column->values, uint64_t)[row];
+
+    *output = input;
+    return column_set_valid(column);
+}
+
+push_define_pure_callback(column_begin_string_new, column_begin_string,
+                          "column-begin", void, void,
+                          push_protobuf_column_t);
+
+
+static bool
+column_append_string(void *user_data, const void *buf, size_t size)
+{
+    push_protobuf_column_t  *column = (push_protobuf_column_t *) user_data;
+
+    if (size == 0)
+        return true;
+
+    return hwm_buffer_append_mem(&column->data, buf, size);
+}
+
+
+/**
+ * A function that creates the callback that reads a column's field
+ * and stores it into the column.
+ */
+
+typedef push_callback_t *
+column_field_new_t(const char *name,
+                   void *parent,
+                   push_parser_t *parser,
+                   push_protobuf_column_t *column);
+
+
+#define DEFINE_SCALAR_FIELD(FIELD_NEW, VALUE_STR, VALUE_CALLBACK_NEW,   \
+                            STORE_NEW)                                  \
+static push_callback_t *                                                \
+FIELD_NEW(const char *name,                                             \
+          void *parent,                                                 \
+          push_parser_t *parser,                                        \
+          push_protobuf_column_t *column)                               \
+{                                                                       \
+    push_callback_t  *value;                                            \
+    push_callback_t  *store;                                            \
+                                                                        \
+    value = VALUE_CALLBACK_NEW                                          \
+        (push_talloc_asprintf(parent, "%s." VALUE_STR, name),           \
+         parent, parser);                                               \
+    store = STORE_NEW                                                   \
+        (push_talloc_asprintf(parent, "%s.column", name),               \
+         parent, parser, column);                                       \
+    return push_compose_new                                             \
+        (push_talloc_asprintf(parent, "%s.compose", name),              \
+         parent, parser, value, store);                                 \
+}
+
+DEFINE_SCALAR_FIELD(raw32_varint_field_new,
+                    "varint32", push_protobuf_varint32_new,
+                    column_raw32_new);
+
+DEFINE_SCALAR_FIELD(raw64_varint_field_new,
+                    "varint64", push_protobuf_varint64_new,
+                    column_raw64_new);
+
+DEFINE_SCALAR_FIELD(zigzag32_field_new,
+                    "varint32", push_protobuf_varint32_new,
+                    column_zigzag32_new);
+
+DEFINE_SCALAR_FIELD(zigzag64_field_new,
+                    "varint64", push_protobuf_varint64_new,
+                    column_zigzag64_new);
+
+DEFINE_SCALAR_FIELD(bool_field_new,
+                    "varint32", push_protobuf_varint32_new,
+                    column_bool_new);
+
+DEFINE_SCALAR_FIELD(raw32_fixed_field_new,
+                    "fixed32", push_protobuf_fixed32_new,
+                    column_raw32_new);
+
+DEFINE_SCALAR_FIELD(raw64_fixed_field_new,
+                    "fixed64", push_protobuf_fixed64_new,
+                    column_raw64_new);
+
+
+static push_callback_t *
+string_field_new(const char *name,
+                 void *parent,
+                 push_parser_t *parser,
+                 push_protobuf_column_t *column)
+{
+    push_callback_t  *begin;
+    push_callback_t  *value;
+
+    begin = column_begin_string_new
+        (push_talloc_asprintf(parent, "%s.begin", name),
+         parent, parser, column);
+    value = push_protobuf_string_sink_new
+        (push_talloc_asprintf(parent, "%s.sink", name),
+         parent, parser, column_append_string, column);
+    return push_compose_new
+        (push_talloc_asprintf(parent, "%s.compose", name),
+         parent, parser, begin, value);
+}
+
+
+static push_protobuf_column_t *
+add_column(const char *message_name,
+           const char *field_name,
+           void *parent,
+           push_parser_t *parser,
+           push_protobuf_field_map_t *field_map,
+           push_protobuf_tag_number_t field_number,
+           push_protobuf_columns_t *columns,
+           push_protobuf_column_type_t type,
+           push_protobuf_tag_type_t tag_type,
+           column_field_new_t *field_new)
+{
+    void  *context;
+    const char  *full_field_name;
+    push_protobuf_column_t  *column;
+    push_callback_t  *field;
+
+    /*
+     * If the field map or columns are NULL, return NULL.
+     */
+
+    if ((field_map == NULL) || (columns == NULL))
+        return NULL;
+
+    /*
+     * Create a memory context for the objects we're about to create.
+     */
+
+    context = push_talloc_new(parent);
+    if (context == NULL) return NULL;
+
+    /*
+     * Create the callbacks.
+     */
+
+    if (message_name == NULL) message_name = "message";
+    if (field_name == NULL) field_name = ".column";
+
+    full_field_name =
+        push_talloc_asprintf(context, "%s.%s",
+                             message_name, field_name);
+
+    column = column_new(columns, type);
+    if (column == NULL) goto error;
+
+    field = field_new(full_field_name, context, parser, column);
+
+    /*
+     * Because of NULL propagation, we only have to check the last
+     * result to see if everything was created okay.
+     */
+
+    if (field == NULL) goto error_column;
+
+    /*
+     * Try to add the new field.  If we can't, free the field before
+     * returning.
+     */
+
+    if (!push_protobuf_field_map_add_field
+        (full_field_name, parser,
+         field_map, field_number, tag_type, field))
+    {
+        goto error_column;
+    }
+
+    return column;
+
+  error_column:
+    /*
+     * The column is the last one in the set, so we can just drop it.
+     */
+
+    columns->columns.current_size -= sizeof(push_protobuf_column_t *);
+    push_talloc_free(column);
+
+  error:
+    /*
+     * Before returning, free any objects we created before the error.
+     */
+
+    push_talloc_free(context);
+    return NULL;
+}
+
+
+#define ADD_COLUMN(ADD, COLUMN_TYPE, TAG_TYPE, FIELD_NEW)               \
+push_protobuf_column_t *                                                \
+ADD(const char *message_name,                                           \
+    const char *field_name,                                             \
+    void *parent,                                                       \
+    push_parser_t *parser,                                              \
+    push_protobuf_field_map_t *field_map,                               \
+    push_protobuf_tag_number_t field_number,                            \
+    push_protobuf_columns_t *columns)                                   \
+{                                                                       \
+    return add_column(message_name, field_name, parent, parser,         \
+                      field_map, field_number, columns,                 \
+                      COLUMN_TYPE, TAG_TYPE, FIELD_NEW);                \
+}
+
+
+ADD_COLUMN(push_protobuf_add_int32_column,
+           PUSH_PROTOBUF_COLUMN_INT32,
+           PUSH_PROTOBUF_TAG_TYPE_VARINT,
+           raw32_varint_field_new);
+
+ADD_COLUMN(push_protobuf_add_int64_column,
+           PUSH_PROTOBUF_COLUMN_INT64,
+           PUSH_PROTOBUF_TAG_TYPE_VARINT,
+           raw64_varint_field_new);
+
+ADD_COLUMN(push_protobuf_add_uint32_column,
+           PUSH_PROTOBUF_COLUMN_UINT32,
+           PUSH_PROTOBUF_TAG_TYPE_VARINT,
+           raw32_varint_field_new);
+
+ADD_COLUMN(push_protobuf_add_uint64_column,
+           PUSH_PROTOBUF_COLUMN_UINT64,
+           PUSH_PROTOBUF_TAG_TYPE_VARINT,
+           raw64_varint_field_new);
+
+ADD_COLUMN(push_protobuf_add_sint32_column,
+           PUSH_PROTOBUF_COLUMN_INT32,
+           PUSH_PROTOBUF_TAG_TYPE_VARINT,
+           zigzag32_field_new);
+
+ADD_COLUMN(push_protobuf_add_sint64_column,
+           PUSH_PROTOBUF_COLUMN_INT64,
+           PUSH_PROTOBUF_TAG_TYPE_VARINT,
+           zigzag64_field_new);
+
+ADD_COLUMN(push_protobuf_add_fixed32_column,
+           PUSH_PROTOBUF_COLUMN_UINT32,
+           PUSH_PROTOBUF_TAG_TYPE_FIXED32,
+           raw32_fixed_field_new);
+
+ADD_COLUMN(push_protobuf_add_fixed64_column,
+           PUSH_PROTOBUF_COLUMN_UINT64,
+           PUSH_PROTOBUF_TAG_TYPE_FIXED64,
+           raw64_fixed_field_new);
+
+ADD_COLUMN(push_protobuf_add_sfixed32_column,
+           PUSH_PROTOBUF_COLUMN_INT32,
+           PUSH_PROTOBUF_TAG_TYPE_FIXED32,
+           raw32_fixed_field_new);
+
+ADD_COLUMN(push_protobuf_add_sfixed64_column,
+           PUSH_PROTOBUF_COLUMN_INT64,
+           PUSH_PROTOBUF_TAG_TYPE_FIXED64,
+           raw64_fixed_field_new);
+
+ADD_COLUMN(push_protobuf_add_float_column,
+           PUSH_PROTOBUF_COLUMN_FLOAT,
+           PUSH_PROTOBUF_TAG_TYPE_FIXED32,
+           raw32_fixed_field_new);
+
+ADD_COLUMN(push_protobuf_add_double_column,
+           PUSH_PROTOBUF_COLUMN_DOUBLE,
+           PUSH_PROTOBUF_TAG_TYPE_FIXED64,
+           raw64_fixed_field_new);
+
+ADD_COLUMN(push_protobuf_add_bool_column,
+           PUSH_PROTOBUF_COLUMN_BOOL,
+           PUSH_PROTOBUF_TAG_TYPE_VARINT,
+           bool_field_new);
+
+ADD_COLUMN(push_protobuf_add_string_column,
+           PUSH_PROTOBUF_COLUMN_STRING,
+           PUSH_PROTOBUF_TAG_TYPE_LENGTH_DELIMITED,
+           string_field_new);
@@ -0,0 +1,1806 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2010, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the LICENSE.txt file in this distribution for license
+ * details.
+ * ----------------------------------------------------------------------
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <hwm-buffer.h>
+
+#include <push/basics.h>
+#include <push/combinators.h>
+#include <push/primitives.h>
+#include <push/talloc.h>
+
+#include <push/protobuf/basics.h>
+#include <push/protobuf/combinators.h>
+#include <push/protobuf/dynamic.h>
+#include <push/protobuf/field-map.h>
+#include <push/protobuf/message.h>
+#include <push/protobuf/primitives.h>
+
+
+/*-----------------------------------------------------------------------
+ * Arenas
+ */
+
+/**
+ * The minimum size of each arena block.
+ */
+
+#define ARENA_BLOCK_SIZE  4096
+
+
+/**
+ * One block of memory in an arena.
+ */
+
+typedef struct _arena_block
+{
+    /**
+     * The next block in the arena.
+     */
+
+    struct _arena_block  *next;
+
+    /**
+     * The number of bytes in this block.
+     */
+
+    size_t  size;
+
+    /**
+     * The number of bytes that have been handed out from this block.
+     */
+
+    size_t  used;
+
+    /**
+     * The contents of the block.
+     */
+
+    uint64_t  data[];
+
+} arena_block_t;
+
+
+/**
+ * An arena that the values of a dynamic message are allocated from.
+ * Nothing is freed individually; instead, the whole arena is reset
+ * before parsing the next message.  The blocks are kept around, so
+ * that once the arena has grown to fit a typical message, parsing
+ * doesn't need to allocate any memory.
+ */
+
+typedef struct _arena
+{
+    /**
+     * The memory context that blocks are allocated in.
+     */
+
+    void  *context;
+
+    /**
+     * The first block in the arena.
+     */
+
+    arena_block_t  *first;
+
+    /**
+     * The block that we're currently allocating from.
+     */
+
+    arena_block_t  *current;
+
+} arena_t;
+
+
+static void
+arena_init(arena_t *arena, void *context)
+{
+    arena->context = context;
+    arena->first = NULL;
+    arena->current = NULL;
+}
+
+
+static void
+arena_reset(arena_t *arena)
+{
+    arena->current = arena->first;
+    if (arena->first != NULL)
+        arena->first->used = 0;
+}
+
+
+static void *
+arena_alloc(arena_t *arena, size_t size)
+{
+    arena_block_t  *block = arena->current;
+    size_t  block_size;
+    void  *result;
+
+    /*
+     * Keep everything 8-byte aligned.
+     */
+
+    size = (size + 7) & ~((size_t) 7);
+
+    if ((block != NULL) && (block->size - block->used >= size))
+        goto found;
+
+    /*
+     * Move on to any blocks that were allocated while parsing an
+     * earlier message.
+     */
+
+    while ((block != NULL) && (block->next != NULL))
+    {
+        block = block->next;
+        block->used = 0;
+
+        if (block->size >= size)
+            goto found;
+    }
+
+    /*
+     * If there aren't any that are big enough, allocate a new block
+     * at the end of the list.
+     */
+
+    block_size = (size > ARENA_BLOCK_SIZE)? size: ARENA_BLOCK_SIZE;
+
+    {
+        arena_block_t  *new_block =
+            push_talloc_size(arena->context,
+                             sizeof(arena_block_t) + block_size);
+
+        if (new_block == NULL)
+            return NULL;
+
+        new_block->next = NULL;
+        new_block->size = block_size;
+        new_block->used = 0;
+
+        if (block == NULL)
+            arena->first = new_block;
+        else
+            block->next = new_block;
+
+        block = new_block;
+    }
+
+  found:
+    arena->current = block;
+    result = ((uint8_t *) block->data) + block->used;
+    block->used += size;
+    return result;
+}
+
+
+/*-----------------------------------------------------------------------
+ * Descriptor pools
+ */
+
+typedef struct _dynamic_context  dynamic_context_t;
+typedef struct _instance  instance_t;
+
+
+struct _push_protobuf_descriptor_pool
+{
+    /**
+     * The message types in the pool, indexed by their index field.
+     */
+
+    const push_protobuf_message_descriptor_t  **messages;
+
+    /**
+     * The number of message types in the pool.
+     */
+
+    size_t  message_count;
+
+    /**
+     * The graph caches for each parser that uses this pool.
+     */
+
+    dynamic_context_t  *contexts;
+};
+
+
+/**
+ * The field map graphs that have been built for one pool and parser.
+ * It's allocated as a child of the parser, since the graphs are tied
+ * to the parser's continuations, and goes away if either the parser
+ * or the pool is freed.
+ */
+
+struct _dynamic_context
+{
+    /**
+     * The next context for the same pool.
+     */
+
+    dynamic_context_t  *next;
+
+    /**
+     * The pool that the message types come from.
+     */
+
+    push_protobuf_descriptor_pool_t  *pool;
+
+    /**
+     * The parser that the graphs belong to.
+     */
+
+    push_parser_t  *parser;
+
+    /**
+     * The arena of the dynamic message callback that's currently
+     * parsing.
+     */
+
+    arena_t  *arena;
+
+    /**
+     * Incremented each time a dynamic message callback starts a new
+     * top-level message.  Instances that were claimed in an earlier
+     * generation are free to use, even if that parse never finished.
+     */
+
+    unsigned int  generation;
+
+    /**
+     * The graphs that we've built for each message type, indexed by
+     * the message type's index.
+     */
+
+    instance_t  **instances;
+
+    /**
+     * The number of entries in instances.
+     */
+
+    size_t  instance_count;
+};
+
+
+static int
+pool_destructor(push_protobuf_descriptor_pool_t *pool)
+{
+    /*
+     * Each context removes itself from the list when it's freed.
+     */
+
+    while (pool->contexts != NULL)
+        push_talloc_free(pool->contexts);
+
+    return 0;
+}
+
+
+static int
+context_destructor(dynamic_context_t *context)
+{
+    dynamic_context_t  **prev = &context->pool->contexts;
+
+    while (*prev != NULL)
+    {
+        if (*prev == context)
+        {
+            *prev = context->next;
+            break;
+        }
+
+        prev = &(*prev)->next;
+    }
+
+    return 0;
+}
+
+
+push_protobuf_descriptor_pool_t *
+push_protobuf_descriptor_pool_new(void *parent)
+{
+    push_protobuf_descriptor_pool_t  *pool =
+        push_talloc(parent, push_protobuf_descriptor_pool_t);
+
+    if (pool == NULL)
+        return NULL;
+
+    pool->messages = NULL;
+    pool->message_count = 0;
+    pool->contexts = NULL;
+    push_talloc_set_destructor(pool, pool_destructor);
+    return pool;
+}
+
+
+/**
+ * Add a message type to a pool.  Its index must already be set to
+ * the current number of message types.
+ */
+
+static bool
+pool_add_message(push_protobuf_descriptor_pool_t *pool,
+                 const push_protobuf_message_descriptor_t *message)
+{
+    const push_protobuf_message_descriptor_t  **new_messages;
+
+    new_messages = push_talloc_realloc
+        (pool, pool->messages, const push_protobuf_message_descriptor_t *,
+         pool->message_count + 1);
+
+    if (new_messages == NULL)
+        return false;
+
+    new_messages[pool->message_count++] = message;
+    pool->messages = new_messages;
+    return true;
+}
+
+
+const push_protobuf_message_descriptor_t *
+push_protobuf_descriptor_pool_find_message
+    (push_protobuf_descriptor_pool_t *pool,
+     const char *full_name)
+{
+    size_t  i;
+
+    if (full_name[0] == '.')
+        full_name++;
+
+    for (i = 0; i < pool->message_count; i++)
+    {
+        if (strcmp(pool->messages[i]->full_name, full_name) == 0)
+            return pool->messages[i];
+    }
+
+    return NULL;
+}
+
+
+static dynamic_context_t *
+get_context(push_protobuf_descriptor_pool_t *pool,
+            push_parser_t *parser)
+{
+    dynamic_context_t  *context;
+
+    for (context = pool->contexts; context != NULL; context = context->next)
+    {
+        if (context->parser == parser)
+            return context;
+    }
+
+    context = push_talloc(parser, dynamic_context_t);
+    if (context == NULL)
+        return NULL;
+
+    context->pool = pool;
+    context->parser = parser;
+    context->arena = NULL;
+    context->generation = 0;
+    context->instances = NULL;
+    context->instance_count = 0;
+
+    context->next = pool->contexts;
+    pool->contexts = context;
+    push_talloc_set_destructor(context, context_destructor);
+
+    return context;
+}
+
+
+/*-----------------------------------------------------------------------
+ * Dynamic messages
+ */
+
+static push_protobuf_dynamic_message_t *
+message_new(arena_t *arena,
+            const push_protobuf_message_descriptor_t *descriptor)
+{
+    push_protobuf_dynamic_message_t  *message;
+    size_t  fields_size =
+        descriptor->field_count * sizeof(push_protobuf_dynamic_field_t);
+
+    message = arena_alloc(arena,
+                          sizeof(push_protobuf_dynamic_message_t) +
+                          fields_size);
+    if (message == NULL)
+        return NULL;
+
+    message->descriptor = descriptor;
+    message->fields = (push_protobuf_dynamic_field_t *) (message + 1);
+    memset(message->fields, 0, fields_size);
+    return message;
+}
+
+
+/**
+ * Get the value to fill in for a field.  For a repeated field, we
+ * always add a new value to the end of the list; for a singular
+ * field, we overwrite the existing value if there is one.  (The
+ * submessage callback doesn't overwrite a singular submessage; it
+ * merges into it instead.)
+ */
+
+static push_protobuf_dynamic_value_t *
+add_value(arena_t *arena,
+          push_protobuf_dynamic_field_t *field,
+          bool repeated)
+{
+    push_protobuf_dynamic_value_t  *value;
+
+    if (!repeated && (field->first != NULL))
+        return field->first;
+
+    value = arena_alloc(arena, sizeof(push_protobuf_dynamic_value_t));
+    if (value == NULL)
+        return NULL;
+
+    value->next = NULL;
+
+    if (field->last == NULL)
+        field->first = value;
+    else
+        field->last->next = value;
+
+    field->last = value;
+    field->count++;
+    return value;
+}
+
+
+const push_protobuf_dynamic_field_t *
+push_protobuf_dynamic_message_get_field
+    (const push_protobuf_dynamic_message_t *message,
+     push_protobuf_tag_number_t field_number)
+{
+    size_t  i;
+
+    for (i = 0; i < message->descriptor->field_count; i++)
+    {
+        if (message->descriptor->fields[i].number == field_number)
+            return &message->fields[i];
+    }
+
+    return NULL;
+}
+
+
+/*-----------------------------------------------------------------------
+ * Graph instances
+ */
+
+/**
+ * A field map graph that parses one message type.  There's usually
+ * one instance for each message type and parser; we only need more
+ * when a message type (directly or indirectly) contains itself, since
+ * a graph can't be used to parse two messages at once.
+ */
+
+struct _instance
+{
+    /**
+     * The next instance for the same message type.
+     */
+
+    instance_t  *next;
+
+    /**
+     * The context that this instance belongs to.
+     */
+
+    dynamic_context_t  *context;
+
+    /**
+     * The message type that this instance parses.
+     */
+
+    const push_protobuf_message_descriptor_t  *descriptor;
+
+    /**
+     * Whether the entry callback reads a length prefix first.  This
+     * is true for instances that parse submessages.
+     */
+
+    bool  prefixed;
+
+    /**
+     * Whether this instance is in the middle of parsing a message.
+     * Only meaningful if generation matches the context's.
+     */
+
+    bool  busy;
+
+    /**
+     * The context generation in which busy was set.
+     */
+
+    unsigned int  generation;
+
+    /**
+     * The callback that parses a message.
+     */
+
+    push_callback_t  *entry;
+
+    /**
+     * The callback that activated the entry callback.  Once the
+     * message is parsed, we continue using this callback's
+     * continuations.
+     */
+
+    push_callback_t  *owner;
+
+    /**
+     * The message that we're currently filling in.
+     */
+
+    push_protobuf_dynamic_message_t  *current;
+
+    /**
+     * A buffer for strings that straddle two or more data chunks.
+     */
+
+    hwm_buffer_t  scratch;
+
+    /**
+     * The continuations that the entry callback uses.
+     */
+
+    push_success_continuation_t  success;
+    push_incomplete_continuation_t  incomplete;
+    push_error_continuation_t  error;
+};
+
+
+static int
+instance_destructor(instance_t *instance)
+{
+    hwm_buffer_done(&instance->scratch);
+    return 0;
+}
+
+
+static void
+instance_success(void *user_data,
+                 void *result,
+                 const void *buf,
+                 size_t bytes_remaining)
+{
+    instance_t  *instance = (instance_t *) user_data;
+
+    instance->busy = false;
+    push_continuation_call(instance->owner->success,
+                           instance->current,
+                           buf, bytes_remaining);
+}
+
+
+static void
+instance_incomplete(void *user_data,
+                    push_continue_continuation_t *cont)
+{
+    instance_t  *instance = (instance_t *) user_data;
+
+    push_continuation_call(instance->owner->incomplete, cont);
+}
+
+
+static void
+instance_error(void *user_data,
+               push_error_code_t error_code,
+               const char *error_message)
+{
+    instance_t  *instance = (instance_t *) user_data;
+
+    instance->busy = false;
+    push_continuation_call(instance->owner->error,
+                           error_code, error_message);
+}
+
+
+/**
+ * The callback that stores a scalar, string, or bytes value into the
+ * current message of an instance.
+ */
+
+typedef struct _store
+{
+    push_callback_t  callback;
+    instance_t  *instance;
+    size_t  index;
+} store_t;
+
+
+static void
+store_activate(void *user_data,
+               void *result,
+               const void *buf,
+               size_t bytes_remaining)
+{
+    store_t  *store = (store_t *) user_data;
+    instance_t  *instance = store->instance;
+    const push_protobuf_field_descriptor_t  *field =
+        &instance->descriptor->fields[store->index];
+    arena_t  *arena = instance->context->arena;
+    push_protobuf_dynamic_value_t  *value;
+
+    value = add_value(arena, &instance->current->fields[store->index],
+                      field->label == PUSH_PROTOBUF_LABEL_REPEATED);
+    if (value == NULL)
+        goto memory_error;
+
+    switch (field->type)
+    {
+      case PUSH_PROTOBUF_TYPE_INT32:
+      case PUSH_PROTOBUF_TYPE_ENUM:
+        value->v.i32 = *(uint64_t *) result;
+        break;
+
+      case PUSH_PROTOBUF_TYPE_UINT32:
+        value->v.u32 = *(uint64_t *) result;
+        break;
+
+      case PUSH_PROTOBUF_TYPE_SINT32:
+        value->v.i32 =
+            PUSH_PROTOBUF_ZIGZAG_DECODE32((uint32_t) *(uint64_t *) result);
+        break;
+
+      case PUSH_PROTOBUF_TYPE_INT64:
+      case PUSH_PROTOBUF_TYPE_UINT64:
+      case PUSH_PROTOBUF_TYPE_FIXED64:
+      case PUSH_PROTOBUF_TYPE_SFIXED64:
+        value->v.u64 = *(uint64_t *) result;
+        break;
+
+      case PUSH_PROTOBUF_TYPE_SINT64:
+        value->v.i64 =
+            PUSH_PROTOBUF_ZIGZAG_DECODE64(*(uint64_t *) result);
+        break;
+
+      case PUSH_PROTOBUF_TYPE_BOOL:
+        value->v.b = (*(uint64_t *) result != 0);
+        break;
+
+      case PUSH_PROTOBUF_TYPE_FIXED32:
+      case PUSH_PROTOBUF_TYPE_SFIXED32:
+        value->v.u32 = *(uint32_t *) result;
+        break;
+
+      case PUSH_PROTOBUF_TYPE_FLOAT:
+        memcpy(&value->v.f, result, sizeof(float));
+        break;
+
+      case PUSH_PROTOBUF_TYPE_DOUBLE:
+        memcpy(&value->v.d, result, sizeof(double));
+        break;
+
+      case PUSH_PROTOBUF_TYPE_STRING:
+      case PUSH_PROTOBUF_TYPE_BYTES:
+        {
+            push_string_view_t  *view = (push_string_view_t *) result;
+            char  *data = arena_alloc(arena, view->size + 1);
+
+            if (data == NULL)
+                goto memory_error;
+
+            memcpy(data, view->buf, view->size);
+            data[view->size] = '\0';
+            value->v.bytes.data = data;
+            value->v.bytes.size = view->size;
+            break;
+        }
+
+      default:
+        break;
+    }
+
+    push_continuation_call(store->callback.success,
+                           value,
+                           buf, bytes_remaining);
+    return;
+
+  memory_error:
+    push_continuation_call(store->callback.error,
+                           PUSH_MEMORY_ERROR,
+                           "Cannot store field");
+}
+
+
+static push_callback_t *
+store_new(const char *name,
+          void *parent,
+          push_parser_t *parser,
+          instance_t *instance,
+          size_t index)
+{
+    store_t  *store = push_talloc(parent, store_t);
+
+    if (store == NULL)
+        return NULL;
+
+    push_talloc_set_name_const(store, name);
+    push_callback_init(&store->callback, parser, store,
+                       store_activate,
+                       NULL, NULL, NULL);
+
+    store->instance = instance;
+    store->index = index;
+    return &store->callback;
+}
+
+
+static instance_t *
+acquire_instance(dynamic_context_t *context,
+                 const push_protobuf_message_descriptor_t *descriptor,
+                 bool prefixed);
+
+
+/**
+ * The callback that reads a submessage field.  It claims an instance
+ * for the submessage type when it's activated, and hands the rest of
+ * the field over to it.
+ */
+
+typedef struct _submessage
+{
+    push_callback_t  callback;
+    instance_t  *instance;
+    size_t  index;
+} submessage_t;
+
+
+static void
+submessage_activate(void *user_data,
+                    void *result,
+                    const void *buf,
+                    size_t bytes_remaining)
+{
+    submessage_t  *submessage = (submessage_t *) user_data;
+    instance_t  *parent = submessage->instance;
+    const push_protobuf_field_descriptor_t  *field =
+        &parent->descriptor->fields[submessage->index];
+    push_protobuf_dynamic_field_t  *values =
+        &parent->current->fields[submessage->index];
+    arena_t  *arena = parent->context->arena;
+    instance_t  *child;
+    push_protobuf_dynamic_value_t  *value;
+    bool  repeated = (field->label == PUSH_PROTOBUF_LABEL_REPEATED);
+
+    child = acquire_instance(parent->context, field->message_type, true);
+    if (child == NULL)
+        goto memory_error;
+
+    if (!repeated && (values->first != NULL))
+    {
+        /*
+         * A singular submessage that appears more than once is merged
+         * with the earlier occurrences, so we keep filling in the
+         * existing message instead of starting a new one.
+         */
+
+        value = values->first;
+    } else {
+        value = add_value(arena, values, repeated);
+        if (value == NULL)
+            goto memory_error;
+
+        value->v.message = message_new(arena, field->message_type);
+        if (value->v.message == NULL)
+            goto memory_error;
+    }
+
+    child->current = value->v.message;
+    child->owner = &submessage->callback;
+
+    push_continuation_call(&child->entry->activate,
+                           NULL,
+                           buf, bytes_remaining);
+    return;
+
+  memory_error:
+    if (child != NULL)
+        child->busy = false;
+
+    push_continuation_call(submessage->callback.error,
+                           PUSH_MEMORY_ERROR,
+                           "Cannot store submessage");
+}
+
+
+static push_callback_t *
+submessage_new(const char *name,
+               void *parent,
+               push_parser_t *parser,
+               instance_t *instance,
+               size_t index)
+{
+    submessage_t  *submessage = push_talloc(parent, submessage_t);
+
+    if (submessage == NULL)
+        return NULL;
+
+    push_talloc_set_name_const(submessage, name);
+    push_callback_init(&submessage->callback, parser, submessage,
+                       submessage_activate,
+                       NULL, NULL, NULL);
+
+    submessage->instance = instance;
+    submessage->index = index;
+    return &submessage->callback;
+}
+
+
+/**
+ * Add the callbacks for one field of an instance's message type to
+ * its field map.
+ */
+
+static bool
+add_dynamic_field(void *context,
+                  push_parser_t *parser,
+                  push_protobuf_field_map_t *field_map,
+                  instance_t *instance,
+                  size_t index)
+{
+    const push_protobuf_field_descriptor_t  *field =
+        &instance->descriptor->fields[index];
+    const char  *full_field_name;
+    push_protobuf_tag_type_t  tag_type;
+    push_callback_t  *value;
+    push_callback_t  *callback;
+
+    full_field_name =
+        push_talloc_asprintf(context, "%s.%s",
+                             instance->descriptor->full_name,
+                             field->name);
+
+    switch (field->type)
+    {
+      case PUSH_PROTOBUF_TYPE_INT32:
+      case PUSH_PROTOBUF_TYPE_INT64:
+      case PUSH_PROTOBUF_TYPE_UINT32:
+      case PUSH_PROTOBUF_TYPE_UINT64:
+      case PUSH_PROTOBUF_TYPE_SINT32:
+      case PUSH_PROTOBUF_TYPE_SINT64:
+      case PUSH_PROTOBUF_TYPE_BOOL:
+      case PUSH_PROTOBUF_TYPE_ENUM:
+        tag_type = PUSH_PROTOBUF_TAG_TYPE_VARINT;
+        value = push_protobuf_varint64_new
+            (push_talloc_asprintf(context, "%s.varint64",
+                                  full_field_name),
+             context, parser);
+        break;
+
+      case PUSH_PROTOBUF_TYPE_FIXED32:
+      case PUSH_PROTOBUF_TYPE_SFIXED32:
+      case PUSH_PROTOBUF_TYPE_FLOAT:
+        tag_type = PUSH_PROTOBUF_TAG_TYPE_FIXED32;
+        value = push_protobuf_fixed32_new
+            (push_talloc_asprintf(context, "%s.fixed32",
+                                  full_field_name),
+             context, parser);
+        break;
+
+      case PUSH_PROTOBUF_TYPE_FIXED64:
+      case PUSH_PROTOBUF_TYPE_SFIXED64:
+      case PUSH_PROTOBUF_TYPE_DOUBLE:
+        tag_type = PUSH_PROTOBUF_TAG_TYPE_FIXED64;
+        value = push_protobuf_fixed64_new
+            (push_talloc_asprintf(context, "%s.fixed64",
+                                  full_field_name),
+             context, parser);
+        break;
+
+      case PUSH_PROTOBUF_TYPE_STRING:
+      case PUSH_PROTOBUF_TYPE_BYTES:
+        tag_type = PUSH_PROTOBUF_TAG_TYPE_LENGTH_DELIMITED;
+        value = push_protobuf_hwm_string_view_new
+            (push_talloc_asprintf(context, "%s.string",
+                                  full_field_name),
+             context, parser, &instance->scratch);
+        break;
+
+      case PUSH_PROTOBUF_TYPE_MESSAGE:
+        callback = submessage_new
+            (push_talloc_asprintf(context, "%s.submessage",
+                                  full_field_name),
+             context, parser, instance, index);
+        if (callback == NULL)
+            return false;
+
+        return push_protobuf_field_map_add_field
+            (full_field_name, parser, field_map, field->number,
+             PUSH_PROTOBUF_TAG_TYPE_LENGTH_DELIMITED, callback);
+
+      default:
+        /*
+         * Groups aren't supported; they'll be skipped like any other
+         * unknown field.
+         */
+
+        return true;
+    }
+
+    callback = push_compose_new
+        (push_talloc_asprintf(context, "%s.compose", full_field_name),
+         context, parser,
+         value,
+         store_new(push_talloc_asprintf(context, "%s.store",
+                                        full_field_name),
+                   context, parser, instance, index));
+
+    if (field->packed)
+    {
+        /*
+         * A packed field is a length-prefixed run of values with no
+         * tags; read values until we reach the end of the run.
+         */
+
+        tag_type = PUSH_PROTOBUF_TAG_TYPE_LENGTH_DELIMITED;
+        callback = push_protobuf_varint_prefixed_new
+            (push_talloc_asprintf(context, "%s.packed", full_field_name),
+             context, parser,
+             push_fold_new
+             (push_talloc_asprintf(context, "%s.fold", full_field_name),
+              context, parser, callback));
+    }
+
+    if (callback == NULL)
+        return false;
+
+    return push_protobuf_field_map_add_field
+        (full_field_name, parser, field_map, field->number,
+         tag_type, callback);
+}
+
+
+static instance_t *
+instance_new(dynamic_context_t *dynamic_context,
+             const push_protobuf_message_descriptor_t *descriptor,
+             bool prefixed)
+{
+    push_parser_t  *parser = dynamic_context->parser;
+    void  *context;
+    instance_t  *instance;
+    push_protobuf_field_map_t  *field_map;
+    push_callback_t  *entry;
+    size_t  i;
+
+    /*
+     * Create a memory context for the objects we're about to create.
+     */
+
+    context = push_talloc_new(dynamic_context);
+    if (context == NULL) return NULL;
+
+    instance = push_talloc(context, instance_t);
+    if (instance == NULL) goto error;
+
+    instance->next = NULL;
+    instance->context = dynamic_context;
+    instance->descriptor = descriptor;
+    instance->prefixed = prefixed;
+    instance->busy = false;
+    instance->generation = 0;
+    instance->owner = NULL;
+    instance->current = NULL;
+    hwm_buffer_init(&instance->scratch);
+    push_talloc_set_destructor(instance, instance_destructor);
+
+    /*
+     * Create the field map and message callback.
+     */
+
+    field_map = push_protobuf_field_map_new(context);
+    if (field_map == NULL) goto error;
+
+    for (i = 0; i < descriptor->field_count; i++)
+    {
+        if (!add_dynamic_field(context, parser, field_map, instance, i))
+            goto error;
+    }
+
+    entry = push_protobuf_message_new
+        (push_talloc_asprintf(context, "%s", descriptor->full_name),
+         context, parser, field_map);
+
+    if (prefixed)
+    {
+        entry = push_protobuf_varint_prefixed_new
+            (push_talloc_asprintf(context, "%s.prefixed",
+                                  descriptor->full_name),
+             context, parser, entry);
+    }
+
+    if (entry == NULL) goto error;
+
+    /*
+     * The entry callback always continues with the instance's own
+     * continuations, which forward to whichever callback activated
+     * the instance.
+     */
+
+    instance->entry = entry;
+
+    push_continuation_set(&instance->success,
+                          instance_success, instance);
+    push_continuation_set(&instance->incomplete,
+                          instance_incomplete, instance);
+    push_continuation_set(&instance->error,
+                          instance_error, instance);
+
+    push_continuation_call(&entry->set_success,
+                           &instance->success);
+    push_continuation_call(&entry->set_incomplete,
+                           &instance->incomplete);
+    push_continuation_call(&entry->set_error,
+                           &instance->error);
+
+    return instance;
+
+  error:
+    /*
+     * Before returning, free any objects we created before the error.
+     */
+
+    push_talloc_free(context);
+    return NULL;
+}
+
+
+/**
+ * Find a free instance for the given message type, building a new
+ * one if they're all busy.
+ */
+
+static instance_t *
+acquire_instance(dynamic_context_t *context,
+                 const push_protobuf_message_descriptor_t *descriptor,
+                 bool prefixed)
+{
+    instance_t  *instance;
+
+    if (descriptor->index >= context->instance_count)
+    {
+        instance_t  **new_instances;
+        size_t  new_count = context->pool->message_count;
+        size_t  i;
+
+        new_instances = push_talloc_realloc
+            (context, context->instances, instance_t *, new_count);
+        if (new_instances == NULL)
+            return NULL;
+
+        for (i = context->instance_count; i < new_count; i++)
+            new_instances[i] = NULL;
+
+        context->instances = new_instances;
+        context->instance_count = new_count;
+    }
+
+    for (instance = context->instances[descriptor->index];
+         instance != NULL;
+         instance = instance->next)
+    {
+        if ((instance->prefixed == prefixed) &&
+            (!instance->busy ||
+             (instance->generation != context->generation)))
+        {
+            goto found;
+        }
+    }
+
+    PUSH_DEBUG_MSG("dynamic: Building %s graph for %s.\n",
+                   prefixed? "prefixed": "top-level",
+                   descriptor->full_name);
+
+    instance = instance_new(context, descriptor, prefixed);
+    if (instance == NULL)
+        return NULL;
+
+    instance->next = context->instances[descriptor->index];
+    context->instances[descriptor->index] = instance;
+
+  found:
+    instance->busy = true;
+    instance->generation = context->generation;
+    return instance;
+}
+
+
+/*-----------------------------------------------------------------------
+ * Dynamic message callbacks
+ */
+
+typedef struct _dynamic_message
+{
+    /**
+     * The push_callback_t superclass for this callback.
+     */
+
+    push_callback_t  callback;
+
+    /**
+     * The graph cache for our pool and parser.
+     */
+
+    dynamic_context_t  *context;
+
+    /**
+     * The type of message that we parse.
+     */
+
+    const push_protobuf_message_descriptor_t  *descriptor;
+
+    /**
+     * The arena that the parsed messages are allocated from.
+     */
+
+    arena_t  arena;
+
+} dynamic_message_t;
+
+
+static void
+dynamic_message_activate(void *user_data,
+                         void *result,
+                         const void *buf,
+                         size_t bytes_remaining)
+{
+    dynamic_message_t  *dynamic = (dynamic_message_t *) user_data;
+    dynamic_context_t  *context = dynamic->context;
+    instance_t  *instance;
+    push_protobuf_dynamic_message_t  *message;
+
+    /*
+     * Starting a new top-level message frees up everything from the
+     * previous one.
+     */
+
+    context->generation++;
+    context->arena = &dynamic->arena;
+    arena_reset(&dynamic->arena);
+
+    instance = acquire_instance(context, dynamic->descriptor, false);
+    if (instance == NULL)
+        goto memory_error;
+
+    message = message_new(&dynamic->arena, dynamic->descriptor);
+    if (message == NULL)
+        goto memory_error;
+
+    instance->current = message;
+    instance->owner = &dynamic->callback;
+
+    push_continuation_call(&instance->entry->activate,
+                           NULL,
+                           buf, bytes_remaining);
+    return;
+
+  memory_error:
+    push_continuation_call(dynamic->callback.error,
+                           PUSH_MEMORY_ERROR,
+                           "Cannot allocate dynamic message");
+}
+
+
+push_callback_t *
+push_protobuf_dynamic_message_new
+    (const char *name,
+     void *parent,
+     push_parser_t *parser,
+     push_protobuf_descriptor_pool_t *pool,
+     const push_protobuf_message_descriptor_t *descriptor)
+{
+    dynamic_message_t  *dynamic;
+
+    if ((pool == NULL) || (descriptor == NULL))
+        return NULL;
+
+    dynamic = push_talloc(parent, dynamic_message_t);
+    if (dynamic == NULL)
+        return NULL;
+
+    dynamic->context = get_context(pool, parser);
+    if (dynamic->context == NULL)
+    {
+        push_talloc_free(dynamic);
+        return NULL;
+    }
+
+    dynamic->descriptor = descriptor;
+    arena_init(&dynamic->arena, dynamic);
+
+    if (name == NULL) name = "dynamic-message";
+    push_talloc_set_name_const(dynamic, name);
+
+    push_callback_init(&dynamic->callback, parser, dynamic,
+                       dynamic_message_activate,
+                       NULL, NULL, NULL);
+
+    return &dynamic->callback;
+}
+
+
+/*-----------------------------------------------------------------------
+ * Loading descriptor sets
+ */
+
+/*
+ * A built-in description of the parts of descriptor.proto that we
+ * need to load a FileDescriptorSet.
+ */
+
+#define FIELD(name, number, label, type, message_type)         \
+    { name, number, PUSH_PROTOBUF_LABEL_##label,                \
+      PUSH_PROTOBUF_TYPE_##type, false, message_type }
+
+static const push_protobuf_message_descriptor_t  FIELD_OPTIONS;
+static const push_protobuf_message_descriptor_t  FIELD_DESCRIPTOR_PROTO;
+static const push_protobuf_message_descriptor_t  DESCRIPTOR_PROTO;
+static const push_protobuf_message_descriptor_t  FILE_DESCRIPTOR_PROTO;
+static const push_protobuf_message_descriptor_t  FILE_DESCRIPTOR_SET;
+
+static const push_protobuf_field_descriptor_t  FIELD_OPTIONS_FIELDS[] =
+{
+    FIELD("packed", 2, OPTIONAL, BOOL, NULL)
+};
+
+static const push_protobuf_message_descriptor_t  FIELD_OPTIONS =
+{
+    "google.protobuf.FieldOptions", 1, FIELD_OPTIONS_FIELDS, 0
+};
+
+static const push_protobuf_field_descriptor_t
+FIELD_DESCRIPTOR_PROTO_FIELDS[] =
+{
+    FIELD("name", 1, OPTIONAL, STRING, NULL),
+    FIELD("number", 3, OPTIONAL, INT32, NULL),
+    FIELD("label", 4, OPTIONAL, ENUM, NULL),
+    FIELD("type", 5, OPTIONAL, ENUM, NULL),
+    FIELD("type_name", 6, OPTIONAL, STRING, NULL),
+    FIELD("options", 8, OPTIONAL, MESSAGE, &FIELD_OPTIONS)
+};
+
+static const push_protobuf_message_descriptor_t  FIELD_DESCRIPTOR_PROTO =
+{
+    "google.protobuf.FieldDescriptorProto", 6,
+    FIELD_DESCRIPTOR_PROTO_FIELDS, 1
+};
+
+static const push_protobuf_field_descriptor_t  DESCRIPTOR_PROTO_FIELDS[] =
+{
+    FIELD("name", 1, OPTIONAL, STRING, NULL),
+    FIELD("field", 2, REPEATED, MESSAGE, &FIELD_DESCRIPTOR_PROTO),
+    FIELD("nested_type", 3, REPEATED, MESSAGE, &DESCRIPTOR_PROTO)
+};
+
+static const push_protobuf_message_descriptor_t  DESCRIPTOR_PROTO =
+{
+    "google.protobuf.DescriptorProto", 3, DESCRIPTOR_PROTO_FIELDS, 2
+};
+
+static const push_protobuf_field_descriptor_t
+FILE_DESCRIPTOR_PROTO_FIELDS[] =
+{
+    FIELD("name", 1, OPTIONAL, STRING, NULL),
+    FIELD("package", 2, OPTIONAL, STRING, NULL),
+    FIELD("message_type", 4, REPEATED, MESSAGE, &DESCRIPTOR_PROTO),
+    FIELD("syntax", 12, OPTIONAL, STRING, NULL)
+};
+
+static const push_protobuf_message_descriptor_t  FILE_DESCRIPTOR_PROTO =
+{
+    "google.protobuf.FileDescriptorProto", 4,
+    FILE_DESCRIPTOR_PROTO_FIELDS, 3
+};
+
+static const push_protobuf_field_descriptor_t  FILE_DESCRIPTOR_SET_FIELDS[] =
+{
+    FIELD("file", 1, REPEATED, MESSAGE, &FILE_DESCRIPTOR_PROTO)
+};
+
+static const push_protobuf_message_descriptor_t  FILE_DESCRIPTOR_SET =
+{
+    "google.protobuf.FileDescriptorSet", 1, FILE_DESCRIPTOR_SET_FIELDS, 4
+};
+
+static const push_protobuf_message_descriptor_t  *BOOTSTRAP_MESSAGES[] =
+{
+    &FIELD_OPTIONS,
+    &FIELD_DESCRIPTOR_PROTO,
+    &DESCRIPTOR_PROTO,
+    &FILE_DESCRIPTOR_PROTO,
+    &FILE_DESCRIPTOR_SET
+};
+
+#undef FIELD
+
+
+/**
+ * Returns the first value of a field of a parsed descriptor, or NULL
+ * if it's not present.
+ */
+
+static const push_protobuf_dynamic_value_t *
+get_value(const push_protobuf_dynamic_message_t *message,
+          push_protobuf_tag_number_t field_number)
+{
+    const push_protobuf_dynamic_field_t  *field =
+        push_protobuf_dynamic_message_get_field(message, field_number);
+
+    return (field == NULL)? NULL: field->first;
+}
+
+
+static const char *
+get_string(const push_protobuf_dynamic_message_t *message,
+           push_protobuf_tag_number_t field_number)
+{
+    const push_protobuf_dynamic_value_t  *value =
+        get_value(message, field_number);
+
+    return (value == NULL)? "": value->v.bytes.data;
+}
+
+
+static bool
+is_packable(push_protobuf_field_type_t type)
+{
+    return
+        (type != PUSH_PROTOBUF_TYPE_STRING) &&
+        (type != PUSH_PROTOBUF_TYPE_BYTES) &&
+        (type != PUSH_PROTOBUF_TYPE_MESSAGE) &&
+        (type != PUSH_PROTOBUF_TYPE_GROUP);
+}
+
+
+/**
+ * Add a DescriptorProto, and all of its nested types, to the pool.
+ * Message fields are resolved later, once every type in the set has
+ * been added; in the meantime we stash the type name in the
+ * corresponding entry of type_names.
+ */
+
+static bool
+load_message(push_protobuf_descriptor_pool_t *pool,
+             void *context,
+             const char *scope,
+             bool proto3,
+             const push_protobuf_dynamic_message_t *proto,
+             hwm_buffer_t *type_names)
+{
+    push_protobuf_message_descriptor_t  *message;
+    push_protobuf_field_descriptor_t  *fields;
+    const push_protobuf_dynamic_field_t  *field_list;
+    const push_protobuf_dynamic_value_t  *value;
+    size_t  i;
+
+    message = push_talloc(context, push_protobuf_message_descriptor_t);
+    if (message == NULL)
+        return false;
+
+    if (scope[0] == '\0')
+        message->full_name =
+            push_talloc_strdup(message, get_string(proto, 1));
+    else
+        message->full_name =
+            push_talloc_asprintf(message, "%s.%s",
+                                 scope, get_string(proto, 1));
+
+    if (message->full_name == NULL)
+        return false;
+
+    field_list = push_protobuf_dynamic_message_get_field(proto, 2);
+    fields = push_talloc_zero_array(message,
+                                    push_protobuf_field_descriptor_t,
+                                    field_list->count + 1);
+    if (fields == NULL)
+        return false;
+
+    for (i = 0, value = field_list->first;
+         value != NULL;
+         i++, value = value->next)
+    {
+        const push_protobuf_dynamic_message_t  *field_proto =
+            value->v.message;
+        const push_protobuf_dynamic_value_t  *option;
+        const char  *type_name = NULL;
+
+        fields[i].name =
+            push_talloc_strdup(message, get_string(field_proto, 1));
+        if (fields[i].name == NULL)
+            return false;
+
+        option = get_value(field_proto, 3);
+        fields[i].number = (option == NULL)? 0: option->v.i32;
+        option = get_value(field_proto, 4);
+        fields[i].label = (option == NULL)?
+            PUSH_PROTOBUF_LABEL_OPTIONAL: option->v.i32;
+        option = get_value(field_proto, 5);
+        fields[i].type = (option == NULL)? 0: option->v.i32;
+
+        /*
+         * Repeated scalars are packed if the field says so, or by
+         * default in proto3 files.
+         */
+
+        if ((fields[i].label == PUSH_PROTOBUF_LABEL_REPEATED) &&
+            is_packable(fields[i].type))
+        {
+            const push_protobuf_dynamic_value_t  *options =
+                get_value(field_proto, 8);
+
+            option = (options == NULL)? NULL:
+                get_value(options->v.message, 2);
+
+            fields[i].packed = (option == NULL)? proto3: option->v.b;
+        }
+
+        if (fields[i].type == PUSH_PROTOBUF_TYPE_MESSAGE)
+            type_name = get_string(field_proto, 6);
+
+        {
+            const char  **slot =
+                hwm_buffer_append_list_elem(type_names, const char *);
+
+            if (slot == NULL)
+                return false;
+
+            *slot = type_name;
+        }
+    }
+
+    message->field_count = field_list->count;
+    message->fields = fields;
+    message->index = pool->message_count;
+
+    if (!pool_add_message(pool, message))
+        return false;
+
+    /*
+     * Then load any nested types.
+     */
+
+    for (value = push_protobuf_dynamic_message_get_field(proto, 3)->first;
+         value != NULL;
+         value = value->next)
+    {
+        if (!load_message(pool, context, message->full_name, proto3,
+                          value->v.message, type_names))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+/**
+ * Fill in the message_type of each message field in the types that
+ * were just loaded.
+ */
+
+static bool
+resolve_types(push_protobuf_descriptor_pool_t *pool,
+              size_t first_index,
+              hwm_buffer_t *type_names)
+{
+    const char  **names = hwm_buffer_mem(type_names, const char *);
+    size_t  name_index = 0;
+    size_t  i;
+    size_t  j;
+
+    for (i = first_index; i < pool->message_count; i++)
+    {
+        push_protobuf_field_descriptor_t  *fields =
+            (push_protobuf_field_descriptor_t *) pool->messages[i]->fields;
+
+        for (j = 0; j < pool->messages[i]->field_count; j++)
+        {
+            const char  *type_name = names[name_index++];
+
+            if (type_name == NULL)
+                continue;
+
+            fields[j].message_type =
+                push_protobuf_descriptor_pool_find_message(pool, type_name);
+
+            if (fields[j].message_type == NULL)
+            {
+                PUSH_DEBUG_MSG("dynamic: Unknown message type %s.\n",
+                               type_name);
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+
+bool
+push_protobuf_descriptor_pool_load(push_protobuf_descriptor_pool_t *pool,
+                                   const void *buf,
+                                   size_t size)
+{
+    size_t  first_index = pool->message_count;
+    void  *context = NULL;
+    push_protobuf_descriptor_pool_t  *bootstrap = NULL;
+    push_parser_t  *parser = NULL;
+    push_callback_t  *callback;
+    const push_protobuf_dynamic_message_t  *set;
+    const push_protobuf_dynamic_value_t  *file;
+    hwm_buffer_t  type_names;
+    size_t  i;
+
+    hwm_buffer_init(&type_names);
+
+    /*
+     * Parse the FileDescriptorSet using the built-in descriptors.
+     */
+
+    context = push_talloc_new(pool);
+    bootstrap = push_protobuf_descriptor_pool_new(context);
+    if (bootstrap == NULL) goto error;
+
+    for (i = 0;
+         i < sizeof(BOOTSTRAP_MESSAGES) / sizeof(BOOTSTRAP_MESSAGES[0]);
+         i++)
+    {
+        if (!pool_add_message(bootstrap, BOOTSTRAP_MESSAGES[i]))
+            goto error;
+    }
+
+    parser = push_parser_new();
+    if (parser == NULL) goto error;
+
+    callback = push_protobuf_dynamic_message_new
+        ("descriptor-set", parser, parser,
+         bootstrap, &FILE_DESCRIPTOR_SET);
+    if (callback == NULL) goto error;
+
+    push_parser_set_callback(parser, callback);
+
+    if ((push_parser_activate(parser, NULL) != PUSH_INCOMPLETE) ||
+        (push_parser_submit_data(parser, buf, size) != PUSH_INCOMPLETE) ||
+        (push_parser_eof(parser) != PUSH_SUCCESS))
+    {
+        PUSH_DEBUG_MSG("dynamic: Cannot parse FileDescriptorSet.\n");
+        goto error;
+    }
+
+    set = push_parser_result(parser, push_protobuf_dynamic_message_t);
+
+    /*
+     * Then copy each message type into the pool.
+     */
+
+    for (file = set->fields[0].first; file != NULL; file = file->next)
+    {
+        const push_protobuf_dynamic_message_t  *file_proto =
+            file->v.message;
+        const push_protobuf_dynamic_value_t  *message_proto;
+        bool  proto3 = (strcmp(get_string(file_proto, 12), "proto3") == 0);
+
+        for (message_proto =
+                 push_protobuf_dynamic_message_get_field(file_proto, 4)->first;
+             message_proto != NULL;
+             message_proto = message_proto->next)
+        {
+            if (!load_message(pool, context, get_string(file_proto, 2),
+                              proto3, message_proto->v.message,
+                              &type_names))
+            {
+                goto error;
+            }
+        }
+    }
+
+    if (!resolve_types(pool, first_index, &type_names))
+        goto error;
+
+    /*
+     * The new descriptors stay in the load context, so just free
+     * everything else.
+     */
+
+    push_parser_free(parser);
+    push_talloc_free(bootstrap);
+    hwm_buffer_done(&type_names);
+    return true;
+
+  error:
+    /*
+     * Remove any message types that we added before the error.
+     */
+
+    pool->message_count = first_index;
+
+    if (parser != NULL)
+        push_parser_free(parser);
+
+    push_talloc_free(context);
+    hwm_buffer_done(&type_names);
+    return false;
+}
+
+
+/*-----------------------------------------------------------------------
+ * Projections
+ */
+
+/**
+ * Returns the length of the first component of a field path.
+ */
+
+static size_t
+first_component_length(const char *path)
+{
+    const char  *dot = strchr(path, '.');
+    return (dot == NULL)? strlen(path): (size_t) (dot - path);
+}
+
+
+/**
+ * Build a copy of a message type that only has the fields named by
+ * the given paths, which are relative to the message type.  Message
+ * fields that are named with further components are projected
+ * recursively; ones that are named on their own are kept whole.  Each
+ * new message type is added to the pool, so that it gets its own
+ * graph cache entry.
+ */
+
+static const push_protobuf_message_descriptor_t *
+project_message(push_protobuf_descriptor_pool_t *pool,
+                void *context,
+                const push_protobuf_message_descriptor_t *descriptor,
+                const char * const *paths,
+                size_t path_count)
+{
+    push_protobuf_message_descriptor_t  *message;
+    push_protobuf_field_descriptor_t  *fields;
+    const char  **suffixes;
+    bool  *matched;
+    size_t  field_count = 0;
+    size_t  i;
+    size_t  j;
+
+    message = push_talloc(context, push_protobuf_message_descriptor_t);
+    fields = push_talloc_zero_array(context,
+                                    push_protobuf_field_descriptor_t,
+                                    descriptor->field_count + 1);
+    suffixes = push_talloc_array(context, const char *, path_count);
+    matched = push_talloc_zero_array(context, bool, path_count);
+
+    if ((message == NULL) || (fields == NULL) ||
+        (suffixes == NULL) || (matched == NULL))
+        return NULL;
+
+    for (i = 0; i < descriptor->field_count; i++)
+    {
+        const push_protobuf_field_descriptor_t  *field =
+            &descriptor->fields[i];
+        bool  whole = false;
+        size_t  suffix_count = 0;
+
+        for (j = 0; j < path_count; j++)
+        {
+            size_t  length = first_component_length(paths[j]);
+
+            if ((length == 0) ||
+                (strncmp(paths[j], field->name, length) != 0) ||
+                (field->name[length] != '\0'))
+            {
+                continue;
+            }
+
+            matched[j] = true;
+
+            if (paths[j][length] == '\0')
+                whole = true;
+            else
+                suffixes[suffix_count++] = paths[j] + length + 1;
+        }
+
+        if (!whole && (suffix_count == 0))
+            continue;
+
+        fields[field_count] = *field;
+
+        if (!whole)
+        {
+            if (field->type != PUSH_PROTOBUF_TYPE_MESSAGE)
+            {
+                PUSH_DEBUG_MSG("dynamic: %s.%s isn't a message field.\n",
+                               descriptor->full_name, field->name);
+                return NULL;
+            }
+
+            fields[field_count].message_type =
+                project_message(pool, context, field->message_type,
+                                suffixes, suffix_count);
+
+            if (fields[field_count].message_type == NULL)
+                return NULL;
+        }
+
+        field_count++;
+    }
+
+    for (j = 0; j < path_count; j++)
+    {
+        if (!matched[j])
+        {
+            PUSH_DEBUG_MSG("dynamic: %s has no field for path %s.\n",
+                           descriptor->full_name, paths[j]);
+            return NULL;
+        }
+    }
+
+    push_talloc_free(suffixes);
+    push_talloc_free(matched);
+
+    /*
+     * The projection has the same name as the original, but it's
+     * always added to the pool after it, so find_message will never
+     * return it.
+     */
+
+    message->full_name = descriptor->full_name;
+    message->field_count = field_count;
+    message->fields = fields;
+    message->index = pool->message_count;
+
+    if (!pool_add_message(pool, message))
+        return NULL;
+
+    return message;
+}
+
+
+const push_protobuf_message_descriptor_t *
+push_protobuf_descriptor_pool_project
+    (push_protobuf_descriptor_pool_t *pool,
+     const push_protobuf_message_descriptor_t *descriptor,
+     const char * const *paths,
+     size_t path_count)
+{
+    size_t  first_index = pool->message_count;
+    void  *context;
+    const push_protobuf_message_descriptor_t  *projection;
+
+    if ((descriptor == NULL) || (path_count == 0))
+        return NULL;
+
+    context = push_talloc_new(pool);
+    if (context == NULL)
+        return NULL;
+
+    projection = project_message(pool, context, descriptor,
+                                 paths, path_count);
+
+    if (projection == NULL)
+    {
+        /*
+         * Remove any projected types that we added before the error.
+         */
+
+        pool->message_count = first_index;
+        push_talloc_free(context);
+        return NULL;
+    }
+
+    return projection;
+}
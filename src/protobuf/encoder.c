@@ -0,0 +1,918 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2010, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the LICENSE.txt file in this distribution for license
+ * details.
+ * ----------------------------------------------------------------------
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+
+#include <hwm-buffer.h>
+
+#include <push/basics.h>
+#include <push/talloc.h>
+
+#include <push/protobuf/basics.h>
+#include <push/protobuf/dynamic.h>
+#include <push/protobuf/encoder.h>
+#include <push/protobuf/unknown.h>
+
+
+/**
+ * The smallest chunk size that we allow.  A chunk must be able to
+ * hold the largest tag and value that we write contiguously.
+ */
+
+#define MIN_CHUNK_SIZE  64
+
+
+/**
+ * The most bytes that we write contiguously for a single field: a
+ * tag, plus a varint value.
+ */
+
+#define MAX_FIELD_HEADER_LENGTH                 \
+    (PUSH_PROTOBUF_MAX_VARINT32_LENGTH +        \
+     PUSH_PROTOBUF_MAX_VARINT_LENGTH)
+
+
+/**
+ * An unfinished submessage.
+ */
+
+typedef struct _frame
+{
+    /**
+     * The index of the iovec that will hold the submessage's length
+     * prefix.
+     */
+
+    size_t  iovec_index;
+
+    /**
+     * The total size of the output when the submessage started.
+     */
+
+    size_t  start_size;
+
+} frame_t;
+
+
+struct _push_protobuf_encoder
+{
+    /**
+     * The size of each chunk.
+     */
+
+    size_t  chunk_size;
+
+    /**
+     * Strings and bytes values at least this long are referenced
+     * instead of copied.
+     */
+
+    size_t  copy_threshold;
+
+    /**
+     * The chunks that we've allocated, as a list of uint8_t
+     * pointers.  Each chunk is a talloc child of the encoder.
+     */
+
+    hwm_buffer_t  chunks;
+
+    /**
+     * The number of chunks in use for the current output.  The
+     * current chunk is the last one of these.
+     */
+
+    size_t  chunks_used;
+
+    /**
+     * The number of bytes used in the current chunk.
+     */
+
+    size_t  chunk_used;
+
+    /**
+     * The iovecs for the current output.
+     */
+
+    hwm_buffer_t  iovecs;
+
+    /**
+     * Whether the last iovec points at the used part of the current
+     * chunk, so that new bytes in the chunk can be added to it.
+     */
+
+    bool  can_extend;
+
+    /**
+     * The stack of unfinished submessages.
+     */
+
+    hwm_buffer_t  frames;
+
+    /**
+     * The total number of bytes in the current output.
+     */
+
+    size_t  total_size;
+};
+
+
+static int
+encoder_destructor(push_protobuf_encoder_t *encoder)
+{
+    hwm_buffer_done(&encoder->chunks);
+    hwm_buffer_done(&encoder->iovecs);
+    hwm_buffer_done(&encoder->frames);
+    return 0;
+}
+
+
+push_protobuf_encoder_t *
+push_protobuf_encoder_new(void *parent,
+                          size_t chunk_size,
+                          size_t copy_threshold)
+{
+    push_protobuf_encoder_t  *encoder;
+
+    if (chunk_size == 0)
+        chunk_size = PUSH_PROTOBUF_ENCODER_DEFAULT_CHUNK_SIZE;
+    else if (chunk_size < MIN_CHUNK_SIZE)
+        chunk_size = MIN_CHUNK_SIZE;
+
+    if (copy_threshold == 0)
+        copy_threshold = PUSH_PROTOBUF_ENCODER_DEFAULT_COPY_THRESHOLD;
+
+    encoder = push_talloc(parent, push_protobuf_encoder_t);
+    if (encoder == NULL) return NULL;
+
+    encoder->chunk_size = chunk_size;
+    encoder->copy_threshold = copy_threshold;
+    hwm_buffer_init(&encoder->chunks);
+    hwm_buffer_init(&encoder->iovecs);
+    hwm_buffer_init(&encoder->frames);
+    push_talloc_set_destructor(encoder, encoder_destructor);
+
+    push_protobuf_encoder_reset(encoder);
+    return encoder;
+}
+
+
+void
+push_protobuf_encoder_reset(push_protobuf_encoder_t *encoder)
+{
+    /*
+     * Pretend that there's a full chunk in use, so that the first
+     * write moves on to the first real chunk.
+     */
+
+    encoder->chunks_used = 0;
+    encoder->chunk_used = encoder->chunk_size;
+    hwm_buffer_clear(&encoder->iovecs);
+    encoder->can_extend = false;
+    hwm_buffer_clear(&encoder->frames);
+    encoder->total_size = 0;
+}
+
+
+const struct iovec *
+push_protobuf_encoder_iovecs(push_protobuf_encoder_t *encoder,
+                             size_t *count)
+{
+    *count = hwm_buffer_current_list_size(&encoder->iovecs, struct iovec);
+    return hwm_buffer_mem(&encoder->iovecs, struct iovec);
+}
+
+
+size_t
+push_protobuf_encoder_size(push_protobuf_encoder_t *encoder)
+{
+    return encoder->total_size;
+}
+
+
+/*-----------------------------------------------------------------------
+ * Output chunks
+ */
+
+/**
+ * Return a pointer to at least size contiguous bytes of chunk
+ * memory, moving on to the next chunk if the current one doesn't
+ * have enough room left.  size must not be larger than the chunk
+ * size.  Nothing is added to the output until commit_bytes is called.
+ */
+
+static uint8_t *
+reserve_bytes(push_protobuf_encoder_t *encoder, size_t size)
+{
+    uint8_t  **chunks;
+    size_t  chunk_count;
+
+    if (encoder->chunk_used + size <= encoder->chunk_size)
+    {
+        chunks = hwm_buffer_writable_mem(&encoder->chunks, uint8_t *);
+        return chunks[encoder->chunks_used - 1] + encoder->chunk_used;
+    }
+
+    /*
+     * Reuse a chunk from an earlier output if there is one; otherwise
+     * allocate a new one.
+     */
+
+    chunk_count = hwm_buffer_current_list_size(&encoder->chunks, uint8_t *);
+
+    if (encoder->chunks_used == chunk_count)
+    {
+        uint8_t  **new_chunk;
+
+        new_chunk = hwm_buffer_append_list_elem(&encoder->chunks, uint8_t *);
+        if (new_chunk == NULL)
+            return NULL;
+
+        *new_chunk = push_talloc_size(encoder, encoder->chunk_size);
+        if (*new_chunk == NULL)
+        {
+            encoder->chunks.current_size -= sizeof(uint8_t *);
+            return NULL;
+        }
+
+        PUSH_DEBUG_MSG("encoder: Allocated chunk %zu.\n", chunk_count);
+    }
+
+    encoder->chunks_used++;
+    encoder->chunk_used = 0;
+    encoder->can_extend = false;
+
+    chunks = hwm_buffer_writable_mem(&encoder->chunks, uint8_t *);
+    return chunks[encoder->chunks_used - 1];
+}
+
+
+/**
+ * Add size bytes, which were written into the memory returned by
+ * reserve_bytes, to the output.
+ */
+
+static bool
+commit_bytes(push_protobuf_encoder_t *encoder, uint8_t *ptr, size_t size)
+{
+    struct iovec  *iov;
+
+    encoder->chunk_used += size;
+    encoder->total_size += size;
+
+    if (encoder->can_extend)
+    {
+        size_t  count =
+            hwm_buffer_current_list_size(&encoder->iovecs, struct iovec);
+
+        iov = hwm_buffer_writable_mem(&encoder->iovecs, struct iovec);
+        iov[count - 1].iov_len += size;
+        return true;
+    }
+
+    iov = hwm_buffer_append_list_elem(&encoder->iovecs, struct iovec);
+    if (iov == NULL)
+        return false;
+
+    iov->iov_base = ptr;
+    iov->iov_len = size;
+    encoder->can_extend = true;
+    return true;
+}
+
+
+/**
+ * Copy bytes into the output, splitting them across as many chunks
+ * as necessary.
+ */
+
+static bool
+copy_bytes(push_protobuf_encoder_t *encoder, const void *buf, size_t size)
+{
+    const uint8_t  *src = (const uint8_t *) buf;
+
+    while (size > 0)
+    {
+        size_t  room = encoder->chunk_size - encoder->chunk_used;
+        size_t  piece;
+        uint8_t  *dest;
+
+        if (room == 0)
+            room = encoder->chunk_size;
+
+        piece = (size < room)? size: room;
+
+        dest = reserve_bytes(encoder, piece);
+        if (dest == NULL)
+            return false;
+
+        memcpy(dest, src, piece);
+        if (!commit_bytes(encoder, dest, piece))
+            return false;
+
+        src += piece;
+        size -= piece;
+    }
+
+    return true;
+}
+
+
+/**
+ * Add a reference to the caller's memory to the output.
+ */
+
+static bool
+reference_bytes(push_protobuf_encoder_t *encoder,
+                const void *buf, size_t size)
+{
+    struct iovec  *iov;
+
+    iov = hwm_buffer_append_list_elem(&encoder->iovecs, struct iovec);
+    if (iov == NULL)
+        return false;
+
+    iov->iov_base = (void *) buf;
+    iov->iov_len = size;
+    encoder->can_extend = false;
+    encoder->total_size += size;
+    return true;
+}
+
+
+/*-----------------------------------------------------------------------
+ * Wire encodings
+ */
+
+static size_t
+encode_varint(uint8_t *dest, uint64_t value)
+{
+    size_t  length = 0;
+
+    while (value >= 0x80)
+    {
+        dest[length++] = (uint8_t) (value | 0x80);
+        value >>= 7;
+    }
+
+    dest[length++] = (uint8_t) value;
+    return length;
+}
+
+
+static size_t
+encode_fixed32(uint8_t *dest, uint32_t value)
+{
+    dest[0] = (uint8_t) value;
+    dest[1] = (uint8_t) (value >> 8);
+    dest[2] = (uint8_t) (value >> 16);
+    dest[3] = (uint8_t) (value >> 24);
+    return sizeof(uint32_t);
+}
+
+
+static size_t
+encode_fixed64(uint8_t *dest, uint64_t value)
+{
+    encode_fixed32(dest, (uint32_t) value);
+    encode_fixed32(dest + 4, (uint32_t) (value >> 32));
+    return sizeof(uint64_t);
+}
+
+
+static inline size_t
+encode_tag(uint8_t *dest,
+           push_protobuf_tag_number_t field_number,
+           push_protobuf_tag_type_t tag_type)
+{
+    return encode_varint(dest, PUSH_PROTOBUF_MAKE_TAG(field_number,
+                                                      tag_type));
+}
+
+
+/*-----------------------------------------------------------------------
+ * Fields
+ */
+
+bool
+push_protobuf_encoder_add_varint(push_protobuf_encoder_t *encoder,
+                                 push_protobuf_tag_number_t field_number,
+                                 uint64_t value)
+{
+    uint8_t  *dest;
+    size_t  length;
+
+    dest = reserve_bytes(encoder, MAX_FIELD_HEADER_LENGTH);
+    if (dest == NULL)
+        return false;
+
+    length = encode_tag(dest, field_number, PUSH_PROTOBUF_TAG_TYPE_VARINT);
+    length += encode_varint(dest + length, value);
+    return commit_bytes(encoder, dest, length);
+}
+
+
+bool
+push_protobuf_encoder_add_int32(push_protobuf_encoder_t *encoder,
+                                push_protobuf_tag_number_t field_number,
+                                int32_t value)
+{
+    return push_protobuf_encoder_add_varint
+        (encoder, field_number, (uint64_t) (int64_t) value);
+}
+
+
+bool
+push_protobuf_encoder_add_int64(push_protobuf_encoder_t *encoder,
+                                push_protobuf_tag_number_t field_number,
+                                int64_t value)
+{
+    return push_protobuf_encoder_add_varint
+        (encoder, field_number, (uint64_t) value);
+}
+
+
+bool
+push_protobuf_encoder_add_sint32(push_protobuf_encoder_t *encoder,
+                                 push_protobuf_tag_number_t field_number,
+                                 int32_t value)
+{
+    return push_protobuf_encoder_add_varint
+        (encoder, field_number,
+         PUSH_PROTOBUF_ZIGZAG_ENCODE32(value));
+}
+
+
+bool
+push_protobuf_encoder_add_sint64(push_protobuf_encoder_t *encoder,
+                                 push_protobuf_tag_number_t field_number,
+                                 int64_t value)
+{
+    return push_protobuf_encoder_add_varint
+        (encoder, field_number,
+         PUSH_PROTOBUF_ZIGZAG_ENCODE64(value));
+}
+
+
+bool
+push_protobuf_encoder_add_fixed32(push_protobuf_encoder_t *encoder,
+                                  push_protobuf_tag_number_t field_number,
+                                  uint32_t value)
+{
+    uint8_t  *dest;
+    size_t  length;
+
+    dest = reserve_bytes(encoder, MAX_FIELD_HEADER_LENGTH);
+    if (dest == NULL)
+        return false;
+
+    length = encode_tag(dest, field_number, PUSH_PROTOBUF_TAG_TYPE_FIXED32);
+    length += encode_fixed32(dest + length, value);
+    return commit_bytes(encoder, dest, length);
+}
+
+
+bool
+push_protobuf_encoder_add_fixed64(push_protobuf_encoder_t *encoder,
+                                  push_protobuf_tag_number_t field_number,
+                                  uint64_t value)
+{
+    uint8_t  *dest;
+    size_t  length;
+
+    dest = reserve_bytes(encoder, MAX_FIELD_HEADER_LENGTH);
+    if (dest == NULL)
+        return false;
+
+    length = encode_tag(dest, field_number, PUSH_PROTOBUF_TAG_TYPE_FIXED64);
+    length += encode_fixed64(dest + length, value);
+    return commit_bytes(encoder, dest, length);
+}
+
+
+bool
+push_protobuf_encoder_add_float(push_protobuf_encoder_t *encoder,
+                                push_protobuf_tag_number_t field_number,
+                                float value)
+{
+    uint32_t  bits;
+
+    memcpy(&bits, &value, sizeof(uint32_t));
+    return push_protobuf_encoder_add_fixed32(encoder, field_number, bits);
+}
+
+
+bool
+push_protobuf_encoder_add_double(push_protobuf_encoder_t *encoder,
+                                 push_protobuf_tag_number_t field_number,
+                                 double value)
+{
+    uint64_t  bits;
+
+    memcpy(&bits, &value, sizeof(uint64_t));
+    return push_protobuf_encoder_add_fixed64(encoder, field_number, bits);
+}
+
+
+bool
+push_protobuf_encoder_add_bytes(push_protobuf_encoder_t *encoder,
+                                push_protobuf_tag_number_t field_number,
+                                const void *buf,
+                                size_t size)
+{
+    uint8_t  *dest;
+    size_t  length;
+
+    dest = reserve_bytes(encoder, MAX_FIELD_HEADER_LENGTH);
+    if (dest == NULL)
+        return false;
+
+    length = encode_tag(dest, field_number,
+                        PUSH_PROTOBUF_TAG_TYPE_LENGTH_DELIMITED);
+    length += encode_varint(dest + length, size);
+
+    if (!commit_bytes(encoder, dest, length))
+        return false;
+
+    return push_protobuf_encoder_write_bytes(encoder, buf, size);
+}
+
+
+bool
+push_protobuf_encoder_begin_submessage
+    (push_protobuf_encoder_t *encoder,
+     push_protobuf_tag_number_t field_number)
+{
+    uint8_t  *dest;
+    size_t  length;
+    struct iovec  *iov;
+    frame_t  *frame;
+
+    dest = reserve_bytes(encoder, PUSH_PROTOBUF_MAX_VARINT32_LENGTH);
+    if (dest == NULL)
+        return false;
+
+    length = encode_tag(dest, field_number,
+                        PUSH_PROTOBUF_TAG_TYPE_LENGTH_DELIMITED);
+
+    if (!commit_bytes(encoder, dest, length))
+        return false;
+
+    /*
+     * Set aside room for the largest possible length prefix, and give
+     * it its own iovec.  The iovec is empty until the submessage is
+     * ended; then it's pointed at just the bytes of the prefix that
+     * are needed.  Since the prefix has its own iovec, the unused
+     * bytes never appear in the output, and the submessage's contents
+     * never have to be moved.
+     */
+
+    dest = reserve_bytes(encoder, PUSH_PROTOBUF_MAX_VARINT32_LENGTH);
+    if (dest == NULL)
+        return false;
+
+    iov = hwm_buffer_append_list_elem(&encoder->iovecs, struct iovec);
+    if (iov == NULL)
+        return false;
+
+    iov->iov_base = dest;
+    iov->iov_len = 0;
+    encoder->chunk_used += PUSH_PROTOBUF_MAX_VARINT32_LENGTH;
+    encoder->can_extend = false;
+
+    frame = hwm_buffer_append_list_elem(&encoder->frames, frame_t);
+    if (frame == NULL)
+        return false;
+
+    frame->iovec_index =
+        hwm_buffer_current_list_size(&encoder->iovecs, struct iovec) - 1;
+    frame->start_size = encoder->total_size;
+    return true;
+}
+
+
+bool
+push_protobuf_encoder_end_submessage(push_protobuf_encoder_t *encoder)
+{
+    size_t  frame_count;
+    frame_t  *frame;
+    struct iovec  *iov;
+    size_t  length;
+
+    frame_count = hwm_buffer_current_list_size(&encoder->frames, frame_t);
+    if (frame_count == 0)
+    {
+        PUSH_DEBUG_MSG("encoder: No submessage to end.\n");
+        return false;
+    }
+
+    frame = hwm_buffer_writable_mem(&encoder->frames, frame_t) +
+        (frame_count - 1);
+    encoder->frames.current_size -= sizeof(frame_t);
+
+    length = encoder->total_size - frame->start_size;
+    if (length > UINT32_MAX)
+    {
+        PUSH_DEBUG_MSG("encoder: Submessage is too long (%zu bytes).\n",
+                       length);
+        return false;
+    }
+
+    iov = hwm_buffer_writable_mem(&encoder->iovecs, struct iovec) +
+        frame->iovec_index;
+    iov->iov_len = encode_varint((uint8_t *) iov->iov_base, length);
+    encoder->total_size += iov->iov_len;
+    return true;
+}
+
+
+bool
+push_protobuf_encoder_write_varint(push_protobuf_encoder_t *encoder,
+                                   uint64_t value)
+{
+    uint8_t  *dest;
+
+    dest = reserve_bytes(encoder, PUSH_PROTOBUF_MAX_VARINT_LENGTH);
+    if (dest == NULL)
+        return false;
+
+    return commit_bytes(encoder, dest, encode_varint(dest, value));
+}
+
+
+bool
+push_protobuf_encoder_write_fixed32(push_protobuf_encoder_t *encoder,
+                                    uint32_t value)
+{
+    uint8_t  *dest;
+
+    dest = reserve_bytes(encoder, sizeof(uint32_t));
+    if (dest == NULL)
+        return false;
+
+    return commit_bytes(encoder, dest, encode_fixed32(dest, value));
+}
+
+
+bool
+push_protobuf_encoder_write_fixed64(push_protobuf_encoder_t *encoder,
+                                    uint64_t value)
+{
+    uint8_t  *dest;
+
+    dest = reserve_bytes(encoder, sizeof(uint64_t));
+    if (dest == NULL)
+        return false;
+
+    return commit_bytes(encoder, dest, encode_fixed64(dest, value));
+}
+
+
+bool
+push_protobuf_encoder_write_bytes(push_protobuf_encoder_t *encoder,
+                                  const void *buf,
+                                  size_t size)
+{
+    if (size >= encoder->copy_threshold)
+        return reference_bytes(encoder, buf, size);
+    else
+        return copy_bytes(encoder, buf, size);
+}
+
+
+bool
+push_protobuf_encoder_add_unknown_fields
+    (push_protobuf_encoder_t *encoder,
+     const push_protobuf_unknown_fields_t *fields)
+{
+    size_t  count = push_protobuf_unknown_fields_count(fields);
+    size_t  i;
+
+    for (i = 0; i < count; i++)
+    {
+        push_protobuf_tag_t  tag;
+        size_t  size;
+        const void  *buf;
+
+        buf = push_protobuf_unknown_fields_get(fields, i, &tag, &size);
+
+        if (!push_protobuf_encoder_write_varint(encoder, tag) ||
+            !push_protobuf_encoder_write_bytes(encoder, buf, size))
+            return false;
+    }
+
+    return true;
+}
+
+
+/*-----------------------------------------------------------------------
+ * Dynamic messages
+ */
+
+/**
+ * Write one value of a packed field, without a tag.
+ */
+
+static bool
+write_packed_value(push_protobuf_encoder_t *encoder,
+                   push_protobuf_field_type_t type,
+                   const push_protobuf_dynamic_value_t *value)
+{
+    switch (type)
+    {
+      case PUSH_PROTOBUF_TYPE_INT32:
+      case PUSH_PROTOBUF_TYPE_ENUM:
+        return push_protobuf_encoder_write_varint
+            (encoder, (uint64_t) (int64_t) value->v.i32);
+
+      case PUSH_PROTOBUF_TYPE_UINT32:
+        return push_protobuf_encoder_write_varint(encoder, value->v.u32);
+
+      case PUSH_PROTOBUF_TYPE_SINT32:
+        return push_protobuf_encoder_write_varint
+            (encoder, PUSH_PROTOBUF_ZIGZAG_ENCODE32(value->v.i32));
+
+      case PUSH_PROTOBUF_TYPE_INT64:
+      case PUSH_PROTOBUF_TYPE_UINT64:
+        return push_protobuf_encoder_write_varint(encoder, value->v.u64);
+
+      case PUSH_PROTOBUF_TYPE_SINT64:
+        return push_protobuf_encoder_write_varint
+            (encoder, PUSH_PROTOBUF_ZIGZAG_ENCODE64(value->v.i64));
+
+      case PUSH_PROTOBUF_TYPE_BOOL:
+        return push_protobuf_encoder_write_varint(encoder, value->v.b);
+
+      case PUSH_PROTOBUF_TYPE_FIXED32:
+      case PUSH_PROTOBUF_TYPE_SFIXED32:
+      case PUSH_PROTOBUF_TYPE_FLOAT:
+        {
+            uint32_t  bits;
+            memcpy(&bits, &value->v, sizeof(uint32_t));
+            return push_protobuf_encoder_write_fixed32(encoder, bits);
+        }
+
+      case PUSH_PROTOBUF_TYPE_FIXED64:
+      case PUSH_PROTOBUF_TYPE_SFIXED64:
+      case PUSH_PROTOBUF_TYPE_DOUBLE:
+        {
+            uint64_t  bits;
+            memcpy(&bits, &value->v, sizeof(uint64_t));
+            return push_protobuf_encoder_write_fixed64(encoder, bits);
+        }
+
+      default:
+        return false;
+    }
+}
+
+
+/**
+ * Write one value of an unpacked field, with its tag.
+ */
+
+static bool
+add_value(push_protobuf_encoder_t *encoder,
+          const push_protobuf_field_descriptor_t *field,
+          const push_protobuf_dynamic_value_t *value)
+{
+    push_protobuf_tag_number_t  number = field->number;
+
+    switch (field->type)
+    {
+      case PUSH_PROTOBUF_TYPE_INT32:
+      case PUSH_PROTOBUF_TYPE_ENUM:
+        return push_protobuf_encoder_add_int32(encoder, number,
+                                               value->v.i32);
+
+      case PUSH_PROTOBUF_TYPE_UINT32:
+        return push_protobuf_encoder_add_varint(encoder, number,
+                                                value->v.u32);
+
+      case PUSH_PROTOBUF_TYPE_SINT32:
+        return push_protobuf_encoder_add_sint32(encoder, number,
+                                                value->v.i32);
+
+      case PUSH_PROTOBUF_TYPE_INT64:
+      case PUSH_PROTOBUF_TYPE_UINT64:
+        return push_protobuf_encoder_add_varint(encoder, number,
+                                                value->v.u64);
+
+      case PUSH_PROTOBUF_TYPE_SINT64:
+        return push_protobuf_encoder_add_sint64(encoder, number,
+                                                value->v.i64);
+
+      case PUSH_PROTOBUF_TYPE_BOOL:
+        return push_protobuf_encoder_add_varint(encoder, number,
+                                                value->v.b);
+
+      case PUSH_PROTOBUF_TYPE_FIXED32:
+      case PUSH_PROTOBUF_TYPE_SFIXED32:
+        return push_protobuf_encoder_add_fixed32(encoder, number,
+                                                 value->v.u32);
+
+      case PUSH_PROTOBUF_TYPE_FIXED64:
+      case PUSH_PROTOBUF_TYPE_SFIXED64:
+        return push_protobuf_encoder_add_fixed64(encoder, number,
+                                                 value->v.u64);
+
+      case PUSH_PROTOBUF_TYPE_FLOAT:
+        return push_protobuf_encoder_add_float(encoder, number,
+                                               value->v.f);
+
+      case PUSH_PROTOBUF_TYPE_DOUBLE:
+        return push_protobuf_encoder_add_double(encoder, number,
+                                                value->v.d);
+
+      case PUSH_PROTOBUF_TYPE_STRING:
+      case PUSH_PROTOBUF_TYPE_BYTES:
+        return push_protobuf_encoder_add_bytes(encoder, number,
+                                               value->v.bytes.data,
+                                               value->v.bytes.size);
+
+      case PUSH_PROTOBUF_TYPE_MESSAGE:
+        return
+            push_protobuf_encoder_begin_submessage(encoder, number) &&
+            push_protobuf_encoder_add_dynamic_message(encoder,
+                                                      value->v.message) &&
+            push_protobuf_encoder_end_submessage(encoder);
+
+      default:
+        /*
+         * The dynamic message parser skips groups, so there's never a
+         * value to write.
+         */
+
+        return true;
+    }
+}
+
+
+bool
+push_protobuf_encoder_add_dynamic_message
+    (push_protobuf_encoder_t *encoder,
+     const push_protobuf_dynamic_message_t *message)
+{
+    const push_protobuf_message_descriptor_t  *descriptor =
+        message->descriptor;
+    size_t  i;
+
+    for (i = 0; i < descriptor->field_count; i++)
+    {
+        const push_protobuf_field_descriptor_t  *field =
+            &descriptor->fields[i];
+        const push_protobuf_dynamic_field_t  *values = &message->fields[i];
+        const push_protobuf_dynamic_value_t  *value;
+
+        if (values->count == 0)
+            continue;
+
+        if (field->label != PUSH_PROTOBUF_LABEL_REPEATED)
+        {
+            /*
+             * The last value of a singular field wins.
+             */
+
+            if (!add_value(encoder, field, values->last))
+                return false;
+
+            continue;
+        }
+
+        if (field->packed)
+        {
+            if (!push_protobuf_encoder_begin_submessage(encoder,
+                                                        field->number))
+                return false;
+
+            for (value = values->first; value != NULL; value = value->next)
+            {
+                if (!write_packed_value(encoder, field->type, value))
+                    return false;
+            }
+
+            if (!push_protobuf_encoder_end_submessage(encoder))
+                return false;
+
+            continue;
+        }
+
+        for (value = values->first; value != NULL; value = value->next)
+        {
+            if (!add_value(encoder, field, value))
+                return false;
+        }
+    }
+
+    return true;
+}
@@ -44,15 +44,95 @@ typedef struct _field_map_entry
 } field_map_entry_t;
 
 
+/**
+ * Field numbers below this limit are stored in directly indexed
+ * tables, so that looking them up is a single array access.  Field
+ * numbers at or above the limit are found with a binary search of
+ * the sorted entry list.  Most messages number their fields densely
+ * from 1, so nearly every lookup should hit the direct tables.  The
+ * limit is chosen so that every tag in the dense range fits in a
+ * one- or two-byte varint.
+ */
+
+#define DENSE_LIMIT  2048
+
+
 struct _push_protobuf_field_map
 {
     /**
      * A mapping of field numbers to the callback that reads the
      * corresponding field.  Stored as an expandable array of
-     * field_map_entry_t instances.
+     * field_map_entry_t instances, sorted by field number.
      */
 
     hwm_buffer_t  entries;
+
+    /**
+     * A directly indexed table of the callbacks for field numbers
+     * below DENSE_LIMIT.  The table only grows as large as the
+     * largest such field number that's been added.  Entries for
+     * missing fields are NULL.
+     */
+
+    push_callback_t  **dense;
+
+    /**
+     * The number of elements in the dense table.
+     */
+
+    push_protobuf_tag_number_t  dense_size;
+
+    /**
+     * A directly indexed table of the value callbacks for field
+     * numbers below DENSE_LIMIT, keyed on the full tag, including
+     * the wire type.  There are (dense_size << 3) elements.  Entries
+     * for missing fields, and for tags whose wire type doesn't match
+     * the field's, are NULL.
+     */
+
+    push_callback_t  **tags;
+
+    /**
+     * The index into entries of the last field that we found with a
+     * binary search.  Encoders almost always emit fields in order,
+     * so we check the entry after this one before searching.
+     */
+
+    unsigned int  last_index;
+
+    /**
+     * Where to record unknown fields, or NULL if they should be
+     * skipped.
+     */
+
+    push_protobuf_unknown_fields_t  *unknown_fields;
+
+    /**
+     * Where to record field statistics, or NULL if we're not
+     * tracking them.
+     */
+
+    push_protobuf_field_stats_t  *stats;
+
+    /**
+     * Where to record which fields appear in each message, or NULL
+     * if we're not tracking presence.
+     */
+
+    uint64_t  *presence;
+
+    /**
+     * The presence bits of the required fields.
+     */
+
+    uint64_t  required;
+
+    /**
+     * The presence bitmap that we use if fields are required, but the
+     * caller didn't provide one.
+     */
+
+    uint64_t  own_presence;
 };
 
 
@@ -66,10 +146,91 @@ push_protobuf_field_map_new(void *parent)
         return NULL;
 
     hwm_buffer_init(&field_map->entries);
+    field_map->dense = NULL;
+    field_map->dense_size = 0;
+    field_map->tags = NULL;
+    field_map->last_index = 0;
+    field_map->unknown_fields = NULL;
+    field_map->stats = NULL;
+    field_map->presence = NULL;
+    field_map->required = 0;
+    field_map->own_presence = 0;
     return field_map;
 }
 
 
+void
+push_protobuf_field_map_preserve_unknown
+    (push_protobuf_field_map_t *field_map,
+     push_protobuf_unknown_fields_t *dest)
+{
+    field_map->unknown_fields = dest;
+}
+
+
+push_protobuf_unknown_fields_t *
+push_protobuf_field_map_get_unknown_fields
+    (push_protobuf_field_map_t *field_map)
+{
+    return field_map->unknown_fields;
+}
+
+
+void
+push_protobuf_field_map_track_stats
+    (push_protobuf_field_map_t *field_map,
+     push_protobuf_field_stats_t *dest)
+{
+    field_map->stats = dest;
+}
+
+
+push_protobuf_field_stats_t *
+push_protobuf_field_map_get_stats(push_protobuf_field_map_t *field_map)
+{
+    return field_map->stats;
+}
+
+
+void
+push_protobuf_field_map_track_presence
+    (push_protobuf_field_map_t *field_map,
+     uint64_t *dest)
+{
+    field_map->presence = dest;
+}
+
+
+bool
+push_protobuf_field_map_require_field
+    (push_protobuf_field_map_t *field_map,
+     push_protobuf_tag_number_t field_number)
+{
+    if (field_number >= PUSH_PROTOBUF_PRESENCE_LIMIT)
+        return false;
+
+    if (field_map->presence == NULL)
+        field_map->presence = &field_map->own_presence;
+
+    field_map->required |= PUSH_PROTOBUF_PRESENCE_BIT(field_number);
+    return true;
+}
+
+
+uint64_t *
+push_protobuf_field_map_get_presence(push_protobuf_field_map_t *field_map)
+{
+    return field_map->presence;
+}
+
+
+uint64_t
+push_protobuf_field_map_get_required(push_protobuf_field_map_t *field_map)
+{
+    return field_map->required;
+}
+
+
 void
 push_protobuf_field_map_set_success
 (push_protobuf_field_map_t *field_map,
@@ -136,36 +297,101 @@ push_protobuf_field_map_set_error
 }
 
 
+/**
+ * Returns the index of the first entry whose field number is at least
+ * field_number.
+ */
+
+static unsigned int
+find_entry(const field_map_entry_t *entries,
+           unsigned int num_entries,
+           push_protobuf_tag_number_t field_number)
+{
+    unsigned int  low = 0;
+    unsigned int  high = num_entries;
+
+    while (low < high)
+    {
+        unsigned int  mid = low + (high - low) / 2;
+
+        if (entries[mid].field_number < field_number)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+
+    return low;
+}
+
+
 push_callback_t *
 push_protobuf_field_map_get_field
     (push_protobuf_field_map_t *field_map,
      push_protobuf_tag_number_t field_number)
 {
     const field_map_entry_t  *entries;
+    unsigned int  num_entries;
     unsigned int  i;
 
+    /*
+     * Small field numbers are in the dense table.
+     */
+
+    if (field_number < DENSE_LIMIT)
+    {
+        if (field_number < field_map->dense_size)
+            return field_map->dense[field_number];
+
+        return NULL;
+    }
+
     entries =
         hwm_buffer_mem(&field_map->entries, field_map_entry_t);
+    num_entries =
+        hwm_buffer_current_list_size(&field_map->entries,
+                                     field_map_entry_t);
 
-    for (i = 0;
-         i < hwm_buffer_current_list_size
-             (&field_map->entries, field_map_entry_t);
-         i++)
+    /*
+     * Otherwise, try the entry after the last one we found, since
+     * fields are usually in order.  If that's not it, fall back on a
+     * binary search.
+     */
+
+    i = field_map->last_index + 1;
+
+    if ((i >= num_entries) ||
+        (entries[i].field_number != field_number))
     {
-        if (entries[i].field_number == field_number)
+        i = find_entry(entries, num_entries, field_number);
+
+        if ((i == num_entries) ||
+            (entries[i].field_number != field_number))
         {
             /*
-             * Found one!  Return the callback.
+             * There isn't a matching callback.
              */
 
-            return entries[i].callback;
+            return NULL;
         }
     }
 
     /*
-     * If we fall through the loop, there wasn't a matching callack.
+     * Found one!  Return the callback.
      */
 
+    field_map->last_index = i;
+    return entries[i].callback;
+}
+
+
+push_callback_t *
+push_protobuf_field_map_get_tag_callback
+    (push_protobuf_field_map_t *field_map,
+     push_protobuf_tag_t tag)
+{
+    if ((tag >> 3) < field_map->dense_size)
+        return field_map->tags[tag];
+
     return NULL;
 }
 
@@ -288,6 +514,173 @@ verify_tag_new(const char *name,
 }
 
 
+/*-----------------------------------------------------------------------
+ * Choose tag callback
+ */
+
+/**
+ * A callback for repeated scalar fields, which can be encoded either
+ * one element per tag, or packed into a length-delimited run.  The
+ * field tag should be passed in as input as a uint32_t.  Depending on
+ * its tag type, we activate either the element callback or the packed
+ * callback; if it's neither, we throw a parse error.
+ */
+
+typedef struct _choose_tag
+{
+    /**
+     * The push_callback_t superclass for this callback.
+     */
+
+    push_callback_t  callback;
+
+    /**
+     * The tag type of a single element.
+     */
+
+    push_protobuf_tag_type_t  element_tag_type;
+
+    /**
+     * The callback that reads a single element.
+     */
+
+    push_callback_t  *element;
+
+    /**
+     * The callback that reads a packed run of elements.
+     */
+
+    push_callback_t  *packed;
+
+} choose_tag_t;
+
+
+static void
+choose_tag_set_success(void *user_data,
+                       push_success_continuation_t *success)
+{
+    choose_tag_t  *choose_tag = (choose_tag_t *) user_data;
+
+    push_continuation_call(&choose_tag->element->set_success,
+                           success);
+    push_continuation_call(&choose_tag->packed->set_success,
+                           success);
+}
+
+
+static void
+choose_tag_set_incomplete(void *user_data,
+                          push_incomplete_continuation_t *incomplete)
+{
+    choose_tag_t  *choose_tag = (choose_tag_t *) user_data;
+
+    push_continuation_call(&choose_tag->element->set_incomplete,
+                           incomplete);
+    push_continuation_call(&choose_tag->packed->set_incomplete,
+                           incomplete);
+}
+
+
+static void
+choose_tag_set_error(void *user_data,
+                     push_error_continuation_t *error)
+{
+    choose_tag_t  *choose_tag = (choose_tag_t *) user_data;
+
+    choose_tag->callback.error = error;
+
+    push_continuation_call(&choose_tag->element->set_error,
+                           error);
+    push_continuation_call(&choose_tag->packed->set_error,
+                           error);
+}
+
+
+static void
+choose_tag_activate(void *user_data,
+                    void *result,
+                    const void *buf,
+                    size_t bytes_remaining)
+{
+    choose_tag_t  *choose_tag = (choose_tag_t *) user_data;
+    push_protobuf_tag_t  *tag = (push_protobuf_tag_t *) result;
+    push_protobuf_tag_type_t  tag_type = PUSH_PROTOBUF_GET_TAG_TYPE(*tag);
+
+    PUSH_DEBUG_MSG("%s: Activating.  Got tag 0x%04"PRIx32"\n",
+                   push_talloc_get_name(choose_tag),
+                   *tag);
+
+    if (tag_type == choose_tag->element_tag_type)
+    {
+        push_continuation_call(&choose_tag->element->activate,
+                               NULL,
+                               buf, bytes_remaining);
+        return;
+    }
+
+    if (tag_type == PUSH_PROTOBUF_TAG_TYPE_LENGTH_DELIMITED)
+    {
+        push_continuation_call(&choose_tag->packed->activate,
+                               NULL,
+                               buf, bytes_remaining);
+        return;
+    }
+
+    PUSH_DEBUG_MSG("%s: Tag types don't match.\n",
+                   push_talloc_get_name(choose_tag));
+
+    push_continuation_call(choose_tag->callback.error,
+                           PUSH_PARSE_ERROR,
+                           "Tag types don't match");
+}
+
+
+static push_callback_t *
+choose_tag_new(const char *name,
+               void *parent,
+               push_parser_t *parser,
+               push_protobuf_tag_type_t element_tag_type,
+               push_callback_t *element,
+               push_callback_t *packed)
+{
+    choose_tag_t  *choose_tag;
+
+    /*
+     * If either callback is NULL, return NULL ourselves.
+     */
+
+    if ((element == NULL) || (packed == NULL))
+        return NULL;
+
+    choose_tag = push_talloc(parent, choose_tag_t);
+    if (choose_tag == NULL)
+        return NULL;
+
+    /*
+     * Fill in the data items.
+     */
+
+    choose_tag->element_tag_type = element_tag_type;
+    choose_tag->element = element;
+    choose_tag->packed = packed;
+
+    /*
+     * Initialize the push_callback_t instance.
+     */
+
+    if (name == NULL) name = "choose_tag";
+    push_talloc_set_name_const(choose_tag, name);
+
+    push_callback_init(&choose_tag->callback, parser, choose_tag,
+                       choose_tag_activate,
+                       choose_tag_set_success,
+                       choose_tag_set_incomplete,
+                       choose_tag_set_error);
+
+    return &choose_tag->callback;
+}
+
+
 /*-----------------------------------------------------------------------
  * Field callbacks
  */
@@ -350,6 +743,113 @@ create_field_callback(const char *name,
 }
 
 
+/**
+ * Grow the dense tables so that they can hold new_size field numbers.
+ * The new elements are cleared.
+ */
+
+static bool
+grow_dense_tables(push_protobuf_field_map_t *field_map,
+                  push_protobuf_tag_number_t new_size)
+{
+    push_callback_t  **dense;
+    push_callback_t  **tags;
+    push_protobuf_tag_t  i;
+
+    dense = push_talloc_realloc(field_map, field_map->dense,
+                                push_callback_t *, new_size);
+    if (dense == NULL) return false;
+    field_map->dense = dense;
+
+    tags = push_talloc_realloc(field_map, field_map->tags,
+                               push_callback_t *, new_size << 3);
+    if (tags == NULL) return false;
+    field_map->tags = tags;
+
+    for (i = field_map->dense_size; i < new_size; i++)
+        dense[i] = NULL;
+
+    for (i = field_map->dense_size << 3; i < (new_size << 3); i++)
+        tags[i] = NULL;
+
+    field_map->dense_size = new_size;
+    return true;
+}
+
+
+/**
+ * Add a field callback to the entry list and the dense table.  The
+ * caller fills in the tag table.
+ */
+
+static bool
+add_entry(push_protobuf_field_map_t *field_map,
+          push_protobuf_tag_number_t field_number,
+          push_callback_t *field)
+{
+    field_map_entry_t  *new_entry;
+    field_map_entry_t  *entries;
+    unsigned int  num_entries;
+    unsigned int  i;
+
+    /*
+     * If this is a small field number, make sure the dense tables are
+     * large enough to hold it.
+     */
+
+    if ((field_number < DENSE_LIMIT) &&
+        (field_number >= field_map->dense_size))
+    {
+        if (!grow_dense_tables(field_map, field_number + 1))
+            return false;
+    }
+
+    /*
+     * Then try to allocate a new element in the list of field
+     * callbacks.  If we can't, return an error code.
+     */
+
+    new_entry =
+        hwm_buffer_append_list_elem(&field_map->entries,
+                                    field_map_entry_t);
+    if (new_entry == NULL) return false;
+
+    /*
+     * Keep the list sorted by field number.
+     */
+
+    entries =
+        hwm_buffer_writable_mem(&field_map->entries, field_map_entry_t);
+    num_entries =
+        hwm_buffer_current_list_size(&field_map->entries,
+                                     field_map_entry_t);
+
+    for (i = num_entries - 1;
+         (i > 0) && (entries[i-1].field_number > field_number);
+         i--)
+    {
+        entries[i] = entries[i-1];
+    }
+
+    /*
+     * Stash the number and callback into the slot that we just
+     * opened up.
+     */
+
+    entries[i].field_number = field_number;
+    entries[i].callback = field;
+
+    /*
+     * Small field numbers also go into the dense table.
+     */
+
+    if (field_number < DENSE_LIMIT)
+        field_map->dense[field_number] = field;
+
+    return true;
+}
+
+
 bool
 push_protobuf_field_map_add_field
 (const char *name,
@@ -360,22 +860,25 @@ push_protobuf_field_map_add_field
  push_callback_t *value_callback)
 {
     void  *context;
-    field_map_entry_t  *new_entry;
     push_callback_t  *field;
 
     /*
-     * If the field map or value callback is NULL, return false.
+     * If the field map or value callback is NULL, or the field number
+     * is already taken, return false.
      */
 
     if ((field_map == NULL) || (value_callback == NULL))
         return false;
 
+    if (push_protobuf_field_map_get_field(field_map, field_number) != NULL)
+        return false;
+
     /*
      * Create a memory context for the objects we're about to create.
      */
 
     context = push_talloc_new(field_map);
-    if (context == NULL) return NULL;
+    if (context == NULL) return false;
 
     /*
      * First, try to create a field callback for this field.
@@ -387,23 +890,86 @@ push_protobuf_field_map_add_field
                               value_callback);
     if (field == NULL) goto error;
 
+    if (!add_entry(field_map, field_number, field))
+        goto error;
+
+    if (field_number < DENSE_LIMIT)
+    {
+        field_map->tags[PUSH_PROTOBUF_MAKE_TAG
+                        (field_number, expected_tag_type)] =
+            value_callback;
+    }
+
+    return true;
+
+  error:
+    /*
+     * Before returning, free any objects we created before the error.
+     */
+
+    push_talloc_free(context);
+    return false;
+}
+
+
+bool
+push_protobuf_field_map_add_packable_field
+(const char *name,
+ push_parser_t *parser,
+ push_protobuf_field_map_t *field_map,
+ push_protobuf_tag_number_t field_number,
+ push_protobuf_tag_type_t element_tag_type,
+ push_callback_t *element_callback,
+ push_callback_t *packed_callback)
+{
+    void  *context;
+    push_callback_t  *field;
+
     /*
-     * Then try to allocate a new element in the list of field
-     * callbacks.  If we can't, return an error code.
+     * If the field map or either value callback is NULL, or the field
+     * number is already taken, return false.
      */
 
-    new_entry =
-        hwm_buffer_append_list_elem(&field_map->entries,
-                                    field_map_entry_t);
-    if (new_entry == NULL) goto error;
+    if ((field_map == NULL) ||
+        (element_callback == NULL) || (packed_callback == NULL))
+        return false;
+
+    if (push_protobuf_field_map_get_field(field_map, field_number) != NULL)
+        return false;
+
+    /*
+     * Create a memory context for the objects we're about to create.
+     */
+
+    context = push_talloc_new(field_map);
+    if (context == NULL) return false;
+
+    if (name == NULL) name = "field";
+
+    field = choose_tag_new
+        (push_talloc_asprintf(context, "%s.choose-tag", name),
+         context, parser,
+         element_tag_type, element_callback, packed_callback);
+    if (field == NULL) goto error;
+
+    if (!add_entry(field_map, field_number, field))
+        goto error;
 
     /*
-     * If the allocation worked, stash the number and callback into
-     * the new entry.
+     * Both encodings go into the tag table, so that the message
+     * callback can dispatch either one directly.
      */
 
-    new_entry->field_number = field_number;
-    new_entry->callback = field;
+    if (field_number < DENSE_LIMIT)
+    {
+        field_map->tags[PUSH_PROTOBUF_MAKE_TAG
+                        (field_number, element_tag_type)] =
+            element_callback;
+        field_map->tags[PUSH_PROTOBUF_MAKE_TAG
+                        (field_number,
+                         PUSH_PROTOBUF_TAG_TYPE_LENGTH_DELIMITED)] =
+            packed_callback;
+    }
 
     return true;
 
@@ -0,0 +1,181 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2010, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the LICENSE.txt file in this distribution for license
+ * details.
+ * ----------------------------------------------------------------------
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <hwm-buffer.h>
+
+#include <push/basics.h>
+
+#include <push/protobuf/basics.h>
+#include <push/protobuf/field-stats.h>
+
+
+void
+push_protobuf_field_stats_init(push_protobuf_field_stats_t *stats)
+{
+    hwm_buffer_init(&stats->entries);
+    hwm_buffer_init(&stats->dense);
+}
+
+
+void
+push_protobuf_field_stats_done(push_protobuf_field_stats_t *stats)
+{
+    hwm_buffer_done(&stats->entries);
+    hwm_buffer_done(&stats->dense);
+}
+
+
+void
+push_protobuf_field_stats_clear(push_protobuf_field_stats_t *stats)
+{
+    hwm_buffer_clear(&stats->entries);
+    hwm_buffer_clear(&stats->dense);
+}
+
+
+size_t
+push_protobuf_field_stats_count(const push_protobuf_field_stats_t *stats)
+{
+    return hwm_buffer_current_list_size(&stats->entries,
+                                        push_protobuf_field_stat_t);
+}
+
+
+const push_protobuf_field_stat_t *
+push_protobuf_field_stats_get(const push_protobuf_field_stats_t *stats,
+                              size_t index)
+{
+    if (index >= push_protobuf_field_stats_count(stats))
+        return NULL;
+
+    return hwm_buffer_mem(&stats->entries,
+                          push_protobuf_field_stat_t) + index;
+}
+
+
+/**
+ * Find the index of the entry for a field number.  Returns false if
+ * the field number hasn't appeared.
+ */
+
+static bool
+field_stats_index(const push_protobuf_field_stats_t *stats,
+                  push_protobuf_tag_number_t number,
+                  size_t *index)
+{
+    const push_protobuf_field_stat_t  *entries;
+    size_t  count;
+    size_t  i;
+
+    if (number < PUSH_PROTOBUF_FIELD_STATS_DENSE_LIMIT)
+    {
+        uint32_t  slot;
+
+        if (number >= hwm_buffer_current_list_size(&stats->dense,
+                                                   uint32_t))
+            return false;
+
+        slot = hwm_buffer_mem(&stats->dense, uint32_t)[number];
+        if (slot == 0)
+            return false;
+
+        *index = slot - 1;
+        return true;
+    }
+
+    /*
+     * Large field numbers are rare, so a linear search is fine.
+     */
+
+    entries = hwm_buffer_mem(&stats->entries, push_protobuf_field_stat_t);
+    count = push_protobuf_field_stats_count(stats);
+
+    for (i = 0; i < count; i++)
+    {
+        if (entries[i].number == number)
+        {
+            *index = i;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+const push_protobuf_field_stat_t *
+push_protobuf_field_stats_find(const push_protobuf_field_stats_t *stats,
+                               push_protobuf_tag_number_t number)
+{
+    size_t  index;
+
+    if (!field_stats_index(stats, number, &index))
+        return NULL;
+
+    return push_protobuf_field_stats_get(stats, index);
+}
+
+
+bool
+push_protobuf_field_stats_add(push_protobuf_field_stats_t *stats,
+                              push_protobuf_tag_number_t number,
+                              size_t *index)
+{
+    push_protobuf_field_stat_t  *entry;
+
+    if (field_stats_index(stats, number, index))
+        return true;
+
+    /*
+     * Grow the dense table to cover the field number, clearing the
+     * new slots.
+     */
+
+    if (number < PUSH_PROTOBUF_FIELD_STATS_DENSE_LIMIT)
+    {
+        size_t  old_size = stats->dense.current_size;
+        size_t  size = (number + 1) * sizeof(uint32_t);
+
+        if (size > old_size)
+        {
+            if (!hwm_buffer_ensure_size(&stats->dense, size))
+                return false;
+
+            memset(hwm_buffer_writable_mem(&stats->dense, uint8_t) +
+                   old_size, 0, size - old_size);
+            stats->dense.current_size = size;
+        }
+    }
+
+    *index = push_protobuf_field_stats_count(stats);
+
+    entry = hwm_buffer_append_list_elem(&stats->entries,
+                                        push_protobuf_field_stat_t);
+    if (entry == NULL)
+        return false;
+
+    entry->number = number;
+    entry->occurrences = 0;
+    entry->bytes = 0;
+    entry->failures = 0;
+
+    if (number < PUSH_PROTOBUF_FIELD_STATS_DENSE_LIMIT)
+    {
+        hwm_buffer_writable_mem(&stats->dense, uint32_t)[number] =
+            *index + 1;
+    }
+
+    return true;
+}
@@ -0,0 +1,271 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2010, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the LICENSE.txt file in this distribution for license
+ * details.
+ * ----------------------------------------------------------------------
+ */
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <push/basics.h>
+#include <push/talloc.h>
+
+#include <push/protobuf/basics.h>
+#include <push/protobuf/primitives.h>
+#include <push/protobuf/varint.h>
+
+
+/**
+ * The user data struct for a fixed32 or fixed64 callback.
+ */
+
+typedef struct _pb_fixed
+{
+    /**
+     * The push_callback_t superclass for this callback.
+     */
+
+    push_callback_t  callback;
+
+    /**
+     * The continue continuation for this callback.
+     */
+
+    push_continue_continuation_t  cont;
+
+    /**
+     * The size of the value: either 4 or 8 bytes.
+     */
+
+    size_t  size;
+
+    /**
+     * The bytes of a value that straddles two data chunks.
+     */
+
+    uint8_t  partial[sizeof(uint64_t)];
+
+    /**
+     * The number of bytes in the partial buffer.
+     */
+
+    size_t  partial_size;
+
+    /**
+     * The parsed value, if this is a fixed32 callback.
+     */
+
+    uint32_t  value32;
+
+    /**
+     * The parsed value, if this is a fixed64 callback.
+     */
+
+    uint64_t  value64;
+
+} pb_fixed_t;
+
+
+/**
+ * Decode the value from a buffer that's known to contain all of it,
+ * and pass it on to the success continuation.
+ */
+
+static void
+pb_fixed_succeed(pb_fixed_t *fixed,
+                 const void *value_buf,
+                 const void *buf,
+                 size_t bytes_remaining)
+{
+    void  *result;
+
+    if (fixed->size == sizeof(uint32_t))
+    {
+        fixed->value32 = push_protobuf_load_le32(value_buf);
+        result = &fixed->value32;
+
+        PUSH_DEBUG_MSG("%s: Read value %"PRIu32".\n",
+                       push_talloc_get_name(fixed),
+                       fixed->value32);
+    } else {
+        fixed->value64 = push_protobuf_load_le64(value_buf);
+        result = &fixed->value64;
+
+        PUSH_DEBUG_MSG("%s: Read value %"PRIu64".\n",
+                       push_talloc_get_name(fixed),
+                       fixed->value64);
+    }
+
+    push_continuation_call(fixed->callback.success,
+                           result,
+                           buf, bytes_remaining);
+}
+
+
+static void
+pb_fixed_continue(void *user_data,
+                  const void *buf,
+                  size_t bytes_remaining)
+{
+    pb_fixed_t  *fixed = (pb_fixed_t *) user_data;
+    size_t  bytes_to_copy;
+
+    if (bytes_remaining == 0)
+    {
+        PUSH_DEBUG_MSG("%s: Reached EOF before end of value.\n",
+                       push_talloc_get_name(fixed));
+
+        push_continuation_call(fixed->callback.error,
+                               PUSH_PARSE_ERROR,
+                               "Reached EOF before end of value");
+
+        return;
+    }
+
+    /*
+     * Fast path: if we haven't seen any of the value yet, and it's
+     * entirely contained in this chunk, load it straight from the
+     * chunk.
+     */
+
+    if ((fixed->partial_size == 0) && (bytes_remaining >= fixed->size))
+    {
+        const void  *value_buf = buf;
+
+        buf += fixed->size;
+        bytes_remaining -= fixed->size;
+
+        pb_fixed_succeed(fixed, value_buf, buf, bytes_remaining);
+        return;
+    }
+
+    /*
+     * Slow path: the value straddles a chunk boundary, so we collect
+     * its bytes in the partial buffer.
+     */
+
+    bytes_to_copy = fixed->size - fixed->partial_size;
+    if (bytes_to_copy > bytes_remaining)
+        bytes_to_copy = bytes_remaining;
+
+    PUSH_DEBUG_MSG("%s: Using slow path on %zu bytes.\n",
+                   push_talloc_get_name(fixed),
+                   bytes_to_copy);
+
+    memcpy(fixed->partial + fixed->partial_size, buf, bytes_to_copy);
+    fixed->partial_size += bytes_to_copy;
+    buf += bytes_to_copy;
+    bytes_remaining -= bytes_to_copy;
+
+    if (fixed->partial_size == fixed->size)
+    {
+        pb_fixed_succeed(fixed, fixed->partial, buf, bytes_remaining);
+        return;
+    }
+
+    push_continuation_call(fixed->callback.incomplete,
+                           &fixed->cont);
+}
+
+
+static void
+pb_fixed_activate(void *user_data,
+                  void *result,
+                  const void *buf,
+                  size_t bytes_remaining)
+{
+    pb_fixed_t  *fixed = (pb_fixed_t *) user_data;
+
+    PUSH_DEBUG_MSG("%s: Activating with %zu bytes.\n",
+                   push_talloc_get_name(fixed),
+                   bytes_remaining);
+
+    fixed->partial_size = 0;
+
+    if (bytes_remaining == 0)
+    {
+        /*
+         * If we don't get any data when we're activated, return an
+         * incomplete and wait for some data.
+         */
+
+        push_continuation_call(fixed->callback.incomplete,
+                               &fixed->cont);
+
+        return;
+
+    } else {
+        /*
+         * Otherwise let the continue continuation go ahead and
+         * process this chunk of data.
+         */
+
+        pb_fixed_continue(user_data, buf, bytes_remaining);
+        return;
+    }
+}
+
+
+static push_callback_t *
+pb_fixed_new(const char *name,
+             void *parent,
+             push_parser_t *parser,
+             size_t size)
+{
+    pb_fixed_t  *fixed = push_talloc(parent, pb_fixed_t);
+
+    if (fixed == NULL)
+        return NULL;
+
+    /*
+     * Fill in the data items.
+     */
+
+    fixed->size = size;
+
+    /*
+     * Initialize the push_callback_t instance.
+     */
+
+    push_talloc_set_name_const(fixed, name);
+
+    push_callback_init(&fixed->callback, parser, fixed,
+                       pb_fixed_activate,
+                       NULL, NULL, NULL);
+
+    /*
+     * Fill in the continuation objects for the continuations that we
+     * implement.
+     */
+
+    push_continuation_set(&fixed->cont,
+                          pb_fixed_continue,
+                          fixed);
+
+    return &fixed->callback;
+}
+
+
+push_callback_t *
+push_protobuf_fixed32_new(const char *name,
+                          void *parent,
+                          push_parser_t *parser)
+{
+    if (name == NULL) name = "fixed32";
+    return pb_fixed_new(name, parent, parser, sizeof(uint32_t));
+}
+
+
+push_callback_t *
+push_protobuf_fixed64_new(const char *name,
+                          void *parent,
+                          push_parser_t *parser)
+{
+    if (name == NULL) name = "fixed64";
+    return pb_fixed_new(name, parent, parser, sizeof(uint64_t));
+}
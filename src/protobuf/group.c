@@ -0,0 +1,781 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2010, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the LICENSE.txt file in this distribution for license
+ * details.
+ * ----------------------------------------------------------------------
+ */
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <push/basics.h>
+#include <push/talloc.h>
+
+#include <push/protobuf/basics.h>
+#include <push/protobuf/field-map.h>
+#include <push/protobuf/field-stats.h>
+#include <push/protobuf/message.h>
+#include <push/protobuf/primitives.h>
+#include <push/protobuf/unknown.h>
+
+
+/*-----------------------------------------------------------------------
+ * Group callback
+ */
+
+/**
+ * A callback that reads the fields of a group, up to and including
+ * the END_GROUP tag that matches the group's START_GROUP.  A group
+ * doesn't have a length prefix, so we can't wrap a message callback
+ * in a max-bytes callback, like we do for submessages.  Instead, we
+ * run the tag loop ourselves: we read each tag, dispatch its value to
+ * the field map, and come back here when the value has been read.
+ * Like the message callback, we decode one- and two-byte tags
+ * directly, and look up their value callbacks in the field map's tag
+ * table; longer tags, and tags that span chunks, are read with a
+ * varint32 callback.  If the group's field map is tracking
+ * statistics, we count each field the same way that the message
+ * callback does; since every field callback already comes back to
+ * us, we don't need a separate tracker object.
+ */
+
+typedef struct _group
+{
+    /**
+     * The push_callback_t superclass for this callback.
+     */
+
+    push_callback_t  callback;
+
+    /**
+     * The continue continuation that we use when we need more data
+     * to read the next tag.
+     */
+
+    push_continue_continuation_t  cont;
+
+    /**
+     * The continue continuation that we pass on when a field callback
+     * needs more data, and we're counting its bytes.
+     */
+
+    push_continue_continuation_t  field_cont;
+
+    /**
+     * The success continuation for the field callbacks and the
+     * skipper.  Once a field's value has been read, we read the next
+     * tag.
+     */
+
+    push_success_continuation_t  field_success;
+
+    /**
+     * The incomplete continuation for the field callbacks, the
+     * skipper, and the tag reader.  This passes the incomplete on to
+     * our own incomplete continuation, so that we don't have to
+     * rewire all of the field callbacks whenever it changes.
+     */
+
+    push_incomplete_continuation_t  field_incomplete;
+
+    /**
+     * The error continuation for the field callbacks, the skipper,
+     * and the tag reader.
+     */
+
+    push_error_continuation_t  field_error;
+
+    /**
+     * The success continuation for the tag reader.
+     */
+
+    push_success_continuation_t  tag_success;
+
+    /**
+     * A mapping of field numbers to the callback that reads the
+     * corresponding field.
+     */
+
+    push_protobuf_field_map_t  *field_map;
+
+    /**
+     * A callback that can skip unknown fields of any wire type, or
+     * record them, if the field map is preserving unknown fields.
+     */
+
+    push_callback_t  *skip_field;
+
+    /**
+     * A callback that reads tags that we can't decode directly.
+     */
+
+    push_callback_t  *read_tag;
+
+    /**
+     * The presence bitmap to update, or NULL if we're not tracking
+     * presence.
+     */
+
+    uint64_t  *presence;
+
+    /**
+     * The presence bits of the required fields.
+     */
+
+    uint64_t  required;
+
+    /**
+     * The parser whose limits we enforce.
+     */
+
+    push_parser_t  *parser;
+
+    /**
+     * The END_GROUP tag that finishes the group.
+     */
+
+    push_protobuf_tag_t  end_tag;
+
+    /**
+     * The tag of the field that we're currently reading, when it's
+     * passed as input to a field callback or the skipper.
+     */
+
+    push_protobuf_tag_t  tag;
+
+    /**
+     * The statistics to update, or NULL if we're not tracking
+     * statistics.
+     */
+
+    push_protobuf_field_stats_t  *stats;
+
+    /**
+     * Whether a field callback is running, and its statistics need
+     * to be updated when it finishes.
+     */
+
+    bool  tracking;
+
+    /**
+     * The index of the current field's entry in stats.
+     */
+
+    size_t  index;
+
+    /**
+     * The number of bytes that the current field has used so far.
+     */
+
+    uint64_t  bytes;
+
+    /**
+     * The number of bytes that were available when the current field
+     * callback last received data.
+     */
+
+    size_t  available;
+
+    /**
+     * The continue continuation of the field callback that's waiting
+     * for more data.
+     */
+
+    push_continue_continuation_t  *next_cont;
+
+} group_t;
+
+
+/**
+ * Return the number of bytes in a tag's varint encoding.
+ */
+
+static inline size_t
+encoded_tag_size(push_protobuf_tag_t tag)
+{
+    size_t  size = 1;
+
+    while (tag >= 0x80)
+    {
+        tag >>= 7;
+        size++;
+    }
+
+    return size;
+}
+
+
+static inline push_protobuf_field_stat_t *
+group_current_stat(group_t *group)
+{
+    return hwm_buffer_writable_mem(&group->stats->entries,
+                                   push_protobuf_field_stat_t) +
+        group->index;
+}
+
+
+/**
+ * Start counting a field, whose tag has already been read.  Returns
+ * false if we can't allocate an entry for the field.
+ */
+
+static bool
+group_track_start(group_t *group,
+                  push_protobuf_tag_t tag,
+                  size_t bytes_remaining)
+{
+    if (!push_protobuf_field_stats_add(group->stats,
+                                       PUSH_PROTOBUF_GET_TAG_NUMBER(tag),
+                                       &group->index))
+        return false;
+
+    group_current_stat(group)->occurrences++;
+
+    group->tracking = true;
+    group->bytes = encoded_tag_size(tag);
+    group->available = bytes_remaining;
+    return true;
+}
+
+
+static void
+group_finish(group_t *group)
+{
+    push_parser_leave_value(group->parser);
+}
+
+
+static void
+group_fail(group_t *group,
+           push_error_code_t error_code,
+           const char *error_message)
+{
+    group_finish(group);
+    push_continuation_call(group->callback.error,
+                           error_code, error_message);
+}
+
+
+/**
+ * Dispatch the value of a field, once we've read its tag.
+ */
+
+static void
+group_dispatch(group_t *group,
+               push_protobuf_tag_t tag,
+               const void *buf,
+               size_t bytes_remaining)
+{
+    push_callback_t  *value_callback;
+    void  *input;
+
+    if (tag == group->end_tag)
+    {
+        PUSH_DEBUG_MSG("%s: Reached end of group.\n",
+                       push_talloc_get_name(group));
+
+        if ((group->presence != NULL) &&
+            ((*group->presence & group->required) != group->required))
+        {
+            PUSH_DEBUG_MSG("%s: Missing required fields "
+                           "(have 0x%016"PRIx64", need 0x%016"PRIx64").\n",
+                           push_talloc_get_name(group),
+                           *group->presence, group->required);
+
+            group_fail(group, PUSH_PARSE_ERROR,
+                       "Missing required field");
+            return;
+        }
+
+        group_finish(group);
+        push_continuation_call(group->callback.success,
+                               NULL,
+                               buf, bytes_remaining);
+        return;
+    }
+
+    if (!push_parser_count_field(group->parser))
+    {
+        PUSH_DEBUG_MSG("%s: Too many fields.\n",
+                       push_talloc_get_name(group));
+
+        group_fail(group, PUSH_PARSE_ERROR, "Too many fields");
+        return;
+    }
+
+    /*
+     * If the tag is in the field map's tag table, the value callback
+     * doesn't need to see the tag.  Otherwise, the full field callback
+     * verifies the wire type.  If there isn't one, skip the field,
+     * whatever its wire type.  (The skipper rejects an END_GROUP for
+     * any other group.)
+     */
+
+    if ((group->stats != NULL) &&
+        !group_track_start(group, tag, bytes_remaining))
+    {
+        group_fail(group, PUSH_MEMORY_ERROR,
+                   "Cannot record field statistics");
+        return;
+    }
+
+    group->tag = tag;
+
+    value_callback =
+        push_protobuf_field_map_get_tag_callback(group->field_map, tag);
+
+    if (value_callback != NULL)
+    {
+        input = NULL;
+    } else {
+        input = &group->tag;
+        value_callback =
+            push_protobuf_field_map_get_field
+            (group->field_map, PUSH_PROTOBUF_GET_TAG_NUMBER(tag));
+
+        if (value_callback == NULL)
+        {
+            PUSH_DEBUG_MSG("%s: No field callback for tag "
+                           "0x%04"PRIx32".  Skipping.\n",
+                           push_talloc_get_name(group),
+                           tag);
+
+            push_continuation_call(&group->skip_field->activate,
+                                   &group->tag,
+                                   buf, bytes_remaining);
+            return;
+        }
+    }
+
+    if (group->presence != NULL)
+    {
+        *group->presence |=
+            PUSH_PROTOBUF_PRESENCE_BIT(PUSH_PROTOBUF_GET_TAG_NUMBER(tag));
+    }
+
+    PUSH_DEBUG_MSG("%s: Tag 0x%04"PRIx32" matches callback %p.\n",
+                   push_talloc_get_name(group),
+                   tag, value_callback);
+
+    push_continuation_call(&value_callback->activate,
+                           input,
+                           buf, bytes_remaining);
+}
+
+
+/**
+ * Read the next tag of the group.
+ */
+
+static void
+group_read_tag(group_t *group,
+               const void *buf,
+               size_t bytes_remaining)
+{
+    const uint8_t  *bbuf = (const uint8_t *) buf;
+
+    if (bytes_remaining == 0)
+    {
+        PUSH_DEBUG_MSG("%s: Need more data for next tag.\n",
+                       push_talloc_get_name(group));
+
+        push_continuation_call(group->callback.incomplete,
+                               &group->cont);
+        return;
+    }
+
+    if (bbuf[0] < 0x80)
+    {
+        group_dispatch(group, bbuf[0],
+                       bbuf + 1, bytes_remaining - 1);
+        return;
+    }
+
+    if ((bytes_remaining >= 2) && (bbuf[1] < 0x80))
+    {
+        group_dispatch(group,
+                       (bbuf[0] & 0x7f) |
+                       (((push_protobuf_tag_t) bbuf[1]) << 7),
+                       bbuf + 2, bytes_remaining - 2);
+        return;
+    }
+
+    push_continuation_call(&group->read_tag->activate,
+                           NULL,
+                           buf, bytes_remaining);
+}
+
+
+static void
+group_continue(void *user_data,
+               const void *buf,
+               size_t bytes_remaining)
+{
+    group_t  *group = (group_t *) user_data;
+
+    if (bytes_remaining == 0)
+    {
+        PUSH_DEBUG_MSG("%s: Reached EOF before end of group.\n",
+                       push_talloc_get_name(group));
+
+        group_fail(group, PUSH_PARSE_ERROR,
+                   "Reached EOF before end of group");
+        return;
+    }
+
+    group_read_tag(group, buf, bytes_remaining);
+}
+
+
+static void
+group_field_success(void *user_data,
+                    void *result,
+                    const void *buf,
+                    size_t bytes_remaining)
+{
+    group_t  *group = (group_t *) user_data;
+
+    if (group->tracking)
+    {
+        group_current_stat(group)->bytes +=
+            group->bytes + (group->available - bytes_remaining);
+        group->tracking = false;
+    }
+
+    group_read_tag(group, buf, bytes_remaining);
+}
+
+
+static void
+group_field_incomplete(void *user_data,
+                       push_continue_continuation_t *cont)
+{
+    group_t  *group = (group_t *) user_data;
+
+    if (group->tracking)
+    {
+        /*
+         * The field callback has used up all of the data it was
+         * given.
+         */
+
+        group->bytes += group->available;
+        group->next_cont = cont;
+        cont = &group->field_cont;
+    }
+
+    push_continuation_call(group->callback.incomplete, cont);
+}
+
+
+static void
+group_field_continue(void *user_data,
+                     const void *buf,
+                     size_t bytes_remaining)
+{
+    group_t  *group = (group_t *) user_data;
+
+    group->available = bytes_remaining;
+
+    push_continuation_call(group->next_cont,
+                           buf, bytes_remaining);
+}
+
+
+static void
+group_field_error(void *user_data,
+                  push_error_code_t error_code,
+                  const char *error_message)
+{
+    group_t  *group = (group_t *) user_data;
+
+    if (group->tracking)
+    {
+        group_current_stat(group)->failures++;
+        group->tracking = false;
+    }
+
+    group_fail(group, error_code, error_message);
+}
+
+
+static void
+group_tag_success(void *user_data,
+                  void *result,
+                  const void *buf,
+                  size_t bytes_remaining)
+{
+    group_t  *group = (group_t *) user_data;
+    uint32_t  *tag = (uint32_t *) result;
+
+    group_dispatch(group, *tag, buf, bytes_remaining);
+}
+
+
+static void
+group_activate(void *user_data,
+               void *result,
+               const void *buf,
+               size_t bytes_remaining)
+{
+    group_t  *group = (group_t *) user_data;
+    const char  *error_message;
+
+    PUSH_DEBUG_MSG("%s: Activating.\n",
+                   push_talloc_get_name(group));
+
+    /*
+     * A group has no length prefix, so only its depth is limited.
+     */
+
+    error_message = push_parser_enter_value(group->parser, 0);
+    if (error_message != NULL)
+    {
+        PUSH_DEBUG_MSG("%s: %s.\n",
+                       push_talloc_get_name(group),
+                       error_message);
+
+        push_continuation_call(group->callback.error,
+                               PUSH_PARSE_ERROR,
+                               error_message);
+        return;
+    }
+
+    if (group->presence != NULL)
+        *group->presence = 0;
+
+    group->tracking = false;
+
+    group_read_tag(group, buf, bytes_remaining);
+}
+
+
+push_callback_t *
+push_protobuf_group_new(const char *name,
+                        void *parent,
+                        push_parser_t *parser,
+                        push_protobuf_field_map_t *field_map,
+                        push_protobuf_tag_number_t field_number)
+{
+    void  *context;
+    group_t  *group;
+    push_protobuf_unknown_fields_t  *unknown_fields;
+
+    /*
+     * If the field map is NULL, return NULL ourselves.
+     */
+
+    if (field_map == NULL)
+        return NULL;
+
+    /*
+     * Create a memory context for the objects we're about to create.
+     */
+
+    context = push_talloc_new(parent);
+    if (context == NULL) return NULL;
+
+    /*
+     * Create the callbacks.
+     */
+
+    if (name == NULL) name = "group";
+
+    group = push_talloc(context, group_t);
+    if (group == NULL) goto error;
+
+    push_talloc_set_name_const(group, name);
+
+    /*
+     * Make the field map a child of the group callback.
+     */
+
+    push_talloc_steal(group, field_map);
+
+    unknown_fields = push_protobuf_field_map_get_unknown_fields(field_map);
+
+    if (unknown_fields == NULL)
+    {
+        group->skip_field = push_protobuf_skip_field_new
+            (push_talloc_asprintf(context, "%s.skip-field", name),
+             context, parser);
+    } else {
+        group->skip_field = push_protobuf_unknown_field_new
+            (push_talloc_asprintf(context, "%s.unknown-field", name),
+             context, parser, unknown_fields);
+    }
+
+    group->read_tag = push_protobuf_varint32_new
+        (push_talloc_asprintf(context, "%s.tag", name),
+         context, parser);
+
+    if ((group->skip_field == NULL) || (group->read_tag == NULL))
+        goto error;
+
+    /*
+     * Fill in the data items.
+     */
+
+    group->field_map = field_map;
+    group->presence = push_protobuf_field_map_get_presence(field_map);
+    group->required = push_protobuf_field_map_get_required(field_map);
+    group->parser = parser;
+    group->end_tag =
+        PUSH_PROTOBUF_MAKE_TAG(field_number,
+                               PUSH_PROTOBUF_TAG_TYPE_END_GROUP);
+    group->tag = 0;
+    group->stats = push_protobuf_field_map_get_stats(field_map);
+    group->tracking = false;
+    group->index = 0;
+    group->bytes = 0;
+    group->available = 0;
+    group->next_cont = NULL;
+
+    /*
+     * Initialize the push_callback_t instance.
+     */
+
+    push_callback_init(&group->callback, parser, group,
+                       group_activate,
+                       NULL, NULL, NULL);
+
+    /*
+     * Fill in the continuation objects for the continuations that we
+     * implement.
+     */
+
+    push_continuation_set(&group->cont,
+                          group_continue,
+                          group);
+
+    push_continuation_set(&group->field_cont,
+                          group_field_continue,
+                          group);
+
+    push_continuation_set(&group->field_success,
+                          group_field_success,
+                          group);
+
+    push_continuation_set(&group->field_incomplete,
+                          group_field_incomplete,
+                          group);
+
+    push_continuation_set(&group->field_error,
+                          group_field_error,
+                          group);
+
+    push_continuation_set(&group->tag_success,
+                          group_tag_success,
+                          group);
+
+    /*
+     * The callbacks that we wrap always come back to us, so we only
+     * have to wire them up once.
+     */
+
+    push_protobuf_field_map_set_success(field_map, &group->field_success);
+    push_protobuf_field_map_set_incomplete(field_map,
+                                           &group->field_incomplete);
+    push_protobuf_field_map_set_error(field_map, &group->field_error);
+
+    push_continuation_call(&group->skip_field->set_success,
+                           &group->field_success);
+    push_continuation_call(&group->skip_field->set_incomplete,
+                           &group->field_incomplete);
+    push_continuation_call(&group->skip_field->set_error,
+                           &group->field_error);
+
+    push_continuation_call(&group->read_tag->set_success,
+                           &group->tag_success);
+    push_continuation_call(&group->read_tag->set_incomplete,
+                           &group->field_incomplete);
+    push_continuation_call(&group->read_tag->set_error,
+                           &group->field_error);
+
+    return &group->callback;
+
+  error:
+    /*
+     * Before returning, free any objects we created before the error.
+     */
+
+    push_talloc_free(context);
+    return NULL;
+}
+
+
+/*-----------------------------------------------------------------------
+ * Group fields
+ */
+
+bool
+push_protobuf_add_group(const char *message_name,
+                        const char *field_name,
+                        void *parent,
+                        push_parser_t *parser,
+                        push_protobuf_field_map_t *field_map,
+                        push_protobuf_tag_number_t field_number,
+                        push_protobuf_field_map_t *group_field_map)
+{
+    void  *context;
+    const char  *full_field_name;
+    push_callback_t  *group;
+
+    /*
+     * If either field map is NULL, return false.
+     */
+
+    if ((field_map == NULL) || (group_field_map == NULL))
+        return false;
+
+    /*
+     * Create a memory context for the objects we're about to create.
+     */
+
+    context = push_talloc_new(parent);
+    if (context == NULL) return false;
+
+    /*
+     * Create the callbacks.
+     */
+
+    if (message_name == NULL) message_name = "message";
+    if (field_name == NULL) field_name = ".group";
+
+    full_field_name =
+        push_talloc_asprintf(context, "%s.%s",
+                             message_name, field_name);
+
+    group = push_protobuf_group_new
+        (push_talloc_asprintf(context, "%s.group", full_field_name),
+         context, parser, group_field_map, field_number);
+
+    if (group == NULL) goto error;
+
+    /*
+     * Try to add the new field.  If we can't, free the group before
+     * returning.
+     */
+
+    if (!push_protobuf_field_map_add_field
+        (full_field_name, parser, field_map, field_number,
+         PUSH_PROTOBUF_TAG_TYPE_START_GROUP,
+         group))
+    {
+        goto error;
+    }
+
+    return true;
+
+  error:
+    /*
+     * Before returning, free any objects we created before the error.
+     */
+
+    push_talloc_free(context);
+    return false;
+}
@@ -12,6 +12,7 @@
 
 #include <push/basics.h>
 #include <push/combinators.h>
+#include <push/pure.h>
 #include <push/primitives.h>
 #include <push/talloc.h>
 
@@ -20,11 +21,24 @@
 #include <push/protobuf/primitives.h>
 
 
-push_callback_t *
-push_protobuf_hwm_string_new(const char *name,
-                             void *parent,
-                             push_parser_t *parser,
-                             hwm_buffer_t *buf)
+/**
+ * The type of the functions that create the callback that reads the
+ * contents of the string, once we know its length.
+ */
+
+typedef push_callback_t *
+read_string_new_t(const char *name,
+                  void *parent,
+                  push_parser_t *parser,
+                  hwm_buffer_t *buf);
+
+
+static push_callback_t *
+inner_hwm_string_new(const char *name,
+                     void *parent,
+                     push_parser_t *parser,
+                     hwm_buffer_t *buf,
+                     read_string_new_t *read_string_new)
 {
     void  *context;
     push_callback_t  *read_size = NULL;
@@ -42,12 +56,10 @@ push_protobuf_hwm_string_new(const char *name,
      * Create the callbacks.
      */
 
-    if (name == NULL) name = "pb-hwm-string";
-
     read_size = push_protobuf_varint_size_new
         (push_talloc_asprintf(context, "%s.size", name),
          context, parser);
-    read = push_hwm_string_new
+    read = read_string_new
         (push_talloc_asprintf(context, "%s.read", name),
          context, parser, buf);
     compose = push_compose_new
@@ -72,6 +84,30 @@ push_protobuf_hwm_string_new(const char *name,
 }
 
 
+push_callback_t *
+push_protobuf_hwm_string_new(const char *name,
+                             void *parent,
+                             push_parser_t *parser,
+                             hwm_buffer_t *buf)
+{
+    if (name == NULL) name = "pb-hwm-string";
+    return inner_hwm_string_new(name, parent, parser, buf,
+                                push_hwm_string_new);
+}
+
+
+push_callback_t *
+push_protobuf_hwm_string_view_new(const char *name,
+                                  void *parent,
+                                  push_parser_t *parser,
+                                  hwm_buffer_t *buf)
+{
+    if (name == NULL) name = "pb-hwm-string-view";
+    return inner_hwm_string_new(name, parent, parser, buf,
+                                push_hwm_string_view_new);
+}
+
+
 bool
 push_protobuf_add_hwm_string(const char *message_name,
                              const char *field_name,
@@ -140,3 +176,102 @@ push_protobuf_add_hwm_string(const char *message_name,
     push_talloc_free(context);
     return false;
 }
+
+
+static bool
+assign_view(push_string_view_t *dest,
+            push_string_view_t *input,
+            push_string_view_t **output)
+{
+    *dest = *input;
+    *output = dest;
+    return true;
+}
+
+push_define_pure_callback(assign_view_new, assign_view, "assign",
+                          push_string_view_t, push_string_view_t,
+                          push_string_view_t);
+
+
+bool
+push_protobuf_add_string_view(const char *message_name,
+                              const char *field_name,
+                              void *parent,
+                              push_parser_t *parser,
+                              push_protobuf_field_map_t *field_map,
+                              push_protobuf_tag_number_t field_number,
+                              hwm_buffer_t *buf,
+                              push_string_view_t *dest)
+{
+    void  *context;
+    const char  *full_field_name;
+    push_callback_t  *read;
+    push_callback_t  *assign;
+    push_callback_t  *field_callback;
+
+    /*
+     * If the field map is NULL, return false.
+     */
+
+    if (field_map == NULL)
+        return false;
+
+    /*
+     * Create a memory context for the objects we're about to create.
+     */
+
+    context = push_talloc_new(parent);
+    if (context == NULL) return false;
+
+    /*
+     * Create the callbacks.
+     */
+
+    if (message_name == NULL) message_name = "message";
+    if (field_name == NULL) field_name = ".view";
+
+    full_field_name =
+        push_talloc_asprintf(context, "%s.%s",
+                             message_name, field_name);
+
+    read = push_protobuf_hwm_string_view_new
+        (push_talloc_asprintf(context, "%s.read", full_field_name),
+         context, parser, buf);
+    assign = assign_view_new
+        (push_talloc_asprintf(context, "%s.assign", full_field_name),
+         context, parser, dest);
+    field_callback = push_compose_new
+        (push_talloc_asprintf(context, "%s.compose", full_field_name),
+         context, parser, read, assign);
+
+    /*
+     * Because of NULL propagation, we only have to check the last
+     * result to see if everything was created okay.
+     */
+
+    if (field_callback == NULL) goto error;
+
+    /*
+     * Try to add the new field.  If we can't, free the callback
+     * before returning.
+     */
+
+    if (!push_protobuf_field_map_add_field
+        (full_field_name,
+         parser, field_map, field_number,
+         PUSH_PROTOBUF_TAG_TYPE_LENGTH_DELIMITED,
+         field_callback))
+    {
+        goto error;
+    }
+
+    return true;
+
+  error:
+    /*
+     * Before returning, free any objects we created before the error.
+     */
+
+    push_talloc_free(context);
+    return false;
+}
@@ -0,0 +1,2233 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2010, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the LICENSE.txt file in this distribution for license
+ * details.
+ * ----------------------------------------------------------------------
+ */
+
+#include <inttypes.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include <hwm-buffer.h>
+
+#include <push/basics.h>
+#include <push/talloc.h>
+
+#include <push/protobuf/basics.h>
+#include <push/protobuf/decoder.h>
+#include <push/protobuf/dynamic.h>
+#include <push/protobuf/json.h>
+#include <push/protobuf/varint.h>
+
+
+/*-----------------------------------------------------------------------
+ * Text output
+ */
+
+/**
+ * Make sure that there's room for size more bytes at the end of
+ * dest, and return a pointer to them.  Returns NULL if we can't
+ * allocate the memory.
+ */
+
+static inline char *
+json_reserve(hwm_buffer_t *dest, size_t size)
+{
+    if (!hwm_buffer_ensure_size(dest, dest->current_size + size))
+        return NULL;
+
+    return hwm_buffer_writable_mem(dest, char) + dest->current_size;
+}
+
+
+static inline bool
+json_append_char(hwm_buffer_t *dest, char ch)
+{
+    char  *out = json_reserve(dest, 1);
+
+    if (out == NULL)
+        return false;
+
+    *out = ch;
+    dest->current_size++;
+    return true;
+}
+
+
+/**
+ * The two-digit decimal representations of 0 through 99.  Converting
+ * two digits per division halves the number of (slow) 64-bit
+ * divisions needed to print an integer.
+ */
+
+static const char  DIGIT_PAIRS[201] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+
+/**
+ * The largest number of characters in a formatted integer: 20 digits
+ * for UINT64_MAX, or a sign and 19 digits for INT64_MIN, plus a pair
+ * of quotes.
+ */
+
+#define MAX_INTEGER_LENGTH  22
+
+
+/**
+ * Write the decimal representation of value into out, which must
+ * have room for 20 characters.  Returns the number of characters
+ * written.
+ */
+
+static inline size_t
+json_format_uint64(char *out, uint64_t value)
+{
+    char  tmp[20];
+    char  *p = tmp + sizeof(tmp);
+    size_t  length;
+
+    while (value >= 100)
+    {
+        unsigned int  pair = (unsigned int) (value % 100) * 2;
+        value /= 100;
+        p -= 2;
+        memcpy(p, DIGIT_PAIRS + pair, 2);
+    }
+
+    if (value >= 10)
+    {
+        p -= 2;
+        memcpy(p, DIGIT_PAIRS + value * 2, 2);
+    } else {
+        *--p = '0' + (char) value;
+    }
+
+    length = tmp + sizeof(tmp) - p;
+    memcpy(out, p, length);
+    return length;
+}
+
+
+/**
+ * Append an integer, with a minus sign if negative is set.  If quoted
+ * is set, the integer is written as a JSON string, which is how the
+ * proto3 JSON mapping writes 64-bit integers.
+ */
+
+static bool
+json_append_integer(hwm_buffer_t *dest, uint64_t magnitude,
+                    bool negative, bool quoted)
+{
+    char  *out = json_reserve(dest, MAX_INTEGER_LENGTH);
+    char  *start = out;
+
+    if (out == NULL)
+        return false;
+
+    if (quoted) *out++ = '"';
+    if (negative) *out++ = '-';
+    out += json_format_uint64(out, magnitude);
+    if (quoted) *out++ = '"';
+
+    dest->current_size += out - start;
+    return true;
+}
+
+
+static inline bool
+json_append_uint64(hwm_buffer_t *dest, uint64_t value, bool quoted)
+{
+    return json_append_integer(dest, value, false, quoted);
+}
+
+
+static inline bool
+json_append_int64(hwm_buffer_t *dest, int64_t value, bool quoted)
+{
+    if (value < 0)
+        return json_append_integer(dest, -(uint64_t) value, true, quoted);
+    else
+        return json_append_integer(dest, value, false, quoted);
+}
+
+
+/**
+ * Append a floating-point number, using the shortest of the two
+ * precisions that reads back as the same value.
+ */
+
+static bool
+json_append_double(hwm_buffer_t *dest, double value, bool is_float)
+{
+    char  tmp[32];
+    int  length;
+
+    if (isnan(value))
+        return hwm_buffer_append_mem(dest, "\"NaN\"", 5);
+
+    if (isinf(value))
+    {
+        return (value > 0)?
+            hwm_buffer_append_mem(dest, "\"Infinity\"", 10):
+            hwm_buffer_append_mem(dest, "\"-Infinity\"", 11);
+    }
+
+    if (is_float)
+    {
+        length = snprintf(tmp, sizeof(tmp), "%.6g", value);
+        if (strtof(tmp, NULL) != (float) value)
+            length = snprintf(tmp, sizeof(tmp), "%.9g", value);
+    } else {
+        length = snprintf(tmp, sizeof(tmp), "%.15g", value);
+        if (strtod(tmp, NULL) != value)
+            length = snprintf(tmp, sizeof(tmp), "%.17g", value);
+    }
+
+    return hwm_buffer_append_mem(dest, tmp, length);
+}
+
+
+/**
+ * Returns whether a string byte can be copied into JSON as-is: it's
+ * ASCII, and doesn't have to be escaped.
+ */
+
+static inline bool
+json_is_plain(uint8_t ch)
+{
+    return (ch >= 0x20) && (ch < 0x80) && (ch != '"') && (ch != '\\');
+}
+
+
+#if !defined(__SSE2__)
+
+/**
+ * The bytes of a word, each set to 0x01 or 0x80.
+ */
+
+#define ONES   UINT64_C(0x0101010101010101)
+#define HIGHS  UINT64_C(0x8080808080808080)
+
+/**
+ * Returns a non-zero value if any byte of word is less than n, for n
+ * ≤ 0x80.  Bytes after the first such byte might be flagged
+ * spuriously, but the result is only non-zero if there is one.
+ */
+
+#define HAS_LESS(word, n) \
+    (((word) - ONES * (n)) & ~(word) & HIGHS)
+
+#define HAS_BYTE(word, b) \
+    HAS_LESS((word) ^ (ONES * (b)), 1)
+
+#endif
+
+
+/**
+ * Return the number of plain bytes at the start of buf.  Most strings
+ * are mostly plain ASCII, so we check 16 bytes at a time with SSE2,
+ * or 8 bytes at a time with word-sized arithmetic.
+ */
+
+static size_t
+json_scan_plain(const uint8_t *buf, size_t size)
+{
+    size_t  i = 0;
+
+#if defined(__SSE2__)
+    const __m128i  quote = _mm_set1_epi8('"');
+    const __m128i  backslash = _mm_set1_epi8('\\');
+    const __m128i  control = _mm_set1_epi8(0x1f);
+
+    for (; i + 16 <= size; i += 16)
+    {
+        __m128i  bytes = _mm_loadu_si128((const __m128i *) (buf + i));
+
+        /*
+         * A byte is a control character if max(byte, 0x1f) == 0x1f,
+         * comparing as unsigned.
+         */
+
+        __m128i  special =
+            _mm_or_si128
+            (_mm_or_si128(_mm_cmpeq_epi8(bytes, quote),
+                          _mm_cmpeq_epi8(bytes, backslash)),
+             _mm_cmpeq_epi8(_mm_max_epu8(bytes, control), control));
+
+        int  mask =
+            _mm_movemask_epi8(special) | _mm_movemask_epi8(bytes);
+
+        if (mask != 0)
+            return i + __builtin_ctz(mask);
+    }
+#else
+    for (; i + 8 <= size; i += 8)
+    {
+        uint64_t  word = push_protobuf_load_le64(buf + i);
+
+        if (((word & HIGHS) != 0) ||
+            HAS_LESS(word, 0x20) ||
+            HAS_BYTE(word, '"') ||
+            HAS_BYTE(word, '\\'))
+            break;
+    }
+#endif
+
+    for (; i < size; i++)
+    {
+        if (!json_is_plain(buf[i]))
+            break;
+    }
+
+    return i;
+}
+
+
+/**
+ * U+FFFD, the replacement character, in UTF-8.
+ */
+
+static const char  REPLACEMENT[] = "\xef\xbf\xbd";
+
+
+/**
+ * Check the UTF-8 sequence at the start of buf, whose first byte is
+ * at least 0x80, following RFC 3629: overlong forms, surrogates, and
+ * code points past U+10FFFF are invalid.  Returns the length of the
+ * sequence if it's valid; this is more than size if the sequence is
+ * cut off by the end of buf, but valid so far.  Returns 0 if it's
+ * invalid, and sets *prefix to the number of bytes to replace with a
+ * single U+FFFD: the longest prefix of a valid sequence, or just the
+ * first byte if there isn't one.
+ */
+
+static inline size_t
+json_utf8_length(const uint8_t *buf, size_t size, size_t *prefix)
+{
+    uint8_t  lead = buf[0];
+    uint8_t  low = 0x80;
+    uint8_t  high = 0xbf;
+    size_t  length;
+    size_t  i;
+
+    if ((lead < 0xc2) || (lead > 0xf4))
+    {
+        *prefix = 1;
+        return 0;
+    }
+
+    if (lead < 0xe0)
+    {
+        length = 2;
+    } else if (lead < 0xf0) {
+        length = 3;
+        if (lead == 0xe0) low = 0xa0;
+        if (lead == 0xed) high = 0x9f;
+    } else {
+        length = 4;
+        if (lead == 0xf0) low = 0x90;
+        if (lead == 0xf4) high = 0x8f;
+    }
+
+    for (i = 1; (i < length) && (i < size); i++)
+    {
+        if ((buf[i] < low) || (buf[i] > high))
+        {
+            *prefix = i;
+            return 0;
+        }
+
+        low = 0x80;
+        high = 0xbf;
+    }
+
+    return length;
+}
+
+
+/**
+ * Append a string, escaping any characters that JSON requires, and
+ * replacing each invalid UTF-8 sequence with U+FFFD.  A string can be
+ * split across several calls; pending holds the start of a UTF-8
+ * sequence that was cut off by the end of the previous call, and
+ * receives the start of one that's cut off by the end of this one.
+ */
+
+static bool
+json_append_escaped(hwm_buffer_t *dest, const uint8_t *buf, size_t size,
+                    uint8_t *pending, size_t *pending_size)
+{
+    static const char  HEX[] = "0123456789abcdef";
+    size_t  i = 0;
+    size_t  length = 0;
+    size_t  prefix = 0;
+
+    /*
+     * Finish off a sequence from the previous call.  Its bytes so far
+     * are valid, so an invalid sequence can't end before them.
+     */
+
+    if (*pending_size > 0)
+    {
+        uint8_t  seq[4];
+        size_t  have = *pending_size;
+        size_t  take = (size < 4 - have)? size: 4 - have;
+
+        memcpy(seq, pending, have);
+        memcpy(seq + have, buf, take);
+        length = json_utf8_length(seq, have + take, &prefix);
+
+        if (length > have + take)
+        {
+            memcpy(pending + have, buf, take);
+            *pending_size = have + take;
+            return true;
+        }
+
+        *pending_size = 0;
+
+        if (length == 0)
+        {
+            if (!hwm_buffer_append_mem(dest, REPLACEMENT, 3))
+                return false;
+            i = prefix - have;
+        } else {
+            if (!hwm_buffer_append_mem(dest, seq, length))
+                return false;
+            i = length - have;
+        }
+    }
+
+    while (i < size)
+    {
+        size_t  start = i;
+        char  *out;
+
+        /*
+         * Copy everything up to the next byte that has to be escaped
+         * or replaced, skipping plain ASCII in bulk, and valid UTF-8
+         * one sequence at a time.
+         */
+
+        while (true)
+        {
+            i += json_scan_plain(buf + i, size - i);
+            if ((i == size) || (buf[i] < 0x80))
+                break;
+
+            length = json_utf8_length(buf + i, size - i, &prefix);
+            if ((length == 0) || (length > size - i))
+                break;
+
+            i += length;
+        }
+
+        if (!hwm_buffer_append_mem(dest, buf + start, i - start))
+            return false;
+
+        if (i == size)
+            break;
+
+        if (buf[i] >= 0x80)
+        {
+            if (length == 0)
+            {
+                if (!hwm_buffer_append_mem(dest, REPLACEMENT, 3))
+                    return false;
+                i += prefix;
+            } else {
+                memcpy(pending, buf + i, size - i);
+                *pending_size = size - i;
+                i = size;
+            }
+
+            continue;
+        }
+
+        out = json_reserve(dest, 6);
+        if (out == NULL)
+            return false;
+
+        out[0] = '\\';
+
+        switch (buf[i])
+        {
+          case '"':  out[1] = '"';  dest->current_size += 2; break;
+          case '\\': out[1] = '\\'; dest->current_size += 2; break;
+          case '\b': out[1] = 'b';  dest->current_size += 2; break;
+          case '\f': out[1] = 'f';  dest->current_size += 2; break;
+          case '\n': out[1] = 'n';  dest->current_size += 2; break;
+          case '\r': out[1] = 'r';  dest->current_size += 2; break;
+          case '\t': out[1] = 't';  dest->current_size += 2; break;
+
+          default:
+            out[1] = 'u';
+            out[2] = '0';
+            out[3] = '0';
+            out[4] = HEX[buf[i] >> 4];
+            out[5] = HEX[buf[i] & 0xf];
+            dest->current_size += 6;
+            break;
+        }
+
+        i++;
+    }
+
+    return true;
+}
+
+
+static const char  BASE64[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+
+/**
+ * Append the base64 encoding of a complete group of three bytes.
+ */
+
+static inline void
+json_base64_group(char *out, const uint8_t *in)
+{
+    out[0] = BASE64[in[0] >> 2];
+    out[1] = BASE64[((in[0] & 0x03) << 4) | (in[1] >> 4)];
+    out[2] = BASE64[((in[1] & 0x0f) << 2) | (in[2] >> 6)];
+    out[3] = BASE64[in[2] & 0x3f];
+}
+
+
+/*-----------------------------------------------------------------------
+ * Message types
+ */
+
+/**
+ * Field numbers below this limit are looked up in a directly indexed
+ * table; this matches the field map's dense tables.
+ */
+
+#define DENSE_LIMIT  2048
+
+
+typedef struct _json_type  json_type_t;
+
+
+/**
+ * The information we need to write one field of a message type.
+ */
+
+typedef struct _json_field
+{
+    /**
+     * The field's descriptor.
+     */
+
+    const push_protobuf_field_descriptor_t  *descriptor;
+
+    /**
+     * For message fields, the submessage type.
+     */
+
+    const json_type_t  *message_type;
+
+    /**
+     * The field's JSON key, including the quotes and the colon.
+     */
+
+    const char  *key;
+
+    /**
+     * The length of key.
+     */
+
+    size_t  key_size;
+
+    /**
+     * The wire type of a single value of the field.
+     */
+
+    push_protobuf_tag_type_t  tag_type;
+
+    /**
+     * Whether the field is repeated, and so written as an array.
+     */
+
+    bool  repeated;
+
+} json_field_t;
+
+
+/**
+ * The information we need to write a message type.
+ */
+
+struct _json_type
+{
+    /**
+     * The message type's descriptor.
+     */
+
+    const push_protobuf_message_descriptor_t  *descriptor;
+
+    /**
+     * The message type's fields, in the same order as the
+     * descriptor's.
+     */
+
+    json_field_t  *fields;
+
+    /**
+     * A directly indexed table of fields whose numbers are below
+     * DENSE_LIMIT.  Entries for missing fields are NULL.
+     */
+
+    json_field_t  **dense;
+
+    /**
+     * The number of elements in the dense table.
+     */
+
+    push_protobuf_tag_number_t  dense_size;
+
+    /**
+     * The number of words in json_t.seen that a message needs, for
+     * the fields past the first 64.
+     */
+
+    size_t  more_seen;
+};
+
+
+static const json_field_t *
+json_type_find_field(const json_type_t *type,
+                     push_protobuf_tag_number_t number)
+{
+    size_t  i;
+
+    if (number < type->dense_size)
+        return type->dense[number];
+
+    if (number < DENSE_LIMIT)
+        return NULL;
+
+    for (i = 0; i < type->descriptor->field_count; i++)
+    {
+        if ((type->fields[i].descriptor != NULL) &&
+            (type->fields[i].descriptor->number == number))
+            return &type->fields[i];
+    }
+
+    return NULL;
+}
+
+
+/**
+ * Returns the wire type of a single value of the given field type,
+ * or -1 if we don't support the field type.
+ */
+
+static int
+json_tag_type(push_protobuf_field_type_t type)
+{
+    switch (type)
+    {
+      case PUSH_PROTOBUF_TYPE_INT32:
+      case PUSH_PROTOBUF_TYPE_INT64:
+      case PUSH_PROTOBUF_TYPE_UINT32:
+      case PUSH_PROTOBUF_TYPE_UINT64:
+      case PUSH_PROTOBUF_TYPE_SINT32:
+      case PUSH_PROTOBUF_TYPE_SINT64:
+      case PUSH_PROTOBUF_TYPE_BOOL:
+      case PUSH_PROTOBUF_TYPE_ENUM:
+        return PUSH_PROTOBUF_TAG_TYPE_VARINT;
+
+      case PUSH_PROTOBUF_TYPE_FIXED32:
+      case PUSH_PROTOBUF_TYPE_SFIXED32:
+      case PUSH_PROTOBUF_TYPE_FLOAT:
+        return PUSH_PROTOBUF_TAG_TYPE_FIXED32;
+
+      case PUSH_PROTOBUF_TYPE_FIXED64:
+      case PUSH_PROTOBUF_TYPE_SFIXED64:
+      case PUSH_PROTOBUF_TYPE_DOUBLE:
+        return PUSH_PROTOBUF_TAG_TYPE_FIXED64;
+
+      case PUSH_PROTOBUF_TYPE_STRING:
+      case PUSH_PROTOBUF_TYPE_BYTES:
+      case PUSH_PROTOBUF_TYPE_MESSAGE:
+        return PUSH_PROTOBUF_TAG_TYPE_LENGTH_DELIMITED;
+
+      default:
+        return -1;
+    }
+}
+
+
+/*-----------------------------------------------------------------------
+ * Transcoder callback
+ */
+
+/**
+ * We write each field as soon as we parse it, but a field can appear
+ * more than once in a message: an encoder can interleave a repeated
+ * field's values with other fields, and a singular field that
+ * appears again is merged into (for messages) or replaced (for
+ * scalars).  So as we write each key, we record a span of the output
+ * buffer that holds the values that follow it.  If a message repeats
+ * a key, we rebuild its JSON from those spans once the message is
+ * finished, writing each key once.  Messages that don't repeat any
+ * keys are left as they were written.
+ *
+ * The spans are kept in an array, in the order that they were
+ * written, and refer to each other by index, since the array can
+ * move as it grows.  NO_INDEX marks the end of a list.
+ */
+
+#define NO_INDEX  SIZE_MAX
+
+
+/**
+ * The values that follow one key in the output buffer.
+ */
+
+typedef struct _json_span
+{
+    /**
+     * The field that the key belongs to.
+     */
+
+    const json_field_t  *field;
+
+    /**
+     * The values' text, not including the key, or the brackets of a
+     * repeated field's array.
+     */
+
+    size_t  start;
+    size_t  end;
+
+    /**
+     * The number of spans that follow this one that belong to its
+     * submessage.  We only keep the spans of a singular submessage,
+     * since that's the only kind of value that can be merged into,
+     * so this is 0 for any other field.
+     */
+
+    size_t  descendants;
+
+    /**
+     * The next span of the same field, and whether this is the
+     * field's first span.  These are only filled in while we rebuild
+     * a message.
+     */
+
+    size_t  next;
+    bool  first;
+
+} json_span_t;
+
+
+/**
+ * One message that we're in the middle of writing.
+ */
+
+typedef struct _json_frame
+{
+    /**
+     * The type of the message.
+     */
+
+    const json_type_t  *type;
+
+    /**
+     * The stream offset at which the message ends.  This is
+     * UINT64_MAX for the top-level message, which ends at EOF.
+     */
+
+    uint64_t  end;
+
+    /**
+     * The repeated field whose array we're currently writing, or NULL
+     * if there isn't an open array.
+     */
+
+    const json_field_t  *array;
+
+    /**
+     * Where the message's JSON starts in the output buffer.
+     */
+
+    size_t  start;
+
+    /**
+     * The index of the message's first span.
+     */
+
+    size_t  spans;
+
+    /**
+     * The span of the key that we wrote most recently, or NO_INDEX
+     * if we haven't written any fields of the message yet.
+     */
+
+    size_t  span;
+
+    /**
+     * A bit for each of the message's first 64 fields that we've
+     * written a key for.  The bits for the rest of its fields are in
+     * json_t.seen, starting at index more_seen.
+     */
+
+    uint64_t  seen;
+    size_t  more_seen;
+
+    /**
+     * Whether the message is the value of a singular field.
+     */
+
+    bool  singular;
+
+    /**
+     * Whether the message, or one of its singular submessages,
+     * repeats a key.
+     */
+
+    bool  repeats;
+
+} json_frame_t;
+
+
+/**
+ * A set of messages that we're in the middle of merging while we
+ * rebuild a message's JSON.
+ */
+
+typedef struct _json_level
+{
+    /**
+     * The span whose submessage we're reading, or NO_INDEX if we're
+     * reading the message that's being rebuilt.
+     */
+
+    size_t  message;
+
+    /**
+     * The next span to read, and the end of the message's spans.
+     */
+
+    size_t  next;
+    size_t  last;
+
+    /**
+     * Whether we haven't written any keys yet.
+     */
+
+    bool  empty;
+
+} json_level_t;
+
+
+/**
+ * A callback that transcodes a message into JSON.  Like the decoders
+ * generated by push-protoc, this is a single callback that reads the
+ * whole message with the push_protobuf_decoder_t state machine.
+ * Nested messages are tracked with an explicit stack of frames,
+ * rather than with a callback per message type, so recursive types
+ * don't need any extra callbacks, and there's no per-field
+ * continuation overhead.
+ */
+
+typedef struct _json
+{
+    /**
+     * The push_callback_t superclass for this callback.
+     */
+
+    push_callback_t  callback;
+
+    /**
+     * The continue continuation for this callback.
+     */
+
+    push_continue_continuation_t  cont;
+
+    /**
+     * The decoder state.
+     */
+
+    push_protobuf_decoder_t  decoder;
+
+    /**
+     * The parser whose limits we enforce.
+     */
+
+    push_parser_t  *parser;
+
+    /**
+     * The type of the top-level message.
+     */
+
+    const json_type_t  *type;
+
+    /**
+     * The buffer that we write the JSON into.
+     */
+
+    hwm_buffer_t  *dest;
+
+    /**
+     * The stack of messages that we're writing, as an array of
+     * json_frame_t.  The top-level message is first.
+     */
+
+    hwm_buffer_t  frames;
+
+    /**
+     * The json_type_t for each message type that we've seen, as an
+     * array of pointers.  This is only used while building the
+     * types.
+     */
+
+    hwm_buffer_t  types;
+
+    /**
+     * The spans of the messages that we're writing, as an array of
+     * json_span_t.
+     */
+
+    hwm_buffer_t  spans;
+
+    /**
+     * The number of bytes that we've made sure spans can hold.
+     */
+
+    size_t  spans_capacity;
+
+    /**
+     * The bits of json_frame_t.seen for fields past the first 64, as
+     * an array of uint64_t.
+     */
+
+    hwm_buffer_t  seen;
+
+    /**
+     * The stack of json_level_t used while rebuilding a message.
+     */
+
+    hwm_buffer_t  stack;
+
+    /**
+     * The last span of each field, as an array of size_t, used while
+     * linking the spans of a json_level_t.
+     */
+
+    hwm_buffer_t  tails;
+
+    /**
+     * The rebuilt JSON, before it's copied back into dest.
+     */
+
+    hwm_buffer_t  scratch;
+
+    /**
+     * The field whose value we're reading, or NULL if we're skipping
+     * an unknown field.
+     */
+
+    const json_field_t  *field;
+
+    /**
+     * The number of bytes that we've read since we were activated.
+     */
+
+    uint64_t  offset;
+
+    /**
+     * The bytes of the current value that we can't write until the
+     * next chunk: for a bytes field, the bytes that don't make up a
+     * full group of three for base64; for a string field, the start
+     * of a UTF-8 sequence that's cut off by the end of the chunk.
+     */
+
+    uint8_t  pending[3];
+
+    /**
+     * The number of bytes in pending.
+     */
+
+    size_t  pending_size;
+
+} json_t;
+
+
+static int
+json_destructor(void *ptr)
+{
+    json_t  *json = (json_t *) ptr;
+
+    hwm_buffer_done(&json->frames);
+    hwm_buffer_done(&json->types);
+    hwm_buffer_done(&json->spans);
+    hwm_buffer_done(&json->seen);
+    hwm_buffer_done(&json->stack);
+    hwm_buffer_done(&json->tails);
+    hwm_buffer_done(&json->scratch);
+    return 0;
+}
+
+
+/**
+ * Get the json_type_t for a message type, creating it (and the types
+ * of its submessages) if needed.
+ */
+
+static const json_type_t *
+json_get_type(json_t *json,
+              const push_protobuf_message_descriptor_t *descriptor)
+{
+    const json_type_t * const  *types;
+    json_type_t  **slot;
+    json_type_t  *type;
+    size_t  count;
+    size_t  i;
+
+    types = hwm_buffer_mem(&json->types, const json_type_t *);
+    count = hwm_buffer_current_list_size(&json->types, json_type_t *);
+
+    for (i = 0; i < count; i++)
+    {
+        if (types[i]->descriptor == descriptor)
+            return types[i];
+    }
+
+    /*
+     * Add the new type to the list before filling in its fields, so
+     * that recursive references find it.
+     */
+
+    type = push_talloc(json, json_type_t);
+    if (type == NULL)
+        return NULL;
+
+    slot = hwm_buffer_append_list_elem(&json->types, json_type_t *);
+    if (slot == NULL)
+        return NULL;
+
+    *slot = type;
+
+    type->descriptor = descriptor;
+    type->dense = NULL;
+    type->dense_size = 0;
+    type->more_seen =
+        (descriptor->field_count > 64)?
+        (descriptor->field_count - 1) / 64:
+        0;
+    type->fields = push_talloc_array(type, json_field_t,
+                                     descriptor->field_count + 1);
+    if (type->fields == NULL)
+        return NULL;
+
+    for (i = 0; i < descriptor->field_count; i++)
+    {
+        const push_protobuf_field_descriptor_t  *field =
+            &descriptor->fields[i];
+        json_field_t  *json_field = &type->fields[i];
+        int  tag_type = json_tag_type(field->type);
+
+        /*
+         * Fields of types that we don't support are left out, and
+         * will be skipped like unknown fields.
+         */
+
+        if ((tag_type < 0) ||
+            ((field->type == PUSH_PROTOBUF_TYPE_MESSAGE) &&
+             (field->message_type == NULL)))
+        {
+            json_field->descriptor = NULL;
+            continue;
+        }
+
+        json_field->descriptor = field;
+        json_field->tag_type = tag_type;
+        json_field->repeated =
+            (field->label == PUSH_PROTOBUF_LABEL_REPEATED);
+        json_field->key =
+            push_talloc_asprintf(type, "\"%s\":", field->name);
+        if (json_field->key == NULL)
+            return NULL;
+        json_field->key_size = strlen(json_field->key);
+
+        if (field->type == PUSH_PROTOBUF_TYPE_MESSAGE)
+        {
+            json_field->message_type =
+                json_get_type(json, field->message_type);
+            if (json_field->message_type == NULL)
+                return NULL;
+        } else {
+            json_field->message_type = NULL;
+        }
+
+        if ((field->number < DENSE_LIMIT) &&
+            (field->number >= type->dense_size))
+        {
+            push_protobuf_tag_number_t  j;
+            json_field_t  **dense =
+                push_talloc_realloc(type, type->dense, json_field_t *,
+                                    field->number + 1);
+
+            if (dense == NULL)
+                return NULL;
+
+            for (j = type->dense_size; j <= field->number; j++)
+                dense[j] = NULL;
+
+            type->dense = dense;
+            type->dense_size = field->number + 1;
+        }
+
+        /*
+         * If a field number appears twice, the first one wins, as in
+         * the field map.
+         */
+
+        if ((field->number < DENSE_LIMIT) &&
+            (type->dense[field->number] == NULL))
+            type->dense[field->number] = json_field;
+    }
+
+    return type;
+}
+
+
+static inline json_frame_t *
+json_top(json_t *json)
+{
+    size_t  count =
+        hwm_buffer_current_list_size(&json->frames, json_frame_t);
+
+    return hwm_buffer_writable_mem(&json->frames, json_frame_t) +
+        (count - 1);
+}
+
+
+static inline json_level_t *
+json_top_level(json_t *json)
+{
+    size_t  count =
+        hwm_buffer_current_list_size(&json->stack, json_level_t);
+
+    return hwm_buffer_writable_mem(&json->stack, json_level_t) +
+        (count - 1);
+}
+
+
+/**
+ * Start merging a set of messages of the given type.  If message is
+ * NO_INDEX, the set is the single message whose spans run from first
+ * to last; otherwise, it's the submessage of each span in the list
+ * that starts at message.  We link together the spans of each field
+ * in the set, and mark the first one, whose position decides where
+ * the field's key goes.
+ */
+
+static bool
+json_push_level(json_t *json, const json_type_t *type,
+                size_t message, size_t first, size_t last)
+{
+    json_span_t  *spans = hwm_buffer_writable_mem(&json->spans, json_span_t);
+    size_t  field_count = type->descriptor->field_count;
+    json_level_t  *level;
+    size_t  *tails;
+    size_t  i;
+
+    if (!hwm_buffer_ensure_size(&json->tails,
+                                field_count * sizeof(size_t)))
+        return false;
+
+    tails = hwm_buffer_writable_mem(&json->tails, size_t);
+    for (i = 0; i < field_count; i++)
+        tails[i] = NO_INDEX;
+
+    level = hwm_buffer_append_list_elem(&json->stack, json_level_t);
+    if (level == NULL)
+        return false;
+
+    level->message = message;
+    level->next = first;
+    level->last = last;
+    level->empty = true;
+
+    while (true)
+    {
+        for (i = first; i < last; i += 1 + spans[i].descendants)
+        {
+            size_t  field = spans[i].field - type->fields;
+
+            spans[i].next = NO_INDEX;
+            spans[i].first = (tails[field] == NO_INDEX);
+            if (!spans[i].first)
+                spans[tails[field]].next = i;
+            tails[field] = i;
+        }
+
+        if ((message == NO_INDEX) || (spans[message].next == NO_INDEX))
+            break;
+
+        message = spans[message].next;
+        first = message + 1;
+        last = first + spans[message].descendants;
+    }
+
+    return json_append_char(&json->scratch, '{');
+}
+
+
+/**
+ * Rewrite the JSON of a message that repeats a key, using the spans
+ * that we recorded while writing it, so that each field has a single
+ * key.  Like the parser, this uses an explicit stack rather than
+ * recursion, so deeply nested messages can't overflow the C stack.
+ */
+
+static bool
+json_rebuild(json_t *json, const json_frame_t *frame)
+{
+    hwm_buffer_t  *scratch = &json->scratch;
+    const json_span_t  *spans = hwm_buffer_mem(&json->spans, json_span_t);
+    const char  *text = hwm_buffer_mem(json->dest, char);
+
+    hwm_buffer_clear(scratch);
+    json->stack.current_size = 0;
+
+    if (!json_push_level(json, frame->type, NO_INDEX, frame->spans,
+                         hwm_buffer_current_list_size(&json->spans,
+                                                      json_span_t)))
+        return false;
+
+    while (json->stack.current_size > 0)
+    {
+        json_level_t  *level = json_top_level(json);
+        const json_field_t  *field;
+        size_t  index;
+        size_t  i;
+
+        if (level->next == level->last)
+        {
+            /*
+             * Move on to the next message that's merged into this
+             * one, if there is one.
+             */
+
+            index = level->message;
+            if ((index != NO_INDEX) && (spans[index].next != NO_INDEX))
+            {
+                index = spans[index].next;
+                level->message = index;
+                level->next = index + 1;
+                level->last = level->next + spans[index].descendants;
+                continue;
+            }
+
+            if (!json_append_char(scratch, '}'))
+                return false;
+
+            json->stack.current_size -= sizeof(json_level_t);
+            continue;
+        }
+
+        index = level->next;
+        level->next += 1 + spans[index].descendants;
+
+        if (!spans[index].first)
+            continue;
+
+        field = spans[index].field;
+
+        if ((!level->empty && !json_append_char(scratch, ',')) ||
+            !hwm_buffer_append_mem(scratch, field->key, field->key_size))
+            return false;
+
+        level->empty = false;
+
+        if (field->repeated)
+        {
+            /*
+             * A repeated field gets all of its values, in order.
+             */
+
+            if (!json_append_char(scratch, '['))
+                return false;
+
+            for (i = index; i != NO_INDEX; i = spans[i].next)
+            {
+                if (((i != index) && !json_append_char(scratch, ',')) ||
+                    !hwm_buffer_append_mem(scratch, text + spans[i].start,
+                                           spans[i].end - spans[i].start))
+                    return false;
+            }
+
+            if (!json_append_char(scratch, ']'))
+                return false;
+        }
+
+        else if (field->message_type != NULL)
+        {
+            /*
+             * A singular submessage is merged from all of its values.
+             */
+
+            if (!json_push_level(json, field->message_type, index,
+                                 index + 1,
+                                 index + 1 + spans[index].descendants))
+                return false;
+        }
+
+        else
+        {
+            /*
+             * For a singular scalar, the last value wins.
+             */
+
+            for (i = index; spans[i].next != NO_INDEX; i = spans[i].next)
+                ;
+
+            if (!hwm_buffer_append_mem(scratch, text + spans[i].start,
+                                       spans[i].end - spans[i].start))
+                return false;
+        }
+    }
+
+    /*
+     * A message never gets longer when it's rebuilt, so this won't
+     * move the output buffer.
+     */
+
+    json->dest->current_size = frame->start;
+    return hwm_buffer_append_mem(json->dest,
+                                 hwm_buffer_mem(scratch, char),
+                                 scratch->current_size);
+}
+
+
+static bool
+json_push_frame(json_t *json, const json_type_t *type, uint64_t end,
+                bool singular)
+{
+    json_frame_t  *frame;
+    size_t  seen_size = type->more_seen * sizeof(uint64_t);
+
+    if ((seen_size > 0) &&
+        !hwm_buffer_ensure_size(&json->seen,
+                                json->seen.current_size + seen_size))
+        return false;
+
+    frame = hwm_buffer_append_list_elem(&json->frames, json_frame_t);
+    if (frame == NULL)
+        return false;
+
+    frame->type = type;
+    frame->end = end;
+    frame->array = NULL;
+    frame->start = json->dest->current_size;
+    frame->spans = hwm_buffer_current_list_size(&json->spans, json_span_t);
+    frame->span = NO_INDEX;
+    frame->seen = 0;
+    frame->more_seen = hwm_buffer_current_list_size(&json->seen, uint64_t);
+    frame->singular = singular;
+    frame->repeats = false;
+
+    if (seen_size > 0)
+    {
+        memset(hwm_buffer_writable_mem(&json->seen, char) +
+               json->seen.current_size, 0, seen_size);
+        json->seen.current_size += seen_size;
+    }
+
+    return json_append_char(json->dest, '{');
+}
+
+
+/**
+ * Record where the values of the current field of a message end.
+ */
+
+static inline void
+json_end_span(json_t *json, json_frame_t *frame)
+{
+    json_span_t  *span;
+
+    if (frame->span == NO_INDEX)
+        return;
+
+    span = hwm_buffer_writable_mem(&json->spans, json_span_t) + frame->span;
+    span->end = json->dest->current_size;
+    span->descendants =
+        hwm_buffer_current_list_size(&json->spans, json_span_t) -
+        frame->span - 1;
+}
+
+
+/**
+ * Finish the message on the top of the stack, and pop it off.  If
+ * the message repeats a key, we rebuild its JSON now, unless it's the
+ * value of a singular field; then a later value might be merged into
+ * it, so we keep its spans and let its parent rebuild it.
+ */
+
+static bool
+json_pop_frame(json_t *json)
+{
+    json_frame_t  *frame = json_top(json);
+    char  *out = json_reserve(json->dest, 2);
+
+    if (out == NULL)
+        return false;
+
+    json_end_span(json, frame);
+
+    if (frame->array != NULL)
+    {
+        *out++ = ']';
+        json->dest->current_size++;
+    }
+
+    *out = '}';
+    json->dest->current_size++;
+
+    if (frame->singular)
+    {
+        if (frame->repeats)
+            (frame - 1)->repeats = true;
+    } else {
+        if (frame->repeats && !json_rebuild(json, frame))
+            return false;
+
+        json->spans.current_size = frame->spans * sizeof(json_span_t);
+    }
+
+    json->seen.current_size = frame->more_seen * sizeof(uint64_t);
+    json->frames.current_size -= sizeof(json_frame_t);
+    return true;
+}
+
+
+/**
+ * Add a span to the end of json_t.spans.  We write a span for every
+ * key, so we grow the array ourselves, rather than checking its size
+ * with an hwm_buffer_t call each time.
+ */
+
+static inline json_span_t *
+json_add_span(json_t *json)
+{
+    size_t  size = json->spans.current_size + sizeof(json_span_t);
+    json_span_t  *span;
+
+    if (size > json->spans_capacity)
+    {
+        if (!hwm_buffer_ensure_size(&json->spans, size * 2))
+            return NULL;
+        json->spans_capacity = size * 2;
+    }
+
+    span = (json_span_t *)
+        (hwm_buffer_writable_mem(&json->spans, char) +
+         json->spans.current_size);
+    json->spans.current_size = size;
+    return span;
+}
+
+
+/**
+ * Write whatever comes before a value of the current field: a comma
+ * and the field's key, and the start of an array for a repeated
+ * field.  If we're in the middle of the field's array, this is just
+ * a comma.  Each new key starts a new span.
+ */
+
+static bool
+json_begin_value(json_t *json)
+{
+    json_frame_t  *frame = json_top(json);
+    const json_field_t  *field = json->field;
+    size_t  index = field - frame->type->fields;
+    uint64_t  *seen;
+    uint64_t  bit;
+    json_span_t  *span;
+    char  *out;
+
+    if (frame->array == field)
+        return json_append_char(json->dest, ',');
+
+    seen =
+        (index < 64)?
+        &frame->seen:
+        hwm_buffer_writable_mem(&json->seen, uint64_t) +
+        frame->more_seen + index / 64 - 1;
+    bit = UINT64_C(1) << (index % 64);
+    if ((*seen & bit) != 0)
+        frame->repeats = true;
+    *seen |= bit;
+
+    json_end_span(json, frame);
+
+    span = json_add_span(json);
+    if (span == NULL)
+        return false;
+
+    out = json_reserve(json->dest, field->key_size + 3);
+    if (out == NULL)
+        return false;
+
+    if (frame->array != NULL)
+    {
+        *out++ = ']';
+        json->dest->current_size++;
+        frame->array = NULL;
+    }
+
+    if (frame->span != NO_INDEX)
+    {
+        *out++ = ',';
+        json->dest->current_size++;
+    }
+
+    memcpy(out, field->key, field->key_size);
+    out += field->key_size;
+    json->dest->current_size += field->key_size;
+
+    if (field->repeated)
+    {
+        *out = '[';
+        json->dest->current_size++;
+        frame->array = field;
+    }
+
+    span->field = field;
+    span->start = json->dest->current_size;
+    frame->span =
+        hwm_buffer_current_list_size(&json->spans, json_span_t) - 1;
+    return true;
+}
+
+
+static bool
+json_write_varint(json_t *json, uint64_t value)
+{
+    hwm_buffer_t  *dest = json->dest;
+
+    if (!json_begin_value(json))
+        return false;
+
+    switch (json->field->descriptor->type)
+    {
+      case PUSH_PROTOBUF_TYPE_INT32:
+      case PUSH_PROTOBUF_TYPE_ENUM:
+        return json_append_int64(dest, (int32_t) value, false);
+
+      case PUSH_PROTOBUF_TYPE_INT64:
+        return json_append_int64(dest, (int64_t) value, true);
+
+      case PUSH_PROTOBUF_TYPE_UINT32:
+        return json_append_uint64(dest, (uint32_t) value, false);
+
+      case PUSH_PROTOBUF_TYPE_UINT64:
+        return json_append_uint64(dest, value, true);
+
+      case PUSH_PROTOBUF_TYPE_SINT32:
+        return json_append_int64
+            (dest, (int32_t) PUSH_PROTOBUF_ZIGZAG_DECODE32((uint32_t) value),
+             false);
+
+      case PUSH_PROTOBUF_TYPE_SINT64:
+        return json_append_int64
+            (dest, (int64_t) PUSH_PROTOBUF_ZIGZAG_DECODE64(value), true);
+
+      case PUSH_PROTOBUF_TYPE_BOOL:
+        return (value != 0)?
+            hwm_buffer_append_mem(dest, "true", 4):
+            hwm_buffer_append_mem(dest, "false", 5);
+
+      default:
+        return true;
+    }
+}
+
+
+static bool
+json_write_fixed32(json_t *json, uint32_t value)
+{
+    hwm_buffer_t  *dest = json->dest;
+
+    if (!json_begin_value(json))
+        return false;
+
+    switch (json->field->descriptor->type)
+    {
+      case PUSH_PROTOBUF_TYPE_FIXED32:
+        return json_append_uint64(dest, value, false);
+
+      case PUSH_PROTOBUF_TYPE_SFIXED32:
+        return json_append_int64(dest, (int32_t) value, false);
+
+      case PUSH_PROTOBUF_TYPE_FLOAT:
+      {
+        float  f;
+        memcpy(&f, &value, sizeof(float));
+        return json_append_double(dest, f, true);
+      }
+
+      default:
+        return true;
+    }
+}
+
+
+static bool
+json_write_fixed64(json_t *json, uint64_t value)
+{
+    hwm_buffer_t  *dest = json->dest;
+
+    if (!json_begin_value(json))
+        return false;
+
+    switch (json->field->descriptor->type)
+    {
+      case PUSH_PROTOBUF_TYPE_FIXED64:
+        return json_append_uint64(dest, value, true);
+
+      case PUSH_PROTOBUF_TYPE_SFIXED64:
+        return json_append_int64(dest, (int64_t) value, true);
+
+      case PUSH_PROTOBUF_TYPE_DOUBLE:
+      {
+        double  d;
+        memcpy(&d, &value, sizeof(double));
+        return json_append_double(dest, d, false);
+      }
+
+      default:
+        return true;
+    }
+}
+
+
+static bool
+json_write_bytes(json_t *json, const uint8_t *buf, size_t size)
+{
+    hwm_buffer_t  *dest = json->dest;
+    char  *out;
+
+    if (json->field->descriptor->type == PUSH_PROTOBUF_TYPE_STRING)
+        return json_append_escaped(dest, buf, size, json->pending,
+                                   &json->pending_size);
+
+    /*
+     * Finish off any partial group from the previous chunk.
+     */
+
+    while ((json->pending_size > 0) && (json->pending_size < 3) &&
+           (size > 0))
+    {
+        json->pending[json->pending_size++] = *buf++;
+        size--;
+    }
+
+    out = json_reserve(dest, 4 + (size / 3) * 4);
+    if (out == NULL)
+        return false;
+
+    if (json->pending_size == 3)
+    {
+        json_base64_group(out, json->pending);
+        out += 4;
+        dest->current_size += 4;
+        json->pending_size = 0;
+    }
+
+    while (size >= 3)
+    {
+        json_base64_group(out, buf);
+        out += 4;
+        dest->current_size += 4;
+        buf += 3;
+        size -= 3;
+    }
+
+    memcpy(json->pending + json->pending_size, buf, size);
+    json->pending_size += size;
+    return true;
+}
+
+
+static bool
+json_finish_bytes(json_t *json)
+{
+    hwm_buffer_t  *dest = json->dest;
+    char  *out = json_reserve(dest, 5);
+
+    if (out == NULL)
+        return false;
+
+    /*
+     * A string that ends partway through a UTF-8 sequence gets a
+     * replacement character for it.
+     */
+
+    if ((json->pending_size > 0) &&
+        (json->field->descriptor->type == PUSH_PROTOBUF_TYPE_STRING))
+    {
+        memcpy(out, REPLACEMENT, 3);
+        out += 3;
+        dest->current_size += 3;
+        json->pending_size = 0;
+    }
+
+    if (json->pending_size > 0)
+    {
+        uint8_t  group[3] = { 0, 0, 0 };
+
+        memcpy(group, json->pending, json->pending_size);
+        json_base64_group(out, group);
+
+        out[3] = '=';
+        if (json->pending_size == 1)
+            out[2] = '=';
+
+        out += 4;
+        dest->current_size += 4;
+        json->pending_size = 0;
+    }
+
+    *out = '"';
+    dest->current_size++;
+    return true;
+}
+
+
+/**
+ * Figure out how to read the value of a field, given its tag.
+ * Returns false if the tag is invalid.
+ */
+
+static inline bool
+json_dispatch(json_t *json, push_protobuf_tag_t tag)
+{
+    push_protobuf_decoder_t  *d = &json->decoder;
+    const json_field_t  *field;
+    push_protobuf_tag_type_t  tag_type = PUSH_PROTOBUF_GET_TAG_TYPE(tag);
+
+    if (d->depth == 0)
+    {
+        field = json_type_find_field(json_top(json)->type,
+                                     PUSH_PROTOBUF_GET_TAG_NUMBER(tag));
+
+        /*
+         * Repeated scalars can be packed, whether or not the
+         * descriptor says so.
+         */
+
+        if ((field != NULL) && (field->descriptor != NULL) &&
+            ((tag_type == field->tag_type) ||
+             (field->repeated &&
+              (tag_type == PUSH_PROTOBUF_TAG_TYPE_LENGTH_DELIMITED))))
+        {
+            json->field = field;
+
+            switch (tag_type)
+            {
+              case PUSH_PROTOBUF_TAG_TYPE_VARINT:
+                d->state = PUSH_PROTOBUF_DECODER_VARINT;
+                return true;
+
+              case PUSH_PROTOBUF_TAG_TYPE_FIXED32:
+                d->state = PUSH_PROTOBUF_DECODER_FIXED32;
+                return true;
+
+              case PUSH_PROTOBUF_TAG_TYPE_FIXED64:
+                d->state = PUSH_PROTOBUF_DECODER_FIXED64;
+                return true;
+
+              default:
+                d->state = PUSH_PROTOBUF_DECODER_LENGTH;
+                return true;
+            }
+        }
+    }
+
+    json->field = NULL;
+    return push_protobuf_decoder_skip(d, tag);
+}
+
+
+static void
+json_parse(json_t *json,
+           const uint8_t *buf,
+           size_t bytes_remaining)
+{
+    push_protobuf_decoder_t  *d = &json->decoder;
+    push_parser_t  *parser = json->parser;
+    const char  *limit_message;
+
+#define ADVANCE(used)                           \
+    {                                           \
+        buf += (used);                          \
+        bytes_remaining -= (used);              \
+        json->offset += (used);                 \
+    }
+
+    while (true)
+    {
+        json_frame_t  *frame = json_top(json);
+        uint64_t  frame_left = frame->end - json->offset;
+        size_t  available;
+        size_t  used;
+        bool  done = false;
+
+        available =
+            (frame_left < bytes_remaining)?
+            frame_left:
+            bytes_remaining;
+
+        if (available == 0)
+        {
+            if (frame_left > 0)
+                break;
+
+            /*
+             * We've reached the end of a submessage, which has to
+             * fall between fields.
+             */
+
+            if (!push_protobuf_decoder_at_field_boundary(d))
+                goto truncated;
+
+            if (!json_pop_frame(json))
+                goto out_of_memory;
+
+            continue;
+        }
+
+        switch (d->state)
+        {
+          case PUSH_PROTOBUF_DECODER_TAG:
+            used = push_protobuf_decoder_read_varint
+                (d, buf, available, &done);
+            if (used == (size_t) -1) goto too_long;
+            ADVANCE(used);
+            if (!done) break;
+
+            if ((d->depth == 0) && !push_parser_count_field(parser))
+                goto too_many_fields;
+
+            if ((d->value > UINT32_MAX) ||
+                !json_dispatch(json, (push_protobuf_tag_t) d->value))
+                goto invalid_tag;
+            break;
+
+          case PUSH_PROTOBUF_DECODER_VARINT:
+            used = push_protobuf_decoder_read_varint
+                (d, buf, available, &done);
+            if (used == (size_t) -1) goto too_long;
+            ADVANCE(used);
+            if (!done) break;
+
+            if ((json->field != NULL) &&
+                !json_write_varint(json, d->value))
+                goto out_of_memory;
+            d->state = PUSH_PROTOBUF_DECODER_TAG;
+            break;
+
+          case PUSH_PROTOBUF_DECODER_FIXED32:
+            used = push_protobuf_decoder_read_fixed
+                (d, buf, available, 4, &done);
+            ADVANCE(used);
+            if (!done) break;
+
+            if ((json->field != NULL) &&
+                !json_write_fixed32(json, (uint32_t) d->value))
+                goto out_of_memory;
+            d->state = PUSH_PROTOBUF_DECODER_TAG;
+            break;
+
+          case PUSH_PROTOBUF_DECODER_FIXED64:
+            used = push_protobuf_decoder_read_fixed
+                (d, buf, available, 8, &done);
+            ADVANCE(used);
+            if (!done) break;
+
+            if ((json->field != NULL) &&
+                !json_write_fixed64(json, d->value))
+                goto out_of_memory;
+            d->state = PUSH_PROTOBUF_DECODER_TAG;
+            break;
+
+          case PUSH_PROTOBUF_DECODER_LENGTH:
+            used = push_protobuf_decoder_read_varint
+                (d, buf, available, &done);
+            if (used == (size_t) -1) goto too_long;
+            ADVANCE(used);
+            if (!done) break;
+
+            if (d->value > frame->end - json->offset)
+                goto truncated;
+
+            d->bytes_left = d->value;
+
+            if (json->field == NULL)
+            {
+                d->state = PUSH_PROTOBUF_DECODER_BYTES;
+            }
+
+            else if (json->field->tag_type !=
+                     PUSH_PROTOBUF_TAG_TYPE_LENGTH_DELIMITED)
+            {
+                /*
+                 * A packed repeated field.
+                 */
+
+                d->state =
+                    (json->field->tag_type ==
+                     PUSH_PROTOBUF_TAG_TYPE_VARINT)?
+                    PUSH_PROTOBUF_DECODER_PACKED_VARINT:
+                    (json->field->tag_type ==
+                     PUSH_PROTOBUF_TAG_TYPE_FIXED32)?
+                    PUSH_PROTOBUF_DECODER_PACKED_FIXED32:
+                    PUSH_PROTOBUF_DECODER_PACKED_FIXED64;
+            }
+
+            else if (json->field->message_type != NULL)
+            {
+                /*
+                 * Our own frames are nested within whatever depth the
+                 * callback itself was activated at.
+                 */
+
+                limit_message = push_parser_check_value
+                    (parser, d->value,
+                     hwm_buffer_current_list_size(&json->frames,
+                                                  json_frame_t) - 1);
+
+                if (limit_message != NULL)
+                    goto limit_exceeded;
+
+                if (!json_begin_value(json) ||
+                    !json_push_frame(json, json->field->message_type,
+                                     json->offset + d->value,
+                                     !json->field->repeated))
+                    goto out_of_memory;
+
+                d->state = PUSH_PROTOBUF_DECODER_TAG;
+                break;
+            }
+
+            else
+            {
+                if (!json_begin_value(json) ||
+                    !json_append_char(json->dest, '"'))
+                    goto out_of_memory;
+
+                json->pending_size = 0;
+                d->state = PUSH_PROTOBUF_DECODER_BYTES;
+            }
+
+            /*
+             * An empty value is finished already.
+             */
+
+            if (d->bytes_left == 0)
+            {
+                if ((d->state == PUSH_PROTOBUF_DECODER_BYTES) &&
+                    (json->field != NULL) &&
+                    !json_finish_bytes(json))
+                    goto out_of_memory;
+                d->state = PUSH_PROTOBUF_DECODER_TAG;
+            }
+            break;
+
+          case PUSH_PROTOBUF_DECODER_BYTES:
+            used =
+                (available < d->bytes_left)?
+                available:
+                d->bytes_left;
+            if ((json->field != NULL) &&
+                !json_write_bytes(json, buf, used))
+                goto out_of_memory;
+            ADVANCE(used);
+            d->bytes_left -= used;
+
+            if (d->bytes_left == 0)
+            {
+                if ((json->field != NULL) &&
+                    !json_finish_bytes(json))
+                    goto out_of_memory;
+                d->state = PUSH_PROTOBUF_DECODER_TAG;
+            }
+            break;
+
+          case PUSH_PROTOBUF_DECODER_PACKED_VARINT:
+            if (available > d->bytes_left)
+                available = d->bytes_left;
+            used = push_protobuf_decoder_read_varint
+                (d, buf, available, &done);
+            if (used == (size_t) -1) goto too_long;
+            ADVANCE(used);
+            d->bytes_left -= used;
+
+            if (done && !json_write_varint(json, d->value))
+                goto out_of_memory;
+
+            if (d->bytes_left == 0)
+            {
+                if (d->size != 0) goto truncated;
+                d->state = PUSH_PROTOBUF_DECODER_TAG;
+            }
+            break;
+
+          case PUSH_PROTOBUF_DECODER_PACKED_FIXED32:
+            if (available > d->bytes_left)
+                available = d->bytes_left;
+            used = push_protobuf_decoder_read_fixed
+                (d, buf, available, 4, &done);
+            ADVANCE(used);
+            d->bytes_left -= used;
+
+            if (done && !json_write_fixed32(json, (uint32_t) d->value))
+                goto out_of_memory;
+
+            if (d->bytes_left == 0)
+            {
+                if (d->size != 0) goto truncated;
+                d->state = PUSH_PROTOBUF_DECODER_TAG;
+            }
+            break;
+
+          case PUSH_PROTOBUF_DECODER_PACKED_FIXED64:
+            if (available > d->bytes_left)
+                available = d->bytes_left;
+            used = push_protobuf_decoder_read_fixed
+                (d, buf, available, 8, &done);
+            ADVANCE(used);
+            d->bytes_left -= used;
+
+            if (done && !json_write_fixed64(json, d->value))
+                goto out_of_memory;
+
+            if (d->bytes_left == 0)
+            {
+                if (d->size != 0) goto truncated;
+                d->state = PUSH_PROTOBUF_DECODER_TAG;
+            }
+            break;
+
+          default:
+            break;
+        }
+    }
+
+#undef ADVANCE
+
+    push_continuation_call(json->callback.incomplete, &json->cont);
+    return;
+
+  too_long:
+    push_continuation_call(json->callback.error,
+                           PUSH_PARSE_ERROR,
+                           "Varint is too long");
+    return;
+
+  invalid_tag:
+    push_continuation_call(json->callback.error,
+                           PUSH_PARSE_ERROR,
+                           "Invalid tag");
+    return;
+
+  truncated:
+    push_continuation_call(json->callback.error,
+                           PUSH_PARSE_ERROR,
+                           "Field extends past end of submessage");
+    return;
+
+  too_many_fields:
+    push_continuation_call(json->callback.error,
+                           PUSH_PARSE_ERROR,
+                           "Too many fields");
+    return;
+
+  limit_exceeded:
+    push_continuation_call(json->callback.error,
+                           PUSH_PARSE_ERROR,
+                           limit_message);
+    return;
+
+  out_of_memory:
+    push_continuation_call(json->callback.error,
+                           PUSH_MEMORY_ERROR,
+                           "Cannot write JSON");
+    return;
+}
+
+
+static void
+json_continue(void *user_data,
+              const void *buf,
+              size_t bytes_remaining)
+{
+    json_t  *json = (json_t *) user_data;
+
+    if (bytes_remaining == 0)
+    {
+        /*
+         * The message ends at EOF, which must fall between fields,
+         * and outside of any submessages.
+         */
+
+        if (!push_protobuf_decoder_at_field_boundary(&json->decoder) ||
+            (hwm_buffer_current_list_size(&json->frames, json_frame_t)
+             != 1))
+        {
+            PUSH_DEBUG_MSG("%s: Reached EOF in middle of field.\n",
+                           push_talloc_get_name(json));
+
+            push_continuation_call(json->callback.error,
+                                   PUSH_PARSE_ERROR,
+                                   "Reached EOF in middle of field");
+            return;
+        }
+
+        if (!json_pop_frame(json))
+        {
+            push_continuation_call(json->callback.error,
+                                   PUSH_MEMORY_ERROR,
+                                   "Cannot write JSON");
+            return;
+        }
+
+        PUSH_DEBUG_MSG("%s: Finished message.\n",
+                       push_talloc_get_name(json));
+
+        push_continuation_call(json->callback.success,
+                               json->dest,
+                               buf, bytes_remaining);
+        return;
+    }
+
+    json_parse(json, buf, bytes_remaining);
+}
+
+
+static void
+json_activate(void *user_data,
+              void *result,
+              const void *buf,
+              size_t bytes_remaining)
+{
+    json_t  *json = (json_t *) user_data;
+
+    PUSH_DEBUG_MSG("%s: Activating.\n",
+                   push_talloc_get_name(json));
+
+    push_protobuf_decoder_init(&json->decoder);
+    json->field = NULL;
+    json->offset = 0;
+    json->pending_size = 0;
+
+    json->frames.current_size = 0;
+    json->spans.current_size = 0;
+    json->seen.current_size = 0;
+    if (!json_push_frame(json, json->type, UINT64_MAX, false))
+    {
+        push_continuation_call(json->callback.error,
+                               PUSH_MEMORY_ERROR,
+                               "Cannot write JSON");
+        return;
+    }
+
+    json_parse(json, buf, bytes_remaining);
+}
+
+
+push_callback_t *
+push_protobuf_json_new(const char *name,
+                       void *parent,
+                       push_parser_t *parser,
+                       const push_protobuf_message_descriptor_t *descriptor,
+                       hwm_buffer_t *dest)
+{
+    json_t  *json;
+
+    if ((descriptor == NULL) || (dest == NULL))
+        return NULL;
+
+    json = push_talloc(parent, json_t);
+    if (json == NULL)
+        return NULL;
+
+    /*
+     * Initialize the push_callback_t instance.
+     */
+
+    if (name == NULL) name = "pb-json";
+    push_talloc_set_name_const(json, name);
+
+    push_callback_init(&json->callback, parser, json,
+                       json_activate,
+                       NULL, NULL, NULL);
+
+    /*
+     * Fill in the continuation objects for the continuations that we
+     * implement.
+     */
+
+    push_continuation_set(&json->cont,
+                          json_continue,
+                          json);
+
+    /*
+     * Fill in the data items, and build the types of every message
+     * that we might have to write.
+     */
+
+    json->parser = parser;
+    json->dest = dest;
+    json->field = NULL;
+    json->offset = 0;
+    json->pending_size = 0;
+    push_protobuf_decoder_init(&json->decoder);
+    hwm_buffer_init(&json->frames);
+    hwm_buffer_init(&json->types);
+    hwm_buffer_init(&json->spans);
+    json->spans_capacity = 0;
+    hwm_buffer_init(&json->seen);
+    hwm_buffer_init(&json->stack);
+    hwm_buffer_init(&json->tails);
+    hwm_buffer_init(&json->scratch);
+    push_talloc_set_destructor(json, json_destructor);
+
+    json->type = json_get_type(json, descriptor);
+    if (json->type == NULL)
+    {
+        push_talloc_free(json);
+        return NULL;
+    }
+
+    return &json->callback;
+}
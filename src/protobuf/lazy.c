@@ -0,0 +1,248 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2010, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the LICENSE.txt file in this distribution for license
+ * details.
+ * ----------------------------------------------------------------------
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <hwm-buffer.h>
+
+#include <push/basics.h>
+#include <push/combinators.h>
+#include <push/primitives.h>
+#include <push/pure.h>
+#include <push/talloc.h>
+
+#include <push/protobuf/basics.h>
+#include <push/protobuf/field-map.h>
+#include <push/protobuf/lazy.h>
+#include <push/protobuf/primitives.h>
+
+
+void
+push_protobuf_lazy_message_init(push_protobuf_lazy_message_t *lazy)
+{
+    hwm_buffer_init(&lazy->buf);
+    hwm_buffer_init(&lazy->merged);
+    push_protobuf_lazy_message_clear(lazy);
+}
+
+
+void
+push_protobuf_lazy_message_done(push_protobuf_lazy_message_t *lazy)
+{
+    hwm_buffer_done(&lazy->buf);
+    hwm_buffer_done(&lazy->merged);
+}
+
+
+void
+push_protobuf_lazy_message_clear(push_protobuf_lazy_message_t *lazy)
+{
+    lazy->view.buf = NULL;
+    lazy->view.size = 0;
+    lazy->view.copied = false;
+    lazy->present = false;
+    lazy->decoded = false;
+    lazy->result = PUSH_SUCCESS;
+}
+
+
+push_error_code_t
+push_protobuf_lazy_message_decode(push_protobuf_lazy_message_t *lazy,
+                                  push_parser_t *parser)
+{
+    push_error_code_t  result;
+
+    if (lazy->decoded)
+        return lazy->result;
+
+    result = push_parser_activate(parser, NULL);
+
+    if ((result == PUSH_INCOMPLETE) && (lazy->view.size > 0))
+        result = push_parser_submit_data(parser, lazy->view.buf,
+                                         lazy->view.size);
+
+    if (result == PUSH_INCOMPLETE)
+        result = push_parser_eof(parser);
+
+    lazy->decoded = true;
+    lazy->result = result;
+    return result;
+}
+
+
+/**
+ * Append some bytes to the merged buffer.
+ */
+
+static bool
+append_merged(push_protobuf_lazy_message_t *lazy,
+              const void *buf, size_t size)
+{
+    size_t  old_size = lazy->merged.current_size;
+
+    if (size == 0)
+        return true;
+
+    if (!hwm_buffer_ensure_size(&lazy->merged, old_size + size))
+        return false;
+
+    memcpy(hwm_buffer_writable_mem(&lazy->merged, uint8_t) + old_size,
+           buf, size);
+    lazy->merged.current_size += size;
+    return true;
+}
+
+
+static bool
+record_view(push_protobuf_lazy_message_t *lazy,
+            push_string_view_t *input,
+            push_string_view_t **output)
+{
+    if (!lazy->present)
+    {
+        hwm_buffer_clear(&lazy->merged);
+
+        if (input->copied)
+        {
+            /*
+             * If the submessage had to be copied, the next lazy field
+             * we read would reuse the same buffer, so swap it into
+             * the merged buffer, where it's safe.  This doesn't move
+             * the bytes themselves, so the view is still valid.
+             */
+
+            hwm_buffer_t  tmp = lazy->merged;
+            lazy->merged = lazy->buf;
+            lazy->buf = tmp;
+            lazy->merged.current_size = input->size;
+        } else {
+            /*
+             * Otherwise the view points into the caller's data chunk,
+             * which the caller is free to reuse as soon as the chunk
+             * has been parsed.  We don't find out when that happens,
+             * and if the field appears again in a later chunk, we'll
+             * need these bytes to merge with it, so copy them now.
+             */
+
+            if (!append_merged(lazy, input->buf, input->size))
+                return false;
+        }
+    } else {
+        /*
+         * This field has appeared before in the same message.
+         * Concatenating the encoded submessages is the same as
+         * merging them, so build up the concatenation in the merged
+         * buffer.
+         */
+
+        if (!append_merged(lazy, input->buf, input->size))
+            return false;
+    }
+
+    lazy->view.buf = hwm_buffer_mem(&lazy->merged, void);
+    lazy->view.size = lazy->merged.current_size;
+    lazy->view.copied = true;
+
+    lazy->present = true;
+    lazy->decoded = false;
+    *output = &lazy->view;
+    return true;
+}
+
+push_define_pure_callback_with_error
+    (record_view_new, record_view, "record",
+     push_string_view_t, push_string_view_t,
+     push_protobuf_lazy_message_t,
+     PUSH_MEMORY_ERROR, "Cannot copy lazy submessage");
+
+
+bool
+push_protobuf_add_lazy_submessage(const char *message_name,
+                                  const char *field_name,
+                                  void *parent,
+                                  push_parser_t *parser,
+                                  push_protobuf_field_map_t *field_map,
+                                  push_protobuf_tag_number_t field_number,
+                                  push_protobuf_lazy_message_t *dest)
+{
+    void  *context;
+    const char  *full_field_name;
+    push_callback_t  *read;
+    push_callback_t  *record;
+    push_callback_t  *field_callback;
+
+    /*
+     * If the field map is NULL, return false.
+     */
+
+    if (field_map == NULL)
+        return false;
+
+    /*
+     * Create a memory context for the objects we're about to create.
+     */
+
+    context = push_talloc_new(parent);
+    if (context == NULL) return false;
+
+    /*
+     * Create the callbacks.  We read the submessage just like a
+     * string, so that it isn't copied if it's all in one chunk.
+     */
+
+    if (message_name == NULL) message_name = "message";
+    if (field_name == NULL) field_name = ".lazy";
+
+    full_field_name =
+        push_talloc_asprintf(context, "%s.%s",
+                             message_name, field_name);
+
+    read = push_protobuf_hwm_string_view_new
+        (push_talloc_asprintf(context, "%s.read", full_field_name),
+         context, parser, &dest->buf);
+    record = record_view_new
+        (push_talloc_asprintf(context, "%s.record", full_field_name),
+         context, parser, dest);
+    field_callback = push_compose_new
+        (push_talloc_asprintf(context, "%s.compose", full_field_name),
+         context, parser, read, record);
+
+    /*
+     * Because of NULL propagation, we only have to check the last
+     * result to see if everything was created okay.
+     */
+
+    if (field_callback == NULL) goto error;
+
+    /*
+     * Try to add the new field.  If we can't, free the callback
+     * before returning.
+     */
+
+    if (!push_protobuf_field_map_add_field
+        (full_field_name, parser, field_map, field_number,
+         PUSH_PROTOBUF_TAG_TYPE_LENGTH_DELIMITED,
+         field_callback))
+    {
+        goto error;
+    }
+
+    return true;
+
+  error:
+    /*
+     * Before returning, free any objects we created before the error.
+     */
+
+    push_talloc_free(context);
+    return false;
+}
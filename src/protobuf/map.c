@@ -0,0 +1,1125 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2010, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the LICENSE.txt file in this distribution for license
+ * details.
+ * ----------------------------------------------------------------------
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <hwm-buffer.h>
+
+#include <push/basics.h>
+#include <push/combinators.h>
+#include <push/primitives.h>
+#include <push/pure.h>
+#include <push/talloc.h>
+
+#include <push/protobuf/basics.h>
+#include <push/protobuf/combinators.h>
+#include <push/protobuf/field-map.h>
+#include <push/protobuf/map.h>
+#include <push/protobuf/message.h>
+#include <push/protobuf/primitives.h>
+
+
+/*-----------------------------------------------------------------------
+ * Maps
+ */
+
+/**
+ * The smallest number of slots in a map's hash table.
+ */
+
+#define MIN_SLOTS  16
+
+
+/**
+ * One entry in a map.  String keys and values, and submessage values,
+ * are stored in the map's arena; we keep their offsets rather than
+ * pointers, since the arena moves when it grows.
+ */
+
+typedef struct _map_entry
+{
+    /**
+     * The hash of the key.  We compare this before comparing the
+     * keys, and use it to rehash the table when it grows.
+     */
+
+    uint64_t  hash;
+
+    /**
+     * The key's value, if it's an integer.
+     */
+
+    uint64_t  key_integer;
+
+    /**
+     * The offset of a string key within the arena.
+     */
+
+    size_t  key_offset;
+
+    /**
+     * The length of a string key.
+     */
+
+    size_t  key_size;
+
+    /**
+     * The value's value, if it's an integer.
+     */
+
+    uint64_t  value_integer;
+
+    /**
+     * The offset of a string or submessage value within the arena.
+     */
+
+    size_t  value_offset;
+
+    /**
+     * The size of a string or submessage value.
+     */
+
+    size_t  value_size;
+
+} map_entry_t;
+
+
+struct _push_protobuf_map
+{
+    /**
+     * How the map's keys are encoded.
+     */
+
+    push_protobuf_map_kind_t  key_kind;
+
+    /**
+     * How the map's values are encoded.
+     */
+
+    push_protobuf_map_kind_t  value_kind;
+
+    /**
+     * The entries, as a list of map_entry_t instances, in the order
+     * that their keys first appeared.
+     */
+
+    hwm_buffer_t  entries;
+
+    /**
+     * The hash table.  We use open addressing with linear probing.
+     * Each slot is a size_t holding an index into entries, plus one;
+     * an empty slot is 0.  The number of slots is a power of two, and
+     * at least twice the number of entries, so that probe sequences
+     * stay short and always end at an empty slot.
+     */
+
+    hwm_buffer_t  slots;
+
+    /**
+     * The number of slots, minus one.
+     */
+
+    size_t  mask;
+
+    /**
+     * The arena that string keys and values, and submessage values,
+     * are allocated from.  Nothing is freed individually; the whole
+     * arena is cleared along with the map.
+     */
+
+    hwm_buffer_t  arena;
+};
+
+
+static int
+map_destructor(push_protobuf_map_t *map)
+{
+    hwm_buffer_done(&map->entries);
+    hwm_buffer_done(&map->slots);
+    hwm_buffer_done(&map->arena);
+    return 0;
+}
+
+
+/**
+ * Mix the bits of an integer key.  (This is the finalizer from
+ * MurmurHash3.)
+ */
+
+static uint64_t
+hash_integer(uint64_t key)
+{
+    key ^= key >> 33;
+    key *= UINT64_C(0xff51afd7ed558ccd);
+    key ^= key >> 33;
+    key *= UINT64_C(0xc4ceb9fe1a85ec53);
+    key ^= key >> 33;
+    return key;
+}
+
+
+/**
+ * The 64-bit FNV-1a hash function, for string keys.
+ */
+
+static uint64_t
+hash_string(const void *buf, size_t size)
+{
+    const uint8_t  *bytes = (const uint8_t *) buf;
+    uint64_t  hash = UINT64_C(14695981039346656037);
+    size_t  i;
+
+    for (i = 0; i < size; i++)
+    {
+        hash ^= bytes[i];
+        hash *= UINT64_C(1099511628211);
+    }
+
+    return hash;
+}
+
+
+/**
+ * Allocate size bytes from the map's arena, and return their offset,
+ * or (size_t) -1 if we can't allocate the memory.  Allocations are
+ * 8-byte aligned, so that submessage structs can live there.
+ */
+
+static size_t
+arena_alloc(push_protobuf_map_t *map, size_t size)
+{
+    size_t  offset = (map->arena.current_size + 7) & ~((size_t) 7);
+
+    if (!hwm_buffer_ensure_size(&map->arena, offset + size))
+        return (size_t) -1;
+
+    map->arena.current_size = offset + size;
+    return offset;
+}
+
+
+/**
+ * Copy a string into the map's arena, with a NUL terminator.
+ */
+
+static size_t
+arena_add_string(push_protobuf_map_t *map, const void *buf, size_t size)
+{
+    size_t  offset = arena_alloc(map, size + 1);
+    char  *dest;
+
+    if (offset == (size_t) -1)
+        return offset;
+
+    dest = hwm_buffer_writable_mem(&map->arena, char) + offset;
+    if (size > 0)
+        memcpy(dest, buf, size);
+    dest[size] = '\0';
+    return offset;
+}
+
+
+/**
+ * Rebuild the hash table with the given number of slots, which must
+ * be a power of two.
+ */
+
+static bool
+map_resize(push_protobuf_map_t *map, size_t num_slots)
+{
+    const map_entry_t  *entries = hwm_buffer_mem(&map->entries, map_entry_t);
+    size_t  count = push_protobuf_map_count(map);
+    size_t  *slots;
+    size_t  i;
+
+    if (!hwm_buffer_ensure_size(&map->slots, num_slots * sizeof(size_t)))
+        return false;
+
+    slots = hwm_buffer_writable_mem(&map->slots, size_t);
+    memset(slots, 0, num_slots * sizeof(size_t));
+    map->slots.current_size = num_slots * sizeof(size_t);
+    map->mask = num_slots - 1;
+
+    for (i = 0; i < count; i++)
+    {
+        size_t  index = entries[i].hash & map->mask;
+
+        while (slots[index] != 0)
+            index = (index + 1) & map->mask;
+
+        slots[index] = i + 1;
+    }
+
+    return true;
+}
+
+
+/**
+ * Find the slot for a key.  If the key is in the map, the slot holds
+ * its entry; otherwise the slot is empty, and is where the key
+ * should be added.
+ */
+
+static size_t
+map_find_slot(const push_protobuf_map_t *map,
+              uint64_t hash,
+              uint64_t key_integer,
+              const void *key_buf,
+              size_t key_size)
+{
+    const map_entry_t  *entries = hwm_buffer_mem(&map->entries, map_entry_t);
+    const size_t  *slots = hwm_buffer_mem(&map->slots, size_t);
+    size_t  index = hash & map->mask;
+
+    while (slots[index] != 0)
+    {
+        const map_entry_t  *entry = &entries[slots[index] - 1];
+
+        if (entry->hash == hash)
+        {
+            if (map->key_kind != PUSH_PROTOBUF_MAP_STRING)
+            {
+                if (entry->key_integer == key_integer)
+                    return index;
+            } else {
+                if ((entry->key_size == key_size) &&
+                    (memcmp(hwm_buffer_mem(&map->arena, uint8_t) +
+                            entry->key_offset,
+                            key_buf, key_size) == 0))
+                    return index;
+            }
+        }
+
+        index = (index + 1) & map->mask;
+    }
+
+    return index;
+}
+
+
+/**
+ * Add an entry to the map, or replace the value of the existing entry
+ * with the same key.  For string keys, the key must already be in the
+ * arena.
+ */
+
+static bool
+map_insert(push_protobuf_map_t *map, const map_entry_t *new_entry)
+{
+    const void  *key_buf = NULL;
+    size_t  count = push_protobuf_map_count(map);
+    size_t  index;
+    size_t  *slot;
+    map_entry_t  *entry;
+
+    if (2 * (count + 1) > map->mask + 1)
+    {
+        size_t  num_slots = (map->mask == 0)? MIN_SLOTS: 2 * (map->mask + 1);
+
+        if (!map_resize(map, num_slots))
+            return false;
+    }
+
+    if (map->key_kind == PUSH_PROTOBUF_MAP_STRING)
+        key_buf = hwm_buffer_mem(&map->arena, uint8_t) + new_entry->key_offset;
+
+    index = map_find_slot(map, new_entry->hash, new_entry->key_integer,
+                          key_buf, new_entry->key_size);
+    slot = hwm_buffer_writable_mem(&map->slots, size_t) + index;
+
+    if (*slot != 0)
+    {
+        /*
+         * The last value for a key wins.
+         */
+
+        entry = hwm_buffer_writable_mem(&map->entries, map_entry_t) +
+            (*slot - 1);
+
+        entry->value_integer = new_entry->value_integer;
+        entry->value_offset = new_entry->value_offset;
+        entry->value_size = new_entry->value_size;
+        return true;
+    }
+
+    entry = hwm_buffer_append_list_elem(&map->entries, map_entry_t);
+    if (entry == NULL)
+        return false;
+
+    *entry = *new_entry;
+    *slot = count + 1;
+    return true;
+}
+
+
+static void
+fill_value(const push_protobuf_map_t *map,
+           push_protobuf_map_kind_t kind,
+           uint64_t integer, size_t offset, size_t size,
+           push_protobuf_map_value_t *dest)
+{
+    if (dest == NULL)
+        return;
+
+    dest->integer = integer;
+
+    if ((kind == PUSH_PROTOBUF_MAP_STRING) ||
+        (kind == PUSH_PROTOBUF_MAP_MESSAGE))
+    {
+        dest->data = hwm_buffer_mem(&map->arena, uint8_t) + offset;
+        dest->size = size;
+    } else {
+        dest->data = NULL;
+        dest->size = 0;
+    }
+}
+
+
+push_protobuf_map_t *
+push_protobuf_map_new(void *parent,
+                      push_protobuf_map_kind_t key_kind,
+                      push_protobuf_map_kind_t value_kind)
+{
+    push_protobuf_map_t  *map;
+
+    if (key_kind == PUSH_PROTOBUF_MAP_MESSAGE)
+        return NULL;
+
+    map = push_talloc(parent, push_protobuf_map_t);
+    if (map == NULL)
+        return NULL;
+
+    push_talloc_set_name_const(map, "map");
+
+    map->key_kind = key_kind;
+    map->value_kind = value_kind;
+    hwm_buffer_init(&map->entries);
+    hwm_buffer_init(&map->slots);
+    map->mask = 0;
+    hwm_buffer_init(&map->arena);
+
+    push_talloc_set_destructor(map, map_destructor);
+
+    return map;
+}
+
+
+void
+push_protobuf_map_clear(push_protobuf_map_t *map)
+{
+    hwm_buffer_clear(&map->entries);
+    hwm_buffer_clear(&map->arena);
+
+    if (map->mask != 0)
+    {
+        memset(hwm_buffer_writable_mem(&map->slots, size_t), 0,
+               map->slots.current_size);
+    }
+}
+
+
+bool
+push_protobuf_map_reserve(push_protobuf_map_t *map, size_t count)
+{
+    size_t  num_slots = MIN_SLOTS;
+
+    while (num_slots < 2 * count)
+        num_slots *= 2;
+
+    if (num_slots <= map->mask + 1)
+        return true;
+
+    PUSH_DEBUG_MSG("map: Reserving room for %zu entries.\n", count);
+
+    if (!hwm_buffer_ensure_size(&map->entries, count * sizeof(map_entry_t)))
+        return false;
+
+    return map_resize(map, num_slots);
+}
+
+
+size_t
+push_protobuf_map_count(const push_protobuf_map_t *map)
+{
+    return hwm_buffer_current_list_size(&map->entries, map_entry_t);
+}
+
+
+bool
+push_protobuf_map_get(const push_protobuf_map_t *map,
+                      size_t index,
+                      push_protobuf_map_value_t *key,
+                      push_protobuf_map_value_t *value)
+{
+    const map_entry_t  *entry;
+
+    if (index >= push_protobuf_map_count(map))
+        return false;
+
+    entry = hwm_buffer_mem(&map->entries, map_entry_t) + index;
+
+    fill_value(map, map->key_kind, entry->key_integer,
+               entry->key_offset, entry->key_size, key);
+    fill_value(map, map->value_kind, entry->value_integer,
+               entry->value_offset, entry->value_size, value);
+    return true;
+}
+
+
+static bool
+map_find(const push_protobuf_map_t *map,
+         uint64_t hash,
+         uint64_t key_integer,
+         const void *key_buf,
+         size_t key_size,
+         push_protobuf_map_value_t *value)
+{
+    size_t  index;
+    size_t  slot;
+
+    if (map->mask == 0)
+        return false;
+
+    index = map_find_slot(map, hash, key_integer, key_buf, key_size);
+    slot = hwm_buffer_mem(&map->slots, size_t)[index];
+
+    if (slot == 0)
+        return false;
+
+    return push_protobuf_map_get(map, slot - 1, NULL, value);
+}
+
+
+bool
+push_protobuf_map_find_integer(const push_protobuf_map_t *map,
+                               uint64_t key,
+                               push_protobuf_map_value_t *value)
+{
+    if (map->key_kind == PUSH_PROTOBUF_MAP_STRING)
+        return false;
+
+    return map_find(map, hash_integer(key), key, NULL, 0, value);
+}
+
+
+bool
+push_protobuf_map_find_string(const push_protobuf_map_t *map,
+                              const void *key,
+                              size_t size,
+                              push_protobuf_map_value_t *value)
+{
+    if (map->key_kind != PUSH_PROTOBUF_MAP_STRING)
+        return false;
+
+    return map_find(map, hash_string(key, size), 0, key, size, value);
+}
+
+
+/*-----------------------------------------------------------------------
+ * Map field callbacks
+ */
+
+/**
+ * The key or value of the entry that we're currently parsing.
+ */
+
+typedef struct _pending
+{
+    /**
+     * An integer or 64-bit fixed-width key or value.
+     */
+
+    uint64_t  integer;
+
+    /**
+     * A 32-bit fixed-width key or value.
+     */
+
+    uint32_t  fixed32;
+
+    /**
+     * Whether a string key or value has been copied into the arena
+     * yet.
+     */
+
+    bool  stored;
+
+    /**
+     * The offset of a string key or value within the arena.
+     */
+
+    size_t  offset;
+
+    /**
+     * The length of a string key or value.
+     */
+
+    size_t  size;
+
+} pending_t;
+
+
+/**
+ * The state that all of the callbacks for a map field share.
+ */
+
+typedef struct _map_field
+{
+    /**
+     * The map that we're parsing into.
+     */
+
+    push_protobuf_map_t  *map;
+
+    /**
+     * The current entry's key.
+     */
+
+    pending_t  key;
+
+    /**
+     * The current entry's value.
+     */
+
+    pending_t  value;
+
+    /**
+     * The struct that submessage values are parsed into, or NULL.
+     */
+
+    void  *element;
+
+    /**
+     * The size of element.
+     */
+
+    size_t  element_size;
+
+    /**
+     * The number of bytes available when the first entry started,
+     * which is the rest of the surrounding message if it's all in
+     * the current chunk.
+     */
+
+    size_t  available;
+
+    /**
+     * The size of the first entry, which we use to estimate how many
+     * entries there are.
+     */
+
+    size_t  entry_size;
+
+    /**
+     * A buffer for any strings that straddle data chunks.
+     */
+
+    hwm_buffer_t  scratch;
+
+} map_field_t;
+
+
+static int
+map_field_destructor(map_field_t *field)
+{
+    hwm_buffer_done(&field->scratch);
+    return 0;
+}
+
+
+/**
+ * A callback that records how many bytes it was activated with into
+ * dest, as long as the map is still empty, and optionally resets the
+ * pending key and value.  The input is passed through unchanged.
+ * Used at the start of each entry, to see how much of the surrounding
+ * message is left, and just inside its length prefix, to see how
+ * large the entry is.  Both are only hints: if the value isn't all in
+ * the current chunk, we'll only see the part that is.
+ */
+
+typedef struct _note_bytes
+{
+    push_callback_t  callback;
+    map_field_t  *field;
+    size_t  *dest;
+    bool  reset;
+} note_bytes_t;
+
+
+static void
+note_bytes_activate(void *user_data,
+                    void *result,
+                    const void *buf,
+                    size_t bytes_remaining)
+{
+    note_bytes_t  *note = (note_bytes_t *) user_data;
+    map_field_t  *field = note->field;
+
+    if (push_protobuf_map_count(field->map) == 0)
+        *note->dest = bytes_remaining;
+
+    if (note->reset)
+    {
+        memset(&field->key, 0, sizeof(pending_t));
+        memset(&field->value, 0, sizeof(pending_t));
+
+        if (field->element != NULL)
+            memset(field->element, 0, field->element_size);
+    }
+
+    push_continuation_call(note->callback.success,
+                           result,
+                           buf, bytes_remaining);
+}
+
+
+static push_callback_t *
+note_bytes_new(const char *name,
+               void *parent,
+               push_parser_t *parser,
+               map_field_t *field,
+               size_t *dest,
+               bool reset)
+{
+    note_bytes_t  *note = push_talloc(parent, note_bytes_t);
+
+    if (note == NULL)
+        return NULL;
+
+    push_talloc_set_name_const(note, name);
+    push_callback_init(&note->callback, parser, note,
+                       note_bytes_activate,
+                       NULL, NULL, NULL);
+
+    note->field = field;
+    note->dest = dest;
+    note->reset = reset;
+    return &note->callback;
+}
+
+
+/**
+ * Copies a string key or value into the arena as soon as it's read,
+ * since it might point into a data chunk that won't be around when
+ * the entry finishes.
+ */
+
+typedef struct _stash_info
+{
+    push_protobuf_map_t  *map;
+    pending_t  *pending;
+} stash_info_t;
+
+
+static bool
+stash_string(stash_info_t *info,
+             push_string_view_t *input,
+             void **output)
+{
+    size_t  offset = arena_add_string(info->map, input->buf, input->size);
+
+    if (offset == (size_t) -1)
+        return false;
+
+    info->pending->stored = true;
+    info->pending->offset = offset;
+    info->pending->size = input->size;
+
+    *output = input;
+    return true;
+}
+
+push_define_pure_callback(stash_string_new, stash_string, "stash",
+                          push_string_view_t, void, stash_info_t);
+
+
+/**
+ * Fills in one side of a new entry from the pending key or value.
+ */
+
+static bool
+finish_pending(push_protobuf_map_t *map,
+               push_protobuf_map_kind_t kind,
+               pending_t *pending,
+               uint64_t *integer,
+               size_t *offset,
+               size_t *size)
+{
+    *integer = 0;
+    *offset = 0;
+    *size = 0;
+
+    switch (kind)
+    {
+      case PUSH_PROTOBUF_MAP_FIXED32:
+        *integer = pending->fixed32;
+        return true;
+
+      case PUSH_PROTOBUF_MAP_STRING:
+        /*
+         * A missing string is empty.
+         */
+
+        if (!pending->stored)
+        {
+            pending->offset = arena_add_string(map, NULL, 0);
+            if (pending->offset == (size_t) -1)
+                return false;
+        }
+
+        *offset = pending->offset;
+        *size = pending->size;
+        return true;
+
+      default:
+        *integer = pending->integer;
+        return true;
+    }
+}
+
+
+/**
+ * Adds the current entry to the map once it's been parsed.  The input
+ * is passed through unchanged.
+ */
+
+static bool
+commit_entry(map_field_t *field, void *input, void **output)
+{
+    push_protobuf_map_t  *map = field->map;
+    map_entry_t  entry;
+
+    /*
+     * If this is the first entry, assume that the rest of the data we
+     * could see when it started is entries like this one, and size
+     * the table to fit.  (Each entry has at least a one-byte tag and
+     * one-byte length prefix in front of it.)
+     */
+
+    if ((push_protobuf_map_count(map) == 0) &&
+        (field->available > 0))
+    {
+        if (!push_protobuf_map_reserve
+            (map, field->available / (field->entry_size + 2)))
+            return false;
+    }
+
+    if (!finish_pending(map, map->key_kind, &field->key,
+                        &entry.key_integer,
+                        &entry.key_offset, &entry.key_size))
+        return false;
+
+    if (field->element != NULL)
+    {
+        entry.value_integer = 0;
+        entry.value_offset = arena_alloc(map, field->element_size);
+        entry.value_size = field->element_size;
+
+        if (entry.value_offset == (size_t) -1)
+            return false;
+
+        memcpy(hwm_buffer_writable_mem(&map->arena, uint8_t) +
+               entry.value_offset,
+               field->element, field->element_size);
+    } else {
+        if (!finish_pending(map, map->value_kind, &field->value,
+                            &entry.value_integer,
+                            &entry.value_offset, &entry.value_size))
+            return false;
+    }
+
+    if (map->key_kind == PUSH_PROTOBUF_MAP_STRING)
+    {
+        entry.hash = hash_string(hwm_buffer_mem(&map->arena, uint8_t) +
+                                 entry.key_offset,
+                                 entry.key_size);
+    } else {
+        entry.hash = hash_integer(entry.key_integer);
+    }
+
+    if (!map_insert(map, &entry))
+        return false;
+
+    *output = input;
+    return true;
+}
+
+push_define_pure_callback(commit_entry_new, commit_entry, "commit",
+                          void, void, map_field_t);
+
+
+/**
+ * Adds a key or value field (other than a submessage) to the field
+ * map for a map's entries.
+ */
+
+static bool
+add_entry_field(const char *entry_name,
+                const char *field_name,
+                void *context,
+                push_parser_t *parser,
+                push_protobuf_field_map_t *entry_map,
+                push_protobuf_tag_number_t field_number,
+                map_field_t *field,
+                push_protobuf_map_kind_t kind,
+                pending_t *pending)
+{
+    switch (kind)
+    {
+      case PUSH_PROTOBUF_MAP_VARINT:
+        return push_protobuf_assign_uint64
+            (entry_name, field_name, context, parser,
+             entry_map, field_number, &pending->integer);
+
+      case PUSH_PROTOBUF_MAP_SVARINT:
+        return push_protobuf_assign_sint64
+            (entry_name, field_name, context, parser,
+             entry_map, field_number, (int64_t *) &pending->integer);
+
+      case PUSH_PROTOBUF_MAP_FIXED32:
+        return push_protobuf_assign_fixed32
+            (entry_name, field_name, context, parser,
+             entry_map, field_number, &pending->fixed32);
+
+      case PUSH_PROTOBUF_MAP_FIXED64:
+        return push_protobuf_assign_fixed64
+            (entry_name, field_name, context, parser,
+             entry_map, field_number, &pending->integer);
+
+      case PUSH_PROTOBUF_MAP_STRING:
+        {
+            const char  *full_field_name;
+            stash_info_t  *info;
+            push_callback_t  *view;
+            push_callback_t  *stash;
+            push_callback_t  *callback;
+
+            full_field_name =
+                push_talloc_asprintf(context, "%s.%s",
+                                     entry_name, field_name);
+
+            info = push_talloc(context, stash_info_t);
+            if (info == NULL) return false;
+
+            info->map = field->map;
+            info->pending = pending;
+
+            view = push_protobuf_hwm_string_view_new
+                (push_talloc_asprintf(context, "%s.view", full_field_name),
+                 context, parser, &field->scratch);
+            stash = stash_string_new
+                (push_talloc_asprintf(context, "%s.stash", full_field_name),
+                 context, parser, info);
+            callback = push_compose_new
+                (push_talloc_asprintf(context, "%s.compose",
+                                      full_field_name),
+                 context, parser, view, stash);
+
+            if (callback == NULL)
+                return false;
+
+            return push_protobuf_field_map_add_field
+                (full_field_name, parser, entry_map, field_number,
+                 PUSH_PROTOBUF_TAG_TYPE_LENGTH_DELIMITED, callback);
+        }
+
+      default:
+        return false;
+    }
+}
+
+
+static bool
+add_map_field(const char *message_name,
+              const char *field_name,
+              void *parent,
+              push_parser_t *parser,
+              push_protobuf_field_map_t *field_map,
+              push_protobuf_tag_number_t field_number,
+              push_callback_t *message,
+              void *element,
+              size_t element_size,
+              push_protobuf_map_t *dest)
+{
+    void  *context;
+    const char  *full_field_name;
+    map_field_t  *field;
+    push_protobuf_field_map_t  *entry_map;
+    push_callback_t  *entry;
+    push_callback_t  *note_size;
+    push_callback_t  *compose1;
+    push_callback_t  *begin;
+    push_callback_t  *prefixed;
+    push_callback_t  *commit;
+    push_callback_t  *compose2;
+    push_callback_t  *callback;
+
+    /*
+     * If the field map or destination is NULL, return false.
+     */
+
+    if ((field_map == NULL) || (dest == NULL))
+        return false;
+
+    /*
+     * Create a memory context for the objects we're about to create.
+     */
+
+    context = push_talloc_new(parent);
+    if (context == NULL) return false;
+
+    /*
+     * All of the callbacks share the same state.
+     */
+
+    field = push_talloc(context, map_field_t);
+    if (field == NULL) goto error;
+
+    field->map = dest;
+    field->element = element;
+    field->element_size = element_size;
+    field->available = 0;
+    field->entry_size = 0;
+    hwm_buffer_init(&field->scratch);
+    push_talloc_set_destructor(field, map_field_destructor);
+
+    /*
+     * Create the callbacks that parse each entry.
+     */
+
+    if (message_name == NULL) message_name = "message";
+    if (field_name == NULL) field_name = ".map";
+
+    full_field_name =
+        push_talloc_asprintf(context, "%s.%s",
+                             message_name, field_name);
+
+    entry_map = push_protobuf_field_map_new(context);
+    if (entry_map == NULL) goto error;
+
+    if (!add_entry_field(full_field_name, "key", context, parser,
+                         entry_map, 1, field, dest->key_kind, &field->key))
+        goto error;
+
+    if (message != NULL)
+    {
+        if (!push_protobuf_add_submessage(full_field_name, "value",
+                                          context, parser,
+                                          entry_map, 2, message))
+            goto error;
+    } else {
+        if (!add_entry_field(full_field_name, "value", context, parser,
+                             entry_map, 2, field, dest->value_kind,
+                             &field->value))
+            goto error;
+    }
+
+    entry = push_protobuf_message_new
+        (push_talloc_asprintf(context, "%s.entry", full_field_name),
+         context, parser, entry_map);
+
+    /*
+     * Then wrap the entry in a length prefix, and add it to the map
+     * once it's finished.
+     */
+
+    note_size = note_bytes_new
+        (push_talloc_asprintf(context, "%s.size", full_field_name),
+         context, parser, field, &field->entry_size, false);
+    compose1 = push_compose_new
+        (push_talloc_asprintf(context, "%s.compose1", full_field_name),
+         context, parser, note_size, entry);
+    begin = note_bytes_new
+        (push_talloc_asprintf(context, "%s.begin", full_field_name),
+         context, parser, field, &field->available, true);
+    prefixed = push_protobuf_varint_prefixed_new
+        (push_talloc_asprintf(context, "%s.prefixed", full_field_name),
+         context, parser, compose1);
+    commit = commit_entry_new
+        (push_talloc_asprintf(context, "%s.commit", full_field_name),
+         context, parser, field);
+    compose2 = push_compose_new
+        (push_talloc_asprintf(context, "%s.compose2", full_field_name),
+         context, parser, begin, prefixed);
+    callback = push_compose_new
+        (push_talloc_asprintf(context, "%s.compose3", full_field_name),
+         context, parser, compose2, commit);
+
+    /*
+     * Because of NULL propagation, we only have to check the last
+     * result to see if everything was created okay.
+     */
+
+    if (callback == NULL) goto error;
+
+    /*
+     * Try to add the new field.  If we can't, free the callback
+     * before returning.
+     */
+
+    if (!push_protobuf_field_map_add_field
+        (full_field_name, parser, field_map, field_number,
+         PUSH_PROTOBUF_TAG_TYPE_LENGTH_DELIMITED, callback))
+    {
+        goto error;
+    }
+
+    return true;
+
+  error:
+    /*
+     * Before returning, free any objects we created before the error.
+     */
+
+    push_talloc_free(context);
+    return false;
+}
+
+
+bool
+push_protobuf_add_map(const char *message_name,
+                      const char *field_name,
+                      void *parent,
+                      push_parser_t *parser,
+                      push_protobuf_field_map_t *field_map,
+                      push_protobuf_tag_number_t field_number,
+                      push_protobuf_map_t *dest)
+{
+    if ((dest == NULL) || (dest->value_kind == PUSH_PROTOBUF_MAP_MESSAGE))
+        return false;
+
+    return add_map_field(message_name, field_name, parent, parser,
+                         field_map, field_number,
+                         NULL, NULL, 0, dest);
+}
+
+
+bool
+push_protobuf_add_map_submessage(const char *message_name,
+                                 const char *field_name,
+                                 void *parent,
+                                 push_parser_t *parser,
+                                 push_protobuf_field_map_t *field_map,
+                                 push_protobuf_tag_number_t field_number,
+                                 push_callback_t *message,
+                                 void *element,
+                                 size_t element_size,
+                                 push_protobuf_map_t *dest)
+{
+    if ((dest == NULL) || (message == NULL) || (element == NULL) ||
+        (dest->value_kind != PUSH_PROTOBUF_MAP_MESSAGE))
+        return false;
+
+    return add_map_field(message_name, field_name, parent, parser,
+                         field_map, field_number,
+                         message, element, element_size, dest);
+}
@@ -0,0 +1,495 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2010, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the LICENSE.txt file in this distribution for license
+ * details.
+ * ----------------------------------------------------------------------
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <hwm-buffer.h>
+
+#include <push/basics.h>
+#include <push/talloc.h>
+
+#include <push/protobuf/combinators.h>
+
+
+/**
+ * The user data struct for a message stream callback.
+ */
+
+typedef struct _message_stream
+{
+    /**
+     * The push_callback_t superclass for this callback.
+     */
+
+    push_callback_t  callback;
+
+    /**
+     * The continue continuation that we use while waiting for the
+     * next message to start.
+     */
+
+    push_continue_continuation_t  cont;
+
+    /**
+     * The success continuation for each message.
+     */
+
+    push_success_continuation_t  message_done;
+
+    /**
+     * An incomplete continuation that passes on the wrapped
+     * callback's incompletes to our own incomplete continuation.
+     */
+
+    push_incomplete_continuation_t  message_incomplete;
+
+    /**
+     * An error continuation that passes on the wrapped callback's
+     * errors to our own error continuation.
+     */
+
+    push_error_continuation_t  message_error;
+
+    /**
+     * A continue continuation that we hand out in place of the
+     * wrapped callback's, so that we can catch EOFs in the middle of
+     * a message.
+     */
+
+    push_continue_continuation_t  message_cont;
+
+    /**
+     * The wrapped callback's continue continuation.
+     */
+
+    push_continue_continuation_t  *wrapped_cont;
+
+    /**
+     * The varint-prefixed callback that reads each message.
+     */
+
+    push_callback_t  *wrapped;
+
+    /**
+     * The struct that the message callback stores its values into.
+     */
+
+    void  *element;
+
+    /**
+     * The size of element.
+     */
+
+    size_t  element_size;
+
+    /**
+     * The number of messages in a full batch.
+     */
+
+    size_t  batch_size;
+
+    /**
+     * The current batch.  The buffer's memory is reused for every
+     * batch.
+     */
+
+    hwm_buffer_t  batch;
+
+    /**
+     * The number of messages in the current batch.
+     */
+
+    size_t  batch_count;
+
+    /**
+     * The function that receives each batch.
+     */
+
+    push_protobuf_message_sink_func_t  *sink;
+
+    /**
+     * The user data pointer to pass into the sink function.
+     */
+
+    void  *sink_user_data;
+
+    /**
+     * The input that we pass into each message.
+     */
+
+    void  *input;
+
+    /**
+     * The number of messages read so far.  This is also our result.
+     */
+
+    size_t  message_count;
+
+    /**
+     * The parser, whose field count we reset for each message.
+     */
+
+    push_parser_t  *parser;
+
+} message_stream_t;
+
+
+static int
+message_stream_destructor(message_stream_t *stream)
+{
+    hwm_buffer_done(&stream->batch);
+    return 0;
+}
+
+
+static bool
+flush_batch(message_stream_t *stream)
+{
+    bool  result;
+
+    if (stream->batch_count == 0)
+        return true;
+
+    PUSH_DEBUG_MSG("%s: Sending batch of %zu messages to sink.\n",
+                   push_talloc_get_name(stream),
+                   stream->batch_count);
+
+    result = stream->sink(stream->sink_user_data,
+                          hwm_buffer_writable_mem(&stream->batch, void),
+                          stream->batch_count);
+
+    hwm_buffer_clear(&stream->batch);
+    stream->batch_count = 0;
+    return result;
+}
+
+
+static void
+message_stream_continue(void *user_data,
+                        const void *buf,
+                        size_t bytes_remaining)
+{
+    message_stream_t  *stream = (message_stream_t *) user_data;
+
+    /*
+     * We're in between messages, so EOF means that the stream is
+     * finished.  Send off whatever's left in the current batch.
+     */
+
+    if (bytes_remaining == 0)
+    {
+        PUSH_DEBUG_MSG("%s: EOF after %zu messages.\n",
+                       push_talloc_get_name(stream),
+                       stream->message_count);
+
+        if (!flush_batch(stream))
+        {
+            push_continuation_call(stream->callback.error,
+                                   PUSH_PARSE_ERROR,
+                                   "Message sink failed");
+
+            return;
+        }
+
+        push_continuation_call(stream->callback.success,
+                               &stream->message_count,
+                               buf, bytes_remaining);
+
+        return;
+    }
+
+    /*
+     * Otherwise this data starts the next message.  The parser's
+     * field count limit applies to each message separately.
+     */
+
+    push_parser_reset_field_count(stream->parser);
+
+    if (stream->element != NULL)
+        memset(stream->element, 0, stream->element_size);
+
+    push_continuation_call(&stream->wrapped->activate,
+                           stream->input,
+                           buf, bytes_remaining);
+}
+
+
+static void
+message_stream_message_done(void *user_data,
+                            void *result,
+                            const void *buf,
+                            size_t bytes_remaining)
+{
+    message_stream_t  *stream = (message_stream_t *) user_data;
+    bool  sink_ok = true;
+
+    stream->message_count++;
+
+    if (stream->element == NULL)
+    {
+        sink_ok = stream->sink(stream->sink_user_data, result, 1);
+    } else {
+        void  *dest;
+
+        /*
+         * Copy the element into the next slot of the batch.  The
+         * batch buffer keeps its memory when it's cleared, so this
+         * only allocates while the first batch is filling up.
+         */
+
+        if (!hwm_buffer_ensure_size(&stream->batch,
+                                    stream->batch.current_size +
+                                    stream->element_size))
+        {
+            push_continuation_call(stream->callback.error,
+                                   PUSH_MEMORY_ERROR,
+                                   "Cannot grow message batch");
+
+            return;
+        }
+
+        dest = hwm_buffer_writable_mem(&stream->batch, uint8_t) +
+            stream->batch.current_size;
+        memcpy(dest, stream->element, stream->element_size);
+        stream->batch.current_size += stream->element_size;
+        stream->batch_count++;
+
+        if (stream->batch_count >= stream->batch_size)
+            sink_ok = flush_batch(stream);
+    }
+
+    if (!sink_ok)
+    {
+        push_continuation_call(stream->callback.error,
+                               PUSH_PARSE_ERROR,
+                               "Message sink failed");
+
+        return;
+    }
+
+    /*
+     * If the message used up the current chunk, wait for the next
+     * one; we can't tell yet whether there's another message.
+     */
+
+    if (bytes_remaining == 0)
+    {
+        push_continuation_call(stream->callback.incomplete,
+                               &stream->cont);
+
+        return;
+    }
+
+    message_stream_continue(user_data, buf, bytes_remaining);
+}
+
+
+static void
+message_stream_message_continue(void *user_data,
+                                const void *buf,
+                                size_t bytes_remaining)
+{
+    message_stream_t  *stream = (message_stream_t *) user_data;
+
+    /*
+     * A message that reaches its length prefix finishes without
+     * waiting for more data, so an EOF that reaches the message means
+     * that it was cut short.  (The varint-prefixed callback would
+     * happily pass the EOF on to the message, which would succeed
+     * with whatever fields it had seen.)
+     */
+
+    if (bytes_remaining == 0)
+    {
+        PUSH_DEBUG_MSG("%s: EOF in the middle of a message.\n",
+                       push_talloc_get_name(stream));
+
+        push_continuation_call(stream->callback.error,
+                               PUSH_PARSE_ERROR,
+                               "EOF in the middle of a message");
+
+        return;
+    }
+
+    push_continuation_call(stream->wrapped_cont, buf, bytes_remaining);
+}
+
+
+static void
+message_stream_message_incomplete(void *user_data,
+                                  push_continue_continuation_t *cont)
+{
+    message_stream_t  *stream = (message_stream_t *) user_data;
+
+    stream->wrapped_cont = cont;
+    push_continuation_call(stream->callback.incomplete,
+                           &stream->message_cont);
+}
+
+
+static void
+message_stream_message_error(void *user_data,
+                             push_error_code_t error_code,
+                             const char *error_message)
+{
+    message_stream_t  *stream = (message_stream_t *) user_data;
+
+    push_continuation_call(stream->callback.error,
+                           error_code, error_message);
+}
+
+
+static void
+message_stream_activate(void *user_data,
+                        void *result,
+                        const void *buf,
+                        size_t bytes_remaining)
+{
+    message_stream_t  *stream = (message_stream_t *) user_data;
+
+    PUSH_DEBUG_MSG("%s: Activating.\n",
+                   push_talloc_get_name(stream));
+
+    stream->input = result;
+    stream->message_count = 0;
+    hwm_buffer_clear(&stream->batch);
+    stream->batch_count = 0;
+
+    if (bytes_remaining == 0)
+    {
+        /*
+         * If we don't get any data when we're activated, return an
+         * incomplete and wait for some data.
+         */
+
+        push_continuation_call(stream->callback.incomplete,
+                               &stream->cont);
+
+        return;
+    }
+
+    message_stream_continue(user_data, buf, bytes_remaining);
+}
+
+
+push_callback_t *
+push_protobuf_message_stream_new(const char *name,
+                                 void *parent,
+                                 push_parser_t *parser,
+                                 push_callback_t *message,
+                                 void *element,
+                                 size_t element_size,
+                                 size_t batch_size,
+                                 push_protobuf_message_sink_func_t *sink,
+                                 void *sink_user_data)
+{
+    message_stream_t  *stream;
+
+    /*
+     * If the message callback or sink is NULL, return NULL ourselves.
+     */
+
+    if ((message == NULL) || (sink == NULL))
+        return NULL;
+
+    /*
+     * Allocate the user data struct.
+     */
+
+    stream = push_talloc(parent, message_stream_t);
+    if (stream == NULL) return NULL;
+
+    if (name == NULL) name = "message-stream";
+    push_talloc_set_name_const(stream, name);
+
+    /*
+     * Each message is varint-prefixed.
+     */
+
+    stream->wrapped = push_protobuf_varint_prefixed_new
+        (push_talloc_asprintf(stream, "%s.prefixed", name),
+         stream, parser, message);
+
+    if (stream->wrapped == NULL)
+    {
+        push_talloc_free(stream);
+        return NULL;
+    }
+
+    /*
+     * Fill in the data items.
+     */
+
+    stream->element = element;
+    stream->element_size = element_size;
+    stream->batch_size = (batch_size == 0)? 1: batch_size;
+    hwm_buffer_init(&stream->batch);
+    stream->batch_count = 0;
+    stream->sink = sink;
+    stream->sink_user_data = sink_user_data;
+    stream->input = NULL;
+    stream->message_count = 0;
+    stream->parser = parser;
+
+    push_talloc_set_destructor(stream, message_stream_destructor);
+
+    /*
+     * Initialize the push_callback_t instance.
+     */
+
+    push_callback_init(&stream->callback, parser, stream,
+                       message_stream_activate,
+                       NULL, NULL, NULL);
+
+    /*
+     * Fill in the continuation objects for the continuations that we
+     * implement.
+     */
+
+    push_continuation_set(&stream->cont,
+                          message_stream_continue,
+                          stream);
+
+    push_continuation_set(&stream->message_done,
+                          message_stream_message_done,
+                          stream);
+
+    push_continuation_set(&stream->message_incomplete,
+                          message_stream_message_incomplete,
+                          stream);
+
+    push_continuation_set(&stream->message_error,
+                          message_stream_message_error,
+                          stream);
+
+    push_continuation_set(&stream->message_cont,
+                          message_stream_message_continue,
+                          stream);
+
+    /*
+     * The wrapped callback returns to us after each message; its
+     * incompletes and errors are passed on to whatever our own
+     * continuations are at the time.
+     */
+
+    push_continuation_call(&stream->wrapped->set_success,
+                           &stream->message_done);
+
+    push_continuation_call(&stream->wrapped->set_incomplete,
+                           &stream->message_incomplete);
+
+    push_continuation_call(&stream->wrapped->set_error,
+                           &stream->message_error);
+
+    return &stream->callback;
+}
@@ -13,12 +13,254 @@
 #include <stdint.h>
 
 #include <push/basics.h>
+#include <push/combinators.h>
+#include <push/pure.h>
 #include <push/talloc.h>
 
 #include <push/protobuf/basics.h>
 #include <push/protobuf/field-map.h>
+#include <push/protobuf/field-stats.h>
 #include <push/protobuf/message.h>
 #include <push/protobuf/primitives.h>
+#include <push/protobuf/unknown.h>
+
+
+/*-----------------------------------------------------------------------
+ * Field statistics
+ */
+
+/**
+ * Sits between a message's field callbacks and the continuations
+ * that they would otherwise call, so that it can count the bytes that
+ * each field uses, and whether it fails.  This is only created if the
+ * field map is tracking statistics; otherwise the field callbacks are
+ * wired straight to the message's continuations, and the only cost
+ * is a NULL check per field.
+ */
+
+typedef struct _field_tracker
+{
+    /**
+     * The success continuation that we give to the field callbacks.
+     */
+
+    push_success_continuation_t  success;
+
+    /**
+     * The incomplete continuation that we give to the field
+     * callbacks.
+     */
+
+    push_incomplete_continuation_t  incomplete;
+
+    /**
+     * The error continuation that we give to the field callbacks.
+     */
+
+    push_error_continuation_t  error;
+
+    /**
+     * The continue continuation that we pass on when a field callback
+     * needs more data.
+     */
+
+    push_continue_continuation_t  cont;
+
+    /**
+     * The message's continuations, which we pass everything on to.
+     */
+
+    push_success_continuation_t  *next_success;
+    push_incomplete_continuation_t  *next_incomplete;
+    push_error_continuation_t  *next_error;
+
+    /**
+     * The continue continuation of the field callback that's waiting
+     * for more data.
+     */
+
+    push_continue_continuation_t  *field_cont;
+
+    /**
+     * The statistics to update.
+     */
+
+    push_protobuf_field_stats_t  *stats;
+
+    /**
+     * The index of the current field's entry in stats.
+     */
+
+    size_t  index;
+
+    /**
+     * The number of bytes that the current field has used so far.
+     */
+
+    uint64_t  bytes;
+
+    /**
+     * The number of bytes that were available when the current field
+     * callback last received data.
+     */
+
+    size_t  available;
+
+} field_tracker_t;
+
+
+/**
+ * Return the number of bytes in a tag's varint encoding.
+ */
+
+static inline size_t
+encoded_tag_size(push_protobuf_tag_t tag)
+{
+    size_t  size = 1;
+
+    while (tag >= 0x80)
+    {
+        tag >>= 7;
+        size++;
+    }
+
+    return size;
+}
+
+
+/**
+ * Start counting a field, whose tag has already been read.  Returns
+ * false if we can't allocate an entry for the field.
+ */
+
+static bool
+field_tracker_start(field_tracker_t *tracker,
+                    push_protobuf_tag_t tag,
+                    size_t bytes_remaining)
+{
+    push_protobuf_field_stat_t  *stat;
+
+    if (!push_protobuf_field_stats_add(tracker->stats,
+                                       PUSH_PROTOBUF_GET_TAG_NUMBER(tag),
+                                       &tracker->index))
+        return false;
+
+    stat = hwm_buffer_writable_mem(&tracker->stats->entries,
+                                   push_protobuf_field_stat_t) +
+        tracker->index;
+    stat->occurrences++;
+
+    tracker->bytes = encoded_tag_size(tag);
+    tracker->available = bytes_remaining;
+    return true;
+}
+
+
+static void
+field_tracker_success(void *user_data,
+                      void *result,
+                      const void *buf,
+                      size_t bytes_remaining)
+{
+    field_tracker_t  *tracker = (field_tracker_t *) user_data;
+    push_protobuf_field_stat_t  *stat =
+        hwm_buffer_writable_mem(&tracker->stats->entries,
+                                push_protobuf_field_stat_t) +
+        tracker->index;
+
+    stat->bytes +=
+        tracker->bytes + (tracker->available - bytes_remaining);
+
+    push_continuation_call(tracker->next_success,
+                           result,
+                           buf, bytes_remaining);
+}
+
+
+static void
+field_tracker_incomplete(void *user_data,
+                         push_continue_continuation_t *cont)
+{
+    field_tracker_t  *tracker = (field_tracker_t *) user_data;
+
+    /*
+     * The field callback has used up all of the data it was given.
+     */
+
+    tracker->bytes += tracker->available;
+    tracker->field_cont = cont;
+
+    push_continuation_call(tracker->next_incomplete,
+                           &tracker->cont);
+}
+
+
+static void
+field_tracker_continue(void *user_data,
+                       const void *buf,
+                       size_t bytes_remaining)
+{
+    field_tracker_t  *tracker = (field_tracker_t *) user_data;
+
+    tracker->available = bytes_remaining;
+
+    push_continuation_call(tracker->field_cont,
+                           buf, bytes_remaining);
+}
+
+
+static void
+field_tracker_error(void *user_data,
+                    push_error_code_t error_code,
+                    const char *error_message)
+{
+    field_tracker_t  *tracker = (field_tracker_t *) user_data;
+    push_protobuf_field_stat_t  *stat =
+        hwm_buffer_writable_mem(&tracker->stats->entries,
+                                push_protobuf_field_stat_t) +
+        tracker->index;
+
+    stat->failures++;
+
+    push_continuation_call(tracker->next_error,
+                           error_code,
+                           error_message);
+}
+
+
+static field_tracker_t *
+field_tracker_new(void *parent,
+                  push_protobuf_field_stats_t *stats)
+{
+    field_tracker_t  *tracker = push_talloc(parent, field_tracker_t);
+
+    if (tracker == NULL)
+        return NULL;
+
+    push_continuation_set(&tracker->success,
+                          field_tracker_success,
+                          tracker);
+    push_continuation_set(&tracker->incomplete,
+                          field_tracker_incomplete,
+                          tracker);
+    push_continuation_set(&tracker->error,
+                          field_tracker_error,
+                          tracker);
+    push_continuation_set(&tracker->cont,
+                          field_tracker_continue,
+                          tracker);
+
+    tracker->next_success = NULL;
+    tracker->next_incomplete = NULL;
+    tracker->next_error = NULL;
+    tracker->field_cont = NULL;
+    tracker->stats = stats;
+    tracker->index = 0;
+    tracker->bytes = 0;
+    tracker->available = 0;
+
+    return tracker;
+}
 
 
 /*-----------------------------------------------------------------------
@@ -48,10 +290,30 @@ typedef struct _dispatch
     push_protobuf_field_map_t  *field_map;
 
     /**
-     * A callback that can skip unknown length-prefixed fields.
+     * A callback that can skip unknown fields of any wire type.
+     */
+
+    push_callback_t  *skip_field;
+
+    /**
+     * The presence bitmap to update, or NULL if we're not tracking
+     * presence.
      */
 
-    push_callback_t  *skip_length_prefixed;
+    uint64_t  *presence;
+
+    /**
+     * The field statistics tracker, or NULL if we're not tracking
+     * statistics.
+     */
+
+    field_tracker_t  *tracker;
+
+    /**
+     * The parser whose field count limit we enforce.
+     */
+
+    push_parser_t  *parser;
 
 } dispatch_t;
 
@@ -62,11 +324,21 @@ dispatch_set_success(void *user_data,
 {
     dispatch_t  *dispatch = (dispatch_t *) user_data;
 
+    /*
+     * If we're tracking statistics, the field callbacks are already
+     * wired to the tracker, which passes everything on to us.
+     */
+
+    if (dispatch->tracker != NULL)
+    {
+        dispatch->tracker->next_success = success;
+        return;
+    }
+
     push_protobuf_field_map_set_success(dispatch->field_map,
                                         success);
 
-    push_continuation_call(&dispatch->skip_length_prefixed
-                           ->set_success,
+    push_continuation_call(&dispatch->skip_field->set_success,
                            success);
 }
 
@@ -77,11 +349,16 @@ dispatch_set_incomplete(void *user_data,
 {
     dispatch_t  *dispatch = (dispatch_t *) user_data;
 
+    if (dispatch->tracker != NULL)
+    {
+        dispatch->tracker->next_incomplete = incomplete;
+        return;
+    }
+
     push_protobuf_field_map_set_incomplete(dispatch->field_map,
                                            incomplete);
 
-    push_continuation_call(&dispatch->skip_length_prefixed
-                           ->set_incomplete,
+    push_continuation_call(&dispatch->skip_field->set_incomplete,
                            incomplete);
 }
 
@@ -94,11 +371,16 @@ dispatch_set_error(void *user_data,
 
     dispatch->callback.error = error;
 
+    if (dispatch->tracker != NULL)
+    {
+        dispatch->tracker->next_error = error;
+        return;
+    }
+
     push_protobuf_field_map_set_error(dispatch->field_map,
                                       error);
 
-    push_continuation_call(&dispatch->skip_length_prefixed
-                           ->set_error,
+    push_continuation_call(&dispatch->skip_field->set_error,
                            error);
 }
 
@@ -125,6 +407,18 @@ dispatch_activate(void *user_data,
 
     field_number = PUSH_PROTOBUF_GET_TAG_NUMBER(*field_tag);
 
+    if (!push_parser_count_field(dispatch->parser))
+    {
+        PUSH_DEBUG_MSG("%s: Too many fields.\n",
+                       push_talloc_get_name(dispatch));
+
+        push_continuation_call(dispatch->callback.error,
+                               PUSH_PARSE_ERROR,
+                               "Too many fields");
+
+        return;
+    }
+
     PUSH_DEBUG_MSG("%s: Dispatching field %"PRIu32".\n",
                    push_talloc_get_name(dispatch),
                    field_number);
@@ -139,33 +433,26 @@ dispatch_activate(void *user_data,
 
     if (field_callback == NULL)
     {
-        push_protobuf_tag_type_t  field_type =
-            PUSH_PROTOBUF_GET_TAG_TYPE(*field_tag);
-
-        switch (field_type)
-        {
-          case PUSH_PROTOBUF_TAG_TYPE_LENGTH_DELIMITED:
-            field_callback = dispatch->skip_length_prefixed;
-            break;
-
-          default:
-            /*
-             * TODO: Add skippers for the other field types.
-             */
-
-            PUSH_DEBUG_MSG("%s: No field callback for "
-                           "field %"PRIu32".\n",
-                           push_talloc_get_name(dispatch),
-                           field_number);
-
-            push_continuation_call(dispatch->callback.error,
-                                   PUSH_PARSE_ERROR,
-                                   "No callback for field");
-
-            return;
-        }
+        /*
+         * We don't know about this field, so skip over it, whatever
+         * its wire type.
+         */
+
+        PUSH_DEBUG_MSG("%s: No field callback for "
+                       "field %"PRIu32".  Skipping.\n",
+                       push_talloc_get_name(dispatch),
+                       field_number);
+
+        field_callback = dispatch->skip_field;
+    } else if (dispatch->presence != NULL) {
+        *dispatch->presence |= PUSH_PROTOBUF_PRESENCE_BIT(field_number);
     }
 
+    if ((dispatch->tracker != NULL) &&
+        !field_tracker_start(dispatch->tracker, *field_tag,
+                             bytes_remaining))
+        goto out_of_memory;
+
     /*
      * Found it!  Activate that callback we just found.  The field
      * callback is going to need to verify the wire type, so make sure
@@ -182,6 +469,10 @@ dispatch_activate(void *user_data,
 
     return;
 
+  out_of_memory:
+    push_continuation_call(dispatch->callback.error,
+                           PUSH_MEMORY_ERROR,
+                           "Cannot record field statistics");
 }
 
 
@@ -189,17 +480,18 @@ static push_callback_t *
 dispatch_new(const char *name,
              void *parent,
              push_parser_t *parser,
-             push_protobuf_field_map_t *field_map)
+             push_protobuf_field_map_t *field_map,
+             push_callback_t *skip_field,
+             field_tracker_t *tracker)
 {
     void  *context;
     dispatch_t  *dispatch = NULL;
-    push_callback_t  *skip_length_prefixed = NULL;
 
     /*
-     * If the field map is NULL, return NULL ourselves.
+     * If the field map or skipper is NULL, return NULL ourselves.
      */
 
-    if (field_map == NULL)
+    if ((field_map == NULL) || (skip_field == NULL))
         return NULL;
 
     /*
@@ -218,16 +510,6 @@ dispatch_new(const char *name,
 
     push_talloc_set_name_const(dispatch, name);
 
-    /*
-     * Then try to create the skipper callbacks.
-     */
-
-    skip_length_prefixed =
-        push_protobuf_skip_length_prefixed_new
-        (push_talloc_asprintf(context, "%s.skip-length-prefixed", name),
-         context, parser);
-    if (skip_length_prefixed == NULL) goto error;
-
     /*
      * Make the field map a child of the dispatch callback.
      */
@@ -239,7 +521,30 @@ dispatch_new(const char *name,
      */
 
     dispatch->field_map = field_map;
-    dispatch->skip_length_prefixed = skip_length_prefixed;
+    dispatch->skip_field = skip_field;
+    dispatch->presence = push_protobuf_field_map_get_presence(field_map);
+    dispatch->tracker = tracker;
+    dispatch->parser = parser;
+
+    /*
+     * If we're tracking statistics, wire the field callbacks to the
+     * tracker once and for all.
+     */
+
+    if (tracker != NULL)
+    {
+        push_protobuf_field_map_set_success(field_map, &tracker->success);
+        push_protobuf_field_map_set_incomplete(field_map,
+                                               &tracker->incomplete);
+        push_protobuf_field_map_set_error(field_map, &tracker->error);
+
+        push_continuation_call(&skip_field->set_success,
+                               &tracker->success);
+        push_continuation_call(&skip_field->set_incomplete,
+                               &tracker->incomplete);
+        push_continuation_call(&skip_field->set_error,
+                               &tracker->error);
+    }
 
     /*
      * Initialize the push_callback_t instance.
@@ -264,21 +569,243 @@ dispatch_new(const char *name,
 
 
 /*-----------------------------------------------------------------------
- * Top-level message callback
+ * Read field callback
  */
 
+/**
+ * A callback that reads a field tag and dispatches to the reader
+ * callback for that field.  Most tags are one or two bytes long, and
+ * for those we look up the field's value callback directly in the
+ * field map's tag table, which also verifies the wire type.  Tags
+ * that are longer, that span chunks, or that don't match the tag
+ * table are handed off to the general path, which reads the tag with
+ * a varint32 callback and then activates the dispatch callback.
+ */
 
-push_callback_t *
-push_protobuf_message_new(const char *name,
-                          void *parent,
-                          push_parser_t *parser,
-                          push_protobuf_field_map_t *field_map)
+typedef struct _read_field
+{
+    /**
+     * The push_callback_t superclass for this callback.
+     */
+
+    push_callback_t  callback;
+
+    /**
+     * A mapping of field numbers to the callback that reads the
+     * corresponding field.
+     */
+
+    push_protobuf_field_map_t  *field_map;
+
+    /**
+     * A callback that can skip unknown fields of any wire type, or
+     * record them, if the field map is preserving unknown fields.
+     */
+
+    push_callback_t  *skip_field;
+
+    /**
+     * The general path: a composition of a tag reader and the
+     * dispatch callback.
+     */
+
+    push_callback_t  *read_tag;
+
+    /**
+     * The presence bitmap to update, or NULL if we're not tracking
+     * presence.
+     */
+
+    uint64_t  *presence;
+
+    /**
+     * The field statistics tracker, or NULL if we're not tracking
+     * statistics.
+     */
+
+    field_tracker_t  *tracker;
+
+    /**
+     * The parser whose field count limit we enforce.
+     */
+
+    push_parser_t  *parser;
+
+    /**
+     * The tag of an unknown field that we're skipping.
+     */
+
+    push_protobuf_tag_t  tag;
+
+} read_field_t;
+
+
+static void
+read_field_set_success(void *user_data,
+                       push_success_continuation_t *success)
+{
+    read_field_t  *read_field = (read_field_t *) user_data;
+
+    push_continuation_call(&read_field->read_tag->set_success,
+                           success);
+}
+
+
+static void
+read_field_set_incomplete(void *user_data,
+                          push_incomplete_continuation_t *incomplete)
+{
+    read_field_t  *read_field = (read_field_t *) user_data;
+
+    push_continuation_call(&read_field->read_tag->set_incomplete,
+                           incomplete);
+}
+
+
+static void
+read_field_set_error(void *user_data,
+                     push_error_continuation_t *error)
+{
+    read_field_t  *read_field = (read_field_t *) user_data;
+
+    read_field->callback.error = error;
+
+    push_continuation_call(&read_field->read_tag->set_error,
+                           error);
+}
+
+
+static void
+read_field_activate(void *user_data,
+                    void *result,
+                    const void *buf,
+                    size_t bytes_remaining)
+{
+    read_field_t  *read_field = (read_field_t *) user_data;
+    const uint8_t  *bbuf = (const uint8_t *) buf;
+    push_protobuf_tag_t  tag;
+    size_t  tag_size;
+    push_callback_t  *value_callback;
+
+    /*
+     * Decode a one- or two-byte tag if we've got one.
+     */
+
+    if ((bytes_remaining >= 1) && (bbuf[0] < 0x80))
+    {
+        tag = bbuf[0];
+        tag_size = 1;
+    } else if ((bytes_remaining >= 2) && (bbuf[1] < 0x80)) {
+        tag = (bbuf[0] & 0x7f) | (((push_protobuf_tag_t) bbuf[1]) << 7);
+        tag_size = 2;
+    } else {
+        goto general_path;
+    }
+
+    value_callback =
+        push_protobuf_field_map_get_tag_callback(read_field->field_map,
+                                                 tag);
+
+    if (value_callback != NULL)
+    {
+        if (!push_parser_count_field(read_field->parser))
+            goto too_many_fields;
+
+        PUSH_DEBUG_MSG("%s: Tag 0x%04"PRIx32" matches callback %p.\n",
+                       push_talloc_get_name(read_field),
+                       tag, value_callback);
+
+        if (read_field->presence != NULL)
+        {
+            *read_field->presence |=
+                PUSH_PROTOBUF_PRESENCE_BIT
+                (PUSH_PROTOBUF_GET_TAG_NUMBER(tag));
+        }
+
+        if ((read_field->tracker != NULL) &&
+            !field_tracker_start(read_field->tracker, tag,
+                                 bytes_remaining - tag_size))
+            goto out_of_memory;
+
+        push_continuation_call(&value_callback->activate,
+                               NULL,
+                               bbuf + tag_size,
+                               bytes_remaining - tag_size);
+
+        return;
+    }
+
+    if (push_protobuf_field_map_get_field
+        (read_field->field_map, PUSH_PROTOBUF_GET_TAG_NUMBER(tag)) == NULL)
+    {
+        /*
+         * We don't know about this field, so skip over it.
+         */
+
+        if (!push_parser_count_field(read_field->parser))
+            goto too_many_fields;
+
+        PUSH_DEBUG_MSG("%s: No field callback for tag 0x%04"PRIx32".  "
+                       "Skipping.\n",
+                       push_talloc_get_name(read_field),
+                       tag);
+
+        if ((read_field->tracker != NULL) &&
+            !field_tracker_start(read_field->tracker, tag,
+                                 bytes_remaining - tag_size))
+            goto out_of_memory;
+
+        read_field->tag = tag;
+        push_continuation_call(&read_field->skip_field->activate,
+                               &read_field->tag,
+                               bbuf + tag_size,
+                               bytes_remaining - tag_size);
+
+        return;
+    }
+
+  general_path:
+    /*
+     * Otherwise, let the general path read the tag again from the
+     * start.  It will report a wire type mismatch if there is one.
+     */
+
+    push_continuation_call(&read_field->read_tag->activate,
+                           result,
+                           buf, bytes_remaining);
+    return;
+
+  too_many_fields:
+    PUSH_DEBUG_MSG("%s: Too many fields.\n",
+                   push_talloc_get_name(read_field));
+
+    push_continuation_call(read_field->callback.error,
+                           PUSH_PARSE_ERROR,
+                           "Too many fields");
+    return;
+
+  out_of_memory:
+    push_continuation_call(read_field->callback.error,
+                           PUSH_MEMORY_ERROR,
+                           "Cannot record field statistics");
+}
+
+
+static push_callback_t *
+read_field_new(const char *name,
+               void *parent,
+               push_parser_t *parser,
+               push_protobuf_field_map_t *field_map)
 {
     void  *context;
-    push_callback_t  *read_field_tag;
+    read_field_t  *read_field;
+    push_protobuf_unknown_fields_t  *unknown_fields;
+    push_callback_t  *skip_field;
+    push_callback_t  *read_tag;
     push_callback_t  *dispatch;
     push_callback_t  *compose;
-    push_callback_t  *fold;
+    push_protobuf_field_stats_t  *stats;
+    field_tracker_t  *tracker = NULL;
 
     /*
      * If the field map is NULL, return NULL ourselves.
@@ -298,21 +825,232 @@ push_protobuf_message_new(const char *name,
      * Create the callbacks.
      */
 
-    if (name == NULL) name = "message";
+    read_field = push_talloc(context, read_field_t);
+    if (read_field == NULL) goto error;
+
+    push_talloc_set_name_const(read_field, name);
+
+    unknown_fields = push_protobuf_field_map_get_unknown_fields(field_map);
+
+    if (unknown_fields == NULL)
+    {
+        skip_field = push_protobuf_skip_field_new
+            (push_talloc_asprintf(context, "%s.skip-field", name),
+             context, parser);
+    } else {
+        skip_field = push_protobuf_unknown_field_new
+            (push_talloc_asprintf(context, "%s.unknown-field", name),
+             context, parser, unknown_fields);
+    }
+
+    stats = push_protobuf_field_map_get_stats(field_map);
+    if (stats != NULL)
+    {
+        tracker = field_tracker_new(context, stats);
+        if (tracker == NULL) goto error;
+    }
 
-    read_field_tag = push_protobuf_varint32_new
+    read_tag = push_protobuf_varint32_new
         (push_talloc_asprintf(context, "%s.tag", name),
          context, parser);
     dispatch = dispatch_new
         (push_talloc_asprintf(context, "%s.dispatch", name),
-         context, parser, field_map);
+         context, parser, field_map, skip_field, tracker);
     compose = push_compose_new
         (push_talloc_asprintf(context, "%s.compose", name),
          context, parser,
-         read_field_tag, dispatch);
+         read_tag, dispatch);
+
+    /*
+     * Because of NULL propagation, we only have to check the last
+     * result to see if everything was created okay.
+     */
+
+    if (compose == NULL) goto error;
+
+    /*
+     * Fill in the data items.
+     */
+
+    read_field->field_map = field_map;
+    read_field->skip_field = skip_field;
+    read_field->read_tag = compose;
+    read_field->presence = push_protobuf_field_map_get_presence(field_map);
+    read_field->tracker = tracker;
+    read_field->parser = parser;
+
+    /*
+     * Initialize the push_callback_t instance.
+     */
+
+    push_callback_init(&read_field->callback, parser, read_field,
+                       read_field_activate,
+                       read_field_set_success,
+                       read_field_set_incomplete,
+                       read_field_set_error);
+
+    return &read_field->callback;
+
+  error:
+    /*
+     * Before returning, free any objects we created before the error.
+     */
+
+    push_talloc_free(context);
+    return NULL;
+}
+
+
+/*-----------------------------------------------------------------------
+ * Presence callbacks
+ */
+
+/**
+ * Clear the presence bitmap at the start of each message.  The input
+ * is passed through unchanged.
+ */
+
+static bool
+clear_presence(uint64_t *presence, void *input, void **output)
+{
+    *presence = 0;
+    *output = input;
+    return true;
+}
+
+push_define_pure_callback(clear_presence_new, clear_presence,
+                          "clear-presence", void, void, uint64_t);
+
+
+/**
+ * A callback that runs at the end of each message, and fails with
+ * PUSH_PARSE_ERROR if any of the required fields are missing from
+ * the presence bitmap.  Otherwise it passes its input through
+ * unchanged.
+ */
+
+typedef struct _check_presence
+{
+    /**
+     * The push_callback_t superclass for this callback.
+     */
+
+    push_callback_t  callback;
+
+    /**
+     * The presence bitmap to check.
+     */
+
+    uint64_t  *presence;
+
+    /**
+     * The presence bits of the required fields.
+     */
+
+    uint64_t  required;
+
+} check_presence_t;
+
+
+static void
+check_presence_activate(void *user_data,
+                        void *result,
+                        const void *buf,
+                        size_t bytes_remaining)
+{
+    check_presence_t  *check = (check_presence_t *) user_data;
+
+    if ((*check->presence & check->required) != check->required)
+    {
+        PUSH_DEBUG_MSG("%s: Missing required fields "
+                       "(have 0x%016"PRIx64", need 0x%016"PRIx64").\n",
+                       push_talloc_get_name(check),
+                       *check->presence, check->required);
+
+        push_continuation_call(check->callback.error,
+                               PUSH_PARSE_ERROR,
+                               "Missing required field");
+
+        return;
+    }
+
+    push_continuation_call(check->callback.success,
+                           result,
+                           buf, bytes_remaining);
+}
+
+
+static push_callback_t *
+check_presence_new(const char *name,
+                   void *parent,
+                   push_parser_t *parser,
+                   uint64_t *presence,
+                   uint64_t required)
+{
+    check_presence_t  *check = push_talloc(parent, check_presence_t);
+
+    if (check == NULL)
+        return NULL;
+
+    if (name == NULL) name = "check-presence";
+    push_talloc_set_name_const(check, name);
+
+    check->presence = presence;
+    check->required = required;
+
+    push_callback_init(&check->callback, parser, check,
+                       check_presence_activate,
+                       NULL, NULL, NULL);
+
+    return &check->callback;
+}
+
+
+/*-----------------------------------------------------------------------
+ * Top-level message callback
+ */
+
+
+push_callback_t *
+push_protobuf_message_new(const char *name,
+                          void *parent,
+                          push_parser_t *parser,
+                          push_protobuf_field_map_t *field_map)
+{
+    void  *context;
+    uint64_t  *presence;
+    push_callback_t  *read_field;
+    push_callback_t  *fold;
+    push_callback_t  *clear;
+    push_callback_t  *check;
+    push_callback_t  *compose;
+
+    /*
+     * If the field map is NULL, return NULL ourselves.
+     */
+
+    if (field_map == NULL)
+        return NULL;
+
+    /*
+     * Create a memory context for the objects we're about to create.
+     */
+
+    context = push_talloc_new(parent);
+    if (context == NULL) return NULL;
+
+    /*
+     * Create the callbacks.
+     */
+
+    if (name == NULL) name = "message";
+
+    read_field = read_field_new
+        (push_talloc_asprintf(context, "%s.field", name),
+         context, parser, field_map);
     fold = push_fold_new
         (push_talloc_asprintf(context, "%s.fold", name),
-         context, parser, compose);
+         context, parser, read_field);
 
     /*
      * Because of NULL propagation, we only have to check the last
@@ -320,7 +1058,32 @@ push_protobuf_message_new(const char *name,
      */
 
     if (fold == NULL) goto error;
-    return fold;
+
+    /*
+     * If we're tracking presence, clear the bitmap before the first
+     * field, and check it for required fields after the last.
+     */
+
+    presence = push_protobuf_field_map_get_presence(field_map);
+    if (presence == NULL)
+        return fold;
+
+    clear = clear_presence_new
+        (push_talloc_asprintf(context, "%s.clear-presence", name),
+         context, parser, presence);
+    check = check_presence_new
+        (push_talloc_asprintf(context, "%s.check-presence", name),
+         context, parser, presence,
+         push_protobuf_field_map_get_required(field_map));
+    compose = push_compose_new
+        (push_talloc_asprintf(context, "%s.compose", name),
+         context, parser, clear, fold);
+    compose = push_compose_new
+        (push_talloc_asprintf(context, "%s.compose-check", name),
+         context, parser, compose, check);
+
+    if (compose == NULL) goto error;
+    return compose;
 
   error:
     /*
@@ -0,0 +1,938 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2010, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the LICENSE.txt file in this distribution for license
+ * details.
+ * ----------------------------------------------------------------------
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <hwm-buffer.h>
+
+#include <push/basics.h>
+#include <push/combinators.h>
+#include <push/pure.h>
+#include <push/talloc.h>
+
+#include <push/protobuf/basics.h>
+#include <push/protobuf/field-map.h>
+#include <push/protobuf/primitives.h>
+#include <push/protobuf/varint.h>
+
+
+/**
+ * The different ways that we can decode the elements of a packed
+ * field.
+ */
+
+typedef enum _packed_kind
+{
+    /**
+     * Varints, truncated to 32 bits.  Used for uint32 and int32.
+     */
+
+    PACKED_VARINT32,
+
+    /**
+     * Varints, kept as 64 bits.  Used for uint64 and int64.
+     */
+
+    PACKED_VARINT64,
+
+    /**
+     * ZigZag-encoded varints, truncated to 32 bits.  Used for sint32.
+     */
+
+    PACKED_ZIGZAG32,
+
+    /**
+     * ZigZag-encoded varints, kept as 64 bits.  Used for sint64.
+     */
+
+    PACKED_ZIGZAG64,
+
+    /**
+     * Little-endian 32-bit values.  Used for fixed32, sfixed32, and
+     * float.
+     */
+
+    PACKED_FIXED32,
+
+    /**
+     * Little-endian 64-bit values.  Used for fixed64, sfixed64, and
+     * double.
+     */
+
+    PACKED_FIXED64
+
+} packed_kind_t;
+
+
+/**
+ * The number of decoded varints that we store into the destination
+ * array at a time.
+ */
+
+#define PACKED_BATCH_SIZE  64
+
+
+/**
+ * The user data struct for a packed callback.
+ */
+
+typedef struct _packed
+{
+    /**
+     * The push_callback_t superclass for this callback.
+     */
+
+    push_callback_t  callback;
+
+    /**
+     * The continue continuation for this callback.
+     */
+
+    push_continue_continuation_t  cont;
+
+    /**
+     * How to decode each element.
+     */
+
+    packed_kind_t  kind;
+
+    /**
+     * The size of each decoded element in the destination array.
+     */
+
+    size_t  element_size;
+
+    /**
+     * The array that we append the decoded elements to.  This is
+     * also our result.
+     */
+
+    hwm_buffer_t  *dest;
+
+    /**
+     * The number of bytes left in the packed field.
+     */
+
+    size_t  bytes_left;
+
+    /**
+     * The bytes of an element that straddles two data chunks.
+     */
+
+    uint8_t  partial[PUSH_PROTOBUF_MAX_VARINT_LENGTH];
+
+    /**
+     * The number of bytes in the partial buffer.
+     */
+
+    size_t  partial_size;
+
+} packed_t;
+
+
+static bool
+is_varint(packed_t *packed)
+{
+    return (packed->kind != PACKED_FIXED32) &&
+        (packed->kind != PACKED_FIXED64);
+}
+
+
+/**
+ * Make room for count more elements at the end of the destination
+ * array, returning a pointer to the new space.  The caller must call
+ * packed_commit once the elements are filled in.
+ */
+
+static void *
+packed_reserve(packed_t *packed, size_t count)
+{
+    size_t  new_size =
+        packed->dest->current_size + count * packed->element_size;
+
+    if (!hwm_buffer_ensure_size(packed->dest, new_size))
+        return NULL;
+
+    return hwm_buffer_writable_mem(packed->dest, uint8_t) +
+        packed->dest->current_size;
+}
+
+
+static void
+packed_commit(packed_t *packed, size_t count)
+{
+    packed->dest->current_size += count * packed->element_size;
+}
+
+
+/**
+ * Convert some decoded varints into the destination element type and
+ * append them to the destination array.
+ */
+
+static bool
+packed_store_varints(packed_t *packed,
+                     const uint64_t *values,
+                     size_t count)
+{
+    void  *out;
+    size_t  i;
+
+    if (count == 0)
+        return true;
+
+    out = packed_reserve(packed, count);
+    if (out == NULL)
+        return false;
+
+    switch (packed->kind)
+    {
+      case PACKED_VARINT32:
+        for (i = 0; i < count; i++)
+            ((uint32_t *) out)[i] = values[i];
+        break;
+
+      case PACKED_VARINT64:
+        memcpy(out, values, count * sizeof(uint64_t));
+        break;
+
+      case PACKED_ZIGZAG32:
+        for (i = 0; i < count; i++)
+        {
+            uint32_t  value = values[i];
+            ((int32_t *) out)[i] = PUSH_PROTOBUF_ZIGZAG_DECODE32(value);
+        }
+        break;
+
+      case PACKED_ZIGZAG64:
+        for (i = 0; i < count; i++)
+            ((int64_t *) out)[i] = PUSH_PROTOBUF_ZIGZAG_DECODE64(values[i]);
+        break;
+
+      default:
+        return false;
+    }
+
+    packed_commit(packed, count);
+    return true;
+}
+
+
+/**
+ * Append some little-endian fixed-width elements to the destination
+ * array.  On little-endian hosts, this is a single memcpy.
+ */
+
+static bool
+packed_store_fixed(packed_t *packed,
+                   const uint8_t *buf,
+                   size_t count)
+{
+    void  *out;
+
+    if (count == 0)
+        return true;
+
+    out = packed_reserve(packed, count);
+    if (out == NULL)
+        return false;
+
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+    {
+        size_t  i;
+
+        if (packed->kind == PACKED_FIXED32)
+        {
+            for (i = 0; i < count; i++)
+                ((uint32_t *) out)[i] =
+                    push_protobuf_load_le32(buf + 4 * i);
+        } else {
+            for (i = 0; i < count; i++)
+                ((uint64_t *) out)[i] =
+                    push_protobuf_load_le64(buf + 8 * i);
+        }
+    }
+#else
+    memcpy(out, buf, count * packed->element_size);
+#endif
+
+    packed_commit(packed, count);
+    return true;
+}
+
+
+/**
+ * Add bytes to the partial element that straddles a chunk boundary,
+ * storing the element once it's complete.  The number of bytes
+ * consumed is stored into *used.  Returns PUSH_PARSE_ERROR if the
+ * element is invalid, and PUSH_MEMORY_ERROR if it can't be stored.
+ */
+
+static push_error_code_t
+packed_finish_partial(packed_t *packed,
+                      const uint8_t *buf,
+                      size_t size,
+                      size_t *used)
+{
+    *used = 0;
+
+    if (is_varint(packed))
+    {
+        while (*used < size)
+        {
+            uint8_t  b = buf[(*used)++];
+
+            packed->partial[packed->partial_size++] = b;
+
+            if (b < 0x80)
+            {
+                uint64_t  value = 0;
+                size_t  i;
+
+                for (i = 0; i < packed->partial_size; i++)
+                    value |= ((uint64_t) (packed->partial[i] & 0x7f))
+                        << (7 * i);
+
+                packed->partial_size = 0;
+                if (!packed_store_varints(packed, &value, 1))
+                    return PUSH_MEMORY_ERROR;
+
+                return PUSH_SUCCESS;
+            }
+
+            if (packed->partial_size == PUSH_PROTOBUF_MAX_VARINT_LENGTH)
+                return PUSH_PARSE_ERROR;
+        }
+
+        return PUSH_SUCCESS;
+
+    } else {
+        *used = packed->element_size - packed->partial_size;
+        if (*used > size)
+            *used = size;
+
+        memcpy(packed->partial + packed->partial_size, buf, *used);
+        packed->partial_size += *used;
+
+        if (packed->partial_size == packed->element_size)
+        {
+            packed->partial_size = 0;
+            if (!packed_store_fixed(packed, packed->partial, 1))
+                return PUSH_MEMORY_ERROR;
+        }
+
+        return PUSH_SUCCESS;
+    }
+}
+
+
+/**
+ * Decode a varint a byte at a time, from a buffer that's too short
+ * for the word-at-a-time kernel.  Returns the number of bytes in the
+ * varint, or 0 if the buffer ends before the varint does.
+ */
+
+static size_t
+packed_decode_short(const uint8_t *buf,
+                    size_t size,
+                    uint64_t *value)
+{
+    uint64_t  result = 0;
+    size_t  i;
+
+    for (i = 0; i < size; i++)
+    {
+        result |= ((uint64_t) (buf[i] & 0x7f)) << (7 * i);
+        if (buf[i] < 0x80)
+        {
+            *value = result;
+            return i + 1;
+        }
+    }
+
+    return 0;
+}
+
+
+/**
+ * Decode as many complete elements as we can from buf, stashing any
+ * trailing partial element away for the next chunk.  Returns
+ * PUSH_PARSE_ERROR if the data is invalid, and PUSH_MEMORY_ERROR if
+ * it can't be stored.
+ */
+
+static push_error_code_t
+packed_decode_bulk(packed_t *packed,
+                   const uint8_t *buf,
+                   size_t size)
+{
+    if (is_varint(packed))
+    {
+        uint64_t  values[PACKED_BATCH_SIZE];
+        size_t  count = 0;
+
+        while (size > 0)
+        {
+            size_t  length;
+
+            /*
+             * Use the word-at-a-time kernel whenever a maximum-length
+             * varint fits in what's left.
+             */
+
+            if (size >= PUSH_PROTOBUF_MAX_VARINT_LENGTH)
+            {
+                length = push_protobuf_varint_decode(buf, &values[count]);
+                if (length == 0)
+                    return PUSH_PARSE_ERROR;
+            } else {
+                length = packed_decode_short(buf, size, &values[count]);
+                if (length == 0)
+                    break;
+            }
+
+            buf += length;
+            size -= length;
+
+            if (++count == PACKED_BATCH_SIZE)
+            {
+                if (!packed_store_varints(packed, values, count))
+                    return PUSH_MEMORY_ERROR;
+
+                count = 0;
+            }
+        }
+
+        if (!packed_store_varints(packed, values, count))
+            return PUSH_MEMORY_ERROR;
+
+    } else {
+        size_t  count = size / packed->element_size;
+
+        if (!packed_store_fixed(packed, buf, count))
+            return PUSH_MEMORY_ERROR;
+
+        buf += count * packed->element_size;
+        size -= count * packed->element_size;
+    }
+
+    /*
+     * Anything left over is the beginning of an element that
+     * continues in the next chunk.
+     */
+
+    memcpy(packed->partial, buf, size);
+    packed->partial_size = size;
+    return PUSH_SUCCESS;
+}
+
+
+static void
+packed_continue(void *user_data,
+                const void *buf,
+                size_t bytes_remaining)
+{
+    packed_t  *packed = (packed_t *) user_data;
+    const uint8_t  *ibuf = (const uint8_t *) buf;
+    size_t  available;
+    size_t  used;
+    push_error_code_t  result;
+
+    if (bytes_remaining == 0)
+    {
+        PUSH_DEBUG_MSG("%s: EOF found before end of packed field.  "
+                       "Parse fails.\n",
+                       push_talloc_get_name(packed));
+
+        push_continuation_call(packed->callback.error,
+                               PUSH_PARSE_ERROR,
+                               "EOF found before end of packed field");
+
+        return;
+    }
+
+    /*
+     * Only look at the bytes that belong to this field.
+     */
+
+    available =
+        (bytes_remaining < packed->bytes_left)?
+        bytes_remaining:
+        packed->bytes_left;
+
+    PUSH_DEBUG_MSG("%s: Decoding %zu bytes.\n",
+                   push_talloc_get_name(packed),
+                   available);
+
+    /*
+     * First finish off any element left over from the previous chunk,
+     * then decode the rest of the chunk in bulk.
+     */
+
+    used = 0;
+    if (packed->partial_size > 0)
+    {
+        result = packed_finish_partial(packed, ibuf, available, &used);
+        if (result != PUSH_SUCCESS)
+            goto error;
+    }
+
+    if (packed->partial_size == 0)
+    {
+        result = packed_decode_bulk(packed, ibuf + used, available - used);
+        if (result != PUSH_SUCCESS)
+            goto error;
+    }
+
+    packed->bytes_left -= available;
+    buf += available;
+    bytes_remaining -= available;
+
+    if (packed->bytes_left > 0)
+    {
+        push_continuation_call(packed->callback.incomplete,
+                               &packed->cont);
+
+        return;
+    }
+
+    /*
+     * We've reached the end of the field.  It had better not end in
+     * the middle of an element.
+     */
+
+    if (packed->partial_size > 0)
+    {
+        PUSH_DEBUG_MSG("%s: Field ends in the middle of an element.\n",
+                       push_talloc_get_name(packed));
+
+        push_continuation_call(packed->callback.error,
+                               PUSH_PARSE_ERROR,
+                               "Packed field ends in the middle "
+                               "of an element");
+
+        return;
+    }
+
+    PUSH_DEBUG_MSG("%s: Finished packed field.\n",
+                   push_talloc_get_name(packed));
+
+    push_continuation_call(packed->callback.success,
+                           packed->dest,
+                           buf, bytes_remaining);
+
+    return;
+
+  error:
+    if (result == PUSH_MEMORY_ERROR)
+    {
+        PUSH_DEBUG_MSG("%s: Cannot grow destination array.\n",
+                       push_talloc_get_name(packed));
+
+        push_continuation_call(packed->callback.error,
+                               PUSH_MEMORY_ERROR,
+                               "Cannot store packed field");
+
+        return;
+    }
+
+    PUSH_DEBUG_MSG("%s: Invalid element.\n",
+                   push_talloc_get_name(packed));
+
+    push_continuation_call(packed->callback.error,
+                           PUSH_PARSE_ERROR,
+                           "Cannot decode packed field");
+}
+
+
+static void
+packed_activate(void *user_data,
+                void *result,
+                const void *buf,
+                size_t bytes_remaining)
+{
+    packed_t  *packed = (packed_t *) user_data;
+    size_t  *input_size = (size_t *) result;
+
+    PUSH_DEBUG_MSG("%s: Activating.  Packed field has %zu bytes.\n",
+                   push_talloc_get_name(packed),
+                   *input_size);
+
+    packed->bytes_left = *input_size;
+    packed->partial_size = 0;
+
+    if (packed->bytes_left == 0)
+    {
+        /*
+         * An empty packed field is perfectly valid; there's nothing
+         * to append.
+         */
+
+        push_continuation_call(packed->callback.success,
+                               packed->dest,
+                               buf, bytes_remaining);
+
+        return;
+    }
+
+    if (bytes_remaining == 0)
+    {
+        /*
+         * If we don't get any data when we're activated, return an
+         * incomplete and wait for some data.
+         */
+
+        push_continuation_call(packed->callback.incomplete,
+                               &packed->cont);
+
+        return;
+
+    } else {
+        /*
+         * Otherwise let the continue continuation go ahead and
+         * process this chunk of data.
+         */
+
+        packed_continue(user_data, buf, bytes_remaining);
+        return;
+    }
+}
+
+
+static packed_t *
+packed_new(const char *name,
+           void *parent,
+           push_parser_t *parser,
+           packed_kind_t kind,
+           size_t element_size,
+           hwm_buffer_t *dest)
+{
+    packed_t  *packed;
+
+    /*
+     * If the destination array is NULL, return NULL ourselves.
+     */
+
+    if (dest == NULL)
+        return NULL;
+
+    packed = push_talloc(parent, packed_t);
+    if (packed == NULL)
+        return NULL;
+
+    /*
+     * Fill in the data items.
+     */
+
+    packed->kind = kind;
+    packed->element_size = element_size;
+    packed->dest = dest;
+
+    /*
+     * Initialize the push_callback_t instance.
+     */
+
+    if (name == NULL) name = "packed";
+    push_talloc_set_name_const(packed, name);
+
+    push_callback_init(&packed->callback, parser, packed,
+                       packed_activate,
+                       NULL, NULL, NULL);
+
+    /*
+     * Fill in the continuation objects for the continuations that we
+     * implement.
+     */
+
+    push_continuation_set(&packed->cont,
+                          packed_continue,
+                          packed);
+
+    return packed;
+}
+
+
+/*-----------------------------------------------------------------------
+ * Unpacked elements
+ */
+
+/**
+ * Append a single element that was encoded with its own tag.  Varint
+ * elements are read as 64-bit varints and converted like the elements
+ * of a packed run.
+ */
+
+static bool
+store_element32(packed_t *packed, uint32_t *input, hwm_buffer_t **output)
+{
+    void  *out = packed_reserve(packed, 1);
+
+    if (out == NULL)
+        return false;
+
+    memcpy(out, input, sizeof(uint32_t));
+    packed_commit(packed, 1);
+    *output = packed->dest;
+    return true;
+}
+
+push_define_pure_callback_with_error
+    (store_element32_new, store_element32, "store",
+     uint32_t, hwm_buffer_t, packed_t,
+     PUSH_MEMORY_ERROR, "Cannot store packed field");
+
+
+static bool
+store_element64(packed_t *packed, uint64_t *input, hwm_buffer_t **output)
+{
+    if (is_varint(packed))
+    {
+        if (!packed_store_varints(packed, input, 1))
+            return false;
+    } else {
+        void  *out = packed_reserve(packed, 1);
+
+        if (out == NULL)
+            return false;
+
+        memcpy(out, input, sizeof(uint64_t));
+        packed_commit(packed, 1);
+    }
+
+    *output = packed->dest;
+    return true;
+}
+
+push_define_pure_callback_with_error
+    (store_element64_new, store_element64, "store",
+     uint64_t, hwm_buffer_t, packed_t,
+     PUSH_MEMORY_ERROR, "Cannot store packed field");
+
+
+/**
+ * Create a callback that reads a single unpacked element, and
+ * appends it to the same array as the packed callback.
+ */
+
+static push_callback_t *
+element_new(const char *name,
+            void *parent,
+            push_parser_t *parser,
+            packed_t *packed)
+{
+    void  *context;
+    push_callback_t  *value;
+    push_callback_t  *store;
+    push_callback_t  *element;
+
+    /*
+     * If the packed callback is NULL, return NULL ourselves.
+     */
+
+    if (packed == NULL)
+        return NULL;
+
+    /*
+     * Create a memory context for the objects we're about to create.
+     */
+
+    context = push_talloc_new(parent);
+    if (context == NULL) return NULL;
+
+    switch (packed->kind)
+    {
+      case PACKED_FIXED32:
+        value = push_protobuf_fixed32_new
+            (push_talloc_asprintf(context, "%s.fixed32", name),
+             context, parser);
+        store = store_element32_new
+            (push_talloc_asprintf(context, "%s.store", name),
+             context, parser, packed);
+        break;
+
+      case PACKED_FIXED64:
+        value = push_protobuf_fixed64_new
+            (push_talloc_asprintf(context, "%s.fixed64", name),
+             context, parser);
+        store = store_element64_new
+            (push_talloc_asprintf(context, "%s.store", name),
+             context, parser, packed);
+        break;
+
+      default:
+        value = push_protobuf_varint64_new
+            (push_talloc_asprintf(context, "%s.varint64", name),
+             context, parser);
+        store = store_element64_new
+            (push_talloc_asprintf(context, "%s.store", name),
+             context, parser, packed);
+        break;
+    }
+
+    element = push_compose_new
+        (push_talloc_asprintf(context, "%s.compose", name),
+         context, parser, value, store);
+
+    /*
+     * Because of NULL propagation, we only have to check the last
+     * result to see if everything was created okay.
+     */
+
+    if (element == NULL) goto error;
+    return element;
+
+  error:
+    /*
+     * Before returning, free any objects we created before the error.
+     */
+
+    push_talloc_free(context);
+    return NULL;
+}
+
+
+/*-----------------------------------------------------------------------
+ * Packed fields
+ */
+
+/**
+ * Add a repeated scalar field to a field map.  We accept both
+ * encodings: each element with its own tag, or a packed run.
+ */
+
+static bool
+add_packed(const char *message_name,
+           const char *field_name,
+           void *parent,
+           push_parser_t *parser,
+           push_protobuf_field_map_t *field_map,
+           push_protobuf_tag_number_t field_number,
+           packed_kind_t kind,
+           size_t element_size,
+           hwm_buffer_t *dest)
+{
+    void  *context;
+    const char  *full_field_name;
+    push_protobuf_tag_type_t  element_tag_type;
+    push_callback_t  *size;
+    packed_t  *packed;
+    push_callback_t  *run;
+    push_callback_t  *element;
+
+    /*
+     * If the field map is NULL, return false.
+     */
+
+    if (field_map == NULL)
+        return false;
+
+    /*
+     * Create a memory context for the objects we're about to create.
+     */
+
+    context = push_talloc_new(parent);
+    if (context == NULL) return false;
+
+    /*
+     * Create the callbacks.
+     */
+
+    if (message_name == NULL) message_name = "message";
+    if (field_name == NULL) field_name = ".packed";
+
+    full_field_name =
+        push_talloc_asprintf(context, "%s.%s",
+                             message_name, field_name);
+
+    size = push_protobuf_varint_size_new
+        (push_talloc_asprintf(context, "%s.size", full_field_name),
+         context, parser);
+    packed = packed_new
+        (push_talloc_asprintf(context, "%s.packed", full_field_name),
+         context, parser, kind, element_size, dest);
+    run = push_compose_new
+        (push_talloc_asprintf(context, "%s.compose", full_field_name),
+         context, parser, size,
+         (packed == NULL)? NULL: &packed->callback);
+    element = element_new
+        (push_talloc_asprintf(context, "%s.element", full_field_name),
+         context, parser, packed);
+
+    if ((run == NULL) || (element == NULL)) goto error;
+
+    switch (kind)
+    {
+      case PACKED_FIXED32:
+        element_tag_type = PUSH_PROTOBUF_TAG_TYPE_FIXED32;
+        break;
+
+      case PACKED_FIXED64:
+        element_tag_type = PUSH_PROTOBUF_TAG_TYPE_FIXED64;
+        break;
+
+      default:
+        element_tag_type = PUSH_PROTOBUF_TAG_TYPE_VARINT;
+        break;
+    }
+
+    /*
+     * Try to add the new field.  If we can't, free the callbacks
+     * before returning.
+     */
+
+    if (!push_protobuf_field_map_add_packable_field
+        (full_field_name, parser, field_map, field_number,
+         element_tag_type, element, run))
+    {
+        goto error;
+    }
+
+    return true;
+
+  error:
+    /*
+     * Before returning, free any objects we created before the error.
+     */
+
+    push_talloc_free(context);
+    return false;
+}
+
+
+#define ADD_PACKED(ADD, KIND, ELEMENT_T)                                \
+bool                                                                    \
+ADD(const char *message_name,                                           \
+    const char *field_name,                                             \
+    void *parent,                                                       \
+    push_parser_t *parser,                                              \
+    push_protobuf_field_map_t *field_map,                               \
+    push_protobuf_tag_number_t field_number,                            \
+    hwm_buffer_t *dest)                                                 \
+{                                                                       \
+    return add_packed(message_name, field_name, parent, parser,         \
+                      field_map, field_number,                          \
+                      KIND, sizeof(ELEMENT_T), dest);                   \
+}
+
+
+ADD_PACKED(push_protobuf_add_packed_uint32, PACKED_VARINT32, uint32_t)
+ADD_PACKED(push_protobuf_add_packed_uint64, PACKED_VARINT64, uint64_t)
+ADD_PACKED(push_protobuf_add_packed_int32, PACKED_VARINT32, int32_t)
+ADD_PACKED(push_protobuf_add_packed_int64, PACKED_VARINT64, int64_t)
+ADD_PACKED(push_protobuf_add_packed_sint32, PACKED_ZIGZAG32, int32_t)
+ADD_PACKED(push_protobuf_add_packed_sint64, PACKED_ZIGZAG64, int64_t)
+ADD_PACKED(push_protobuf_add_packed_fixed32, PACKED_FIXED32, uint32_t)
+ADD_PACKED(push_protobuf_add_packed_fixed64, PACKED_FIXED64, uint64_t)
+ADD_PACKED(push_protobuf_add_packed_sfixed32, PACKED_FIXED32, int32_t)
+ADD_PACKED(push_protobuf_add_packed_sfixed64, PACKED_FIXED64, int64_t)
+ADD_PACKED(push_protobuf_add_packed_float, PACKED_FIXED32, float)
+ADD_PACKED(push_protobuf_add_packed_double, PACKED_FIXED64, double)
@@ -0,0 +1,453 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2010, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the LICENSE.txt file in this distribution for license
+ * details.
+ * ----------------------------------------------------------------------
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <hwm-buffer.h>
+
+#include <push/basics.h>
+#include <push/combinators.h>
+#include <push/pure.h>
+#include <push/talloc.h>
+
+#include <push/protobuf/basics.h>
+#include <push/protobuf/combinators.h>
+#include <push/protobuf/field-map.h>
+#include <push/protobuf/primitives.h>
+#include <push/protobuf/repeated.h>
+
+
+/*-----------------------------------------------------------------------
+ * String lists
+ */
+
+void
+push_protobuf_string_list_init(push_protobuf_string_list_t *list)
+{
+    hwm_buffer_init(&list->data);
+    hwm_buffer_init(&list->offsets);
+}
+
+
+void
+push_protobuf_string_list_done(push_protobuf_string_list_t *list)
+{
+    hwm_buffer_done(&list->data);
+    hwm_buffer_done(&list->offsets);
+}
+
+
+void
+push_protobuf_string_list_clear(push_protobuf_string_list_t *list)
+{
+    hwm_buffer_clear(&list->data);
+    hwm_buffer_clear(&list->offsets);
+}
+
+
+const char *
+push_protobuf_string_list_get(const push_protobuf_string_list_t *list,
+                              size_t index,
+                              size_t *size)
+{
+    const size_t  *offsets = hwm_buffer_mem(&list->offsets, size_t);
+    size_t  count = push_protobuf_string_list_count(list);
+    size_t  end;
+
+    if (index >= count)
+        return NULL;
+
+    /*
+     * Each string ends just before the next one's NUL terminator.
+     */
+
+    end = (index + 1 < count)? offsets[index + 1]: list->data.current_size;
+
+    if (size != NULL)
+        *size = end - offsets[index] - 1;
+
+    return hwm_buffer_mem(&list->data, char) + offsets[index];
+}
+
+
+/**
+ * Records where the next string starts.  The input is passed through
+ * unchanged.
+ */
+
+static bool
+start_string(push_protobuf_string_list_t *list,
+             void *input, void **output)
+{
+    size_t  *offset =
+        hwm_buffer_append_list_elem(&list->offsets, size_t);
+
+    if (offset == NULL)
+        return false;
+
+    *offset = list->data.current_size;
+    *output = input;
+    return true;
+}
+
+push_define_pure_callback(start_string_new, start_string, "start",
+                          void, void, push_protobuf_string_list_t);
+
+
+static bool
+append_to_string(void *user_data, const void *buf, size_t size)
+{
+    push_protobuf_string_list_t  *list =
+        (push_protobuf_string_list_t *) user_data;
+    void  *dest;
+
+    if (size == 0)
+        return true;
+
+    if (!hwm_buffer_ensure_size(&list->data,
+                                list->data.current_size + size))
+        return false;
+
+    dest = hwm_buffer_writable_mem(&list->data, uint8_t) +
+        list->data.current_size;
+    memcpy(dest, buf, size);
+    list->data.current_size += size;
+    return true;
+}
+
+
+/**
+ * Tacks on the NUL terminator once the whole string has been read.
+ */
+
+static bool
+finish_string(push_protobuf_string_list_t *list,
+              void *input, void **output)
+{
+    char  *nul = hwm_buffer_append_list_elem(&list->data, char);
+
+    if (nul == NULL)
+        return false;
+
+    *nul = '\0';
+    *output = input;
+    return true;
+}
+
+push_define_pure_callback(finish_string_new, finish_string, "finish",
+                          void, void, push_protobuf_string_list_t);
+
+
+bool
+push_protobuf_add_repeated_string(const char *message_name,
+                                  const char *field_name,
+                                  void *parent,
+                                  push_parser_t *parser,
+                                  push_protobuf_field_map_t *field_map,
+                                  push_protobuf_tag_number_t field_number,
+                                  push_protobuf_string_list_t *dest)
+{
+    void  *context;
+    const char  *full_field_name;
+    push_callback_t  *start;
+    push_callback_t  *sink;
+    push_callback_t  *finish;
+    push_callback_t  *compose1;
+    push_callback_t  *field;
+
+    /*
+     * If the field map is NULL, return false.
+     */
+
+    if (field_map == NULL)
+        return false;
+
+    /*
+     * Create a memory context for the objects we're about to create.
+     */
+
+    context = push_talloc_new(parent);
+    if (context == NULL) return false;
+
+    /*
+     * Create the callbacks.  The string's contents are streamed
+     * directly onto the end of the list's data buffer.
+     */
+
+    if (message_name == NULL) message_name = "message";
+    if (field_name == NULL) field_name = ".repeated-string";
+
+    full_field_name =
+        push_talloc_asprintf(context, "%s.%s",
+                             message_name, field_name);
+
+    start = start_string_new
+        (push_talloc_asprintf(context, "%s.start", full_field_name),
+         context, parser, dest);
+    sink = push_protobuf_string_sink_new
+        (push_talloc_asprintf(context, "%s.sink", full_field_name),
+         context, parser, append_to_string, dest);
+    finish = finish_string_new
+        (push_talloc_asprintf(context, "%s.finish", full_field_name),
+         context, parser, dest);
+    compose1 = push_compose_new
+        (push_talloc_asprintf(context, "%s.compose1", full_field_name),
+         context, parser, start, sink);
+    field = push_compose_new
+        (push_talloc_asprintf(context, "%s.compose2", full_field_name),
+         context, parser, compose1, finish);
+
+    /*
+     * Because of NULL propagation, we only have to check the last
+     * result to see if everything was created okay.
+     */
+
+    if (field == NULL) goto error;
+
+    /*
+     * Try to add the new field.  If we can't, free the callback
+     * before returning.
+     */
+
+    if (!push_protobuf_field_map_add_field
+        (full_field_name, parser, field_map, field_number,
+         PUSH_PROTOBUF_TAG_TYPE_LENGTH_DELIMITED, field))
+    {
+        goto error;
+    }
+
+    return true;
+
+  error:
+    /*
+     * Before returning, free any objects we created before the error.
+     */
+
+    push_talloc_free(context);
+    return false;
+}
+
+
+/*-----------------------------------------------------------------------
+ * Repeated submessages
+ */
+
+typedef struct _element_info
+{
+    void  *element;
+    size_t  element_size;
+    hwm_buffer_t  *dest;
+} element_info_t;
+
+
+static bool
+clear_element(element_info_t *info, void *input, void **output)
+{
+    memset(info->element, 0, info->element_size);
+    *output = input;
+    return true;
+}
+
+push_define_pure_callback(clear_element_new, clear_element, "clear",
+                          void, void, element_info_t);
+
+
+static bool
+append_element(element_info_t *info, void *input, void **output)
+{
+    void  *dest;
+
+    if (!hwm_buffer_ensure_size(info->dest,
+                                info->dest->current_size +
+                                info->element_size))
+        return false;
+
+    dest = hwm_buffer_writable_mem(info->dest, uint8_t) +
+        info->dest->current_size;
+    memcpy(dest, info->element, info->element_size);
+    info->dest->current_size += info->element_size;
+
+    *output = dest;
+    return true;
+}
+
+push_define_pure_callback(append_element_new, append_element, "append",
+                          void, void, element_info_t);
+
+
+bool
+push_protobuf_add_repeated_submessage
+    (const char *message_name,
+     const char *field_name,
+     void *parent,
+     push_parser_t *parser,
+     push_protobuf_field_map_t *field_map,
+     push_protobuf_tag_number_t field_number,
+     push_callback_t *message,
+     void *element,
+     size_t element_size,
+     hwm_buffer_t *dest)
+{
+    void  *context;
+    const char  *full_field_name;
+    element_info_t  *info;
+    push_callback_t  *clear;
+    push_callback_t  *prefixed;
+    push_callback_t  *append;
+    push_callback_t  *compose1;
+    push_callback_t  *field;
+
+    /*
+     * If the field map or message callback is NULL, return false.
+     */
+
+    if ((field_map == NULL) || (message == NULL))
+        return false;
+
+    /*
+     * Create a memory context for the objects we're about to create.
+     */
+
+    context = push_talloc_new(parent);
+    if (context == NULL) return false;
+
+    /*
+     * Both ends of the field share the same element description.
+     */
+
+    info = push_talloc(context, element_info_t);
+    if (info == NULL) goto error;
+
+    info->element = element;
+    info->element_size = element_size;
+    info->dest = dest;
+
+    /*
+     * Create the callbacks.
+     */
+
+    if (message_name == NULL) message_name = "message";
+    if (field_name == NULL) field_name = ".repeated-submessage";
+
+    full_field_name =
+        push_talloc_asprintf(context, "%s.%s",
+                             message_name, field_name);
+
+    clear = clear_element_new
+        (push_talloc_asprintf(context, "%s.clear", full_field_name),
+         context, parser, info);
+    prefixed = push_protobuf_varint_prefixed_new
+        (push_talloc_asprintf(context, "%s.prefixed", full_field_name),
+         context, parser, message);
+    append = append_element_new
+        (push_talloc_asprintf(context, "%s.append", full_field_name),
+         context, parser, info);
+    compose1 = push_compose_new
+        (push_talloc_asprintf(context, "%s.compose1", full_field_name),
+         context, parser, clear, prefixed);
+    field = push_compose_new
+        (push_talloc_asprintf(context, "%s.compose2", full_field_name),
+         context, parser, compose1, append);
+
+    /*
+     * Because of NULL propagation, we only have to check the last
+     * result to see if everything was created okay.
+     */
+
+    if (field == NULL) goto error;
+
+    /*
+     * Try to add the new field.  If we can't, free the callback
+     * before returning.
+     */
+
+    if (!push_protobuf_field_map_add_field
+        (full_field_name, parser, field_map, field_number,
+         PUSH_PROTOBUF_TAG_TYPE_LENGTH_DELIMITED, field))
+    {
+        goto error;
+    }
+
+    return true;
+
+  error:
+    /*
+     * Before returning, free any objects we created before the error.
+     */
+
+    push_talloc_free(context);
+    return false;
+}
+
+
+/*-----------------------------------------------------------------------
+ * Repeated scalars
+ */
+
+/*
+ * A parser has to accept both encodings of a repeated scalar field,
+ * whichever one the field was declared with, so these are the same
+ * as the packed helpers.
+ */
+
+#define ADD_REPEATED(ADD, ADD_PACKED)                                   \
+bool                                                                    \
+ADD(const char *message_name,                                           \
+    const char *field_name,                                             \
+    void *parent,                                                       \
+    push_parser_t *parser,                                              \
+    push_protobuf_field_map_t *field_map,                               \
+    push_protobuf_tag_number_t field_number,                            \
+    hwm_buffer_t *dest)                                                 \
+{                                                                       \
+    if (field_name == NULL) field_name = ".repeated";                   \
+                                                                        \
+    return ADD_PACKED(message_name, field_name, parent, parser,         \
+                      field_map, field_number, dest);                   \
+}
+
+
+ADD_REPEATED(push_protobuf_add_repeated_uint32,
+             push_protobuf_add_packed_uint32)
+
+ADD_REPEATED(push_protobuf_add_repeated_uint64,
+             push_protobuf_add_packed_uint64)
+
+ADD_REPEATED(push_protobuf_add_repeated_int32,
+             push_protobuf_add_packed_int32)
+
+ADD_REPEATED(push_protobuf_add_repeated_int64,
+             push_protobuf_add_packed_int64)
+
+ADD_REPEATED(push_protobuf_add_repeated_sint32,
+             push_protobuf_add_packed_sint32)
+
+ADD_REPEATED(push_protobuf_add_repeated_sint64,
+             push_protobuf_add_packed_sint64)
+
+ADD_REPEATED(push_protobuf_add_repeated_fixed32,
+             push_protobuf_add_packed_fixed32)
+
+ADD_REPEATED(push_protobuf_add_repeated_fixed64,
+             push_protobuf_add_packed_fixed64)
+
+ADD_REPEATED(push_protobuf_add_repeated_sfixed32,
+             push_protobuf_add_packed_sfixed32)
+
+ADD_REPEATED(push_protobuf_add_repeated_sfixed64,
+             push_protobuf_add_packed_sfixed64)
+
+ADD_REPEATED(push_protobuf_add_repeated_float,
+             push_protobuf_add_packed_float)
+
+ADD_REPEATED(push_protobuf_add_repeated_double,
+             push_protobuf_add_packed_double)
@@ -0,0 +1,602 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2010, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the LICENSE.txt file in this distribution for license
+ * details.
+ * ----------------------------------------------------------------------
+ */
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <hwm-buffer.h>
+
+#include <push/basics.h>
+#include <push/talloc.h>
+
+#include <push/protobuf/basics.h>
+#include <push/protobuf/primitives.h>
+#include <push/protobuf/varint.h>
+
+
+/**
+ * The states of the skip-field state machine.
+ */
+
+typedef enum _skip_state
+{
+    /**
+     * Reading the tag of a field inside of a group.
+     */
+
+    SKIP_TAG,
+
+    /**
+     * Scanning for the last byte of a varint value.
+     */
+
+    SKIP_VARINT,
+
+    /**
+     * Reading the length of a length-delimited value.
+     */
+
+    SKIP_LENGTH,
+
+    /**
+     * Skipping over a known number of bytes.
+     */
+
+    SKIP_BYTES
+
+} skip_state_t;
+
+
+/**
+ * The user data struct for a skip-field callback.
+ */
+
+typedef struct _skip_field
+{
+    /**
+     * The push_callback_t superclass for this callback.
+     */
+
+    push_callback_t  callback;
+
+    /**
+     * The continue continuation for this callback.
+     */
+
+    push_continue_continuation_t  cont;
+
+    /**
+     * The current state.
+     */
+
+    skip_state_t  state;
+
+    /**
+     * The field numbers of the groups that we're currently inside
+     * of, innermost last, as a list of push_protobuf_tag_number_t.
+     * Each END_GROUP has to match the innermost START_GROUP.
+     */
+
+    hwm_buffer_t  groups;
+
+    /**
+     * The tag or length that we're currently reading.
+     */
+
+    uint64_t  value;
+
+    /**
+     * The number of bytes of the current varint that we've seen.
+     */
+
+    size_t  varint_size;
+
+    /**
+     * The number of bytes left to skip in the SKIP_BYTES state.
+     */
+
+    uint64_t  bytes_left;
+
+} skip_field_t;
+
+
+/**
+ * Set up the state machine to skip a value with the given tag.
+ * Returns PUSH_PARSE_ERROR if the tag is invalid, and
+ * PUSH_MEMORY_ERROR if we can't record a new group.
+ */
+
+static push_error_code_t
+skip_field_start_value(skip_field_t *skip,
+                       push_protobuf_tag_t tag)
+{
+    push_protobuf_tag_number_t  *group;
+    size_t  depth;
+
+    skip->varint_size = 0;
+    skip->value = 0;
+
+    switch (PUSH_PROTOBUF_GET_TAG_TYPE(tag))
+    {
+      case PUSH_PROTOBUF_TAG_TYPE_VARINT:
+        skip->state = SKIP_VARINT;
+        return PUSH_SUCCESS;
+
+      case PUSH_PROTOBUF_TAG_TYPE_FIXED64:
+        skip->state = SKIP_BYTES;
+        skip->bytes_left = sizeof(uint64_t);
+        return PUSH_SUCCESS;
+
+      case PUSH_PROTOBUF_TAG_TYPE_LENGTH_DELIMITED:
+        skip->state = SKIP_LENGTH;
+        return PUSH_SUCCESS;
+
+      case PUSH_PROTOBUF_TAG_TYPE_START_GROUP:
+        group = hwm_buffer_append_list_elem(&skip->groups,
+                                            push_protobuf_tag_number_t);
+        if (group == NULL)
+            return PUSH_MEMORY_ERROR;
+
+        *group = PUSH_PROTOBUF_GET_TAG_NUMBER(tag);
+        skip->state = SKIP_TAG;
+        return PUSH_SUCCESS;
+
+      case PUSH_PROTOBUF_TAG_TYPE_END_GROUP:
+        /*
+         * An END_GROUP is only valid inside of a group with the same
+         * field number.  It finishes that group, which we treat as an
+         * empty value.
+         */
+
+        depth = hwm_buffer_current_list_size(&skip->groups,
+                                             push_protobuf_tag_number_t);
+        if (depth == 0)
+            return PUSH_PARSE_ERROR;
+
+        if (hwm_buffer_mem(&skip->groups,
+                           push_protobuf_tag_number_t)[depth - 1] !=
+            PUSH_PROTOBUF_GET_TAG_NUMBER(tag))
+            return PUSH_PARSE_ERROR;
+
+        skip->groups.current_size -= sizeof(push_protobuf_tag_number_t);
+        skip->state = SKIP_BYTES;
+        skip->bytes_left = 0;
+        return PUSH_SUCCESS;
+
+      case PUSH_PROTOBUF_TAG_TYPE_FIXED32:
+        skip->state = SKIP_BYTES;
+        skip->bytes_left = sizeof(uint32_t);
+        return PUSH_SUCCESS;
+
+      default:
+        return PUSH_PARSE_ERROR;
+    }
+}
+
+
+/**
+ * Read some of a tag or length varint into skip->value.  Returns the
+ * number of bytes consumed, or (size_t) -1 if the varint is too long.
+ * Sets *done once the varint is complete.
+ */
+
+static size_t
+skip_field_read_varint(skip_field_t *skip,
+                       const uint8_t *buf,
+                       size_t bytes_remaining,
+                       bool *done)
+{
+    size_t  used = 0;
+
+    /*
+     * Fast path: a complete varint in the current chunk.
+     */
+
+    if ((skip->varint_size == 0) &&
+        (bytes_remaining >= PUSH_PROTOBUF_MAX_VARINT_LENGTH))
+    {
+        used = push_protobuf_varint_decode(buf, &skip->value);
+        if (used == 0)
+            return (size_t) -1;
+
+        *done = true;
+        return used;
+    }
+
+    while (used < bytes_remaining)
+    {
+        uint8_t  b = buf[used++];
+
+        if (skip->varint_size == PUSH_PROTOBUF_MAX_VARINT_LENGTH)
+            return (size_t) -1;
+
+        skip->value |= ((uint64_t) (b & 0x7f)) << (7 * skip->varint_size);
+        skip->varint_size++;
+
+        if (b < 0x80)
+        {
+            *done = true;
+            return used;
+        }
+    }
+
+    *done = false;
+    return used;
+}
+
+
+/**
+ * Scan for the last byte of a varint, without decoding it.  Returns
+ * the number of bytes consumed, or (size_t) -1 if the varint is too
+ * long.
+ */
+
+static size_t
+skip_field_scan_varint(skip_field_t *skip,
+                       const uint8_t *buf,
+                       size_t bytes_remaining,
+                       bool *done)
+{
+    size_t  used;
+
+    /*
+     * Most varints are a single byte.
+     */
+
+    if (buf[0] < 0x80)
+    {
+        used = 1;
+    }
+
+    /*
+     * Otherwise, if there are at least 16 bytes in the chunk, find
+     * the last byte from the mask of continuation bits.
+     */
+
+    else if (bytes_remaining >= 16)
+    {
+        uint32_t  mask = push_protobuf_varint_stop_mask16(buf);
+
+        if (mask == 0)
+            return (size_t) -1;
+
+        used = __builtin_ctz(mask) + 1;
+    }
+
+    /*
+     * Otherwise, look at each byte in turn.
+     */
+
+    else
+    {
+        for (used = 0; used < bytes_remaining; used++)
+        {
+            if (buf[used] < 0x80)
+                break;
+        }
+
+        if (used == bytes_remaining)
+        {
+            skip->varint_size += used;
+            if (skip->varint_size > PUSH_PROTOBUF_MAX_VARINT_LENGTH)
+                return (size_t) -1;
+
+            *done = false;
+            return used;
+        }
+
+        used++;
+    }
+
+    skip->varint_size += used;
+    if (skip->varint_size > PUSH_PROTOBUF_MAX_VARINT_LENGTH)
+        return (size_t) -1;
+
+    *done = true;
+    return used;
+}
+
+
+static void
+skip_field_continue(void *user_data,
+                    const void *buf,
+                    size_t bytes_remaining)
+{
+    skip_field_t  *skip = (skip_field_t *) user_data;
+
+    if (bytes_remaining == 0)
+    {
+        PUSH_DEBUG_MSG("%s: Reached EOF before end of field.\n",
+                       push_talloc_get_name(skip));
+
+        push_continuation_call(skip->callback.error,
+                               PUSH_PARSE_ERROR,
+                               "Reached EOF before end of field");
+
+        return;
+    }
+
+    while (true)
+    {
+        bool  done = false;
+        size_t  used = 0;
+
+        /*
+         * A zero-byte skip (which we use to finish a group) can
+         * complete even when the chunk is empty; everything else
+         * needs data.
+         */
+
+        if ((bytes_remaining == 0) &&
+            !((skip->state == SKIP_BYTES) && (skip->bytes_left == 0)))
+        {
+            break;
+        }
+
+        switch (skip->state)
+        {
+          case SKIP_TAG:
+            used = skip_field_read_varint(skip, buf, bytes_remaining,
+                                          &done);
+            break;
+
+          case SKIP_VARINT:
+            used = skip_field_scan_varint(skip, buf, bytes_remaining,
+                                          &done);
+            break;
+
+          case SKIP_LENGTH:
+            used = skip_field_read_varint(skip, buf, bytes_remaining,
+                                          &done);
+            break;
+
+          case SKIP_BYTES:
+            used =
+                (bytes_remaining < skip->bytes_left)?
+                bytes_remaining:
+                skip->bytes_left;
+            skip->bytes_left -= used;
+            done = (skip->bytes_left == 0);
+            break;
+        }
+
+        if (used == (size_t) -1)
+        {
+            PUSH_DEBUG_MSG("%s: Varint is too long.\n",
+                           push_talloc_get_name(skip));
+
+            push_continuation_call(skip->callback.error,
+                                   PUSH_PARSE_ERROR,
+                                   "Varint is too long");
+
+            return;
+        }
+
+        buf += used;
+        bytes_remaining -= used;
+
+        if (!done)
+            continue;
+
+        /*
+         * We've finished the current state.  Figure out what's next.
+         */
+
+        if (skip->state == SKIP_TAG)
+        {
+            push_error_code_t  result;
+
+            PUSH_DEBUG_MSG("%s: Skipping nested field with tag "
+                           "0x%04"PRIx64".\n",
+                           push_talloc_get_name(skip),
+                           skip->value);
+
+            /*
+             * A tag has to fit into 32 bits.
+             */
+
+            if (skip->value > UINT32_MAX)
+                result = PUSH_PARSE_ERROR;
+            else
+                result = skip_field_start_value(skip, skip->value);
+
+            if (result == PUSH_MEMORY_ERROR)
+            {
+                PUSH_DEBUG_MSG("%s: Cannot record nested group.\n",
+                               push_talloc_get_name(skip));
+
+                push_continuation_call(skip->callback.error,
+                                       PUSH_MEMORY_ERROR,
+                                       "Cannot record nested group");
+
+                return;
+            }
+
+            if (result != PUSH_SUCCESS)
+            {
+                PUSH_DEBUG_MSG("%s: Invalid nested tag.\n",
+                               push_talloc_get_name(skip));
+
+                push_continuation_call(skip->callback.error,
+                                       PUSH_PARSE_ERROR,
+                                       "Invalid tag in group");
+
+                return;
+            }
+
+            continue;
+        }
+
+        if (skip->state == SKIP_LENGTH)
+        {
+            skip->state = SKIP_BYTES;
+            skip->bytes_left = skip->value;
+            continue;
+        }
+
+        /*
+         * We've finished skipping a value.  If we're not inside of a
+         * group, we're done; otherwise, read the group's next tag.
+         */
+
+        if (skip->groups.current_size == 0)
+        {
+            PUSH_DEBUG_MSG("%s: Finished skipping field.\n",
+                           push_talloc_get_name(skip));
+
+            push_continuation_call(skip->callback.success,
+                                   NULL,
+                                   buf, bytes_remaining);
+
+            return;
+        }
+
+        skip->state = SKIP_TAG;
+        skip->value = 0;
+        skip->varint_size = 0;
+    }
+
+    PUSH_DEBUG_MSG("%s: Need more data to skip field.\n",
+                   push_talloc_get_name(skip));
+
+    push_continuation_call(skip->callback.incomplete,
+                           &skip->cont);
+}
+
+
+static void
+skip_field_activate(void *user_data,
+                    void *result,
+                    const void *buf,
+                    size_t bytes_remaining)
+{
+    skip_field_t  *skip = (skip_field_t *) user_data;
+    push_protobuf_tag_t  *tag = (push_protobuf_tag_t *) result;
+    push_error_code_t  start_result;
+
+    PUSH_DEBUG_MSG("%s: Activating.  Skipping field with tag "
+                   "0x%04"PRIx32".\n",
+                   push_talloc_get_name(skip),
+                   *tag);
+
+    hwm_buffer_clear(&skip->groups);
+
+    start_result = skip_field_start_value(skip, *tag);
+
+    if (start_result == PUSH_MEMORY_ERROR)
+    {
+        PUSH_DEBUG_MSG("%s: Cannot record group.\n",
+                       push_talloc_get_name(skip));
+
+        push_continuation_call(skip->callback.error,
+                               PUSH_MEMORY_ERROR,
+                               "Cannot record group");
+
+        return;
+    }
+
+    if (start_result != PUSH_SUCCESS)
+    {
+        PUSH_DEBUG_MSG("%s: Invalid tag.\n",
+                       push_talloc_get_name(skip));
+
+        push_continuation_call(skip->callback.error,
+                               PUSH_PARSE_ERROR,
+                               "Invalid tag");
+
+        return;
+    }
+
+    /*
+     * Fixed-width values that fit in the current chunk can be
+     * skipped without entering the state machine.
+     */
+
+    if ((skip->state == SKIP_BYTES) &&
+        (bytes_remaining >= skip->bytes_left))
+    {
+        buf += skip->bytes_left;
+        bytes_remaining -= skip->bytes_left;
+
+        push_continuation_call(skip->callback.success,
+                               NULL,
+                               buf, bytes_remaining);
+
+        return;
+    }
+
+    if (bytes_remaining == 0)
+    {
+        /*
+         * If we don't get any data when we're activated, return an
+         * incomplete and wait for some data.
+         */
+
+        push_continuation_call(skip->callback.incomplete,
+                               &skip->cont);
+
+        return;
+
+    } else {
+        /*
+         * Otherwise let the continue continuation go ahead and
+         * process this chunk of data.
+         */
+
+        skip_field_continue(user_data, buf, bytes_remaining);
+        return;
+    }
+}
+
+
+static int
+skip_field_destructor(skip_field_t *skip)
+{
+    hwm_buffer_done(&skip->groups);
+    return 0;
+}
+
+
+push_callback_t *
+push_protobuf_skip_field_new(const char *name,
+                             void *parent,
+                             push_parser_t *parser)
+{
+    skip_field_t  *skip = push_talloc(parent, skip_field_t);
+
+    if (skip == NULL)
+        return NULL;
+
+    /*
+     * Initialize the push_callback_t instance.
+     */
+
+    if (name == NULL) name = "pb-skip-field";
+    push_talloc_set_name_const(skip, name);
+
+    hwm_buffer_init(&skip->groups);
+    push_talloc_set_destructor(skip, skip_field_destructor);
+
+    push_callback_init(&skip->callback, parser, skip,
+                       skip_field_activate,
+                       NULL, NULL, NULL);
+
+    /*
+     * Fill in the continuation objects for the continuations that we
+     * implement.
+     */
+
+    push_continuation_set(&skip->cont,
+                          skip_field_continue,
+                          skip);
+
+    return &skip->callback;
+}
@@ -0,0 +1,476 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2010, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the LICENSE.txt file in this distribution for license
+ * details.
+ * ----------------------------------------------------------------------
+ */
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <hwm-buffer.h>
+
+#include <push/basics.h>
+#include <push/talloc.h>
+
+#include <push/protobuf/basics.h>
+#include <push/protobuf/primitives.h>
+#include <push/protobuf/unknown.h>
+
+
+/**
+ * Where one unknown field's bytes are.
+ */
+
+typedef struct _unknown_field
+{
+    /**
+     * The field's tag.
+     */
+
+    push_protobuf_tag_t  tag;
+
+    /**
+     * The field's bytes, if they're in the caller's data chunk, or
+     * NULL if they were copied into the list's data buffer.
+     */
+
+    const void  *buf;
+
+    /**
+     * If the bytes were copied, their offset within the data buffer.
+     */
+
+    size_t  offset;
+
+    /**
+     * The number of bytes.
+     */
+
+    size_t  size;
+
+} unknown_field_t;
+
+
+void
+push_protobuf_unknown_fields_init(push_protobuf_unknown_fields_t *fields)
+{
+    hwm_buffer_init(&fields->entries);
+    hwm_buffer_init(&fields->data);
+}
+
+
+void
+push_protobuf_unknown_fields_done(push_protobuf_unknown_fields_t *fields)
+{
+    hwm_buffer_done(&fields->entries);
+    hwm_buffer_done(&fields->data);
+}
+
+
+void
+push_protobuf_unknown_fields_clear(push_protobuf_unknown_fields_t *fields)
+{
+    hwm_buffer_clear(&fields->entries);
+    hwm_buffer_clear(&fields->data);
+}
+
+
+size_t
+push_protobuf_unknown_fields_count
+    (const push_protobuf_unknown_fields_t *fields)
+{
+    return hwm_buffer_current_list_size(&fields->entries, unknown_field_t);
+}
+
+
+const void *
+push_protobuf_unknown_fields_get
+    (const push_protobuf_unknown_fields_t *fields,
+     size_t index,
+     push_protobuf_tag_t *tag,
+     size_t *size)
+{
+    const unknown_field_t  *entry;
+
+    if (index >= push_protobuf_unknown_fields_count(fields))
+        return NULL;
+
+    entry = hwm_buffer_mem(&fields->entries, unknown_field_t) + index;
+
+    if (tag != NULL)
+        *tag = entry->tag;
+
+    if (size != NULL)
+        *size = entry->size;
+
+    if (entry->buf != NULL)
+        return entry->buf;
+
+    return hwm_buffer_mem(&fields->data, uint8_t) + entry->offset;
+}
+
+
+/*-----------------------------------------------------------------------
+ * Unknown field callback
+ */
+
+/**
+ * A callback that records an unknown field.  We don't parse the field
+ * ourselves; we let a skip-field callback do that, and watch which
+ * bytes it consumes.  If it finishes within the chunk that the field
+ * started in, the field's bytes are everything between where we
+ * started and where it finished.  If it needs more data, it has
+ * consumed the rest of the current chunk, which we copy before
+ * passing on the next one.
+ */
+
+typedef struct _unknown_field_callback
+{
+    /**
+     * The push_callback_t superclass for this callback.
+     */
+
+    push_callback_t  callback;
+
+    /**
+     * The success continuation for the skip callback.
+     */
+
+    push_success_continuation_t  skip_success;
+
+    /**
+     * The incomplete continuation for the skip callback.
+     */
+
+    push_incomplete_continuation_t  skip_incomplete;
+
+    /**
+     * The error continuation for the skip callback.
+     */
+
+    push_error_continuation_t  skip_error;
+
+    /**
+     * The continue continuation that we hand out in place of the
+     * skip callback's, so that we can see each new chunk.
+     */
+
+    push_continue_continuation_t  cont;
+
+    /**
+     * The skip callback's continue continuation.
+     */
+
+    push_continue_continuation_t  *skip_cont;
+
+    /**
+     * The callback that skips over the field.
+     */
+
+    push_callback_t  *skip_field;
+
+    /**
+     * The list that we record fields into.
+     */
+
+    push_protobuf_unknown_fields_t  *dest;
+
+    /**
+     * The tag of the current field.
+     */
+
+    push_protobuf_tag_t  tag;
+
+    /**
+     * The start of the part of the current field that's in the
+     * current chunk.
+     */
+
+    const uint8_t  *start;
+
+    /**
+     * The end of the current chunk.
+     */
+
+    const uint8_t  *end;
+
+    /**
+     * Whether any of the current field has been copied into the data
+     * buffer.
+     */
+
+    bool  copied;
+
+    /**
+     * If so, where the copy starts.
+     */
+
+    size_t  offset;
+
+} unknown_field_callback_t;
+
+
+/**
+ * Copy part of the current field into the data buffer.
+ */
+
+static bool
+copy_bytes(unknown_field_callback_t *unknown,
+           const uint8_t *start, const uint8_t *end)
+{
+    hwm_buffer_t  *data = &unknown->dest->data;
+    size_t  old_size = data->current_size;
+    size_t  size = end - start;
+
+    if (size == 0)
+        return true;
+
+    if (!unknown->copied)
+    {
+        unknown->copied = true;
+        unknown->offset = old_size;
+    }
+
+    if (!hwm_buffer_ensure_size(data, old_size + size))
+        return false;
+
+    memcpy(hwm_buffer_writable_mem(data, uint8_t) + old_size, start, size);
+    data->current_size += size;
+    return true;
+}
+
+
+static void
+unknown_field_activate(void *user_data,
+                       void *result,
+                       const void *buf,
+                       size_t bytes_remaining)
+{
+    unknown_field_callback_t  *unknown =
+        (unknown_field_callback_t *) user_data;
+
+    unknown->tag = *(push_protobuf_tag_t *) result;
+    unknown->start = (const uint8_t *) buf;
+    unknown->end = unknown->start + bytes_remaining;
+    unknown->copied = false;
+
+    PUSH_DEBUG_MSG("%s: Recording field with tag 0x%04"PRIx32".\n",
+                   push_talloc_get_name(unknown),
+                   unknown->tag);
+
+    push_continuation_call(&unknown->skip_field->activate,
+                           &unknown->tag,
+                           buf, bytes_remaining);
+}
+
+
+static void
+unknown_field_continue(void *user_data,
+                       const void *buf,
+                       size_t bytes_remaining)
+{
+    unknown_field_callback_t  *unknown =
+        (unknown_field_callback_t *) user_data;
+
+    unknown->start = (const uint8_t *) buf;
+    unknown->end = unknown->start + bytes_remaining;
+
+    push_continuation_call(unknown->skip_cont, buf, bytes_remaining);
+}
+
+
+static void
+unknown_field_skip_success(void *user_data,
+                           void *result,
+                           const void *buf,
+                           size_t bytes_remaining)
+{
+    unknown_field_callback_t  *unknown =
+        (unknown_field_callback_t *) user_data;
+    const uint8_t  *finish = (const uint8_t *) buf;
+    unknown_field_t  *entry;
+
+    entry = hwm_buffer_append_list_elem(&unknown->dest->entries,
+                                        unknown_field_t);
+    if (entry == NULL)
+        goto memory_error;
+
+    entry->tag = unknown->tag;
+
+    if (unknown->copied)
+    {
+        /*
+         * The field straddled chunks, so copy the rest of it after
+         * the parts that we've already copied.
+         */
+
+        if (!copy_bytes(unknown, unknown->start, finish))
+        {
+            unknown->dest->entries.current_size -= sizeof(unknown_field_t);
+            goto memory_error;
+        }
+
+        entry->buf = NULL;
+        entry->offset = unknown->offset;
+        entry->size = unknown->dest->data.current_size - unknown->offset;
+    } else {
+        entry->buf = unknown->start;
+        entry->offset = 0;
+        entry->size = finish - unknown->start;
+    }
+
+    PUSH_DEBUG_MSG("%s: Recorded %zu bytes (%s).\n",
+                   push_talloc_get_name(unknown),
+                   entry->size,
+                   unknown->copied? "copied": "in place");
+
+    push_continuation_call(unknown->callback.success,
+                           result,
+                           buf, bytes_remaining);
+    return;
+
+  memory_error:
+    push_continuation_call(unknown->callback.error,
+                           PUSH_MEMORY_ERROR,
+                           "Cannot record unknown field");
+}
+
+
+static void
+unknown_field_skip_incomplete(void *user_data,
+                              push_continue_continuation_t *cont)
+{
+    unknown_field_callback_t  *unknown =
+        (unknown_field_callback_t *) user_data;
+
+    /*
+     * The skip callback has consumed the rest of the chunk, which
+     * won't be around when the field finishes, so copy it now.
+     */
+
+    if (!copy_bytes(unknown, unknown->start, unknown->end))
+    {
+        push_continuation_call(unknown->callback.error,
+                               PUSH_MEMORY_ERROR,
+                               "Cannot record unknown field");
+
+        return;
+    }
+
+    unknown->skip_cont = cont;
+    push_continuation_call(unknown->callback.incomplete,
+                           &unknown->cont);
+}
+
+
+static void
+unknown_field_skip_error(void *user_data,
+                         push_error_code_t error_code,
+                         const char *error_message)
+{
+    unknown_field_callback_t  *unknown =
+        (unknown_field_callback_t *) user_data;
+
+    push_continuation_call(unknown->callback.error,
+                           error_code, error_message);
+}
+
+
+push_callback_t *
+push_protobuf_unknown_field_new(const char *name,
+                                void *parent,
+                                push_parser_t *parser,
+                                push_protobuf_unknown_fields_t *dest)
+{
+    unknown_field_callback_t  *unknown;
+
+    /*
+     * If the destination is NULL, return NULL ourselves.
+     */
+
+    if (dest == NULL)
+        return NULL;
+
+    /*
+     * Allocate the user data struct.
+     */
+
+    unknown = push_talloc(parent, unknown_field_callback_t);
+    if (unknown == NULL) return NULL;
+
+    if (name == NULL) name = "unknown-field";
+    push_talloc_set_name_const(unknown, name);
+
+    unknown->skip_field = push_protobuf_skip_field_new
+        (push_talloc_asprintf(unknown, "%s.skip", name),
+         unknown, parser);
+
+    if (unknown->skip_field == NULL)
+    {
+        push_talloc_free(unknown);
+        return NULL;
+    }
+
+    /*
+     * Fill in the data items.
+     */
+
+    unknown->dest = dest;
+    unknown->skip_cont = NULL;
+    unknown->tag = 0;
+    unknown->start = NULL;
+    unknown->end = NULL;
+    unknown->copied = false;
+    unknown->offset = 0;
+
+    /*
+     * Initialize the push_callback_t instance.
+     */
+
+    push_callback_init(&unknown->callback, parser, unknown,
+                       unknown_field_activate,
+                       NULL, NULL, NULL);
+
+    /*
+     * Fill in the continuation objects for the continuations that we
+     * implement.
+     */
+
+    push_continuation_set(&unknown->cont,
+                          unknown_field_continue,
+                          unknown);
+
+    push_continuation_set(&unknown->skip_success,
+                          unknown_field_skip_success,
+                          unknown);
+
+    push_continuation_set(&unknown->skip_incomplete,
+                          unknown_field_skip_incomplete,
+                          unknown);
+
+    push_continuation_set(&unknown->skip_error,
+                          unknown_field_skip_error,
+                          unknown);
+
+    /*
+     * The skip callback always returns to us.
+     */
+
+    push_continuation_call(&unknown->skip_field->set_success,
+                           &unknown->skip_success);
+
+    push_continuation_call(&unknown->skip_field->set_incomplete,
+                           &unknown->skip_incomplete);
+
+    push_continuation_call(&unknown->skip_field->set_error,
+                           &unknown->skip_error);
+
+    return &unknown->callback;
+}
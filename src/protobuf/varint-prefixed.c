@@ -8,36 +8,464 @@
  * ----------------------------------------------------------------------
  */
 
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
 #include <push/basics.h>
 #include <push/combinators.h>
 #include <push/pairs.h>
 #include <push/primitives.h>
 #include <push/talloc.h>
 
+#include <push/protobuf/combinators.h>
 #include <push/protobuf/primitives.h>
+#include <push/protobuf/varint.h>
 
 
-push_callback_t *
-push_protobuf_varint_prefixed_new(const char *name,
-                                  void *parent,
-                                  push_parser_t *parser,
-                                  push_callback_t *wrapped)
+/**
+ * A callback that enforces the parser's depth and size limits around
+ * a dynamic-max-bytes callback.  Its input is the same pair as the
+ * max-bytes callback's, so we can check the length prefix before
+ * reading any of the value.  The parser keeps track of the current
+ * depth, since the wrapped callback might contain other
+ * varint-prefixed callbacks.
+ */
+
+typedef struct _limit
+{
+    /**
+     * The push_callback_t superclass for this callback.
+     */
+
+    push_callback_t  callback;
+
+    /**
+     * The success continuation for the wrapped callback.
+     */
+
+    push_success_continuation_t  wrapped_success;
+
+    /**
+     * The error continuation for the wrapped callback.
+     */
+
+    push_error_continuation_t  wrapped_error;
+
+    /**
+     * The parser whose limits we enforce.
+     */
+
+    push_parser_t  *parser;
+
+    /**
+     * The dynamic-max-bytes callback that reads the value.
+     */
+
+    push_callback_t  *wrapped;
+
+} limit_t;
+
+
+static void
+limit_activate(void *user_data,
+               void *result,
+               const void *buf,
+               size_t bytes_remaining)
+{
+    limit_t  *limit = (limit_t *) user_data;
+    push_parser_t  *parser = limit->parser;
+    push_pair_t  *input = (push_pair_t *) result;
+    size_t  size = *(size_t *) input->first;
+    const char  *error_message;
+
+    error_message = push_parser_enter_value(parser, size);
+    if (error_message != NULL)
+    {
+        PUSH_DEBUG_MSG("%s: %s.\n",
+                       push_talloc_get_name(limit),
+                       error_message);
+
+        push_continuation_call(limit->callback.error,
+                               PUSH_PARSE_ERROR,
+                               error_message);
+
+        return;
+    }
+
+    /*
+     * The wrapped callback's incomplete continuation is our own, so
+     * we only have to catch it when it finishes.
+     */
+
+    push_continuation_call(&limit->wrapped->set_incomplete,
+                           limit->callback.incomplete);
+
+    push_continuation_call(&limit->wrapped->activate,
+                           result,
+                           buf, bytes_remaining);
+}
+
+
+static void
+limit_wrapped_success(void *user_data,
+                      void *result,
+                      const void *buf,
+                      size_t bytes_remaining)
+{
+    limit_t  *limit = (limit_t *) user_data;
+
+    push_parser_leave_value(limit->parser);
+    push_continuation_call(limit->callback.success,
+                           result,
+                           buf, bytes_remaining);
+}
+
+
+static void
+limit_wrapped_error(void *user_data,
+                    push_error_code_t error_code,
+                    const char *error_message)
+{
+    limit_t  *limit = (limit_t *) user_data;
+
+    push_parser_leave_value(limit->parser);
+    push_continuation_call(limit->callback.error,
+                           error_code, error_message);
+}
+
+
+static push_callback_t *
+limit_new(const char *name,
+          void *parent,
+          push_parser_t *parser,
+          push_callback_t *wrapped)
+{
+    limit_t  *limit;
+
+    if (wrapped == NULL)
+        return NULL;
+
+    limit = push_talloc(parent, limit_t);
+    if (limit == NULL) return NULL;
+
+    push_talloc_set_name_const(limit, name);
+
+    limit->parser = parser;
+    limit->wrapped = wrapped;
+
+    push_callback_init(&limit->callback, parser, limit,
+                       limit_activate,
+                       NULL, NULL, NULL);
+
+    push_continuation_set(&limit->wrapped_success,
+                          limit_wrapped_success,
+                          limit);
+
+    push_continuation_set(&limit->wrapped_error,
+                          limit_wrapped_error,
+                          limit);
+
+    push_continuation_call(&wrapped->set_success,
+                           &limit->wrapped_success);
+
+    push_continuation_call(&wrapped->set_error,
+                           &limit->wrapped_error);
+
+    return &limit->callback;
+}
+
+
+/*-----------------------------------------------------------------------
+ * Varint-prefixed callback
+ */
+
+/**
+ * A callback that reads a varint length prefix, and then passes
+ * exactly that many bytes to the wrapped callback.  Most of the time
+ * the prefix and the whole value are in the current chunk; we decode
+ * the prefix ourselves and activate the wrapped callback directly on
+ * the value's bytes.  Otherwise we hand off to the general path,
+ * which reads the prefix with a varint-size callback and passes the
+ * value through a dynamic-max-bytes callback, so that it can span any
+ * number of chunks.
+ */
+
+typedef struct _varint_prefixed
+{
+    /**
+     * The push_callback_t superclass for this callback.
+     */
+
+    push_callback_t  callback;
+
+    /**
+     * The success continuation for the wrapped callback, when it's
+     * reading a value from within a single chunk.
+     */
+
+    push_success_continuation_t  fast_success;
+
+    /**
+     * The incomplete continuation for the wrapped callback, when it's
+     * reading a value from within a single chunk.  The wrapped
+     * callback has seen all of the value, so we send it an EOF.
+     */
+
+    push_incomplete_continuation_t  fast_finished;
+
+    /**
+     * The error continuation for the wrapped callback, when it's
+     * reading a value from within a single chunk.
+     */
+
+    push_error_continuation_t  fast_error;
+
+    /**
+     * The parser whose limits we enforce.
+     */
+
+    push_parser_t  *parser;
+
+    /**
+     * The callback that reads the value.
+     */
+
+    push_callback_t  *wrapped;
+
+    /**
+     * The general path: a composition that reads the prefix and then
+     * the value, across any number of chunks.
+     */
+
+    push_callback_t  *general;
+
+    /**
+     * Whether the wrapped callback's continuations currently point at
+     * our fast path continuations.  The general path's max-bytes
+     * callback points them elsewhere whenever it runs.
+     */
+
+    bool  fast_wired;
+
+    /**
+     * The end of the value that the fast path is reading.
+     */
+
+    const uint8_t  *end;
+
+    /**
+     * The number of bytes in the current chunk after the end of the
+     * value.
+     */
+
+    size_t  leftover_size;
+
+} varint_prefixed_t;
+
+
+static void
+varint_prefixed_set_success(void *user_data,
+                            push_success_continuation_t *success)
+{
+    varint_prefixed_t  *prefixed = (varint_prefixed_t *) user_data;
+
+    prefixed->callback.success = success;
+    push_continuation_call(&prefixed->general->set_success,
+                           success);
+}
+
+
+static void
+varint_prefixed_set_incomplete(void *user_data,
+                               push_incomplete_continuation_t *incomplete)
+{
+    varint_prefixed_t  *prefixed = (varint_prefixed_t *) user_data;
+
+    prefixed->callback.incomplete = incomplete;
+    push_continuation_call(&prefixed->general->set_incomplete,
+                           incomplete);
+}
+
+
+static void
+varint_prefixed_set_error(void *user_data,
+                          push_error_continuation_t *error)
+{
+    varint_prefixed_t  *prefixed = (varint_prefixed_t *) user_data;
+
+    prefixed->callback.error = error;
+    push_continuation_call(&prefixed->general->set_error,
+                           error);
+}
+
+
+static void
+varint_prefixed_activate(void *user_data,
+                         void *result,
+                         const void *buf,
+                         size_t bytes_remaining)
+{
+    varint_prefixed_t  *prefixed = (varint_prefixed_t *) user_data;
+    const uint8_t  *bbuf = (const uint8_t *) buf;
+    uint64_t  size;
+    size_t  prefix_size;
+    const char  *error_message;
+
+    /*
+     * Decode the length prefix if it's in the current chunk.  Most
+     * prefixes are a single byte.
+     */
+
+    if ((bytes_remaining >= 1) && (bbuf[0] < 0x80))
+    {
+        size = bbuf[0];
+        prefix_size = 1;
+    } else if (bytes_remaining >= PUSH_PROTOBUF_MAX_VARINT_LENGTH) {
+        prefix_size = push_protobuf_varint_decode(bbuf, &size);
+        if (prefix_size == 0)
+            goto general_path;
+    } else {
+        goto general_path;
+    }
+
+    if (size > bytes_remaining - prefix_size)
+        goto general_path;
+
+    /*
+     * The whole value is in this chunk.
+     */
+
+    error_message = push_parser_enter_value(prefixed->parser, size);
+    if (error_message != NULL)
+    {
+        PUSH_DEBUG_MSG("%s: %s.\n",
+                       push_talloc_get_name(prefixed),
+                       error_message);
+
+        push_continuation_call(prefixed->callback.error,
+                               PUSH_PARSE_ERROR,
+                               error_message);
+
+        return;
+    }
+
+    PUSH_DEBUG_MSG("%s: Reading %"PRIu64"-byte value from "
+                   "current chunk.\n",
+                   push_talloc_get_name(prefixed),
+                   size);
+
+    if (!prefixed->fast_wired)
+    {
+        push_continuation_call(&prefixed->wrapped->set_success,
+                               &prefixed->fast_success);
+
+        push_continuation_call(&prefixed->wrapped->set_incomplete,
+                               &prefixed->fast_finished);
+
+        push_continuation_call(&prefixed->wrapped->set_error,
+                               &prefixed->fast_error);
+
+        prefixed->fast_wired = true;
+    }
+
+    prefixed->end = bbuf + prefix_size + size;
+    prefixed->leftover_size = bytes_remaining - prefix_size - size;
+
+    push_continuation_call(&prefixed->wrapped->activate,
+                           result,
+                           bbuf + prefix_size, size);
+
+    return;
+
+  general_path:
+    PUSH_DEBUG_MSG("%s: Value isn't in current chunk; "
+                   "using general path.\n",
+                   push_talloc_get_name(prefixed));
+
+    prefixed->fast_wired = false;
+    push_continuation_call(&prefixed->general->activate,
+                           result,
+                           buf, bytes_remaining);
+}
+
+
+static void
+varint_prefixed_fast_success(void *user_data,
+                             void *result,
+                             const void *buf,
+                             size_t bytes_remaining)
+{
+    varint_prefixed_t  *prefixed = (varint_prefixed_t *) user_data;
+
+    push_parser_leave_value(prefixed->parser);
+
+    /*
+     * If the wrapped callback didn't use all of the value, the rest
+     * of it comes right before the leftover part of the chunk.
+     */
+
+    if (bytes_remaining == 0)
+    {
+        push_continuation_call(prefixed->callback.success,
+                               result,
+                               prefixed->end,
+                               prefixed->leftover_size);
+    } else {
+        push_continuation_call(prefixed->callback.success,
+                               result,
+                               buf,
+                               bytes_remaining + prefixed->leftover_size);
+    }
+}
+
+
+static void
+varint_prefixed_fast_finished(void *user_data,
+                              push_continue_continuation_t *cont)
+{
+    /*
+     * The wrapped callback has seen all of the value, so let it know
+     * that there's nothing more.
+     */
+
+    push_continuation_call(cont, NULL, 0);
+}
+
+
+static void
+varint_prefixed_fast_error(void *user_data,
+                           push_error_code_t error_code,
+                           const char *error_message)
+{
+    varint_prefixed_t  *prefixed = (varint_prefixed_t *) user_data;
+
+    push_parser_leave_value(prefixed->parser);
+    push_continuation_call(prefixed->callback.error,
+                           error_code, error_message);
+}
+
+
+/**
+ * Create the general path for a varint-prefixed callback.
+ */
+
+static push_callback_t *
+general_new(const char *name,
+            void *parent,
+            push_parser_t *parser,
+            push_callback_t *wrapped)
 {
     void  *context;
     push_callback_t  *dup;
     push_callback_t  *size;
     push_callback_t  *first;
     push_callback_t  *max_bytes;
+    push_callback_t  *limit;
     push_callback_t  *compose1;
     push_callback_t  *compose2;
 
-    /*
-     * If the wrapped callback is NULL, return NULL ourselves.
-     */
-
-    if (wrapped == NULL)
-        return NULL;
-
     /*
      * Create a memory context for the objects we're about to create.
      */
@@ -49,8 +477,6 @@ push_protobuf_varint_prefixed_new(const char *name,
      * Then create the callbacks.
      */
 
-    if (name == NULL) name = "varint-prefixed";
-
     dup = push_dup_new
         (push_talloc_asprintf(context, "%s.dup", name),
          context, parser);
@@ -66,9 +492,12 @@ push_protobuf_varint_prefixed_new(const char *name,
     max_bytes = push_dynamic_max_bytes_new
         (push_talloc_asprintf(context, "%s.max", name),
          context, parser, wrapped);
+    limit = limit_new
+        (push_talloc_asprintf(context, "%s.limit", name),
+         context, parser, max_bytes);
     compose2 = push_compose_new
         (push_talloc_asprintf(context, "%s.compose2", name),
-         context, parser, compose1, max_bytes);
+         context, parser, compose1, limit);
 
     /*
      * Because of NULL propagation, we only have to check the last
@@ -86,3 +515,79 @@ push_protobuf_varint_prefixed_new(const char *name,
     push_talloc_free(context);
     return NULL;
 }
+
+
+push_callback_t *
+push_protobuf_varint_prefixed_new(const char *name,
+                                  void *parent,
+                                  push_parser_t *parser,
+                                  push_callback_t *wrapped)
+{
+    varint_prefixed_t  *prefixed;
+
+    /*
+     * If the wrapped callback is NULL, return NULL ourselves.
+     */
+
+    if (wrapped == NULL)
+        return NULL;
+
+    /*
+     * Allocate the user data struct.
+     */
+
+    prefixed = push_talloc(parent, varint_prefixed_t);
+    if (prefixed == NULL) return NULL;
+
+    if (name == NULL) name = "varint-prefixed";
+    push_talloc_set_name_const(prefixed, name);
+
+    prefixed->general = general_new
+        (push_talloc_asprintf(prefixed, "%s.general", name),
+         prefixed, parser, wrapped);
+
+    if (prefixed->general == NULL)
+    {
+        push_talloc_free(prefixed);
+        return NULL;
+    }
+
+    /*
+     * Fill in the data items.
+     */
+
+    prefixed->parser = parser;
+    prefixed->wrapped = wrapped;
+    prefixed->fast_wired = false;
+    prefixed->end = NULL;
+    prefixed->leftover_size = 0;
+
+    /*
+     * Initialize the push_callback_t instance.
+     */
+
+    push_callback_init(&prefixed->callback, parser, prefixed,
+                       varint_prefixed_activate,
+                       varint_prefixed_set_success,
+                       varint_prefixed_set_incomplete,
+                       varint_prefixed_set_error);
+
+    /*
+     * Fill in the continuation objects for the continuations that we
+     * implement.
+     */
+
+    push_continuation_set(&prefixed->fast_success,
+                          varint_prefixed_fast_success,
+                          prefixed);
+
+    push_continuation_set(&prefixed->fast_finished,
+                          varint_prefixed_fast_finished,
+                          prefixed);
+
+    push_continuation_set(&prefixed->fast_error,
+                          varint_prefixed_fast_error,
+                          prefixed);
+
+    return &prefixed->callback;
+}
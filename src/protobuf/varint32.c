@@ -16,6 +16,7 @@
 
 #include <push/protobuf/basics.h>
 #include <push/protobuf/primitives.h>
+#include <push/protobuf/varint.h>
 
 
 /**
@@ -106,7 +107,13 @@ varint32_rest_continue(void *user_data,
 
     while (bytes_remaining > 0)
     {
-        if (varint32->bytes_processed > PUSH_PROTOBUF_MAX_VARINT_LENGTH)
+        /*
+         * If we've already read as many bytes as a varint can have,
+         * without seeing its last byte, this one would make it too
+         * long.
+         */
+
+        if (varint32->bytes_processed >= PUSH_PROTOBUF_MAX_VARINT_LENGTH)
         {
             PUSH_DEBUG_MSG("%s: More than %u bytes in value.\n",
                            push_talloc_get_name(varint32),
@@ -235,13 +242,55 @@ varint32_first_continue(void *user_data,
     }
 
     /*
-     * If there are enough bytes to read a maximum-length varint, or
-     * if the last byte in the buffer would end a varint, then we can
-     * use the “fast path”, and read each byte unchecked.
+     * If there are enough bytes to read a maximum-length varint, we
+     * can use the word-at-a-time kernel, which finds the end of the
+     * varint and decodes it without looping over each byte.
+     */
+
+    if (bytes_remaining >= PUSH_PROTOBUF_MAX_VARINT_LENGTH)
+    {
+        uint64_t  result;
+        size_t  length;
+
+        PUSH_DEBUG_MSG("%s: Using word-at-a-time path\n",
+                       push_talloc_get_name(varint32));
+
+        length = push_protobuf_varint_decode(buf, &result);
+        if (length == 0)
+        {
+            PUSH_DEBUG_MSG("%s: More than %u bytes in value.\n",
+                           push_talloc_get_name(varint32),
+                           PUSH_PROTOBUF_MAX_VARINT_LENGTH);
+
+            push_continuation_call(varint32->callback.error,
+                                   PUSH_PARSE_ERROR,
+                                   "Varint is too long");
+
+            return;
+        }
+
+        varint32->value = result;
+
+        PUSH_DEBUG_MSG("%s: Read value %"PRIu32", using %zu bytes\n",
+                       push_talloc_get_name(varint32),
+                       varint32->value, length);
+
+        buf += length;
+        bytes_remaining -= length;
+
+        push_continuation_call(varint32->callback.success,
+                               &varint32->value,
+                               buf, bytes_remaining);
+
+        return;
+    }
+
+    /*
+     * Otherwise, if the last byte in the buffer would end a varint,
+     * then we can use the “fast path”, and read each byte unchecked.
      */
 
-    if ((bytes_remaining >= PUSH_PROTOBUF_MAX_VARINT_LENGTH) ||
-        (ibuf[bytes_remaining-1] < 0x80))
+    if (ibuf[bytes_remaining-1] < 0x80)
     {
         uint32_t  result;
         const uint8_t  *ptr = (const uint8_t *) buf;
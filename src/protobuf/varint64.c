@@ -17,6 +17,7 @@
 
 #include <push/protobuf/basics.h>
 #include <push/protobuf/primitives.h>
+#include <push/protobuf/varint.h>
 
 
 /**
@@ -98,7 +99,13 @@ varint64_rest_continue(void *user_data,
 
     while (bytes_remaining > 0)
     {
-        if (varint64->bytes_processed > PUSH_PROTOBUF_MAX_VARINT_LENGTH)
+        /*
+         * If we've already read as many bytes as a varint can have,
+         * without seeing its last byte, this one would make it too
+         * long.
+         */
+
+        if (varint64->bytes_processed >= PUSH_PROTOBUF_MAX_VARINT_LENGTH)
         {
             PUSH_DEBUG_MSG("%s: More than %u bytes in value.\n",
                            push_talloc_get_name(varint64),
@@ -190,13 +197,81 @@ varint64_first_continue(void *user_data,
      */
 
     /*
-     * If there are enough bytes to read a maximum-length varint, or
-     * if the last byte in the buffer would end a varint, then we can
-     * use the “fast path”, and read each byte unchecked.
+     * Special case for single-byte varints — super common, especially
+     * for small values.
+     */
+
+    if (*ibuf < 0x80)
+    {
+        PUSH_DEBUG_MSG("%s: Using super-fast path\n",
+                       push_talloc_get_name(varint64));
+
+        varint64->value = *ibuf;
+
+        PUSH_DEBUG_MSG("%s: Read value %"PRIu64", using 1 byte\n",
+                       push_talloc_get_name(varint64),
+                       varint64->value);
+
+        buf++;
+        bytes_remaining--;
+
+        push_continuation_call(varint64->callback.success,
+                               &varint64->value,
+                               buf, bytes_remaining);
+
+        return;
+    }
+
+    /*
+     * If there are enough bytes to read a maximum-length varint, we
+     * can use the word-at-a-time kernel, which finds the end of the
+     * varint and decodes it without looping over each byte.
+     */
+
+    if (bytes_remaining >= PUSH_PROTOBUF_MAX_VARINT_LENGTH)
+    {
+        uint64_t  result;
+        size_t  length;
+
+        PUSH_DEBUG_MSG("%s: Using word-at-a-time path\n",
+                       push_talloc_get_name(varint64));
+
+        length = push_protobuf_varint_decode(buf, &result);
+        if (length == 0)
+        {
+            PUSH_DEBUG_MSG("%s: More than %u bytes in value.\n",
+                           push_talloc_get_name(varint64),
+                           PUSH_PROTOBUF_MAX_VARINT_LENGTH);
+
+            push_continuation_call(varint64->callback.error,
+                                   PUSH_PARSE_ERROR,
+                                   "Varint is too long");
+
+            return;
+        }
+
+        varint64->value = result;
+
+        PUSH_DEBUG_MSG("%s: Read value %"PRIu64", using %zu bytes\n",
+                       push_talloc_get_name(varint64),
+                       varint64->value, length);
+
+        buf += length;
+        bytes_remaining -= length;
+
+        push_continuation_call(varint64->callback.success,
+                               &varint64->value,
+                               buf, bytes_remaining);
+
+        return;
+    }
+
+    /*
+     * Otherwise, if the last byte in the buffer would end a varint,
+     * then we can use the “fast path”, and read each byte unchecked.
      */
 
-    if ((bytes_remaining >= PUSH_PROTOBUF_MAX_VARINT_LENGTH) ||
-        (ibuf[bytes_remaining-1] < 0x80))
+    if (ibuf[bytes_remaining-1] < 0x80)
     {
         uint32_t  part0 = 0;
         uint32_t  part1 = 0;
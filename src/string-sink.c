@@ -0,0 +1,283 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2010, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the LICENSE.txt file in this distribution for license
+ * details.
+ * ----------------------------------------------------------------------
+ */
+
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include <push/basics.h>
+#include <push/primitives.h>
+#include <push/talloc.h>
+
+
+/**
+ * The user data struct for a string-sink callback.
+ */
+
+typedef struct _string_sink
+{
+    /**
+     * The push_callback_t superclass for this callback.
+     */
+
+    push_callback_t  callback;
+
+    /**
+     * The continue continuation for this callback.
+     */
+
+    push_continue_continuation_t  cont;
+
+    /**
+     * The function that receives each piece of the string.
+     */
+
+    push_string_sink_func_t  *sink;
+
+    /**
+     * The user data pointer to pass into the sink function.
+     */
+
+    void  *sink_user_data;
+
+    /**
+     * The total length of the string.  This is also our result.
+     */
+
+    size_t  total_size;
+
+    /**
+     * The number of bytes left to pass to the sink.
+     */
+
+    size_t  bytes_left;
+
+} string_sink_t;
+
+
+/**
+ * Tell the sink that the string is finished, by passing it a final
+ * zero-length piece, and then succeed.
+ */
+
+static void
+string_sink_finish(string_sink_t *string_sink,
+                   const void *buf,
+                   size_t bytes_remaining)
+{
+    if (!string_sink->sink(string_sink->sink_user_data, buf, 0))
+    {
+        PUSH_DEBUG_MSG("%s: Sink failed at end of string.\n",
+                       push_talloc_get_name(string_sink));
+
+        push_continuation_call(string_sink->callback.error,
+                               PUSH_PARSE_ERROR,
+                               "String sink failed");
+
+        return;
+    }
+
+    push_continuation_call(string_sink->callback.success,
+                           &string_sink->total_size,
+                           buf, bytes_remaining);
+}
+
+
+static void
+string_sink_continue(void *user_data,
+                     const void *buf,
+                     size_t bytes_remaining)
+{
+    string_sink_t  *string_sink = (string_sink_t *) user_data;
+    size_t  bytes_to_send;
+
+    /*
+     * EOF is a parse error if we haven't seen all of the string yet.
+     */
+
+    if (bytes_remaining == 0)
+    {
+        if (string_sink->bytes_left == 0)
+        {
+            /*
+             * We'll only get here for a 0-byte string that occurs
+             * right at the end of the stream.
+             */
+
+            PUSH_DEBUG_MSG("%s: EOF found at end of string.  "
+                           "Parse successful.\n",
+                           push_talloc_get_name(string_sink));
+
+            string_sink_finish(string_sink, buf, bytes_remaining);
+            return;
+
+        } else {
+            PUSH_DEBUG_MSG("%s: EOF found before end of string.  "
+                           "Parse fails.\n",
+                           push_talloc_get_name(string_sink));
+
+            push_continuation_call(string_sink->callback.error,
+                                   PUSH_PARSE_ERROR,
+                                   "EOF found before end of string");
+
+            return;
+        }
+    }
+
+    /*
+     * Make sure we don't send more data than is available, or more
+     * data than is in the string.
+     */
+
+    bytes_to_send =
+        (bytes_remaining < string_sink->bytes_left)?
+        bytes_remaining:
+        string_sink->bytes_left;
+
+    /*
+     * Hand this piece of the string to the sink.  We never hold on to
+     * it ourselves.
+     */
+
+    if (bytes_to_send > 0)
+    {
+        PUSH_DEBUG_MSG("%s: Sending %zu bytes to sink.\n",
+                       push_talloc_get_name(string_sink),
+                       bytes_to_send);
+
+        if (!string_sink->sink(string_sink->sink_user_data,
+                               buf, bytes_to_send))
+        {
+            PUSH_DEBUG_MSG("%s: Sink failed.\n",
+                           push_talloc_get_name(string_sink));
+
+            push_continuation_call(string_sink->callback.error,
+                                   PUSH_PARSE_ERROR,
+                                   "String sink failed");
+
+            return;
+        }
+    }
+
+    string_sink->bytes_left -= bytes_to_send;
+    buf += bytes_to_send;
+    bytes_remaining -= bytes_to_send;
+
+    /*
+     * If that's the end of the string, we've succeeded.
+     */
+
+    if (string_sink->bytes_left == 0)
+    {
+        PUSH_DEBUG_MSG("%s: Finished string of %zu bytes.\n",
+                       push_talloc_get_name(string_sink),
+                       string_sink->total_size);
+
+        string_sink_finish(string_sink, buf, bytes_remaining);
+        return;
+    }
+
+    /*
+     * Otherwise wait for the rest of the string.
+     */
+
+    push_continuation_call(string_sink->callback.incomplete,
+                           &string_sink->cont);
+}
+
+
+static void
+string_sink_activate(void *user_data,
+                     void *result,
+                     const void *buf,
+                     size_t bytes_remaining)
+{
+    string_sink_t  *string_sink = (string_sink_t *) user_data;
+    size_t  *input_size = (size_t *) result;
+
+    PUSH_DEBUG_MSG("%s: Activating.  Will stream %zu bytes.\n",
+                   push_talloc_get_name(string_sink),
+                   *input_size);
+
+    string_sink->total_size = *input_size;
+    string_sink->bytes_left = *input_size;
+
+    if (bytes_remaining == 0)
+    {
+        /*
+         * If we don't get any data when we're activated, return an
+         * incomplete and wait for some data.
+         */
+
+        push_continuation_call(string_sink->callback.incomplete,
+                               &string_sink->cont);
+
+        return;
+
+    } else {
+        /*
+         * Otherwise let the continue continuation go ahead and
+         * process this chunk of data.
+         */
+
+        string_sink_continue(user_data, buf, bytes_remaining);
+        return;
+    }
+}
+
+
+push_callback_t *
+push_string_sink_new(const char *name,
+                     void *parent,
+                     push_parser_t *parser,
+                     push_string_sink_func_t *sink,
+                     void *sink_user_data)
+{
+    string_sink_t  *string_sink;
+
+    /*
+     * If the sink function is NULL, return NULL ourselves.
+     */
+
+    if (sink == NULL)
+        return NULL;
+
+    string_sink = push_talloc(parent, string_sink_t);
+    if (string_sink == NULL)
+        return NULL;
+
+    /*
+     * Fill in the data items.
+     */
+
+    string_sink->sink = sink;
+    string_sink->sink_user_data = sink_user_data;
+
+    /*
+     * Initialize the push_callback_t instance.
+     */
+
+    if (name == NULL) name = "string-sink";
+    push_talloc_set_name_const(string_sink, name);
+
+    push_callback_init(&string_sink->callback, parser, string_sink,
+                       string_sink_activate,
+                       NULL, NULL, NULL);
+
+    /*
+     * Fill in the continuation objects for the continuations that we
+     * implement.
+     */
+
+    push_continuation_set(&string_sink->cont,
+                          string_sink_continue,
+                          string_sink);
+
+    return &string_sink->callback;
+}
@@ -0,0 +1,344 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2010, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the LICENSE.txt file in this distribution for license
+ * details.
+ * ----------------------------------------------------------------------
+ */
+
+/*
+ * Compares the hand-built field map parser for the genealogy
+ * example's Person message against the decoder that push-protoc
+ * generates from person.proto, and against a dynamic message parser
+ * loaded from person.proto's FileDescriptorSet.  Each message in the
+ * corpus is parsed separately, in one chunk and then in 16-byte
+ * chunks.
+ */
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <hwm-buffer.h>
+
+#include <push/basics.h>
+#include <push/talloc.h>
+#include <push/protobuf/dynamic.h>
+
+#include <person.h>
+#include <gen-person.pb.h>
+
+
+#define NUM_PEOPLE  (64 * 1024)
+#define NUM_ROUNDS  10
+
+
+/*-----------------------------------------------------------------------
+ * Corpus generation
+ */
+
+/*
+ * The output of protoc --descriptor_set_out for person.proto.
+ */
+
+static const uint8_t  PERSON_DESCRIPTOR_SET[] =
+    "\x0a\x7e\x0a\x0c\x70\x65\x72\x73\x6f\x6e\x2e\x70"
+    "\x72\x6f\x74\x6f\x22\x6e\x0a\x06\x50\x65\x72\x73"
+    "\x6f\x6e\x12\x0e\x0a\x02\x69\x64\x18\x01\x20\x02"
+    "\x28\x0d\x52\x02\x69\x64\x12\x12\x0a\x04\x6e\x61"
+    "\x6d\x65\x18\x02\x20\x02\x28\x09\x52\x04\x6e\x61"
+    "\x6d\x65\x12\x16\x0a\x06\x6d\x6f\x74\x68\x65\x72"
+    "\x18\x03\x20\x01\x28\x0d\x52\x06\x6d\x6f\x74\x68"
+    "\x65\x72\x12\x16\x0a\x06\x66\x61\x74\x68\x65\x72"
+    "\x18\x04\x20\x01\x28\x0d\x52\x06\x66\x61\x74\x68"
+    "\x65\x72\x12\x10\x0a\x03\x64\x6f\x62\x18\x05\x20"
+    "\x01\x28\x04\x52\x03\x64\x6f\x62";
+
+static const size_t  PERSON_DESCRIPTOR_SET_LENGTH = 128;
+
+
+static uint64_t  rng_state = 1;
+
+static uint64_t
+next_random()
+{
+    rng_state = rng_state * UINT64_C(6364136223846793005) +
+        UINT64_C(1442695040888963407);
+    return rng_state ^ (rng_state >> 29);
+}
+
+
+static size_t
+encode(uint64_t value, uint8_t *buf)
+{
+    size_t  length = 0;
+
+    while (value >= 0x80)
+    {
+        buf[length++] = (value & 0x7f) | 0x80;
+        value >>= 7;
+    }
+
+    buf[length++] = value;
+    return length;
+}
+
+
+/**
+ * Encodes a random Person message into buf, returning its length.
+ * The mother and father are each present three quarters of the
+ * time.
+ */
+
+static size_t
+make_person(uint32_t id, uint8_t *buf)
+{
+    size_t  size = 0;
+    size_t  name_length = 4 + next_random() % 24;
+    size_t  i;
+
+    buf[size++] = 0x08;
+    size += encode(id, buf + size);
+
+    buf[size++] = 0x12;
+    size += encode(name_length, buf + size);
+    for (i = 0; i < name_length; i++)
+        buf[size++] = 'a' + next_random() % 26;
+
+    if (next_random() % 4 != 0)
+    {
+        buf[size++] = 0x18;
+        size += encode(next_random() % id + 1, buf + size);
+    }
+
+    if (next_random() % 4 != 0)
+    {
+        buf[size++] = 0x20;
+        size += encode(next_random() % id + 1, buf + size);
+    }
+
+    buf[size++] = 0x28;
+    size += encode(UINT64_C(1000000000) + next_random() % 4000000000u,
+                   buf + size);
+
+    return size;
+}
+
+
+/*-----------------------------------------------------------------------
+ * Harness
+ */
+
+static double
+now()
+{
+    struct timespec  ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+static bool
+parse_message(push_parser_t *parser,
+              const uint8_t *buf, size_t size, size_t chunk_size)
+{
+    size_t  pos;
+
+    push_parser_activate(parser, NULL);
+
+    for (pos = 0; pos < size; pos += chunk_size)
+    {
+        size_t  this_size = size - pos;
+        if (this_size > chunk_size) this_size = chunk_size;
+
+        if (push_parser_submit_data(parser, buf + pos, this_size)
+            != PUSH_INCOMPLETE)
+            return false;
+    }
+
+    return (push_parser_eof(parser) == PUSH_SUCCESS);
+}
+
+
+/*
+ * Functions that summarize the message that a parser just read, so
+ * that we can make sure that all of the parsers agree.
+ */
+
+static person_t  runtime_person;
+static gen_person_t  generated_person;
+
+static uint64_t
+runtime_checksum(push_parser_t *parser)
+{
+    return runtime_person.id + runtime_person.dob +
+        runtime_person.name.current_size;
+}
+
+static uint64_t
+generated_checksum(push_parser_t *parser)
+{
+    return generated_person.id + generated_person.dob +
+        generated_person.name.current_size;
+}
+
+static uint64_t
+dynamic_checksum(push_parser_t *parser)
+{
+    const push_protobuf_dynamic_message_t  *person =
+        push_parser_result(parser, push_protobuf_dynamic_message_t);
+
+    /*
+     * The HWM buffers' sizes include a NUL terminator.
+     */
+
+    return person->fields[0].first->v.u32 +
+        person->fields[4].first->v.u64 +
+        person->fields[1].first->v.bytes.size + 1;
+}
+
+typedef uint64_t
+checksum_func_t(push_parser_t *parser);
+
+
+/**
+ * Parses every message in the corpus, returning the best time over
+ * all of the rounds.  The checksum of the parsed fields is stored in
+ * *checksum, so that we can make sure the parsers agree.
+ */
+
+static double
+parse_corpus(push_parser_t *parser,
+             const uint8_t *corpus, const size_t *offsets,
+             size_t chunk_size,
+             checksum_func_t *checksum_func, uint64_t *checksum)
+{
+    double  best = 1e9;
+    int  round;
+
+    for (round = 0; round < NUM_ROUNDS; round++)
+    {
+        double  start = now();
+        size_t  i;
+
+        *checksum = 0;
+
+        for (i = 0; i < NUM_PEOPLE; i++)
+        {
+            if (!parse_message(parser, corpus + offsets[i],
+                               offsets[i+1] - offsets[i], chunk_size))
+            {
+                fprintf(stderr, "Could not parse message %zu\n", i);
+                exit(EXIT_FAILURE);
+            }
+
+            *checksum += checksum_func(parser);
+        }
+
+        double  elapsed = now() - start;
+        if (elapsed < best) best = elapsed;
+    }
+
+    return best;
+}
+
+
+int
+main(int argc, const char **argv)
+{
+    static const size_t  chunk_sizes[] = { 4096, 16 };
+
+    uint8_t  *corpus = malloc(NUM_PEOPLE * 64);
+    size_t  *offsets = malloc((NUM_PEOPLE + 1) * sizeof(size_t));
+    push_protobuf_descriptor_pool_t  *pool;
+    push_parser_t  *runtime_parser;
+    push_parser_t  *generated_parser;
+    push_parser_t  *dynamic_parser;
+    size_t  i;
+    size_t  c;
+
+    if (corpus == NULL || offsets == NULL)
+        return EXIT_FAILURE;
+
+    offsets[0] = 0;
+    for (i = 0; i < NUM_PEOPLE; i++)
+        offsets[i+1] = offsets[i] + make_person(i + 1, corpus + offsets[i]);
+
+    person_init(&runtime_person);
+    gen_person_init(&generated_person);
+
+    pool = push_protobuf_descriptor_pool_new(NULL);
+    if ((pool == NULL) ||
+        !push_protobuf_descriptor_pool_load(pool, PERSON_DESCRIPTOR_SET,
+                                            PERSON_DESCRIPTOR_SET_LENGTH))
+    {
+        fprintf(stderr, "Could not load person.proto descriptors\n");
+        return EXIT_FAILURE;
+    }
+
+    runtime_parser = push_parser_new();
+    generated_parser = push_parser_new();
+    dynamic_parser = push_parser_new();
+    if (runtime_parser == NULL || generated_parser == NULL ||
+        dynamic_parser == NULL)
+        return EXIT_FAILURE;
+
+    push_parser_set_callback
+        (runtime_parser,
+         create_person_parser("person", runtime_parser, runtime_parser,
+                              &runtime_person));
+    push_parser_set_callback
+        (generated_parser,
+         gen_person_parser_new("person", generated_parser,
+                               generated_parser, &generated_person));
+    push_parser_set_callback
+        (dynamic_parser,
+         push_protobuf_dynamic_message_new
+         ("person", dynamic_parser, dynamic_parser, pool,
+          push_protobuf_descriptor_pool_find_message(pool, "Person")));
+
+    for (c = 0; c < sizeof(chunk_sizes) / sizeof(chunk_sizes[0]); c++)
+    {
+        static const char  *names[] =
+            { "field map", "generated", "dynamic" };
+        push_parser_t  *parsers[] =
+            { runtime_parser, generated_parser, dynamic_parser };
+        checksum_func_t  *checksum_funcs[] =
+            { runtime_checksum, generated_checksum, dynamic_checksum };
+        uint64_t  checksums[3];
+        size_t  p;
+
+        for (p = 0; p < 3; p++)
+        {
+            double  time = parse_corpus
+                (parsers[p], corpus, offsets, chunk_sizes[c],
+                 checksum_funcs[p], &checksums[p]);
+
+            if (checksums[p] != checksums[0])
+            {
+                fprintf(stderr, "Parsers don't agree\n");
+                return EXIT_FAILURE;
+            }
+
+            printf("chunk %-5zu  %-10s %7.1f MB/s %6.0f ns/msg\n",
+                   chunk_sizes[c], names[p],
+                   offsets[NUM_PEOPLE] / time / 1e6,
+                   time * 1e9 / NUM_PEOPLE);
+        }
+    }
+
+    push_parser_free(runtime_parser);
+    push_parser_free(generated_parser);
+    push_parser_free(dynamic_parser);
+    push_talloc_free(pool);
+    person_done(&runtime_person);
+    gen_person_done(&generated_person);
+    free(corpus);
+    free(offsets);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,489 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2010, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the LICENSE.txt file in this distribution for license
+ * details.
+ * ----------------------------------------------------------------------
+ */
+
+/*
+ * Measures how much a projection saves over parsing every field of a
+ * nested message with a dynamic message parser, at several
+ * selectivities.  Each projection's results are checked against the
+ * same fields of a full parse.
+ */
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <push/basics.h>
+#include <push/talloc.h>
+#include <push/protobuf/dynamic.h>
+
+
+#define NUM_RECORDS  (64 * 1024)
+#define NUM_ROUNDS  10
+
+
+/*-----------------------------------------------------------------------
+ * Corpus generation
+ */
+
+/*
+ * The output of protoc --descriptor_set_out for the following file:
+ *
+ *   syntax = "proto2";
+ *   package bench;
+ *
+ *   message Address
+ *   {
+ *       optional string street = 1;
+ *       optional string city = 2;
+ *       optional string zip = 3;
+ *   }
+ *
+ *   message Contact
+ *   {
+ *       optional string email = 1;
+ *       optional string phone = 2;
+ *       optional Address address = 3;
+ *   }
+ *
+ *   message Record
+ *   {
+ *       optional uint64 id = 1;
+ *       optional string name = 2;
+ *       optional Address home = 3;
+ *       optional Address work = 4;
+ *       optional Contact contact = 5;
+ *       repeated string tags = 6;
+ *       optional uint32 score = 7;
+ *   }
+ */
+
+static const uint8_t  RECORD_DESCRIPTOR_SET[] =
+    "\x0a\x8a\x03\x0a\x0c\x72\x65\x63\x6f\x72\x64\x2e"
+    "\x70\x72\x6f\x74\x6f\x12\x05\x62\x65\x6e\x63\x68"
+    "\x22\x47\x0a\x07\x41\x64\x64\x72\x65\x73\x73\x12"
+    "\x16\x0a\x06\x73\x74\x72\x65\x65\x74\x18\x01\x20"
+    "\x01\x28\x09\x52\x06\x73\x74\x72\x65\x65\x74\x12"
+    "\x12\x0a\x04\x63\x69\x74\x79\x18\x02\x20\x01\x28"
+    "\x09\x52\x04\x63\x69\x74\x79\x12\x10\x0a\x03\x7a"
+    "\x69\x70\x18\x03\x20\x01\x28\x09\x52\x03\x7a\x69"
+    "\x70\x22\x5f\x0a\x07\x43\x6f\x6e\x74\x61\x63\x74"
+    "\x12\x14\x0a\x05\x65\x6d\x61\x69\x6c\x18\x01\x20"
+    "\x01\x28\x09\x52\x05\x65\x6d\x61\x69\x6c\x12\x14"
+    "\x0a\x05\x70\x68\x6f\x6e\x65\x18\x02\x20\x01\x28"
+    "\x09\x52\x05\x70\x68\x6f\x6e\x65\x12\x28\x0a\x07"
+    "\x61\x64\x64\x72\x65\x73\x73\x18\x03\x20\x01\x28"
+    "\x0b\x32\x0e\x2e\x62\x65\x6e\x63\x68\x2e\x41\x64"
+    "\x64\x72\x65\x73\x73\x52\x07\x61\x64\x64\x72\x65"
+    "\x73\x73\x22\xc8\x01\x0a\x06\x52\x65\x63\x6f\x72"
+    "\x64\x12\x0e\x0a\x02\x69\x64\x18\x01\x20\x01\x28"
+    "\x04\x52\x02\x69\x64\x12\x12\x0a\x04\x6e\x61\x6d"
+    "\x65\x18\x02\x20\x01\x28\x09\x52\x04\x6e\x61\x6d"
+    "\x65\x12\x22\x0a\x04\x68\x6f\x6d\x65\x18\x03\x20"
+    "\x01\x28\x0b\x32\x0e\x2e\x62\x65\x6e\x63\x68\x2e"
+    "\x41\x64\x64\x72\x65\x73\x73\x52\x04\x68\x6f\x6d"
+    "\x65\x12\x22\x0a\x04\x77\x6f\x72\x6b\x18\x04\x20"
+    "\x01\x28\x0b\x32\x0e\x2e\x62\x65\x6e\x63\x68\x2e"
+    "\x41\x64\x64\x72\x65\x73\x73\x52\x04\x77\x6f\x72"
+    "\x6b\x12\x28\x0a\x07\x63\x6f\x6e\x74\x61\x63\x74"
+    "\x18\x05\x20\x01\x28\x0b\x32\x0e\x2e\x62\x65\x6e"
+    "\x63\x68\x2e\x43\x6f\x6e\x74\x61\x63\x74\x52\x07"
+    "\x63\x6f\x6e\x74\x61\x63\x74\x12\x12\x0a\x04\x74"
+    "\x61\x67\x73\x18\x06\x20\x03\x28\x09\x52\x04\x74"
+    "\x61\x67\x73\x12\x14\x0a\x05\x73\x63\x6f\x72\x65"
+    "\x18\x07\x20\x01\x28\x0d\x52\x05\x73\x63\x6f\x72"
+    "\x65";
+
+static const size_t  RECORD_DESCRIPTOR_SET_LENGTH = 397;
+
+
+static uint64_t  rng_state = 1;
+
+static uint64_t
+next_random()
+{
+    rng_state = rng_state * UINT64_C(6364136223846793005) +
+        UINT64_C(1442695040888963407);
+    return rng_state ^ (rng_state >> 29);
+}
+
+
+static size_t
+encode(uint64_t value, uint8_t *buf)
+{
+    size_t  length = 0;
+
+    while (value >= 0x80)
+    {
+        buf[length++] = (value & 0x7f) | 0x80;
+        value >>= 7;
+    }
+
+    buf[length++] = value;
+    return length;
+}
+
+
+/**
+ * Encodes a random string field, between min_length and max_length
+ * bytes long.
+ */
+
+static size_t
+make_string(uint8_t tag, size_t min_length, size_t max_length,
+            uint8_t *buf)
+{
+    size_t  size = 0;
+    size_t  length = min_length +
+        next_random() % (max_length - min_length + 1);
+    size_t  i;
+
+    buf[size++] = tag;
+    size += encode(length, buf + size);
+    for (i = 0; i < length; i++)
+        buf[size++] = 'a' + next_random() % 26;
+
+    return size;
+}
+
+
+/**
+ * Encodes a submessage field, given the encoded submessage.
+ */
+
+static size_t
+make_submessage(uint8_t tag, const uint8_t *message, size_t length,
+                uint8_t *buf)
+{
+    size_t  size = 0;
+
+    buf[size++] = tag;
+    size += encode(length, buf + size);
+    memcpy(buf + size, message, length);
+    return size + length;
+}
+
+
+static size_t
+make_address(uint8_t *buf)
+{
+    size_t  size = 0;
+
+    size += make_string(0x0a, 8, 40, buf + size);
+    size += make_string(0x12, 4, 16, buf + size);
+    size += make_string(0x1a, 5, 10, buf + size);
+    return size;
+}
+
+
+static size_t
+make_contact(uint8_t *buf)
+{
+    uint8_t  address[128];
+    size_t  size = 0;
+
+    size += make_string(0x0a, 10, 30, buf + size);
+    size += make_string(0x12, 10, 14, buf + size);
+    size += make_submessage(0x1a, address, make_address(address),
+                            buf + size);
+    return size;
+}
+
+
+/**
+ * Encodes a random Record message into buf, returning its length.
+ */
+
+static size_t
+make_record(uint64_t id, uint8_t *buf)
+{
+    uint8_t  sub[256];
+    size_t  size = 0;
+    size_t  tag_count = next_random() % 5;
+    size_t  i;
+
+    buf[size++] = 0x08;
+    size += encode(id, buf + size);
+    size += make_string(0x12, 4, 24, buf + size);
+    size += make_submessage(0x1a, sub, make_address(sub), buf + size);
+    size += make_submessage(0x22, sub, make_address(sub), buf + size);
+    size += make_submessage(0x2a, sub, make_contact(sub), buf + size);
+
+    for (i = 0; i < tag_count; i++)
+        size += make_string(0x32, 3, 12, buf + size);
+
+    buf[size++] = 0x38;
+    size += encode(next_random() % 1000, buf + size);
+
+    return size;
+}
+
+
+/*-----------------------------------------------------------------------
+ * Harness
+ */
+
+static double
+now()
+{
+    struct timespec  ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+static bool
+parse_message(push_parser_t *parser,
+              const uint8_t *buf, size_t size, size_t chunk_size)
+{
+    size_t  pos;
+
+    push_parser_activate(parser, NULL);
+
+    for (pos = 0; pos < size; pos += chunk_size)
+    {
+        size_t  this_size = size - pos;
+        if (this_size > chunk_size) this_size = chunk_size;
+
+        if (push_parser_submit_data(parser, buf + pos, this_size)
+            != PUSH_INCOMPLETE)
+            return false;
+    }
+
+    return (push_parser_eof(parser) == PUSH_SUCCESS);
+}
+
+
+/**
+ * Summarizes the fields of a parsed message that are also in the
+ * given message type, which is either the message's own type or a
+ * projection of it.
+ */
+
+static uint64_t
+checksum(const push_protobuf_dynamic_message_t *message,
+         const push_protobuf_message_descriptor_t *descriptor)
+{
+    uint64_t  result = 0;
+    size_t  i;
+
+    for (i = 0; i < descriptor->field_count; i++)
+    {
+        const push_protobuf_field_descriptor_t  *field =
+            &descriptor->fields[i];
+        const push_protobuf_dynamic_value_t  *value =
+            push_protobuf_dynamic_message_get_field
+            (message, field->number)->first;
+
+        for (; value != NULL; value = value->next)
+        {
+            switch (field->type)
+            {
+              case PUSH_PROTOBUF_TYPE_MESSAGE:
+                result += checksum(value->v.message,
+                                   field->message_type);
+                break;
+
+              case PUSH_PROTOBUF_TYPE_STRING:
+                result += value->v.bytes.size;
+                break;
+
+              case PUSH_PROTOBUF_TYPE_UINT32:
+                result += value->v.u32;
+                break;
+
+              default:
+                result += value->v.u64;
+                break;
+            }
+        }
+    }
+
+    return result;
+}
+
+
+/**
+ * Parses every message in the corpus, returning the best time over
+ * all of the rounds.
+ */
+
+static double
+parse_corpus(push_parser_t *parser,
+             const push_protobuf_message_descriptor_t *descriptor,
+             const uint8_t *corpus, const size_t *offsets,
+             size_t chunk_size, uint64_t *sum)
+{
+    double  best = 1e9;
+    int  round;
+
+    for (round = 0; round < NUM_ROUNDS; round++)
+    {
+        double  start = now();
+        size_t  i;
+
+        *sum = 0;
+
+        for (i = 0; i < NUM_RECORDS; i++)
+        {
+            if (!parse_message(parser, corpus + offsets[i],
+                               offsets[i+1] - offsets[i], chunk_size))
+            {
+                fprintf(stderr, "Could not parse message %zu\n", i);
+                exit(EXIT_FAILURE);
+            }
+
+            *sum += checksum(push_parser_result
+                             (parser, push_protobuf_dynamic_message_t),
+                             descriptor);
+        }
+
+        double  elapsed = now() - start;
+        if (elapsed < best) best = elapsed;
+    }
+
+    return best;
+}
+
+
+/*
+ * The projections that we measure, from least to most selective.
+ */
+
+static const char  *SOME_PATHS[] =
+    { "name", "home.zip", "work.zip", "contact.address.city", "score" };
+static const char  *ONE_PATH[] = { "home.zip" };
+static const char  *SCALAR_PATH[] = { "score" };
+
+static const struct
+{
+    const char  *name;
+    const char  **paths;
+    size_t  path_count;
+} PROJECTIONS[] =
+{
+    { "all fields", NULL, 0 },
+    { "5 paths", SOME_PATHS, 5 },
+    { "home.zip", ONE_PATH, 1 },
+    { "score", SCALAR_PATH, 1 },
+};
+
+#define NUM_PROJECTIONS  (sizeof(PROJECTIONS) / sizeof(PROJECTIONS[0]))
+
+
+int
+main(int argc, const char **argv)
+{
+    static const size_t  chunk_sizes[] = { 4096, 16 };
+
+    uint8_t  *corpus = malloc(NUM_RECORDS * 512);
+    size_t  *offsets = malloc((NUM_RECORDS + 1) * sizeof(size_t));
+    push_protobuf_descriptor_pool_t  *pool;
+    const push_protobuf_message_descriptor_t  *record;
+    const push_protobuf_message_descriptor_t  *descriptors[NUM_PROJECTIONS];
+    push_parser_t  *parsers[NUM_PROJECTIONS];
+    uint64_t  expected[NUM_PROJECTIONS];
+    size_t  i;
+    size_t  c;
+    size_t  p;
+
+    if (corpus == NULL || offsets == NULL)
+        return EXIT_FAILURE;
+
+    offsets[0] = 0;
+    for (i = 0; i < NUM_RECORDS; i++)
+        offsets[i+1] = offsets[i] + make_record(i + 1, corpus + offsets[i]);
+
+    pool = push_protobuf_descriptor_pool_new(NULL);
+    if ((pool == NULL) ||
+        !push_protobuf_descriptor_pool_load(pool, RECORD_DESCRIPTOR_SET,
+                                            RECORD_DESCRIPTOR_SET_LENGTH))
+    {
+        fprintf(stderr, "Could not load record.proto descriptors\n");
+        return EXIT_FAILURE;
+    }
+
+    record = push_protobuf_descriptor_pool_find_message(pool,
+                                                        "bench.Record");
+
+    for (p = 0; p < NUM_PROJECTIONS; p++)
+    {
+        descriptors[p] = (PROJECTIONS[p].paths == NULL)? record:
+            push_protobuf_descriptor_pool_project
+            (pool, record, PROJECTIONS[p].paths,
+             PROJECTIONS[p].path_count);
+
+        parsers[p] = push_parser_new();
+        if ((descriptors[p] == NULL) || (parsers[p] == NULL))
+            return EXIT_FAILURE;
+
+        push_parser_set_callback
+            (parsers[p],
+             push_protobuf_dynamic_message_new
+             ("record", parsers[p], parsers[p], pool, descriptors[p]));
+
+        expected[p] = 0;
+    }
+
+    /*
+     * Work out what each projection should find, using a full parse.
+     */
+
+    for (i = 0; i < NUM_RECORDS; i++)
+    {
+        const push_protobuf_dynamic_message_t  *message;
+
+        if (!parse_message(parsers[0], corpus + offsets[i],
+                           offsets[i+1] - offsets[i], 4096))
+        {
+            fprintf(stderr, "Could not parse message %zu\n", i);
+            return EXIT_FAILURE;
+        }
+
+        message = push_parser_result(parsers[0],
+                                     push_protobuf_dynamic_message_t);
+
+        for (p = 0; p < NUM_PROJECTIONS; p++)
+            expected[p] += checksum(message, descriptors[p]);
+    }
+
+    for (c = 0; c < sizeof(chunk_sizes) / sizeof(chunk_sizes[0]); c++)
+    {
+        for (p = 0; p < NUM_PROJECTIONS; p++)
+        {
+            uint64_t  sum;
+            double  time = parse_corpus
+                (parsers[p], descriptors[p], corpus, offsets,
+                 chunk_sizes[c], &sum);
+
+            if (sum != expected[p])
+            {
+                fprintf(stderr, "Projection %s doesn't match\n",
+                        PROJECTIONS[p].name);
+                return EXIT_FAILURE;
+            }
+
+            printf("chunk %-5zu  %-10s %7.1f MB/s %6.0f ns/msg\n",
+                   chunk_sizes[c], PROJECTIONS[p].name,
+                   offsets[NUM_RECORDS] / time / 1e6,
+                   time * 1e9 / NUM_RECORDS);
+        }
+    }
+
+    for (p = 0; p < NUM_PROJECTIONS; p++)
+        push_parser_free(parsers[p]);
+
+    push_talloc_free(pool);
+    free(corpus);
+    free(offsets);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,155 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2010, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the LICENSE.txt file in this distribution for license
+ * details.
+ * ----------------------------------------------------------------------
+ */
+
+/*
+ * Measures field dispatch: looking up each field of a message, in
+ * order, in a field map with 5, 50, or 500 fields.  The "dense"
+ * messages number their fields from 1; the "sparse" messages space
+ * them 1000 apart.  A linear scan, like the field map used to do, is
+ * included for comparison.
+ */
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <push/basics.h>
+#include <push/primitives.h>
+#include <push/talloc.h>
+
+#include <push/protobuf/basics.h>
+#include <push/protobuf/field-map.h>
+
+
+#define NUM_LOOKUPS  (4 * 1024 * 1024)
+#define NUM_ROUNDS  10
+#define MAX_FIELDS  500
+
+
+/*-----------------------------------------------------------------------
+ * Harness
+ */
+
+static double
+now()
+{
+    struct timespec  ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+static push_protobuf_tag_number_t  numbers[MAX_FIELDS];
+static push_callback_t  *callbacks[MAX_FIELDS];
+
+
+static push_callback_t *
+linear_lookup(size_t num_fields, push_protobuf_tag_number_t field_number)
+{
+    size_t  i;
+
+    for (i = 0; i < num_fields; i++)
+    {
+        if (numbers[i] == field_number)
+            return callbacks[i];
+    }
+
+    return NULL;
+}
+
+
+static void
+bench(const char *layout, size_t num_fields,
+      push_protobuf_tag_number_t spacing)
+{
+    push_parser_t  *parser;
+    push_protobuf_field_map_t  *field_map;
+    double  best_map = 1e9;
+    double  best_linear = 1e9;
+    int  round;
+    size_t  i;
+
+    parser = push_parser_new();
+    field_map = push_protobuf_field_map_new(parser);
+    if (parser == NULL || field_map == NULL)
+        exit(EXIT_FAILURE);
+
+    for (i = 0; i < num_fields; i++)
+    {
+        push_callback_t  *value = push_noop_new(NULL, field_map, parser);
+
+        numbers[i] = 1 + i * spacing;
+        if (!push_protobuf_field_map_add_field
+            (NULL, parser, field_map, numbers[i],
+             PUSH_PROTOBUF_TAG_TYPE_VARINT, value))
+            exit(EXIT_FAILURE);
+
+        callbacks[i] =
+            push_protobuf_field_map_get_field(field_map, numbers[i]);
+    }
+
+    for (round = 0; round < NUM_ROUNDS; round++)
+    {
+        double  start;
+        double  elapsed;
+        size_t  found = 0;
+
+        start = now();
+        for (i = 0; i < NUM_LOOKUPS; i++)
+        {
+            if (push_protobuf_field_map_get_field
+                (field_map, numbers[i % num_fields])
+                == callbacks[i % num_fields])
+                found++;
+        }
+        elapsed = now() - start;
+        if (found != NUM_LOOKUPS) exit(EXIT_FAILURE);
+        if (elapsed < best_map) best_map = elapsed;
+
+        found = 0;
+        start = now();
+        for (i = 0; i < NUM_LOOKUPS; i++)
+        {
+            if (linear_lookup(num_fields, numbers[i % num_fields])
+                == callbacks[i % num_fields])
+                found++;
+        }
+        elapsed = now() - start;
+        if (found != NUM_LOOKUPS) exit(EXIT_FAILURE);
+        if (elapsed < best_linear) best_linear = elapsed;
+    }
+
+    printf("%-6s %3zu fields  field map %6.2f ns/lookup"
+           "  linear %7.2f ns/lookup\n",
+           layout, num_fields,
+           best_map * 1e9 / NUM_LOOKUPS,
+           best_linear * 1e9 / NUM_LOOKUPS);
+
+    push_parser_free(parser);
+}
+
+
+int
+main(int argc, const char **argv)
+{
+    static const size_t  sizes[] = { 5, 50, 500 };
+    size_t  s;
+
+    for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+        bench("dense", sizes[s], 1);
+
+    for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+        bench("sparse", sizes[s], 1000);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,286 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2010, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the LICENSE.txt file in this distribution for license
+ * details.
+ * ----------------------------------------------------------------------
+ */
+
+/*
+ * Measures how quickly a message parser gets through nested
+ * submessages.  The outer message is a long run of submessage fields,
+ * each of which contains a small submessage of its own, so most of
+ * the work is in reading length prefixes and entering and leaving
+ * submessages.
+ */
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <push/basics.h>
+#include <push/talloc.h>
+
+#include <push/protobuf/basics.h>
+#include <push/protobuf/field-map.h>
+#include <push/protobuf/message.h>
+#include <push/protobuf/primitives.h>
+
+
+#define NUM_MESSAGES  (128 * 1024)
+#define NUM_ROUNDS    20
+
+
+/*-----------------------------------------------------------------------
+ * Our data type
+ */
+
+typedef struct _leaf
+{
+    uint32_t  id;
+    uint64_t  value;
+} leaf_t;
+
+typedef struct _inner
+{
+    uint32_t  id;
+    leaf_t  leaf;
+} inner_t;
+
+typedef struct _data
+{
+    uint32_t  id;
+    inner_t  inner;
+} data_t;
+
+
+static push_callback_t *
+create_leaf_message(void *parent, push_parser_t *parser, leaf_t *dest)
+{
+    push_protobuf_field_map_t  *field_map;
+
+    field_map = push_protobuf_field_map_new(parent);
+    if (field_map == NULL ||
+        !push_protobuf_assign_uint32("leaf", "id", parent, parser,
+                                     field_map, 1, &dest->id) ||
+        !push_protobuf_assign_uint64("leaf", "value", parent, parser,
+                                     field_map, 2, &dest->value))
+        return NULL;
+
+    return push_protobuf_message_new("leaf", parent, parser, field_map);
+}
+
+
+static push_callback_t *
+create_inner_message(void *parent, push_parser_t *parser, inner_t *dest)
+{
+    push_protobuf_field_map_t  *field_map;
+    push_callback_t  *leaf;
+
+    field_map = push_protobuf_field_map_new(parent);
+    leaf = create_leaf_message(parent, parser, &dest->leaf);
+
+    if (field_map == NULL || leaf == NULL ||
+        !push_protobuf_assign_uint32("inner", "id", parent, parser,
+                                     field_map, 1, &dest->id) ||
+        !push_protobuf_add_submessage("inner", "leaf", parent, parser,
+                                      field_map, 2, leaf))
+        return NULL;
+
+    return push_protobuf_message_new("inner", parent, parser, field_map);
+}
+
+
+static push_callback_t *
+create_data_message(void *parent, push_parser_t *parser, data_t *dest)
+{
+    push_protobuf_field_map_t  *field_map;
+    push_callback_t  *inner;
+
+    field_map = push_protobuf_field_map_new(parent);
+    inner = create_inner_message(parent, parser, &dest->inner);
+
+    if (field_map == NULL || inner == NULL ||
+        !push_protobuf_assign_uint32("data", "id", parent, parser,
+                                     field_map, 1, &dest->id) ||
+        !push_protobuf_add_submessage("data", "inner", parent, parser,
+                                      field_map, 2, inner))
+        return NULL;
+
+    return push_protobuf_message_new("data", parent, parser, field_map);
+}
+
+
+/*-----------------------------------------------------------------------
+ * Data generation
+ */
+
+static size_t
+encode(uint64_t value, uint8_t *buf)
+{
+    size_t  length = 0;
+
+    while (value >= 0x80)
+    {
+        buf[length++] = (value & 0x7f) | 0x80;
+        value >>= 7;
+    }
+
+    buf[length++] = value;
+    return length;
+}
+
+
+/**
+ * Fills in a message with NUM_MESSAGES inner submessages, each
+ * containing a leaf submessage, followed by the field 1 = 42.
+ * Returns the size of the message.
+ */
+
+static size_t
+make_message(uint8_t *buf)
+{
+    size_t  size = 0;
+    size_t  i;
+
+    for (i = 0; i < NUM_MESSAGES; i++)
+    {
+        uint8_t  leaf[32];
+        size_t  leaf_size = 0;
+        uint8_t  inner[48];
+        size_t  inner_size = 0;
+
+        leaf[leaf_size++] = 0x08;
+        leaf_size += encode(i, leaf + leaf_size);
+        leaf[leaf_size++] = 0x10;
+        leaf_size += encode(UINT64_C(1) << (7 * (i % 9)),
+                            leaf + leaf_size);
+
+        inner[inner_size++] = 0x08;
+        inner_size += encode(i % 128, inner + inner_size);
+        inner[inner_size++] = 0x12;
+        inner_size += encode(leaf_size, inner + inner_size);
+        memcpy(inner + inner_size, leaf, leaf_size);
+        inner_size += leaf_size;
+
+        buf[size++] = 0x12;
+        size += encode(inner_size, buf + size);
+        memcpy(buf + size, inner, inner_size);
+        size += inner_size;
+    }
+
+    buf[size++] = 0x08;
+    buf[size++] = 0x2a;
+    return size;
+}
+
+
+/*-----------------------------------------------------------------------
+ * Harness
+ */
+
+static double
+now()
+{
+    struct timespec  ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+/**
+ * Parses the message, handing it to the parser in chunks of the
+ * given size.
+ */
+
+static double
+parse_message(push_parser_t *parser, data_t *actual,
+              const uint8_t *buf, size_t size, size_t chunk_size)
+{
+    double  start = now();
+    size_t  pos;
+
+    memset(actual, 0, sizeof(data_t));
+    push_parser_activate(parser, NULL);
+
+    for (pos = 0; pos < size; pos += chunk_size)
+    {
+        size_t  this_size = size - pos;
+        if (this_size > chunk_size) this_size = chunk_size;
+
+        if (push_parser_submit_data(parser, buf + pos, this_size)
+            != PUSH_INCOMPLETE)
+            return -1.0;
+    }
+
+    if (push_parser_eof(parser) != PUSH_SUCCESS)
+        return -1.0;
+
+    return now() - start;
+}
+
+
+static void
+bench(uint8_t *buf, size_t chunk_size)
+{
+    push_parser_t  *parser;
+    push_callback_t  *callback;
+    data_t  actual;
+    size_t  size;
+    double  best = 1e9;
+    int  round;
+
+    parser = push_parser_new();
+    if (parser == NULL)
+        exit(EXIT_FAILURE);
+
+    callback = create_data_message(parser, parser, &actual);
+    if (callback == NULL)
+        exit(EXIT_FAILURE);
+
+    push_parser_set_callback(parser, callback);
+    size = make_message(buf);
+
+    for (round = 0; round < NUM_ROUNDS; round++)
+    {
+        double  elapsed =
+            parse_message(parser, &actual, buf, size, chunk_size);
+
+        if (elapsed < 0 || actual.id != 42 ||
+            actual.inner.leaf.id != NUM_MESSAGES - 1)
+        {
+            fprintf(stderr, "nested: could not parse message\n");
+            exit(EXIT_FAILURE);
+        }
+
+        if (elapsed < best) best = elapsed;
+    }
+
+    printf("nested   chunk %-6zu %7.2f ns/message %8.1f MB/s\n",
+           chunk_size,
+           best * 1e9 / NUM_MESSAGES, size / best / 1e6);
+
+    push_parser_free(parser);
+}
+
+
+int
+main(int argc, const char **argv)
+{
+    uint8_t  *buf = malloc(NUM_MESSAGES * 32);
+
+    if (buf == NULL)
+        return EXIT_FAILURE;
+
+    bench(buf, 65536);
+    bench(buf, 4096);
+    bench(buf, 64);
+
+    free(buf);
+    return EXIT_SUCCESS;
+}
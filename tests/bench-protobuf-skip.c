@@ -0,0 +1,240 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2010, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the LICENSE.txt file in this distribution for license
+ * details.
+ * ----------------------------------------------------------------------
+ */
+
+/*
+ * Measures how quickly a message parser gets through fields that it
+ * doesn't know about.  Each message has a single known field; the
+ * rest of the message is unknown fields of a single wire type.
+ */
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <push/basics.h>
+#include <push/talloc.h>
+
+#include <push/protobuf/basics.h>
+#include <push/protobuf/field-map.h>
+#include <push/protobuf/message.h>
+#include <push/protobuf/primitives.h>
+
+
+#define NUM_FIELDS  (256 * 1024)
+#define NUM_ROUNDS  20
+
+
+/*-----------------------------------------------------------------------
+ * Data generation
+ */
+
+static size_t
+encode(uint64_t value, uint8_t *buf)
+{
+    size_t  length = 0;
+
+    while (value >= 0x80)
+    {
+        buf[length++] = (value & 0x7f) | 0x80;
+        value >>= 7;
+    }
+
+    buf[length++] = value;
+    return length;
+}
+
+
+/**
+ * Fills in a message with NUM_FIELDS unknown fields of the given wire
+ * type, followed by the known field 1 = 42.  Returns the size of the
+ * message.
+ */
+
+static size_t
+make_message(push_protobuf_tag_type_t type, uint8_t *buf)
+{
+    size_t  size = 0;
+    size_t  i;
+
+    for (i = 0; i < NUM_FIELDS; i++)
+    {
+        push_protobuf_tag_number_t  number = 2 + (i % 1000);
+
+        size += encode(PUSH_PROTOBUF_MAKE_TAG(number, type), buf + size);
+
+        switch (type)
+        {
+          case PUSH_PROTOBUF_TAG_TYPE_VARINT:
+            size += encode(UINT64_C(1) << (7 * (i % 9)), buf + size);
+            break;
+
+          case PUSH_PROTOBUF_TAG_TYPE_FIXED64:
+            memset(buf + size, 0xab, 8);
+            size += 8;
+            break;
+
+          case PUSH_PROTOBUF_TAG_TYPE_LENGTH_DELIMITED:
+            size += encode(i % 32, buf + size);
+            memset(buf + size, 'x', i % 32);
+            size += i % 32;
+            break;
+
+          case PUSH_PROTOBUF_TAG_TYPE_START_GROUP:
+            buf[size++] = 0x08;     /* field 1, varint */
+            buf[size++] = 0x01;
+            size += encode(PUSH_PROTOBUF_MAKE_TAG
+                           (number, PUSH_PROTOBUF_TAG_TYPE_END_GROUP),
+                           buf + size);
+            break;
+
+          case PUSH_PROTOBUF_TAG_TYPE_FIXED32:
+            memset(buf + size, 0xab, 4);
+            size += 4;
+            break;
+
+          default:
+            break;
+        }
+    }
+
+    buf[size++] = 0x08;
+    buf[size++] = 0x2a;
+    return size;
+}
+
+
+/*-----------------------------------------------------------------------
+ * Harness
+ */
+
+static double
+now()
+{
+    struct timespec  ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+/**
+ * Parses the message, handing it to the parser in chunks of the
+ * given size.
+ */
+
+static double
+parse_message(push_parser_t *parser, uint32_t *actual,
+              const uint8_t *buf, size_t size, size_t chunk_size)
+{
+    double  start = now();
+    size_t  pos;
+
+    *actual = 0;
+    push_parser_activate(parser, NULL);
+
+    for (pos = 0; pos < size; pos += chunk_size)
+    {
+        size_t  this_size = size - pos;
+        if (this_size > chunk_size) this_size = chunk_size;
+
+        if (push_parser_submit_data(parser, buf + pos, this_size)
+            != PUSH_INCOMPLETE)
+            return -1.0;
+    }
+
+    if (push_parser_eof(parser) != PUSH_SUCCESS)
+        return -1.0;
+
+    return now() - start;
+}
+
+
+static void
+bench(const char *type_name, push_protobuf_tag_type_t type,
+      uint8_t *buf, size_t chunk_size)
+{
+    push_parser_t  *parser;
+    push_protobuf_field_map_t  *field_map;
+    push_callback_t  *callback;
+    uint32_t  actual;
+    size_t  size;
+    double  best = 1e9;
+    int  round;
+
+    parser = push_parser_new();
+    field_map = push_protobuf_field_map_new(parser);
+    if (parser == NULL || field_map == NULL ||
+        !push_protobuf_assign_uint32("bench", "known", parser, parser,
+                                     field_map, 1, &actual))
+        exit(EXIT_FAILURE);
+
+    callback = push_protobuf_message_new("bench", parser, parser,
+                                         field_map);
+    if (callback == NULL)
+        exit(EXIT_FAILURE);
+
+    push_parser_set_callback(parser, callback);
+    size = make_message(type, buf);
+
+    for (round = 0; round < NUM_ROUNDS; round++)
+    {
+        double  elapsed =
+            parse_message(parser, &actual, buf, size, chunk_size);
+
+        if (elapsed < 0 || actual != 42)
+        {
+            fprintf(stderr, "%s: could not parse message\n", type_name);
+            exit(EXIT_FAILURE);
+        }
+
+        if (elapsed < best) best = elapsed;
+    }
+
+    printf("%-8s chunk %-6zu %7.2f ns/field %8.1f MB/s\n",
+           type_name, chunk_size,
+           best * 1e9 / NUM_FIELDS, size / best / 1e6);
+
+    push_parser_free(parser);
+}
+
+
+int
+main(int argc, const char **argv)
+{
+    static const struct
+    {
+        const char  *name;
+        push_protobuf_tag_type_t  type;
+    } types[] =
+    {
+        { "varint", PUSH_PROTOBUF_TAG_TYPE_VARINT },
+        { "fixed32", PUSH_PROTOBUF_TAG_TYPE_FIXED32 },
+        { "fixed64", PUSH_PROTOBUF_TAG_TYPE_FIXED64 },
+        { "bytes", PUSH_PROTOBUF_TAG_TYPE_LENGTH_DELIMITED },
+        { "group", PUSH_PROTOBUF_TAG_TYPE_START_GROUP },
+    };
+
+    uint8_t  *buf = malloc(NUM_FIELDS * 48);
+    size_t  t;
+
+    if (buf == NULL)
+        return EXIT_FAILURE;
+
+    for (t = 0; t < sizeof(types) / sizeof(types[0]); t++)
+    {
+        bench(types[t].name, types[t].type, buf, 4096);
+        bench(types[t].name, types[t].type, buf, 64);
+    }
+
+    free(buf);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,287 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2010, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the LICENSE.txt file in this distribution for license
+ * details.
+ * ----------------------------------------------------------------------
+ */
+
+/*
+ * Compares the byte-at-a-time varint decoder against the
+ * word-at-a-time kernels in push/protobuf/varint.h, over a few
+ * distributions of value sizes.
+ */
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <push/protobuf/basics.h>
+#include <push/protobuf/varint.h>
+
+
+#define NUM_VALUES  (1024 * 1024)
+#define NUM_ROUNDS  20
+
+
+/*-----------------------------------------------------------------------
+ * Data generation
+ */
+
+static uint64_t  rng_state = 1;
+
+static uint64_t
+next_random()
+{
+    rng_state = rng_state * UINT64_C(6364136223846793005) +
+        UINT64_C(1442695040888963407);
+    return rng_state ^ (rng_state >> 29);
+}
+
+
+/**
+ * Returns a value whose varint encoding has the given number of
+ * bytes.
+ */
+
+static uint64_t
+value_with_length(size_t length)
+{
+    uint64_t  value = next_random();
+    if (length < 10)
+    {
+        uint64_t  max = UINT64_C(1) << (7 * length);
+        uint64_t  min = (length == 1)? 0: (UINT64_C(1) << (7 * (length-1)));
+        value = min + value % (max - min);
+    } else {
+        value |= UINT64_C(1) << 63;
+    }
+    return value;
+}
+
+
+/**
+ * Field tags, booleans, and enums: everything fits in one byte.
+ */
+
+static uint64_t
+dist_small()
+{
+    return value_with_length(1);
+}
+
+
+/**
+ * A mix that resembles a typical record: mostly one- and two-byte
+ * values, some lengths and counters, and an occasional 64-bit ID or
+ * negative int32.
+ */
+
+static uint64_t
+dist_mixed()
+{
+    uint64_t  r = next_random() % 100;
+    if (r < 55) return value_with_length(1);
+    if (r < 80) return value_with_length(2);
+    if (r < 90) return value_with_length(3);
+    if (r < 95) return value_with_length(4);
+    if (r < 98) return value_with_length(5 + next_random() % 4);
+    return value_with_length(10);
+}
+
+
+/**
+ * Hashes and IDs spread over the full 64-bit range.
+ */
+
+static uint64_t
+dist_large()
+{
+    return value_with_length(1 + next_random() % 10);
+}
+
+
+static size_t
+encode(uint64_t value, uint8_t *buf)
+{
+    size_t  length = 0;
+
+    while (value >= 0x80)
+    {
+        buf[length++] = (value & 0x7f) | 0x80;
+        value >>= 7;
+    }
+
+    buf[length++] = value;
+    return length;
+}
+
+
+/*-----------------------------------------------------------------------
+ * Decoders
+ */
+
+/**
+ * The byte-at-a-time loop from the varint64 fast path.
+ */
+
+static size_t
+decode_bytewise(const uint8_t *buf, uint64_t *value)
+{
+    uint32_t  part0 = 0;
+    uint32_t  part1 = 0;
+    uint32_t  part2 = 0;
+    const uint8_t  *ptr = buf;
+    uint8_t  b;
+
+    b = *(ptr++); part0  = (b & 0x7F)      ; if (!(b & 0x80)) goto done;
+    b = *(ptr++); part0 |= (b & 0x7F) <<  7; if (!(b & 0x80)) goto done;
+    b = *(ptr++); part0 |= (b & 0x7F) << 14; if (!(b & 0x80)) goto done;
+    b = *(ptr++); part0 |= (b & 0x7F) << 21; if (!(b & 0x80)) goto done;
+    b = *(ptr++); part1  = (b & 0x7F)      ; if (!(b & 0x80)) goto done;
+    b = *(ptr++); part1 |= (b & 0x7F) <<  7; if (!(b & 0x80)) goto done;
+    b = *(ptr++); part1 |= (b & 0x7F) << 14; if (!(b & 0x80)) goto done;
+    b = *(ptr++); part1 |= (b & 0x7F) << 21; if (!(b & 0x80)) goto done;
+    b = *(ptr++); part2  = (b & 0x7F)      ; if (!(b & 0x80)) goto done;
+    b = *(ptr++); part2 |= (b & 0x7F) <<  7; if (!(b & 0x80)) goto done;
+    return 0;
+
+  done:
+    *value =
+        (((uint64_t) part0)      ) |
+        (((uint64_t) part1) << 28) |
+        (((uint64_t) part2) << 56);
+    return ptr - buf;
+}
+
+
+static uint64_t
+run_bytewise(const uint8_t *buf, size_t size, uint64_t *values)
+{
+    size_t  pos = 0;
+    size_t  count = 0;
+
+    while (pos < size)
+        pos += decode_bytewise(buf + pos, &values[count++]);
+
+    return count;
+}
+
+
+static uint64_t
+run_word(const uint8_t *buf, size_t size, uint64_t *values)
+{
+    size_t  pos = 0;
+    size_t  count = 0;
+
+    while (pos < size)
+        pos += push_protobuf_varint_decode(buf + pos, &values[count++]);
+
+    return count;
+}
+
+
+/*-----------------------------------------------------------------------
+ * Harness
+ */
+
+typedef uint64_t run_func_t(const uint8_t *buf, size_t size,
+                            uint64_t *values);
+
+static double
+now()
+{
+    struct timespec  ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+static void
+bench(const char *dist_name, const char *decoder_name,
+      run_func_t *run, const uint8_t *buf, size_t size,
+      uint64_t *values, const uint64_t *expected)
+{
+    double  best = 1e9;
+    int  round;
+
+    for (round = 0; round < NUM_ROUNDS; round++)
+    {
+        double  start = now();
+        uint64_t  count = run(buf, size, values);
+        double  elapsed = now() - start;
+
+        if (count != NUM_VALUES ||
+            memcmp(values, expected, NUM_VALUES * sizeof(uint64_t)) != 0)
+        {
+            fprintf(stderr, "%s/%s: decoded values don't match\n",
+                    dist_name, decoder_name);
+            exit(EXIT_FAILURE);
+        }
+
+        if (elapsed < best) best = elapsed;
+    }
+
+    printf("%-8s %-10s %7.2f ns/value %8.1f MB/s\n",
+           dist_name, decoder_name,
+           best * 1e9 / NUM_VALUES, size / best / 1e6);
+}
+
+
+int
+main(int argc, const char **argv)
+{
+    static const struct
+    {
+        const char  *name;
+        uint64_t  (*next)();
+    } dists[] =
+    {
+        { "small", dist_small },
+        { "mixed", dist_mixed },
+        { "large", dist_large },
+    };
+
+    uint64_t  *expected = malloc(NUM_VALUES * sizeof(uint64_t));
+    uint64_t  *values = malloc(NUM_VALUES * sizeof(uint64_t));
+    uint8_t  *buf = malloc(NUM_VALUES * PUSH_PROTOBUF_MAX_VARINT_LENGTH
+                           + PUSH_PROTOBUF_MAX_VARINT_LENGTH);
+    size_t  i;
+    size_t  d;
+
+    if (expected == NULL || values == NULL || buf == NULL)
+        return EXIT_FAILURE;
+
+    for (d = 0; d < sizeof(dists) / sizeof(dists[0]); d++)
+    {
+        size_t  size = 0;
+
+        for (i = 0; i < NUM_VALUES; i++)
+        {
+            expected[i] = dists[d].next();
+            size += encode(expected[i], buf + size);
+        }
+
+        /*
+         * Pad the buffer so that the single-value decoders can read
+         * past the last varint.
+         */
+
+        memset(buf + size, 0, PUSH_PROTOBUF_MAX_VARINT_LENGTH);
+
+        bench(dists[d].name, "bytewise", run_bytewise,
+              buf, size, values, expected);
+        bench(dists[d].name, "word", run_word,
+              buf, size, values, expected);
+    }
+
+    free(expected);
+    free(values);
+    free(buf);
+    return EXIT_SUCCESS;
+}
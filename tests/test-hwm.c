@@ -170,6 +170,152 @@ START_TEST(test_hwm_string_03)
 END_TEST
 
 
+START_TEST(test_hwm_view_01)
+{
+    push_parser_t  *parser;
+    push_callback_t  *callback;
+    hwm_buffer_t  buf;
+    push_string_view_t  *result;
+    size_t  bytes_to_read = 5;
+
+    PUSH_DEBUG_MSG("---\nStarting test_hwm_view_01\n");
+
+    /*
+     * Read five bytes, and provide 7 bytes in a single chunk.  This
+     * should succeed without copying.
+     */
+
+    hwm_buffer_init(&buf);
+
+    parser = push_parser_new();
+    fail_if(parser == NULL,
+            "Could not allocate a new push parser");
+
+    callback = push_hwm_string_view_new("hwm", NULL, parser, &buf);
+    fail_if(callback == NULL,
+            "Could not allocate a new HWM-string callback");
+
+    push_parser_set_callback(parser, callback);
+
+    fail_unless(push_parser_activate(parser, &bytes_to_read)
+                == PUSH_INCOMPLETE,
+                "Could not activate parser");
+
+    fail_unless(push_parser_submit_data
+                (parser, &DATA_01, 7) == PUSH_SUCCESS,
+                "Could not parse data");
+
+    result = push_parser_result(parser, push_string_view_t);
+    fail_unless(result->size == bytes_to_read,
+                "Size doesn't match (got %zu, expected %zu)",
+                result->size, bytes_to_read);
+    fail_if(result->copied,
+            "Contiguous string shouldn't be copied");
+    fail_unless(result->buf == (const void *) &DATA_01,
+                "View should point into the data chunk");
+
+    push_parser_free(parser);
+    hwm_buffer_done(&buf);
+}
+END_TEST
+
+
+START_TEST(test_hwm_view_02)
+{
+    push_parser_t  *parser;
+    push_callback_t  *callback;
+    hwm_buffer_t  buf;
+    push_string_view_t  *result;
+    size_t  bytes_to_read = 5;
+
+    PUSH_DEBUG_MSG("---\nStarting test_hwm_view_02\n");
+
+    /*
+     * Read five bytes, providing them in two chunks.  This should
+     * succeed, copying the string into the HWM buffer.
+     */
+
+    hwm_buffer_init(&buf);
+
+    parser = push_parser_new();
+    fail_if(parser == NULL,
+            "Could not allocate a new push parser");
+
+    callback = push_hwm_string_view_new("hwm", NULL, parser, &buf);
+    fail_if(callback == NULL,
+            "Could not allocate a new HWM-string callback");
+
+    push_parser_set_callback(parser, callback);
+
+    fail_unless(push_parser_activate(parser, &bytes_to_read)
+                == PUSH_INCOMPLETE,
+                "Could not activate parser");
+
+    fail_unless(push_parser_submit_data
+                (parser, &DATA_01, 2) == PUSH_INCOMPLETE,
+                "Could not parse data");
+
+    fail_unless(push_parser_submit_data
+                (parser, &DATA_01[2], 5) == PUSH_SUCCESS,
+                "Could not parse data");
+
+    result = push_parser_result(parser, push_string_view_t);
+    fail_unless(result->size == bytes_to_read,
+                "Size doesn't match (got %zu, expected %zu)",
+                result->size, bytes_to_read);
+    fail_unless(result->copied,
+                "Split string should be copied");
+    fail_unless(memcmp(result->buf, "12345", 6) == 0,
+                "Data doesn't match");
+
+    push_parser_free(parser);
+    hwm_buffer_done(&buf);
+}
+END_TEST
+
+
+START_TEST(test_hwm_view_03)
+{
+    push_parser_t  *parser;
+    push_callback_t  *callback;
+    hwm_buffer_t  buf;
+    size_t  bytes_to_read = 5;
+
+    PUSH_DEBUG_MSG("---\nStarting test_hwm_view_03\n");
+
+    /*
+     * Read five bytes, and provide 3 bytes.  This should fail.
+     */
+
+    hwm_buffer_init(&buf);
+
+    parser = push_parser_new();
+    fail_if(parser == NULL,
+            "Could not allocate a new push parser");
+
+    callback = push_hwm_string_view_new("hwm", NULL, parser, &buf);
+    fail_if(callback == NULL,
+            "Could not allocate a new HWM-string callback");
+
+    push_parser_set_callback(parser, callback);
+
+    fail_unless(push_parser_activate(parser, &bytes_to_read)
+                == PUSH_INCOMPLETE,
+                "Could not activate parser");
+
+    fail_unless(push_parser_submit_data
+                (parser, &DATA_01, 3) == PUSH_INCOMPLETE,
+                "Could not parse data");
+
+    fail_unless(push_parser_eof(parser) == PUSH_PARSE_ERROR,
+                "Should get parse error at EOF");
+
+    push_parser_free(parser);
+    hwm_buffer_done(&buf);
+}
+END_TEST
+
+
 /*-----------------------------------------------------------------------
  * Testing harness
  */
@@ -183,6 +329,9 @@ test_suite()
     tcase_add_test(tc, test_hwm_string_01);
     tcase_add_test(tc, test_hwm_string_02);
     tcase_add_test(tc, test_hwm_string_03);
+    tcase_add_test(tc, test_hwm_view_01);
+    tcase_add_test(tc, test_hwm_view_02);
+    tcase_add_test(tc, test_hwm_view_03);
     suite_add_tcase(s, tc);
 
     return s;
@@ -0,0 +1,273 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2010, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the LICENSE.txt file in this distribution for license
+ * details.
+ * ----------------------------------------------------------------------
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <check.h>
+#include <hwm-buffer.h>
+
+#include <push/basics.h>
+#include <push/intern.h>
+#include <push/talloc.h>
+
+
+/*-----------------------------------------------------------------------
+ * Sample data
+ */
+
+const uint8_t  DATA_01[] = "alicebobalice";
+
+
+/*-----------------------------------------------------------------------
+ * Helper functions
+ */
+
+static const char *
+parse_interned(push_intern_table_t *table,
+               hwm_buffer_t *buf,
+               const void *data,
+               size_t size,
+               size_t chunk_size)
+{
+    push_parser_t  *parser;
+    push_callback_t  *callback;
+    const char  *result = NULL;
+    size_t  bytes_to_read = size;
+    size_t  offset;
+
+    parser = push_parser_new();
+    if (parser == NULL) return NULL;
+
+    callback = push_interned_string_new("interned", NULL, parser,
+                                        buf, table);
+    if (callback == NULL) goto done;
+
+    push_parser_set_callback(parser, callback);
+
+    if (push_parser_activate(parser, &bytes_to_read)
+        != PUSH_INCOMPLETE)
+        goto done;
+
+    for (offset = 0; offset < size; offset += chunk_size)
+    {
+        size_t  this_size = size - offset;
+        if (this_size > chunk_size) this_size = chunk_size;
+
+        if (push_parser_submit_data
+            (parser, data + offset, this_size) == PUSH_PARSE_ERROR)
+            goto done;
+    }
+
+    if (push_parser_eof(parser) != PUSH_SUCCESS)
+        goto done;
+
+    result = push_parser_result(parser, const char);
+
+  done:
+    push_parser_free(parser);
+    return result;
+}
+
+
+/*-----------------------------------------------------------------------
+ * Test cases
+ */
+
+
+START_TEST(test_intern_table_01)
+{
+    push_intern_table_t  *table;
+    const char  *s1;
+    const char  *s2;
+    const char  *s3;
+
+    PUSH_DEBUG_MSG("---\nStarting test_intern_table_01\n");
+
+    /*
+     * Repeated lookups of the same value return the same pointer.
+     */
+
+    table = push_intern_table_new(NULL, 4);
+    fail_if(table == NULL,
+            "Could not allocate a new interning table");
+
+    s1 = push_intern_table_lookup(table, DATA_01, 5);
+    s2 = push_intern_table_lookup(table, DATA_01 + 5, 3);
+    s3 = push_intern_table_lookup(table, DATA_01 + 8, 5);
+
+    fail_unless(s1 != NULL && strcmp(s1, "alice") == 0,
+                "First value doesn't match");
+    fail_unless(s2 != NULL && strcmp(s2, "bob") == 0,
+                "Second value doesn't match");
+    fail_unless(s1 == s3,
+                "Repeated value isn't canonical");
+    fail_unless(push_intern_table_size(table) == 2,
+                "Expected 2 entries, got %zu",
+                push_intern_table_size(table));
+
+    push_talloc_free(table);
+}
+END_TEST
+
+
+START_TEST(test_intern_table_02)
+{
+    push_intern_table_t  *table;
+
+    PUSH_DEBUG_MSG("---\nStarting test_intern_table_02\n");
+
+    /*
+     * A full table still finds existing values, but won't add new
+     * ones.
+     */
+
+    table = push_intern_table_new(NULL, 1);
+    fail_if(table == NULL,
+            "Could not allocate a new interning table");
+
+    fail_if(push_intern_table_lookup(table, DATA_01, 5) == NULL,
+            "Could not add first value");
+    fail_if(push_intern_table_lookup(table, DATA_01 + 8, 5) == NULL,
+            "Could not find first value");
+    fail_unless(push_intern_table_lookup(table, DATA_01 + 5, 3) == NULL,
+                "Shouldn't add a value to a full table");
+
+    push_talloc_free(table);
+}
+END_TEST
+
+
+START_TEST(test_intern_table_size)
+{
+    PUSH_DEBUG_MSG("---\nStarting test_intern_table_size\n");
+
+    /*
+     * Sizes whose slot array can't be allocated should fail right
+     * away.
+     */
+
+    fail_unless(push_intern_table_new(NULL, 0) == NULL,
+                "Shouldn't create an empty table");
+    fail_unless(push_intern_table_new(NULL, SIZE_MAX) == NULL,
+                "Shouldn't create a table with SIZE_MAX entries");
+    fail_unless(push_intern_table_new(NULL, SIZE_MAX / 2 + 1) == NULL,
+                "Shouldn't create a table with SIZE_MAX/2+1 entries");
+    fail_unless(push_intern_table_new(NULL, SIZE_MAX / 4) == NULL,
+                "Shouldn't create a table with SIZE_MAX/4 entries");
+}
+END_TEST
+
+
+START_TEST(test_interned_string_01)
+{
+    push_intern_table_t  *table;
+    hwm_buffer_t  buf;
+    const char  *s1;
+    const char  *s2;
+
+    PUSH_DEBUG_MSG("---\nStarting test_interned_string_01\n");
+
+    /*
+     * Parse the same value twice, once in a single chunk and once
+     * split across chunks.  Both should give the canonical pointer.
+     */
+
+    hwm_buffer_init(&buf);
+    table = push_intern_table_new(NULL, 4);
+    fail_if(table == NULL,
+            "Could not allocate a new interning table");
+
+    s1 = parse_interned(table, &buf, DATA_01, 5, 5);
+    s2 = parse_interned(table, &buf, DATA_01 + 8, 5, 2);
+
+    fail_unless(s1 != NULL && strcmp(s1, "alice") == 0,
+                "First value doesn't match");
+    fail_unless(s1 == s2,
+                "Repeated value isn't canonical");
+
+    push_talloc_free(table);
+    hwm_buffer_done(&buf);
+}
+END_TEST
+
+
+START_TEST(test_interned_string_02)
+{
+    push_intern_table_t  *table;
+    hwm_buffer_t  buf;
+    const char  *s1;
+    const char  *s2;
+
+    PUSH_DEBUG_MSG("---\nStarting test_interned_string_02\n");
+
+    /*
+     * Once the table is full, new values are copied into the HWM
+     * buffer instead.
+     */
+
+    hwm_buffer_init(&buf);
+    table = push_intern_table_new(NULL, 1);
+    fail_if(table == NULL,
+            "Could not allocate a new interning table");
+
+    s1 = parse_interned(table, &buf, DATA_01, 5, 5);
+    s2 = parse_interned(table, &buf, DATA_01 + 5, 3, 3);
+
+    fail_unless(s1 != NULL && strcmp(s1, "alice") == 0,
+                "First value doesn't match");
+    fail_unless(s2 != NULL && strcmp(s2, "bob") == 0,
+                "Second value doesn't match");
+    fail_unless(s2 == hwm_buffer_mem(&buf, char),
+                "Overflow value should be in HWM buffer");
+
+    push_talloc_free(table);
+    hwm_buffer_done(&buf);
+}
+END_TEST
+
+
+/*-----------------------------------------------------------------------
+ * Testing harness
+ */
+
+Suite *
+test_suite()
+{
+    Suite  *s = suite_create("intern");
+
+    TCase  *tc = tcase_create("intern");
+    tcase_add_test(tc, test_intern_table_01);
+    tcase_add_test(tc, test_intern_table_02);
+    tcase_add_test(tc, test_intern_table_size);
+    tcase_add_test(tc, test_interned_string_01);
+    tcase_add_test(tc, test_interned_string_02);
+    suite_add_tcase(s, tc);
+
+    return s;
+}
+
+
+int
+main(int argc, const char **argv)
+{
+    int  number_failed;
+    Suite  *suite = test_suite();
+    SRunner  *runner = srunner_create(suite);
+
+    srunner_run_all(runner, CK_NORMAL);
+    number_failed = srunner_ntests_failed(runner);
+    srunner_free(runner);
+
+    return (number_failed == 0)? EXIT_SUCCESS: EXIT_FAILURE;
+}
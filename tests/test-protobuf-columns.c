@@ -0,0 +1,439 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2010, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the LICENSE.txt file in this distribution for license
+ * details.
+ * ----------------------------------------------------------------------
+ */
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <check.h>
+
+#include <push/basics.h>
+#include <push/talloc.h>
+
+#include <push/protobuf/basics.h>
+#include <push/protobuf/columns.h>
+#include <push/protobuf/combinators.h>
+#include <push/protobuf/field-map.h>
+#include <push/protobuf/message.h>
+
+
+/*-----------------------------------------------------------------------
+ * Our data type
+ */
+
+/*
+ * message Person {
+ *   uint32 id = 1;
+ *   string name = 2;
+ *   double score = 3;
+ *   sint64 delta = 4;
+ *   bool active = 5;
+ * }
+ */
+
+typedef struct _person_columns
+{
+    push_protobuf_columns_t  *columns;
+    push_protobuf_column_t  *id;
+    push_protobuf_column_t  *name;
+    push_protobuf_column_t  *score;
+    push_protobuf_column_t  *delta;
+    push_protobuf_column_t  *active;
+} person_columns_t;
+
+static push_callback_t *
+create_person_message(const char *name,
+                      void *parent,
+                      push_parser_t *parser,
+                      person_columns_t *dest)
+{
+    void  *context;
+    push_protobuf_field_map_t  *field_map;
+    push_callback_t  *callback;
+
+    context = push_talloc_new(parent);
+    if (context == NULL) return NULL;
+
+    if (name == NULL) name = "person";
+
+    field_map = push_protobuf_field_map_new(context);
+    if (field_map == NULL) goto error;
+
+    dest->columns = push_protobuf_columns_new(context);
+    if (dest->columns == NULL) goto error;
+
+#define CHECK(call) { if ((call) == NULL) goto error; }
+
+    CHECK(dest->id = push_protobuf_add_uint32_column
+          (name, "id", context, parser, field_map, 1, dest->columns));
+    CHECK(dest->name = push_protobuf_add_string_column
+          (name, "name", context, parser, field_map, 2, dest->columns));
+    CHECK(dest->score = push_protobuf_add_double_column
+          (name, "score", context, parser, field_map, 3, dest->columns));
+    CHECK(dest->delta = push_protobuf_add_sint64_column
+          (name, "delta", context, parser, field_map, 4, dest->columns));
+    CHECK(dest->active = push_protobuf_add_bool_column
+          (name, "active", context, parser, field_map, 5, dest->columns));
+
+#undef CHECK
+
+    callback = push_protobuf_message_new(name, context, parser, field_map);
+
+    if (callback == NULL) goto error;
+    return callback;
+
+  error:
+    push_talloc_free(context);
+    return NULL;
+}
+
+
+/*-----------------------------------------------------------------------
+ * Sample data
+ */
+
+const uint8_t  DATA_01[] =
+    "\x14"                      /* length = 20 */
+    "\x08\x07"                  /*   id = 7 */
+    "\x12\x03" "ann"            /*   name = "ann" */
+    "\x19\x00\x00\x00\x00"      /*   score = 1.5 */
+    "\x00\x00\xf8\x3f"
+    "\x20\x05"                  /*   delta = -3 */
+    "\x28\x01"                  /*   active = true */
+    "\x00"                      /* length = 0 */
+    "\x0d"                      /* length = 13 */
+    "\x12\x02" "bo"             /*   name = "bo" */
+    "\x12\x04" "carl"           /*   name = "carl" */
+    "\x08\xac\x02"              /*   id = 300 */
+    "\x04"                      /* length = 4 */
+    "\x20\x02"                  /*   delta = 1 */
+    "\x28\x00";                 /*   active = false */
+const size_t  LENGTH_01 = 41;
+
+const uint32_t  EXPECTED_IDS_01[] = { 7, 0, 300, 0 };
+const uint64_t  EXPECTED_NAME_OFFSETS_01[] = { 0, 3, 3, 7, 7 };
+const double  EXPECTED_SCORES_01[] = { 1.5, 0.0, 0.0, 0.0 };
+const int64_t  EXPECTED_DELTAS_01[] = { -3, 0, 0, 1 };
+const uint8_t  EXPECTED_ACTIVE_01[] = { 1, 0, 0, 0 };
+
+
+/*-----------------------------------------------------------------------
+ * Helper functions
+ */
+
+/**
+ * Parse a stream into columns, sending it in chunks of at most
+ * chunk_size bytes, with the first chunk ending at first_chunk_size.
+ */
+
+static push_error_code_t
+read_stream(push_parser_t *parser,
+            const uint8_t *data, size_t length,
+            size_t first_chunk_size, size_t chunk_size)
+{
+    size_t  offset;
+    push_error_code_t  result;
+
+    fail_unless(push_parser_activate(parser, NULL)
+                == PUSH_INCOMPLETE,
+                "Could not activate parser");
+
+    result = push_parser_submit_data(parser, data, first_chunk_size);
+
+    for (offset = first_chunk_size;
+         (result == PUSH_INCOMPLETE) && (offset < length);
+         offset += chunk_size)
+    {
+        size_t  size = length - offset;
+        if (size > chunk_size) size = chunk_size;
+
+        result = push_parser_submit_data(parser, &data[offset], size);
+    }
+
+    if (result == PUSH_INCOMPLETE)
+        result = push_parser_eof(parser);
+
+    return result;
+}
+
+
+static push_parser_t *
+create_parser(person_columns_t *dest)
+{
+    push_parser_t  *parser;
+    push_callback_t  *person;
+    push_callback_t  *stream;
+
+    parser = push_parser_new();
+    fail_if(parser == NULL,
+            "Could not allocate a new push parser");
+
+    person = create_person_message("person", parser, parser, dest);
+    fail_if(person == NULL,
+            "Could not allocate a new message callback");
+
+    stream = push_protobuf_message_stream_new
+        ("stream", parser, parser, person,
+         NULL, 0, 0,
+         push_protobuf_columns_sink, dest->columns);
+    fail_if(stream == NULL,
+            "Could not allocate a new message stream callback");
+
+    push_parser_set_callback(parser, stream);
+    return parser;
+}
+
+
+#define COLUMN_EQ(column, type, expected)                           \
+    (memcmp(push_protobuf_column_values(column), expected,          \
+            sizeof(expected)) == 0)
+
+
+static void
+check_columns_01(person_columns_t *dest,
+                 size_t first_chunk_size, size_t chunk_size)
+{
+    fail_unless(push_protobuf_columns_row_count(dest->columns) == 4,
+                "Expected 4 rows, got %zu (split at %zu, %zu)",
+                push_protobuf_columns_row_count(dest->columns),
+                first_chunk_size, chunk_size);
+
+    fail_unless(COLUMN_EQ(dest->id, uint32_t, EXPECTED_IDS_01),
+                "IDs don't match (split at %zu, %zu)",
+                first_chunk_size, chunk_size);
+
+    fail_unless(COLUMN_EQ(dest->name, uint64_t,
+                          EXPECTED_NAME_OFFSETS_01) &&
+                (memcmp(push_protobuf_column_data(dest->name),
+                        "anncarl", 7) == 0),
+                "Names don't match (split at %zu, %zu)",
+                first_chunk_size, chunk_size);
+
+    fail_unless(COLUMN_EQ(dest->score, double, EXPECTED_SCORES_01),
+                "Scores don't match (split at %zu, %zu)",
+                first_chunk_size, chunk_size);
+
+    fail_unless(COLUMN_EQ(dest->delta, int64_t, EXPECTED_DELTAS_01),
+                "Deltas don't match (split at %zu, %zu)",
+                first_chunk_size, chunk_size);
+
+    fail_unless(COLUMN_EQ(dest->active, uint8_t, EXPECTED_ACTIVE_01),
+                "Active flags don't match (split at %zu, %zu)",
+                first_chunk_size, chunk_size);
+
+    /*
+     * Rows 1 and 3 have no id or name; only row 0 has a score; rows
+     * 0 and 3 have a delta and an active flag.
+     */
+
+    fail_unless((push_protobuf_column_validity(dest->id)[0] == 0x05) &&
+                (push_protobuf_column_validity(dest->name)[0] == 0x05) &&
+                (push_protobuf_column_validity(dest->score)[0] == 0x01) &&
+                (push_protobuf_column_validity(dest->delta)[0] == 0x09) &&
+                (push_protobuf_column_validity(dest->active)[0] == 0x09),
+                "Validity bitmaps don't match (split at %zu, %zu)",
+                first_chunk_size, chunk_size);
+
+    fail_unless((push_protobuf_column_null_count(dest->id) == 2) &&
+                (push_protobuf_column_null_count(dest->name) == 2) &&
+                (push_protobuf_column_null_count(dest->score) == 3) &&
+                (push_protobuf_column_null_count(dest->delta) == 2) &&
+                (push_protobuf_column_null_count(dest->active) == 2),
+                "Null counts don't match (split at %zu, %zu)",
+                first_chunk_size, chunk_size);
+}
+
+
+static void
+read_data_01(size_t first_chunk_size, size_t chunk_size)
+{
+    person_columns_t  dest;
+    push_parser_t  *parser = create_parser(&dest);
+
+    fail_unless(read_stream(parser, DATA_01, LENGTH_01,
+                            first_chunk_size, chunk_size)
+                == PUSH_SUCCESS,
+                "Could not parse stream (split at %zu, %zu)",
+                first_chunk_size, chunk_size);
+
+    check_columns_01(&dest, first_chunk_size, chunk_size);
+
+    push_parser_free(parser);
+}
+
+
+/*-----------------------------------------------------------------------
+ * Test cases
+ */
+
+START_TEST(test_read_01)
+{
+    PUSH_DEBUG_MSG("---\nStarting test_read_01\n");
+    read_data_01(LENGTH_01, LENGTH_01);
+}
+END_TEST
+
+
+START_TEST(test_two_part_read_01)
+{
+    size_t  first_chunk_size;
+
+    PUSH_DEBUG_MSG("---\nStarting test_two_part_read_01\n");
+
+    for (first_chunk_size = 1;
+         first_chunk_size < LENGTH_01;
+         first_chunk_size++)
+    {
+        read_data_01(first_chunk_size, LENGTH_01);
+    }
+}
+END_TEST
+
+
+START_TEST(test_bytewise_read_01)
+{
+    PUSH_DEBUG_MSG("---\nStarting test_bytewise_read_01\n");
+    read_data_01(1, 1);
+}
+END_TEST
+
+
+START_TEST(test_clear_01)
+{
+    person_columns_t  dest;
+    push_parser_t  *parser = create_parser(&dest);
+
+    PUSH_DEBUG_MSG("---\nStarting test_clear_01\n");
+
+    /*
+     * Parse the stream twice, clearing the columns in between; the
+     * second batch shouldn't see anything from the first.
+     */
+
+    fail_unless(read_stream(parser, DATA_01, LENGTH_01,
+                            LENGTH_01, LENGTH_01) == PUSH_SUCCESS,
+                "Could not parse first stream");
+
+    push_protobuf_columns_clear(dest.columns);
+
+    fail_unless(push_protobuf_columns_row_count(dest.columns) == 0,
+                "Expected no rows after clearing");
+
+    fail_unless(read_stream(parser, DATA_01, LENGTH_01,
+                            LENGTH_01, LENGTH_01) == PUSH_SUCCESS,
+                "Could not parse second stream");
+
+    check_columns_01(&dest, LENGTH_01, LENGTH_01);
+
+    push_parser_free(parser);
+}
+END_TEST
+
+
+START_TEST(test_late_column)
+{
+    push_parser_t  *parser;
+    push_protobuf_columns_t  *columns;
+    push_protobuf_field_map_t  *field_map;
+    push_protobuf_column_t  *early;
+    push_protobuf_column_t  *late;
+    size_t  row;
+
+    PUSH_DEBUG_MSG("---\nStarting test_late_column\n");
+
+    parser = push_parser_new();
+    fail_if(parser == NULL,
+            "Could not allocate a new push parser");
+
+    columns = push_protobuf_columns_new(parser);
+    field_map = push_protobuf_field_map_new(parser);
+    fail_if((columns == NULL) || (field_map == NULL),
+            "Could not allocate columns");
+
+    early = push_protobuf_add_string_column
+        ("msg", "early", parser, parser, field_map, 1, columns);
+    fail_if(early == NULL, "Could not add early column");
+
+    /*
+     * Finish enough rows to span more than one byte of the validity
+     * bitmap.
+     */
+
+    for (row = 0; row < 10; row++)
+    {
+        fail_unless(push_protobuf_columns_end_row(columns),
+                    "Could not finish row %zu", row);
+    }
+
+    late = push_protobuf_add_fixed64_column
+        ("msg", "late", parser, parser, field_map, 2, columns);
+    fail_if(late == NULL, "Could not add late column");
+
+    fail_unless(push_protobuf_columns_end_row(columns),
+                "Could not finish last row");
+
+    fail_unless(push_protobuf_columns_row_count(columns) == 11,
+                "Expected 11 rows");
+
+    fail_unless((push_protobuf_column_null_count(early) == 11) &&
+                (push_protobuf_column_null_count(late) == 11),
+                "Every row should be null");
+
+    for (row = 0; row < 11; row++)
+    {
+        fail_if(push_protobuf_column_is_valid(early, row) ||
+                push_protobuf_column_is_valid(late, row) ||
+                (((const uint64_t *)
+                  push_protobuf_column_values(late))[row] != 0) ||
+                (((const uint64_t *)
+                  push_protobuf_column_values(early))[row + 1] != 0),
+                "Row %zu should be null", row);
+    }
+
+    push_parser_free(parser);
+}
+END_TEST
+
+
+/*-----------------------------------------------------------------------
+ * Testing harness
+ */
+
+Suite *
+test_suite()
+{
+    Suite  *s = suite_create("protobuf-columns");
+
+    TCase  *tc = tcase_create("protobuf-columns");
+    tcase_add_test(tc, test_read_01);
+    tcase_add_test(tc, test_two_part_read_01);
+    tcase_add_test(tc, test_bytewise_read_01);
+    tcase_add_test(tc, test_clear_01);
+    tcase_add_test(tc, test_late_column);
+    suite_add_tcase(s, tc);
+
+    return s;
+}
+
+int
+main(int argc, const char **argv)
+{
+    int  number_failed;
+    Suite  *suite = test_suite();
+    SRunner  *runner = srunner_create(suite);
+
+    srunner_run_all(runner, CK_NORMAL);
+    number_failed = srunner_ntests_failed(runner);
+    srunner_free(runner);
+
+    return (number_failed == 0)? EXIT_SUCCESS: EXIT_FAILURE;
+}
@@ -0,0 +1,738 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2010, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the LICENSE.txt file in this distribution for license
+ * details.
+ * ----------------------------------------------------------------------
+ */
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <check.h>
+
+#include <push/basics.h>
+#include <push/talloc.h>
+
+#include <push/protobuf/basics.h>
+#include <push/protobuf/dynamic.h>
+#include <push/protobuf/encoder.h>
+
+
+/*-----------------------------------------------------------------------
+ * Sample data
+ */
+
+/*
+ * The output of protoc --descriptor_set_out for the following file:
+ *
+ *   syntax = "proto2";
+ *   package test;
+ *
+ *   message Node
+ *   {
+ *       enum Kind { LEAF = 0; BRANCH = 1; }
+ *
+ *       message Label
+ *       {
+ *           optional string text = 1;
+ *           optional double weight = 2;
+ *       }
+ *
+ *       optional uint32 id = 1;
+ *       optional Kind kind = 2;
+ *       optional Label label = 3;
+ *       repeated Node children = 4;
+ *       repeated sint32 deltas = 5 [packed = true];
+ *       repeated fixed64 stamps = 6;
+ *       optional int32 offset = 7;
+ *   }
+ */
+
+const uint8_t  DESCRIPTOR_SET[] =
+    "\x0a\xbf\x02\x0a\x0a\x74\x72\x65\x65\x2e\x70\x72"
+    "\x6f\x74\x6f\x12\x04\x74\x65\x73\x74\x22\xaa\x02"
+    "\x0a\x04\x4e\x6f\x64\x65\x12\x0e\x0a\x02\x69\x64"
+    "\x18\x01\x20\x01\x28\x0d\x52\x02\x69\x64\x12\x23"
+    "\x0a\x04\x6b\x69\x6e\x64\x18\x02\x20\x01\x28\x0e"
+    "\x32\x0f\x2e\x74\x65\x73\x74\x2e\x4e\x6f\x64\x65"
+    "\x2e\x4b\x69\x6e\x64\x52\x04\x6b\x69\x6e\x64\x12"
+    "\x26\x0a\x05\x6c\x61\x62\x65\x6c\x18\x03\x20\x01"
+    "\x28\x0b\x32\x10\x2e\x74\x65\x73\x74\x2e\x4e\x6f"
+    "\x64\x65\x2e\x4c\x61\x62\x65\x6c\x52\x05\x6c\x61"
+    "\x62\x65\x6c\x12\x26\x0a\x08\x63\x68\x69\x6c\x64"
+    "\x72\x65\x6e\x18\x04\x20\x03\x28\x0b\x32\x0a\x2e"
+    "\x74\x65\x73\x74\x2e\x4e\x6f\x64\x65\x52\x08\x63"
+    "\x68\x69\x6c\x64\x72\x65\x6e\x12\x1a\x0a\x06\x64"
+    "\x65\x6c\x74\x61\x73\x18\x05\x20\x03\x28\x11\x42"
+    "\x02\x10\x01\x52\x06\x64\x65\x6c\x74\x61\x73\x12"
+    "\x16\x0a\x06\x73\x74\x61\x6d\x70\x73\x18\x06\x20"
+    "\x03\x28\x06\x52\x06\x73\x74\x61\x6d\x70\x73\x12"
+    "\x16\x0a\x06\x6f\x66\x66\x73\x65\x74\x18\x07\x20"
+    "\x01\x28\x05\x52\x06\x6f\x66\x66\x73\x65\x74\x1a"
+    "\x33\x0a\x05\x4c\x61\x62\x65\x6c\x12\x12\x0a\x04"
+    "\x74\x65\x78\x74\x18\x01\x20\x01\x28\x09\x52\x04"
+    "\x74\x65\x78\x74\x12\x16\x0a\x06\x77\x65\x69\x67"
+    "\x68\x74\x18\x02\x20\x01\x28\x01\x52\x06\x77\x65"
+    "\x69\x67\x68\x74\x22\x1c\x0a\x04\x4b\x69\x6e\x64"
+    "\x12\x08\x0a\x04\x4c\x45\x41\x46\x10\x00\x12\x0a"
+    "\x0a\x06\x42\x52\x41\x4e\x43\x48\x10\x01";
+
+const size_t  DESCRIPTOR_SET_LENGTH = 322;
+
+
+const uint8_t  DATA_01[] =
+    "\x08\x01"                  /* id = 1 */
+    "\x10\x01"                  /* kind = BRANCH */
+    "\x1a\x0f"                  /* label, length = 15 */
+    "\x0a\x04" "root"           /*   text = "root" */
+    "\x11\x00\x00\x00\x00"      /*   weight = 0.5 */
+    "\x00\x00\xe0\x3f"
+    "\x22\x0d"                  /* children, length = 13 */
+    "\x08\x02"                  /*   id = 2 */
+    "\x1a\x03"                  /*   label, length = 3 */
+    "\x0a\x01" "a"              /*     text = "a" */
+    "\x2a\x04"                  /*   deltas, length = 4 */
+    "\x01\x04\xd7\x04"          /*     -1, 2, -300 */
+    "\x22\x25"                  /* children, length = 37 */
+    "\x08\x03"                  /*   id = 3 */
+    "\x10\x01"                  /*   kind = BRANCH */
+    "\x22\x0d"                  /*   children, length = 13 */
+    "\x08\x04"                  /*     id = 4 */
+    "\x38\xf9\xff\xff\xff"      /*     offset = -7 */
+    "\xff\xff\xff\xff\xff\x01"
+    "\x31\x11\x00\x00\x00"      /*   stamps = 17 */
+    "\x00\x00\x00\x00"
+    "\x31\x12\x00\x00\x00"      /*   stamps = 18 */
+    "\x00\x00\x00\x00"
+    "\x2a\x01\x0a"              /* deltas, length = 1: 5 */
+    "\x38\xfe\xff\xff\xff"      /* offset = -2 */
+    "\xff\xff\xff\xff\xff\x01";
+
+const size_t  LENGTH_01 = 89;
+
+
+/*
+ * A singular submessage that appears three times.  The occurrences
+ * should be merged: the label's text comes from the last occurrence,
+ * and its weight from the second.
+ */
+
+const uint8_t  DATA_02[] =
+    "\x1a\x03"                  /* label, length = 3 */
+    "\x0a\x01" "a"              /*   text = "a" */
+    "\x1a\x09"                  /* label, length = 9 */
+    "\x11\x00\x00\x00\x00"      /*   weight = 0.5 */
+    "\x00\x00\xe0\x3f"
+    "\x1a\x03"                  /* label, length = 3 */
+    "\x0a\x01" "b";             /*   text = "b" */
+
+const size_t  LENGTH_02 = 21;
+
+
+/*-----------------------------------------------------------------------
+ * Helper functions
+ */
+
+static push_protobuf_descriptor_pool_t *
+load_pool()
+{
+    push_protobuf_descriptor_pool_t  *pool;
+
+    pool = push_protobuf_descriptor_pool_new(NULL);
+    fail_if(pool == NULL,
+            "Could not allocate a new descriptor pool");
+
+    fail_unless(push_protobuf_descriptor_pool_load
+                (pool, DESCRIPTOR_SET, DESCRIPTOR_SET_LENGTH),
+                "Could not load descriptor set");
+
+    return pool;
+}
+
+
+static const push_protobuf_dynamic_value_t *
+get_value(const push_protobuf_dynamic_message_t *message,
+          push_protobuf_tag_number_t field_number,
+          size_t expected_count)
+{
+    const push_protobuf_dynamic_field_t  *field =
+        push_protobuf_dynamic_message_get_field(message, field_number);
+
+    fail_if(field == NULL,
+            "No field %"PRIu32" in %s",
+            field_number, message->descriptor->full_name);
+
+    fail_unless(field->count == expected_count,
+                "Field %"PRIu32" has %zu values, expected %zu",
+                field_number, field->count, expected_count);
+
+    return field->first;
+}
+
+
+static void
+check_message_01(const push_protobuf_dynamic_message_t *node)
+{
+    const push_protobuf_dynamic_value_t  *value;
+    const push_protobuf_dynamic_value_t  *child;
+    const push_protobuf_dynamic_message_t  *label;
+
+    fail_unless(strcmp(node->descriptor->full_name, "test.Node") == 0,
+                "Wrong message type %s", node->descriptor->full_name);
+
+    fail_unless(get_value(node, 1, 1)->v.u32 == 1, "Wrong id");
+    fail_unless(get_value(node, 2, 1)->v.i32 == 1, "Wrong kind");
+
+    label = get_value(node, 3, 1)->v.message;
+    value = get_value(label, 1, 1);
+    fail_unless((value->v.bytes.size == 4) &&
+                (strcmp(value->v.bytes.data, "root") == 0),
+                "Wrong label text");
+    fail_unless(get_value(label, 2, 1)->v.d == 0.5, "Wrong weight");
+
+    value = get_value(node, 5, 1);
+    fail_unless(value->v.i32 == 5, "Wrong delta");
+    fail_unless(get_value(node, 6, 0) == NULL, "Unexpected stamp");
+    fail_unless(get_value(node, 7, 1)->v.i32 == -2, "Wrong offset");
+
+    /*
+     * The first child.
+     */
+
+    child = get_value(node, 4, 2);
+    fail_unless(get_value(child->v.message, 1, 1)->v.u32 == 2,
+                "Wrong child id");
+    fail_unless(get_value(child->v.message, 2, 0) == NULL,
+                "Unexpected child kind");
+
+    label = get_value(child->v.message, 3, 1)->v.message;
+    fail_unless(strcmp(get_value(label, 1, 1)->v.bytes.data, "a") == 0,
+                "Wrong child label text");
+
+    value = get_value(child->v.message, 5, 3);
+    fail_unless((value->v.i32 == -1) &&
+                (value->next->v.i32 == 2) &&
+                (value->next->next->v.i32 == -300),
+                "Wrong child deltas");
+
+    /*
+     * The second child, and its child.
+     */
+
+    child = child->next;
+    fail_unless(get_value(child->v.message, 1, 1)->v.u32 == 3,
+                "Wrong child id");
+
+    value = get_value(child->v.message, 6, 2);
+    fail_unless((value->v.u64 == 17) && (value->next->v.u64 == 18),
+                "Wrong child stamps");
+
+    child = get_value(child->v.message, 4, 1);
+    fail_unless(get_value(child->v.message, 1, 1)->v.u32 == 4,
+                "Wrong grandchild id");
+    fail_unless(get_value(child->v.message, 7, 1)->v.i32 == -7,
+                "Wrong grandchild offset");
+    fail_unless(get_value(child->v.message, 4, 0) == NULL,
+                "Unexpected great-grandchild");
+}
+
+
+/**
+ * Parse DATA_01 with the given parser, sending in chunk_size bytes at
+ * a time.
+ */
+
+static push_error_code_t
+parse_01(push_parser_t *parser, size_t length, size_t chunk_size)
+{
+    size_t  pos;
+
+    fail_unless(push_parser_activate(parser, NULL)
+                == PUSH_INCOMPLETE,
+                "Could not activate parser");
+
+    for (pos = 0; pos < length; pos += chunk_size)
+    {
+        size_t  size = length - pos;
+        if (size > chunk_size) size = chunk_size;
+
+        fail_unless(push_parser_submit_data(parser, &DATA_01[pos], size)
+                    == PUSH_INCOMPLETE,
+                    "Could not parse data");
+    }
+
+    return push_parser_eof(parser);
+}
+
+
+/*-----------------------------------------------------------------------
+ * Test cases
+ */
+
+START_TEST(test_load)
+{
+    push_protobuf_descriptor_pool_t  *pool;
+    const push_protobuf_message_descriptor_t  *node;
+    const push_protobuf_message_descriptor_t  *label;
+
+    PUSH_DEBUG_MSG("---\nStarting test_load\n");
+
+    pool = load_pool();
+
+    node = push_protobuf_descriptor_pool_find_message(pool, "test.Node");
+    fail_if(node == NULL, "Could not find test.Node");
+
+    label = push_protobuf_descriptor_pool_find_message
+        (pool, ".test.Node.Label");
+    fail_if(label == NULL, "Could not find test.Node.Label");
+
+    fail_unless(push_protobuf_descriptor_pool_find_message
+                (pool, "test.Node.Kind") == NULL,
+                "Enums shouldn't be message types");
+
+    fail_unless(node->field_count == 7,
+                "Node has %zu fields, expected 7", node->field_count);
+    fail_unless(label->field_count == 2,
+                "Label has %zu fields, expected 2", label->field_count);
+
+    fail_unless((strcmp(node->fields[2].name, "label") == 0) &&
+                (node->fields[2].number == 3) &&
+                (node->fields[2].label == PUSH_PROTOBUF_LABEL_OPTIONAL) &&
+                (node->fields[2].message_type == label),
+                "Wrong descriptor for Node.label");
+
+    fail_unless((node->fields[3].label == PUSH_PROTOBUF_LABEL_REPEATED) &&
+                (node->fields[3].message_type == node),
+                "Wrong descriptor for Node.children");
+
+    fail_unless((node->fields[4].type == PUSH_PROTOBUF_TYPE_SINT32) &&
+                node->fields[4].packed,
+                "Node.deltas should be packed");
+    fail_unless((node->fields[5].type == PUSH_PROTOBUF_TYPE_FIXED64) &&
+                !node->fields[5].packed,
+                "Node.stamps shouldn't be packed");
+
+    push_talloc_free(pool);
+}
+END_TEST
+
+
+START_TEST(test_load_error)
+{
+    push_protobuf_descriptor_pool_t  *pool;
+
+    PUSH_DEBUG_MSG("---\nStarting test_load_error\n");
+
+    pool = push_protobuf_descriptor_pool_new(NULL);
+    fail_if(pool == NULL,
+            "Could not allocate a new descriptor pool");
+
+    fail_if(push_protobuf_descriptor_pool_load
+            (pool, DESCRIPTOR_SET, DESCRIPTOR_SET_LENGTH - 1),
+            "Shouldn't load a truncated descriptor set");
+
+    fail_unless(push_protobuf_descriptor_pool_find_message
+                (pool, "test.Node") == NULL,
+                "Shouldn't keep types from a failed load");
+
+    push_talloc_free(pool);
+}
+END_TEST
+
+
+START_TEST(test_read_01)
+{
+    push_protobuf_descriptor_pool_t  *pool;
+    push_parser_t  *parser;
+    push_callback_t  *callback;
+
+    PUSH_DEBUG_MSG("---\nStarting test_read_01\n");
+
+    pool = load_pool();
+
+    parser = push_parser_new();
+    fail_if(parser == NULL,
+            "Could not allocate a new push parser");
+
+    callback = push_protobuf_dynamic_message_new
+        ("node", parser, parser, pool,
+         push_protobuf_descriptor_pool_find_message(pool, "test.Node"));
+    fail_if(callback == NULL,
+            "Could not allocate a new dynamic message callback");
+
+    push_parser_set_callback(parser, callback);
+
+    fail_unless(parse_01(parser, LENGTH_01, LENGTH_01) == PUSH_SUCCESS,
+                "Shouldn't get parse error at EOF");
+
+    check_message_01(push_parser_result
+                     (parser, push_protobuf_dynamic_message_t));
+
+    push_parser_free(parser);
+    push_talloc_free(pool);
+}
+END_TEST
+
+
+/*
+ * Parses DATA_01 and encodes it again.  DATA_01's fields are in the
+ * same order as the message type's, so we should get the same bytes
+ * back.
+ */
+
+START_TEST(test_encode_01)
+{
+    push_protobuf_descriptor_pool_t  *pool;
+    push_parser_t  *parser;
+    push_callback_t  *callback;
+    push_protobuf_encoder_t  *encoder;
+    const struct iovec  *iov;
+    size_t  count;
+    size_t  i;
+    uint8_t  actual[LENGTH_01];
+    size_t  pos = 0;
+
+    PUSH_DEBUG_MSG("---\nStarting test_encode_01\n");
+
+    pool = load_pool();
+
+    parser = push_parser_new();
+    fail_if(parser == NULL,
+            "Could not allocate a new push parser");
+
+    callback = push_protobuf_dynamic_message_new
+        ("node", parser, parser, pool,
+         push_protobuf_descriptor_pool_find_message(pool, "test.Node"));
+    fail_if(callback == NULL,
+            "Could not allocate a new dynamic message callback");
+
+    push_parser_set_callback(parser, callback);
+
+    fail_unless(parse_01(parser, LENGTH_01, LENGTH_01) == PUSH_SUCCESS,
+                "Shouldn't get parse error at EOF");
+
+    encoder = push_protobuf_encoder_new(parser, 0, 0);
+    fail_if(encoder == NULL,
+            "Could not allocate a new encoder");
+
+    fail_unless(push_protobuf_encoder_add_dynamic_message
+                (encoder,
+                 push_parser_result(parser, push_protobuf_dynamic_message_t)),
+                "Could not encode dynamic message");
+
+    fail_unless(push_protobuf_encoder_size(encoder) == LENGTH_01,
+                "Encoded %zu bytes, expected %zu",
+                push_protobuf_encoder_size(encoder), LENGTH_01);
+
+    iov = push_protobuf_encoder_iovecs(encoder, &count);
+    for (i = 0; i < count; i++)
+    {
+        memcpy(actual + pos, iov[i].iov_base, iov[i].iov_len);
+        pos += iov[i].iov_len;
+    }
+
+    fail_unless(memcmp(actual, DATA_01, LENGTH_01) == 0,
+                "Encoded bytes don't match");
+
+    push_parser_free(parser);
+    push_talloc_free(pool);
+}
+END_TEST
+
+
+/*
+ * Sends in the data one byte at a time, several times with the same
+ * parser, so that the cached graphs and the arena are reused.
+ */
+
+START_TEST(test_byte_at_a_time_read_01)
+{
+    push_protobuf_descriptor_pool_t  *pool;
+    push_parser_t  *parser;
+    push_callback_t  *callback;
+    int  i;
+
+    PUSH_DEBUG_MSG("---\nStarting test_byte_at_a_time_read_01\n");
+
+    pool = load_pool();
+
+    parser = push_parser_new();
+    fail_if(parser == NULL,
+            "Could not allocate a new push parser");
+
+    callback = push_protobuf_dynamic_message_new
+        ("node", parser, parser, pool,
+         push_protobuf_descriptor_pool_find_message(pool, "test.Node"));
+    fail_if(callback == NULL,
+            "Could not allocate a new dynamic message callback");
+
+    push_parser_set_callback(parser, callback);
+
+    for (i = 0; i < 3; i++)
+    {
+        fail_unless(parse_01(parser, LENGTH_01, 1) == PUSH_SUCCESS,
+                    "Shouldn't get parse error at EOF");
+
+        check_message_01(push_parser_result
+                         (parser, push_protobuf_dynamic_message_t));
+    }
+
+    push_parser_free(parser);
+    push_talloc_free(pool);
+}
+END_TEST
+
+
+START_TEST(test_parse_error_01)
+{
+    push_protobuf_descriptor_pool_t  *pool;
+    push_parser_t  *parser;
+    push_callback_t  *callback;
+
+    PUSH_DEBUG_MSG("---\nStarting test_parse_error_01\n");
+
+    pool = load_pool();
+
+    parser = push_parser_new();
+    fail_if(parser == NULL,
+            "Could not allocate a new push parser");
+
+    callback = push_protobuf_dynamic_message_new
+        ("node", parser, parser, pool,
+         push_protobuf_descriptor_pool_find_message(pool, "test.Node"));
+    fail_if(callback == NULL,
+            "Could not allocate a new dynamic message callback");
+
+    push_parser_set_callback(parser, callback);
+
+    fail_unless(parse_01(parser, LENGTH_01 - 1, LENGTH_01)
+                == PUSH_PARSE_ERROR,
+                "Should get parse error at EOF");
+
+    /*
+     * A failed parse shouldn't keep the next one from working.
+     */
+
+    fail_unless(parse_01(parser, LENGTH_01, LENGTH_01) == PUSH_SUCCESS,
+                "Shouldn't get parse error at EOF");
+
+    check_message_01(push_parser_result
+                     (parser, push_protobuf_dynamic_message_t));
+
+    push_parser_free(parser);
+    push_talloc_free(pool);
+}
+END_TEST
+
+
+/*
+ * Parses DATA_01 with a projection that only descends into some of
+ * the submessages.
+ */
+
+START_TEST(test_projection_01)
+{
+    static const char  *paths[] =
+        { "label.text", "children.id", "offset" };
+
+    push_protobuf_descriptor_pool_t  *pool;
+    const push_protobuf_message_descriptor_t  *node;
+    const push_protobuf_message_descriptor_t  *projection;
+    push_parser_t  *parser;
+    push_callback_t  *callback;
+    const push_protobuf_dynamic_message_t  *message;
+    const push_protobuf_dynamic_value_t  *child;
+    const push_protobuf_dynamic_message_t  *label;
+    size_t  chunk_size;
+
+    PUSH_DEBUG_MSG("---\nStarting test_projection_01\n");
+
+    pool = load_pool();
+    node = push_protobuf_descriptor_pool_find_message(pool, "test.Node");
+
+    projection = push_protobuf_descriptor_pool_project
+        (pool, node, paths, 3);
+    fail_if(projection == NULL, "Could not create projection");
+
+    fail_unless(projection->field_count == 3,
+                "Projection has %zu fields, expected 3",
+                projection->field_count);
+    fail_unless(push_protobuf_descriptor_pool_find_message
+                (pool, "test.Node") == node,
+                "Projection shouldn't replace the original type");
+
+    parser = push_parser_new();
+    fail_if(parser == NULL,
+            "Could not allocate a new push parser");
+
+    callback = push_protobuf_dynamic_message_new
+        ("node", parser, parser, pool, projection);
+    fail_if(callback == NULL,
+            "Could not allocate a new dynamic message callback");
+
+    push_parser_set_callback(parser, callback);
+
+    for (chunk_size = LENGTH_01; chunk_size > 0; chunk_size /= 4)
+    {
+        fail_unless(parse_01(parser, LENGTH_01, chunk_size)
+                    == PUSH_SUCCESS,
+                    "Shouldn't get parse error at EOF");
+
+        message = push_parser_result
+            (parser, push_protobuf_dynamic_message_t);
+
+        fail_unless(push_protobuf_dynamic_message_get_field(message, 1)
+                    == NULL,
+                    "Projection shouldn't have an id field");
+        fail_unless(get_value(message, 7, 1)->v.i32 == -2,
+                    "Wrong offset");
+
+        label = get_value(message, 3, 1)->v.message;
+        fail_unless(strcmp(get_value(label, 1, 1)->v.bytes.data, "root")
+                    == 0,
+                    "Wrong label text");
+        fail_unless(push_protobuf_dynamic_message_get_field(label, 2)
+                    == NULL,
+                    "Projection shouldn't have a weight field");
+
+        child = get_value(message, 4, 2);
+        fail_unless(get_value(child->v.message, 1, 1)->v.u32 == 2,
+                    "Wrong child id");
+        fail_unless(get_value(child->next->v.message, 1, 1)->v.u32 == 3,
+                    "Wrong child id");
+        fail_unless(push_protobuf_dynamic_message_get_field
+                    (child->v.message, 4) == NULL,
+                    "Projection shouldn't have grandchildren");
+    }
+
+    push_parser_free(parser);
+    push_talloc_free(pool);
+}
+END_TEST
+
+
+START_TEST(test_projection_error)
+{
+    static const char  *not_message[] = { "label.text.length" };
+    static const char  *unknown[] = { "id", "color" };
+
+    push_protobuf_descriptor_pool_t  *pool;
+    const push_protobuf_message_descriptor_t  *node;
+
+    PUSH_DEBUG_MSG("---\nStarting test_projection_error\n");
+
+    pool = load_pool();
+    node = push_protobuf_descriptor_pool_find_message(pool, "test.Node");
+
+    fail_unless(push_protobuf_descriptor_pool_project
+                (pool, node, not_message, 1) == NULL,
+                "Shouldn't project through a string field");
+    fail_unless(push_protobuf_descriptor_pool_project
+                (pool, node, unknown, 2) == NULL,
+                "Shouldn't project a nonexistent field");
+
+    push_talloc_free(pool);
+}
+END_TEST
+
+
+START_TEST(test_merge_submessage_02)
+{
+    push_protobuf_descriptor_pool_t  *pool;
+    push_parser_t  *parser;
+    push_callback_t  *callback;
+    const push_protobuf_dynamic_message_t  *node;
+    const push_protobuf_dynamic_message_t  *label;
+    const push_protobuf_dynamic_value_t  *value;
+    size_t  pos;
+
+    PUSH_DEBUG_MSG("---\nStarting test_merge_submessage_02\n");
+
+    pool = load_pool();
+
+    parser = push_parser_new();
+    fail_if(parser == NULL,
+            "Could not allocate a new push parser");
+
+    callback = push_protobuf_dynamic_message_new
+        ("node", parser, parser, pool,
+         push_protobuf_descriptor_pool_find_message(pool, "test.Node"));
+    fail_if(callback == NULL,
+            "Could not allocate a new dynamic message callback");
+
+    push_parser_set_callback(parser, callback);
+
+    fail_unless(push_parser_activate(parser, NULL)
+                == PUSH_INCOMPLETE,
+                "Could not activate parser");
+
+    for (pos = 0; pos < LENGTH_02; pos++)
+    {
+        fail_unless(push_parser_submit_data(parser, &DATA_02[pos], 1)
+                    == PUSH_INCOMPLETE,
+                    "Could not parse data");
+    }
+
+    fail_unless(push_parser_eof(parser) == PUSH_SUCCESS,
+                "Shouldn't get parse error at EOF");
+
+    node = push_parser_result(parser, push_protobuf_dynamic_message_t);
+    label = get_value(node, 3, 1)->v.message;
+
+    value = get_value(label, 1, 1);
+    fail_unless((value->v.bytes.size == 1) &&
+                (strcmp(value->v.bytes.data, "b") == 0),
+                "Wrong label text");
+    fail_unless(get_value(label, 2, 1)->v.d == 0.5, "Wrong weight");
+
+    push_parser_free(parser);
+    push_talloc_free(pool);
+}
+END_TEST
+
+
+/*-----------------------------------------------------------------------
+ * Testing harness
+ */
+
+Suite *
+test_suite()
+{
+    Suite  *s = suite_create("protobuf-dynamic");
+
+    TCase  *tc = tcase_create("protobuf-dynamic");
+    tcase_add_test(tc, test_load);
+    tcase_add_test(tc, test_load_error);
+    tcase_add_test(tc, test_read_01);
+    tcase_add_test(tc, test_encode_01);
+    tcase_add_test(tc, test_byte_at_a_time_read_01);
+    tcase_add_test(tc, test_parse_error_01);
+    tcase_add_test(tc, test_projection_01);
+    tcase_add_test(tc, test_projection_error);
+    tcase_add_test(tc, test_merge_submessage_02);
+    suite_add_tcase(s, tc);
+
+    return s;
+}
+
+
+int
+main(int argc, const char **argv)
+{
+    int  number_failed;
+    Suite  *suite = test_suite();
+    SRunner  *runner = srunner_create(suite);
+
+    srunner_run_all(runner, CK_NORMAL);
+    number_failed = srunner_ntests_failed(runner);
+    srunner_free(runner);
+
+    return (number_failed == 0)? EXIT_SUCCESS: EXIT_FAILURE;
+}
@@ -0,0 +1,327 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2010, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the LICENSE.txt file in this distribution for license
+ * details.
+ * ----------------------------------------------------------------------
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+
+#include <check.h>
+
+#include <push/basics.h>
+#include <push/talloc.h>
+
+#include <push/protobuf/basics.h>
+#include <push/protobuf/encoder.h>
+
+
+/*-----------------------------------------------------------------------
+ * Sample data
+ */
+
+const uint8_t  EXPECTED_01[] =
+    "\x08\x96\x01"              /* 1: varint 150 */
+    "\x10\xff\xff\xff\xff\xff"  /* 2: int32 -1 */
+    "\xff\xff\xff\xff\x01"
+    "\x18\x01"                  /* 3: sint32 -1 */
+    "\x20\x02"                  /* 4: sint64 1 */
+    "\x2d\x78\x56\x34\x12"      /* 5: fixed32 0x12345678 */
+    "\x31\x01\x00\x00\x00"      /* 6: fixed64 1 */
+    "\x00\x00\x00\x00"
+    "\x3a\x03" "abc"            /* 7: bytes "abc" */
+    "\x41\x00\x00\x00\x00"      /* 8: double 1.0 */
+    "\x00\x00\xf0\x3f";
+
+const size_t  LENGTH_01 = 46;
+
+
+#define STRING_LENGTH_02  200
+#define LENGTH_02  213
+
+
+/*-----------------------------------------------------------------------
+ * Helper functions
+ */
+
+/**
+ * Copy the encoder's output into a single buffer, and check that the
+ * iovecs add up to the encoder's size.
+ */
+
+static uint8_t *
+flatten(push_protobuf_encoder_t *encoder, size_t *size)
+{
+    const struct iovec  *iov;
+    size_t  count;
+    size_t  i;
+    uint8_t  *buf;
+    size_t  pos = 0;
+
+    *size = push_protobuf_encoder_size(encoder);
+    buf = push_talloc_size(encoder, *size + 1);
+    fail_if(buf == NULL,
+            "Could not allocate flattened buffer");
+
+    iov = push_protobuf_encoder_iovecs(encoder, &count);
+    for (i = 0; i < count; i++)
+    {
+        fail_unless(pos + iov[i].iov_len <= *size,
+                    "iovecs are longer than encoder size");
+        memcpy(buf + pos, iov[i].iov_base, iov[i].iov_len);
+        pos += iov[i].iov_len;
+    }
+
+    fail_unless(pos == *size,
+                "iovecs add up to %zu bytes, expected %zu",
+                pos, *size);
+
+    return buf;
+}
+
+
+static void
+encode_01(push_protobuf_encoder_t *encoder)
+{
+    fail_unless(push_protobuf_encoder_add_varint(encoder, 1, 150) &&
+                push_protobuf_encoder_add_int32(encoder, 2, -1) &&
+                push_protobuf_encoder_add_sint32(encoder, 3, -1) &&
+                push_protobuf_encoder_add_sint64(encoder, 4, 1) &&
+                push_protobuf_encoder_add_fixed32(encoder, 5, 0x12345678) &&
+                push_protobuf_encoder_add_fixed64(encoder, 6, 1) &&
+                push_protobuf_encoder_add_bytes(encoder, 7, "abc", 3) &&
+                push_protobuf_encoder_add_double(encoder, 8, 1.0),
+                "Could not encode fields");
+}
+
+
+/*-----------------------------------------------------------------------
+ * Test cases
+ */
+
+START_TEST(test_scalars_01)
+{
+    push_protobuf_encoder_t  *encoder;
+    uint8_t  *actual;
+    size_t  size;
+
+    PUSH_DEBUG_MSG("---\nStarting test_scalars_01\n");
+
+    encoder = push_protobuf_encoder_new(NULL, 0, 0);
+    fail_if(encoder == NULL,
+            "Could not allocate a new encoder");
+
+    encode_01(encoder);
+
+    actual = flatten(encoder, &size);
+    fail_unless(size == LENGTH_01,
+                "Encoded %zu bytes, expected %zu", size, LENGTH_01);
+    fail_unless(memcmp(actual, EXPECTED_01, LENGTH_01) == 0,
+                "Encoded bytes don't match");
+
+    push_talloc_free(encoder);
+}
+END_TEST
+
+
+START_TEST(test_reset_01)
+{
+    push_protobuf_encoder_t  *encoder;
+    uint8_t  *actual;
+    size_t  size;
+    size_t  count;
+
+    PUSH_DEBUG_MSG("---\nStarting test_reset_01\n");
+
+    encoder = push_protobuf_encoder_new(NULL, 0, 0);
+    fail_if(encoder == NULL,
+            "Could not allocate a new encoder");
+
+    encode_01(encoder);
+    push_protobuf_encoder_reset(encoder);
+
+    fail_unless(push_protobuf_encoder_size(encoder) == 0,
+                "Encoder should be empty after reset");
+    push_protobuf_encoder_iovecs(encoder, &count);
+    fail_unless(count == 0,
+                "Encoder shouldn't have iovecs after reset");
+
+    encode_01(encoder);
+
+    actual = flatten(encoder, &size);
+    fail_unless(size == LENGTH_01,
+                "Encoded %zu bytes, expected %zu", size, LENGTH_01);
+    fail_unless(memcmp(actual, EXPECTED_01, LENGTH_01) == 0,
+                "Encoded bytes don't match");
+
+    push_talloc_free(encoder);
+}
+END_TEST
+
+
+/*
+ * Nested submessages, with a copied string that doesn't fit into a
+ * single chunk:
+ *
+ *   1 { 1: 1, 2 { 3: "xxx…" } }, 4 { }
+ */
+
+START_TEST(test_submessages_02)
+{
+    push_protobuf_encoder_t  *encoder;
+    char  string[STRING_LENGTH_02];
+    uint8_t  expected[LENGTH_02];
+    uint8_t  *actual;
+    size_t  size;
+
+    PUSH_DEBUG_MSG("---\nStarting test_submessages_02\n");
+
+    memset(string, 'x', STRING_LENGTH_02);
+
+    memcpy(expected, "\x0a\xd0\x01\x08\x01\x12\xcb\x01\x1a\xc8\x01", 11);
+    memset(expected + 11, 'x', STRING_LENGTH_02);
+    memcpy(expected + 11 + STRING_LENGTH_02, "\x22\x00", 2);
+
+    encoder = push_protobuf_encoder_new(NULL, 64, 1000);
+    fail_if(encoder == NULL,
+            "Could not allocate a new encoder");
+
+    fail_unless(push_protobuf_encoder_begin_submessage(encoder, 1) &&
+                push_protobuf_encoder_add_varint(encoder, 1, 1) &&
+                push_protobuf_encoder_begin_submessage(encoder, 2) &&
+                push_protobuf_encoder_add_bytes(encoder, 3, string,
+                                                STRING_LENGTH_02) &&
+                push_protobuf_encoder_end_submessage(encoder) &&
+                push_protobuf_encoder_end_submessage(encoder) &&
+                push_protobuf_encoder_begin_submessage(encoder, 4) &&
+                push_protobuf_encoder_end_submessage(encoder),
+                "Could not encode fields");
+
+    actual = flatten(encoder, &size);
+    fail_unless(size == LENGTH_02,
+                "Encoded %zu bytes, expected %d", size, LENGTH_02);
+    fail_unless(memcmp(actual, expected, LENGTH_02) == 0,
+                "Encoded bytes don't match");
+
+    push_talloc_free(encoder);
+}
+END_TEST
+
+
+START_TEST(test_zero_copy)
+{
+    push_protobuf_encoder_t  *encoder;
+    char  small[8];
+    char  large[1000];
+    const struct iovec  *iov;
+    size_t  count;
+    size_t  i;
+    bool  found_small = false;
+    bool  found_large = false;
+
+    PUSH_DEBUG_MSG("---\nStarting test_zero_copy\n");
+
+    memset(small, 's', sizeof(small));
+    memset(large, 'l', sizeof(large));
+
+    encoder = push_protobuf_encoder_new(NULL, 0, 0);
+    fail_if(encoder == NULL,
+            "Could not allocate a new encoder");
+
+    fail_unless(push_protobuf_encoder_add_bytes(encoder, 1, small,
+                                                sizeof(small)) &&
+                push_protobuf_encoder_add_bytes(encoder, 2, large,
+                                                sizeof(large)),
+                "Could not encode fields");
+
+    fail_unless(push_protobuf_encoder_size(encoder) ==
+                2 + sizeof(small) + 3 + sizeof(large),
+                "Encoded wrong number of bytes");
+
+    iov = push_protobuf_encoder_iovecs(encoder, &count);
+    for (i = 0; i < count; i++)
+    {
+        if (iov[i].iov_base == small)
+            found_small = true;
+
+        if ((iov[i].iov_base == large) &&
+            (iov[i].iov_len == sizeof(large)))
+            found_large = true;
+    }
+
+    fail_if(found_small,
+            "Short bytes value should be copied");
+    fail_unless(found_large,
+                "Long bytes value should be referenced");
+
+    push_talloc_free(encoder);
+}
+END_TEST
+
+
+START_TEST(test_unbalanced_end)
+{
+    push_protobuf_encoder_t  *encoder;
+
+    PUSH_DEBUG_MSG("---\nStarting test_unbalanced_end\n");
+
+    encoder = push_protobuf_encoder_new(NULL, 0, 0);
+    fail_if(encoder == NULL,
+            "Could not allocate a new encoder");
+
+    fail_if(push_protobuf_encoder_end_submessage(encoder),
+            "Shouldn't end a submessage that wasn't started");
+
+    fail_unless(push_protobuf_encoder_begin_submessage(encoder, 1) &&
+                push_protobuf_encoder_end_submessage(encoder),
+                "Could not encode empty submessage");
+
+    fail_if(push_protobuf_encoder_end_submessage(encoder),
+            "Shouldn't end a submessage twice");
+
+    push_talloc_free(encoder);
+}
+END_TEST
+
+
+/*-----------------------------------------------------------------------
+ * Testing harness
+ */
+
+Suite *
+test_suite()
+{
+    Suite  *s = suite_create("protobuf-encoder");
+
+    TCase  *tc = tcase_create("protobuf-encoder");
+    tcase_add_test(tc, test_scalars_01);
+    tcase_add_test(tc, test_reset_01);
+    tcase_add_test(tc, test_submessages_02);
+    tcase_add_test(tc, test_zero_copy);
+    tcase_add_test(tc, test_unbalanced_end);
+    suite_add_tcase(s, tc);
+
+    return s;
+}
+
+int
+main(int argc, const char **argv)
+{
+    int  number_failed;
+    Suite  *suite = test_suite();
+    SRunner  *runner = srunner_create(suite);
+
+    srunner_run_all(runner, CK_NORMAL);
+    number_failed = srunner_ntests_failed(runner);
+    srunner_free(runner);
+
+    return (number_failed == 0)? EXIT_SUCCESS: EXIT_FAILURE;
+}
@@ -0,0 +1,290 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2010, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the LICENSE.txt file in this distribution for license
+ * details.
+ * ----------------------------------------------------------------------
+ */
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <check.h>
+
+#include <push/basics.h>
+#include <push/primitives.h>
+#include <push/talloc.h>
+
+#include <push/protobuf/basics.h>
+#include <push/protobuf/field-map.h>
+
+
+/*-----------------------------------------------------------------------
+ * Helper functions
+ */
+
+static void
+add_field(push_parser_t *parser,
+          push_protobuf_field_map_t *field_map,
+          push_protobuf_tag_number_t field_number,
+          const char *name)
+{
+    push_callback_t  *value;
+
+    value = push_noop_new(NULL, field_map, parser);
+    fail_unless(push_protobuf_field_map_add_field
+                (name, parser, field_map, field_number,
+                 PUSH_PROTOBUF_TAG_TYPE_VARINT, value),
+                "Could not add field %"PRIu32, field_number);
+}
+
+
+static void
+add_duplicate_field(push_parser_t *parser,
+                    push_protobuf_field_map_t *field_map,
+                    push_protobuf_tag_number_t field_number,
+                    const char *name)
+{
+    push_callback_t  *value;
+
+    value = push_noop_new(NULL, field_map, parser);
+    fail_if(push_protobuf_field_map_add_field
+            (name, parser, field_map, field_number,
+             PUSH_PROTOBUF_TAG_TYPE_LENGTH_DELIMITED, value),
+            "Shouldn't add field %"PRIu32" twice", field_number);
+}
+
+
+static void
+check_field(push_protobuf_field_map_t *field_map,
+            push_protobuf_tag_number_t field_number,
+            const char *name)
+{
+    push_callback_t  *callback;
+    char  expected[64];
+
+    callback = push_protobuf_field_map_get_field(field_map, field_number);
+
+    if (name == NULL)
+    {
+        fail_unless(callback == NULL,
+                    "Shouldn't find field %"PRIu32, field_number);
+        return;
+    }
+
+    fail_if(callback == NULL,
+            "Couldn't find field %"PRIu32, field_number);
+
+    snprintf(expected, sizeof(expected), "%s.tag-compose", name);
+    fail_unless(strcmp(push_talloc_get_name(callback), expected) == 0,
+                "Wrong callback for field %"PRIu32
+                " (got %s, expected %s)",
+                field_number, push_talloc_get_name(callback), expected);
+}
+
+
+/*-----------------------------------------------------------------------
+ * Test cases
+ */
+
+START_TEST(test_dense_fields)
+{
+    push_parser_t  *parser;
+    push_protobuf_field_map_t  *field_map;
+
+    PUSH_DEBUG_MSG("---\nStarting test case test_dense_fields\n");
+
+    parser = push_parser_new();
+    fail_if(parser == NULL,
+            "Could not allocate a new push parser");
+
+    field_map = push_protobuf_field_map_new(parser);
+    fail_if(field_map == NULL,
+            "Could not allocate a new field map");
+
+    check_field(field_map, 1, NULL);
+
+    add_field(parser, field_map, 3, "three");
+    add_field(parser, field_map, 1, "one");
+    add_field(parser, field_map, 100, "hundred");
+
+    check_field(field_map, 0, NULL);
+    check_field(field_map, 1, "one");
+    check_field(field_map, 2, NULL);
+    check_field(field_map, 3, "three");
+    check_field(field_map, 99, NULL);
+    check_field(field_map, 100, "hundred");
+    check_field(field_map, 101, NULL);
+
+    push_parser_free(parser);
+}
+END_TEST
+
+
+START_TEST(test_sparse_fields)
+{
+    push_parser_t  *parser;
+    push_protobuf_field_map_t  *field_map;
+
+    PUSH_DEBUG_MSG("---\nStarting test case test_sparse_fields\n");
+
+    parser = push_parser_new();
+    fail_if(parser == NULL,
+            "Could not allocate a new push parser");
+
+    field_map = push_protobuf_field_map_new(parser);
+    fail_if(field_map == NULL,
+            "Could not allocate a new field map");
+
+    add_field(parser, field_map, 536870911, "max");
+    add_field(parser, field_map, 20000, "twenty-thousand");
+    add_field(parser, field_map, 5000, "five-thousand");
+    add_field(parser, field_map, 2, "two");
+    add_field(parser, field_map, 10000, "ten-thousand");
+
+    /*
+     * Look the fields up in order, out of order, and repeatedly, to
+     * exercise both the prediction and the binary search.
+     */
+
+    check_field(field_map, 5000, "five-thousand");
+    check_field(field_map, 10000, "ten-thousand");
+    check_field(field_map, 20000, "twenty-thousand");
+    check_field(field_map, 536870911, "max");
+    check_field(field_map, 10000, "ten-thousand");
+    check_field(field_map, 10000, "ten-thousand");
+    check_field(field_map, 5000, "five-thousand");
+    check_field(field_map, 2, "two");
+
+    check_field(field_map, 4999, NULL);
+    check_field(field_map, 15000, NULL);
+    check_field(field_map, 536870910, NULL);
+
+    push_parser_free(parser);
+}
+END_TEST
+
+
+START_TEST(test_duplicate_fields)
+{
+    push_parser_t  *parser;
+    push_protobuf_field_map_t  *field_map;
+
+    PUSH_DEBUG_MSG("---\nStarting test case test_duplicate_fields\n");
+
+    parser = push_parser_new();
+    fail_if(parser == NULL,
+            "Could not allocate a new push parser");
+
+    field_map = push_protobuf_field_map_new(parser);
+    fail_if(field_map == NULL,
+            "Could not allocate a new field map");
+
+    /*
+     * A field number can only be added once, even with a different
+     * wire type; the first callback is kept.
+     */
+
+    add_field(parser, field_map, 7, "first-small");
+    add_duplicate_field(parser, field_map, 7, "second-small");
+    add_field(parser, field_map, 7000, "first-large");
+    add_duplicate_field(parser, field_map, 7000, "second-large");
+    add_field(parser, field_map, 7001, "next-large");
+
+    check_field(field_map, 7, "first-small");
+    check_field(field_map, 7000, "first-large");
+    check_field(field_map, 7001, "next-large");
+    check_field(field_map, 7000, "first-large");
+
+    fail_if(push_protobuf_field_map_get_tag_callback
+            (field_map,
+             PUSH_PROTOBUF_MAKE_TAG(7, PUSH_PROTOBUF_TAG_TYPE_LENGTH_DELIMITED))
+            != NULL,
+            "Duplicate field shouldn't be in the tag table");
+
+    push_parser_free(parser);
+}
+END_TEST
+
+
+START_TEST(test_tag_callbacks)
+{
+    push_parser_t  *parser;
+    push_protobuf_field_map_t  *field_map;
+
+    PUSH_DEBUG_MSG("---\nStarting test case test_tag_callbacks\n");
+
+    parser = push_parser_new();
+    fail_if(parser == NULL,
+            "Could not allocate a new push parser");
+
+    field_map = push_protobuf_field_map_new(parser);
+    fail_if(field_map == NULL,
+            "Could not allocate a new field map");
+
+    add_field(parser, field_map, 1, "one");
+    add_field(parser, field_map, 2047, "two-byte");
+    add_field(parser, field_map, 2048, "three-byte");
+
+#define CHECK_TAG(number, type, found)                              \
+    fail_unless((push_protobuf_field_map_get_tag_callback           \
+                 (field_map, PUSH_PROTOBUF_MAKE_TAG(number, type))  \
+                 != NULL) == (found),                               \
+                "Wrong tag callback for field %d, type %d",         \
+                (number), (type));
+
+    CHECK_TAG(1, PUSH_PROTOBUF_TAG_TYPE_VARINT, true);
+    CHECK_TAG(1, PUSH_PROTOBUF_TAG_TYPE_LENGTH_DELIMITED, false);
+    CHECK_TAG(2, PUSH_PROTOBUF_TAG_TYPE_VARINT, false);
+    CHECK_TAG(2047, PUSH_PROTOBUF_TAG_TYPE_VARINT, true);
+    CHECK_TAG(2047, PUSH_PROTOBUF_TAG_TYPE_FIXED32, false);
+    CHECK_TAG(2048, PUSH_PROTOBUF_TAG_TYPE_VARINT, false);
+
+#undef CHECK_TAG
+
+    check_field(field_map, 2048, "three-byte");
+
+    push_parser_free(parser);
+}
+END_TEST
+
+
+/*-----------------------------------------------------------------------
+ * Testing harness
+ */
+
+Suite *
+test_suite()
+{
+    Suite  *s = suite_create("protobuf-field-map");
+
+    TCase  *tc = tcase_create("protobuf-field-map");
+    tcase_add_test(tc, test_dense_fields);
+    tcase_add_test(tc, test_sparse_fields);
+    tcase_add_test(tc, test_duplicate_fields);
+    tcase_add_test(tc, test_tag_callbacks);
+    suite_add_tcase(s, tc);
+
+    return s;
+}
+
+
+int
+main(int argc, const char **argv)
+{
+    int  number_failed;
+    Suite  *suite = test_suite();
+    SRunner  *runner = srunner_create(suite);
+
+    srunner_run_all(runner, CK_NORMAL);
+    number_failed = srunner_ntests_failed(runner);
+    srunner_free(runner);
+
+    return (number_failed == 0)? EXIT_SUCCESS: EXIT_FAILURE;
+}
@@ -0,0 +1,420 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2010, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the LICENSE.txt file in this distribution for license
+ * details.
+ * ----------------------------------------------------------------------
+ */
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <check.h>
+#include <hwm-buffer.h>
+
+#include <push/basics.h>
+#include <push/talloc.h>
+
+#include <push/protobuf/basics.h>
+#include <push/protobuf/field-map.h>
+#include <push/protobuf/field-stats.h>
+#include <push/protobuf/message.h>
+
+
+/*-----------------------------------------------------------------------
+ * Our data types
+ */
+
+/*
+ * message Data {
+ *   uint32 id = 1;
+ *   string name = 2;
+ *   Inner inner = 3;            // message Inner { uint32 b = 1; }
+ *   group Extra = 11 {
+ *     uint32 c = 1;
+ *   }
+ * }
+ */
+
+typedef struct _data
+{
+    uint32_t  id;
+    hwm_buffer_t  name;
+    uint32_t  b;
+    uint32_t  c;
+    push_protobuf_field_stats_t  stats;
+    push_protobuf_field_stats_t  inner_stats;
+    push_protobuf_field_stats_t  extra_stats;
+} data_t;
+
+static push_callback_t *
+create_data_message(const char *name,
+                    void *parent,
+                    push_parser_t *parser,
+                    data_t *dest)
+{
+    void  *context;
+    push_protobuf_field_map_t  *field_map;
+    push_protobuf_field_map_t  *inner_map;
+    push_protobuf_field_map_t  *extra_map;
+    push_callback_t  *inner;
+    push_callback_t  *callback;
+
+    context = push_talloc_new(parent);
+    if (context == NULL) return NULL;
+
+    /*
+     * Then create the callbacks.
+     */
+
+    if (name == NULL) name = "data";
+
+    field_map = push_protobuf_field_map_new(context);
+    inner_map = push_protobuf_field_map_new(context);
+    extra_map = push_protobuf_field_map_new(context);
+    if ((field_map == NULL) || (inner_map == NULL) || (extra_map == NULL))
+        goto error;
+
+    push_protobuf_field_map_track_stats(field_map, &dest->stats);
+    push_protobuf_field_map_track_stats(inner_map, &dest->inner_stats);
+    push_protobuf_field_map_track_stats(extra_map, &dest->extra_stats);
+
+#define CHECK(call) { if (!(call)) goto error; }
+
+    CHECK(push_protobuf_assign_uint32("inner", "b", context, parser,
+                                      inner_map, 1, &dest->b));
+
+    inner = push_protobuf_message_new("inner", context, parser,
+                                      inner_map);
+
+    CHECK(push_protobuf_assign_uint32(name, "id", context, parser,
+                                      field_map, 1, &dest->id));
+    CHECK(push_protobuf_add_hwm_string(name, "name", context, parser,
+                                       field_map, 2, &dest->name));
+    CHECK(push_protobuf_add_submessage(name, "inner", context, parser,
+                                       field_map, 3, inner));
+    CHECK(push_protobuf_assign_uint32("extra", "c", context, parser,
+                                      extra_map, 1, &dest->c));
+    CHECK(push_protobuf_add_group(name, "extra", context, parser,
+                                  field_map, 11, extra_map));
+
+#undef CHECK
+
+    callback = push_protobuf_message_new(name, context, parser, field_map);
+
+    if (callback == NULL) goto error;
+    return callback;
+
+  error:
+    push_talloc_free(context);
+    return NULL;
+}
+
+
+/*-----------------------------------------------------------------------
+ * Sample data
+ */
+
+const uint8_t  DATA_01[] =
+    "\x08\x07"                  /* id = 7 */
+    "\x12\x03" "abc"            /* name = "abc" */
+    "\x1a\x02\x08\x09"          /* inner, length = 2 { b = 9 } */
+    "\x48\x63"                  /* field 9, varint = 99 */
+    "\xc0\xbb\x01\x2a"          /* field 3000, varint = 42 */
+    "\x53\x08\x01\x54"          /* field 10, group { 1: 1 } */
+    "\x5b\x08\x05\x10\x06"      /* extra, group { c = 5, 2: 6, */
+    "\xc0\xbb\x01\x04\x5c"      /*   3000: 4 } */
+    "\x08\xac\x02";             /* id = 300 */
+const size_t  LENGTH_01 = 34;
+
+const push_protobuf_field_stat_t  EXPECTED_STATS_01[] =
+{
+    {    1, 2, 5, 0 },
+    {    2, 1, 5, 0 },
+    {    3, 1, 4, 0 },
+    {    9, 1, 2, 0 },
+    { 3000, 1, 4, 0 },
+    {   10, 1, 4, 0 },
+    {   11, 1, 10, 0 }
+};
+
+const push_protobuf_field_stat_t  EXPECTED_INNER_STATS_01[] =
+{
+    {    1, 1, 2, 0 }
+};
+
+const push_protobuf_field_stat_t  EXPECTED_EXTRA_STATS_01[] =
+{
+    {    1, 1, 2, 0 },
+    {    2, 1, 2, 0 },
+    { 3000, 1, 4, 0 }
+};
+
+
+/*
+ * The second id's varint is too long.
+ */
+
+const uint8_t  DATA_02[] =
+    "\x08\x07"                  /* id = 7 */
+    "\x08\xff\xff\xff\xff\xff"  /* id = (too long) */
+    "\xff\xff\xff\xff\xff\xff";
+const size_t  LENGTH_02 = 14;
+
+
+/*-----------------------------------------------------------------------
+ * Helper functions
+ */
+
+static void
+data_init(data_t *data)
+{
+    memset(data, 0, sizeof(data_t));
+    hwm_buffer_init(&data->name);
+    push_protobuf_field_stats_init(&data->stats);
+    push_protobuf_field_stats_init(&data->inner_stats);
+    push_protobuf_field_stats_init(&data->extra_stats);
+}
+
+static void
+data_done(data_t *data)
+{
+    hwm_buffer_done(&data->name);
+    push_protobuf_field_stats_done(&data->stats);
+    push_protobuf_field_stats_done(&data->inner_stats);
+    push_protobuf_field_stats_done(&data->extra_stats);
+}
+
+
+/**
+ * Parse some data, sending it in chunks of at most chunk_size bytes,
+ * with the first chunk ending at first_chunk_size, and return the
+ * result.
+ */
+
+static push_error_code_t
+parse(const uint8_t *buf, size_t length,
+      size_t first_chunk_size, size_t chunk_size,
+      data_t *actual)
+{
+    push_parser_t  *parser;
+    push_callback_t  *callback;
+    push_error_code_t  result;
+    size_t  offset;
+    size_t  size;
+
+    push_protobuf_field_stats_clear(&actual->stats);
+    push_protobuf_field_stats_clear(&actual->inner_stats);
+    push_protobuf_field_stats_clear(&actual->extra_stats);
+
+    parser = push_parser_new();
+    fail_if(parser == NULL,
+            "Could not allocate a new push parser");
+
+    callback = create_data_message("data", parser, parser, actual);
+    fail_if(callback == NULL,
+            "Could not allocate a new message callback");
+
+    push_parser_set_callback(parser, callback);
+
+    fail_unless(push_parser_activate(parser, NULL)
+                == PUSH_INCOMPLETE,
+                "Could not activate parser");
+
+    result = push_parser_submit_data(parser, buf, first_chunk_size);
+
+    for (offset = first_chunk_size;
+         (offset < length) && (result == PUSH_INCOMPLETE);
+         offset += size)
+    {
+        size = length - offset;
+        if (size > chunk_size) size = chunk_size;
+
+        result = push_parser_submit_data(parser, &buf[offset], size);
+    }
+
+    if (result == PUSH_INCOMPLETE)
+        result = push_parser_eof(parser);
+
+    push_parser_free(parser);
+    return result;
+}
+
+
+static bool
+stats_eq(const push_protobuf_field_stats_t *stats,
+         const push_protobuf_field_stat_t *expected,
+         size_t expected_count)
+{
+    size_t  i;
+
+    if (push_protobuf_field_stats_count(stats) != expected_count)
+        return false;
+
+    for (i = 0; i < expected_count; i++)
+    {
+        const push_protobuf_field_stat_t  *stat =
+            push_protobuf_field_stats_get(stats, i);
+
+        if ((stat->number != expected[i].number) ||
+            (stat->occurrences != expected[i].occurrences) ||
+            (stat->bytes != expected[i].bytes) ||
+            (stat->failures != expected[i].failures))
+            return false;
+
+        if (push_protobuf_field_stats_find(stats, stat->number) != stat)
+            return false;
+    }
+
+    return true;
+}
+
+#define STATS_EQ(stats, expected)                                   \
+    stats_eq(stats, expected, sizeof(expected) / sizeof(expected[0]))
+
+
+static void
+read_data_01(size_t first_chunk_size, size_t chunk_size)
+{
+    data_t  actual;
+
+    data_init(&actual);
+
+    fail_unless(parse(DATA_01, LENGTH_01,
+                      first_chunk_size, chunk_size, &actual)
+                == PUSH_SUCCESS,
+                "Could not parse data (split at %zu, %zu)",
+                first_chunk_size, chunk_size);
+
+    fail_unless((actual.id == 300) && (actual.b == 9) && (actual.c == 5),
+                "Data doesn't match (split at %zu, %zu)",
+                first_chunk_size, chunk_size);
+
+    fail_unless(STATS_EQ(&actual.stats, EXPECTED_STATS_01),
+                "Statistics don't match (split at %zu, %zu)",
+                first_chunk_size, chunk_size);
+
+    fail_unless(STATS_EQ(&actual.inner_stats, EXPECTED_INNER_STATS_01),
+                "Inner statistics don't match (split at %zu, %zu)",
+                first_chunk_size, chunk_size);
+
+    fail_unless(STATS_EQ(&actual.extra_stats, EXPECTED_EXTRA_STATS_01),
+                "Group statistics don't match (split at %zu, %zu)",
+                first_chunk_size, chunk_size);
+
+    fail_unless(push_protobuf_field_stats_find(&actual.stats, 4) == NULL,
+                "Field 4 shouldn't have statistics");
+
+    data_done(&actual);
+}
+
+
+/*-----------------------------------------------------------------------
+ * Test cases
+ */
+
+START_TEST(test_read_01)
+{
+    PUSH_DEBUG_MSG("---\nStarting test_read_01\n");
+    read_data_01(LENGTH_01, LENGTH_01);
+}
+END_TEST
+
+
+START_TEST(test_two_part_read_01)
+{
+    size_t  first_chunk_size;
+
+    PUSH_DEBUG_MSG("---\nStarting test_two_part_read_01\n");
+
+    for (first_chunk_size = 1;
+         first_chunk_size < LENGTH_01;
+         first_chunk_size++)
+    {
+        read_data_01(first_chunk_size, LENGTH_01);
+    }
+}
+END_TEST
+
+
+START_TEST(test_bytewise_read_01)
+{
+    PUSH_DEBUG_MSG("---\nStarting test_bytewise_read_01\n");
+    read_data_01(1, 1);
+}
+END_TEST
+
+
+START_TEST(test_failure_02)
+{
+    data_t  actual;
+    const push_protobuf_field_stat_t  *stat;
+    size_t  chunk_size;
+
+    PUSH_DEBUG_MSG("---\nStarting test_failure_02\n");
+
+    data_init(&actual);
+
+    for (chunk_size = 1; chunk_size <= LENGTH_02; chunk_size++)
+    {
+        fail_unless(parse(DATA_02, LENGTH_02, chunk_size, chunk_size,
+                          &actual)
+                    == PUSH_PARSE_ERROR,
+                    "Should get parse error (chunk size %zu)",
+                    chunk_size);
+
+        stat = push_protobuf_field_stats_find(&actual.stats, 1);
+        fail_if(stat == NULL,
+                "Field 1 should have statistics");
+
+        fail_unless((stat->occurrences == 2) &&
+                    (stat->bytes == 2) &&
+                    (stat->failures == 1),
+                    "Statistics don't match (chunk size %zu): "
+                    "%"PRIu64" %"PRIu64" %"PRIu64,
+                    chunk_size, stat->occurrences,
+                    stat->bytes, stat->failures);
+    }
+
+    data_done(&actual);
+}
+END_TEST
+
+
+/*-----------------------------------------------------------------------
+ * Testing harness
+ */
+
+Suite *
+test_suite()
+{
+    Suite  *s = suite_create("protobuf-field-stats");
+
+    TCase  *tc = tcase_create("protobuf-field-stats");
+    tcase_add_test(tc, test_read_01);
+    tcase_add_test(tc, test_two_part_read_01);
+    tcase_add_test(tc, test_bytewise_read_01);
+    tcase_add_test(tc, test_failure_02);
+    suite_add_tcase(s, tc);
+
+    return s;
+}
+
+int
+main(int argc, const char **argv)
+{
+    int  number_failed;
+    Suite  *suite = test_suite();
+    SRunner  *runner = srunner_create(suite);
+
+    srunner_run_all(runner, CK_NORMAL);
+    number_failed = srunner_ntests_failed(runner);
+    srunner_free(runner);
+
+    return (number_failed == 0)? EXIT_SUCCESS: EXIT_FAILURE;
+}
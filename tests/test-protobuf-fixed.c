@@ -0,0 +1,288 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2010, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the LICENSE.txt file in this distribution for license
+ * details.
+ * ----------------------------------------------------------------------
+ */
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <check.h>
+
+#include <push/basics.h>
+#include <push/talloc.h>
+
+#include <push/protobuf/basics.h>
+#include <push/protobuf/field-map.h>
+#include <push/protobuf/message.h>
+#include <push/protobuf/primitives.h>
+
+
+/*-----------------------------------------------------------------------
+ * Our data type
+ */
+
+typedef struct _data
+{
+    uint32_t  fixed32;
+    uint64_t  fixed64;
+    int32_t  sfixed32;
+    int64_t  sfixed64;
+    float  f;
+    double  d;
+    uint32_t  after;
+} data_t;
+
+static push_callback_t *
+create_data_message(const char *name,
+                    void *parent,
+                    push_parser_t *parser,
+                    data_t *dest)
+{
+    void  *context;
+    push_protobuf_field_map_t  *field_map;
+    push_callback_t  *callback;
+
+    context = push_talloc_new(parent);
+    if (context == NULL) return NULL;
+
+    /*
+     * Then create the callbacks.
+     */
+
+    if (name == NULL) name = "data";
+
+    field_map = push_protobuf_field_map_new(context);
+    if (field_map == NULL) goto error;
+
+#define CHECK(call) { if (!(call)) goto error; }
+
+    CHECK(push_protobuf_assign_fixed32(name, "fixed32", context, parser,
+                                       field_map, 1, &dest->fixed32));
+    CHECK(push_protobuf_assign_fixed64(name, "fixed64", context, parser,
+                                       field_map, 2, &dest->fixed64));
+    CHECK(push_protobuf_assign_sfixed32(name, "sfixed32", context, parser,
+                                        field_map, 3, &dest->sfixed32));
+    CHECK(push_protobuf_assign_sfixed64(name, "sfixed64", context, parser,
+                                        field_map, 4, &dest->sfixed64));
+    CHECK(push_protobuf_assign_float(name, "f", context, parser,
+                                     field_map, 5, &dest->f));
+    CHECK(push_protobuf_assign_double(name, "d", context, parser,
+                                      field_map, 6, &dest->d));
+    CHECK(push_protobuf_assign_uint32(name, "after", context, parser,
+                                      field_map, 7, &dest->after));
+
+#undef CHECK
+
+    callback = push_protobuf_message_new(name, context, parser, field_map);
+
+    if (callback == NULL) goto error;
+    return callback;
+
+  error:
+    push_talloc_free(context);
+    return NULL;
+}
+
+static bool
+data_eq(const data_t *d1, const data_t *d2)
+{
+    return
+        (d1->fixed32 == d2->fixed32) && (d1->fixed64 == d2->fixed64) &&
+        (d1->sfixed32 == d2->sfixed32) && (d1->sfixed64 == d2->sfixed64) &&
+        (d1->f == d2->f) && (d1->d == d2->d) &&
+        (d1->after == d2->after);
+}
+
+
+/*-----------------------------------------------------------------------
+ * Sample data
+ */
+
+const uint8_t  DATA_01[] =
+    "\x0d"                      /* field 1, wire type 5 */
+    "\x2c\x01\x00\x00"          /*   value = 300 */
+    "\x11"                      /* field 2, wire type 1 */
+    "\x00\xf2\x05\x2a\x01\x00\x00\x00" /* value = 5,000,000,000 */
+    "\x1d"                      /* field 3, wire type 5 */
+    "\x0c\xfe\xff\xff"          /*   value = -500 */
+    "\x21"                      /* field 4, wire type 1 */
+    "\x00\x0e\xfa\xd5\xfe\xff\xff\xff" /* value = -5,000,000,000 */
+    "\x2d"                      /* field 5, wire type 5 */
+    "\x00\x00\xc0\x3f"          /*   value = 1.5 */
+    "\x31"                      /* field 6, wire type 1 */
+    "\x00\x00\x00\x00\x00\x00\x04\xc0" /* value = -2.5 */
+    "\x45"                      /* field 8, wire type 5 (unknown) */
+    "\xde\xad\xbe\xef"          /*   value */
+    "\x49"                      /* field 9, wire type 1 (unknown) */
+    "\xde\xad\xbe\xef\xde\xad\xbe\xef" /* value */
+    "\x38"                      /* field 7, wire type 0 */
+    "\x2a";                     /*   value = 42 */
+const size_t  LENGTH_01 = 58;
+const data_t  EXPECTED_01 =
+{ 300, UINT64_C(5000000000),
+  -500, INT64_C(-5000000000),
+  1.5, -2.5, 42 };
+
+
+/*-----------------------------------------------------------------------
+ * Test cases
+ */
+
+/**
+ * Parse DATA_01, split into two chunks at first_chunk_size.
+ */
+
+static void
+read_data_01(size_t first_chunk_size)
+{
+    push_parser_t  *parser;
+    push_callback_t  *message_callback;
+    data_t  actual;
+
+    memset(&actual, 0, sizeof(data_t));
+
+    parser = push_parser_new();
+    fail_if(parser == NULL,
+            "Could not allocate a new push parser");
+
+    message_callback = create_data_message("data", NULL,
+                                           parser, &actual);
+    fail_if(message_callback == NULL,
+            "Could not allocate a new message callback");
+
+    push_parser_set_callback(parser, message_callback);
+
+    fail_unless(push_parser_activate(parser, NULL)
+                == PUSH_INCOMPLETE,
+                "Could not activate parser");
+
+    fail_unless(push_parser_submit_data
+                (parser, &DATA_01, first_chunk_size) == PUSH_INCOMPLETE,
+                "Could not parse data");
+
+    if (first_chunk_size < LENGTH_01)
+    {
+        fail_unless(push_parser_submit_data
+                    (parser, &DATA_01[first_chunk_size],
+                     LENGTH_01 - first_chunk_size) == PUSH_INCOMPLETE,
+                    "Could not parse data");
+    }
+
+    fail_unless(push_parser_eof(parser) == PUSH_SUCCESS,
+                "Shouldn't get parse error at EOF");
+
+    fail_unless(data_eq(&actual, &EXPECTED_01),
+                "Value doesn't match (split at %zu)",
+                first_chunk_size);
+
+    push_parser_free(parser);
+}
+
+
+START_TEST(test_read_01)
+{
+    PUSH_DEBUG_MSG("---\nStarting test case test_read_01\n");
+    read_data_01(LENGTH_01);
+}
+END_TEST
+
+
+START_TEST(test_two_part_read_01)
+{
+    size_t  first_chunk_size;
+
+    /*
+     * Try splitting the data at every possible position, so that we
+     * cover values that straddle chunk boundaries.
+     */
+
+    PUSH_DEBUG_MSG("---\nStarting test case test_two_part_read_01\n");
+
+    for (first_chunk_size = 1;
+         first_chunk_size < LENGTH_01;
+         first_chunk_size++)
+    {
+        read_data_01(first_chunk_size);
+    }
+}
+END_TEST
+
+
+START_TEST(test_fixed32_eof)
+{
+    push_parser_t  *parser;
+    push_callback_t  *callback;
+
+    PUSH_DEBUG_MSG("---\nStarting test case test_fixed32_eof\n");
+
+    /*
+     * Three bytes of a fixed32, and then EOF, is a parse error.
+     */
+
+    parser = push_parser_new();
+    fail_if(parser == NULL,
+            "Could not allocate a new push parser");
+
+    callback = push_protobuf_fixed32_new("fixed32", NULL, parser);
+    fail_if(callback == NULL,
+            "Could not allocate a new fixed32 callback");
+
+    push_parser_set_callback(parser, callback);
+
+    fail_unless(push_parser_activate(parser, NULL)
+                == PUSH_INCOMPLETE,
+                "Could not activate parser");
+
+    fail_unless(push_parser_submit_data
+                (parser, &DATA_01[1], 3) == PUSH_INCOMPLETE,
+                "Could not parse data");
+
+    fail_unless(push_parser_eof(parser) == PUSH_PARSE_ERROR,
+                "Should get parse error at EOF");
+
+    push_parser_free(parser);
+}
+END_TEST
+
+
+/*-----------------------------------------------------------------------
+ * Testing harness
+ */
+
+Suite *
+test_suite()
+{
+    Suite  *s = suite_create("protobuf-fixed");
+
+    TCase  *tc = tcase_create("protobuf-fixed");
+    tcase_add_test(tc, test_read_01);
+    tcase_add_test(tc, test_two_part_read_01);
+    tcase_add_test(tc, test_fixed32_eof);
+    suite_add_tcase(s, tc);
+
+    return s;
+}
+
+
+int
+main(int argc, const char **argv)
+{
+    int  number_failed;
+    Suite  *suite = test_suite();
+    SRunner  *runner = srunner_create(suite);
+
+    srunner_run_all(runner, CK_NORMAL);
+    number_failed = srunner_ntests_failed(runner);
+    srunner_free(runner);
+
+    return (number_failed == 0)? EXIT_SUCCESS: EXIT_FAILURE;
+}
@@ -0,0 +1,320 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2010, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the LICENSE.txt file in this distribution for license
+ * details.
+ * ----------------------------------------------------------------------
+ */
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <check.h>
+#include <hwm-buffer.h>
+
+#include <push/basics.h>
+
+#include <test-generated.pb.h>
+
+
+/*-----------------------------------------------------------------------
+ * Sample data
+ */
+
+const uint8_t  DATA_01[] =
+    "\x08"                                     /* field 1, wire type 0 */
+    "\x8c\xfc\xff\xff\xff\xff\xff\xff\xff\x01" /*   value = -500 */
+    "\x10"                                     /* field 2, wire type 0 */
+    "\x80\x9c\xe8\xaf\xed\xff\xff\xff\xff\x01" /*   value = -5000000000 */
+    "\x18"                                     /* field 3, wire type 0 */
+    "\xac\x02"                                 /*   value = 300 */
+    "\x20"                                     /* field 4, wire type 0 */
+    "\x80\xe4\x97\xd0\x12"                     /*   value = 5000000000 */
+    "\x28"                                     /* field 5, wire type 0 */
+    "\xe7\x07"                                 /*   value = -500 */
+    "\x30"                                     /* field 6, wire type 0 */
+    "\xff\xc7\xaf\xa0\x25"                     /*   value = -5000000000 */
+    "\x38"                                     /* field 7, wire type 0 */
+    "\x01"                                     /*   value = true */
+    "\xa0\x06"                                 /* field 100, wire type 0 */
+    "\xb9\x60"                                 /*   (unknown) */
+    "\x45"                                     /* field 8, wire type 5 */
+    "\xef\xbe\xad\xde"                         /*   value = 0xdeadbeef */
+    "\x4d"                                     /* field 9, wire type 5 */
+    "\xfe\xff\xff\xff"                         /*   value = -2 */
+    "\x55"                                     /* field 10, wire type 5 */
+    "\x00\x00\xc0\x3f"                         /*   value = 1.5 */
+    "\x59"                                     /* field 11, wire type 1 */
+    "\xef\xcd\xab\x89\x67\x45\x23\x01"         /*   value = 0x0123456789abcdef */
+    "\x61"                                     /* field 12, wire type 1 */
+    "\xfd\xff\xff\xff\xff\xff\xff\xff"         /*   value = -3 */
+    "\x69"                                     /* field 13, wire type 1 */
+    "\x00\x00\x00\x00\x00\x00\xd0\xbf"         /*   value = -0.25 */
+    "\xab\x06"                                 /* field 101, wire type 3 (unknown) */
+    "\x08\x07"                                 /*   field 1 = 7 */
+    "\x72\x01\x78"                             /*   field 14 = "x" */
+    "\xac\x06"                                 /* field 101, wire type 4 */
+    "\x72"                                     /* field 14, wire type 2 */
+    "\x05"                                     /*   length = 5 */
+    "\x68\x65\x6c\x6c\x6f"                     /*   value */
+    "\x7a"                                     /* field 15, wire type 2 */
+    "\x00"                                     /*   length = 0 */
+    "\x80\x01"                                 /* field 16, wire type 0 */
+    "\x02"                                     /*   value = BLUE */
+    "\x8a\x01"                                 /* field 17, wire type 2 */
+    "\x06"                                     /*   length = 6 */
+    "\x08\x2a"                                 /*   field 1 = 42 */
+    "\x12\x02\x68\x69"                         /*   field 2 = "hi" */
+    "\x92\x01"                                 /* field 18, wire type 2 */
+    "\x06"                                     /*   length = 6 */
+    "\x01\xac\x02\xf0\xa2\x04"                 /*   values = 1, 300, 70000 */
+    "\x98\x01"                                 /* field 19, wire type 0 */
+    "\x01"                                     /*   value = -1 */
+    "\x98\x01"                                 /* field 19, wire type 0 */
+    "\x04"                                     /*   value = 2 */
+    "\xa2\x01"                                 /* field 20, wire type 2 */
+    "\x08"                                     /*   length = 8 */
+    "\x05\x00\x00\x00\x06\x00\x00\x00";        /*   values = 5, 6 */
+const size_t  LENGTH_01 = 144;
+
+
+/*
+ * A varint that never ends.
+ */
+
+const uint8_t  DATA_02[] =
+    "\x08"                                     /* field 1, wire type 0 */
+    "\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff" /*   value (too long) */
+    "\x01";
+const size_t  LENGTH_02 = 12;
+
+
+/*-----------------------------------------------------------------------
+ * Helper functions
+ */
+
+static bool
+buf_eq(const hwm_buffer_t *buf, const void *expected, size_t size)
+{
+    return
+        (buf->current_size == size) &&
+        (memcmp(hwm_buffer_mem(buf, void), expected, size) == 0);
+}
+
+
+static void
+check_data_01(everything_t *actual, size_t first_chunk_size)
+{
+    const uint32_t  expected_packed[] = { 1, 300, 70000 };
+    const int32_t  expected_unpacked[] = { -1, 2 };
+    const uint32_t  expected_fixed[] = { 5, 6 };
+
+#define CHECK(cond)                                                 \
+    fail_unless((cond), "Check failed (split at %zu): %s",          \
+                first_chunk_size, #cond);
+
+    CHECK(actual->f_int32 == -500);
+    CHECK(actual->f_int64 == INT64_C(-5000000000));
+    CHECK(actual->f_uint32 == 300);
+    CHECK(actual->f_uint64 == UINT64_C(5000000000));
+    CHECK(actual->f_sint32 == -500);
+    CHECK(actual->f_sint64 == INT64_C(-5000000000));
+    CHECK(actual->f_bool);
+    CHECK(actual->f_fixed32 == 0xdeadbeef);
+    CHECK(actual->f_sfixed32 == -2);
+    CHECK(actual->f_float == 1.5);
+    CHECK(actual->f_fixed64 == UINT64_C(0x0123456789abcdef));
+    CHECK(actual->f_sfixed64 == -3);
+    CHECK(actual->f_double == -0.25);
+    CHECK(buf_eq(&actual->f_string, "hello", 6));
+    CHECK(buf_eq(&actual->f_bytes, "", 1));
+    CHECK(actual->f_color == COLOR_BLUE);
+    CHECK(actual->f_inner.a == 42);
+    CHECK(buf_eq(&actual->f_inner.s, "hi", 3));
+    CHECK(buf_eq(&actual->r_packed,
+                 expected_packed, sizeof(expected_packed)));
+    CHECK(buf_eq(&actual->r_unpacked,
+                 expected_unpacked, sizeof(expected_unpacked)));
+    CHECK(buf_eq(&actual->r_fixed,
+                 expected_fixed, sizeof(expected_fixed)));
+
+#undef CHECK
+}
+
+
+static push_error_code_t
+parse_everything(everything_t *actual,
+                 const uint8_t *data, size_t length,
+                 size_t first_chunk_size)
+{
+    push_parser_t  *parser;
+    push_callback_t  *callback;
+    push_error_code_t  result;
+
+    parser = push_parser_new();
+    fail_if(parser == NULL,
+            "Could not allocate a new push parser");
+
+    callback = everything_parser_new("everything", parser,
+                                     parser, actual);
+    fail_if(callback == NULL,
+            "Could not allocate a new generated callback");
+
+    push_parser_set_callback(parser, callback);
+
+    result = push_parser_activate(parser, NULL);
+
+    if (result == PUSH_INCOMPLETE)
+        result = push_parser_submit_data(parser, data, first_chunk_size);
+
+    if ((result == PUSH_INCOMPLETE) && (first_chunk_size < length))
+        result = push_parser_submit_data(parser, data + first_chunk_size,
+                                         length - first_chunk_size);
+
+    if (result == PUSH_INCOMPLETE)
+        result = push_parser_eof(parser);
+
+    push_parser_free(parser);
+    return result;
+}
+
+
+/*-----------------------------------------------------------------------
+ * Test cases
+ */
+
+START_TEST(test_read_01)
+{
+    everything_t  actual;
+
+    PUSH_DEBUG_MSG("---\nStarting test case test_read_01\n");
+
+    everything_init(&actual);
+
+    fail_unless(parse_everything(&actual, DATA_01, LENGTH_01, LENGTH_01)
+                == PUSH_SUCCESS,
+                "Could not parse data");
+
+    check_data_01(&actual, LENGTH_01);
+    everything_done(&actual);
+}
+END_TEST
+
+
+START_TEST(test_two_part_read_01)
+{
+    size_t  first_chunk_size;
+
+    PUSH_DEBUG_MSG("---\nStarting test case test_two_part_read_01\n");
+
+    for (first_chunk_size = 1;
+         first_chunk_size < LENGTH_01;
+         first_chunk_size++)
+    {
+        everything_t  actual;
+
+        everything_init(&actual);
+
+        fail_unless(parse_everything(&actual, DATA_01, LENGTH_01,
+                                     first_chunk_size)
+                    == PUSH_SUCCESS,
+                    "Could not parse data (split at %zu)",
+                    first_chunk_size);
+
+        check_data_01(&actual, first_chunk_size);
+        everything_done(&actual);
+    }
+}
+END_TEST
+
+
+START_TEST(test_parse_error_01)
+{
+    /*
+     * Truncate the data in the middle of a packed field, an embedded
+     * message, and a string.
+     */
+
+    static const size_t  lengths[] = { 143, 122, 113, 101 };
+    size_t  i;
+
+    PUSH_DEBUG_MSG("---\nStarting test case test_parse_error_01\n");
+
+    for (i = 0; i < sizeof(lengths) / sizeof(lengths[0]); i++)
+    {
+        everything_t  actual;
+
+        everything_init(&actual);
+
+        fail_unless(parse_everything(&actual, DATA_01, lengths[i],
+                                     lengths[i])
+                    == PUSH_PARSE_ERROR,
+                    "Should get parse error at EOF (length %zu)",
+                    lengths[i]);
+
+        everything_done(&actual);
+    }
+}
+END_TEST
+
+
+START_TEST(test_varint_too_long)
+{
+    everything_t  actual;
+
+    PUSH_DEBUG_MSG("---\nStarting test case test_varint_too_long\n");
+
+    everything_init(&actual);
+
+    fail_unless(parse_everything(&actual, DATA_02, LENGTH_02, LENGTH_02)
+                == PUSH_PARSE_ERROR,
+                "Should get parse error for overlong varint");
+
+    fail_unless(parse_everything(&actual, DATA_02, LENGTH_02, 3)
+                == PUSH_PARSE_ERROR,
+                "Should get parse error for split overlong varint");
+
+    everything_done(&actual);
+}
+END_TEST
+
+
+/*-----------------------------------------------------------------------
+ * Testing harness
+ */
+
+Suite *
+test_suite()
+{
+    Suite  *s = suite_create("protobuf-generated");
+
+    TCase  *tc = tcase_create("protobuf-generated");
+    tcase_add_test(tc, test_read_01);
+    tcase_add_test(tc, test_two_part_read_01);
+    tcase_add_test(tc, test_parse_error_01);
+    tcase_add_test(tc, test_varint_too_long);
+    suite_add_tcase(s, tc);
+
+    return s;
+}
+
+
+int
+main(int argc, const char **argv)
+{
+    int  number_failed;
+    Suite  *suite = test_suite();
+    SRunner  *runner = srunner_create(suite);
+
+    srunner_run_all(runner, CK_NORMAL);
+    number_failed = srunner_ntests_failed(runner);
+    srunner_free(runner);
+
+    return (number_failed == 0)? EXIT_SUCCESS: EXIT_FAILURE;
+}
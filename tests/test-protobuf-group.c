@@ -0,0 +1,430 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2010, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the LICENSE.txt file in this distribution for license
+ * details.
+ * ----------------------------------------------------------------------
+ */
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <check.h>
+
+#include <push/basics.h>
+#include <push/talloc.h>
+
+#include <push/protobuf/basics.h>
+#include <push/protobuf/field-map.h>
+#include <push/protobuf/message.h>
+
+
+/*-----------------------------------------------------------------------
+ * Our data type
+ */
+
+/*
+ * message Data {
+ *   uint32 id = 1;
+ *   group Item = 2 {
+ *     uint32 a = 3;
+ *     Inner inner = 4;          // message Inner { uint32 b = 1; }
+ *     group Deep = 5 {
+ *       required uint32 c = 6;
+ *     }
+ *     uint32 x = 3000;
+ *   }
+ *   uint32 tail = 7;
+ * }
+ */
+
+typedef struct _data
+{
+    uint32_t  id;
+    uint32_t  a;
+    uint32_t  b;
+    uint32_t  c;
+    uint32_t  x;
+    uint32_t  tail;
+} data_t;
+
+static push_callback_t *
+create_data_message(const char *name,
+                    void *parent,
+                    push_parser_t *parser,
+                    data_t *dest)
+{
+    void  *context;
+    push_protobuf_field_map_t  *data_map;
+    push_protobuf_field_map_t  *item_map;
+    push_protobuf_field_map_t  *inner_map;
+    push_protobuf_field_map_t  *deep_map;
+    push_callback_t  *inner;
+    push_callback_t  *callback;
+
+    context = push_talloc_new(parent);
+    if (context == NULL) return NULL;
+
+    /*
+     * Then create the callbacks.
+     */
+
+    data_map = push_protobuf_field_map_new(context);
+    item_map = push_protobuf_field_map_new(context);
+    inner_map = push_protobuf_field_map_new(context);
+    deep_map = push_protobuf_field_map_new(context);
+    if ((data_map == NULL) || (item_map == NULL) ||
+        (inner_map == NULL) || (deep_map == NULL))
+        goto error;
+
+#define CHECK(call) { if (!(call)) goto error; }
+
+    CHECK(push_protobuf_assign_uint32("deep", "c", context, parser,
+                                      deep_map, 6, &dest->c));
+    CHECK(push_protobuf_field_map_require_field(deep_map, 6));
+
+    CHECK(push_protobuf_assign_uint32("inner", "b", context, parser,
+                                      inner_map, 1, &dest->b));
+
+    inner = push_protobuf_message_new("inner", context, parser,
+                                      inner_map);
+
+    CHECK(push_protobuf_assign_uint32("item", "a", context, parser,
+                                      item_map, 3, &dest->a));
+    CHECK(push_protobuf_add_submessage("item", "inner", context, parser,
+                                       item_map, 4, inner));
+    CHECK(push_protobuf_add_group("item", "deep", context, parser,
+                                  item_map, 5, deep_map));
+    CHECK(push_protobuf_assign_uint32("item", "x", context, parser,
+                                      item_map, 3000, &dest->x));
+
+    CHECK(push_protobuf_assign_uint32(name, "id", context, parser,
+                                      data_map, 1, &dest->id));
+    CHECK(push_protobuf_add_group(name, "item", context, parser,
+                                  data_map, 2, item_map));
+    CHECK(push_protobuf_assign_uint32(name, "tail", context, parser,
+                                      data_map, 7, &dest->tail));
+
+#undef CHECK
+
+    callback = push_protobuf_message_new(name, context, parser, data_map);
+
+    if (callback == NULL) goto error;
+    return callback;
+
+  error:
+    push_talloc_free(context);
+    return NULL;
+}
+
+
+/*-----------------------------------------------------------------------
+ * Sample data
+ */
+
+const uint8_t  DATA_01[] =
+    "\x08\x01"                  /* id = 1 */
+    "\x13"                      /* item, start group */
+    "\x18\x05"                  /*   a = 5 */
+    "\x22\x02\x08\x09"          /*   inner, length = 2 { b = 9 } */
+    "\x2b"                      /*   deep, start group */
+    "\x30\x0b"                  /*     c = 11 */
+    "\x43\x08\x01\x44"          /*     field 8, group { 1: 1 } */
+    "\x2c"                      /*   deep, end group */
+    "\xc0\xbb\x01\x2a"          /*   x = 42 */
+    "\x48\x63"                  /*   field 9, varint = 99 */
+    "\x14"                      /* item, end group */
+    "\x38\x07";                 /* tail = 7 */
+const size_t  LENGTH_01 = 26;
+
+
+/*
+ * An END_GROUP for a field that isn't the group we're in.
+ */
+
+const uint8_t  DATA_02[] =
+    "\x13"                      /* item, start group */
+    "\x18\x05"                  /*   a = 5 */
+    "\x4c"                      /*   field 9, end group */
+    "\x38\x07";                 /* tail = 7 */
+const size_t  LENGTH_02 = 6;
+
+
+/*
+ * A group that's never finished.
+ */
+
+const uint8_t  DATA_03[] =
+    "\x08\x01"                  /* id = 1 */
+    "\x13"                      /* item, start group */
+    "\x18\x05";                 /*   a = 5 */
+const size_t  LENGTH_03 = 5;
+
+
+/*
+ * A deep group that's missing its required field, followed by more
+ * fields of the enclosing message.
+ */
+
+const uint8_t  DATA_04[] =
+    "\x13"                      /* item, start group */
+    "\x2b"                      /*   deep, start group */
+    "\x2c"                      /*   deep, end group */
+    "\x14"                      /* item, end group */
+    "\x38\x07";                 /* tail = 7 */
+const size_t  LENGTH_04 = 6;
+
+
+/*-----------------------------------------------------------------------
+ * Helper functions
+ */
+
+/**
+ * Parse some data, sending it in chunks of at most chunk_size bytes,
+ * with the first chunk ending at first_chunk_size, and return the
+ * result.
+ */
+
+static push_error_code_t
+parse(const uint8_t *buf, size_t length,
+      size_t first_chunk_size, size_t chunk_size,
+      size_t max_depth, data_t *actual)
+{
+    push_parser_t  *parser;
+    push_callback_t  *callback;
+    push_parser_limits_t  limits;
+    push_error_code_t  result;
+    size_t  offset;
+    size_t  size;
+
+    memset(actual, 0, sizeof(data_t));
+
+    parser = push_parser_new();
+    fail_if(parser == NULL,
+            "Could not allocate a new push parser");
+
+    callback = create_data_message("data", parser, parser, actual);
+    fail_if(callback == NULL,
+            "Could not allocate a new message callback");
+
+    push_parser_set_callback(parser, callback);
+
+    limits.max_depth = max_depth;
+    limits.max_message_bytes = 0;
+    limits.max_field_count = 0;
+    push_parser_set_limits(parser, &limits);
+
+    fail_unless(push_parser_activate(parser, NULL)
+                == PUSH_INCOMPLETE,
+                "Could not activate parser");
+
+    result = push_parser_submit_data(parser, buf, first_chunk_size);
+
+    for (offset = first_chunk_size;
+         (offset < length) && (result == PUSH_INCOMPLETE);
+         offset += size)
+    {
+        size = length - offset;
+        if (size > chunk_size) size = chunk_size;
+
+        result = push_parser_submit_data(parser, &buf[offset], size);
+    }
+
+    if (result == PUSH_INCOMPLETE)
+        result = push_parser_eof(parser);
+
+    push_parser_free(parser);
+    return result;
+}
+
+
+static void
+read_data_01(size_t first_chunk_size, size_t chunk_size)
+{
+    data_t  actual;
+    push_error_code_t  result;
+
+    result = parse(DATA_01, LENGTH_01,
+                   first_chunk_size, chunk_size, 0, &actual);
+
+    fail_unless(result == PUSH_SUCCESS,
+                "Could not parse data (split at %zu, %zu)",
+                first_chunk_size, chunk_size);
+
+    fail_unless((actual.id == 1) && (actual.a == 5) &&
+                (actual.b == 9) && (actual.c == 11) &&
+                (actual.x == 42) && (actual.tail == 7),
+                "Data doesn't match (split at %zu, %zu): "
+                "%"PRIu32" %"PRIu32" %"PRIu32" "
+                "%"PRIu32" %"PRIu32" %"PRIu32,
+                first_chunk_size, chunk_size,
+                actual.id, actual.a, actual.b,
+                actual.c, actual.x, actual.tail);
+}
+
+
+/*-----------------------------------------------------------------------
+ * Test cases
+ */
+
+START_TEST(test_read_01)
+{
+    PUSH_DEBUG_MSG("---\nStarting test_read_01\n");
+    read_data_01(LENGTH_01, LENGTH_01);
+}
+END_TEST
+
+
+START_TEST(test_two_part_read_01)
+{
+    size_t  first_chunk_size;
+
+    PUSH_DEBUG_MSG("---\nStarting test_two_part_read_01\n");
+
+    for (first_chunk_size = 1;
+         first_chunk_size < LENGTH_01;
+         first_chunk_size++)
+    {
+        read_data_01(first_chunk_size, LENGTH_01);
+    }
+}
+END_TEST
+
+
+START_TEST(test_bytewise_read_01)
+{
+    PUSH_DEBUG_MSG("---\nStarting test_bytewise_read_01\n");
+    read_data_01(1, 1);
+}
+END_TEST
+
+
+START_TEST(test_max_depth_01)
+{
+    data_t  actual;
+    size_t  chunk_size;
+
+    PUSH_DEBUG_MSG("---\nStarting test_max_depth_01\n");
+
+    /*
+     * The deep group, and the inner submessage, are both at depth 2.
+     */
+
+    for (chunk_size = 1; chunk_size <= LENGTH_01; chunk_size++)
+    {
+        fail_unless(parse(DATA_01, LENGTH_01, chunk_size, chunk_size,
+                          2, &actual) == PUSH_SUCCESS,
+                    "Should parse with max_depth 2 "
+                    "(chunk size %zu)", chunk_size);
+
+        fail_unless(parse(DATA_01, LENGTH_01, chunk_size, chunk_size,
+                          1, &actual) == PUSH_PARSE_ERROR,
+                    "Should exceed max_depth 1 "
+                    "(chunk size %zu)", chunk_size);
+    }
+}
+END_TEST
+
+
+START_TEST(test_mismatched_end_02)
+{
+    data_t  actual;
+    size_t  chunk_size;
+
+    PUSH_DEBUG_MSG("---\nStarting test_mismatched_end_02\n");
+
+    for (chunk_size = 1; chunk_size <= LENGTH_02; chunk_size++)
+    {
+        fail_unless(parse(DATA_02, LENGTH_02, chunk_size, chunk_size,
+                          0, &actual) == PUSH_PARSE_ERROR,
+                    "Should get parse error (chunk size %zu)",
+                    chunk_size);
+    }
+}
+END_TEST
+
+
+START_TEST(test_unfinished_group_03)
+{
+    data_t  actual;
+    size_t  chunk_size;
+
+    PUSH_DEBUG_MSG("---\nStarting test_unfinished_group_03\n");
+
+    for (chunk_size = 1; chunk_size <= LENGTH_03; chunk_size++)
+    {
+        fail_unless(parse(DATA_03, LENGTH_03, chunk_size, chunk_size,
+                          0, &actual) == PUSH_PARSE_ERROR,
+                    "Should get parse error (chunk size %zu)",
+                    chunk_size);
+    }
+}
+END_TEST
+
+
+START_TEST(test_missing_required_04)
+{
+    data_t  actual;
+    size_t  chunk_size;
+
+    PUSH_DEBUG_MSG("---\nStarting test_missing_required_04\n");
+
+    /*
+     * Even when everything arrives in one chunk, the missing field
+     * must fail the message, rather than ending it early.
+     */
+
+    for (chunk_size = 1; chunk_size <= LENGTH_04; chunk_size++)
+    {
+        fail_unless(parse(DATA_04, LENGTH_04, chunk_size, chunk_size,
+                          0, &actual) == PUSH_PARSE_ERROR,
+                    "Should get missing field error (chunk size %zu)",
+                    chunk_size);
+        fail_unless(actual.tail == 0,
+                    "Shouldn't read the tail (chunk size %zu)",
+                    chunk_size);
+    }
+}
+END_TEST
+
+
+/*-----------------------------------------------------------------------
+ * Testing harness
+ */
+
+Suite *
+test_suite()
+{
+    Suite  *s = suite_create("protobuf-group");
+
+    TCase  *tc = tcase_create("protobuf-group");
+    tcase_add_test(tc, test_read_01);
+    tcase_add_test(tc, test_two_part_read_01);
+    tcase_add_test(tc, test_bytewise_read_01);
+    tcase_add_test(tc, test_max_depth_01);
+    tcase_add_test(tc, test_mismatched_end_02);
+    tcase_add_test(tc, test_unfinished_group_03);
+    tcase_add_test(tc, test_missing_required_04);
+    suite_add_tcase(s, tc);
+
+    return s;
+}
+
+int
+main(int argc, const char **argv)
+{
+    int  number_failed;
+    Suite  *suite = test_suite();
+    SRunner  *runner = srunner_create(suite);
+
+    srunner_run_all(runner, CK_NORMAL);
+    number_failed = srunner_ntests_failed(runner);
+    srunner_free(runner);
+
+    return (number_failed == 0)? EXIT_SUCCESS: EXIT_FAILURE;
+}
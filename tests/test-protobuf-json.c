@@ -0,0 +1,854 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2010, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the LICENSE.txt file in this distribution for license
+ * details.
+ * ----------------------------------------------------------------------
+ */
+
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <check.h>
+#include <hwm-buffer.h>
+
+#include <push/basics.h>
+#include <push/talloc.h>
+
+#include <push/protobuf/basics.h>
+#include <push/protobuf/dynamic.h>
+#include <push/protobuf/json.h>
+
+
+/*-----------------------------------------------------------------------
+ * Sample data
+ */
+
+/*
+ * The output of protoc --descriptor_set_out for the following file
+ * (the same as in test-protobuf-dynamic.c):
+ *
+ *   syntax = "proto2";
+ *   package test;
+ *
+ *   message Node
+ *   {
+ *       enum Kind { LEAF = 0; BRANCH = 1; }
+ *
+ *       message Label
+ *       {
+ *           optional string text = 1;
+ *           optional double weight = 2;
+ *       }
+ *
+ *       optional uint32 id = 1;
+ *       optional Kind kind = 2;
+ *       optional Label label = 3;
+ *       repeated Node children = 4;
+ *       repeated sint32 deltas = 5 [packed = true];
+ *       repeated fixed64 stamps = 6;
+ *       optional int32 offset = 7;
+ *   }
+ */
+
+const uint8_t  DESCRIPTOR_SET[] =
+    "\x0a\xbf\x02\x0a\x0a\x74\x72\x65\x65\x2e\x70\x72"
+    "\x6f\x74\x6f\x12\x04\x74\x65\x73\x74\x22\xaa\x02"
+    "\x0a\x04\x4e\x6f\x64\x65\x12\x0e\x0a\x02\x69\x64"
+    "\x18\x01\x20\x01\x28\x0d\x52\x02\x69\x64\x12\x23"
+    "\x0a\x04\x6b\x69\x6e\x64\x18\x02\x20\x01\x28\x0e"
+    "\x32\x0f\x2e\x74\x65\x73\x74\x2e\x4e\x6f\x64\x65"
+    "\x2e\x4b\x69\x6e\x64\x52\x04\x6b\x69\x6e\x64\x12"
+    "\x26\x0a\x05\x6c\x61\x62\x65\x6c\x18\x03\x20\x01"
+    "\x28\x0b\x32\x10\x2e\x74\x65\x73\x74\x2e\x4e\x6f"
+    "\x64\x65\x2e\x4c\x61\x62\x65\x6c\x52\x05\x6c\x61"
+    "\x62\x65\x6c\x12\x26\x0a\x08\x63\x68\x69\x6c\x64"
+    "\x72\x65\x6e\x18\x04\x20\x03\x28\x0b\x32\x0a\x2e"
+    "\x74\x65\x73\x74\x2e\x4e\x6f\x64\x65\x52\x08\x63"
+    "\x68\x69\x6c\x64\x72\x65\x6e\x12\x1a\x0a\x06\x64"
+    "\x65\x6c\x74\x61\x73\x18\x05\x20\x03\x28\x11\x42"
+    "\x02\x10\x01\x52\x06\x64\x65\x6c\x74\x61\x73\x12"
+    "\x16\x0a\x06\x73\x74\x61\x6d\x70\x73\x18\x06\x20"
+    "\x03\x28\x06\x52\x06\x73\x74\x61\x6d\x70\x73\x12"
+    "\x16\x0a\x06\x6f\x66\x66\x73\x65\x74\x18\x07\x20"
+    "\x01\x28\x05\x52\x06\x6f\x66\x66\x73\x65\x74\x1a"
+    "\x33\x0a\x05\x4c\x61\x62\x65\x6c\x12\x12\x0a\x04"
+    "\x74\x65\x78\x74\x18\x01\x20\x01\x28\x09\x52\x04"
+    "\x74\x65\x78\x74\x12\x16\x0a\x06\x77\x65\x69\x67"
+    "\x68\x74\x18\x02\x20\x01\x28\x01\x52\x06\x77\x65"
+    "\x69\x67\x68\x74\x22\x1c\x0a\x04\x4b\x69\x6e\x64"
+    "\x12\x08\x0a\x04\x4c\x45\x41\x46\x10\x00\x12\x0a"
+    "\x0a\x06\x42\x52\x41\x4e\x43\x48\x10\x01";
+
+const size_t  DESCRIPTOR_SET_LENGTH = 322;
+
+
+const uint8_t  DATA_01[] =
+    "\x08\x01"                  /* id = 1 */
+    "\x10\x01"                  /* kind = BRANCH */
+    "\x1a\x0f"                  /* label, length = 15 */
+    "\x0a\x04" "root"           /*   text = "root" */
+    "\x11\x00\x00\x00\x00"      /*   weight = 0.5 */
+    "\x00\x00\xe0\x3f"
+    "\x22\x0d"                  /* children, length = 13 */
+    "\x08\x02"                  /*   id = 2 */
+    "\x1a\x03"                  /*   label, length = 3 */
+    "\x0a\x01" "a"              /*     text = "a" */
+    "\x2a\x04"                  /*   deltas, length = 4 */
+    "\x01\x04\xd7\x04"          /*     -1, 2, -300 */
+    "\x22\x25"                  /* children, length = 37 */
+    "\x08\x03"                  /*   id = 3 */
+    "\x10\x01"                  /*   kind = BRANCH */
+    "\x22\x0d"                  /*   children, length = 13 */
+    "\x08\x04"                  /*     id = 4 */
+    "\x38\xf9\xff\xff\xff"      /*     offset = -7 */
+    "\xff\xff\xff\xff\xff\x01"
+    "\x31\x11\x00\x00\x00"      /*   stamps = 17 */
+    "\x00\x00\x00\x00"
+    "\x31\x12\x00\x00\x00"      /*   stamps = 18 */
+    "\x00\x00\x00\x00"
+    "\x2a\x01\x0a"              /* deltas, length = 1: 5 */
+    "\x38\xfe\xff\xff\xff"      /* offset = -2 */
+    "\xff\xff\xff\xff\xff\x01";
+
+const size_t  LENGTH_01 = 89;
+
+const char  *EXPECTED_01 =
+    "{\"id\":1,\"kind\":1,"
+    "\"label\":{\"text\":\"root\",\"weight\":0.5},"
+    "\"children\":["
+    "{\"id\":2,\"label\":{\"text\":\"a\"},\"deltas\":[-1,2,-300]},"
+    "{\"id\":3,\"kind\":1,\"children\":[{\"id\":4,\"offset\":-7}],"
+    "\"stamps\":[\"17\",\"18\"]}],"
+    "\"deltas\":[5],\"offset\":-2}";
+
+
+/*
+ * A message type with a field of each scalar type:
+ *
+ *   message Scalars
+ *   {
+ *       optional int32 a = 1;
+ *       optional int64 b = 2;
+ *       optional uint32 c = 3;
+ *       optional uint64 d = 4;
+ *       optional sint32 e = 5;
+ *       optional sint64 f = 6;
+ *       optional bool g = 7;
+ *       optional fixed32 h = 8;
+ *       optional sfixed32 i = 9;
+ *       optional float j = 10;
+ *       optional fixed64 k = 11;
+ *       optional sfixed64 l = 12;
+ *       optional double m = 13;
+ *       optional string n = 14;
+ *       optional bytes o = 15;
+ *       repeated uint32 p = 16;
+ *   }
+ */
+
+#define OPTIONAL  PUSH_PROTOBUF_LABEL_OPTIONAL
+#define REPEATED  PUSH_PROTOBUF_LABEL_REPEATED
+
+const push_protobuf_field_descriptor_t  SCALAR_FIELDS[] =
+{
+    { "a",  1, OPTIONAL, PUSH_PROTOBUF_TYPE_INT32,    false, NULL },
+    { "b",  2, OPTIONAL, PUSH_PROTOBUF_TYPE_INT64,    false, NULL },
+    { "c",  3, OPTIONAL, PUSH_PROTOBUF_TYPE_UINT32,   false, NULL },
+    { "d",  4, OPTIONAL, PUSH_PROTOBUF_TYPE_UINT64,   false, NULL },
+    { "e",  5, OPTIONAL, PUSH_PROTOBUF_TYPE_SINT32,   false, NULL },
+    { "f",  6, OPTIONAL, PUSH_PROTOBUF_TYPE_SINT64,   false, NULL },
+    { "g",  7, OPTIONAL, PUSH_PROTOBUF_TYPE_BOOL,     false, NULL },
+    { "h",  8, OPTIONAL, PUSH_PROTOBUF_TYPE_FIXED32,  false, NULL },
+    { "i",  9, OPTIONAL, PUSH_PROTOBUF_TYPE_SFIXED32, false, NULL },
+    { "j", 10, OPTIONAL, PUSH_PROTOBUF_TYPE_FLOAT,    false, NULL },
+    { "k", 11, OPTIONAL, PUSH_PROTOBUF_TYPE_FIXED64,  false, NULL },
+    { "l", 12, OPTIONAL, PUSH_PROTOBUF_TYPE_SFIXED64, false, NULL },
+    { "m", 13, OPTIONAL, PUSH_PROTOBUF_TYPE_DOUBLE,   false, NULL },
+    { "n", 14, OPTIONAL, PUSH_PROTOBUF_TYPE_STRING,   false, NULL },
+    { "o", 15, OPTIONAL, PUSH_PROTOBUF_TYPE_BYTES,    false, NULL },
+    { "p", 16, REPEATED, PUSH_PROTOBUF_TYPE_UINT32,   false, NULL }
+};
+
+#undef OPTIONAL
+#undef REPEATED
+
+const push_protobuf_message_descriptor_t  SCALARS =
+{
+    "test.Scalars", 16, SCALAR_FIELDS, 0
+};
+
+
+const uint8_t  DATA_02[] =
+    "\x08\xfb\xff\xff\xff\xff"  /* a = -5 */
+    "\xff\xff\xff\xff\x01"
+    "\x10\xff\xff\xff\xff\xff"  /* b = -1 */
+    "\xff\xff\xff\xff\x01"
+    "\x18\x80\xd0\xac\xf3\x0e"  /* c = 4000000000 */
+    "\x20\xff\xff\xff\xff\xff"  /* d = 2^64-1 */
+    "\xff\xff\xff\xff\x01"
+    "\x28\x05"                  /* e = -3 */
+    "\x30\xff\xff\xff\xff\xff"  /* f = -2^63 */
+    "\xff\xff\xff\xff\x01"
+    "\x38\x01"                  /* g = true */
+    "\x45\x07\x00\x00\x00"      /* h = 7 */
+    "\x4d\xfe\xff\xff\xff"      /* i = -2 */
+    "\x55\xcd\xcc\xcc\x3d"      /* j = 0.1 */
+    "\x59\x39\x30\x00\x00"      /* k = 12345 */
+    "\x00\x00\x00\x00"
+    "\x61\xf7\xff\xff\xff"      /* l = -9 */
+    "\xff\xff\xff\xff"
+    "\x69\x00\x00\x00\x00"      /* m = infinity */
+    "\x00\x00\xf0\x7f"
+    "\x72\x16"                  /* n, length = 22 */
+    "0123456789abcdef"
+    "\"\\\n\x01" "\xc3\xa9"
+    "\x7a\x04\x00\xff\x10\x20"  /* o = 00 ff 10 20 */
+    "\x80\x01\x01"              /* p = 1 */
+    "\x82\x01\x02\x02\x03"      /* p, packed = 2, 3 */
+    "\x38\x00"                  /* g = false */
+    "\x80\x01\x04"              /* p = 4 */
+    "\xc0\x3e\x2a";             /* field 1000, unknown = 42 */
+const size_t  LENGTH_02 = 142;
+
+const char  *EXPECTED_02 =
+    "{\"a\":-5,\"b\":\"-1\",\"c\":4000000000,"
+    "\"d\":\"18446744073709551615\",\"e\":-3,"
+    "\"f\":\"-9223372036854775808\",\"g\":false,\"h\":7,\"i\":-2,"
+    "\"j\":0.1,\"k\":\"12345\",\"l\":\"-9\",\"m\":\"Infinity\","
+    "\"n\":\"0123456789abcdef\\\"\\\\\\n\\u0001\xc3\xa9\","
+    "\"o\":\"AP8QIA==\",\"p\":[1,2,3,4]}";
+
+
+/*
+ * A child whose label extends past the end of the child.
+ */
+
+const uint8_t  DATA_03[] =
+    "\x08\x01"                  /* id = 1 */
+    "\x22\x05"                  /* children, length = 5 */
+    "\x08\x02"                  /*   id = 2 */
+    "\x1a\x05\x0a";             /*   label, length = 5 */
+const size_t  LENGTH_03 = 9;
+
+
+/*
+ * A child that's cut off by EOF.
+ */
+
+const uint8_t  DATA_04[] =
+    "\x08\x01"                  /* id = 1 */
+    "\x22\x05"                  /* children, length = 5 */
+    "\x08\x02";                 /*   id = 2 */
+const size_t  LENGTH_04 = 6;
+
+
+/*
+ * Fields that appear more than once: children is interleaved with
+ * other fields, and label appears twice, both in the top-level
+ * message and in one of the children.  The children are merged into
+ * one array, and the labels are merged, with the last text winning.
+ */
+
+const uint8_t  DATA_05[] =
+    "\x22\x02"                  /* children, length = 2 */
+    "\x08\x01"                  /*   id = 1 */
+    "\x08\x05"                  /* id = 5 */
+    "\x22\x02"                  /* children, length = 2 */
+    "\x08\x02"                  /*   id = 2 */
+    "\x1a\x03"                  /* label, length = 3 */
+    "\x0a\x01" "a"              /*   text = "a" */
+    "\x1a\x09"                  /* label, length = 9 */
+    "\x11\x00\x00\x00\x00"      /*   weight = 0.5 */
+    "\x00\x00\xe0\x3f"
+    "\x22\x0c"                  /* children, length = 12 */
+    "\x1a\x03"                  /*   label, length = 3 */
+    "\x0a\x01" "b"              /*     text = "b" */
+    "\x08\x07"                  /*   id = 7 */
+    "\x1a\x03"                  /*   label, length = 3 */
+    "\x0a\x01" "c"              /*     text = "c" */
+    "\x22\x02"                  /* children, length = 2 */
+    "\x08\x08"                  /*   id = 8 */
+    "\x22\x00"                  /* children, length = 0 */
+    "\x2a\x01\x02"              /* deltas, length = 1: 1 */
+    "\x28\x06";                 /* deltas = 3 */
+const size_t  LENGTH_05 = 51;
+
+const char  *EXPECTED_05 =
+    "{\"children\":[{\"id\":1},{\"id\":2},"
+    "{\"label\":{\"text\":\"c\"},\"id\":7},{\"id\":8},{}],"
+    "\"id\":5,\"label\":{\"text\":\"a\",\"weight\":0.5},"
+    "\"deltas\":[1,3]}";
+
+
+/*
+ * A string with invalid UTF-8, followed by a bytes field.  Each
+ * invalid sequence is replaced with U+FFFD, including a sequence cut
+ * off by the end of the string.
+ */
+
+const uint8_t  DATA_06[] =
+    "\x72\x0f"                  /* n, length = 15 */
+    "\x80"                      /*   stray continuation byte */
+    "\xc3\xa9"                  /*   U+00E9 */
+    "\xe2\x82" "b"              /*   truncated sequence, "b" */
+    "\xed\xa0\x80"              /*   surrogate U+D800 */
+    "\xf0\x9f\x98\x80"          /*   U+1F600 */
+    "\xe2\x82"                  /*   truncated sequence */
+    "\x7a\x02\x00\xff";         /* o = 00 ff */
+const size_t  LENGTH_06 = 21;
+
+#define FFFD  "\xef\xbf\xbd"
+
+const char  *EXPECTED_06 =
+    "{\"n\":\"" FFFD "\xc3\xa9" FFFD "b" FFFD FFFD FFFD
+    "\xf0\x9f\x98\x80" FFFD "\",\"o\":\"AP8=\"}";
+
+#undef FFFD
+
+
+/*
+ * A message type with more fields than fit in one word of the
+ * transcoder's bitmap (see wide_message below).  Field 65 shares a
+ * bit with field 1 if the bitmap wraps around, and field 70, which is
+ * repeated, is interleaved with field 1.
+ */
+
+#define WIDE_FIELD_COUNT  70
+
+const uint8_t  DATA_07[] =
+    "\x08\x01"                  /* f1 = 1 */
+    "\x88\x04\x02"              /* f65 = 2 */
+    "\xb0\x04\x03"              /* f70 = 3 */
+    "\x08\x04"                  /* f1 = 4 */
+    "\xb0\x04\x05";             /* f70 = 5 */
+const size_t  LENGTH_07 = 13;
+
+const char  *EXPECTED_07 = "{\"f1\":4,\"f65\":2,\"f70\":[3,5]}";
+
+
+/*-----------------------------------------------------------------------
+ * Helper functions
+ */
+
+static const push_protobuf_message_descriptor_t *
+find_node(void *parent)
+{
+    push_protobuf_descriptor_pool_t  *pool;
+    const push_protobuf_message_descriptor_t  *node;
+
+    pool = push_protobuf_descriptor_pool_new(parent);
+    fail_if(pool == NULL,
+            "Could not allocate a new descriptor pool");
+
+    fail_unless(push_protobuf_descriptor_pool_load
+                (pool, DESCRIPTOR_SET, DESCRIPTOR_SET_LENGTH),
+                "Could not load descriptor set");
+
+    node = push_protobuf_descriptor_pool_find_message(pool, "test.Node");
+    fail_if(node == NULL, "Could not find test.Node");
+
+    return node;
+}
+
+
+/**
+ * Create a message type with WIDE_FIELD_COUNT uint32 fields, named
+ * f1, f2, and so on.  The last field is repeated.
+ */
+
+static const push_protobuf_message_descriptor_t *
+wide_message(void *parent)
+{
+    push_protobuf_message_descriptor_t  *message;
+    push_protobuf_field_descriptor_t  *fields;
+    size_t  i;
+
+    message = push_talloc(parent, push_protobuf_message_descriptor_t);
+    fail_if(message == NULL,
+            "Could not allocate a message descriptor");
+
+    fields = push_talloc_array(message, push_protobuf_field_descriptor_t,
+                               WIDE_FIELD_COUNT);
+    fail_if(fields == NULL,
+            "Could not allocate field descriptors");
+
+    for (i = 0; i < WIDE_FIELD_COUNT; i++)
+    {
+        fields[i].name = push_talloc_asprintf(fields, "f%zu", i + 1);
+        fail_if(fields[i].name == NULL,
+                "Could not allocate field name");
+
+        fields[i].number = i + 1;
+        fields[i].label =
+            (i + 1 == WIDE_FIELD_COUNT)?
+            PUSH_PROTOBUF_LABEL_REPEATED:
+            PUSH_PROTOBUF_LABEL_OPTIONAL;
+        fields[i].type = PUSH_PROTOBUF_TYPE_UINT32;
+        fields[i].packed = false;
+        fields[i].message_type = NULL;
+    }
+
+    message->full_name = "test.Wide";
+    message->field_count = WIDE_FIELD_COUNT;
+    message->fields = fields;
+    message->index = 0;
+
+    return message;
+}
+
+
+/**
+ * Transcode some data, sending it in chunks of at most chunk_size
+ * bytes, with the first chunk ending at first_chunk_size.  The JSON
+ * is written into dest as a NUL-terminated string.
+ */
+
+static push_error_code_t
+transcode(const push_protobuf_message_descriptor_t *descriptor,
+          const uint8_t *buf, size_t length,
+          size_t first_chunk_size, size_t chunk_size,
+          size_t max_depth, hwm_buffer_t *dest)
+{
+    push_parser_t  *parser;
+    push_callback_t  *callback;
+    push_parser_limits_t  limits;
+    push_error_code_t  result;
+    size_t  offset;
+    size_t  size;
+
+    hwm_buffer_clear(dest);
+
+    parser = push_parser_new();
+    fail_if(parser == NULL,
+            "Could not allocate a new push parser");
+
+    callback = push_protobuf_json_new("json", parser, parser,
+                                      descriptor, dest);
+    fail_if(callback == NULL,
+            "Could not allocate a new JSON callback");
+
+    push_parser_set_callback(parser, callback);
+
+    limits.max_depth = max_depth;
+    limits.max_message_bytes = 0;
+    limits.max_field_count = 0;
+    push_parser_set_limits(parser, &limits);
+
+    fail_unless(push_parser_activate(parser, NULL)
+                == PUSH_INCOMPLETE,
+                "Could not activate parser");
+
+    result = push_parser_submit_data(parser, buf, first_chunk_size);
+
+    for (offset = first_chunk_size;
+         (offset < length) && (result == PUSH_INCOMPLETE);
+         offset += size)
+    {
+        size = length - offset;
+        if (size > chunk_size) size = chunk_size;
+
+        result = push_parser_submit_data(parser, &buf[offset], size);
+    }
+
+    if (result == PUSH_INCOMPLETE)
+        result = push_parser_eof(parser);
+
+    if (result == PUSH_SUCCESS)
+    {
+        fail_unless(push_parser_result(parser, hwm_buffer_t) == dest,
+                    "Result should be the output buffer");
+        fail_unless(hwm_buffer_append_mem(dest, "", 1),
+                    "Could not terminate JSON");
+    }
+
+    push_parser_free(parser);
+    return result;
+}
+
+
+static void
+read_data(const push_protobuf_message_descriptor_t *descriptor,
+          const uint8_t *buf, size_t length, const char *expected,
+          size_t first_chunk_size, size_t chunk_size)
+{
+    hwm_buffer_t  dest;
+    const char  *actual;
+
+    hwm_buffer_init(&dest);
+
+    fail_unless(transcode(descriptor, buf, length,
+                          first_chunk_size, chunk_size, 0, &dest)
+                == PUSH_SUCCESS,
+                "Could not transcode data (split at %zu, %zu)",
+                first_chunk_size, chunk_size);
+
+    actual = hwm_buffer_mem(&dest, char);
+    fail_unless(strcmp(actual, expected) == 0,
+                "JSON doesn't match (split at %zu, %zu): "
+                "got %s, expected %s",
+                first_chunk_size, chunk_size, actual, expected);
+
+    hwm_buffer_done(&dest);
+}
+
+
+/*-----------------------------------------------------------------------
+ * Test cases
+ */
+
+START_TEST(test_read_01)
+{
+    void  *context = push_talloc_new(NULL);
+    const push_protobuf_message_descriptor_t  *node = find_node(context);
+
+    PUSH_DEBUG_MSG("---\nStarting test_read_01\n");
+    read_data(node, DATA_01, LENGTH_01, EXPECTED_01,
+              LENGTH_01, LENGTH_01);
+
+    push_talloc_free(context);
+}
+END_TEST
+
+
+START_TEST(test_two_part_read_01)
+{
+    void  *context = push_talloc_new(NULL);
+    const push_protobuf_message_descriptor_t  *node = find_node(context);
+    size_t  first_chunk_size;
+
+    PUSH_DEBUG_MSG("---\nStarting test_two_part_read_01\n");
+
+    for (first_chunk_size = 1;
+         first_chunk_size < LENGTH_01;
+         first_chunk_size++)
+    {
+        read_data(node, DATA_01, LENGTH_01, EXPECTED_01,
+                  first_chunk_size, LENGTH_01);
+    }
+
+    push_talloc_free(context);
+}
+END_TEST
+
+
+START_TEST(test_bytewise_read_01)
+{
+    void  *context = push_talloc_new(NULL);
+    const push_protobuf_message_descriptor_t  *node = find_node(context);
+
+    PUSH_DEBUG_MSG("---\nStarting test_bytewise_read_01\n");
+    read_data(node, DATA_01, LENGTH_01, EXPECTED_01, 1, 1);
+
+    push_talloc_free(context);
+}
+END_TEST
+
+
+START_TEST(test_max_depth_01)
+{
+    void  *context = push_talloc_new(NULL);
+    const push_protobuf_message_descriptor_t  *node = find_node(context);
+    hwm_buffer_t  dest;
+    size_t  chunk_size;
+
+    PUSH_DEBUG_MSG("---\nStarting test_max_depth_01\n");
+
+    /*
+     * The innermost child is at depth 2.
+     */
+
+    hwm_buffer_init(&dest);
+
+    for (chunk_size = 1; chunk_size <= LENGTH_01; chunk_size++)
+    {
+        fail_unless(transcode(node, DATA_01, LENGTH_01,
+                              chunk_size, chunk_size, 2, &dest)
+                    == PUSH_SUCCESS,
+                    "Should transcode with max_depth 2 "
+                    "(chunk size %zu)", chunk_size);
+
+        fail_unless(transcode(node, DATA_01, LENGTH_01,
+                              chunk_size, chunk_size, 1, &dest)
+                    == PUSH_PARSE_ERROR,
+                    "Should exceed max_depth 1 "
+                    "(chunk size %zu)", chunk_size);
+    }
+
+    hwm_buffer_done(&dest);
+    push_talloc_free(context);
+}
+END_TEST
+
+
+START_TEST(test_read_02)
+{
+    PUSH_DEBUG_MSG("---\nStarting test_read_02\n");
+    read_data(&SCALARS, DATA_02, LENGTH_02, EXPECTED_02,
+              LENGTH_02, LENGTH_02);
+}
+END_TEST
+
+
+START_TEST(test_two_part_read_02)
+{
+    size_t  first_chunk_size;
+
+    PUSH_DEBUG_MSG("---\nStarting test_two_part_read_02\n");
+
+    for (first_chunk_size = 1;
+         first_chunk_size < LENGTH_02;
+         first_chunk_size++)
+    {
+        read_data(&SCALARS, DATA_02, LENGTH_02, EXPECTED_02,
+                  first_chunk_size, LENGTH_02);
+    }
+}
+END_TEST
+
+
+START_TEST(test_bytewise_read_02)
+{
+    PUSH_DEBUG_MSG("---\nStarting test_bytewise_read_02\n");
+    read_data(&SCALARS, DATA_02, LENGTH_02, EXPECTED_02, 1, 1);
+}
+END_TEST
+
+
+START_TEST(test_truncated_03)
+{
+    void  *context = push_talloc_new(NULL);
+    const push_protobuf_message_descriptor_t  *node = find_node(context);
+    hwm_buffer_t  dest;
+    size_t  chunk_size;
+
+    PUSH_DEBUG_MSG("---\nStarting test_truncated_03\n");
+
+    hwm_buffer_init(&dest);
+
+    for (chunk_size = 1; chunk_size <= LENGTH_03; chunk_size++)
+    {
+        fail_unless(transcode(node, DATA_03, LENGTH_03,
+                              chunk_size, chunk_size, 0, &dest)
+                    == PUSH_PARSE_ERROR,
+                    "Should get parse error (chunk size %zu)",
+                    chunk_size);
+    }
+
+    hwm_buffer_done(&dest);
+    push_talloc_free(context);
+}
+END_TEST
+
+
+START_TEST(test_unfinished_04)
+{
+    void  *context = push_talloc_new(NULL);
+    const push_protobuf_message_descriptor_t  *node = find_node(context);
+    hwm_buffer_t  dest;
+    size_t  chunk_size;
+
+    PUSH_DEBUG_MSG("---\nStarting test_unfinished_04\n");
+
+    hwm_buffer_init(&dest);
+
+    for (chunk_size = 1; chunk_size <= LENGTH_04; chunk_size++)
+    {
+        fail_unless(transcode(node, DATA_04, LENGTH_04,
+                              chunk_size, chunk_size, 0, &dest)
+                    == PUSH_PARSE_ERROR,
+                    "Should get parse error (chunk size %zu)",
+                    chunk_size);
+    }
+
+    hwm_buffer_done(&dest);
+    push_talloc_free(context);
+}
+END_TEST
+
+
+START_TEST(test_read_05)
+{
+    void  *context = push_talloc_new(NULL);
+    const push_protobuf_message_descriptor_t  *node = find_node(context);
+
+    PUSH_DEBUG_MSG("---\nStarting test_read_05\n");
+    read_data(node, DATA_05, LENGTH_05, EXPECTED_05,
+              LENGTH_05, LENGTH_05);
+
+    push_talloc_free(context);
+}
+END_TEST
+
+
+START_TEST(test_two_part_read_05)
+{
+    void  *context = push_talloc_new(NULL);
+    const push_protobuf_message_descriptor_t  *node = find_node(context);
+    size_t  first_chunk_size;
+
+    PUSH_DEBUG_MSG("---\nStarting test_two_part_read_05\n");
+
+    for (first_chunk_size = 1;
+         first_chunk_size < LENGTH_05;
+         first_chunk_size++)
+    {
+        read_data(node, DATA_05, LENGTH_05, EXPECTED_05,
+                  first_chunk_size, LENGTH_05);
+    }
+
+    push_talloc_free(context);
+}
+END_TEST
+
+
+START_TEST(test_bytewise_read_05)
+{
+    void  *context = push_talloc_new(NULL);
+    const push_protobuf_message_descriptor_t  *node = find_node(context);
+
+    PUSH_DEBUG_MSG("---\nStarting test_bytewise_read_05\n");
+    read_data(node, DATA_05, LENGTH_05, EXPECTED_05, 1, 1);
+
+    push_talloc_free(context);
+}
+END_TEST
+
+
+START_TEST(test_read_06)
+{
+    PUSH_DEBUG_MSG("---\nStarting test_read_06\n");
+    read_data(&SCALARS, DATA_06, LENGTH_06, EXPECTED_06,
+              LENGTH_06, LENGTH_06);
+}
+END_TEST
+
+
+START_TEST(test_two_part_read_06)
+{
+    size_t  first_chunk_size;
+
+    PUSH_DEBUG_MSG("---\nStarting test_two_part_read_06\n");
+
+    for (first_chunk_size = 1;
+         first_chunk_size < LENGTH_06;
+         first_chunk_size++)
+    {
+        read_data(&SCALARS, DATA_06, LENGTH_06, EXPECTED_06,
+                  first_chunk_size, LENGTH_06);
+    }
+}
+END_TEST
+
+
+START_TEST(test_bytewise_read_06)
+{
+    PUSH_DEBUG_MSG("---\nStarting test_bytewise_read_06\n");
+    read_data(&SCALARS, DATA_06, LENGTH_06, EXPECTED_06, 1, 1);
+}
+END_TEST
+
+
+START_TEST(test_read_07)
+{
+    void  *context = push_talloc_new(NULL);
+    const push_protobuf_message_descriptor_t  *wide =
+        wide_message(context);
+
+    PUSH_DEBUG_MSG("---\nStarting test_read_07\n");
+    read_data(wide, DATA_07, LENGTH_07, EXPECTED_07,
+              LENGTH_07, LENGTH_07);
+
+    push_talloc_free(context);
+}
+END_TEST
+
+
+START_TEST(test_two_part_read_07)
+{
+    void  *context = push_talloc_new(NULL);
+    const push_protobuf_message_descriptor_t  *wide =
+        wide_message(context);
+    size_t  first_chunk_size;
+
+    PUSH_DEBUG_MSG("---\nStarting test_two_part_read_07\n");
+
+    for (first_chunk_size = 1;
+         first_chunk_size < LENGTH_07;
+         first_chunk_size++)
+    {
+        read_data(wide, DATA_07, LENGTH_07, EXPECTED_07,
+                  first_chunk_size, LENGTH_07);
+    }
+
+    push_talloc_free(context);
+}
+END_TEST
+
+
+START_TEST(test_bytewise_read_07)
+{
+    void  *context = push_talloc_new(NULL);
+    const push_protobuf_message_descriptor_t  *wide =
+        wide_message(context);
+
+    PUSH_DEBUG_MSG("---\nStarting test_bytewise_read_07\n");
+    read_data(wide, DATA_07, LENGTH_07, EXPECTED_07, 1, 1);
+
+    push_talloc_free(context);
+}
+END_TEST
+
+
+/*-----------------------------------------------------------------------
+ * Testing harness
+ */
+
+Suite *
+test_suite()
+{
+    Suite  *s = suite_create("protobuf-json");
+
+    TCase  *tc = tcase_create("protobuf-json");
+    tcase_add_test(tc, test_read_01);
+    tcase_add_test(tc, test_two_part_read_01);
+    tcase_add_test(tc, test_bytewise_read_01);
+    tcase_add_test(tc, test_max_depth_01);
+    tcase_add_test(tc, test_read_02);
+    tcase_add_test(tc, test_two_part_read_02);
+    tcase_add_test(tc, test_bytewise_read_02);
+    tcase_add_test(tc, test_truncated_03);
+    tcase_add_test(tc, test_unfinished_04);
+    tcase_add_test(tc, test_read_05);
+    tcase_add_test(tc, test_two_part_read_05);
+    tcase_add_test(tc, test_bytewise_read_05);
+    tcase_add_test(tc, test_read_06);
+    tcase_add_test(tc, test_two_part_read_06);
+    tcase_add_test(tc, test_bytewise_read_06);
+    tcase_add_test(tc, test_read_07);
+    tcase_add_test(tc, test_two_part_read_07);
+    tcase_add_test(tc, test_bytewise_read_07);
+    suite_add_tcase(s, tc);
+
+    return s;
+}
+
+int
+main(int argc, const char **argv)
+{
+    int  number_failed;
+    Suite  *suite = test_suite();
+    SRunner  *runner = srunner_create(suite);
+
+    srunner_run_all(runner, CK_NORMAL);
+    number_failed = srunner_ntests_failed(runner);
+    srunner_free(runner);
+
+    return (number_failed == 0)? EXIT_SUCCESS: EXIT_FAILURE;
+}
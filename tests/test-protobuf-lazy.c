@@ -0,0 +1,546 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2010, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the LICENSE.txt file in this distribution for license
+ * details.
+ * ----------------------------------------------------------------------
+ */
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <check.h>
+#include <hwm-buffer.h>
+
+#include <push/basics.h>
+#include <push/talloc.h>
+
+#include <push/protobuf/basics.h>
+#include <push/protobuf/field-map.h>
+#include <push/protobuf/lazy.h>
+#include <push/protobuf/message.h>
+
+
+/*-----------------------------------------------------------------------
+ * Our data types
+ */
+
+typedef struct _item
+{
+    uint32_t  id;
+    uint32_t  count;
+} item_t;
+
+typedef struct _data
+{
+    uint32_t  id;
+    push_protobuf_lazy_message_t  a;
+    push_protobuf_lazy_message_t  b;
+} data_t;
+
+static void
+data_init(data_t *data)
+{
+    data->id = 0;
+    push_protobuf_lazy_message_init(&data->a);
+    push_protobuf_lazy_message_init(&data->b);
+}
+
+static void
+data_done(data_t *data)
+{
+    push_protobuf_lazy_message_done(&data->a);
+    push_protobuf_lazy_message_done(&data->b);
+}
+
+static push_callback_t *
+create_item_message(const char *name,
+                    void *parent,
+                    push_parser_t *parser,
+                    item_t *dest)
+{
+    void  *context;
+    push_protobuf_field_map_t  *field_map;
+    push_callback_t  *callback;
+
+    context = push_talloc_new(parent);
+    if (context == NULL) return NULL;
+
+    if (name == NULL) name = "item";
+
+    field_map = push_protobuf_field_map_new(context);
+    if (field_map == NULL) goto error;
+
+#define CHECK(call) { if (!(call)) goto error; }
+
+    CHECK(push_protobuf_assign_uint32(name, "id", context, parser,
+                                      field_map, 1, &dest->id));
+    CHECK(push_protobuf_assign_uint32(name, "count", context, parser,
+                                      field_map, 2, &dest->count));
+
+#undef CHECK
+
+    callback = push_protobuf_message_new(name, context, parser, field_map);
+
+    if (callback == NULL) goto error;
+    return callback;
+
+  error:
+    push_talloc_free(context);
+    return NULL;
+}
+
+static push_callback_t *
+create_data_message(const char *name,
+                    void *parent,
+                    push_parser_t *parser,
+                    data_t *dest)
+{
+    void  *context;
+    push_protobuf_field_map_t  *field_map;
+    push_callback_t  *callback;
+
+    context = push_talloc_new(parent);
+    if (context == NULL) return NULL;
+
+    /*
+     * Then create the callbacks.
+     */
+
+    if (name == NULL) name = "data";
+
+    field_map = push_protobuf_field_map_new(context);
+    if (field_map == NULL) goto error;
+
+#define CHECK(call) { if (!(call)) goto error; }
+
+    CHECK(push_protobuf_assign_uint32(name, "id", context, parser,
+                                      field_map, 1, &dest->id));
+    CHECK(push_protobuf_add_lazy_submessage(name, "a", context, parser,
+                                            field_map, 2, &dest->a));
+    CHECK(push_protobuf_add_lazy_submessage(name, "b", context, parser,
+                                            field_map, 3, &dest->b));
+
+#undef CHECK
+
+    callback = push_protobuf_message_new(name, context, parser, field_map);
+
+    if (callback == NULL) goto error;
+    return callback;
+
+  error:
+    push_talloc_free(context);
+    return NULL;
+}
+
+
+/*-----------------------------------------------------------------------
+ * Sample data
+ */
+
+const uint8_t  DATA_01[] =
+    "\x08"                      /* field 1, wire type 0 */
+    "\x2a"                      /*   value = 42 */
+    "\x12"                      /* field 2, wire type 2 */
+    "\x04"                      /*   length = 4 */
+    "\x08\x07"                  /*     id = 7 */
+    "\x10\x03"                  /*     count = 3 */
+    "\x1a"                      /* field 3, wire type 2 */
+    "\x02"                      /*   length = 2 */
+    "\x08\x09"                  /*     id = 9 */
+    "\x12"                      /* field 2 again, wire type 2 */
+    "\x02"                      /*   length = 2 */
+    "\x10\x05";                 /*     count = 5 */
+const size_t  LENGTH_01 = 16;
+
+const uint8_t  EXPECTED_A_01[] = "\x08\x07\x10\x03\x10\x05";
+const item_t  EXPECTED_ITEM_A_01 = { 7, 5 };
+const uint8_t  EXPECTED_B_01[] = "\x08\x09";
+const item_t  EXPECTED_ITEM_B_01 = { 9, 0 };
+
+
+/**
+ * A lazy submessage that can be read, but not decoded.
+ */
+
+const uint8_t  DATA_02[] =
+    "\x12"                      /* field 2, wire type 2 */
+    "\x02"                      /*   length = 2 */
+    "\x08\x80";                 /*     id = (incomplete) */
+const size_t  LENGTH_02 = 4;
+
+
+/**
+ * A lazy submessage that appears twice, with each occurrence
+ * contained entirely in its own data chunk.
+ */
+
+const uint8_t  DATA_03[] =
+    "\x12"                      /* field 2, wire type 2 */
+    "\x02"                      /*   length = 2 */
+    "\x08\x05"                  /*     id = 5 */
+    "\x12"                      /* field 2 again, wire type 2 */
+    "\x02"                      /*   length = 2 */
+    "\x10\x07";                 /*     count = 7 */
+const size_t  LENGTH_03 = 8;
+const size_t  CHUNK_03 = 4;
+
+const item_t  EXPECTED_ITEM_A_03 = { 5, 7 };
+
+
+/*-----------------------------------------------------------------------
+ * Helper functions
+ */
+
+static bool
+view_eq(const push_protobuf_lazy_message_t *lazy,
+        const uint8_t *expected, size_t expected_size)
+{
+    return
+        lazy->present &&
+        (lazy->view.size == expected_size) &&
+        (memcmp(lazy->view.buf, expected, expected_size) == 0);
+}
+
+
+static push_parser_t *
+create_item_parser(item_t *item)
+{
+    push_parser_t  *parser;
+    push_callback_t  *callback;
+
+    parser = push_parser_new();
+    fail_if(parser == NULL,
+            "Could not allocate a new push parser");
+
+    callback = create_item_message("item", NULL, parser, item);
+    fail_if(callback == NULL,
+            "Could not allocate a new message callback");
+
+    push_parser_set_callback(parser, callback);
+    return parser;
+}
+
+
+/**
+ * Parse some data into a data_t, sending it in chunks of at most
+ * chunk_size bytes, with the first chunk ending at first_chunk_size.
+ */
+
+static void
+read_data(data_t *actual, const uint8_t *data, size_t length,
+          size_t first_chunk_size, size_t chunk_size)
+{
+    push_parser_t  *parser;
+    push_callback_t  *message_callback;
+    size_t  offset;
+
+    parser = push_parser_new();
+    fail_if(parser == NULL,
+            "Could not allocate a new push parser");
+
+    message_callback = create_data_message("data", NULL,
+                                           parser, actual);
+    fail_if(message_callback == NULL,
+            "Could not allocate a new message callback");
+
+    push_parser_set_callback(parser, message_callback);
+
+    fail_unless(push_parser_activate(parser, NULL)
+                == PUSH_INCOMPLETE,
+                "Could not activate parser");
+
+    fail_unless(push_parser_submit_data
+                (parser, data, first_chunk_size) == PUSH_INCOMPLETE,
+                "Could not parse data");
+
+    for (offset = first_chunk_size;
+         offset < length;
+         offset += chunk_size)
+    {
+        size_t  size = length - offset;
+        if (size > chunk_size) size = chunk_size;
+
+        fail_unless(push_parser_submit_data
+                    (parser, &data[offset], size) == PUSH_INCOMPLETE,
+                    "Could not parse data");
+    }
+
+    fail_unless(push_parser_eof(parser) == PUSH_SUCCESS,
+                "Shouldn't get parse error at EOF");
+
+    push_parser_free(parser);
+}
+
+
+static void
+read_data_01(size_t first_chunk_size, size_t chunk_size)
+{
+    data_t  actual;
+    item_t  item;
+    push_parser_t  *item_parser;
+
+    data_init(&actual);
+    read_data(&actual, DATA_01, LENGTH_01, first_chunk_size, chunk_size);
+
+    fail_unless(actual.id == 42,
+                "ID doesn't match (split at %zu, %zu)",
+                first_chunk_size, chunk_size);
+    fail_unless(view_eq(&actual.a, EXPECTED_A_01,
+                        sizeof(EXPECTED_A_01) - 1),
+                "Lazy field a doesn't match (split at %zu, %zu)",
+                first_chunk_size, chunk_size);
+    fail_unless(view_eq(&actual.b, EXPECTED_B_01,
+                        sizeof(EXPECTED_B_01) - 1),
+                "Lazy field b doesn't match (split at %zu, %zu)",
+                first_chunk_size, chunk_size);
+    fail_if(actual.a.decoded || actual.b.decoded,
+            "Lazy fields shouldn't be decoded yet");
+
+    /*
+     * Decode both submessages, using the same item parser.
+     */
+
+    item_parser = create_item_parser(&item);
+
+    memset(&item, 0, sizeof(item_t));
+    fail_unless(push_protobuf_lazy_message_decode(&actual.a, item_parser)
+                == PUSH_SUCCESS,
+                "Could not decode lazy field a");
+    fail_unless(memcmp(&item, &EXPECTED_ITEM_A_01, sizeof(item_t)) == 0,
+                "Decoded field a doesn't match (split at %zu, %zu)",
+                first_chunk_size, chunk_size);
+
+    memset(&item, 0, sizeof(item_t));
+    fail_unless(push_protobuf_lazy_message_decode(&actual.b, item_parser)
+                == PUSH_SUCCESS,
+                "Could not decode lazy field b");
+    fail_unless(memcmp(&item, &EXPECTED_ITEM_B_01, sizeof(item_t)) == 0,
+                "Decoded field b doesn't match (split at %zu, %zu)",
+                first_chunk_size, chunk_size);
+
+    push_parser_free(item_parser);
+    data_done(&actual);
+}
+
+
+/*-----------------------------------------------------------------------
+ * Test cases
+ */
+
+START_TEST(test_read_01)
+{
+    PUSH_DEBUG_MSG("---\nStarting test case test_read_01\n");
+    read_data_01(LENGTH_01, LENGTH_01);
+}
+END_TEST
+
+
+START_TEST(test_two_part_read_01)
+{
+    size_t  first_chunk_size;
+
+    PUSH_DEBUG_MSG("---\nStarting test case test_two_part_read_01\n");
+
+    for (first_chunk_size = 1;
+         first_chunk_size < LENGTH_01;
+         first_chunk_size++)
+    {
+        read_data_01(first_chunk_size, LENGTH_01);
+    }
+}
+END_TEST
+
+
+START_TEST(test_bytewise_read_01)
+{
+    PUSH_DEBUG_MSG("---\nStarting test case test_bytewise_read_01\n");
+    read_data_01(1, 1);
+}
+END_TEST
+
+
+START_TEST(test_memoized)
+{
+    data_t  actual;
+    item_t  item;
+    push_parser_t  *item_parser;
+
+    PUSH_DEBUG_MSG("---\nStarting test case test_memoized\n");
+
+    data_init(&actual);
+    read_data(&actual, DATA_01, LENGTH_01, LENGTH_01, LENGTH_01);
+    item_parser = create_item_parser(&item);
+
+    fail_unless(push_protobuf_lazy_message_decode(&actual.a, item_parser)
+                == PUSH_SUCCESS,
+                "Could not decode lazy field a");
+
+    /*
+     * The second decode shouldn't touch the item at all.
+     */
+
+    item.id = 999;
+    fail_unless(push_protobuf_lazy_message_decode(&actual.a, item_parser)
+                == PUSH_SUCCESS,
+                "Could not decode lazy field a again");
+    fail_unless(item.id == 999,
+                "Lazy field shouldn't be decoded twice");
+
+    /*
+     * But once it's cleared, it's decoded again, as an empty
+     * message.
+     */
+
+    push_protobuf_lazy_message_clear(&actual.a);
+    fail_unless(push_protobuf_lazy_message_decode(&actual.a, item_parser)
+                == PUSH_SUCCESS,
+                "Could not decode absent lazy field");
+    fail_unless(item.id == 999,
+                "Empty message shouldn't set any fields");
+    fail_if(actual.a.present,
+            "Cleared lazy field shouldn't be present");
+
+    push_parser_free(item_parser);
+    data_done(&actual);
+}
+END_TEST
+
+
+START_TEST(test_decode_error_02)
+{
+    data_t  actual;
+    item_t  item;
+    push_parser_t  *item_parser;
+
+    PUSH_DEBUG_MSG("---\nStarting test case test_decode_error_02\n");
+
+    /*
+     * The enclosing message parses fine, since the bad submessage is
+     * never looked at.
+     */
+
+    data_init(&actual);
+    read_data(&actual, DATA_02, LENGTH_02, 1, LENGTH_02);
+    item_parser = create_item_parser(&item);
+
+    fail_unless(push_protobuf_lazy_message_decode(&actual.a, item_parser)
+                == PUSH_PARSE_ERROR,
+                "Should get parse error when decoding");
+    fail_unless(push_protobuf_lazy_message_decode(&actual.a, item_parser)
+                == PUSH_PARSE_ERROR,
+                "Decode error should be remembered");
+
+    push_parser_free(item_parser);
+    data_done(&actual);
+}
+END_TEST
+
+
+START_TEST(test_reused_chunk_03)
+{
+    data_t  actual;
+    item_t  item;
+    push_parser_t  *parser;
+    push_parser_t  *item_parser;
+    push_callback_t  *message_callback;
+    uint8_t  chunk[CHUNK_03];
+    size_t  offset;
+
+    PUSH_DEBUG_MSG("---\nStarting test case test_reused_chunk_03\n");
+
+    /*
+     * Send each occurrence of the field in the same buffer, as a
+     * caller reading from a socket would.  The first occurrence must
+     * survive the buffer being overwritten by the second.
+     */
+
+    data_init(&actual);
+
+    parser = push_parser_new();
+    fail_if(parser == NULL,
+            "Could not allocate a new push parser");
+
+    message_callback = create_data_message("data", NULL,
+                                           parser, &actual);
+    fail_if(message_callback == NULL,
+            "Could not allocate a new message callback");
+
+    push_parser_set_callback(parser, message_callback);
+
+    fail_unless(push_parser_activate(parser, NULL)
+                == PUSH_INCOMPLETE,
+                "Could not activate parser");
+
+    for (offset = 0; offset < LENGTH_03; offset += CHUNK_03)
+    {
+        memcpy(chunk, &DATA_03[offset], CHUNK_03);
+        fail_unless(push_parser_submit_data(parser, chunk, CHUNK_03)
+                    == PUSH_INCOMPLETE,
+                    "Could not parse data");
+    }
+
+    memset(chunk, 0xff, CHUNK_03);
+
+    fail_unless(push_parser_eof(parser) == PUSH_SUCCESS,
+                "Shouldn't get parse error at EOF");
+
+    push_parser_free(parser);
+
+    item_parser = create_item_parser(&item);
+
+    memset(&item, 0, sizeof(item_t));
+    fail_unless(push_protobuf_lazy_message_decode(&actual.a, item_parser)
+                == PUSH_SUCCESS,
+                "Could not decode lazy field a");
+    fail_unless(memcmp(&item, &EXPECTED_ITEM_A_03, sizeof(item_t)) == 0,
+                "Decoded field a doesn't match "
+                "(got %"PRIu32", %"PRIu32")",
+                item.id, item.count);
+
+    push_parser_free(item_parser);
+    data_done(&actual);
+}
+END_TEST
+
+
+/*-----------------------------------------------------------------------
+ * Testing harness
+ */
+
+Suite *
+test_suite()
+{
+    Suite  *s = suite_create("protobuf-lazy");
+
+    TCase  *tc = tcase_create("protobuf-lazy");
+    tcase_add_test(tc, test_read_01);
+    tcase_add_test(tc, test_two_part_read_01);
+    tcase_add_test(tc, test_bytewise_read_01);
+    tcase_add_test(tc, test_memoized);
+    tcase_add_test(tc, test_decode_error_02);
+    tcase_add_test(tc, test_reused_chunk_03);
+    suite_add_tcase(s, tc);
+
+    return s;
+}
+
+int
+main(int argc, const char **argv)
+{
+    int  number_failed;
+    Suite  *suite = test_suite();
+    SRunner  *runner = srunner_create(suite);
+
+    srunner_run_all(runner, CK_NORMAL);
+    number_failed = srunner_ntests_failed(runner);
+    srunner_free(runner);
+
+    return (number_failed == 0)? EXIT_SUCCESS: EXIT_FAILURE;
+}
@@ -0,0 +1,282 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2010, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the LICENSE.txt file in this distribution for license
+ * details.
+ * ----------------------------------------------------------------------
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <check.h>
+
+#include <push/basics.h>
+#include <push/talloc.h>
+
+#include <push/protobuf/basics.h>
+#include <push/protobuf/field-map.h>
+#include <push/protobuf/message.h>
+
+
+/*-----------------------------------------------------------------------
+ * Our data type
+ */
+
+/**
+ * Each level of the message has an id field (1), and all but the
+ * innermost have a submessage field (2) containing the next level.
+ */
+
+#define LEVEL_COUNT 4
+
+typedef struct _data
+{
+    uint32_t  ids[LEVEL_COUNT];
+} data_t;
+
+static push_callback_t *
+create_level_message(const char *name,
+                     void *parent,
+                     push_parser_t *parser,
+                     data_t *dest,
+                     unsigned int level)
+{
+    void  *context;
+    push_protobuf_field_map_t  *field_map;
+    push_callback_t  *nested;
+    push_callback_t  *callback;
+
+    context = push_talloc_new(parent);
+    if (context == NULL) return NULL;
+
+    /*
+     * Then create the callbacks.
+     */
+
+    field_map = push_protobuf_field_map_new(context);
+    if (field_map == NULL) goto error;
+
+#define CHECK(call) { if (!(call)) goto error; }
+
+    CHECK(push_protobuf_assign_uint32(name, "id", context, parser,
+                                      field_map, 1, &dest->ids[level]));
+
+    if (level + 1 < LEVEL_COUNT)
+    {
+        nested = create_level_message
+            (push_talloc_asprintf(context, "%s.nested", name),
+             context, parser, dest, level + 1);
+        CHECK(nested != NULL);
+
+        CHECK(push_protobuf_add_submessage(name, "nested", context, parser,
+                                           field_map, 2, nested));
+    }
+
+#undef CHECK
+
+    callback = push_protobuf_message_new(name, context, parser, field_map);
+
+    if (callback == NULL) goto error;
+    return callback;
+
+  error:
+    push_talloc_free(context);
+    return NULL;
+}
+
+
+/*-----------------------------------------------------------------------
+ * Sample data
+ */
+
+/*
+ * Three levels of nesting.  The largest length prefix is 10, and
+ * there are 7 fields in total.
+ */
+
+const uint8_t  DATA_01[] =
+    "\x08\x01"                  /* id = 1 */
+    "\x12\x0a"                  /* nested, length = 10 */
+    "\x08\x02"                  /*   id = 2 */
+    "\x12\x06"                  /*   nested, length = 6 */
+    "\x08\x03"                  /*     id = 3 */
+    "\x12\x02"                  /*     nested, length = 2 */
+    "\x08\x04";                 /*       id = 4 */
+const size_t  LENGTH_01 = 14;
+
+
+/*-----------------------------------------------------------------------
+ * Helper functions
+ */
+
+/**
+ * Parse DATA_01 with the given limits, sending it in chunks of at
+ * most chunk_size bytes, and return the result.
+ */
+
+static push_error_code_t
+parse_01(size_t max_depth, size_t max_message_bytes,
+         size_t max_field_count, size_t chunk_size)
+{
+    data_t  actual;
+    push_parser_t  *parser;
+    push_callback_t  *callback;
+    push_parser_limits_t  limits;
+    push_error_code_t  result;
+    size_t  offset;
+
+    memset(&actual, 0, sizeof(data_t));
+
+    parser = push_parser_new();
+    fail_if(parser == NULL,
+            "Could not allocate a new push parser");
+
+    callback = create_level_message("data", NULL, parser, &actual, 0);
+    fail_if(callback == NULL,
+            "Could not allocate a new message callback");
+
+    push_parser_set_callback(parser, callback);
+
+    limits.max_depth = max_depth;
+    limits.max_message_bytes = max_message_bytes;
+    limits.max_field_count = max_field_count;
+    push_parser_set_limits(parser, &limits);
+
+    fail_unless(push_parser_activate(parser, NULL)
+                == PUSH_INCOMPLETE,
+                "Could not activate parser");
+
+    result = PUSH_INCOMPLETE;
+
+    for (offset = 0;
+         (offset < LENGTH_01) && (result == PUSH_INCOMPLETE);
+         offset += chunk_size)
+    {
+        size_t  size = LENGTH_01 - offset;
+        if (size > chunk_size) size = chunk_size;
+
+        result = push_parser_submit_data(parser, &DATA_01[offset], size);
+    }
+
+    if (result == PUSH_INCOMPLETE)
+    {
+        result = push_parser_eof(parser);
+
+        if (result == PUSH_SUCCESS)
+        {
+            fail_unless((actual.ids[0] == 1) && (actual.ids[1] == 2) &&
+                        (actual.ids[2] == 3) && (actual.ids[3] == 4),
+                        "Data doesn't match (chunk size %zu)",
+                        chunk_size);
+        }
+    }
+
+    push_parser_free(parser);
+    return result;
+}
+
+
+static void
+check_01(size_t max_depth, size_t max_message_bytes,
+         size_t max_field_count, push_error_code_t expected)
+{
+    size_t  chunk_size;
+
+    for (chunk_size = 1; chunk_size <= LENGTH_01; chunk_size++)
+    {
+        push_error_code_t  actual =
+            parse_01(max_depth, max_message_bytes,
+                     max_field_count, chunk_size);
+
+        fail_unless(actual == expected,
+                    "Expected result %d, got %d "
+                    "(limits %zu/%zu/%zu, chunk size %zu)",
+                    expected, actual,
+                    max_depth, max_message_bytes, max_field_count,
+                    chunk_size);
+    }
+}
+
+
+/*-----------------------------------------------------------------------
+ * Test cases
+ */
+
+START_TEST(test_no_limits_01)
+{
+    PUSH_DEBUG_MSG("---\nStarting test_no_limits_01\n");
+    check_01(0, 0, 0, PUSH_SUCCESS);
+}
+END_TEST
+
+
+START_TEST(test_within_limits_01)
+{
+    PUSH_DEBUG_MSG("---\nStarting test_within_limits_01\n");
+    check_01(3, 10, 7, PUSH_SUCCESS);
+}
+END_TEST
+
+
+START_TEST(test_max_depth_01)
+{
+    PUSH_DEBUG_MSG("---\nStarting test_max_depth_01\n");
+    check_01(2, 0, 0, PUSH_PARSE_ERROR);
+}
+END_TEST
+
+
+START_TEST(test_max_message_bytes_01)
+{
+    PUSH_DEBUG_MSG("---\nStarting test_max_message_bytes_01\n");
+    check_01(0, 9, 0, PUSH_PARSE_ERROR);
+}
+END_TEST
+
+
+START_TEST(test_max_field_count_01)
+{
+    PUSH_DEBUG_MSG("---\nStarting test_max_field_count_01\n");
+    check_01(0, 0, 6, PUSH_PARSE_ERROR);
+}
+END_TEST
+
+
+/*-----------------------------------------------------------------------
+ * Testing harness
+ */
+
+Suite *
+test_suite()
+{
+    Suite  *s = suite_create("protobuf-limits");
+
+    TCase  *tc = tcase_create("protobuf-limits");
+    tcase_add_test(tc, test_no_limits_01);
+    tcase_add_test(tc, test_within_limits_01);
+    tcase_add_test(tc, test_max_depth_01);
+    tcase_add_test(tc, test_max_message_bytes_01);
+    tcase_add_test(tc, test_max_field_count_01);
+    suite_add_tcase(s, tc);
+
+    return s;
+}
+
+int
+main(int argc, const char **argv)
+{
+    int  number_failed;
+    Suite  *suite = test_suite();
+    SRunner  *runner = srunner_create(suite);
+
+    srunner_run_all(runner, CK_NORMAL);
+    number_failed = srunner_ntests_failed(runner);
+    srunner_free(runner);
+
+    return (number_failed == 0)? EXIT_SUCCESS: EXIT_FAILURE;
+}
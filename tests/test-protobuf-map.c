@@ -0,0 +1,495 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2010, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the LICENSE.txt file in this distribution for license
+ * details.
+ * ----------------------------------------------------------------------
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <check.h>
+
+#include <push/basics.h>
+#include <push/talloc.h>
+
+#include <push/protobuf/basics.h>
+#include <push/protobuf/field-map.h>
+#include <push/protobuf/map.h>
+#include <push/protobuf/message.h>
+
+
+/*-----------------------------------------------------------------------
+ * Our data types
+ */
+
+/*
+ * message Counts { map<string, uint64> counts = 1; }
+ */
+
+static push_callback_t *
+create_counts_message(const char *name,
+                      void *parent,
+                      push_parser_t *parser,
+                      push_protobuf_map_t *dest)
+{
+    void  *context;
+    push_protobuf_field_map_t  *field_map;
+    push_callback_t  *callback;
+
+    context = push_talloc_new(parent);
+    if (context == NULL) return NULL;
+
+    field_map = push_protobuf_field_map_new(context);
+    if (field_map == NULL) goto error;
+
+    if (!push_protobuf_add_map(name, "counts", context, parser,
+                               field_map, 1, dest))
+        goto error;
+
+    callback = push_protobuf_message_new(name, context, parser, field_map);
+
+    if (callback == NULL) goto error;
+    return callback;
+
+  error:
+    push_talloc_free(context);
+    return NULL;
+}
+
+
+/*
+ * message Point { int32 x = 1; int32 y = 2; }
+ * message Points { map<sint64, Point> points = 1; }
+ * message Wrapper { Points points = 2; }
+ */
+
+typedef struct _point
+{
+    int32_t  x;
+    int32_t  y;
+} point_t;
+
+static push_callback_t *
+create_wrapper_message(const char *name,
+                       void *parent,
+                       push_parser_t *parser,
+                       point_t *element,
+                       push_protobuf_map_t *dest)
+{
+    void  *context;
+    push_protobuf_field_map_t  *point_map;
+    push_protobuf_field_map_t  *points_map;
+    push_protobuf_field_map_t  *wrapper_map;
+    push_callback_t  *point;
+    push_callback_t  *points;
+    push_callback_t  *callback;
+
+    context = push_talloc_new(parent);
+    if (context == NULL) return NULL;
+
+    point_map = push_protobuf_field_map_new(context);
+    points_map = push_protobuf_field_map_new(context);
+    wrapper_map = push_protobuf_field_map_new(context);
+    if ((point_map == NULL) || (points_map == NULL) ||
+        (wrapper_map == NULL))
+        goto error;
+
+#define CHECK(call) { if (!(call)) goto error; }
+
+    CHECK(push_protobuf_assign_int32("point", "x", context, parser,
+                                     point_map, 1, &element->x));
+    CHECK(push_protobuf_assign_int32("point", "y", context, parser,
+                                     point_map, 2, &element->y));
+
+    point = push_protobuf_message_new("point", context, parser,
+                                      point_map);
+
+    CHECK(push_protobuf_add_map_submessage("points", "points",
+                                           context, parser,
+                                           points_map, 1, point,
+                                           element, sizeof(point_t),
+                                           dest));
+
+    points = push_protobuf_message_new("points", context, parser,
+                                       points_map);
+
+    CHECK(push_protobuf_add_submessage(name, "points", context, parser,
+                                       wrapper_map, 2, points));
+
+#undef CHECK
+
+    callback = push_protobuf_message_new(name, context, parser,
+                                         wrapper_map);
+
+    if (callback == NULL) goto error;
+    return callback;
+
+  error:
+    push_talloc_free(context);
+    return NULL;
+}
+
+
+/*-----------------------------------------------------------------------
+ * Sample data
+ */
+
+const uint8_t  DATA_01[] =
+    "\x0a\x05"                  /* entry, length = 5 */
+    "\x0a\x01" "a"              /*   key = "a" */
+    "\x10\x01"                  /*   value = 1 */
+    "\x0a\x07"                  /* entry, length = 7 */
+    "\x0a\x02" "bb"             /*   key = "bb" */
+    "\x10\xac\x02"              /*   value = 300 */
+    "\x0a\x05"                  /* entry, length = 5 */
+    "\x0a\x01" "a"              /*   key = "a" */
+    "\x10\x07"                  /*   value = 7 */
+    "\x0a\x02"                  /* entry, length = 2 */
+    "\x10\x09";                 /*   value = 9 */
+const size_t  LENGTH_01 = 27;
+
+
+const uint8_t  DATA_02[] =
+    "\x12\x12"                  /* points, length = 18 */
+    "\x0a\x08"                  /*   entry, length = 8 */
+    "\x08\x01"                  /*     key = -1 */
+    "\x12\x04"                  /*     value, length = 4 */
+    "\x08\x03"                  /*       x = 3 */
+    "\x10\x04"                  /*       y = 4 */
+    "\x0a\x06"                  /*   entry, length = 6 */
+    "\x08\x0a"                  /*     key = 5 */
+    "\x12\x02"                  /*     value, length = 2 */
+    "\x08\x05";                 /*       x = 5 */
+const size_t  LENGTH_02 = 20;
+
+
+/*-----------------------------------------------------------------------
+ * Helper functions
+ */
+
+/**
+ * Parse some data, sending it in chunks of at most chunk_size bytes,
+ * with the first chunk ending at first_chunk_size.
+ */
+
+static void
+parse(push_parser_t *parser, const uint8_t *data, size_t length,
+      size_t first_chunk_size, size_t chunk_size)
+{
+    size_t  offset;
+
+    fail_unless(push_parser_activate(parser, NULL)
+                == PUSH_INCOMPLETE,
+                "Could not activate parser");
+
+    fail_unless(push_parser_submit_data
+                (parser, data, first_chunk_size) == PUSH_INCOMPLETE,
+                "Could not parse data");
+
+    for (offset = first_chunk_size;
+         offset < length;
+         offset += chunk_size)
+    {
+        size_t  size = length - offset;
+        if (size > chunk_size) size = chunk_size;
+
+        fail_unless(push_parser_submit_data
+                    (parser, &data[offset], size) == PUSH_INCOMPLETE,
+                    "Could not parse data");
+    }
+
+    fail_unless(push_parser_eof(parser) == PUSH_SUCCESS,
+                "Shouldn't get parse error at EOF");
+}
+
+
+static void
+check_string_entry(push_protobuf_map_t *map, size_t index,
+                   const char *key, uint64_t value)
+{
+    push_protobuf_map_value_t  actual_key;
+    push_protobuf_map_value_t  actual_value;
+
+    fail_unless(push_protobuf_map_get(map, index,
+                                      &actual_key, &actual_value),
+                "Missing entry %zu", index);
+
+    fail_unless((actual_key.size == strlen(key)) &&
+                (strcmp(actual_key.data, key) == 0),
+                "Key %zu doesn't match", index);
+
+    fail_unless(actual_value.integer == value,
+                "Value %zu doesn't match", index);
+}
+
+
+static void
+read_data_01(size_t first_chunk_size, size_t chunk_size)
+{
+    push_parser_t  *parser;
+    push_protobuf_map_t  *map;
+    push_callback_t  *callback;
+    push_protobuf_map_value_t  value;
+
+    parser = push_parser_new();
+    fail_if(parser == NULL,
+            "Could not allocate a new push parser");
+
+    map = push_protobuf_map_new(parser, PUSH_PROTOBUF_MAP_STRING,
+                                PUSH_PROTOBUF_MAP_VARINT);
+    fail_if(map == NULL,
+            "Could not allocate a new map");
+
+    callback = create_counts_message("counts", parser, parser, map);
+    fail_if(callback == NULL,
+            "Could not allocate a new message callback");
+
+    push_parser_set_callback(parser, callback);
+    parse(parser, DATA_01, LENGTH_01, first_chunk_size, chunk_size);
+
+    fail_unless(push_protobuf_map_count(map) == 3,
+                "Expected 3 entries, got %zu (split at %zu, %zu)",
+                push_protobuf_map_count(map),
+                first_chunk_size, chunk_size);
+
+    check_string_entry(map, 0, "a", 7);
+    check_string_entry(map, 1, "bb", 300);
+    check_string_entry(map, 2, "", 9);
+
+    fail_unless(push_protobuf_map_find_string(map, "bb", 2, &value) &&
+                (value.integer == 300),
+                "Could not find \"bb\"");
+    fail_if(push_protobuf_map_find_string(map, "b", 1, &value),
+            "Shouldn't find \"b\"");
+    fail_if(push_protobuf_map_find_integer(map, 0, &value),
+            "Shouldn't find an integer key in a string map");
+
+    push_parser_free(parser);
+}
+
+
+static void
+read_data_02(size_t first_chunk_size, size_t chunk_size)
+{
+    push_parser_t  *parser;
+    push_protobuf_map_t  *map;
+    push_callback_t  *callback;
+    point_t  element;
+    push_protobuf_map_value_t  key;
+    push_protobuf_map_value_t  value;
+    const point_t  *point;
+
+    parser = push_parser_new();
+    fail_if(parser == NULL,
+            "Could not allocate a new push parser");
+
+    map = push_protobuf_map_new(parser, PUSH_PROTOBUF_MAP_SVARINT,
+                                PUSH_PROTOBUF_MAP_MESSAGE);
+    fail_if(map == NULL,
+            "Could not allocate a new map");
+
+    callback = create_wrapper_message("wrapper", parser, parser,
+                                      &element, map);
+    fail_if(callback == NULL,
+            "Could not allocate a new message callback");
+
+    push_parser_set_callback(parser, callback);
+    parse(parser, DATA_02, LENGTH_02, first_chunk_size, chunk_size);
+
+    fail_unless(push_protobuf_map_count(map) == 2,
+                "Expected 2 entries, got %zu (split at %zu, %zu)",
+                push_protobuf_map_count(map),
+                first_chunk_size, chunk_size);
+
+    fail_unless(push_protobuf_map_get(map, 0, &key, &value) &&
+                ((int64_t) key.integer == -1) &&
+                (value.size == sizeof(point_t)),
+                "Entry 0 doesn't match (split at %zu, %zu)",
+                first_chunk_size, chunk_size);
+
+    point = value.data;
+    fail_unless((point->x == 3) && (point->y == 4),
+                "Point 0 doesn't match (split at %zu, %zu)",
+                first_chunk_size, chunk_size);
+
+    fail_unless(push_protobuf_map_find_integer(map, 5, &value),
+                "Could not find key 5 (split at %zu, %zu)",
+                first_chunk_size, chunk_size);
+
+    point = value.data;
+    fail_unless((point->x == 5) && (point->y == 0),
+                "Point 1 doesn't match (split at %zu, %zu)",
+                first_chunk_size, chunk_size);
+
+    push_parser_free(parser);
+}
+
+
+/*-----------------------------------------------------------------------
+ * Test cases
+ */
+
+START_TEST(test_read_01)
+{
+    PUSH_DEBUG_MSG("---\nStarting test_read_01\n");
+    read_data_01(LENGTH_01, LENGTH_01);
+}
+END_TEST
+
+
+START_TEST(test_two_part_read_01)
+{
+    size_t  first_chunk_size;
+
+    PUSH_DEBUG_MSG("---\nStarting test_two_part_read_01\n");
+
+    for (first_chunk_size = 1;
+         first_chunk_size < LENGTH_01;
+         first_chunk_size++)
+    {
+        read_data_01(first_chunk_size, LENGTH_01);
+    }
+}
+END_TEST
+
+
+START_TEST(test_bytewise_read_01)
+{
+    PUSH_DEBUG_MSG("---\nStarting test_bytewise_read_01\n");
+    read_data_01(1, 1);
+}
+END_TEST
+
+
+START_TEST(test_read_02)
+{
+    size_t  first_chunk_size;
+
+    PUSH_DEBUG_MSG("---\nStarting test_read_02\n");
+
+    for (first_chunk_size = 1;
+         first_chunk_size <= LENGTH_02;
+         first_chunk_size++)
+    {
+        read_data_02(first_chunk_size, LENGTH_02);
+        read_data_02(first_chunk_size, 1);
+    }
+}
+END_TEST
+
+
+START_TEST(test_many_entries)
+{
+    push_parser_t  *parser;
+    push_protobuf_map_t  *map;
+    push_callback_t  *callback;
+    uint8_t  data[9000];
+    size_t  length = 0;
+    size_t  i;
+    int  round;
+
+    PUSH_DEBUG_MSG("---\nStarting test_many_entries\n");
+
+    parser = push_parser_new();
+    fail_if(parser == NULL,
+            "Could not allocate a new push parser");
+
+    map = push_protobuf_map_new(parser, PUSH_PROTOBUF_MAP_STRING,
+                                PUSH_PROTOBUF_MAP_VARINT);
+    fail_if(map == NULL,
+            "Could not allocate a new map");
+
+    callback = create_counts_message("counts", parser, parser, map);
+    fail_if(callback == NULL,
+            "Could not allocate a new message callback");
+
+    push_parser_set_callback(parser, callback);
+
+    /*
+     * Entries "000" through "999", each mapping to its own number
+     * modulo 128, so that the table has to grow several times.
+     */
+
+    for (i = 0; i < 1000; i++)
+    {
+        data[length++] = 0x0a;
+        data[length++] = 0x07;
+        data[length++] = 0x0a;
+        data[length++] = 0x03;
+        data[length++] = '0' + (i / 100);
+        data[length++] = '0' + (i / 10) % 10;
+        data[length++] = '0' + i % 10;
+        data[length++] = 0x10;
+        data[length++] = i % 128;
+    }
+
+    /*
+     * Parse it twice, clearing the map in between, to make sure that
+     * a cleared map is reusable.
+     */
+
+    for (round = 0; round < 2; round++)
+    {
+        push_protobuf_map_clear(map);
+        parse(parser, data, length, length, length);
+
+        fail_unless(push_protobuf_map_count(map) == 1000,
+                    "Expected 1000 entries, got %zu",
+                    push_protobuf_map_count(map));
+
+        for (i = 0; i < 1000; i++)
+        {
+            char  key[4];
+            push_protobuf_map_value_t  value;
+
+            snprintf(key, sizeof(key), "%03zu", i);
+            fail_unless(push_protobuf_map_find_string(map, key, 3, &value)
+                        && (value.integer == i % 128),
+                        "Entry %s doesn't match", key);
+        }
+    }
+
+    push_parser_free(parser);
+}
+END_TEST
+
+
+/*-----------------------------------------------------------------------
+ * Testing harness
+ */
+
+Suite *
+test_suite()
+{
+    Suite  *s = suite_create("protobuf-map");
+
+    TCase  *tc = tcase_create("protobuf-map");
+    tcase_add_test(tc, test_read_01);
+    tcase_add_test(tc, test_two_part_read_01);
+    tcase_add_test(tc, test_bytewise_read_01);
+    tcase_add_test(tc, test_read_02);
+    tcase_add_test(tc, test_many_entries);
+    suite_add_tcase(s, tc);
+
+    return s;
+}
+
+int
+main(int argc, const char **argv)
+{
+    int  number_failed;
+    Suite  *suite = test_suite();
+    SRunner  *runner = srunner_create(suite);
+
+    srunner_run_all(runner, CK_NORMAL);
+    number_failed = srunner_ntests_failed(runner);
+    srunner_free(runner);
+
+    return (number_failed == 0)? EXIT_SUCCESS: EXIT_FAILURE;
+}
@@ -0,0 +1,413 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2010, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the LICENSE.txt file in this distribution for license
+ * details.
+ * ----------------------------------------------------------------------
+ */
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <check.h>
+#include <hwm-buffer.h>
+
+#include <push/basics.h>
+#include <push/talloc.h>
+
+#include <push/protobuf/basics.h>
+#include <push/protobuf/combinators.h>
+#include <push/protobuf/field-map.h>
+#include <push/protobuf/message.h>
+
+
+/*-----------------------------------------------------------------------
+ * Our data type
+ */
+
+typedef struct _item
+{
+    uint32_t  id;
+    uint32_t  count;
+} item_t;
+
+static push_callback_t *
+create_item_message(const char *name,
+                    void *parent,
+                    push_parser_t *parser,
+                    item_t *dest)
+{
+    void  *context;
+    push_protobuf_field_map_t  *field_map;
+    push_callback_t  *callback;
+
+    context = push_talloc_new(parent);
+    if (context == NULL) return NULL;
+
+    if (name == NULL) name = "item";
+
+    field_map = push_protobuf_field_map_new(context);
+    if (field_map == NULL) goto error;
+
+#define CHECK(call) { if (!(call)) goto error; }
+
+    CHECK(push_protobuf_assign_uint32(name, "id", context, parser,
+                                      field_map, 1, &dest->id));
+    CHECK(push_protobuf_assign_uint32(name, "count", context, parser,
+                                      field_map, 2, &dest->count));
+
+#undef CHECK
+
+    callback = push_protobuf_message_new(name, context, parser, field_map);
+
+    if (callback == NULL) goto error;
+    return callback;
+
+  error:
+    push_talloc_free(context);
+    return NULL;
+}
+
+
+/**
+ * The sink collects every item that it receives, and the size of
+ * each batch.  It fails once it has seen max_items items.
+ */
+
+typedef struct _collected
+{
+    hwm_buffer_t  items;
+    hwm_buffer_t  batch_sizes;
+    size_t  max_items;
+} collected_t;
+
+static bool
+collect(void *user_data, void *messages, size_t count)
+{
+    collected_t  *collected = (collected_t *) user_data;
+    size_t  *batch_size;
+    size_t  old_size = collected->items.current_size;
+
+    batch_size = hwm_buffer_append_list_elem(&collected->batch_sizes,
+                                             size_t);
+    if (batch_size == NULL)
+        return false;
+    *batch_size = count;
+
+    if (!hwm_buffer_ensure_size(&collected->items,
+                                old_size + count * sizeof(item_t)))
+        return false;
+
+    memcpy(hwm_buffer_writable_mem(&collected->items, uint8_t) + old_size,
+           messages, count * sizeof(item_t));
+    collected->items.current_size += count * sizeof(item_t);
+
+    return (hwm_buffer_current_list_size(&collected->items, item_t)
+            <= collected->max_items);
+}
+
+
+/*-----------------------------------------------------------------------
+ * Sample data
+ */
+
+const uint8_t  DATA_01[] =
+    "\x02"                      /* length = 2 */
+    "\x08\x07"                  /*   id = 7 */
+    "\x00"                      /* length = 0 */
+    "\x04"                      /* length = 4 */
+    "\x08\x01"                  /*   id = 1 */
+    "\x10\x02"                  /*   count = 2 */
+    "\x05"                      /* length = 5 */
+    "\x10\x05"                  /*   count = 5 */
+    "\x08\xac\x02";             /*   id = 300 */
+const size_t  LENGTH_01 = 15;
+
+const item_t  EXPECTED_ITEMS_01[] =
+{ { 7, 0 }, { 0, 0 }, { 1, 2 }, { 300, 5 } };
+
+
+/**
+ * A message that ends early.
+ */
+
+const uint8_t  DATA_02[] =
+    "\x02"                      /* length = 2 */
+    "\x08\x07"                  /*   id = 7 */
+    "\x04"                      /* length = 4 */
+    "\x08\x01";                 /*   id = 1, (incomplete) */
+const size_t  LENGTH_02 = 6;
+
+
+/*-----------------------------------------------------------------------
+ * Helper functions
+ */
+
+#define ARRAY_EQ(buf, type, expected)                               \
+    ((hwm_buffer_current_list_size(buf, type) ==                    \
+      sizeof(expected) / sizeof(type)) &&                           \
+     (memcmp(hwm_buffer_mem(buf, type), expected,                   \
+             sizeof(expected)) == 0))
+
+
+/**
+ * Parse a stream, sending it in chunks of at most chunk_size bytes,
+ * with the first chunk ending at first_chunk_size.  Returns the
+ * parser's final result.
+ */
+
+static push_error_code_t
+read_stream(const uint8_t *data, size_t length,
+            size_t first_chunk_size, size_t chunk_size,
+            size_t batch_size, collected_t *collected,
+            size_t *message_count)
+{
+    push_parser_t  *parser;
+    push_callback_t  *item;
+    push_callback_t  *stream;
+    item_t  element;
+    size_t  offset;
+    push_error_code_t  result;
+
+    parser = push_parser_new();
+    fail_if(parser == NULL,
+            "Could not allocate a new push parser");
+
+    item = create_item_message("item", NULL, parser, &element);
+    stream = push_protobuf_message_stream_new
+        ("stream", NULL, parser, item,
+         &element, sizeof(item_t), batch_size,
+         collect, collected);
+    fail_if(stream == NULL,
+            "Could not allocate a new message stream callback");
+
+    push_parser_set_callback(parser, stream);
+
+    fail_unless(push_parser_activate(parser, NULL)
+                == PUSH_INCOMPLETE,
+                "Could not activate parser");
+
+    result = push_parser_submit_data(parser, data, first_chunk_size);
+
+    for (offset = first_chunk_size;
+         (result == PUSH_INCOMPLETE) && (offset < length);
+         offset += chunk_size)
+    {
+        size_t  size = length - offset;
+        if (size > chunk_size) size = chunk_size;
+
+        result = push_parser_submit_data(parser, &data[offset], size);
+    }
+
+    if (result == PUSH_INCOMPLETE)
+        result = push_parser_eof(parser);
+
+    if (result == PUSH_SUCCESS)
+        *message_count = *push_parser_result(parser, size_t);
+
+    push_parser_free(parser);
+    return result;
+}
+
+
+static void
+collected_init(collected_t *collected, size_t max_items)
+{
+    hwm_buffer_init(&collected->items);
+    hwm_buffer_init(&collected->batch_sizes);
+    collected->max_items = max_items;
+}
+
+static void
+collected_done(collected_t *collected)
+{
+    hwm_buffer_done(&collected->items);
+    hwm_buffer_done(&collected->batch_sizes);
+}
+
+
+static void
+read_data_01(size_t first_chunk_size, size_t chunk_size,
+             size_t batch_size)
+{
+    collected_t  collected;
+    size_t  message_count = 0;
+    size_t  expected_batches;
+
+    collected_init(&collected, SIZE_MAX);
+
+    fail_unless(read_stream(DATA_01, LENGTH_01,
+                            first_chunk_size, chunk_size, batch_size,
+                            &collected, &message_count)
+                == PUSH_SUCCESS,
+                "Could not parse stream (split at %zu, %zu)",
+                first_chunk_size, chunk_size);
+
+    fail_unless(message_count == 4,
+                "Expected 4 messages, got %zu", message_count);
+
+    fail_unless(ARRAY_EQ(&collected.items, item_t, EXPECTED_ITEMS_01),
+                "Items don't match (split at %zu, %zu)",
+                first_chunk_size, chunk_size);
+
+    /*
+     * Every batch but the last should be full.
+     */
+
+    expected_batches = (4 + batch_size - 1) / batch_size;
+    fail_unless(hwm_buffer_current_list_size(&collected.batch_sizes,
+                                             size_t)
+                == expected_batches,
+                "Expected %zu batches", expected_batches);
+    fail_unless(hwm_buffer_mem(&collected.batch_sizes, size_t)[0]
+                == ((batch_size < 4)? batch_size: 4),
+                "First batch has the wrong size");
+
+    collected_done(&collected);
+}
+
+
+/*-----------------------------------------------------------------------
+ * Test cases
+ */
+
+START_TEST(test_read_01)
+{
+    PUSH_DEBUG_MSG("---\nStarting test case test_read_01\n");
+    read_data_01(LENGTH_01, LENGTH_01, 1);
+    read_data_01(LENGTH_01, LENGTH_01, 3);
+    read_data_01(LENGTH_01, LENGTH_01, 10);
+}
+END_TEST
+
+
+START_TEST(test_two_part_read_01)
+{
+    size_t  first_chunk_size;
+
+    PUSH_DEBUG_MSG("---\nStarting test case test_two_part_read_01\n");
+
+    for (first_chunk_size = 1;
+         first_chunk_size < LENGTH_01;
+         first_chunk_size++)
+    {
+        read_data_01(first_chunk_size, LENGTH_01, 2);
+    }
+}
+END_TEST
+
+
+START_TEST(test_bytewise_read_01)
+{
+    PUSH_DEBUG_MSG("---\nStarting test case test_bytewise_read_01\n");
+    read_data_01(1, 1, 3);
+}
+END_TEST
+
+
+START_TEST(test_empty_stream)
+{
+    collected_t  collected;
+    size_t  message_count = 1;
+
+    PUSH_DEBUG_MSG("---\nStarting test case test_empty_stream\n");
+
+    collected_init(&collected, SIZE_MAX);
+
+    fail_unless(read_stream(DATA_01, 0, 0, 1, 2,
+                            &collected, &message_count)
+                == PUSH_SUCCESS,
+                "Could not parse empty stream");
+
+    fail_unless(message_count == 0,
+                "Expected 0 messages, got %zu", message_count);
+    fail_unless(collected.batch_sizes.current_size == 0,
+                "Sink shouldn't be called for an empty stream");
+
+    collected_done(&collected);
+}
+END_TEST
+
+
+START_TEST(test_parse_error_02)
+{
+    collected_t  collected;
+    size_t  message_count;
+
+    PUSH_DEBUG_MSG("---\nStarting test case test_parse_error_02\n");
+
+    collected_init(&collected, SIZE_MAX);
+
+    fail_unless(read_stream(DATA_02, LENGTH_02, 1, LENGTH_02, 1,
+                            &collected, &message_count)
+                == PUSH_PARSE_ERROR,
+                "Should get parse error");
+
+    collected_done(&collected);
+}
+END_TEST
+
+
+START_TEST(test_sink_error)
+{
+    collected_t  collected;
+    size_t  message_count;
+
+    PUSH_DEBUG_MSG("---\nStarting test case test_sink_error\n");
+
+    collected_init(&collected, 1);
+
+    fail_unless(read_stream(DATA_01, LENGTH_01, LENGTH_01, LENGTH_01, 1,
+                            &collected, &message_count)
+                == PUSH_PARSE_ERROR,
+                "Should get parse error when sink fails");
+
+    fail_unless(hwm_buffer_current_list_size(&collected.batch_sizes,
+                                             size_t) == 2,
+                "Parse should stop as soon as the sink fails");
+
+    collected_done(&collected);
+}
+END_TEST
+
+
+/*-----------------------------------------------------------------------
+ * Testing harness
+ */
+
+Suite *
+test_suite()
+{
+    Suite  *s = suite_create("protobuf-message-stream");
+
+    TCase  *tc = tcase_create("protobuf-message-stream");
+    tcase_add_test(tc, test_read_01);
+    tcase_add_test(tc, test_two_part_read_01);
+    tcase_add_test(tc, test_bytewise_read_01);
+    tcase_add_test(tc, test_empty_stream);
+    tcase_add_test(tc, test_parse_error_02);
+    tcase_add_test(tc, test_sink_error);
+    suite_add_tcase(s, tc);
+
+    return s;
+}
+
+int
+main(int argc, const char **argv)
+{
+    int  number_failed;
+    Suite  *suite = test_suite();
+    SRunner  *runner = srunner_create(suite);
+
+    srunner_run_all(runner, CK_NORMAL);
+    number_failed = srunner_ntests_failed(runner);
+    srunner_free(runner);
+
+    return (number_failed == 0)? EXIT_SUCCESS: EXIT_FAILURE;
+}
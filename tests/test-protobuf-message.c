@@ -235,6 +235,21 @@ const data_t  EXPECTED_04 =
   HWM_BUFFER_INIT(EXPECTED_BUF_03, 6) };
 
 
+/*
+ * Field 1 should be a varint, not a length-prefixed field.  The bad
+ * tag is padded out to two bytes, so that we can split it across
+ * chunks.
+ */
+
+const uint8_t  DATA_05[] =
+    "\x08"                      /* field 1, wire type 0 */
+    "\xac\x02"                  /*   value = 300 */
+    "\x8a\x00"                  /* field 1, wire type 2 */
+    "\x01"                      /*   length = 1 */
+    "a";                        /*   content */
+const size_t  LENGTH_05 = 7;
+
+
 /*-----------------------------------------------------------------------
  * Helper functions
  */
@@ -438,6 +453,46 @@ const data_t  EXPECTED_04 =
     END_TEST
 
 
+START_TEST(test_wire_type_mismatch)
+{
+    push_parser_t  *parser;
+    push_callback_t  *message_callback;
+    data_t  actual;
+    push_error_code_t  result;
+
+    PUSH_DEBUG_MSG("---\nStarting test case "
+                   "test_wire_type_mismatch\n");
+
+    data_init(&actual);
+
+    parser = push_parser_new();
+    fail_if(parser == NULL,
+            "Could not allocate a new push parser");
+
+    message_callback = create_data_message("data", NULL,
+                                           parser, &actual);
+    fail_if(message_callback == NULL,
+            "Could not allocate a new message callback");
+
+    push_parser_set_callback(parser, message_callback);
+
+    fail_unless(push_parser_activate(parser, NULL)
+                == PUSH_INCOMPLETE,
+                "Could not activate parser");
+
+    result = push_parser_submit_data(parser, &DATA_05, LENGTH_05);
+    if (result == PUSH_INCOMPLETE)
+        result = push_parser_eof(parser);
+
+    fail_unless(result == PUSH_PARSE_ERROR,
+                "Should get parse error for mismatched wire type");
+
+    push_parser_free(parser);
+    data_done(&actual);
+}
+END_TEST
+
+
 /*-----------------------------------------------------------------------
  * Test cases
  */
@@ -480,6 +535,7 @@ test_suite()
     tcase_add_test(tc, test_parse_error_02);
     tcase_add_test(tc, test_parse_error_03);
     tcase_add_test(tc, test_parse_error_04);
+    tcase_add_test(tc, test_wire_type_mismatch);
     suite_add_tcase(s, tc);
 
     return s;
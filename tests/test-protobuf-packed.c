@@ -0,0 +1,492 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2010, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the LICENSE.txt file in this distribution for license
+ * details.
+ * ----------------------------------------------------------------------
+ */
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <check.h>
+#include <hwm-buffer.h>
+
+#include <push/basics.h>
+#include <push/talloc.h>
+
+#include <push/protobuf/basics.h>
+#include <push/protobuf/field-map.h>
+#include <push/protobuf/message.h>
+
+
+/*-----------------------------------------------------------------------
+ * Our data type
+ */
+
+typedef struct _data
+{
+    hwm_buffer_t  uint32s;
+    hwm_buffer_t  sint64s;
+    hwm_buffer_t  fixed32s;
+    hwm_buffer_t  doubles;
+} data_t;
+
+static void
+data_init(data_t *data)
+{
+    hwm_buffer_init(&data->uint32s);
+    hwm_buffer_init(&data->sint64s);
+    hwm_buffer_init(&data->fixed32s);
+    hwm_buffer_init(&data->doubles);
+}
+
+static void
+data_done(data_t *data)
+{
+    hwm_buffer_done(&data->uint32s);
+    hwm_buffer_done(&data->sint64s);
+    hwm_buffer_done(&data->fixed32s);
+    hwm_buffer_done(&data->doubles);
+}
+
+static push_callback_t *
+create_data_message(const char *name,
+                    void *parent,
+                    push_parser_t *parser,
+                    data_t *dest)
+{
+    void  *context;
+    push_protobuf_field_map_t  *field_map;
+    push_callback_t  *callback;
+
+    context = push_talloc_new(parent);
+    if (context == NULL) return NULL;
+
+    /*
+     * Then create the callbacks.
+     */
+
+    if (name == NULL) name = "data";
+
+    field_map = push_protobuf_field_map_new(context);
+    if (field_map == NULL) goto error;
+
+#define CHECK(call) { if (!(call)) goto error; }
+
+    CHECK(push_protobuf_add_packed_uint32(name, "uint32s", context, parser,
+                                          field_map, 1, &dest->uint32s));
+    CHECK(push_protobuf_add_packed_sint64(name, "sint64s", context, parser,
+                                          field_map, 2, &dest->sint64s));
+    CHECK(push_protobuf_add_packed_fixed32(name, "fixed32s", context,
+                                           parser, field_map, 3,
+                                           &dest->fixed32s));
+    CHECK(push_protobuf_add_packed_double(name, "doubles", context, parser,
+                                          field_map, 4, &dest->doubles));
+
+#undef CHECK
+
+    callback = push_protobuf_message_new(name, context, parser, field_map);
+
+    if (callback == NULL) goto error;
+    return callback;
+
+  error:
+    push_talloc_free(context);
+    return NULL;
+}
+
+
+/*-----------------------------------------------------------------------
+ * Sample data
+ */
+
+const uint8_t  DATA_01[] =
+    "\x0a"                      /* field 1, wire type 2 */
+    "\x19"                      /*   length = 25 */
+    "\x01\x02\x03\x04\x05"      /*   values = 1..5 */
+    "\xac\x02"                  /*   value = 300 */
+    "\x80\x80\x01"              /*   value = 16384 */
+    "\xff\xff\xff\xff\x0f"      /*   value = 4294967295 */
+    "\x06\x07\x08\x09\x0a"      /*   values = 6..10 */
+    "\x80\x01\x7f"              /*   values = 128, 127 */
+    "\x00\x00"                  /*   values = 0, 0 */
+    "\x12"                      /* field 2, wire type 2 */
+    "\x07"                      /*   length = 7 */
+    "\x01"                      /*   value = -1 */
+    "\x02"                      /*   value = 1 */
+    "\xff\xc7\xaf\xa0\x25"      /*   value = -5000000000 */
+    "\x1a"                      /* field 3, wire type 2 */
+    "\x08"                      /*   length = 8 */
+    "\x01\x00\x00\x00"          /*   value = 1 */
+    "\xff\xff\xff\xff"          /*   value = 4294967295 */
+    "\x22"                      /* field 4, wire type 2 */
+    "\x08"                      /*   length = 8 */
+    "\x00\x00\x00\x00\x00\x00\xf8\x3f" /* value = 1.5 */
+    "\x08"                      /* field 1 unpacked, wire type 0 */
+    "\x05"                      /*   value = 5 */
+    "\x0a"                      /* field 1 again, wire type 2 */
+    "\x01"                      /*   length = 1 */
+    "\x2a"                      /*   value = 42 */
+    "\x12"                      /* field 2, wire type 2 */
+    "\x00"                      /*   length = 0 */
+    "\x1d"                      /* field 3 unpacked, wire type 5 */
+    "\x07\x00\x00\x00"          /*   value = 7 */
+    "\x21"                      /* field 4 unpacked, wire type 1 */
+    "\x00\x00\x00\x00\x00\x00\x00\x40" /* value = 2.0 */
+    "\x10"                      /* field 2 unpacked, wire type 0 */
+    "\x03";                     /*   value = -2 */
+const size_t  LENGTH_01 = 79;
+
+const uint32_t  EXPECTED_UINT32S_01[] =
+{ 1, 2, 3, 4, 5, 300, 16384, UINT32_C(4294967295),
+  6, 7, 8, 9, 10, 128, 127, 0, 0, 5, 42 };
+const int64_t  EXPECTED_SINT64S_01[] =
+{ -1, 1, INT64_C(-5000000000), -2 };
+const uint32_t  EXPECTED_FIXED32S_01[] =
+{ 1, UINT32_C(4294967295), 7 };
+const double  EXPECTED_DOUBLES_01[] =
+{ 1.5, 2.0 };
+
+
+/**
+ * A packed field that ends in the middle of a varint.
+ */
+
+const uint8_t  DATA_02[] =
+    "\x0a"                      /* field 1, wire type 2 */
+    "\x02"                      /*   length = 2 */
+    "\x01\x80";                 /*   values = 1, (incomplete) */
+const size_t  LENGTH_02 = 4;
+
+
+/**
+ * A packed fixed32 field whose length isn't a multiple of 4.
+ */
+
+const uint8_t  DATA_03[] =
+    "\x1a"                      /* field 3, wire type 2 */
+    "\x06"                      /*   length = 6 */
+    "\x01\x00\x00\x00\x02\x00"; /*   values = 1, (incomplete) */
+const size_t  LENGTH_03 = 8;
+
+
+/**
+ * A packed uint32 field that arrives with a fixed32 wire type, after
+ * a valid field.
+ */
+
+const uint8_t  DATA_04[] =
+    "\x08"                      /* field 1 unpacked, wire type 0 */
+    "\x05"                      /*   value = 5 */
+    "\x0d"                      /* field 1, wire type 5 */
+    "\x01\x00\x00\x00";         /*   value = 1 */
+const size_t  LENGTH_04 = 7;
+
+
+
+/*-----------------------------------------------------------------------
+ * Helper functions
+ */
+
+#define ARRAY_EQ(buf, type, expected)                               \
+    ((hwm_buffer_current_list_size(buf, type) ==                    \
+      sizeof(expected) / sizeof(type)) &&                           \
+     (memcmp(hwm_buffer_mem(buf, type), expected,                   \
+             sizeof(expected)) == 0))
+
+
+/**
+ * Parse DATA_01, sending it in chunks of at most chunk_size bytes,
+ * with the first chunk ending at first_chunk_size.
+ */
+
+static void
+read_data_01(size_t first_chunk_size, size_t chunk_size)
+{
+    push_parser_t  *parser;
+    push_callback_t  *message_callback;
+    data_t  actual;
+    size_t  offset;
+
+    data_init(&actual);
+
+    parser = push_parser_new();
+    fail_if(parser == NULL,
+            "Could not allocate a new push parser");
+
+    message_callback = create_data_message("data", NULL,
+                                           parser, &actual);
+    fail_if(message_callback == NULL,
+            "Could not allocate a new message callback");
+
+    push_parser_set_callback(parser, message_callback);
+
+    fail_unless(push_parser_activate(parser, NULL)
+                == PUSH_INCOMPLETE,
+                "Could not activate parser");
+
+    fail_unless(push_parser_submit_data
+                (parser, &DATA_01, first_chunk_size) == PUSH_INCOMPLETE,
+                "Could not parse data");
+
+    for (offset = first_chunk_size;
+         offset < LENGTH_01;
+         offset += chunk_size)
+    {
+        size_t  size = LENGTH_01 - offset;
+        if (size > chunk_size) size = chunk_size;
+
+        fail_unless(push_parser_submit_data
+                    (parser, &DATA_01[offset], size) == PUSH_INCOMPLETE,
+                    "Could not parse data");
+    }
+
+    fail_unless(push_parser_eof(parser) == PUSH_SUCCESS,
+                "Shouldn't get parse error at EOF");
+
+    fail_unless(ARRAY_EQ(&actual.uint32s, uint32_t,
+                         EXPECTED_UINT32S_01),
+                "uint32 values don't match (split at %zu, %zu)",
+                first_chunk_size, chunk_size);
+    fail_unless(ARRAY_EQ(&actual.sint64s, int64_t,
+                         EXPECTED_SINT64S_01),
+                "sint64 values don't match (split at %zu, %zu)",
+                first_chunk_size, chunk_size);
+    fail_unless(ARRAY_EQ(&actual.fixed32s, uint32_t,
+                         EXPECTED_FIXED32S_01),
+                "fixed32 values don't match (split at %zu, %zu)",
+                first_chunk_size, chunk_size);
+    fail_unless(ARRAY_EQ(&actual.doubles, double,
+                         EXPECTED_DOUBLES_01),
+                "double values don't match (split at %zu, %zu)",
+                first_chunk_size, chunk_size);
+
+    push_parser_free(parser);
+    data_done(&actual);
+}
+
+
+#define PARSE_ERROR_TEST(test_name)                                 \
+    START_TEST(test_parse_error_##test_name)                        \
+    {                                                               \
+        push_parser_t  *parser;                                     \
+        push_callback_t  *message_callback;                         \
+        data_t  actual;                                             \
+        push_error_code_t  result;                                  \
+                                                                    \
+        PUSH_DEBUG_MSG("---\nStarting test case "                   \
+                       "test_parse_error_"                          \
+                       #test_name                                   \
+                       "\n");                                       \
+                                                                    \
+        data_init(&actual);                                         \
+                                                                    \
+        parser = push_parser_new();                                 \
+        fail_if(parser == NULL,                                     \
+                "Could not allocate a new push parser");            \
+                                                                    \
+        message_callback = create_data_message("data", NULL,        \
+                                               parser, &actual);    \
+        fail_if(message_callback == NULL,                           \
+                "Could not allocate a new message callback");       \
+                                                                    \
+        push_parser_set_callback(parser, message_callback);         \
+                                                                    \
+        fail_unless(push_parser_activate(parser, NULL)              \
+                    == PUSH_INCOMPLETE,                             \
+                    "Could not activate parser");                   \
+                                                                    \
+        result = push_parser_submit_data                            \
+            (parser, &DATA_##test_name, LENGTH_##test_name);        \
+        if (result == PUSH_INCOMPLETE)                              \
+            result = push_parser_eof(parser);                       \
+                                                                    \
+        fail_unless(result == PUSH_PARSE_ERROR,                     \
+                    "Should get parse error");                      \
+                                                                    \
+        push_parser_free(parser);                                   \
+        data_done(&actual);                                         \
+    }                                                               \
+    END_TEST
+
+
+/*-----------------------------------------------------------------------
+ * Test cases
+ */
+
+START_TEST(test_read_01)
+{
+    PUSH_DEBUG_MSG("---\nStarting test case test_read_01\n");
+    read_data_01(LENGTH_01, LENGTH_01);
+}
+END_TEST
+
+
+START_TEST(test_two_part_read_01)
+{
+    size_t  first_chunk_size;
+
+    /*
+     * Try splitting the data at every possible position, so that we
+     * cover elements that straddle chunk boundaries.
+     */
+
+    PUSH_DEBUG_MSG("---\nStarting test case test_two_part_read_01\n");
+
+    for (first_chunk_size = 1;
+         first_chunk_size < LENGTH_01;
+         first_chunk_size++)
+    {
+        read_data_01(first_chunk_size, LENGTH_01);
+    }
+}
+END_TEST
+
+
+START_TEST(test_bytewise_read_01)
+{
+    PUSH_DEBUG_MSG("---\nStarting test case test_bytewise_read_01\n");
+    read_data_01(1, 1);
+}
+END_TEST
+
+
+/**
+ * Parse a packed field with many more elements than we store in one
+ * batch, with a mix of varint lengths, sending it in chunks of at
+ * most chunk_size bytes.
+ */
+
+#define LONG_RUN_COUNT  200
+
+static void
+read_long_run(size_t chunk_size)
+{
+    push_parser_t  *parser;
+    push_callback_t  *message_callback;
+    data_t  actual;
+    uint32_t  expected[LONG_RUN_COUNT];
+    uint8_t  data[3 + LONG_RUN_COUNT * 5];
+    size_t  length;
+    size_t  offset;
+    size_t  i;
+
+    /*
+     * Encode the values, leaving room for a two-byte length prefix.
+     */
+
+    length = 3;
+    for (i = 0; i < LONG_RUN_COUNT; i++)
+    {
+        uint32_t  value = (uint32_t) (i * i * i * 2654435761u) >> (i % 32);
+
+        expected[i] = value;
+        while (value >= 0x80)
+        {
+            data[length++] = (value & 0x7f) | 0x80;
+            value >>= 7;
+        }
+        data[length++] = value;
+    }
+
+    data[0] = 0x0a;
+    data[1] = ((length - 3) & 0x7f) | 0x80;
+    data[2] = (length - 3) >> 7;
+
+    data_init(&actual);
+
+    parser = push_parser_new();
+    fail_if(parser == NULL,
+            "Could not allocate a new push parser");
+
+    message_callback = create_data_message("data", NULL,
+                                           parser, &actual);
+    fail_if(message_callback == NULL,
+            "Could not allocate a new message callback");
+
+    push_parser_set_callback(parser, message_callback);
+
+    fail_unless(push_parser_activate(parser, NULL)
+                == PUSH_INCOMPLETE,
+                "Could not activate parser");
+
+    for (offset = 0; offset < length; offset += chunk_size)
+    {
+        size_t  size = length - offset;
+        if (size > chunk_size) size = chunk_size;
+
+        fail_unless(push_parser_submit_data
+                    (parser, &data[offset], size) == PUSH_INCOMPLETE,
+                    "Could not parse data");
+    }
+
+    fail_unless(push_parser_eof(parser) == PUSH_SUCCESS,
+                "Shouldn't get parse error at EOF");
+
+    fail_unless(ARRAY_EQ(&actual.uint32s, uint32_t, expected),
+                "uint32 values don't match (chunk size %zu)",
+                chunk_size);
+
+    push_parser_free(parser);
+    data_done(&actual);
+}
+
+
+START_TEST(test_long_run)
+{
+    PUSH_DEBUG_MSG("---\nStarting test case test_long_run\n");
+    read_long_run(3 + LONG_RUN_COUNT * 5);
+    read_long_run(7);
+    read_long_run(64);
+}
+END_TEST
+
+
+PARSE_ERROR_TEST(02)
+PARSE_ERROR_TEST(03)
+PARSE_ERROR_TEST(04)
+
+
+/*-----------------------------------------------------------------------
+ * Testing harness
+ */
+
+Suite *
+test_suite()
+{
+    Suite  *s = suite_create("protobuf-packed");
+
+    TCase  *tc = tcase_create("protobuf-packed");
+    tcase_add_test(tc, test_read_01);
+    tcase_add_test(tc, test_two_part_read_01);
+    tcase_add_test(tc, test_bytewise_read_01);
+    tcase_add_test(tc, test_long_run);
+    tcase_add_test(tc, test_parse_error_02);
+    tcase_add_test(tc, test_parse_error_03);
+    tcase_add_test(tc, test_parse_error_04);
+    suite_add_tcase(s, tc);
+
+    return s;
+}
+
+
+int
+main(int argc, const char **argv)
+{
+    int  number_failed;
+    Suite  *suite = test_suite();
+    SRunner  *runner = srunner_create(suite);
+
+    srunner_run_all(runner, CK_NORMAL);
+    number_failed = srunner_ntests_failed(runner);
+    srunner_free(runner);
+
+    return (number_failed == 0)? EXIT_SUCCESS: EXIT_FAILURE;
+}
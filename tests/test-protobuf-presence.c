@@ -0,0 +1,478 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2010, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the LICENSE.txt file in this distribution for license
+ * details.
+ * ----------------------------------------------------------------------
+ */
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <check.h>
+
+#include <push/basics.h>
+#include <push/talloc.h>
+
+#include <push/protobuf/basics.h>
+#include <push/protobuf/field-map.h>
+#include <push/protobuf/message.h>
+
+
+/*-----------------------------------------------------------------------
+ * Our data type
+ */
+
+typedef struct _data
+{
+    uint32_t  id;
+    uint32_t  count;
+    uint32_t  size;
+    uint32_t  extra;
+    uint64_t  presence;
+} data_t;
+
+static push_callback_t *
+create_data_message(const char *name,
+                    void *parent,
+                    push_parser_t *parser,
+                    data_t *dest)
+{
+    void  *context;
+    push_protobuf_field_map_t  *field_map;
+    push_callback_t  *callback;
+
+    context = push_talloc_new(parent);
+    if (context == NULL) return NULL;
+
+    /*
+     * Then create the callbacks.
+     */
+
+    if (name == NULL) name = "data";
+
+    field_map = push_protobuf_field_map_new(context);
+    if (field_map == NULL) goto error;
+
+#define CHECK(call) { if (!(call)) goto error; }
+
+    CHECK(push_protobuf_assign_uint32(name, "id", context, parser,
+                                      field_map, 1, &dest->id));
+    CHECK(push_protobuf_assign_uint32(name, "count", context, parser,
+                                      field_map, 3, &dest->count));
+    CHECK(push_protobuf_assign_uint32(name, "size", context, parser,
+                                      field_map, 20, &dest->size));
+    CHECK(push_protobuf_assign_uint32(name, "extra", context, parser,
+                                      field_map, 70, &dest->extra));
+
+    push_protobuf_field_map_track_presence(field_map, &dest->presence);
+    CHECK(push_protobuf_field_map_require_field(field_map, 1));
+    CHECK(push_protobuf_field_map_require_field(field_map, 20));
+
+#undef CHECK
+
+    callback = push_protobuf_message_new(name, context, parser, field_map);
+
+    if (callback == NULL) goto error;
+    return callback;
+
+  error:
+    push_talloc_free(context);
+    return NULL;
+}
+
+
+/**
+ * A message that contains a data_t as a submessage.
+ */
+
+typedef struct _outer
+{
+    data_t  inner;
+    uint32_t  after;
+} outer_t;
+
+static push_callback_t *
+create_outer_message(const char *name,
+                     void *parent,
+                     push_parser_t *parser,
+                     outer_t *dest)
+{
+    void  *context;
+    push_protobuf_field_map_t  *field_map;
+    push_callback_t  *inner;
+    push_callback_t  *callback;
+
+    context = push_talloc_new(parent);
+    if (context == NULL) return NULL;
+
+    if (name == NULL) name = "outer";
+
+    field_map = push_protobuf_field_map_new(context);
+    if (field_map == NULL) goto error;
+
+#define CHECK(call) { if (!(call)) goto error; }
+
+    inner = create_data_message("outer.inner", context, parser,
+                                &dest->inner);
+    CHECK(inner != NULL);
+    CHECK(push_protobuf_add_submessage(name, "inner", context, parser,
+                                       field_map, 1, inner));
+    CHECK(push_protobuf_assign_uint32(name, "after", context, parser,
+                                      field_map, 2, &dest->after));
+
+#undef CHECK
+
+    callback = push_protobuf_message_new(name, context, parser, field_map);
+
+    if (callback == NULL) goto error;
+    return callback;
+
+  error:
+    push_talloc_free(context);
+    return NULL;
+}
+
+
+/*-----------------------------------------------------------------------
+ * Sample data
+ */
+
+const uint8_t  DATA_01[] =
+    "\x08\x01"                  /* id = 1 */
+    "\x18\x03"                  /* count = 3 */
+    "\xa0\x01\x05"              /* size = 5 */
+    "\xb0\x04\x07";             /* extra = 7 */
+const size_t  LENGTH_01 = 10;
+
+const uint64_t  EXPECTED_PRESENCE_01 =
+    PUSH_PROTOBUF_PRESENCE_BIT(1) |
+    PUSH_PROTOBUF_PRESENCE_BIT(3) |
+    PUSH_PROTOBUF_PRESENCE_BIT(20);
+
+
+/*
+ * Missing the required size field.
+ */
+
+const uint8_t  DATA_02[] =
+    "\x08\x01"                  /* id = 1 */
+    "\x18\x03"                  /* count = 3 */
+    "\xb0\x04\x07";             /* extra = 7 */
+const size_t  LENGTH_02 = 7;
+
+
+/*
+ * A submessage that's missing its required id and size fields,
+ * followed by another field of the outer message.
+ */
+
+const uint8_t  DATA_03[] =
+    "\x0a\x02"                  /* inner, length = 2 */
+    "\x18\x07"                  /*   count = 7 */
+    "\x10\x05";                 /* after = 5 */
+const size_t  LENGTH_03 = 6;
+
+
+/*-----------------------------------------------------------------------
+ * Helper functions
+ */
+
+static push_parser_t *
+create_parser(data_t *actual)
+{
+    push_parser_t  *parser;
+    push_callback_t  *callback;
+
+    parser = push_parser_new();
+    fail_if(parser == NULL,
+            "Could not allocate a new push parser");
+
+    callback = create_data_message("data", NULL, parser, actual);
+    fail_if(callback == NULL,
+            "Could not allocate a new message callback");
+
+    push_parser_set_callback(parser, callback);
+    return parser;
+}
+
+
+/**
+ * Parse some data, sending it in chunks of at most chunk_size bytes,
+ * and return the result at EOF.
+ */
+
+static push_error_code_t
+parse(push_parser_t *parser, const uint8_t *data, size_t length,
+      size_t chunk_size)
+{
+    size_t  offset;
+
+    fail_unless(push_parser_activate(parser, NULL)
+                == PUSH_INCOMPLETE,
+                "Could not activate parser");
+
+    for (offset = 0; offset < length; offset += chunk_size)
+    {
+        size_t  size = length - offset;
+        if (size > chunk_size) size = chunk_size;
+
+        fail_unless(push_parser_submit_data
+                    (parser, &data[offset], size) == PUSH_INCOMPLETE,
+                    "Could not parse data");
+    }
+
+    return push_parser_eof(parser);
+}
+
+
+/**
+ * Like parse, but stops at the first chunk that doesn't return an
+ * incomplete, and returns that chunk's result.
+ */
+
+static push_error_code_t
+parse_chunks(push_parser_t *parser, const uint8_t *data, size_t length,
+             size_t chunk_size)
+{
+    size_t  offset;
+
+    for (offset = 0; offset < length; offset += chunk_size)
+    {
+        size_t  size = length - offset;
+        push_error_code_t  result;
+
+        if (size > chunk_size) size = chunk_size;
+
+        result = push_parser_submit_data(parser, &data[offset], size);
+        if (result != PUSH_INCOMPLETE)
+            return result;
+    }
+
+    return push_parser_eof(parser);
+}
+
+
+static void
+read_data_01(size_t chunk_size)
+{
+    data_t  actual;
+    push_parser_t  *parser;
+
+    memset(&actual, 0, sizeof(data_t));
+    parser = create_parser(&actual);
+
+    fail_unless(parse(parser, DATA_01, LENGTH_01, chunk_size)
+                == PUSH_SUCCESS,
+                "Shouldn't get parse error at EOF (chunk size %zu)",
+                chunk_size);
+
+    fail_unless(actual.presence == EXPECTED_PRESENCE_01,
+                "Presence 0x%016"PRIx64" doesn't match "
+                "(chunk size %zu)",
+                actual.presence, chunk_size);
+
+    fail_unless((actual.id == 1) && (actual.count == 3) &&
+                (actual.size == 5) && (actual.extra == 7),
+                "Data doesn't match (chunk size %zu)",
+                chunk_size);
+
+    push_parser_free(parser);
+}
+
+
+/*-----------------------------------------------------------------------
+ * Test cases
+ */
+
+START_TEST(test_read_01)
+{
+    PUSH_DEBUG_MSG("---\nStarting test_read_01\n");
+    read_data_01(LENGTH_01);
+}
+END_TEST
+
+
+START_TEST(test_bytewise_read_01)
+{
+    PUSH_DEBUG_MSG("---\nStarting test_bytewise_read_01\n");
+    read_data_01(1);
+}
+END_TEST
+
+
+START_TEST(test_missing_required_02)
+{
+    data_t  actual;
+    push_parser_t  *parser;
+    size_t  chunk_size;
+
+    PUSH_DEBUG_MSG("---\nStarting test_missing_required_02\n");
+
+    for (chunk_size = 1; chunk_size <= LENGTH_02; chunk_size++)
+    {
+        memset(&actual, 0, sizeof(data_t));
+        parser = create_parser(&actual);
+
+        fail_unless(parse(parser, DATA_02, LENGTH_02, chunk_size)
+                    == PUSH_PARSE_ERROR,
+                    "Should get missing field error "
+                    "(chunk size %zu)",
+                    chunk_size);
+
+        push_parser_free(parser);
+    }
+}
+END_TEST
+
+
+START_TEST(test_nested_missing_required_03)
+{
+    outer_t  actual;
+    push_parser_t  *parser;
+    push_callback_t  *callback;
+    size_t  chunk_size;
+
+    PUSH_DEBUG_MSG("---\nStarting test_nested_missing_required_03\n");
+
+    /*
+     * The submessage's missing fields should fail the outer message,
+     * no matter how the data is chunked.  In particular, when the
+     * whole submessage arrives in one chunk, the error must not be
+     * mistaken for the end of the outer message.
+     */
+
+    for (chunk_size = 1; chunk_size <= LENGTH_03; chunk_size++)
+    {
+        memset(&actual, 0, sizeof(outer_t));
+
+        parser = push_parser_new();
+        fail_if(parser == NULL,
+                "Could not allocate a new push parser");
+
+        callback = create_outer_message("outer", NULL, parser, &actual);
+        fail_if(callback == NULL,
+                "Could not allocate a new message callback");
+
+        push_parser_set_callback(parser, callback);
+
+        fail_unless(push_parser_activate(parser, NULL)
+                    == PUSH_INCOMPLETE,
+                    "Could not activate parser");
+
+        fail_unless(parse_chunks(parser, DATA_03, LENGTH_03, chunk_size)
+                    == PUSH_PARSE_ERROR,
+                    "Should get missing field error "
+                    "(chunk size %zu)",
+                    chunk_size);
+
+        fail_unless(actual.after == 0,
+                    "Shouldn't read the field after the submessage "
+                    "(chunk size %zu)",
+                    chunk_size);
+
+        push_parser_free(parser);
+    }
+}
+END_TEST
+
+
+START_TEST(test_presence_reset)
+{
+    data_t  actual;
+    push_parser_t  *parser;
+
+    PUSH_DEBUG_MSG("---\nStarting test_presence_reset\n");
+
+    /*
+     * The fields of the first message shouldn't count towards the
+     * second.
+     */
+
+    memset(&actual, 0, sizeof(data_t));
+    parser = create_parser(&actual);
+
+    fail_unless(parse(parser, DATA_01, LENGTH_01, LENGTH_01)
+                == PUSH_SUCCESS,
+                "Shouldn't get parse error at EOF");
+
+    fail_unless(parse(parser, DATA_02, LENGTH_02, LENGTH_02)
+                == PUSH_PARSE_ERROR,
+                "Should get parse error for missing field");
+
+    fail_unless(actual.presence ==
+                (PUSH_PROTOBUF_PRESENCE_BIT(1) |
+                 PUSH_PROTOBUF_PRESENCE_BIT(3)),
+                "Presence 0x%016"PRIx64" doesn't match",
+                actual.presence);
+
+    push_parser_free(parser);
+}
+END_TEST
+
+
+START_TEST(test_require_large_field)
+{
+    push_protobuf_field_map_t  *field_map;
+
+    PUSH_DEBUG_MSG("---\nStarting test_require_large_field\n");
+
+    field_map = push_protobuf_field_map_new(NULL);
+    fail_if(field_map == NULL,
+            "Could not allocate a new field map");
+
+    fail_unless(push_protobuf_field_map_require_field(field_map, 63),
+                "Should be able to require field 63");
+    fail_if(push_protobuf_field_map_require_field(field_map, 64),
+            "Shouldn't be able to require field 64");
+
+    fail_unless(push_protobuf_field_map_get_presence(field_map) != NULL,
+                "Requiring a field should track presence");
+    fail_unless(push_protobuf_field_map_get_required(field_map) ==
+                PUSH_PROTOBUF_PRESENCE_BIT(63),
+                "Required bits don't match");
+
+    push_talloc_free(field_map);
+}
+END_TEST
+
+
+/*-----------------------------------------------------------------------
+ * Testing harness
+ */
+
+Suite *
+test_suite()
+{
+    Suite  *s = suite_create("protobuf-presence");
+
+    TCase  *tc = tcase_create("protobuf-presence");
+    tcase_add_test(tc, test_read_01);
+    tcase_add_test(tc, test_bytewise_read_01);
+    tcase_add_test(tc, test_missing_required_02);
+    tcase_add_test(tc, test_nested_missing_required_03);
+    tcase_add_test(tc, test_presence_reset);
+    tcase_add_test(tc, test_require_large_field);
+    suite_add_tcase(s, tc);
+
+    return s;
+}
+
+int
+main(int argc, const char **argv)
+{
+    int  number_failed;
+    Suite  *suite = test_suite();
+    SRunner  *runner = srunner_create(suite);
+
+    srunner_run_all(runner, CK_NORMAL);
+    number_failed = srunner_ntests_failed(runner);
+    srunner_free(runner);
+
+    return (number_failed == 0)? EXIT_SUCCESS: EXIT_FAILURE;
+}
@@ -0,0 +1,484 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2010, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the LICENSE.txt file in this distribution for license
+ * details.
+ * ----------------------------------------------------------------------
+ */
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <check.h>
+#include <hwm-buffer.h>
+
+#include <push/basics.h>
+#include <push/talloc.h>
+
+#include <push/protobuf/basics.h>
+#include <push/protobuf/field-map.h>
+#include <push/protobuf/message.h>
+#include <push/protobuf/repeated.h>
+
+
+/*-----------------------------------------------------------------------
+ * Our data type
+ */
+
+typedef struct _item
+{
+    uint32_t  id;
+    uint32_t  count;
+} item_t;
+
+typedef struct _data
+{
+    hwm_buffer_t  uint32s;
+    hwm_buffer_t  sint64s;
+    push_protobuf_string_list_t  strings;
+    hwm_buffer_t  doubles;
+    hwm_buffer_t  items;
+    item_t  current_item;
+} data_t;
+
+static void
+data_init(data_t *data)
+{
+    hwm_buffer_init(&data->uint32s);
+    hwm_buffer_init(&data->sint64s);
+    push_protobuf_string_list_init(&data->strings);
+    hwm_buffer_init(&data->doubles);
+    hwm_buffer_init(&data->items);
+}
+
+static void
+data_done(data_t *data)
+{
+    hwm_buffer_done(&data->uint32s);
+    hwm_buffer_done(&data->sint64s);
+    push_protobuf_string_list_done(&data->strings);
+    hwm_buffer_done(&data->doubles);
+    hwm_buffer_done(&data->items);
+}
+
+static push_callback_t *
+create_item_message(const char *name,
+                    void *parent,
+                    push_parser_t *parser,
+                    item_t *dest)
+{
+    void  *context;
+    push_protobuf_field_map_t  *field_map;
+    push_callback_t  *callback;
+
+    context = push_talloc_new(parent);
+    if (context == NULL) return NULL;
+
+    if (name == NULL) name = "item";
+
+    field_map = push_protobuf_field_map_new(context);
+    if (field_map == NULL) goto error;
+
+#define CHECK(call) { if (!(call)) goto error; }
+
+    CHECK(push_protobuf_assign_uint32(name, "id", context, parser,
+                                      field_map, 1, &dest->id));
+    CHECK(push_protobuf_assign_uint32(name, "count", context, parser,
+                                      field_map, 2, &dest->count));
+
+#undef CHECK
+
+    callback = push_protobuf_message_new(name, context, parser, field_map);
+
+    if (callback == NULL) goto error;
+    return callback;
+
+  error:
+    push_talloc_free(context);
+    return NULL;
+}
+
+static push_callback_t *
+create_data_message(const char *name,
+                    void *parent,
+                    push_parser_t *parser,
+                    data_t *dest)
+{
+    void  *context;
+    push_protobuf_field_map_t  *field_map;
+    push_callback_t  *item;
+    push_callback_t  *callback;
+
+    context = push_talloc_new(parent);
+    if (context == NULL) return NULL;
+
+    /*
+     * Then create the callbacks.
+     */
+
+    if (name == NULL) name = "data";
+
+    field_map = push_protobuf_field_map_new(context);
+    if (field_map == NULL) goto error;
+
+    item = create_item_message("item", context, parser,
+                               &dest->current_item);
+    if (item == NULL) goto error;
+
+#define CHECK(call) { if (!(call)) goto error; }
+
+    CHECK(push_protobuf_add_repeated_uint32(name, "uint32s", context,
+                                            parser, field_map, 1,
+                                            &dest->uint32s));
+    CHECK(push_protobuf_add_repeated_sint64(name, "sint64s", context,
+                                            parser, field_map, 2,
+                                            &dest->sint64s));
+    CHECK(push_protobuf_add_repeated_string(name, "strings", context,
+                                            parser, field_map, 3,
+                                            &dest->strings));
+    CHECK(push_protobuf_add_repeated_double(name, "doubles", context,
+                                            parser, field_map, 4,
+                                            &dest->doubles));
+    CHECK(push_protobuf_add_repeated_submessage(name, "items", context,
+                                                parser, field_map, 5,
+                                                item, &dest->current_item,
+                                                sizeof(item_t),
+                                                &dest->items));
+
+#undef CHECK
+
+    callback = push_protobuf_message_new(name, context, parser, field_map);
+
+    if (callback == NULL) goto error;
+    return callback;
+
+  error:
+    push_talloc_free(context);
+    return NULL;
+}
+
+
+/*-----------------------------------------------------------------------
+ * Sample data
+ */
+
+const uint8_t  DATA_01[] =
+    "\x08"                      /* field 1, wire type 0 */
+    "\x01"                      /*   value = 1 */
+    "\x0a"                      /* field 1 packed, wire type 2 */
+    "\x02"                      /*   length = 2 */
+    "\x06\x07"                  /*   values = 6, 7 */
+    "\x1a"                      /* field 3, wire type 2 */
+    "\x03"                      /*   length = 3 */
+    "abc"                       /*   value = "abc" */
+    "\x08"                      /* field 1, wire type 0 */
+    "\xac\x02"                  /*   value = 300 */
+    "\x2a"                      /* field 5, wire type 2 */
+    "\x02"                      /*   length = 2 */
+    "\x08\x07"                  /*   id = 7 */
+    "\x1a"                      /* field 3, wire type 2 */
+    "\x00"                      /*   length = 0 */
+    "\x2a"                      /* field 5, wire type 2 */
+    "\x04"                      /*   length = 4 */
+    "\x08\x01"                  /*   id = 1 */
+    "\x10\x02"                  /*   count = 2 */
+    "\x10"                      /* field 2, wire type 0 */
+    "\x01"                      /*   value = -1 */
+    "\x10"                      /* field 2, wire type 0 */
+    "\x02"                      /*   value = 1 */
+    "\x21"                      /* field 4, wire type 1 */
+    "\x00\x00\x00\x00\x00\x00\xf8\x3f" /* value = 1.5 */
+    "\x1a"                      /* field 3, wire type 2 */
+    "\x05"                      /*   length = 5 */
+    "hello"                     /*   value = "hello" */
+    "\x12"                      /* field 2 packed, wire type 2 */
+    "\x01"                      /*   length = 1 */
+    "\x03";                     /*   value = -2 */
+const size_t  LENGTH_01 = 49;
+
+const uint32_t  EXPECTED_UINT32S_01[] =
+{ 1, 6, 7, 300 };
+const int64_t  EXPECTED_SINT64S_01[] =
+{ -1, 1, -2 };
+const char  *EXPECTED_STRINGS_01[] =
+{ "abc", "", "hello" };
+const double  EXPECTED_DOUBLES_01[] =
+{ 1.5 };
+const item_t  EXPECTED_ITEMS_01[] =
+{ { 7, 0 }, { 1, 2 } };
+
+
+/**
+ * A string that ends early.
+ */
+
+const uint8_t  DATA_02[] =
+    "\x1a"                      /* field 3, wire type 2 */
+    "\x05"                      /*   length = 5 */
+    "ab";                       /*   value = (incomplete) */
+const size_t  LENGTH_02 = 4;
+
+
+/**
+ * A submessage whose last field is missing its value.
+ */
+
+const uint8_t  DATA_03[] =
+    "\x2a"                      /* field 5, wire type 2 */
+    "\x01"                      /*   length = 1 */
+    "\x08";                     /*   id = (missing) */
+const size_t  LENGTH_03 = 3;
+
+
+/*-----------------------------------------------------------------------
+ * Helper functions
+ */
+
+#define ARRAY_EQ(buf, type, expected)                               \
+    ((hwm_buffer_current_list_size(buf, type) ==                    \
+      sizeof(expected) / sizeof(type)) &&                           \
+     (memcmp(hwm_buffer_mem(buf, type), expected,                   \
+             sizeof(expected)) == 0))
+
+
+static bool
+strings_eq(const push_protobuf_string_list_t *list,
+           const char **expected,
+           size_t expected_count)
+{
+    size_t  i;
+
+    if (push_protobuf_string_list_count(list) != expected_count)
+        return false;
+
+    for (i = 0; i < expected_count; i++)
+    {
+        const char  *actual;
+        size_t  size;
+
+        actual = push_protobuf_string_list_get(list, i, &size);
+        if ((actual == NULL) ||
+            (size != strlen(expected[i])) ||
+            (strcmp(actual, expected[i]) != 0))
+        {
+            return false;
+        }
+    }
+
+    return (push_protobuf_string_list_get(list, i, NULL) == NULL);
+}
+
+
+/**
+ * Parse DATA_01, sending it in chunks of at most chunk_size bytes,
+ * with the first chunk ending at first_chunk_size.
+ */
+
+static void
+read_data_01(size_t first_chunk_size, size_t chunk_size)
+{
+    push_parser_t  *parser;
+    push_callback_t  *message_callback;
+    data_t  actual;
+    size_t  offset;
+
+    data_init(&actual);
+
+    parser = push_parser_new();
+    fail_if(parser == NULL,
+            "Could not allocate a new push parser");
+
+    message_callback = create_data_message("data", NULL,
+                                           parser, &actual);
+    fail_if(message_callback == NULL,
+            "Could not allocate a new message callback");
+
+    push_parser_set_callback(parser, message_callback);
+
+    fail_unless(push_parser_activate(parser, NULL)
+                == PUSH_INCOMPLETE,
+                "Could not activate parser");
+
+    fail_unless(push_parser_submit_data
+                (parser, &DATA_01, first_chunk_size) == PUSH_INCOMPLETE,
+                "Could not parse data");
+
+    for (offset = first_chunk_size;
+         offset < LENGTH_01;
+         offset += chunk_size)
+    {
+        size_t  size = LENGTH_01 - offset;
+        if (size > chunk_size) size = chunk_size;
+
+        fail_unless(push_parser_submit_data
+                    (parser, &DATA_01[offset], size) == PUSH_INCOMPLETE,
+                    "Could not parse data");
+    }
+
+    fail_unless(push_parser_eof(parser) == PUSH_SUCCESS,
+                "Shouldn't get parse error at EOF");
+
+    fail_unless(ARRAY_EQ(&actual.uint32s, uint32_t,
+                         EXPECTED_UINT32S_01),
+                "uint32 values don't match (split at %zu, %zu)",
+                first_chunk_size, chunk_size);
+    fail_unless(ARRAY_EQ(&actual.sint64s, int64_t,
+                         EXPECTED_SINT64S_01),
+                "sint64 values don't match (split at %zu, %zu)",
+                first_chunk_size, chunk_size);
+    fail_unless(strings_eq(&actual.strings, EXPECTED_STRINGS_01, 3),
+                "string values don't match (split at %zu, %zu)",
+                first_chunk_size, chunk_size);
+    fail_unless(ARRAY_EQ(&actual.doubles, double,
+                         EXPECTED_DOUBLES_01),
+                "double values don't match (split at %zu, %zu)",
+                first_chunk_size, chunk_size);
+    fail_unless(ARRAY_EQ(&actual.items, item_t,
+                         EXPECTED_ITEMS_01),
+                "item values don't match (split at %zu, %zu)",
+                first_chunk_size, chunk_size);
+
+    push_parser_free(parser);
+    data_done(&actual);
+}
+
+
+#define PARSE_ERROR_TEST(test_name)                                 \
+    START_TEST(test_parse_error_##test_name)                        \
+    {                                                               \
+        push_parser_t  *parser;                                     \
+        push_callback_t  *message_callback;                         \
+        data_t  actual;                                             \
+        push_error_code_t  result;                                  \
+                                                                    \
+        PUSH_DEBUG_MSG("---\nStarting test case "                   \
+                       "test_parse_error_"                          \
+                       #test_name                                   \
+                       "\n");                                       \
+                                                                    \
+        data_init(&actual);                                         \
+                                                                    \
+        parser = push_parser_new();                                 \
+        fail_if(parser == NULL,                                     \
+                "Could not allocate a new push parser");            \
+                                                                    \
+        message_callback = create_data_message("data", NULL,        \
+                                               parser, &actual);    \
+        fail_if(message_callback == NULL,                           \
+                "Could not allocate a new message callback");       \
+                                                                    \
+        push_parser_set_callback(parser, message_callback);         \
+                                                                    \
+        fail_unless(push_parser_activate(parser, NULL)              \
+                    == PUSH_INCOMPLETE,                             \
+                    "Could not activate parser");                   \
+                                                                    \
+        /*                                                          \
+         * Send in the first byte on its own, so that the error     \
+         * happens after the message has returned an incomplete.    \
+         */                                                         \
+                                                                    \
+        fail_unless(push_parser_submit_data                         \
+                    (parser, &DATA_##test_name, 1)                  \
+                    == PUSH_INCOMPLETE,                             \
+                    "Could not parse data");                        \
+                                                                    \
+        result = push_parser_submit_data                            \
+            (parser, &DATA_##test_name[1], LENGTH_##test_name - 1); \
+        if (result == PUSH_INCOMPLETE)                              \
+            result = push_parser_eof(parser);                       \
+                                                                    \
+        fail_unless(result == PUSH_PARSE_ERROR,                     \
+                    "Should get parse error");                      \
+                                                                    \
+        push_parser_free(parser);                                   \
+        data_done(&actual);                                         \
+    }                                                               \
+    END_TEST
+
+
+/*-----------------------------------------------------------------------
+ * Test cases
+ */
+
+START_TEST(test_read_01)
+{
+    PUSH_DEBUG_MSG("---\nStarting test case test_read_01\n");
+    read_data_01(LENGTH_01, LENGTH_01);
+}
+END_TEST
+
+
+START_TEST(test_two_part_read_01)
+{
+    size_t  first_chunk_size;
+
+    /*
+     * Try splitting the data at every possible position, so that we
+     * cover elements that straddle chunk boundaries.
+     */
+
+    PUSH_DEBUG_MSG("---\nStarting test case test_two_part_read_01\n");
+
+    for (first_chunk_size = 1;
+         first_chunk_size < LENGTH_01;
+         first_chunk_size++)
+    {
+        read_data_01(first_chunk_size, LENGTH_01);
+    }
+}
+END_TEST
+
+
+START_TEST(test_bytewise_read_01)
+{
+    PUSH_DEBUG_MSG("---\nStarting test case test_bytewise_read_01\n");
+    read_data_01(1, 1);
+}
+END_TEST
+
+
+PARSE_ERROR_TEST(02)
+PARSE_ERROR_TEST(03)
+
+
+/*-----------------------------------------------------------------------
+ * Testing harness
+ */
+
+Suite *
+test_suite()
+{
+    Suite  *s = suite_create("protobuf-repeated");
+
+    TCase  *tc = tcase_create("protobuf-repeated");
+    tcase_add_test(tc, test_read_01);
+    tcase_add_test(tc, test_two_part_read_01);
+    tcase_add_test(tc, test_bytewise_read_01);
+    tcase_add_test(tc, test_parse_error_02);
+    tcase_add_test(tc, test_parse_error_03);
+    suite_add_tcase(s, tc);
+
+    return s;
+}
+
+
+int
+main(int argc, const char **argv)
+{
+    int  number_failed;
+    Suite  *suite = test_suite();
+    SRunner  *runner = srunner_create(suite);
+
+    srunner_run_all(runner, CK_NORMAL);
+    number_failed = srunner_ntests_failed(runner);
+    srunner_free(runner);
+
+    return (number_failed == 0)? EXIT_SUCCESS: EXIT_FAILURE;
+}
@@ -0,0 +1,312 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2010, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the LICENSE.txt file in this distribution for license
+ * details.
+ * ----------------------------------------------------------------------
+ */
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <check.h>
+
+#include <push/basics.h>
+#include <push/talloc.h>
+
+#include <push/protobuf/basics.h>
+#include <push/protobuf/field-map.h>
+#include <push/protobuf/message.h>
+#include <push/protobuf/primitives.h>
+
+
+/*-----------------------------------------------------------------------
+ * Sample data
+ */
+
+/**
+ * A message where the only known field (field 1) comes after an
+ * unknown field of every wire type.
+ */
+
+const uint8_t  DATA_01[] =
+    "\x10"                      /* field 2, wire type 0 */
+    "\x80\x80\x80\x80\x80"      /*   value (10 bytes) */
+    "\x80\x80\x80\x80\x01"      /*   (cont) */
+    "\x19"                      /* field 3, wire type 1 */
+    "\x01\x02\x03\x04\x05\x06\x07\x08" /* value */
+    "\x22"                      /* field 4, wire type 2 */
+    "\x03"                      /*   length = 3 */
+    "abc"                       /*   value */
+    "\x2b"                      /* field 5, wire type 3 (start group) */
+    "\x08"                      /*   field 1, wire type 0 */
+    "\x96\x01"                  /*     value = 150 */
+    "\x3b"                      /*   field 7, wire type 3 (nested) */
+    "\x12"                      /*     field 2, wire type 2 */
+    "\x01"                      /*       length = 1 */
+    "z"                         /*       value */
+    "\x3c"                      /*   field 7, wire type 4 (end nested) */
+    "\x1d"                      /*   field 3, wire type 5 */
+    "\x01\x02\x03\x04"          /*     value */
+    "\x2c"                      /* field 5, wire type 4 (end group) */
+    "\x35"                      /* field 6, wire type 5 */
+    "\x01\x02\x03\x04"          /*   value */
+    "\x08"                      /* field 1, wire type 0 */
+    "\x2a";                     /*   value = 42 */
+const size_t  LENGTH_01 = 47;
+
+
+/*-----------------------------------------------------------------------
+ * Helper functions
+ */
+
+static push_callback_t *
+create_data_message(const char *name,
+                    void *parent,
+                    push_parser_t *parser,
+                    uint32_t *dest)
+{
+    void  *context;
+    push_protobuf_field_map_t  *field_map;
+    push_callback_t  *callback;
+
+    context = push_talloc_new(parent);
+    if (context == NULL) return NULL;
+
+    field_map = push_protobuf_field_map_new(context);
+    if (field_map == NULL) goto error;
+
+    if (!push_protobuf_assign_uint32(name, "known", context, parser,
+                                     field_map, 1, dest))
+        goto error;
+
+    callback = push_protobuf_message_new(name, context, parser, field_map);
+
+    if (callback == NULL) goto error;
+    return callback;
+
+  error:
+    push_talloc_free(context);
+    return NULL;
+}
+
+
+static void
+read_data_01(size_t first_chunk_size)
+{
+    push_parser_t  *parser;
+    push_callback_t  *message_callback;
+    uint32_t  actual = 0;
+
+    parser = push_parser_new();
+    fail_if(parser == NULL,
+            "Could not allocate a new push parser");
+
+    message_callback = create_data_message("data", NULL,
+                                           parser, &actual);
+    fail_if(message_callback == NULL,
+            "Could not allocate a new message callback");
+
+    push_parser_set_callback(parser, message_callback);
+
+    fail_unless(push_parser_activate(parser, NULL)
+                == PUSH_INCOMPLETE,
+                "Could not activate parser");
+
+    fail_unless(push_parser_submit_data
+                (parser, &DATA_01, first_chunk_size) == PUSH_INCOMPLETE,
+                "Could not parse data (split at %zu)",
+                first_chunk_size);
+
+    if (first_chunk_size < LENGTH_01)
+    {
+        fail_unless(push_parser_submit_data
+                    (parser, &DATA_01[first_chunk_size],
+                     LENGTH_01 - first_chunk_size) == PUSH_INCOMPLETE,
+                    "Could not parse data (split at %zu)",
+                    first_chunk_size);
+    }
+
+    fail_unless(push_parser_eof(parser) == PUSH_SUCCESS,
+                "Shouldn't get parse error at EOF");
+
+    fail_unless(actual == 42,
+                "Value doesn't match (got %"PRIu32", expected 42, "
+                "split at %zu)",
+                actual, first_chunk_size);
+
+    push_parser_free(parser);
+}
+
+
+/**
+ * Skip a single field with the given tag, returning the result of
+ * the parse.  The data is sent in one byte at a time.
+ */
+
+static push_error_code_t
+skip_bytewise(push_protobuf_tag_t tag,
+              const uint8_t *data, size_t length)
+{
+    push_parser_t  *parser;
+    push_callback_t  *callback;
+    push_error_code_t  result;
+    size_t  i;
+
+    parser = push_parser_new();
+    fail_if(parser == NULL,
+            "Could not allocate a new push parser");
+
+    callback = push_protobuf_skip_field_new("skip", NULL, parser);
+    fail_if(callback == NULL,
+            "Could not allocate a new skip callback");
+
+    push_parser_set_callback(parser, callback);
+
+    result = push_parser_activate(parser, &tag);
+
+    for (i = 0; (i < length) && (result == PUSH_INCOMPLETE); i++)
+        result = push_parser_submit_data(parser, &data[i], 1);
+
+    if (result == PUSH_INCOMPLETE)
+        result = push_parser_eof(parser);
+
+    push_parser_free(parser);
+    return result;
+}
+
+
+/*-----------------------------------------------------------------------
+ * Test cases
+ */
+
+START_TEST(test_read_01)
+{
+    PUSH_DEBUG_MSG("---\nStarting test case test_read_01\n");
+    read_data_01(LENGTH_01);
+}
+END_TEST
+
+
+START_TEST(test_two_part_read_01)
+{
+    size_t  first_chunk_size;
+
+    PUSH_DEBUG_MSG("---\nStarting test case test_two_part_read_01\n");
+
+    for (first_chunk_size = 1;
+         first_chunk_size < LENGTH_01;
+         first_chunk_size++)
+    {
+        read_data_01(first_chunk_size);
+    }
+}
+END_TEST
+
+
+START_TEST(test_skip_group_bytewise)
+{
+    PUSH_DEBUG_MSG("---\nStarting test case test_skip_group_bytewise\n");
+
+    /*
+     * The group field from DATA_01, without its start tag.
+     */
+
+    fail_unless(skip_bytewise(PUSH_PROTOBUF_MAKE_TAG
+                              (5, PUSH_PROTOBUF_TAG_TYPE_START_GROUP),
+                              &DATA_01[26], 14) == PUSH_SUCCESS,
+                "Could not skip group");
+}
+END_TEST
+
+
+START_TEST(test_skip_errors)
+{
+    const uint8_t  too_long[] = "\xff\xff\xff\xff\xff\xff\xff\xff"
+        "\xff\xff\xff\xff";
+    const uint8_t  wrong_end[] =
+        "\x3b"                  /* field 7, wire type 3 (nested) */
+        "\x2c"                  /* field 5, wire type 4 (wrong end) */
+        "\x2c";                 /* field 5, wire type 4 (end group) */
+    const uint8_t  huge_tag[] =
+        "\xac\x80\x80\x80\x10"   /* tag = 2^32 + (field 5, end group) */
+        "\x2c";                 /* field 5, wire type 4 (end group) */
+
+    PUSH_DEBUG_MSG("---\nStarting test case test_skip_errors\n");
+
+    fail_unless(skip_bytewise(PUSH_PROTOBUF_MAKE_TAG
+                              (1, PUSH_PROTOBUF_TAG_TYPE_VARINT),
+                              too_long, 12) == PUSH_PARSE_ERROR,
+                "Should reject overlong varint");
+
+    fail_unless(skip_bytewise(PUSH_PROTOBUF_MAKE_TAG
+                              (1, PUSH_PROTOBUF_TAG_TYPE_END_GROUP),
+                              too_long, 0) == PUSH_PARSE_ERROR,
+                "Should reject unmatched end group");
+
+    fail_unless(skip_bytewise(PUSH_PROTOBUF_MAKE_TAG(1, 7),
+                              too_long, 0) == PUSH_PARSE_ERROR,
+                "Should reject invalid wire type");
+
+    fail_unless(skip_bytewise(PUSH_PROTOBUF_MAKE_TAG
+                              (5, PUSH_PROTOBUF_TAG_TYPE_START_GROUP),
+                              &DATA_01[26], 13) == PUSH_PARSE_ERROR,
+                "Should reject unterminated group");
+
+    fail_unless(skip_bytewise(PUSH_PROTOBUF_MAKE_TAG
+                              (5, PUSH_PROTOBUF_TAG_TYPE_START_GROUP),
+                              wrong_end, 3) == PUSH_PARSE_ERROR,
+                "Should reject end group for the wrong field");
+
+    fail_unless(skip_bytewise(PUSH_PROTOBUF_MAKE_TAG
+                              (5, PUSH_PROTOBUF_TAG_TYPE_START_GROUP),
+                              wrong_end + 2, 1) == PUSH_SUCCESS,
+                "Could not skip empty group");
+
+    fail_unless(skip_bytewise(PUSH_PROTOBUF_MAKE_TAG
+                              (5, PUSH_PROTOBUF_TAG_TYPE_START_GROUP),
+                              huge_tag, 6) == PUSH_PARSE_ERROR,
+                "Should reject tag that doesn't fit into 32 bits");
+}
+END_TEST
+
+
+/*-----------------------------------------------------------------------
+ * Testing harness
+ */
+
+Suite *
+test_suite()
+{
+    Suite  *s = suite_create("protobuf-skip-field");
+
+    TCase  *tc = tcase_create("protobuf-skip-field");
+    tcase_add_test(tc, test_read_01);
+    tcase_add_test(tc, test_two_part_read_01);
+    tcase_add_test(tc, test_skip_group_bytewise);
+    tcase_add_test(tc, test_skip_errors);
+    suite_add_tcase(s, tc);
+
+    return s;
+}
+
+
+int
+main(int argc, const char **argv)
+{
+    int  number_failed;
+    Suite  *suite = test_suite();
+    SRunner  *runner = srunner_create(suite);
+
+    srunner_run_all(runner, CK_NORMAL);
+    number_failed = srunner_ntests_failed(runner);
+    srunner_free(runner);
+
+    return (number_failed == 0)? EXIT_SUCCESS: EXIT_FAILURE;
+}
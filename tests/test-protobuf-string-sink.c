@@ -0,0 +1,380 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2010, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the LICENSE.txt file in this distribution for license
+ * details.
+ * ----------------------------------------------------------------------
+ */
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <check.h>
+
+#include <push/basics.h>
+#include <push/primitives.h>
+#include <push/talloc.h>
+
+#include <push/protobuf/basics.h>
+#include <push/protobuf/field-map.h>
+#include <push/protobuf/message.h>
+
+
+/*-----------------------------------------------------------------------
+ * Sink functions
+ */
+
+/**
+ * A sink that copies each piece into a fixed buffer, and counts how
+ * many pieces it received, and how many strings it saw the end of.  It rejects its data once the buffer is
+ * full.
+ */
+
+typedef struct _collector
+{
+    uint8_t  buf[8];
+    size_t  size;
+    size_t  calls;
+    size_t  ends;
+} collector_t;
+
+
+static bool
+collect(void *user_data, const void *buf, size_t size)
+{
+    collector_t  *collector = (collector_t *) user_data;
+
+    if (size == 0)
+    {
+        collector->ends++;
+        return true;
+    }
+
+    if (collector->size + size > sizeof(collector->buf))
+        return false;
+
+    memcpy(collector->buf + collector->size, buf, size);
+    collector->size += size;
+    collector->calls++;
+    return true;
+}
+
+
+/*-----------------------------------------------------------------------
+ * Our data type
+ */
+
+typedef struct _data
+{
+    collector_t  payload;
+    uint32_t  id;
+} data_t;
+
+static push_callback_t *
+create_data_message(const char *name,
+                    void *parent,
+                    push_parser_t *parser,
+                    data_t *dest)
+{
+    void  *context;
+    push_protobuf_field_map_t  *field_map;
+    push_callback_t  *callback;
+
+    context = push_talloc_new(parent);
+    if (context == NULL) return NULL;
+
+    /*
+     * Then create the callbacks.
+     */
+
+    if (name == NULL) name = "data";
+
+    field_map = push_protobuf_field_map_new(context);
+    if (field_map == NULL) goto error;
+
+#define CHECK(call) { if (!(call)) goto error; }
+
+    CHECK(push_protobuf_add_string_sink(name, "payload", context, parser,
+                                        field_map, 1,
+                                        collect, &dest->payload));
+    CHECK(push_protobuf_assign_uint32(name, "id", context, parser,
+                                      field_map, 2, &dest->id));
+
+#undef CHECK
+
+    callback = push_protobuf_message_new(name, context, parser, field_map);
+
+    if (callback == NULL) goto error;
+    return callback;
+
+  error:
+    push_talloc_free(context);
+    return NULL;
+}
+
+
+/*-----------------------------------------------------------------------
+ * Sample data
+ */
+
+const uint8_t  DATA_01[] =
+    "\x0a\x05" "hello"          /* payload = "hello" */
+    "\x10\x07";                 /* id = 7 */
+const size_t  LENGTH_01 = 9;
+
+
+/*
+ * The payload is too big for the collector.
+ */
+
+const uint8_t  DATA_02[] =
+    "\x0a\x0a" "0123456789"     /* payload = "0123456789" */
+    "\x10\x07";                 /* id = 7 */
+const size_t  LENGTH_02 = 14;
+
+
+/*
+ * An empty payload.
+ */
+
+const uint8_t  DATA_03[] =
+    "\x0a\x00"                  /* payload = "" */
+    "\x10\x07";                 /* id = 7 */
+const size_t  LENGTH_03 = 4;
+
+
+/*-----------------------------------------------------------------------
+ * Helper functions
+ */
+
+static push_error_code_t
+parse_data(data_t *actual,
+           const void *data,
+           size_t length,
+           size_t chunk_size)
+{
+    push_parser_t  *parser;
+    push_callback_t  *callback;
+    push_error_code_t  result;
+    size_t  offset;
+
+    memset(actual, 0, sizeof(data_t));
+
+    parser = push_parser_new();
+    fail_if(parser == NULL,
+            "Could not allocate a new push parser");
+
+    callback = create_data_message("data", NULL, parser, actual);
+    fail_if(callback == NULL,
+            "Could not allocate a new message callback");
+
+    push_parser_set_callback(parser, callback);
+
+    fail_unless(push_parser_activate(parser, NULL)
+                == PUSH_INCOMPLETE,
+                "Could not activate parser");
+
+    for (offset = 0; offset < length; offset += chunk_size)
+    {
+        size_t  this_size = length - offset;
+        if (this_size > chunk_size) this_size = chunk_size;
+
+        result = push_parser_submit_data(parser, data + offset, this_size);
+        if (result != PUSH_INCOMPLETE)
+            goto done;
+    }
+
+    result = push_parser_eof(parser);
+
+  done:
+    push_parser_free(parser);
+    return result;
+}
+
+
+/*-----------------------------------------------------------------------
+ * Test cases
+ */
+
+START_TEST(test_read_01)
+{
+    data_t  actual;
+
+    PUSH_DEBUG_MSG("---\nStarting test_read_01\n");
+
+    fail_unless(parse_data(&actual, DATA_01, LENGTH_01, LENGTH_01)
+                == PUSH_SUCCESS,
+                "Could not parse data");
+
+    fail_unless(actual.payload.size == 5 &&
+                memcmp(actual.payload.buf, "hello", 5) == 0,
+                "Payload doesn't match");
+    fail_unless(actual.payload.calls == 1,
+                "Sink should be called once (got %zu)",
+                actual.payload.calls);
+    fail_unless(actual.payload.ends == 1,
+                "Sink should see one end of string (got %zu)",
+                actual.payload.ends);
+    fail_unless(actual.id == 7,
+                "Id doesn't match (got %"PRIu32", expected 7)",
+                actual.id);
+}
+END_TEST
+
+
+START_TEST(test_bytewise_read_01)
+{
+    data_t  actual;
+
+    PUSH_DEBUG_MSG("---\nStarting test_bytewise_read_01\n");
+
+    fail_unless(parse_data(&actual, DATA_01, LENGTH_01, 1)
+                == PUSH_SUCCESS,
+                "Could not parse data");
+
+    fail_unless(actual.payload.size == 5 &&
+                memcmp(actual.payload.buf, "hello", 5) == 0,
+                "Payload doesn't match");
+    fail_unless(actual.payload.calls == 5,
+                "Sink should be called once per byte (got %zu)",
+                actual.payload.calls);
+    fail_unless(actual.payload.ends == 1,
+                "Sink should see one end of string (got %zu)",
+                actual.payload.ends);
+    fail_unless(actual.id == 7,
+                "Id doesn't match (got %"PRIu32", expected 7)",
+                actual.id);
+}
+END_TEST
+
+
+START_TEST(test_read_03)
+{
+    data_t  actual;
+
+    PUSH_DEBUG_MSG("---\nStarting test_read_03\n");
+
+    /*
+     * The sink should hear about an empty payload, even though there
+     * aren't any bytes to pass to it.
+     */
+
+    fail_unless(parse_data(&actual, DATA_03, LENGTH_03, LENGTH_03)
+                == PUSH_SUCCESS,
+                "Could not parse data");
+
+    fail_unless(actual.payload.size == 0,
+                "Payload should be empty");
+    fail_unless(actual.payload.calls == 0,
+                "Sink shouldn't get any data (got %zu)",
+                actual.payload.calls);
+    fail_unless(actual.payload.ends == 1,
+                "Sink should see one end of string (got %zu)",
+                actual.payload.ends);
+    fail_unless(actual.id == 7,
+                "Id doesn't match (got %"PRIu32", expected 7)",
+                actual.id);
+}
+END_TEST
+
+
+START_TEST(test_bytewise_read_03)
+{
+    data_t  actual;
+
+    PUSH_DEBUG_MSG("---\nStarting test_bytewise_read_03\n");
+
+    fail_unless(parse_data(&actual, DATA_03, LENGTH_03, 1)
+                == PUSH_SUCCESS,
+                "Could not parse data");
+
+    fail_unless(actual.payload.calls == 0,
+                "Sink shouldn't get any data (got %zu)",
+                actual.payload.calls);
+    fail_unless(actual.payload.ends == 1,
+                "Sink should see one end of string (got %zu)",
+                actual.payload.ends);
+    fail_unless(actual.id == 7,
+                "Id doesn't match (got %"PRIu32", expected 7)",
+                actual.id);
+}
+END_TEST
+
+
+START_TEST(test_sink_error_02)
+{
+    data_t  actual;
+
+    PUSH_DEBUG_MSG("---\nStarting test_sink_error_02\n");
+
+    /*
+     * A rejected payload must fail the whole message, even when it
+     * arrives in the message's first chunk, and must not be mistaken
+     * for the end of the message.
+     */
+
+    fail_unless(parse_data(&actual, DATA_02, LENGTH_02, LENGTH_02)
+                == PUSH_PARSE_ERROR,
+                "Should get parse error from sink");
+    fail_unless(actual.id == 0,
+                "Shouldn't parse the id after the sink error");
+}
+END_TEST
+
+
+START_TEST(test_bytewise_sink_error_02)
+{
+    data_t  actual;
+
+    PUSH_DEBUG_MSG("---\nStarting test_bytewise_sink_error_02\n");
+
+    fail_unless(parse_data(&actual, DATA_02, LENGTH_02, 1)
+                == PUSH_PARSE_ERROR,
+                "Should get parse error from sink");
+    fail_unless(actual.id == 0,
+                "Shouldn't parse the id after the sink error");
+}
+END_TEST
+
+
+/*-----------------------------------------------------------------------
+ * Testing harness
+ */
+
+Suite *
+test_suite()
+{
+    Suite  *s = suite_create("protobuf-string-sink");
+
+    TCase  *tc = tcase_create("protobuf-string-sink");
+    tcase_add_test(tc, test_read_01);
+    tcase_add_test(tc, test_bytewise_read_01);
+    tcase_add_test(tc, test_read_03);
+    tcase_add_test(tc, test_bytewise_read_03);
+    tcase_add_test(tc, test_sink_error_02);
+    tcase_add_test(tc, test_bytewise_sink_error_02);
+    suite_add_tcase(s, tc);
+
+    return s;
+}
+
+
+int
+main(int argc, const char **argv)
+{
+    int  number_failed;
+    Suite  *suite = test_suite();
+    SRunner  *runner = srunner_create(suite);
+
+    srunner_run_all(runner, CK_NORMAL);
+    number_failed = srunner_ntests_failed(runner);
+    srunner_free(runner);
+
+    return (number_failed == 0)? EXIT_SUCCESS: EXIT_FAILURE;
+}
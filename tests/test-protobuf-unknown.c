@@ -0,0 +1,382 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2010, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the LICENSE.txt file in this distribution for license
+ * details.
+ * ----------------------------------------------------------------------
+ */
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+
+#include <check.h>
+
+#include <push/basics.h>
+#include <push/talloc.h>
+
+#include <push/protobuf/basics.h>
+#include <push/protobuf/encoder.h>
+#include <push/protobuf/field-map.h>
+#include <push/protobuf/message.h>
+#include <push/protobuf/unknown.h>
+
+
+/*-----------------------------------------------------------------------
+ * Our data types
+ */
+
+typedef struct _data
+{
+    uint32_t  id;
+    push_protobuf_unknown_fields_t  unknown;
+} data_t;
+
+static push_callback_t *
+create_data_message(const char *name,
+                    void *parent,
+                    push_parser_t *parser,
+                    data_t *dest)
+{
+    void  *context;
+    push_protobuf_field_map_t  *field_map;
+    push_callback_t  *callback;
+
+    context = push_talloc_new(parent);
+    if (context == NULL) return NULL;
+
+    /*
+     * Then create the callbacks.
+     */
+
+    if (name == NULL) name = "data";
+
+    field_map = push_protobuf_field_map_new(context);
+    if (field_map == NULL) goto error;
+
+    if (!push_protobuf_assign_uint32(name, "id", context, parser,
+                                     field_map, 1, &dest->id))
+        goto error;
+
+    push_protobuf_field_map_preserve_unknown(field_map, &dest->unknown);
+
+    callback = push_protobuf_message_new(name, context, parser, field_map);
+
+    if (callback == NULL) goto error;
+    return callback;
+
+  error:
+    push_talloc_free(context);
+    return NULL;
+}
+
+
+/*-----------------------------------------------------------------------
+ * Sample data
+ */
+
+const uint8_t  DATA_01[] =
+    "\x08\x2a"                  /* id = 42 */
+    "\x10\x96\x01"              /* field 2, varint = 150 */
+    "\x1a\x05" "hello"          /* field 3, length = 5 */
+    "\x25\x01\x02\x03\x04"      /* field 4, fixed32 */
+    "\x08\x07"                  /* id = 7 */
+    "\x29\x01\x02\x03\x04"      /* field 5, fixed64 */
+    "\x05\x06\x07\x08"
+    "\x33\x08\x01\x34";         /* field 6, group { 1: 1 } */
+const size_t  LENGTH_01 = 32;
+
+typedef struct _expected_field
+{
+    push_protobuf_tag_t  tag;
+    const char  *bytes;
+    size_t  size;
+} expected_field_t;
+
+const expected_field_t  EXPECTED_01[] =
+{
+    { 0x10, "\x96\x01", 2 },
+    { 0x1a, "\x05" "hello", 6 },
+    { 0x25, "\x01\x02\x03\x04", 4 },
+    { 0x29, "\x01\x02\x03\x04\x05\x06\x07\x08", 8 },
+    { 0x33, "\x08\x01\x34", 3 },
+};
+const size_t  EXPECTED_COUNT_01 = 5;
+
+
+/**
+ * The id, followed by the unknown fields in order.
+ */
+
+const uint8_t  ENCODED_01[] =
+    "\x08\x07"
+    "\x10\x96\x01"
+    "\x1a\x05" "hello"
+    "\x25\x01\x02\x03\x04"
+    "\x29\x01\x02\x03\x04"
+    "\x05\x06\x07\x08"
+    "\x33\x08\x01\x34";
+
+
+/*-----------------------------------------------------------------------
+ * Helper functions
+ */
+
+/**
+ * Parse some data into a data_t, sending it in chunks of at most
+ * chunk_size bytes, with the first chunk ending at first_chunk_size.
+ */
+
+static void
+read_data(data_t *actual, const uint8_t *data, size_t length,
+          size_t first_chunk_size, size_t chunk_size)
+{
+    push_parser_t  *parser;
+    push_callback_t  *message_callback;
+    size_t  offset;
+
+    parser = push_parser_new();
+    fail_if(parser == NULL,
+            "Could not allocate a new push parser");
+
+    message_callback = create_data_message("data", NULL,
+                                           parser, actual);
+    fail_if(message_callback == NULL,
+            "Could not allocate a new message callback");
+
+    push_parser_set_callback(parser, message_callback);
+
+    fail_unless(push_parser_activate(parser, NULL)
+                == PUSH_INCOMPLETE,
+                "Could not activate parser");
+
+    fail_unless(push_parser_submit_data
+                (parser, data, first_chunk_size) == PUSH_INCOMPLETE,
+                "Could not parse data");
+
+    for (offset = first_chunk_size;
+         offset < length;
+         offset += chunk_size)
+    {
+        size_t  size = length - offset;
+        if (size > chunk_size) size = chunk_size;
+
+        fail_unless(push_parser_submit_data
+                    (parser, &data[offset], size) == PUSH_INCOMPLETE,
+                    "Could not parse data");
+    }
+
+    fail_unless(push_parser_eof(parser) == PUSH_SUCCESS,
+                "Shouldn't get parse error at EOF");
+
+    push_parser_free(parser);
+}
+
+
+static void
+check_unknown_01(const data_t *actual,
+                 size_t first_chunk_size, size_t chunk_size)
+{
+    size_t  i;
+
+    fail_unless(actual->id == 7,
+                "ID doesn't match (split at %zu, %zu)",
+                first_chunk_size, chunk_size);
+
+    fail_unless(push_protobuf_unknown_fields_count(&actual->unknown)
+                == EXPECTED_COUNT_01,
+                "Expected %zu unknown fields, got %zu "
+                "(split at %zu, %zu)",
+                EXPECTED_COUNT_01,
+                push_protobuf_unknown_fields_count(&actual->unknown),
+                first_chunk_size, chunk_size);
+
+    for (i = 0; i < EXPECTED_COUNT_01; i++)
+    {
+        push_protobuf_tag_t  tag;
+        size_t  size;
+        const void  *buf;
+
+        buf = push_protobuf_unknown_fields_get(&actual->unknown, i,
+                                               &tag, &size);
+
+        fail_unless((tag == EXPECTED_01[i].tag) &&
+                    (size == EXPECTED_01[i].size) &&
+                    (memcmp(buf, EXPECTED_01[i].bytes, size) == 0),
+                    "Unknown field %zu doesn't match "
+                    "(split at %zu, %zu)",
+                    i, first_chunk_size, chunk_size);
+    }
+}
+
+
+static void
+read_data_01(size_t first_chunk_size, size_t chunk_size)
+{
+    data_t  actual;
+
+    actual.id = 0;
+    push_protobuf_unknown_fields_init(&actual.unknown);
+
+    read_data(&actual, DATA_01, LENGTH_01, first_chunk_size, chunk_size);
+    check_unknown_01(&actual, first_chunk_size, chunk_size);
+
+    push_protobuf_unknown_fields_done(&actual.unknown);
+}
+
+
+/*-----------------------------------------------------------------------
+ * Test cases
+ */
+
+START_TEST(test_read_01)
+{
+    PUSH_DEBUG_MSG("---\nStarting test case test_read_01\n");
+    read_data_01(LENGTH_01, LENGTH_01);
+}
+END_TEST
+
+
+START_TEST(test_two_part_read_01)
+{
+    size_t  first_chunk_size;
+
+    PUSH_DEBUG_MSG("---\nStarting test case test_two_part_read_01\n");
+
+    for (first_chunk_size = 1;
+         first_chunk_size < LENGTH_01;
+         first_chunk_size++)
+    {
+        read_data_01(first_chunk_size, LENGTH_01);
+    }
+}
+END_TEST
+
+
+START_TEST(test_bytewise_read_01)
+{
+    PUSH_DEBUG_MSG("---\nStarting test case test_bytewise_read_01\n");
+    read_data_01(1, 1);
+}
+END_TEST
+
+
+START_TEST(test_zero_copy_01)
+{
+    data_t  actual;
+    size_t  i;
+
+    PUSH_DEBUG_MSG("---\nStarting test case test_zero_copy_01\n");
+
+    actual.id = 0;
+    push_protobuf_unknown_fields_init(&actual.unknown);
+
+    read_data(&actual, DATA_01, LENGTH_01, LENGTH_01, LENGTH_01);
+
+    /*
+     * All of the data was in one chunk, so every field should point
+     * into it.
+     */
+
+    for (i = 0; i < EXPECTED_COUNT_01; i++)
+    {
+        const uint8_t  *buf;
+
+        buf = push_protobuf_unknown_fields_get(&actual.unknown, i,
+                                               NULL, NULL);
+        fail_unless((buf >= DATA_01) && (buf < DATA_01 + LENGTH_01),
+                    "Unknown field %zu should point into the data", i);
+    }
+
+    fail_unless(actual.unknown.data.current_size == 0,
+                "Nothing should be copied");
+
+    push_protobuf_unknown_fields_done(&actual.unknown);
+}
+END_TEST
+
+
+START_TEST(test_encode_01)
+{
+    data_t  actual;
+    push_protobuf_encoder_t  *encoder;
+    const struct iovec  *iov;
+    size_t  count;
+    size_t  i;
+    uint8_t  encoded[LENGTH_01];
+    size_t  pos = 0;
+
+    PUSH_DEBUG_MSG("---\nStarting test case test_encode_01\n");
+
+    actual.id = 0;
+    push_protobuf_unknown_fields_init(&actual.unknown);
+
+    read_data(&actual, DATA_01, LENGTH_01, 5, 3);
+
+    encoder = push_protobuf_encoder_new(NULL, 0, 0);
+    fail_if(encoder == NULL,
+            "Could not allocate a new encoder");
+
+    fail_unless(push_protobuf_encoder_add_varint(encoder, 1, actual.id) &&
+                push_protobuf_encoder_add_unknown_fields
+                (encoder, &actual.unknown),
+                "Could not encode fields");
+
+    fail_unless(push_protobuf_encoder_size(encoder) == LENGTH_01 - 2,
+                "Encoded %zu bytes, expected %zu",
+                push_protobuf_encoder_size(encoder), LENGTH_01 - 2);
+
+    iov = push_protobuf_encoder_iovecs(encoder, &count);
+    for (i = 0; i < count; i++)
+    {
+        memcpy(encoded + pos, iov[i].iov_base, iov[i].iov_len);
+        pos += iov[i].iov_len;
+    }
+
+    fail_unless(memcmp(encoded, ENCODED_01, LENGTH_01 - 2) == 0,
+                "Encoded bytes don't match");
+
+    push_talloc_free(encoder);
+    push_protobuf_unknown_fields_done(&actual.unknown);
+}
+END_TEST
+
+
+/*-----------------------------------------------------------------------
+ * Testing harness
+ */
+
+Suite *
+test_suite()
+{
+    Suite  *s = suite_create("protobuf-unknown");
+
+    TCase  *tc = tcase_create("protobuf-unknown");
+    tcase_add_test(tc, test_read_01);
+    tcase_add_test(tc, test_two_part_read_01);
+    tcase_add_test(tc, test_bytewise_read_01);
+    tcase_add_test(tc, test_zero_copy_01);
+    tcase_add_test(tc, test_encode_01);
+    suite_add_tcase(s, tc);
+
+    return s;
+}
+
+int
+main(int argc, const char **argv)
+{
+    int  number_failed;
+    Suite  *suite = test_suite();
+    SRunner  *runner = srunner_create(suite);
+
+    srunner_run_all(runner, CK_NORMAL);
+    number_failed = srunner_ntests_failed(runner);
+    srunner_free(runner);
+
+    return (number_failed == 0)? EXIT_SUCCESS: EXIT_FAILURE;
+}
@@ -0,0 +1,145 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2010, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the LICENSE.txt file in this distribution for license
+ * details.
+ * ----------------------------------------------------------------------
+ */
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <check.h>
+
+#include <push/protobuf/basics.h>
+#include <push/protobuf/varint.h>
+
+
+/*-----------------------------------------------------------------------
+ * Helper functions
+ */
+
+static size_t
+encode(uint64_t value, uint8_t *buf)
+{
+    size_t  length = 0;
+
+    while (value >= 0x80)
+    {
+        buf[length++] = (value & 0x7f) | 0x80;
+        value >>= 7;
+    }
+
+    buf[length++] = value;
+    return length;
+}
+
+
+/**
+ * A simple pseudo-random generator, so that the test is repeatable.
+ * Each value gets a random number of significant bits, so that we
+ * cover every varint length.
+ */
+
+static uint64_t
+next_value(uint64_t *state)
+{
+    uint64_t  bits;
+
+    *state = *state * UINT64_C(6364136223846793005) +
+        UINT64_C(1442695040888963407);
+    bits = (*state >> 58) + 1;
+    return (*state ^ (*state << 17)) >> (64 - bits);
+}
+
+
+#define NUM_VALUES  1000
+
+
+/*-----------------------------------------------------------------------
+ * Test cases
+ */
+
+
+START_TEST(test_varint_kernel_single)
+{
+    uint64_t  state = 1;
+    uint8_t  buf[PUSH_PROTOBUF_MAX_VARINT_LENGTH + 8];
+    int  i;
+
+    /*
+     * Every length of varint should decode to the original value,
+     * with the correct length, even with garbage after it.
+     */
+
+    for (i = 0; i < NUM_VALUES; i++)
+    {
+        uint64_t  expected = next_value(&state);
+        uint64_t  actual = 0;
+        size_t  length;
+
+        memset(buf, 0xff, sizeof(buf));
+        length = encode(expected, buf);
+
+        fail_unless(push_protobuf_varint_decode(buf, &actual) == length,
+                    "Wrong length for %"PRIu64, expected);
+        fail_unless(actual == expected,
+                    "Expected %"PRIu64", got %"PRIu64,
+                    expected, actual);
+    }
+}
+END_TEST
+
+
+START_TEST(test_varint_kernel_too_long)
+{
+    uint8_t  buf[PUSH_PROTOBUF_MAX_VARINT_LENGTH + 8];
+    uint64_t  value;
+
+    /*
+     * Eleven continuation bytes in a row is an error.
+     */
+
+    memset(buf, 0xff, sizeof(buf));
+    fail_unless(push_protobuf_varint_decode(buf, &value) == 0,
+                "Should reject overlong varint");
+}
+END_TEST
+
+
+/*-----------------------------------------------------------------------
+ * Testing harness
+ */
+
+Suite *
+test_suite()
+{
+    Suite  *s = suite_create("protobuf-varint-kernel");
+
+    TCase  *tc = tcase_create("protobuf-varint-kernel");
+    tcase_add_test(tc, test_varint_kernel_single);
+    tcase_add_test(tc, test_varint_kernel_too_long);
+    suite_add_tcase(s, tc);
+
+    return s;
+}
+
+
+int
+main(int argc, const char **argv)
+{
+    int  number_failed;
+    Suite  *suite = test_suite();
+    SRunner  *runner = srunner_create(suite);
+
+    srunner_run_all(runner, CK_NORMAL);
+    number_failed = srunner_ntests_failed(runner);
+    srunner_free(runner);
+
+    return (number_failed == 0)? EXIT_SUCCESS: EXIT_FAILURE;
+}
@@ -56,6 +56,17 @@ const size_t  LENGTH_06 = 10;
 /* -5,000,000,000 truncated to 32 bits */
 const uint32_t  EXPECTED_06 = -705032704;
 
+/*
+ * Ten bytes with the continuation bit set, so the terminating byte
+ * would be the eleventh, which is one more than a varint can have.
+ */
+
+const uint8_t  DATA_OVERLONG[] =
+    "\x80\x80\x80\x80\x80"
+    "\x80\x80\x80\x80\x80"
+    "\x00";
+const size_t  LENGTH_OVERLONG = 11;
+
 const uint8_t  DATA_TRASH[] = "\x00\x00\x00\x00\x00\x00";
 const size_t  LENGTH_TRASH = 6;
 
@@ -293,6 +304,61 @@ START_TEST(test_parse_error_03)
 END_TEST
 
 
+START_TEST(test_overlong)
+{
+    push_parser_t  *parser;
+    push_callback_t  *callback;
+    push_error_code_t  result;
+    size_t  chunk_size;
+    size_t  offset;
+    size_t  size;
+
+    PUSH_DEBUG_MSG("---\nStarting test case test_overlong\n");
+
+    /*
+     * Small chunks go through the slow path, which has to stop at
+     * the eleventh byte just like the fast path does.
+     */
+
+    for (chunk_size = 1; chunk_size <= LENGTH_OVERLONG; chunk_size++)
+    {
+        parser = push_parser_new();
+        fail_if(parser == NULL,
+                "Could not allocate a new push parser");
+
+        callback = push_protobuf_varint32_new("varint32", NULL, parser);
+        fail_if(callback == NULL,
+                "Could not allocate a new callback");
+
+        push_parser_set_callback(parser, callback);
+
+        fail_unless(push_parser_activate(parser, NULL)
+                    == PUSH_INCOMPLETE,
+                    "Could not activate parser");
+
+        result = PUSH_INCOMPLETE;
+
+        for (offset = 0;
+             (offset < LENGTH_OVERLONG) && (result == PUSH_INCOMPLETE);
+             offset += size)
+        {
+            size = LENGTH_OVERLONG - offset;
+            if (size > chunk_size) size = chunk_size;
+
+            result = push_parser_submit_data
+                (parser, &DATA_OVERLONG[offset], size);
+        }
+
+        fail_unless(result == PUSH_PARSE_ERROR,
+                    "Should get parse error (chunk size %zu)",
+                    chunk_size);
+
+        push_parser_free(parser);
+    }
+}
+END_TEST
+
+
 /*-----------------------------------------------------------------------
  * Testing harness
  */
@@ -320,6 +386,7 @@ test_suite()
     tcase_add_test(tc, test_trash_05);
     tcase_add_test(tc, test_trash_06);
     tcase_add_test(tc, test_parse_error_03);
+    tcase_add_test(tc, test_overlong);
     suite_add_tcase(s, tc);
 
     return s;
@@ -42,6 +42,23 @@ const uint8_t  DATA_04[] = "\x80\xe4\x97\xd0\x12";
 const size_t  LENGTH_04 = 5;
 const uint64_t  EXPECTED_04 = UINT64_C(5000000000);
 
+const uint8_t  DATA_05[] =
+    "\xff\xff\xff\xff\xff"
+    "\xff\xff\xff\xff\x01";
+const size_t  LENGTH_05 = 10;
+const uint64_t  EXPECTED_05 = UINT64_MAX;
+
+/*
+ * Ten bytes with the continuation bit set, so the terminating byte
+ * would be the eleventh, which is one more than a varint can have.
+ */
+
+const uint8_t  DATA_OVERLONG[] =
+    "\x80\x80\x80\x80\x80"
+    "\x80\x80\x80\x80\x80"
+    "\x00";
+const size_t  LENGTH_OVERLONG = 11;
+
 const uint8_t  DATA_TRASH[] = "\x00\x00\x00\x00\x00\x00";
 const size_t  LENGTH_TRASH = 6;
 
@@ -224,6 +241,7 @@ READ_TEST(01)
 READ_TEST(02)
 READ_TEST(03)
 READ_TEST(04)
+READ_TEST(05)
 
 /*
  * Only do the two-part read test for the test cases that have more
@@ -232,11 +250,13 @@ READ_TEST(04)
 
 TWO_PART_READ_TEST(03)
 TWO_PART_READ_TEST(04)
+TWO_PART_READ_TEST(05)
 
 TRASH_TEST(01)
 TRASH_TEST(02)
 TRASH_TEST(03)
 TRASH_TEST(04)
+TRASH_TEST(05)
 
 START_TEST(test_parse_error_03)
 {
@@ -273,6 +293,61 @@ START_TEST(test_parse_error_03)
 END_TEST
 
 
+START_TEST(test_overlong)
+{
+    push_parser_t  *parser;
+    push_callback_t  *callback;
+    push_error_code_t  result;
+    size_t  chunk_size;
+    size_t  offset;
+    size_t  size;
+
+    PUSH_DEBUG_MSG("---\nStarting test case test_overlong\n");
+
+    /*
+     * Small chunks go through the slow path, which has to stop at
+     * the eleventh byte just like the fast path does.
+     */
+
+    for (chunk_size = 1; chunk_size <= LENGTH_OVERLONG; chunk_size++)
+    {
+        parser = push_parser_new();
+        fail_if(parser == NULL,
+                "Could not allocate a new push parser");
+
+        callback = push_protobuf_varint64_new("varint64", NULL, parser);
+        fail_if(callback == NULL,
+                "Could not allocate a new callback");
+
+        push_parser_set_callback(parser, callback);
+
+        fail_unless(push_parser_activate(parser, NULL)
+                    == PUSH_INCOMPLETE,
+                    "Could not activate parser");
+
+        result = PUSH_INCOMPLETE;
+
+        for (offset = 0;
+             (offset < LENGTH_OVERLONG) && (result == PUSH_INCOMPLETE);
+             offset += size)
+        {
+            size = LENGTH_OVERLONG - offset;
+            if (size > chunk_size) size = chunk_size;
+
+            result = push_parser_submit_data
+                (parser, &DATA_OVERLONG[offset], size);
+        }
+
+        fail_unless(result == PUSH_PARSE_ERROR,
+                    "Should get parse error (chunk size %zu)",
+                    chunk_size);
+
+        push_parser_free(parser);
+    }
+}
+END_TEST
+
+
 /*-----------------------------------------------------------------------
  * Testing harness
  */
@@ -287,13 +362,17 @@ test_suite()
     tcase_add_test(tc, test_read_02);
     tcase_add_test(tc, test_read_03);
     tcase_add_test(tc, test_read_04);
+    tcase_add_test(tc, test_read_05);
     tcase_add_test(tc, test_two_part_read_03);
     tcase_add_test(tc, test_two_part_read_04);
+    tcase_add_test(tc, test_two_part_read_05);
     tcase_add_test(tc, test_trash_01);
     tcase_add_test(tc, test_trash_02);
     tcase_add_test(tc, test_trash_03);
     tcase_add_test(tc, test_trash_04);
+    tcase_add_test(tc, test_trash_05);
     tcase_add_test(tc, test_parse_error_03);
+    tcase_add_test(tc, test_overlong);
     suite_add_tcase(s, tc);
 
     return s;
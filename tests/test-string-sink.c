@@ -0,0 +1,420 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2010, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the LICENSE.txt file in this distribution for license
+ * details.
+ * ----------------------------------------------------------------------
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <check.h>
+
+#include <push/basics.h>
+#include <push/primitives.h>
+
+
+/*-----------------------------------------------------------------------
+ * Sample data
+ */
+
+const uint8_t  DATA_01[] = "1234567890";
+const size_t  LENGTH_01 = 10;
+
+
+/*-----------------------------------------------------------------------
+ * Sink functions
+ */
+
+/**
+ * A sink that copies each piece into a fixed buffer, and counts how
+ * many pieces it received, and how many strings it saw the end of.
+ */
+
+typedef struct _collector
+{
+    uint8_t  buf[16];
+    size_t  size;
+    size_t  calls;
+    size_t  ends;
+} collector_t;
+
+
+static bool
+collect(void *user_data, const void *buf, size_t size)
+{
+    collector_t  *collector = (collector_t *) user_data;
+
+    if (size == 0)
+    {
+        collector->ends++;
+        return true;
+    }
+
+    if (collector->size + size > sizeof(collector->buf))
+        return false;
+
+    memcpy(collector->buf + collector->size, buf, size);
+    collector->size += size;
+    collector->calls++;
+    return true;
+}
+
+
+static bool
+reject(void *user_data, const void *buf, size_t size)
+{
+    return false;
+}
+
+
+/*-----------------------------------------------------------------------
+ * Test cases
+ */
+
+
+START_TEST(test_string_sink_01)
+{
+    push_parser_t  *parser;
+    push_callback_t  *callback;
+    collector_t  collector;
+    size_t  *result;
+    size_t  bytes_to_read = 5;
+
+    PUSH_DEBUG_MSG("---\nStarting test_string_sink_01\n");
+
+    /*
+     * Stream five bytes, and provide 7 bytes in one chunk.  The sink
+     * should see a single piece.
+     */
+
+    memset(&collector, 0, sizeof(collector_t));
+
+    parser = push_parser_new();
+    fail_if(parser == NULL,
+            "Could not allocate a new push parser");
+
+    callback = push_string_sink_new("sink", NULL, parser,
+                                    collect, &collector);
+    fail_if(callback == NULL,
+            "Could not allocate a new string-sink callback");
+
+    push_parser_set_callback(parser, callback);
+
+    fail_unless(push_parser_activate(parser, &bytes_to_read)
+                == PUSH_INCOMPLETE,
+                "Could not activate parser");
+
+    fail_unless(push_parser_submit_data
+                (parser, &DATA_01, 7) == PUSH_SUCCESS,
+                "Could not parse data");
+
+    fail_unless(push_parser_eof(parser) == PUSH_SUCCESS,
+                "Shouldn't get parse error at EOF");
+
+    result = push_parser_result(parser, size_t);
+    fail_unless(*result == 5,
+                "Size doesn't match (got %zu, expected 5)",
+                *result);
+
+    fail_unless(collector.calls == 1,
+                "Expected 1 sink call, got %zu", collector.calls);
+    fail_unless(collector.ends == 1,
+                "Expected 1 end of string, got %zu", collector.ends);
+
+    fail_unless(collector.size == 5 &&
+                memcmp(collector.buf, DATA_01, 5) == 0,
+                "Data doesn't match");
+
+    push_parser_free(parser);
+}
+END_TEST
+
+
+START_TEST(test_string_sink_02)
+{
+    push_parser_t  *parser;
+    push_callback_t  *callback;
+    collector_t  collector;
+    size_t  *result;
+    size_t  bytes_to_read = LENGTH_01;
+    size_t  i;
+
+    PUSH_DEBUG_MSG("---\nStarting test_string_sink_02\n");
+
+    /*
+     * Stream ten bytes, provided one byte at a time.  The sink should
+     * see each byte as it arrives.
+     */
+
+    memset(&collector, 0, sizeof(collector_t));
+
+    parser = push_parser_new();
+    fail_if(parser == NULL,
+            "Could not allocate a new push parser");
+
+    callback = push_string_sink_new("sink", NULL, parser,
+                                    collect, &collector);
+    fail_if(callback == NULL,
+            "Could not allocate a new string-sink callback");
+
+    push_parser_set_callback(parser, callback);
+
+    fail_unless(push_parser_activate(parser, &bytes_to_read)
+                == PUSH_INCOMPLETE,
+                "Could not activate parser");
+
+    for (i = 0; i < LENGTH_01 - 1; i++)
+    {
+        fail_unless(push_parser_submit_data
+                    (parser, &DATA_01[i], 1) == PUSH_INCOMPLETE,
+                    "Could not parse data");
+    }
+
+    fail_unless(push_parser_submit_data
+                (parser, &DATA_01[i], 1) == PUSH_SUCCESS,
+                "Could not parse data");
+
+    fail_unless(push_parser_eof(parser) == PUSH_SUCCESS,
+                "Shouldn't get parse error at EOF");
+
+    result = push_parser_result(parser, size_t);
+    fail_unless(*result == LENGTH_01,
+                "Size doesn't match (got %zu, expected %zu)",
+                *result, LENGTH_01);
+
+    fail_unless(collector.calls == LENGTH_01,
+                "Expected %zu sink calls, got %zu",
+                LENGTH_01, collector.calls);
+    fail_unless(collector.ends == 1,
+                "Expected 1 end of string, got %zu", collector.ends);
+
+    fail_unless(collector.size == LENGTH_01 &&
+                memcmp(collector.buf, DATA_01, LENGTH_01) == 0,
+                "Data doesn't match");
+
+    push_parser_free(parser);
+}
+END_TEST
+
+
+START_TEST(test_string_sink_03)
+{
+    push_parser_t  *parser;
+    push_callback_t  *callback;
+    collector_t  collector;
+    size_t  bytes_to_read = 5;
+
+    PUSH_DEBUG_MSG("---\nStarting test_string_sink_03\n");
+
+    /*
+     * Stream five bytes, and provide 3 bytes.  This should fail.
+     */
+
+    memset(&collector, 0, sizeof(collector_t));
+
+    parser = push_parser_new();
+    fail_if(parser == NULL,
+            "Could not allocate a new push parser");
+
+    callback = push_string_sink_new("sink", NULL, parser,
+                                    collect, &collector);
+    fail_if(callback == NULL,
+            "Could not allocate a new string-sink callback");
+
+    push_parser_set_callback(parser, callback);
+
+    fail_unless(push_parser_activate(parser, &bytes_to_read)
+                == PUSH_INCOMPLETE,
+                "Could not activate parser");
+
+    fail_unless(push_parser_submit_data
+                (parser, &DATA_01, 3) == PUSH_INCOMPLETE,
+                "Could not parse data");
+
+    fail_unless(push_parser_eof(parser) == PUSH_PARSE_ERROR,
+                "Should get parse error at EOF");
+
+    fail_unless(collector.ends == 0,
+                "Shouldn't see the end of a truncated string");
+
+    push_parser_free(parser);
+}
+END_TEST
+
+
+START_TEST(test_string_sink_04)
+{
+    push_parser_t  *parser;
+    push_callback_t  *callback;
+    size_t  bytes_to_read = 5;
+
+    PUSH_DEBUG_MSG("---\nStarting test_string_sink_04\n");
+
+    /*
+     * A sink that rejects its data should cause a parse error.
+     */
+
+    parser = push_parser_new();
+    fail_if(parser == NULL,
+            "Could not allocate a new push parser");
+
+    callback = push_string_sink_new("sink", NULL, parser,
+                                    reject, NULL);
+    fail_if(callback == NULL,
+            "Could not allocate a new string-sink callback");
+
+    push_parser_set_callback(parser, callback);
+
+    fail_unless(push_parser_activate(parser, &bytes_to_read)
+                == PUSH_INCOMPLETE,
+                "Could not activate parser");
+
+    fail_unless(push_parser_submit_data
+                (parser, &DATA_01, 7) == PUSH_PARSE_ERROR,
+                "Should get parse error from sink");
+
+    push_parser_free(parser);
+}
+END_TEST
+
+
+START_TEST(test_string_sink_05)
+{
+    push_parser_t  *parser;
+    push_callback_t  *callback;
+    collector_t  collector;
+    size_t  *result;
+    size_t  bytes_to_read = 0;
+
+    PUSH_DEBUG_MSG("---\nStarting test_string_sink_05\n");
+
+    /*
+     * Stream an empty string.  The sink should only see the end of
+     * the string.
+     */
+
+    memset(&collector, 0, sizeof(collector_t));
+
+    parser = push_parser_new();
+    fail_if(parser == NULL,
+            "Could not allocate a new push parser");
+
+    callback = push_string_sink_new("sink", NULL, parser,
+                                    collect, &collector);
+    fail_if(callback == NULL,
+            "Could not allocate a new string-sink callback");
+
+    push_parser_set_callback(parser, callback);
+
+    fail_unless(push_parser_activate(parser, &bytes_to_read)
+                == PUSH_INCOMPLETE,
+                "Could not activate parser");
+
+    fail_unless(push_parser_submit_data
+                (parser, &DATA_01, 7) == PUSH_SUCCESS,
+                "Could not parse data");
+
+    fail_unless(push_parser_eof(parser) == PUSH_SUCCESS,
+                "Shouldn't get parse error at EOF");
+
+    result = push_parser_result(parser, size_t);
+    fail_unless(*result == 0,
+                "Size doesn't match (got %zu, expected 0)",
+                *result);
+
+    fail_unless(collector.calls == 0,
+                "Expected no sink calls, got %zu", collector.calls);
+    fail_unless(collector.ends == 1,
+                "Expected 1 end of string, got %zu", collector.ends);
+
+    push_parser_free(parser);
+}
+END_TEST
+
+
+START_TEST(test_string_sink_06)
+{
+    push_parser_t  *parser;
+    push_callback_t  *callback;
+    collector_t  collector;
+    size_t  bytes_to_read = 0;
+
+    PUSH_DEBUG_MSG("---\nStarting test_string_sink_06\n");
+
+    /*
+     * Stream an empty string right at the end of the stream.
+     */
+
+    memset(&collector, 0, sizeof(collector_t));
+
+    parser = push_parser_new();
+    fail_if(parser == NULL,
+            "Could not allocate a new push parser");
+
+    callback = push_string_sink_new("sink", NULL, parser,
+                                    collect, &collector);
+    fail_if(callback == NULL,
+            "Could not allocate a new string-sink callback");
+
+    push_parser_set_callback(parser, callback);
+
+    fail_unless(push_parser_activate(parser, &bytes_to_read)
+                == PUSH_INCOMPLETE,
+                "Could not activate parser");
+
+    fail_unless(push_parser_eof(parser) == PUSH_SUCCESS,
+                "Shouldn't get parse error at EOF");
+
+    fail_unless(collector.calls == 0,
+                "Expected no sink calls, got %zu", collector.calls);
+    fail_unless(collector.ends == 1,
+                "Expected 1 end of string, got %zu", collector.ends);
+
+    push_parser_free(parser);
+}
+END_TEST
+
+
+/*-----------------------------------------------------------------------
+ * Testing harness
+ */
+
+Suite *
+test_suite()
+{
+    Suite  *s = suite_create("string_sink");
+
+    TCase  *tc = tcase_create("string_sink");
+    tcase_add_test(tc, test_string_sink_01);
+    tcase_add_test(tc, test_string_sink_02);
+    tcase_add_test(tc, test_string_sink_03);
+    tcase_add_test(tc, test_string_sink_04);
+    tcase_add_test(tc, test_string_sink_05);
+    tcase_add_test(tc, test_string_sink_06);
+    suite_add_tcase(s, tc);
+
+    return s;
+}
+
+
+int
+main(int argc, const char **argv)
+{
+    int  number_failed;
+    Suite  *suite = test_suite();
+    SRunner  *runner = srunner_create(suite);
+
+    srunner_run_all(runner, CK_NORMAL);
+    number_failed = srunner_ntests_failed(runner);
+    srunner_free(runner);
+
+    return (number_failed == 0)? EXIT_SUCCESS: EXIT_FAILURE;
+}
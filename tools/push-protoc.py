@@ -0,0 +1,1253 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+# ----------------------------------------------------------------------
+# Copyright © 2010, RedJack, LLC.
+# All rights reserved.
+#
+# Please see the LICENSE.txt file in this distribution for license
+# details.
+# ----------------------------------------------------------------------
+
+"""
+Generates specialized libpush decoders from a .proto file.
+
+For each message in the .proto file, we generate a C struct and a
+single push callback that reads the message into an instance of that
+struct.  The callback dispatches on each field's tag with a switch
+statement, and decodes each value inline, rather than building a
+graph of per-field callbacks at runtime.  It still follows the usual
+continuation protocol, so it can be fed data in chunks of any size.
+
+Usage:
+
+    push-protoc.py [--prefix PREFIX] [--output BASE] FILE.proto
+
+This writes BASE.pb.h and BASE.pb.c.  BASE defaults to the name of
+the .proto file, without its extension.  If PREFIX is given, it's
+prepended to every C identifier that we generate.
+
+We support the proto2 subset of the language that libpush can
+decode: messages (including nested message and enum definitions),
+enums, all of the scalar field types, strings and bytes, repeated
+scalar fields (packed or not), and singular embedded messages.
+Repeated strings, repeated messages, oneofs, maps, extensions, and
+imports are reported as errors.
+"""
+
+from __future__ import print_function
+
+import optparse
+import os.path
+import re
+import sys
+
+
+class ProtoError(Exception):
+    pass
+
+
+#-----------------------------------------------------------------------
+# Field types
+
+VARINT = "PUSH_PROTOBUF_TAG_TYPE_VARINT"
+FIXED64 = "PUSH_PROTOBUF_TAG_TYPE_FIXED64"
+LENGTH_DELIMITED = "PUSH_PROTOBUF_TAG_TYPE_LENGTH_DELIMITED"
+FIXED32 = "PUSH_PROTOBUF_TAG_TYPE_FIXED32"
+
+# For each scalar type: the C type, the wire type, and an expression
+# that converts the raw uint64_t "value" into the C type.
+
+SCALAR_TYPES = {
+    "int32":    ("int32_t",  VARINT,  "(int32_t) value"),
+    "int64":    ("int64_t",  VARINT,  "(int64_t) value"),
+    "uint32":   ("uint32_t", VARINT,  "(uint32_t) value"),
+    "uint64":   ("uint64_t", VARINT,  "value"),
+    "sint32":   ("int32_t",  VARINT,
+                 "PUSH_PROTOBUF_ZIGZAG_DECODE32((uint32_t) value)"),
+    "sint64":   ("int64_t",  VARINT,
+                 "PUSH_PROTOBUF_ZIGZAG_DECODE64(value)"),
+    "bool":     ("bool",     VARINT,  "(value != 0)"),
+    "fixed32":  ("uint32_t", FIXED32, "(uint32_t) value"),
+    "sfixed32": ("int32_t",  FIXED32, "(int32_t) (uint32_t) value"),
+    "float":    ("float",    FIXED32, None),
+    "fixed64":  ("uint64_t", FIXED64, "value"),
+    "sfixed64": ("int64_t",  FIXED64, "(int64_t) value"),
+    "double":   ("double",   FIXED64, None),
+}
+
+STATE_FOR_WIRE_TYPE = {
+    VARINT: "PUSH_PROTOBUF_DECODER_VARINT",
+    FIXED32: "PUSH_PROTOBUF_DECODER_FIXED32",
+    FIXED64: "PUSH_PROTOBUF_DECODER_FIXED64",
+    LENGTH_DELIMITED: "PUSH_PROTOBUF_DECODER_LENGTH",
+}
+
+PACKED_STATE_FOR_WIRE_TYPE = {
+    VARINT: "PUSH_PROTOBUF_DECODER_PACKED_VARINT",
+    FIXED32: "PUSH_PROTOBUF_DECODER_PACKED_FIXED32",
+    FIXED64: "PUSH_PROTOBUF_DECODER_PACKED_FIXED64",
+}
+
+
+def snake_case(name):
+    name = re.sub(r"([a-z0-9])([A-Z])", r"\1_\2", name)
+    name = re.sub(r"([A-Z]+)([A-Z][a-z])", r"\1_\2", name)
+    return name.lower()
+
+
+#-----------------------------------------------------------------------
+# Parsing
+
+TOKEN_RE = re.compile(r"""
+    (?P<space>\s+)
+  | (?P<comment>//[^\n]*|/\*.*?\*/)
+  | (?P<ident>[A-Za-z_][A-Za-z0-9_.]*)
+  | (?P<number>-?(?:0[xX][0-9a-fA-F]+|[0-9]+(?:\.[0-9]*)?(?:[eE][-+]?[0-9]+)?))
+  | (?P<string>"(?:[^"\\]|\\.)*"|'(?:[^'\\]|\\.)*')
+  | (?P<symbol>[{}\[\]()<>=;,])
+""", re.VERBOSE | re.DOTALL)
+
+
+def tokenize(text, filename):
+    tokens = []
+    pos = 0
+    line = 1
+
+    while pos < len(text):
+        m = TOKEN_RE.match(text, pos)
+        if m is None:
+            raise ProtoError("%s:%d: unexpected character %r"
+                             % (filename, line, text[pos]))
+
+        kind = m.lastgroup
+        if kind not in ("space", "comment"):
+            tokens.append((kind, m.group(kind), line))
+
+        line += m.group(0).count("\n")
+        pos = m.end()
+
+    return tokens
+
+
+class Enum(object):
+    def __init__(self, name, scope):
+        self.name = name
+        self.scope = scope
+        self.values = []
+
+    def full_name(self):
+        return self.scope + [self.name]
+
+
+class Field(object):
+    def __init__(self, label, type_name, name, number, line):
+        self.label = label
+        self.type_name = type_name
+        self.name = name
+        self.number = number
+        self.line = line
+        self.resolved = None
+
+    def repeated(self):
+        return self.label == "repeated"
+
+
+class Message(object):
+    def __init__(self, name, scope):
+        self.name = name
+        self.scope = scope
+        self.fields = []
+
+    def full_name(self):
+        return self.scope + [self.name]
+
+
+class Parser(object):
+    def __init__(self, tokens, filename):
+        self.tokens = tokens
+        self.filename = filename
+        self.pos = 0
+        self.messages = []
+        self.enums = []
+
+    def error(self, message):
+        if self.pos < len(self.tokens):
+            line = self.tokens[self.pos][2]
+        elif self.tokens:
+            line = self.tokens[-1][2]
+        else:
+            line = 1
+        raise ProtoError("%s:%d: %s" % (self.filename, line, message))
+
+    def peek(self):
+        if self.pos < len(self.tokens):
+            return self.tokens[self.pos][1]
+        return None
+
+    def next(self, kind=None):
+        if self.pos >= len(self.tokens):
+            self.error("unexpected end of file")
+
+        token = self.tokens[self.pos]
+        if kind is not None and token[0] != kind:
+            self.error("expected %s, got %r" % (kind, token[1]))
+
+        self.pos += 1
+        return token[1]
+
+    def expect(self, value):
+        if self.peek() != value:
+            self.error("expected %r, got %r" % (value, self.peek()))
+        self.pos += 1
+
+    def skip_statement(self):
+        # Skip up to and including the next semicolon, ignoring any
+        # bracketed option values along the way.
+        depth = 0
+        while True:
+            value = self.next()
+            if value in ("{", "[", "("):
+                depth += 1
+            elif value in ("}", "]", ")"):
+                depth -= 1
+            elif value == ";" and depth == 0:
+                return
+
+    def parse_file(self):
+        while self.peek() is not None:
+            keyword = self.peek()
+
+            if keyword == "message":
+                self.parse_message([])
+            elif keyword == "enum":
+                self.parse_enum([])
+            elif keyword in ("syntax", "package", "option"):
+                self.skip_statement()
+            elif keyword == ";":
+                self.next()
+            elif keyword == "import":
+                self.error("imports are not supported")
+            else:
+                self.error("unexpected %r" % keyword)
+
+    def parse_enum(self, scope):
+        self.expect("enum")
+        enum = Enum(self.next("ident"), scope)
+        self.expect("{")
+
+        while self.peek() != "}":
+            if self.peek() == "option":
+                self.skip_statement()
+                continue
+            if self.peek() == ";":
+                self.next()
+                continue
+
+            name = self.next("ident")
+            self.expect("=")
+            value = int(self.next("number"), 0)
+            if self.peek() == "[":
+                while self.next() != "]":
+                    pass
+            self.expect(";")
+            enum.values.append((name, value))
+
+        self.expect("}")
+        self.enums.append(enum)
+
+    def parse_message(self, scope):
+        self.expect("message")
+        message = Message(self.next("ident"), scope)
+        inner_scope = message.full_name()
+        self.expect("{")
+
+        while self.peek() != "}":
+            keyword = self.peek()
+
+            if keyword == "message":
+                self.parse_message(inner_scope)
+            elif keyword == "enum":
+                self.parse_enum(inner_scope)
+            elif keyword in ("option", "reserved", "extensions"):
+                self.skip_statement()
+            elif keyword == ";":
+                self.next()
+            elif keyword in ("oneof", "map", "extend", "group"):
+                self.error("%s is not supported" % keyword)
+            else:
+                message.fields.append(self.parse_field())
+
+        self.expect("}")
+        self.messages.append(message)
+
+    def parse_field(self):
+        line = self.tokens[self.pos][2]
+
+        if self.peek() in ("required", "optional", "repeated"):
+            label = self.next()
+        else:
+            label = "optional"
+
+        type_name = self.next("ident")
+        if type_name == "group":
+            self.error("groups are not supported")
+
+        name = self.next("ident")
+        self.expect("=")
+        number = int(self.next("number"), 0)
+
+        if number < 1 or number > 536870911:
+            self.error("invalid field number %d" % number)
+
+        if self.peek() == "[":
+            depth = 0
+            while True:
+                value = self.next()
+                if value == "[":
+                    depth += 1
+                elif value == "]":
+                    depth -= 1
+                    if depth == 0:
+                        break
+
+        self.expect(";")
+        return Field(label, type_name, name, number, line)
+
+
+#-----------------------------------------------------------------------
+# Type resolution
+
+def resolve(messages, enums, filename):
+    by_name = {}
+
+    for definition in messages + enums:
+        by_name[".".join(definition.full_name())] = definition
+
+    for message in messages:
+        for field in message.fields:
+            if field.type_name in SCALAR_TYPES or \
+               field.type_name in ("string", "bytes"):
+                field.resolved = field.type_name
+                continue
+
+            # Look the name up from the innermost scope outwards.
+            scope = message.full_name()
+            name = field.type_name.lstrip(".")
+            found = None
+
+            while True:
+                candidate = ".".join(scope + [name])
+                if candidate in by_name:
+                    found = by_name[candidate]
+                    break
+                if not scope:
+                    break
+                scope = scope[:-1]
+
+            if found is None:
+                raise ProtoError("%s:%d: unknown type %r"
+                                 % (filename, field.line, field.type_name))
+
+            field.resolved = found
+
+            if isinstance(found, Message) and field.repeated():
+                raise ProtoError("%s:%d: repeated message fields are "
+                                 "not supported" % (filename, field.line))
+
+        for field in message.fields:
+            if field.resolved in ("string", "bytes") and field.repeated():
+                raise ProtoError("%s:%d: repeated %s fields are not "
+                                 "supported"
+                                 % (filename, field.line, field.resolved))
+
+        numbers = [field.number for field in message.fields]
+        if len(numbers) != len(set(numbers)):
+            raise ProtoError("%s: duplicate field numbers in %s"
+                             % (filename, message.name))
+
+
+def sort_messages(messages, filename):
+    # Embedded messages are stored by value, so each message's struct
+    # has to be defined after the structs of its fields.
+    result = []
+    visiting = set()
+    done = set()
+
+    def visit(message):
+        if id(message) in done:
+            return
+        if id(message) in visiting:
+            raise ProtoError("%s: message %s contains itself"
+                             % (filename, message.name))
+
+        visiting.add(id(message))
+        for field in message.fields:
+            if isinstance(field.resolved, Message):
+                visit(field.resolved)
+        visiting.remove(id(message))
+
+        done.add(id(message))
+        result.append(message)
+
+    for message in messages:
+        visit(message)
+
+    return result
+
+
+#-----------------------------------------------------------------------
+# Code generation
+
+class Generator(object):
+    def __init__(self, prefix, base, proto_name):
+        self.prefix = prefix
+        self.base = base
+        self.proto_name = proto_name
+
+    def c_name(self, definition):
+        return self.prefix + "_".join(snake_case(part)
+                                      for part in definition.full_name())
+
+    def field_c_type(self, field):
+        if isinstance(field.resolved, Message):
+            return self.c_name(field.resolved) + "_t"
+        if isinstance(field.resolved, Enum):
+            return self.c_name(field.resolved) + "_t"
+        if field.resolved in ("string", "bytes") or field.repeated():
+            return "hwm_buffer_t"
+        return SCALAR_TYPES[field.resolved][0]
+
+    def element_c_type(self, field):
+        if isinstance(field.resolved, Enum):
+            return self.c_name(field.resolved) + "_t"
+        return SCALAR_TYPES[field.resolved][0]
+
+    def wire_type(self, field):
+        if isinstance(field.resolved, Enum):
+            return VARINT
+        if isinstance(field.resolved, Message):
+            return LENGTH_DELIMITED
+        if field.resolved in ("string", "bytes"):
+            return LENGTH_DELIMITED
+        return SCALAR_TYPES[field.resolved][1]
+
+    def convert(self, field):
+        """
+        Returns a list of statements that convert the raw uint64_t
+        "value" into a variable called "v" of the field's element
+        type.
+        """
+
+        c_type = self.element_c_type(field)
+
+        if isinstance(field.resolved, Enum):
+            return ["%s  v = (%s) (int32_t) value;" % (c_type, c_type)]
+
+        if field.resolved == "float":
+            return ["uint32_t  bits = (uint32_t) value;",
+                    "float  v;",
+                    "memcpy(&v, &bits, sizeof(float));"]
+
+        if field.resolved == "double":
+            return ["double  v;",
+                    "memcpy(&v, &value, sizeof(double));"]
+
+        return ["%s  v = %s;" % (c_type, SCALAR_TYPES[field.resolved][2])]
+
+    #-------------------------------------------------------------------
+    # Header
+
+    def header(self, messages, enums):
+        guard = re.sub(r"[^A-Za-z0-9]", "_", self.base).upper() + "_PB_H"
+        out = []
+        w = out.append
+
+        w("/* -*- coding: utf-8 -*-")
+        w(" * ----------------------------------------------------------------------")
+        w(" * Generated by push-protoc from %s.  Do not edit." % self.proto_name)
+        w(" * ----------------------------------------------------------------------")
+        w(" */")
+        w("")
+        w("#ifndef %s" % guard)
+        w("#define %s" % guard)
+        w("")
+        w("#include <stdbool.h>")
+        w("#include <stdint.h>")
+        w("")
+        w("#include <hwm-buffer.h>")
+        w("")
+        w("#include <push/basics.h>")
+        w("")
+
+        for enum in enums:
+            name = self.c_name(enum)
+            w("")
+            w("typedef enum _%s" % name)
+            w("{")
+            for i, (value_name, value) in enumerate(enum.values):
+                comma = "," if i < len(enum.values) - 1 else ""
+                w("    %s_%s = %d%s" % (name.upper(), value_name.upper(),
+                                        value, comma))
+            w("} %s_t;" % name)
+            w("")
+
+        for message in messages:
+            name = self.c_name(message)
+            w("")
+            w("/*-----------------------------------------------------------------------")
+            w(" * %s" % ".".join(message.full_name()))
+            w(" */")
+            w("")
+            w("typedef struct _%s" % name)
+            w("{")
+            for field in message.fields:
+                comment = ""
+                if field.repeated():
+                    comment = "  /* array of %s */" % \
+                        self.element_c_type(field)
+                w("    %s  %s;%s" % (self.field_c_type(field),
+                                    field.name, comment))
+            if not message.fields:
+                w("    char  unused;")
+            w("} %s_t;" % name)
+            w("")
+            w("")
+            w("/**")
+            w(" * Initialize a %s instance." % name)
+            w(" */")
+            w("")
+            w("void")
+            w("%s_init(%s_t *msg);" % (name, name))
+            w("")
+            w("")
+            w("/**")
+            w(" * Free any storage used by a %s instance." % name)
+            w(" */")
+            w("")
+            w("void")
+            w("%s_done(%s_t *msg);" % (name, name))
+            w("")
+            w("")
+            w("/**")
+            w(" * Create a new callback that reads a %s message into"
+              % ".".join(message.full_name()))
+            w(" * dest.  The message extends until the end of the stream.")
+            w(" */")
+            w("")
+            w("push_callback_t *")
+            w("%s_parser_new(const char *name," % name)
+            indent = " " * len("%s_parser_new(" % name)
+            w("%svoid *parent," % indent)
+            w("%spush_parser_t *parser," % indent)
+            w("%s%s_t *dest);" % (indent, name))
+            w("")
+
+        w("")
+        w("#endif  /* %s */" % guard)
+        return "\n".join(out) + "\n"
+
+    #-------------------------------------------------------------------
+    # Source
+
+    def source(self, messages):
+        out = []
+        w = out.append
+
+        w("/* -*- coding: utf-8 -*-")
+        w(" * ----------------------------------------------------------------------")
+        w(" * Generated by push-protoc from %s.  Do not edit." % self.proto_name)
+        w(" * ----------------------------------------------------------------------")
+        w(" */")
+        w("")
+        w("#include <stdbool.h>")
+        w("#include <stdint.h>")
+        w("#include <string.h>")
+        w("")
+        w("#include <hwm-buffer.h>")
+        w("")
+        w("#include <push/basics.h>")
+        w("#include <push/talloc.h>")
+        w("")
+        w("#include <push/protobuf/basics.h>")
+        w("#include <push/protobuf/combinators.h>")
+        w("#include <push/protobuf/decoder.h>")
+        w("")
+        w("#include \"%s.pb.h\"" % os.path.basename(self.base))
+        w("")
+
+        for message in messages:
+            self.message_source(w, message)
+
+        return "\n".join(out) + "\n"
+
+    def message_source(self, w, message):
+        name = self.c_name(message)
+        submessages = [f for f in message.fields
+                       if isinstance(f.resolved, Message)]
+        buffers = [f for f in message.fields
+                   if f.repeated() or f.resolved in ("string", "bytes")]
+        varints = [f for f in message.fields
+                   if self.wire_type(f) == VARINT]
+        fixed32s = [f for f in message.fields
+                    if self.wire_type(f) == FIXED32]
+        fixed64s = [f for f in message.fields
+                    if self.wire_type(f) == FIXED64]
+        strings = [f for f in message.fields
+                   if f.resolved in ("string", "bytes")]
+        packed = [f for f in message.fields
+                  if f.repeated() and self.wire_type(f) != LENGTH_DELIMITED]
+
+        w("")
+        w("/*-----------------------------------------------------------------------")
+        w(" * %s" % ".".join(message.full_name()))
+        w(" */")
+        w("")
+
+        # init and done
+
+        w("void")
+        w("%s_init(%s_t *msg)" % (name, name))
+        w("{")
+        w("    memset(msg, 0, sizeof(%s_t));" % name)
+        for field in buffers:
+            w("    hwm_buffer_init(&msg->%s);" % field.name)
+        for field in submessages:
+            w("    %s_init(&msg->%s);" % (self.c_name(field.resolved),
+                                         field.name))
+        w("}")
+        w("")
+        w("")
+        w("void")
+        w("%s_done(%s_t *msg)" % (name, name))
+        w("{")
+        for field in buffers:
+            w("    hwm_buffer_done(&msg->%s);" % field.name)
+        for field in submessages:
+            w("    %s_done(&msg->%s);" % (self.c_name(field.resolved),
+                                         field.name))
+        if not buffers and not submessages:
+            w("    (void) msg;")
+        w("}")
+        w("")
+        w("")
+
+        # parser struct
+
+        w("typedef struct _%s_parser" % name)
+        w("{")
+        w("    /**")
+        w("     * The push_callback_t superclass for this callback.")
+        w("     */")
+        w("")
+        w("    push_callback_t  callback;")
+        w("")
+        w("    /**")
+        w("     * The continue continuation for this callback.")
+        w("     */")
+        w("")
+        w("    push_continue_continuation_t  cont;")
+        w("")
+        if submessages:
+            w("    /**")
+            w("     * The continuations that our submessage callbacks use.")
+            w("     */")
+            w("")
+            w("    push_success_continuation_t  submessage_success;")
+            w("    push_incomplete_continuation_t  submessage_incomplete;")
+            w("    push_error_continuation_t  submessage_error;")
+            w("")
+        w("    /**")
+        w("     * The decoder state.")
+        w("     */")
+        w("")
+        w("    push_protobuf_decoder_t  decoder;")
+        w("")
+        w("    /**")
+        w("     * The message that we're reading into.")
+        w("     */")
+        w("")
+        w("    %s_t  *dest;" % name)
+        for field in submessages:
+            w("")
+            w("    /**")
+            w("     * The callback that reads the %s field." % field.name)
+            w("     */")
+            w("")
+            w("    push_callback_t  *%s_callback;" % field.name)
+        w("")
+        w("} %s_parser_t;" % name)
+        w("")
+        w("")
+
+        # dispatch
+
+        w("static inline bool")
+        w("%s_dispatch(%s_parser_t *p, push_protobuf_tag_t tag)"
+          % (name, name))
+        w("{")
+        w("    push_protobuf_decoder_t  *d = &p->decoder;")
+        w("")
+        if message.fields:
+            w("    if (d->depth == 0)")
+            w("    {")
+            w("        switch (tag)")
+            w("        {")
+            for field in message.fields:
+                wire_type = self.wire_type(field)
+                if isinstance(field.resolved, Message):
+                    state = "PUSH_PROTOBUF_DECODER_SUBMESSAGE"
+                else:
+                    state = STATE_FOR_WIRE_TYPE[wire_type]
+                w("          case PUSH_PROTOBUF_MAKE_TAG(%d, %s):"
+                  % (field.number, wire_type))
+                w("            d->field = %d;" % field.number)
+                w("            d->state = %s;" % state)
+                w("            return true;")
+                w("")
+                if field in packed:
+                    w("          case PUSH_PROTOBUF_MAKE_TAG(%d, %s):"
+                      % (field.number, LENGTH_DELIMITED))
+                    w("            d->field = %d;" % field.number)
+                    w("            d->state = PUSH_PROTOBUF_DECODER_LENGTH;")
+                    w("            return true;")
+                    w("")
+            w("          default:")
+            w("            break;")
+            w("        }")
+            w("    }")
+            w("")
+        w("    return push_protobuf_decoder_skip(d, tag);")
+        w("}")
+        w("")
+        w("")
+
+        # store functions
+
+        def store_function(kind, fields):
+            w("static inline bool")
+            w("%s_store_%s(%s_t *dest," % (name, kind, name))
+            indent = " " * len("%s_store_%s(" % (name, kind))
+            w("%spush_protobuf_tag_number_t field," % indent)
+            w("%suint64_t value)" % indent)
+            w("{")
+            if fields:
+                w("    switch (field)")
+                w("    {")
+                for field in fields:
+                    w("      case %d:" % field.number)
+                    w("      {")
+                    for line in self.convert(field):
+                        w("        %s" % line)
+                    if field.repeated():
+                        w("        return hwm_buffer_append_mem"
+                          "(&dest->%s, &v, sizeof(v));" % field.name)
+                    else:
+                        w("        dest->%s = v;" % field.name)
+                        w("        return true;")
+                    w("      }")
+                    w("")
+                w("      default:")
+                w("        return true;")
+                w("    }")
+            else:
+                w("    return true;")
+            w("}")
+            w("")
+            w("")
+
+        store_function("varint", varints)
+        store_function("fixed32", fixed32s)
+        store_function("fixed64", fixed64s)
+
+        # length-delimited values
+
+        w("static inline bool")
+        w("%s_start_length(%s_parser_t *p)" % (name, name))
+        w("{")
+        w("    push_protobuf_decoder_t  *d = &p->decoder;")
+        w("")
+        w("    d->bytes_left = d->value;")
+        w("    d->state = PUSH_PROTOBUF_DECODER_BYTES;")
+        if strings or packed:
+            w("")
+            w("    switch (d->field)")
+            w("    {")
+            for field in strings:
+                w("      case %d:" % field.number)
+                w("        return hwm_buffer_clear(&p->dest->%s);"
+                  % field.name)
+                w("")
+            for field in packed:
+                w("      case %d:" % field.number)
+                w("        d->state = %s;"
+                  % PACKED_STATE_FOR_WIRE_TYPE[self.wire_type(field)])
+                w("        return true;")
+                w("")
+            w("      default:")
+            w("        return true;")
+            w("    }")
+        else:
+            w("    return true;")
+        w("}")
+        w("")
+        w("")
+
+        w("static inline bool")
+        w("%s_append_bytes(%s_t *dest," % (name, name))
+        indent = " " * len("%s_append_bytes(" % name)
+        w("%spush_protobuf_tag_number_t field," % indent)
+        w("%sconst uint8_t *buf," % indent)
+        w("%ssize_t size)" % indent)
+        w("{")
+        if strings:
+            w("    switch (field)")
+            w("    {")
+            for field in strings:
+                w("      case %d:" % field.number)
+                w("        return hwm_buffer_append_mem(&dest->%s, buf, size);"
+                  % field.name)
+                w("")
+            w("      default:")
+            w("        return true;")
+            w("    }")
+        else:
+            w("    return true;")
+        w("}")
+        w("")
+        w("")
+
+        w("static inline bool")
+        w("%s_finish_bytes(%s_t *dest," % (name, name))
+        indent = " " * len("%s_finish_bytes(" % name)
+        w("%spush_protobuf_tag_number_t field)" % indent)
+        w("{")
+        if strings:
+            w("    /*")
+            w("     * Strings and bytes are NUL-terminated, just like the")
+            w("     * hwm_buffer_t fields filled in by the runtime callbacks.")
+            w("     */")
+            w("")
+            w("    switch (field)")
+            w("    {")
+            for field in strings:
+                w("      case %d:" % field.number)
+                w("        return hwm_buffer_append_mem(&dest->%s, \"\", 1);"
+                  % field.name)
+                w("")
+            w("      default:")
+            w("        return true;")
+            w("    }")
+        else:
+            w("    return true;")
+        w("}")
+        w("")
+        w("")
+
+        # submessages
+
+        if submessages:
+            w("static push_callback_t *")
+            w("%s_submessage(%s_parser_t *p)" % (name, name))
+            w("{")
+            w("    switch (p->decoder.field)")
+            w("    {")
+            for field in submessages:
+                w("      case %d:" % field.number)
+                w("        return p->%s_callback;" % field.name)
+                w("")
+            w("      default:")
+            w("        return NULL;")
+            w("    }")
+            w("}")
+            w("")
+            w("")
+
+        # main loop
+
+        w("static void")
+        w("%s_parse(%s_parser_t *p," % (name, name))
+        indent = " " * len("%s_parse(" % name)
+        w("%sconst uint8_t *buf," % indent)
+        w("%ssize_t bytes_remaining)" % indent)
+        w("{")
+        w("    push_protobuf_decoder_t  *d = &p->decoder;")
+        w("")
+        w("    while (bytes_remaining > 0)")
+        w("    {")
+        w("        bool  done = false;")
+        w("        size_t  used = 0;")
+        w("        size_t  available;")
+        w("")
+        w("        switch (d->state)")
+        w("        {")
+        w("          case PUSH_PROTOBUF_DECODER_TAG:")
+        w("            used = push_protobuf_decoder_read_varint")
+        w("                (d, buf, bytes_remaining, &done);")
+        w("            if (used == (size_t) -1) goto too_long;")
+        w("            buf += used;")
+        w("            bytes_remaining -= used;")
+        w("            if (!done) break;")
+        w("")
+        w("            if ((d->value > UINT32_MAX) ||")
+        w("                !%s_dispatch(p, (push_protobuf_tag_t) d->value))"
+          % name)
+        w("                goto invalid_tag;")
+        if submessages:
+            w("")
+            w("            if (d->state == PUSH_PROTOBUF_DECODER_SUBMESSAGE)")
+            w("            {")
+            w("                push_continuation_call")
+            w("                    (&%s_submessage(p)->activate," % name)
+            w("                     NULL, buf, bytes_remaining);")
+            w("                return;")
+            w("            }")
+        w("            break;")
+        w("")
+        w("          case PUSH_PROTOBUF_DECODER_VARINT:")
+        w("            used = push_protobuf_decoder_read_varint")
+        w("                (d, buf, bytes_remaining, &done);")
+        w("            if (used == (size_t) -1) goto too_long;")
+        w("            buf += used;")
+        w("            bytes_remaining -= used;")
+        w("            if (!done) break;")
+        w("")
+        w("            if (!%s_store_varint(p->dest, d->field, d->value))"
+          % name)
+        w("                goto out_of_memory;")
+        w("            d->state = PUSH_PROTOBUF_DECODER_TAG;")
+        w("            break;")
+        w("")
+        for width, kind in ((4, "fixed32"), (8, "fixed64")):
+            w("          case PUSH_PROTOBUF_DECODER_%s:" % kind.upper())
+            w("            used = push_protobuf_decoder_read_fixed")
+            w("                (d, buf, bytes_remaining, %d, &done);" % width)
+            w("            buf += used;")
+            w("            bytes_remaining -= used;")
+            w("            if (!done) break;")
+            w("")
+            w("            if (!%s_store_%s(p->dest, d->field, d->value))"
+              % (name, kind))
+            w("                goto out_of_memory;")
+            w("            d->state = PUSH_PROTOBUF_DECODER_TAG;")
+            w("            break;")
+            w("")
+        w("          case PUSH_PROTOBUF_DECODER_LENGTH:")
+        w("            used = push_protobuf_decoder_read_varint")
+        w("                (d, buf, bytes_remaining, &done);")
+        w("            if (used == (size_t) -1) goto too_long;")
+        w("            buf += used;")
+        w("            bytes_remaining -= used;")
+        w("            if (!done) break;")
+        w("")
+        w("            if (!%s_start_length(p))" % name)
+        w("                goto out_of_memory;")
+        w("")
+        w("            /*")
+        w("             * An empty value is finished already.")
+        w("             */")
+        w("")
+        w("            if (d->bytes_left == 0)")
+        w("            {")
+        w("                if ((d->state == PUSH_PROTOBUF_DECODER_BYTES) &&")
+        w("                    !%s_finish_bytes(p->dest, d->field))" % name)
+        w("                    goto out_of_memory;")
+        w("                d->state = PUSH_PROTOBUF_DECODER_TAG;")
+        w("            }")
+        w("            break;")
+        w("")
+        w("          case PUSH_PROTOBUF_DECODER_BYTES:")
+        w("            used =")
+        w("                (bytes_remaining < d->bytes_left)?")
+        w("                bytes_remaining:")
+        w("                d->bytes_left;")
+        w("            if (!%s_append_bytes(p->dest, d->field, buf, used))"
+          % name)
+        w("                goto out_of_memory;")
+        w("            buf += used;")
+        w("            bytes_remaining -= used;")
+        w("            d->bytes_left -= used;")
+        w("")
+        w("            if (d->bytes_left == 0)")
+        w("            {")
+        w("                if (!%s_finish_bytes(p->dest, d->field))" % name)
+        w("                    goto out_of_memory;")
+        w("                d->state = PUSH_PROTOBUF_DECODER_TAG;")
+        w("            }")
+        w("            break;")
+        w("")
+        for kind, reader in (("varint", None), ("fixed32", 4),
+                             ("fixed64", 8)):
+            w("          case PUSH_PROTOBUF_DECODER_PACKED_%s:" % kind.upper())
+            w("            available =")
+            w("                (bytes_remaining < d->bytes_left)?")
+            w("                bytes_remaining:")
+            w("                d->bytes_left;")
+            if reader is None:
+                w("            used = push_protobuf_decoder_read_varint")
+                w("                (d, buf, available, &done);")
+                w("            if (used == (size_t) -1) goto too_long;")
+            else:
+                w("            used = push_protobuf_decoder_read_fixed")
+                w("                (d, buf, available, %d, &done);" % reader)
+            w("            buf += used;")
+            w("            bytes_remaining -= used;")
+            w("            d->bytes_left -= used;")
+            w("")
+            w("            if (done &&")
+            w("                !%s_store_%s(p->dest, d->field, d->value))"
+              % (name, kind))
+            w("                goto out_of_memory;")
+            w("")
+            w("            if (d->bytes_left == 0)")
+            w("            {")
+            w("                if (d->size != 0) goto truncated;")
+            w("                d->state = PUSH_PROTOBUF_DECODER_TAG;")
+            w("            }")
+            w("            break;")
+            w("")
+        w("          default:")
+        w("            break;")
+        w("        }")
+        w("    }")
+        w("")
+        w("    push_continuation_call(p->callback.incomplete, &p->cont);")
+        w("    return;")
+        w("")
+        w("  too_long:")
+        w("    push_continuation_call(p->callback.error,")
+        w("                           PUSH_PARSE_ERROR,")
+        w("                           \"Varint is too long\");")
+        w("    return;")
+        w("")
+        w("  invalid_tag:")
+        w("    push_continuation_call(p->callback.error,")
+        w("                           PUSH_PARSE_ERROR,")
+        w("                           \"Invalid tag\");")
+        w("    return;")
+        w("")
+        w("  truncated:")
+        w("    push_continuation_call(p->callback.error,")
+        w("                           PUSH_PARSE_ERROR,")
+        w("                           \"Truncated packed field\");")
+        w("    return;")
+        w("")
+        w("  out_of_memory:")
+        w("    push_continuation_call(p->callback.error,")
+        w("                           PUSH_MEMORY_ERROR,")
+        w("                           \"Cannot store field\");")
+        w("    return;")
+        w("}")
+        w("")
+        w("")
+
+        # continuations
+
+        w("static void")
+        w("%s_continue(void *user_data," % name)
+        indent = " " * len("%s_continue(" % name)
+        w("%sconst void *buf," % indent)
+        w("%ssize_t bytes_remaining)" % indent)
+        w("{")
+        w("    %s_parser_t  *p = (%s_parser_t *) user_data;" % (name, name))
+        w("")
+        w("    if (bytes_remaining == 0)")
+        w("    {")
+        w("        /*")
+        w("         * The message ends at EOF, which must fall between")
+        w("         * fields.")
+        w("         */")
+        w("")
+        w("        if (push_protobuf_decoder_at_field_boundary(&p->decoder))")
+        w("        {")
+        w("            push_continuation_call(p->callback.success,")
+        w("                                   p->dest,")
+        w("                                   buf, bytes_remaining);")
+        w("        } else {")
+        w("            push_continuation_call(p->callback.error,")
+        w("                                   PUSH_PARSE_ERROR,")
+        w("                                   \"Reached EOF in middle of field\");")
+        w("        }")
+        w("")
+        w("        return;")
+        w("    }")
+        w("")
+        w("    %s_parse(p, buf, bytes_remaining);" % name)
+        w("}")
+        w("")
+        w("")
+
+        if submessages:
+            w("static void")
+            w("%s_submessage_success(void *user_data," % name)
+            indent = " " * len("%s_submessage_success(" % name)
+            w("%svoid *result," % indent)
+            w("%sconst void *buf," % indent)
+            w("%ssize_t bytes_remaining)" % indent)
+            w("{")
+            w("    %s_parser_t  *p = (%s_parser_t *) user_data;"
+              % (name, name))
+            w("")
+            w("    p->decoder.state = PUSH_PROTOBUF_DECODER_TAG;")
+            w("    %s_parse(p, buf, bytes_remaining);" % name)
+            w("}")
+            w("")
+            w("")
+            w("static void")
+            w("%s_submessage_incomplete(void *user_data," % name)
+            indent = " " * len("%s_submessage_incomplete(" % name)
+            w("%spush_continue_continuation_t *cont)" % indent)
+            w("{")
+            w("    %s_parser_t  *p = (%s_parser_t *) user_data;"
+              % (name, name))
+            w("    push_continuation_call(p->callback.incomplete, cont);")
+            w("}")
+            w("")
+            w("")
+            w("static void")
+            w("%s_submessage_error(void *user_data," % name)
+            indent = " " * len("%s_submessage_error(" % name)
+            w("%spush_error_code_t error_code," % indent)
+            w("%sconst char *error_message)" % indent)
+            w("{")
+            w("    %s_parser_t  *p = (%s_parser_t *) user_data;"
+              % (name, name))
+            w("    push_continuation_call(p->callback.error,")
+            w("                           error_code, error_message);")
+            w("}")
+            w("")
+            w("")
+
+        w("static void")
+        w("%s_activate(void *user_data," % name)
+        indent = " " * len("%s_activate(" % name)
+        w("%svoid *result," % indent)
+        w("%sconst void *buf," % indent)
+        w("%ssize_t bytes_remaining)" % indent)
+        w("{")
+        w("    %s_parser_t  *p = (%s_parser_t *) user_data;" % (name, name))
+        w("")
+        w("    push_protobuf_decoder_init(&p->decoder);")
+        w("    %s_parse(p, buf, bytes_remaining);" % name)
+        w("}")
+        w("")
+        w("")
+
+        # constructor
+
+        w("push_callback_t *")
+        w("%s_parser_new(const char *name," % name)
+        indent = " " * len("%s_parser_new(" % name)
+        w("%svoid *parent," % indent)
+        w("%spush_parser_t *parser," % indent)
+        w("%s%s_t *dest)" % (indent, name))
+        w("{")
+        w("    %s_parser_t  *p = push_talloc(parent, %s_parser_t);"
+          % (name, name))
+        w("")
+        w("    if (p == NULL)")
+        w("        return NULL;")
+        w("")
+        w("    if (name == NULL) name = \"%s\";" % name)
+        w("    push_talloc_set_name_const(p, name);")
+        w("")
+        w("    p->dest = dest;")
+        w("    push_protobuf_decoder_init(&p->decoder);")
+        w("")
+        w("    push_callback_init(&p->callback, parser, p,")
+        w("                       %s_activate," % name)
+        w("                       NULL, NULL, NULL);")
+        w("")
+        w("    push_continuation_set(&p->cont,")
+        w("                          %s_continue," % name)
+        w("                          p);")
+        if submessages:
+            w("")
+            w("    push_continuation_set(&p->submessage_success,")
+            w("                          %s_submessage_success," % name)
+            w("                          p);")
+            w("    push_continuation_set(&p->submessage_incomplete,")
+            w("                          %s_submessage_incomplete," % name)
+            w("                          p);")
+            w("    push_continuation_set(&p->submessage_error,")
+            w("                          %s_submessage_error," % name)
+            w("                          p);")
+            for field in submessages:
+                sub_name = self.c_name(field.resolved)
+                w("")
+                w("    p->%s_callback = push_protobuf_varint_prefixed_new"
+                  % field.name)
+                w("        (push_talloc_asprintf(p, \"%%s.%s\", name),"
+                  % field.name)
+                w("         p, parser,")
+                w("         %s_parser_new" % sub_name)
+                w("         (push_talloc_asprintf(p, \"%%s.%s.message\", name),"
+                  % field.name)
+                w("          p, parser, &dest->%s));" % field.name)
+                w("")
+                w("    if (p->%s_callback == NULL)" % field.name)
+                w("    {")
+                w("        push_talloc_free(p);")
+                w("        return NULL;")
+                w("    }")
+                w("")
+                w("    push_continuation_call(&p->%s_callback->set_success,"
+                  % field.name)
+                w("                           &p->submessage_success);")
+                w("    push_continuation_call(&p->%s_callback->set_incomplete,"
+                  % field.name)
+                w("                           &p->submessage_incomplete);")
+                w("    push_continuation_call(&p->%s_callback->set_error,"
+                  % field.name)
+                w("                           &p->submessage_error);")
+        w("")
+        w("    return &p->callback;")
+        w("}")
+        w("")
+
+
+#-----------------------------------------------------------------------
+# Main
+
+def main(argv):
+    usage = "usage: %prog [--prefix PREFIX] [--output BASE] FILE.proto"
+    option_parser = optparse.OptionParser(usage=usage)
+    option_parser.add_option("--prefix", default="",
+                             help="prepend PREFIX to every C identifier")
+    option_parser.add_option("--output", metavar="BASE",
+                             help="write BASE.pb.h and BASE.pb.c")
+    options, args = option_parser.parse_args(argv[1:])
+
+    if len(args) != 1:
+        option_parser.error("expected exactly one .proto file")
+
+    proto_path = args[0]
+    base = options.output
+    if base is None:
+        base = os.path.splitext(os.path.basename(proto_path))[0]
+
+    try:
+        with open(proto_path) as f:
+            text = f.read()
+
+        parser = Parser(tokenize(text, proto_path), proto_path)
+        parser.parse_file()
+        resolve(parser.messages, parser.enums, proto_path)
+        messages = sort_messages(parser.messages, proto_path)
+    except ProtoError as e:
+        print("push-protoc: %s" % e, file=sys.stderr)
+        return 1
+
+    generator = Generator(options.prefix, base,
+                          os.path.basename(proto_path))
+
+    with open(base + ".pb.h", "w") as f:
+        f.write(generator.header(messages, parser.enums))
+
+    with open(base + ".pb.c", "w") as f:
+        f.write(generator.source(messages))
+
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))